@@ -3,7 +3,9 @@
  * Copyright (C) 2024-2025, Advanced Micro Devices, Inc.
  */
 
+#include <linux/file.h>
 #include <linux/timekeeping.h>
+#include <drm/drm_cache.h>
 #include <drm/drm_syncobj.h>
 
 #include "amdxdna_ctx.h"
@@ -16,6 +18,15 @@ bool force_cmdlist;
 module_param(force_cmdlist, bool, 0600);
 MODULE_PARM_DESC(force_cmdlist, "Force use command list (Default false)");
 
+static bool direct_submit = true;
+module_param(direct_submit, bool, 0600);
+MODULE_PARM_DESC(direct_submit, "Send dependency free job from ioctl, bypass scheduler (Default true)");
+
+static uint dep_submit_timeout_ms = 10000;
+module_param(dep_submit_timeout_ms, uint, 0600);
+MODULE_PARM_DESC(dep_submit_timeout_ms,
+		 "Max wait for a dependency to be submitted, 0 = reject unsubmitted dependency (Default 10000)");
+
 static void aie2_job_release(struct kref *ref)
 {
 	struct amdxdna_sched_job *job;
@@ -27,7 +38,7 @@ static void aie2_job_release(struct kref *ref)
 	if (job->out_fence)
 		dma_fence_put(job->out_fence);
 
-	kfree(job);
+	amdxdna_sched_job_free(job);
 
 	atomic64_inc(&ctx->job_free_cnt);
 	wake_up(&ctx->priv->job_free_waitq);
@@ -54,7 +65,7 @@ aie2_ctx_dump(struct amdxdna_dev *xdna, struct amdxdna_ctx *ctx)
 
 	XDNA_ERR(xdna, "Dumping ctx %s, sub=%lld, comp=%lld", ctx->name, sub, comp);
 	mutex_lock(&ctx->priv->io_lock);
-	for (int i = 0; i < CTX_MAX_CMDS; i++) {
+	for (int i = 0; i < ctx->priv->num_cmds; i++) {
 		struct amdxdna_sched_job *j;
 
 		j = ctx->priv->pending[i];
@@ -104,22 +115,34 @@ void aie2_ctx_disconnect(struct amdxdna_ctx *ctx, bool wait)
 	 * break the system. aie2_hwctx_stop() will destroy mailbox
 	 * and abort all commands.
 	 */
+	ktime_t start;
+
 	if (wait)
 		aie2_ctx_wait_for_idle(ctx);
 	mutex_lock(&xdna->dev_handle->aie2_lock);
+	/* Only the save, draining the queue is not cost of switching */
+	start = ktime_get();
 	aie2_hwctx_stop(ctx);
+	ctx->priv->last_stop_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 }
 
 int aie2_ctx_connect(struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
+	ktime_t start;
 	int ret;
 
 	if (!ctx->cus)
 		return -EINVAL;
 
+	ret = aie2_hwctx_sched_init(ctx);
+	if (ret)
+		return ret;
+
 	mutex_lock(&xdna->dev_handle->aie2_lock);
+	/* Only the restore, waiting for aie2_lock is not cost of switching */
+	start = ktime_get();
 	ret = aie2_hwctx_start(ctx);
 	if (ret)
 		goto unlock_and_err;
@@ -142,16 +165,100 @@ int aie2_ctx_connect(struct amdxdna_ctx *ctx)
 #ifdef AMDXDNA_DEVEL
 skip_config_cu:
 #endif
+	ctx->priv->cur_pdi = U32_MAX;
+	ctx->priv->last_start_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 	return 0;
 
 failed:
 	aie2_hwctx_stop(ctx);
+	mutex_unlock(&xdna->dev_handle->aie2_lock);
+	return ret;
+
 unlock_and_err:
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
+	aie2_hwctx_sched_fini(ctx);
 	return ret;
 }
 
+/*
+ * In-flight jobs of a context overlap on device. Only count the time since
+ * the later of job start and last completion, so the sum is busy time.
+ */
+static void aie2_ctx_account(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
+	ktime_t now = ktime_get();
+	ktime_t start = job->start_ts;
+
+	if (ktime_before(start, ctx->priv->last_done_ts))
+		start = ctx->priv->last_done_ts;
+	WRITE_ONCE(ctx->priv->vruntime,
+		   ctx->priv->vruntime + ktime_to_ns(ktime_sub(now, start)));
+	ctx->priv->last_done_ts = now;
+	aie2_pm_account_busy(ctx->client->xdna->dev_handle, job->start_ts, now);
+
+	if (ctx->priv->rel_deadline &&
+	    ktime_to_ns(ktime_sub(now, job->submit_ts)) > ctx->priv->rel_deadline) {
+		WRITE_ONCE(ctx->priv->deadline_miss, ctx->priv->deadline_miss + 1);
+		trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode,
+				     "deadline_miss");
+	}
+}
+
+static void aie2_job_ts_record(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
+	struct aie2_job_ts *ts = &ctx->priv->job_ts[get_job_idx(ctx->priv, job->seq)];
+	ktime_t now = ktime_get();
+
+	WRITE_ONCE(ts->seq, U64_MAX);
+	smp_wmb();
+	ts->submit = job->submit_ts;
+	ts->run = job->start_ts;
+	/* Response can beat the sent stamp taken after the send returns */
+	ts->sent = job->sent_ts && ktime_before(job->sent_ts, now) ? job->sent_ts : now;
+	ts->done = now;
+	smp_wmb();
+	WRITE_ONCE(ts->seq, job->seq);
+
+	trace_xdna_job_ts(ctx->name, job->seq, ktime_to_ns(ts->submit), ktime_to_ns(ts->run),
+			  ktime_to_ns(ts->sent), ktime_to_ns(now));
+}
+
+int aie2_ctx_job_ts(struct amdxdna_ctx *ctx, u64 seq, struct aie2_job_ts *out)
+{
+	struct aie2_job_ts *ts = &ctx->priv->job_ts[get_job_idx(ctx->priv, seq)];
+
+	if (READ_ONCE(ts->seq) != seq)
+		return -ENOENT;
+	smp_rmb();
+	*out = *ts;
+	smp_rmb();
+	if (READ_ONCE(ts->seq) != seq)
+		return -ENOENT;
+
+	return 0;
+}
+
+/* Command state is written already, publish completed count after errors */
+static void aie2_ctx_seq_page_update(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
+	struct amdxdna_ctx_seq_page *page = smp_load_acquire(&ctx->priv->seq_page);
+	bool failed;
+
+	if (!page)
+		return;
+
+	failed = job->fence->error;
+	if (job->opcode == OP_USER && job->cmd_bo &&
+	    amdxdna_cmd_get_state(job->cmd_bo) != ERT_CMD_STATE_COMPLETED)
+		failed = true;
+	if (failed) {
+		WRITE_ONCE(page->error_seq, job->seq);
+		WRITE_ONCE(page->errors, page->errors + 1);
+	}
+	smp_store_release(&page->completed, ctx->completed);
+}
+
 static void
 aie2_sched_notify(struct amdxdna_sched_job *job)
 {
@@ -159,15 +266,20 @@ aie2_sched_notify(struct amdxdna_sched_job *job)
 	struct dma_fence *fence = job->fence;
 	int idx;
 
-#ifdef AMDXDNA_DRM_USAGE
-	amdxdna_update_stats(ctx->client, ktime_get(), false);
-#endif
+	amdxdna_update_stats(ctx, ktime_get(), false);
+	aie2_ctx_account(ctx, job);
+	WRITE_ONCE(ctx->progress_ts, jiffies);
 	ctx->completed++;
-	trace_xdna_job(&job->base, ctx->name, "signaling fence", job->seq, job->opcode);
+	if (READ_ONCE(ctx->priv->boost_prio) != CTX_RQ_NUM_QUEUE &&
+	    ctx->completed >= ctx->priv->boost_until)
+		WRITE_ONCE(ctx->priv->boost_prio, CTX_RQ_NUM_QUEUE);
+	aie2_job_ts_record(ctx, job);
+	trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode, "done");
+	aie2_ctx_seq_page_update(ctx, job);
 	job->job_done = true;
 	dma_fence_signal(fence);
 	aie2_rq_yield(ctx);
-	idx = get_job_idx(job->seq);
+	idx = get_job_idx(ctx->priv, job->seq);
 	ctx->priv->pending[idx] = NULL;
 	up(&job->ctx->priv->job_sem);
 	dma_fence_put(fence);
@@ -229,20 +341,95 @@ out:
 	return ret;
 }
 
+/* Sync BO job sends one message per BO */
+static int
+aie2_sched_sync_bo_resp_handler(void *handle, void __iomem *data, size_t size)
+{
+	struct amdxdna_sched_job *job = handle;
+	u32 ret = 0;
+	u32 status;
+
+	/* Our message still holds chain_left, fence is not signaled yet */
+	if (unlikely(!data)) {
+		dma_fence_set_error(job->fence, -ECANCELED);
+		goto out;
+	}
+
+	if (unlikely(size != sizeof(u32))) {
+		dma_fence_set_error(job->fence, -EINVAL);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	status = readl(data);
+	XDNA_DBG(job->ctx->client->xdna, "Response status 0x%x", status);
+	if (status != AIE2_STATUS_SUCCESS)
+		dma_fence_set_error(job->fence, -EIO);
+
+out:
+	if (atomic_dec_and_test(&job->chain_left))
+		aie2_sched_notify(job);
+	return ret;
+}
+
+/*
+ * The first failed message of a split chain decides the command state.
+ * Success is only set once all messages responded.
+ */
+static bool aie2_chain_set_state(struct amdxdna_sched_job *job, enum ert_cmd_state s)
+{
+	if (job->chain_failed)
+		return false;
+
+	job->chain_failed = true;
+	amdxdna_cmd_set_state(job->cmd_bo, s);
+	return true;
+}
+
+/* Let user space consume sub-commands of a message before the chain is done */
+static void aie2_chain_seg_done(struct amdxdna_sched_job *job, struct aie2_chain_seg *seg)
+{
+	struct amdxdna_client *client = job->ctx->client;
+	struct amdxdna_cmd_chain *cc;
+	struct amdxdna_gem_obj *abo;
+	u32 payload_len;
+	u32 i;
+
+	cc = amdxdna_cmd_get_payload(job->cmd_bo, &payload_len);
+	if (!cc || payload_len < struct_size(cc, data, cc->command_count))
+		return;
+
+	for (i = seg->first; i < seg->first + seg->cnt && i < cc->command_count; i++) {
+		abo = amdxdna_gem_get_obj(client, (u32)cc->data[i], AMDXDNA_BO_CMD);
+		if (!abo)
+			continue;
+		amdxdna_cmd_set_state(abo, ERT_CMD_STATE_COMPLETED);
+		amdxdna_gem_put_obj(abo);
+	}
+}
+
 static int
 aie2_sched_cmdlist_resp_handler(void *handle, void __iomem *data, size_t size)
 {
 	struct amdxdna_sched_job *job = handle;
+	struct amdxdna_ctx_priv *priv = job->ctx->priv;
 	struct amdxdna_gem_obj *cmd_abo;
 	struct amdxdna_dev *xdna;
 	u32 fail_cmd_status;
 	u32 fail_cmd_idx;
 	u32 cmd_status;
+	u32 first = 0;
 	u32 ret = 0;
+	u32 seg;
 
 	cmd_abo = job->cmd_bo;
+	/* Messages of a split chain are responded in order */
+	seg = job->chain_done++;
+	if (seg)
+		first = priv->chains[get_job_idx(priv, job->seq)].segs[seg].first;
+
 	if (unlikely(!data) || unlikely(size != sizeof(u32) * 3)) {
-		amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_ABORT);
+		aie2_chain_set_state(job, ERT_CMD_STATE_ABORT);
 		ret = -EINVAL;
 		goto out;
 	}
@@ -251,7 +438,8 @@ aie2_sched_cmdlist_resp_handler(void *handle, void __iomem *data, size_t size)
 	xdna = job->ctx->client->xdna;
 	XDNA_DBG(xdna, "Status 0x%x", cmd_status);
 	if (cmd_status == AIE2_STATUS_SUCCESS) {
-		amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_COMPLETED);
+		if (job->chain_limit && !job->chain_failed)
+			aie2_chain_seg_done(job, &priv->chains[get_job_idx(priv, job->seq)].segs[seg]);
 		goto out;
 	}
 
@@ -262,44 +450,59 @@ aie2_sched_cmdlist_resp_handler(void *handle, void __iomem *data, size_t size)
 		 fail_cmd_idx, fail_cmd_status);
 
 	if (fail_cmd_status == AIE2_STATUS_SUCCESS) {
-		amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_ABORT);
+		aie2_chain_set_state(job, ERT_CMD_STATE_ABORT);
 		ret = -EINVAL;
 		goto out;
 	}
-	amdxdna_cmd_set_state(cmd_abo, fail_cmd_status);
+	if (!aie2_chain_set_state(job, fail_cmd_status))
+		goto out;
 
 	if (amdxdna_cmd_get_op(cmd_abo) == ERT_CMD_CHAIN) {
 		struct amdxdna_cmd_chain *cc = amdxdna_cmd_get_payload(cmd_abo, NULL);
 
-		cc->error_index = fail_cmd_idx;
+		cc->error_index = first + fail_cmd_idx;
 		if (cc->error_index >= cc->command_count)
 			cc->error_index = 0;
 	}
 out:
+	if (!atomic_dec_and_test(&job->chain_left))
+		return ret;
+
+	/* Later messages may still run until the last one responded */
+	if (!job->chain_failed)
+		amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_COMPLETED);
 	aie2_sched_notify(job);
 	return ret;
 }
 
-static struct dma_fence *
-aie2_sched_job_run(struct drm_sched_job *sched_job)
+/*
+ * Send job to device. On success, the job and mm references taken here are
+ * dropped by aie2_sched_notify() and a reference of job->fence is returned
+ * in the caller's hand.
+ */
+static int aie2_job_run(struct amdxdna_sched_job *job)
 {
-	struct amdxdna_sched_job *job = drm_job_to_xdna_job(sched_job);
 	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
 	struct amdxdna_ctx *ctx = job->ctx;
-	struct dma_fence *fence;
 	int ret = 0;
 
-	trace_xdna_job(sched_job, ctx->name, "job run", job->seq, job->opcode);
+	trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode, "run");
 
 	if (!mmget_not_zero(job->mm))
-		return ERR_PTR(-ESRCH);
+		return -ESRCH;
 
 	kref_get(&job->refcnt);
-	fence = dma_fence_get(job->fence);
+	dma_fence_get(job->fence);
+	job->start_ts = ktime_get();
+	/* Before the send, the response may come before it returns */
+	amdxdna_update_stats(ctx, job->start_ts, true);
 
 	switch (job->opcode) {
 	case OP_SYNC_BO:
-		ret = aie2_sync_bo(ctx, job, aie2_sched_nocmd_resp_handler);
+		ret = aie2_sync_bo(ctx, job, aie2_sched_sync_bo_resp_handler);
+		goto out;
+	case OP_COPY_BO:
+		ret = aie2_copy_bo(ctx, job, aie2_sched_nocmd_resp_handler);
 		goto out;
 	case OP_REG_DEBUG_BO:
 	case OP_UNREG_DEBUG_BO:
@@ -311,26 +514,45 @@ aie2_sched_job_run(struct drm_sched_job *sched_job)
 		goto out;
 	}
 
+	atomic_set(&job->chain_left, 1);
+	job->chain_done = 0;
+	job->chain_failed = false;
 	if (amdxdna_cmd_get_op(cmd_abo) == ERT_CMD_CHAIN)
 		ret = aie2_cmdlist_multi_execbuf(ctx, job, aie2_sched_cmdlist_resp_handler);
-	else if (force_cmdlist)
+	else if (force_cmdlist || !aie2_execbuf_fits_msg(cmd_abo))
 		ret = aie2_cmdlist_single_execbuf(ctx, job, aie2_sched_cmdlist_resp_handler);
 	else
 		ret = aie2_execbuf(ctx, job, aie2_sched_resp_handler);
+	if (!ret) {
+		job->sent_ts = ktime_get();
+		trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode,
+				     "sent");
+	}
 
 out:
 	if (ret) {
 		dma_fence_put(job->fence);
 		aie2_job_put(job);
 		mmput(job->mm);
-		fence = ERR_PTR(ret);
+		amdxdna_update_stats(ctx, ktime_get(), false);
 	}
-#ifdef AMDXDNA_DRM_USAGE
-	else
-		amdxdna_update_stats(ctx->client, ktime_get(), true);
-#endif
 
-	return fence;
+	return ret;
+}
+
+static struct dma_fence *
+aie2_sched_job_run(struct drm_sched_job *sched_job)
+{
+	struct amdxdna_sched_job *job = drm_job_to_xdna_job(sched_job);
+	int ret;
+
+	ret = aie2_job_run(job);
+	/* Direct submit waits for this, to keep order with scheduled jobs */
+	atomic_dec(&job->ctx->priv->sched_queued);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return job->fence;
 }
 
 static void aie2_sched_job_free(struct drm_sched_job *sched_job)
@@ -338,11 +560,11 @@ static void aie2_sched_job_free(struct drm_sched_job *sched_job)
 	struct amdxdna_sched_job *job = drm_job_to_xdna_job(sched_job);
 	struct amdxdna_ctx *ctx = job->ctx;
 
-	trace_xdna_job(sched_job, ctx->name, "job free", job->seq, job->opcode);
+	trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode, "free");
 	if (!job->job_done) {
 		int idx;
 
-		idx = get_job_idx(job->seq);
+		idx = get_job_idx(ctx->priv, job->seq);
 		/* No contention with submit, no lock */
 		ctx->priv->pending[idx] = NULL;
 		up(&ctx->priv->job_sem);
@@ -478,6 +700,221 @@ skip_list_cal:
 	return 0;
 }
 
+/* Upper bound of efficiency mode window */
+#define AIE2_COALESCE_MAX_US	(100 * USEC_PER_MSEC)
+
+struct aie2_gate_fence {
+	struct dma_fence	base;
+	spinlock_t		lock; /* for dma_fence */
+};
+
+static const char *aie2_gate_fence_get_driver_name(struct dma_fence *fence)
+{
+	return KBUILD_MODNAME;
+}
+
+static const char *aie2_gate_fence_get_timeline_name(struct dma_fence *fence)
+{
+	return "coalesce";
+}
+
+static const struct dma_fence_ops aie2_gate_fence_ops = {
+	.get_driver_name = aie2_gate_fence_get_driver_name,
+	.get_timeline_name = aie2_gate_fence_get_timeline_name,
+};
+
+static void aie2_ctx_coalesce_release(struct amdxdna_ctx_priv *priv)
+{
+	struct dma_fence *gate;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->coalesce_lock, flags);
+	gate = priv->coalesce_gate;
+	priv->coalesce_gate = NULL;
+	spin_unlock_irqrestore(&priv->coalesce_lock, flags);
+
+	if (gate) {
+		dma_fence_signal(gate);
+		dma_fence_put(gate);
+	}
+}
+
+static enum hrtimer_restart aie2_ctx_coalesce_timer(struct hrtimer *timer)
+{
+	struct amdxdna_ctx_priv *priv = container_of(timer, struct amdxdna_ctx_priv,
+						     coalesce_timer);
+
+	aie2_ctx_coalesce_release(priv);
+	return HRTIMER_NORESTART;
+}
+
+static void aie2_ctx_coalesce_init(struct amdxdna_ctx_priv *priv)
+{
+	spin_lock_init(&priv->coalesce_lock);
+#if KERNEL_VERSION(6, 13, 0) > LINUX_VERSION_CODE
+	hrtimer_init(&priv->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->coalesce_timer.function = aie2_ctx_coalesce_timer;
+#else
+	hrtimer_setup(&priv->coalesce_timer, aie2_ctx_coalesce_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#endif
+}
+
+static void aie2_ctx_coalesce_stop(struct amdxdna_ctx_priv *priv)
+{
+	WRITE_ONCE(priv->coalesce_us, 0);
+	hrtimer_cancel(&priv->coalesce_timer);
+	aie2_ctx_coalesce_release(priv);
+}
+
+/*
+ * In efficiency mode, a user job submitted to an idle context waits for the
+ * window to close. Jobs submitted meanwhile queue behind it in the entity,
+ * so device wakes up once for all of them. A busy context is awake anyway.
+ */
+static bool aie2_ctx_coalesce_wanted(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
+	return READ_ONCE(ctx->priv->coalesce_us) && job->opcode == OP_USER &&
+		ctx->submitted == READ_ONCE(ctx->completed);
+}
+
+static int aie2_ctx_coalesce_hold(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	u32 us = READ_ONCE(priv->coalesce_us);
+	struct aie2_gate_fence *gate;
+	unsigned long flags;
+	int ret;
+
+	if (!us)
+		return 0;
+
+	gate = kzalloc(sizeof(*gate), GFP_KERNEL);
+	if (!gate)
+		return -ENOMEM;
+
+	spin_lock_init(&gate->lock);
+	dma_fence_init(&gate->base, &aie2_gate_fence_ops, &gate->lock,
+		       dma_fence_context_alloc(1), 1);
+
+	/* Dependency is consumed even on failure */
+	ret = drm_sched_job_add_dependency(&job->base, dma_fence_get(&gate->base));
+	if (ret) {
+		dma_fence_put(&gate->base);
+		return ret;
+	}
+
+	/* Context was idle, no gate can be open. Release a stale one anyway */
+	aie2_ctx_coalesce_release(priv);
+	spin_lock_irqsave(&priv->coalesce_lock, flags);
+	priv->coalesce_gate = &gate->base;
+	spin_unlock_irqrestore(&priv->coalesce_lock, flags);
+	hrtimer_start(&priv->coalesce_timer, us_to_ktime(us), HRTIMER_MODE_REL);
+	trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, ctx->submitted, job->opcode,
+			     "coalesce");
+	return 0;
+}
+
+static int aie2_ctx_coalesce_config(struct amdxdna_ctx *ctx, u64 us)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+
+	if (us > AIE2_COALESCE_MAX_US) {
+		XDNA_ERR(xdna, "Coalescing window %lld us too long", us);
+		return -EINVAL;
+	}
+
+	if (!us) {
+		aie2_ctx_coalesce_stop(ctx->priv);
+		return 0;
+	}
+
+	WRITE_ONCE(ctx->priv->coalesce_us, us);
+	XDNA_DBG(xdna, "%s coalescing window %lld us", ctx->name, us);
+	return 0;
+}
+
+static int aie2_ctx_chain_progress_config(struct amdxdna_ctx *ctx, u64 cnt)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+
+	if (cnt > U32_MAX) {
+		XDNA_ERR(xdna, "Chain progress %lld commands too many", cnt);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(ctx->priv->chain_progress, cnt);
+	XDNA_DBG(xdna, "%s chain progress every %lld commands", ctx->name, cnt);
+	return 0;
+}
+
+/*
+ * Commands completed before the page is published are not counted until the
+ * next completion, so the page lags behind but never runs ahead.
+ */
+static int aie2_ctx_seq_page_config(struct amdxdna_ctx *ctx, u32 bo_hdl)
+{
+	struct amdxdna_client *client = ctx->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx_seq_page *page;
+	struct amdxdna_gem_obj *abo;
+	struct iosys_map map;
+	int ret;
+
+	if (READ_ONCE(ctx->priv->seq_page))
+		return -EBUSY;
+
+	abo = amdxdna_gem_get_obj(client, bo_hdl, AMDXDNA_BO_SHARE);
+	if (!abo) {
+		XDNA_ERR(xdna, "Seq page bo %d is not a share bo", bo_hdl);
+		return -EINVAL;
+	}
+
+	if (to_gobj(abo)->size < sizeof(*page)) {
+		XDNA_ERR(xdna, "Seq page bo size 0x%zx too small", to_gobj(abo)->size);
+		ret = -EINVAL;
+		goto put_obj;
+	}
+
+	ret = drm_gem_vmap_unlocked(to_gobj(abo), &map);
+	if (ret) {
+		XDNA_ERR(xdna, "Vmap seq page bo failed, ret %d", ret);
+		goto put_obj;
+	}
+
+	if (cmpxchg(&ctx->priv->seq_abo, NULL, abo)) {
+		ret = -EBUSY;
+		goto vunmap;
+	}
+
+	page = map.vaddr;
+	memset(page, 0, sizeof(*page));
+	page->completed = READ_ONCE(ctx->completed);
+	ctx->priv->seq_map = map;
+	smp_store_release(&ctx->priv->seq_page, page);
+
+	XDNA_DBG(xdna, "%s seq page bo %d", ctx->name, bo_hdl);
+	return 0;
+
+vunmap:
+	drm_gem_vunmap_unlocked(to_gobj(abo), &map);
+put_obj:
+	amdxdna_gem_put_obj(abo);
+	return ret;
+}
+
+/* No job is running anymore */
+static void aie2_ctx_seq_page_fini(struct amdxdna_ctx_priv *priv)
+{
+	if (!priv->seq_abo)
+		return;
+
+	priv->seq_page = NULL;
+	drm_gem_vunmap_unlocked(to_gobj(priv->seq_abo), &priv->seq_map);
+	amdxdna_gem_put_obj(priv->seq_abo);
+	priv->seq_abo = NULL;
+}
+
 int aie2_ctx_init(struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_client *client = ctx->client;
@@ -485,6 +922,7 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 	struct amdxdna_ctx_priv *priv;
 	struct amdxdna_gem_obj *heap;
 	struct amdxdna_dev_hdl *ndev;
+	u32 max_cmds;
 	int i, ret;
 
 	if (!ctx->num_tiles) {
@@ -522,15 +960,33 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 	drm_gem_object_get(to_gobj(heap));
 	mutex_unlock(&client->mm_lock);
 	priv->heap = heap;
-	sema_init(&priv->job_sem, CTX_MAX_CMDS);
+
+	max_cmds = ndev->priv->ctx_max_cmds ?: CTX_DEFAULT_CMDS;
+	if (ctx->max_cmds)
+		priv->num_cmds = roundup_pow_of_two(min(ctx->max_cmds, max_cmds));
+	else
+		priv->num_cmds = min_t(u32, CTX_DEFAULT_CMDS, max_cmds);
+	ctx->max_cmds = priv->num_cmds;
+	priv->cmd_buf = kcalloc(priv->num_cmds, sizeof(*priv->cmd_buf), GFP_KERNEL);
+	priv->chains = kcalloc(priv->num_cmds, sizeof(*priv->chains), GFP_KERNEL);
+	priv->pending = kcalloc(priv->num_cmds, sizeof(*priv->pending), GFP_KERNEL);
+	priv->job_ts = kcalloc(priv->num_cmds, sizeof(*priv->job_ts), GFP_KERNEL);
+	if (!priv->cmd_buf || !priv->chains || !priv->pending || !priv->job_ts) {
+		ret = -ENOMEM;
+		goto free_arrays;
+	}
+	sema_init(&priv->job_sem, priv->num_cmds);
+	for (i = 0; i < priv->num_cmds; i++)
+		priv->job_ts[i].seq = U64_MAX;
+	XDNA_DBG(xdna, "%s in-flight window %d", ctx->name, priv->num_cmds);
 
 	ret = amdxdna_gem_pin(heap);
 	if (ret) {
 		XDNA_ERR(xdna, "Dev heap pin failed, ret %d", ret);
-		goto put_heap;
+		goto free_arrays;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < priv->num_cmds; i++) {
 		struct amdxdna_gem_obj *abo;
 		struct amdxdna_drm_create_bo args = {
 			.flags = 0,
@@ -551,7 +1007,9 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 	}
 
 	mutex_init(&priv->io_lock);
+	atomic_set(&priv->sched_queued, 0);
 	init_waitqueue_head(&priv->job_free_waitq);
+	aie2_ctx_coalesce_init(priv);
 
 	fs_reclaim_acquire(GFP_KERNEL);
 	might_lock(&priv->io_lock);
@@ -578,13 +1036,17 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx)
 destroy_syncobj:
 	aie2_ctx_syncobj_destroy(ctx);
 free_cmd_bufs:
-	for (i = 0; i < ARRAY_SIZE(priv->cmd_buf); i++) {
+	for (i = 0; i < priv->num_cmds; i++) {
 		if (!priv->cmd_buf[i])
 			continue;
 		drm_gem_object_put(to_gobj(priv->cmd_buf[i]));
 	}
 	amdxdna_gem_unpin(heap);
-put_heap:
+free_arrays:
+	kfree(priv->job_ts);
+	kfree(priv->pending);
+	kfree(priv->chains);
+	kfree(priv->cmd_buf);
 	drm_gem_object_put(to_gobj(heap));
 free_col_list:
 	kfree(ctx->col_list);
@@ -598,11 +1060,28 @@ void aie2_ctx_fini(struct amdxdna_ctx *ctx)
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	int idx;
 
+	/* Held jobs have to run before scheduler goes away */
+	aie2_ctx_coalesce_stop(ctx->priv);
 	aie2_rq_del(&xdna->dev_handle->ctx_rq, ctx);
+	aie2_ctx_seq_page_fini(ctx->priv);
 
 	aie2_ctx_syncobj_destroy(ctx);
-	for (idx = 0; idx < ARRAY_SIZE(ctx->priv->cmd_buf); idx++)
+	for (idx = 0; idx < ctx->priv->num_cmds; idx++) {
+		struct aie2_cmd_chain *chain = &ctx->priv->chains[idx];
+		u32 seg;
+
+		/* segs[0] is cmd_buf[idx] */
+		for (seg = 1; seg < chain->nr_segs; seg++)
+			drm_gem_object_put(to_gobj(chain->segs[seg].bo));
+		kfree(chain->segs);
 		drm_gem_object_put(to_gobj(ctx->priv->cmd_buf[idx]));
+	}
+	kfree(ctx->priv->job_ts);
+	kfree(ctx->priv->pending);
+	kfree(ctx->priv->chains);
+	kfree(ctx->priv->cmd_buf);
+	/* CU BOs live in heap, drop them first */
+	aie2_put_cu_bos(ctx);
 	amdxdna_gem_unpin(ctx->priv->heap);
 	drm_gem_object_put(to_gobj(ctx->priv->heap));
 #ifdef AMDXDNA_DEVEL
@@ -668,14 +1147,39 @@ free_cus:
 	return ret;
 }
 
-static int aie2_ctx_attach_debug_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
+/* Ring data starts on its own cache line */
+#define AIE2_DBG_RING_DATA_OFFSET	64
+
+static int aie2_ctx_init_debug_ring(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_dbg_ring_hdr *hdr = abo->mem.kva;
+
+	if (!hdr || abo->mem.size <= AIE2_DBG_RING_DATA_OFFSET)
+		return -EINVAL;
+
+	memset(hdr, 0, AIE2_DBG_RING_DATA_OFFSET);
+	hdr->magic = AMDXDNA_DBG_RING_MAGIC;
+	hdr->data_offset = AIE2_DBG_RING_DATA_OFFSET;
+	hdr->size = abo->mem.size - AIE2_DBG_RING_DATA_OFFSET;
+	drm_clflush_virt_range(hdr, AIE2_DBG_RING_DATA_OFFSET); /* device can access */
+	return 0;
+}
+
+static int aie2_ctx_attach_debug_bo(struct amdxdna_ctx *ctx, u64 value)
 {
 	struct amdxdna_client *client = ctx->client;
 	struct amdxdna_dev *xdna = client->xdna;
+	u32 bo_hdl = lower_32_bits(value);
 	struct amdxdna_gem_obj *abo;
 	u64 seq;
 	int ret;
 
+	if (value & ~(AMDXDNA_DBG_BUF_RING | U32_MAX)) {
+		XDNA_ERR(xdna, "Invalid debug BO value 0x%llx", value);
+		ret = -EINVAL;
+		goto err_out;
+	}
+
 	abo = amdxdna_gem_get_obj(client, bo_hdl, AMDXDNA_BO_DEV);
 	if (!abo) {
 		XDNA_ERR(xdna, "Get bo %d failed", bo_hdl);
@@ -683,6 +1187,15 @@ static int aie2_ctx_attach_debug_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
 		goto err_out;
 	}
 
+	if (value & AMDXDNA_DBG_BUF_RING) {
+		ret = aie2_ctx_init_debug_ring(abo);
+		if (ret) {
+			XDNA_ERR(xdna, "Debug BO %d too small for ring, size %zu",
+				 bo_hdl, abo->mem.size);
+			goto put_obj;
+		}
+	}
+
 	ret = amdxdna_gem_set_assigned_ctx(client, bo_hdl, ctx->id);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to attach debug BO %d to %s: %d", bo_hdl, ctx->name, ret);
@@ -699,7 +1212,8 @@ static int aie2_ctx_attach_debug_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
 	ret = amdxdna_cmd_wait(client, ctx->id, seq, 3000 /* ms */);
 	if (ret)
 		goto clear_ctx;
-	XDNA_DBG(xdna, "Attached debug BO %d to %s", bo_hdl, ctx->name);
+	XDNA_DBG(xdna, "Attached debug BO %d to %s%s", bo_hdl, ctx->name,
+		 (value & AMDXDNA_DBG_BUF_RING) ? " as ring" : "");
 	amdxdna_gem_put_obj(abo);
 	return 0;
 
@@ -737,6 +1251,27 @@ static int aie2_ctx_detach_debug_bo(struct amdxdna_ctx *ctx, u32 bo_hdl)
 	return ret;
 }
 
+static int aie2_ctx_qos_config(struct amdxdna_ctx *ctx, void *buf, u32 size)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	int ret;
+
+	if (size != sizeof(struct amdxdna_qos_info)) {
+		XDNA_ERR(xdna, "Invalid QoS size %d", size);
+		return -EINVAL;
+	}
+
+	ret = aie2_rq_update_qos(&ndev->ctx_rq, ctx, buf);
+	if (ret)
+		return ret;
+
+	mutex_lock(&ndev->aie2_lock);
+	ret = aie2_hwctx_update_qos(ctx);
+	mutex_unlock(&ndev->aie2_lock);
+	return ret;
+}
+
 int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32 size)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
@@ -745,84 +1280,129 @@ int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32
 	case DRM_AMDXDNA_CTX_CONFIG_CU:
 		return aie2_ctx_cu_config(ctx, buf, size);
 	case DRM_AMDXDNA_CTX_ASSIGN_DBG_BUF:
-		return aie2_ctx_attach_debug_bo(ctx, (u32)value);
+		return aie2_ctx_attach_debug_bo(ctx, value);
 	case DRM_AMDXDNA_CTX_REMOVE_DBG_BUF:
 		return aie2_ctx_detach_debug_bo(ctx, (u32)value);
+	case DRM_AMDXDNA_CTX_CONFIG_QOS:
+		return aie2_ctx_qos_config(ctx, buf, size);
+	case DRM_AMDXDNA_CTX_CONFIG_COALESCE:
+		return aie2_ctx_coalesce_config(ctx, value);
+	case DRM_AMDXDNA_CTX_CONFIG_SEQ_PAGE:
+		return aie2_ctx_seq_page_config(ctx, (u32)value);
+	case DRM_AMDXDNA_CTX_CONFIG_CHAIN_PROGRESS:
+		return aie2_ctx_chain_progress_config(ctx, value);
 	default:
 		XDNA_DBG(xdna, "Not supported type %d", type);
 		return -EOPNOTSUPP;
 	}
 }
 
-static int aie2_populate_range(struct amdxdna_gem_obj *abo)
+/*
+ * Stands in for a timeline point which is not submitted yet, so that the
+ * submit ioctl does not have to block. A worker waits for the point to show
+ * up and then forwards its completion.
+ */
+struct aie2_dep_fence {
+	struct dma_fence	base;
+	spinlock_t		lock;
+	struct work_struct	work;
+	struct dma_fence_cb	cb;
+	struct drm_file		*filp;
+	struct dma_fence	*fence;
+	u32			hdl;
+	u64			pt;
+};
+
+static const char *aie2_dep_fence_get_driver_name(struct dma_fence *fence)
+{
+	return KBUILD_MODNAME;
+}
+
+static const char *aie2_dep_fence_get_timeline_name(struct dma_fence *fence)
 {
-	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
-	struct amdxdna_umap *mapp;
-	unsigned long timeout;
-	struct mm_struct *mm;
-	bool found;
+	return "dependency";
+}
+
+static void aie2_dep_fence_release(struct dma_fence *fence)
+{
+	struct aie2_dep_fence *dep = container_of(fence, struct aie2_dep_fence, base);
+
+	dma_fence_put(dep->fence);
+	dma_fence_free(fence);
+}
+
+static const struct dma_fence_ops aie2_dep_fence_ops = {
+	.get_driver_name = aie2_dep_fence_get_driver_name,
+	.get_timeline_name = aie2_dep_fence_get_timeline_name,
+	.release = aie2_dep_fence_release,
+};
+
+static void aie2_dep_fence_cb(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct aie2_dep_fence *dep = container_of(cb, struct aie2_dep_fence, cb);
+
+	if (fence->error)
+		dma_fence_set_error(&dep->base, fence->error);
+	dma_fence_signal(&dep->base);
+	dma_fence_put(&dep->base);
+}
+
+static void aie2_dep_fence_work(struct work_struct *work)
+{
+	struct aie2_dep_fence *dep = container_of(work, struct aie2_dep_fence, work);
+	unsigned long timeout = jiffies + msecs_to_jiffies(dep_submit_timeout_ms);
+	struct dma_fence *fence;
 	int ret;
 
-	timeout = jiffies + msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
-again:
-	found = false;
-	down_write(&xdna->notifier_lock);
-	list_for_each_entry(mapp, &abo->mem.umap_list, node) {
-		if (mapp->invalid) {
-			found = true;
-			break;
-		}
-	}
+	/* Each try waits for submission up to the DRM syncobj internal limit */
+	do {
+		ret = drm_syncobj_find_fence(dep->filp, dep->hdl, dep->pt,
+					     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, &fence);
+	} while (ret == -ETIME && time_before(jiffies, timeout));
+	fput(dep->filp->filp);
 
-	if (!found) {
-		abo->mem.map_invalid = false;
-		up_write(&xdna->notifier_lock);
-		return 0;
+	if (ret) {
+		dma_fence_set_error(&dep->base, ret);
+		dma_fence_signal(&dep->base);
+		dma_fence_put(&dep->base);
+		return;
 	}
-	kref_get(&mapp->refcnt);
-	up_write(&xdna->notifier_lock);
 
-	XDNA_DBG(xdna, "populate memory range %lx %lx",
-		 mapp->vma->vm_start, mapp->vma->vm_end);
-	mm = mapp->notifier.mm;
-	if (!mmget_not_zero(mm)) {
-		amdxdna_umap_put(mapp);
-		return -EFAULT;
-	}
+	dep->fence = fence;
+	if (dma_fence_add_callback(fence, &dep->cb, aie2_dep_fence_cb))
+		aie2_dep_fence_cb(fence, &dep->cb);
+}
 
-	mapp->range.notifier_seq = mmu_interval_read_begin(&mapp->notifier);
-	mmap_read_lock(mm);
-	ret = hmm_range_fault(&mapp->range);
-	mmap_read_unlock(mm);
-	if (ret) {
-		if (time_after(jiffies, timeout)) {
-			ret = -ETIME;
-			goto put_mm;
-		}
+static int aie2_add_deferred_dependency(struct amdxdna_sched_job *job, u32 hdl, u64 pt)
+{
+	struct amdxdna_client *client = job->ctx->client;
+	struct aie2_dep_fence *dep;
+	int ret;
 
-		if (ret == -EBUSY) {
-			amdxdna_umap_put(mapp);
-			goto again;
-		}
+	dep = kzalloc(sizeof(*dep), GFP_KERNEL);
+	if (!dep)
+		return -ENOMEM;
 
-		goto put_mm;
-	}
+	spin_lock_init(&dep->lock);
+	dma_fence_init(&dep->base, &aie2_dep_fence_ops, &dep->lock,
+		       dma_fence_context_alloc(1), 1);
+	INIT_WORK(&dep->work, aie2_dep_fence_work);
+	dep->filp = client->filp;
+	dep->hdl = hdl;
+	dep->pt = pt;
 
-	down_write(&xdna->notifier_lock);
-	if (mmu_interval_read_retry(&mapp->notifier, mapp->range.notifier_seq)) {
-		up_write(&xdna->notifier_lock);
-		amdxdna_umap_put(mapp);
-		goto again;
+	/* Dependency is consumed even on failure */
+	ret = drm_sched_job_add_dependency(&job->base, dma_fence_get(&dep->base));
+	if (ret) {
+		dma_fence_put(&dep->base);
+		return ret;
 	}
-	mapp->invalid = false;
-	up_write(&xdna->notifier_lock);
-	amdxdna_umap_put(mapp);
-	goto again;
 
-put_mm:
-	amdxdna_umap_put(mapp);
-	mmput(mm);
-	return ret;
+	/* Keep handle lookup valid until the worker is done */
+	get_file(client->filp->filp);
+	queue_work(system_unbound_wq, &dep->work);
+	XDNA_DBG(client->xdna, "Deferred dependency on syncobj %d@%lld", hdl, pt);
+	return 0;
 }
 
 static int aie2_add_job_dependency(struct amdxdna_sched_job *job, u32 *syncobj_hdls,
@@ -838,6 +1418,9 @@ static int aie2_add_job_dependency(struct amdxdna_sched_job *job, u32 *syncobj_h
 		hdl = syncobj_hdls[i];
 		pt = syncobj_points[i];
 		ret = drm_sched_job_add_syncobj_dependency(&job->base, client->filp, hdl, pt);
+		/* Point not submitted yet */
+		if (ret == -EINVAL && dep_submit_timeout_ms)
+			ret = aie2_add_deferred_dependency(job, hdl, pt);
 		if (ret) {
 			XDNA_ERR(client->xdna,
 				 "Failed to add syncobj (%d@%lld) as dependency, ret %d",
@@ -847,46 +1430,160 @@ static int aie2_add_job_dependency(struct amdxdna_sched_job *job, u32 *syncobj_h
 	return ret;
 }
 
+/*
+ * Learn how long this context usually stays idle between bursts. Runqueue
+ * derives the idle disconnect timeout from it.
+ */
+static void aie2_ctx_note_submit(struct amdxdna_ctx *ctx, ktime_t now)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	u64 gap, avg;
+
+	if (ctx->submitted == ctx->completed && priv->last_done_ts) {
+		gap = ktime_to_ns(ktime_sub(now, priv->last_done_ts));
+		avg = READ_ONCE(priv->idle_gap_avg);
+		avg = avg ? (avg * 7 + gap) / 8 : gap;
+		WRITE_ONCE(priv->idle_gap_avg, avg);
+	}
+	WRITE_ONCE(priv->last_submit_ts, now);
+}
+
+/* Caller is in client ctx_srcu read side, ctx found here stays valid */
+static struct amdxdna_ctx *
+aie2_fence_producer(struct amdxdna_client *client, struct dma_fence *fence)
+{
+	struct dma_fence_chain *chain = to_dma_fence_chain(fence);
+	struct drm_sched_fence *s_fence;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+
+	if (chain)
+		fence = chain->fence;
+
+	s_fence = to_drm_sched_fence(fence);
+	if (!s_fence || s_fence->sched->ops != &sched_ops)
+		return NULL;
+
+	amdxdna_for_each_ctx(client, ctx_id, ctx) {
+		if (ctx == s_fence->owner)
+			return ctx;
+	}
+
+	return NULL;
+}
+
+/*
+ * Lend this context's priority to contexts producing the fences it depends
+ * on. Done before submit enter, runqueue lock must not nest in io_sem.
+ */
+static void aie2_boost_producer(struct amdxdna_ctx *ctx, struct dma_fence *fence)
+{
+	struct amdxdna_client *client = ctx->client;
+	struct aie2_ctx_rq *rq = &client->xdna->dev_handle->ctx_rq;
+	struct amdxdna_ctx *producer;
+
+	producer = aie2_fence_producer(client, fence);
+	if (producer && producer != ctx && !dma_fence_is_signaled(fence))
+		aie2_rq_boost(rq, producer, ctx->priv->priority);
+}
+
+static void aie2_boost_dependencies(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+				    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt)
+{
+	struct amdxdna_client *client = ctx->client;
+	struct dma_fence *fence;
+	int i;
+
+	for (i = 0; i < syncobj_cnt; i++) {
+		if (drm_syncobj_find_fence(client->filp, syncobj_hdls[i],
+					   syncobj_points[i], 0, &fence))
+			continue;
+
+		aie2_boost_producer(ctx, fence);
+		dma_fence_put(fence);
+	}
+
+	for (i = 0; i < job->dep_cnt; i++)
+		aie2_boost_producer(ctx, job->deps[i]);
+}
+
+/*
+ * The owner's submissions fence an explicit sync BO as BOOKKEEP, which implicit
+ * sync users don't wait for but invalidation does. Other clients sharing it
+ * still fence it for write as they can't be waited for otherwise.
+ */
+static enum dma_resv_usage aie2_bo_resv_usage(struct amdxdna_ctx *ctx, struct drm_gem_object *gobj)
+{
+	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
+
+	if ((abo->flags & BO_EXPLICIT_SYNC) && abo->client == ctx->client)
+		return DMA_RESV_USAGE_BOOKKEEP;
+	return DMA_RESV_USAGE_WRITE;
+}
+
 int aie2_cmd_submit(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct ww_acquire_ctx acquire_ctx;
-	struct dma_fence_chain *chain;
 	struct amdxdna_gem_obj *abo;
 	unsigned long timeout = 0;
+	bool coalesce = false;
+	bool direct = false;
 	int ret, i;
 
+	job->submit_ts = ktime_get();
+	aie2_ctx_note_submit(ctx, job->submit_ts);
+	aie2_pm_note_submit(xdna->dev_handle, job->submit_ts);
+	aie2_boost_dependencies(ctx, job, syncobj_hdls, syncobj_points, syncobj_cnt);
+
 	ret = down_interruptible(&ctx->priv->job_sem);
 	if (ret) {
 		XDNA_ERR(xdna, "Grab job sem failed, ret %d", ret);
 		return ret;
 	}
 
+	/* Slot of the seq this job gets, no other job uses it with job_sem held */
+	ret = aie2_cmdlist_prepare_chain(ctx, job, ctx->submitted);
+	if (ret) {
+		XDNA_ERR(xdna, "Prepare command chain failed, ret %d", ret);
+		goto up_job_sem;
+	}
+
 	ret = aie2_rq_submit_enter(&xdna->dev_handle->ctx_rq, ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "Submit enter failed, ret %d", ret);
 		goto up_job_sem;
 	}
 
-	chain = dma_fence_chain_alloc();
-	if (!chain) {
-		ret = -ENOMEM;
-		goto rq_yield;
-	}
+	/*
+	 * Without dependency and nothing queued in scheduler ahead of it, a job
+	 * can be sent right here. Its out fence is the hardware fence.
+	 */
+	coalesce = aie2_ctx_coalesce_wanted(ctx, job);
+	direct = direct_submit && !coalesce && !syncobj_cnt && !job->dep_cnt &&
+		 !atomic_read(&ctx->priv->sched_queued);
+	if (direct)
+		goto lock_objects;
 
 	ret = drm_sched_job_init(&job->base, &ctx->priv->entity, 1, ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "DRM job init failed, ret %d", ret);
-		goto free_chain;
+		goto rq_yield;
 	}
 
 	ret = aie2_add_job_dependency(job, syncobj_hdls, syncobj_points, syncobj_cnt);
+	for (i = 0; !ret && i < job->dep_cnt; i++)
+		ret = drm_sched_job_add_dependency(&job->base, dma_fence_get(job->deps[i]));
+	if (!ret && coalesce)
+		ret = aie2_ctx_coalesce_hold(ctx, job);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to add dependency, ret %d", ret);
 		goto cleanup_job;
 	}
 
+lock_objects:
+
 retry:
 	ret = amdxdna_lock_objects(job, &acquire_ctx);
 	if (ret) {
@@ -917,29 +1614,88 @@ retry:
 				goto cleanup_job;
 			}
 
-			ret = aie2_populate_range(abo);
+			ret = amdxdna_gem_populate_range(abo);
 			if (ret)
 				goto cleanup_job;
 			goto retry;
 		}
 	}
 
-	mutex_lock(&ctx->priv->io_lock);
-	drm_sched_job_arm(&job->base);
-	job->out_fence = dma_fence_get(&job->base.s_fence->finished);
+	/*
+	 * Resident BOs skip locking and fencing, but still need a valid
+	 * mapping. This only reads a flag under notifier_lock.
+	 */
+	for (i = 0; job->rset && i < job->rset->bo_cnt; i++) {
+		abo = to_xdna_obj(job->rset->bos[i]);
+		if (abo->mem.map_invalid) {
+			up_read(&xdna->notifier_lock);
+			amdxdna_unlock_objects(job, &acquire_ctx);
+			if (!timeout) {
+				timeout = jiffies +
+					msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
+			} else if (time_after(jiffies, timeout)) {
+				ret = -ETIME;
+				goto cleanup_job;
+			}
+
+			ret = amdxdna_gem_populate_range(abo);
+			if (ret)
+				goto cleanup_job;
+			goto retry;
+		}
+	}
+
+	/*
+	 * Submits to a context are serialized by ctx->submit_lock, which keeps
+	 * arm, seq and push in order. Syncobj points are added in seq order
+	 * under it too, so only notifier_lock has to cover the push.
+	 */
+	lockdep_assert_held(&ctx->submit_lock);
+	if (direct) {
+		job->out_fence = dma_fence_get(job->fence);
+	} else {
+		drm_sched_job_arm(&job->base);
+		job->out_fence = dma_fence_get(&job->base.s_fence->finished);
+	}
 	for (i = 0; i < job->bo_cnt; i++)
-		dma_resv_add_fence(job->bos[i].obj->resv, job->out_fence, DMA_RESV_USAGE_WRITE);
+		dma_resv_add_fence(job->bos[i].obj->resv, job->out_fence,
+				   aie2_bo_resv_usage(ctx, job->bos[i].obj));
+	/* Hang timeout of an idle context starts with this job */
+	if (ctx->submitted == ctx->completed)
+		WRITE_ONCE(ctx->progress_ts, jiffies);
 	job->seq = ctx->submitted++;
-	ctx->priv->pending[get_job_idx(job->seq)] = job;
-	kref_get(&job->refcnt);
-	drm_sched_entity_push_job(&job->base);
-
-	*seq = job->seq;
-	drm_syncobj_add_point(ctx->priv->syncobj, chain, job->out_fence, *seq);
+	trace_xdna_job_stage(ctx->client->pid, ctx->id, ctx->name, job->seq, job->opcode, "submit");
+	/* io_lock only keeps aie2_ctx_dump() from seeing a torn pending[] */
+	mutex_lock(&ctx->priv->io_lock);
+	ctx->priv->pending[get_job_idx(ctx->priv, job->seq)] = job;
 	mutex_unlock(&ctx->priv->io_lock);
-
+	if (direct) {
+		ret = aie2_job_run(job);
+		if (ret) {
+			/* seq is taken, complete it with error like scheduler does */
+			XDNA_ERR(xdna, "Direct submit failed, ret %d", ret);
+			dma_fence_set_error(job->fence, ret);
+			job->start_ts = ktime_get();
+			mmget(job->mm);
+			kref_get(&job->refcnt);
+			/* aie2_job_run() closed its busy interval, notify closes it again */
+			amdxdna_update_stats(ctx, job->start_ts, true);
+			aie2_sched_notify(job);
+			ret = 0;
+		} else {
+			dma_fence_put(job->fence);
+		}
+	} else {
+		atomic_inc(&ctx->priv->sched_queued);
+		kref_get(&job->refcnt);
+		drm_sched_entity_push_job(&job->base);
+	}
 	up_read(&xdna->notifier_lock);
 	amdxdna_unlock_objects(job, &acquire_ctx);
+
+	*seq = job->seq;
+	drm_syncobj_add_point(ctx->priv->syncobj, job->chain, job->out_fence, *seq);
+	job->chain = NULL;
 	aie2_rq_submit_exit(ctx);
 
 	aie2_job_put(job);
@@ -947,9 +1703,8 @@ retry:
 	return 0;
 
 cleanup_job:
-	drm_sched_job_cleanup(&job->base);
-free_chain:
-	dma_fence_chain_free(chain);
+	if (!direct)
+		drm_sched_job_cleanup(&job->base);
 rq_yield:
 	aie2_rq_yield(ctx);
 	aie2_rq_submit_exit(ctx);
@@ -991,17 +1746,49 @@ int aie2_cmd_wait(struct amdxdna_ctx *ctx, u64 seq, u32 timeout)
 	if (!ret)
 		ret = -ETIME;
 	else if (ret > 0)
-		ret = 0;
+		ret = out_fence->error; /* e.g. BOs of a sync job not all synced */
 	dma_fence_put(out_fence);
 	return ret;
 }
 
+/*
+ * Map a newly grown heap chunk into every connected context of the client.
+ * Contexts connecting later map it in aie2_hwctx_start(). Firmware places
+ * host buffers of a context back to back, so chunks must be mapped in order.
+ */
+int aie2_heap_attach(struct amdxdna_client *client, struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_dev_hdl *ndev = client->xdna->dev_handle;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+	int ret = 0;
+	int idx;
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	mutex_lock(&ndev->aie2_lock);
+	amdxdna_for_each_ctx(client, ctx_id, ctx) {
+		if (!ctx->priv || !ctx->priv->mbox_chann)
+			continue;
+
+		ret = aie2_hwctx_map_heap(ctx, heap);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		WRITE_ONCE(heap->heap_mapped, true);
+	mutex_unlock(&ndev->aie2_lock);
+	srcu_read_unlock(&client->ctx_srcu, idx);
+
+	return ret;
+}
+
 void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo, unsigned long cur_seq)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
 	struct drm_gem_object *gobj = to_gobj(abo);
 	long ret;
 
+	/* BOOKKEEP covers jobs of the owner on explicit sync BOs as well */
 	ret = dma_resv_wait_timeout(gobj->resv, DMA_RESV_USAGE_BOOKKEEP,
 				    true, MAX_SCHEDULE_TIMEOUT);
 	if (!ret || ret == -ERESTARTSYS)
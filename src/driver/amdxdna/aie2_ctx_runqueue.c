@@ -17,7 +17,18 @@ uint hwctx_limit;
 module_param(hwctx_limit, uint, 0444);
 MODULE_PARM_DESC(hwctx_limit, "[Debug] Maximum number of hwctx. 0 = Use default");
 
-#define RQ_CTX_IDLE_COUNT 3
+static bool spatial_share = true;
+module_param(spatial_share, bool, 0644);
+MODULE_PARM_DESC(spatial_share,
+		 "Run contexts narrower than partition on their own columns (Default true)");
+
+/*
+ * Idle timeout is twice the usual idle gap of a context, so a periodic
+ * workload keeps its hwctx across the gap. Without history, use default.
+ */
+#define RQ_CTX_IDLE_DEFAULT_NS	(4ULL * NSEC_PER_SEC)
+#define RQ_CTX_IDLE_MIN_NS	(500ULL * NSEC_PER_MSEC)
+#define RQ_CTX_IDLE_MAX_NS	(30ULL * NSEC_PER_SEC)
 
 #if AMDXDNA_NUM_PRIORITY != CTX_RQ_NUM_QUEUE
 #error "AMDXDNA_NUM_PRIORITY not equals to CTX_RQ_NUM_QUEUE"
@@ -46,6 +57,30 @@ static void qos_to_rq_prio(struct amdxdna_ctx *ctx)
 	};
 }
 
+/*
+ * Relative deadline is the tighter of QoS latency and frame period, both in
+ * ms. Frame execution time is taken off, so deadline is the latest time a
+ * waiting context can connect and still finish the frame.
+ */
+static void qos_to_rq_deadline(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_qos_info *qos = &ctx->qos;
+	u32 ms = qos->latency;
+
+	if (qos->fps && (!ms || 1000 / qos->fps < ms))
+		ms = 1000 / qos->fps;
+
+	ctx->priv->rel_deadline = (u64)ms * NSEC_PER_MSEC;
+	ctx->priv->exec_budget = 0;
+	if (qos->frame_exec_time < ms)
+		ctx->priv->exec_budget = (u64)qos->frame_exec_time * NSEC_PER_MSEC;
+}
+
+static inline int ctx_eff_prio(struct amdxdna_ctx *ctx)
+{
+	return min(ctx->priv->priority, READ_ONCE(ctx->priv->boost_prio));
+}
+
 static inline bool ctx_is_rt(struct amdxdna_ctx *ctx)
 {
 	return ctx->priv->priority == CTX_RQ_REALTIME;
@@ -84,6 +119,11 @@ static inline bool ctx_is_disconnecting(struct amdxdna_ctx *ctx)
 	return ctx->priv->status == CTX_STATE_DISCONNECTING;
 }
 
+static inline bool ctx_is_connecting(struct amdxdna_ctx *ctx)
+{
+	return ctx->priv->status == CTX_STATE_CONNECTING;
+}
+
 static inline bool ctx_should_stop(struct amdxdna_ctx *ctx)
 {
 	return ctx_is_connected(ctx) ||
@@ -111,31 +151,155 @@ part_num_col(struct aie2_partition *part)
 	return part->end_col - part->start_col + 1;
 }
 
+static inline u32
+part_col_mask(struct aie2_partition *part)
+{
+	return GENMASK(part->end_col, part->start_col);
+}
+
+static inline u64 ctx_vruntime(struct amdxdna_ctx *ctx)
+{
+	return READ_ONCE(ctx->priv->vruntime);
+}
+
+static inline bool ctx_has_deadline(struct amdxdna_ctx *ctx)
+{
+	return ctx->priv->rel_deadline;
+}
+
+/*
+ * Order within a priority queue. Contexts with deadline go first, earliest
+ * deadline first. The others follow in vruntime order.
+ */
+static bool ctx_runs_before(struct amdxdna_ctx *a, struct amdxdna_ctx *b)
+{
+	if (ctx_has_deadline(a) && ctx_has_deadline(b))
+		return ktime_before(a->priv->deadline, b->priv->deadline);
+
+	if (ctx_has_deadline(a) != ctx_has_deadline(b))
+		return ctx_has_deadline(a);
+
+	return ctx_vruntime(a) < ctx_vruntime(b);
+}
+
+static void rq_ctx_set_deadline(struct amdxdna_ctx *ctx)
+{
+	if (!ctx_has_deadline(ctx))
+		return;
+
+	ctx->priv->deadline = ktime_add_ns(ktime_get(), ctx->priv->rel_deadline -
+					   ctx->priv->exec_budget);
+}
+
+/*
+ * A context's vruntime is raised to the priority floor, so a new or long
+ * idle context can not starve the others with its small value.
+ */
+static void
+part_runqueue_insert(struct aie2_partition *part, struct amdxdna_ctx *new)
+{
+	int prio_q = new->priv->priority;
+	struct list_head *q = &part->runqueue[prio_q];
+	struct amdxdna_ctx *curr;
+
+	if (ctx_vruntime(new) < part->rq->min_vruntime[prio_q])
+		WRITE_ONCE(new->priv->vruntime, part->rq->min_vruntime[prio_q]);
+
+	list_for_each_entry(curr, q, entry) {
+		if (!ctx_runs_before(new, curr))
+			continue;
+
+		list_move_tail(&new->entry, &curr->entry);
+		return;
+	}
+	list_move_tail(&new->entry, q);
+}
+
+/* Charge the time since last move to current state, call before status changes */
+static u64 rq_ctx_stats_account(struct amdxdna_ctx *ctx)
+{
+	struct aie2_rq_stats *st = &ctx->priv->rq_stats;
+	ktime_t now = ktime_get();
+	u64 delta;
+
+	delta = ktime_to_ns(ktime_sub(now, st->state_ts));
+	switch (ctx->priv->status) {
+	case CTX_STATE_DISCONNECTED:
+		WRITE_ONCE(st->disconn_ns, st->disconn_ns + delta);
+		break;
+	case CTX_STATE_DISPATCHED:
+	case CTX_STATE_CONNECTING:
+		WRITE_ONCE(st->wait_ns, st->wait_ns + delta);
+		break;
+	case CTX_STATE_CONNECTED:
+	case CTX_STATE_DISCONNECTING:
+		WRITE_ONCE(st->conn_ns, st->conn_ns + delta);
+		break;
+	default:
+		break;
+	}
+	WRITE_ONCE(st->state_ts, now);
+	return delta;
+}
+
+static void rq_ctx_stats_wait(struct amdxdna_ctx *ctx, u64 wait_ns)
+{
+	struct aie2_rq_stats *st = &ctx->priv->rq_stats;
+	u64 us = wait_ns / NSEC_PER_USEC;
+	int i;
+
+	i = us ? min_t(int, ilog2(us) + 1, AMDXDNA_RQ_WAIT_BUCKETS - 1) : 0;
+	WRITE_ONCE(st->wait_hist[i], st->wait_hist[i] + 1);
+}
+
 static void
 part_ctx_dispatch(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 {
 	int prio_q = ctx->priv->priority;
 
-	list_move_tail(&ctx->entry, &part->runqueue[prio_q]);
+	part_runqueue_insert(part, ctx);
 	part->ctx_cnt++;
 	if (ctx_is_rt(ctx))
 		part->rt_ctx_cnt++;
 
+	rq_ctx_stats_account(ctx);
 	ctx->priv->status = CTX_STATE_DISPATCHED;
 	ctx->priv->part = part;
 	XDNA_DBG(ctx->client->xdna, "%s dispatched, priority queue %d", ctx->name, prio_q);
 }
 
+static u64 ctx_idle_timeout(struct amdxdna_ctx *ctx)
+{
+	u64 avg = READ_ONCE(ctx->priv->idle_gap_avg);
+
+	if (!avg)
+		return RQ_CTX_IDLE_DEFAULT_NS;
+
+	return clamp(avg * 2, RQ_CTX_IDLE_MIN_NS, RQ_CTX_IDLE_MAX_NS);
+}
+
+static u64 ctx_idle_time(struct amdxdna_ctx *ctx, ktime_t now)
+{
+	ktime_t last = READ_ONCE(ctx->priv->last_submit_ts);
+
+	if (ktime_after(ctx->priv->last_done_ts, last))
+		last = ctx->priv->last_done_ts;
+
+	return ktime_to_ns(ktime_sub(now, last));
+}
+
 static bool part_handle_idle_ctx(struct aie2_partition *part, bool force)
 {
 	struct amdxdna_dev *xdna;
 	struct amdxdna_ctx *ctx;
 	bool found = false;
+	ktime_t now;
 
 	xdna = ctx_rq_to_xdna_dev(part->rq);
 	if (!part->hwctx_cnt)
 		return false;
 
+	now = ktime_get();
 	list_for_each_entry(ctx, &part->conn_list, entry) {
 		u64 completed = ctx->completed;
 		u64 submitted;
@@ -147,10 +311,10 @@ static bool part_handle_idle_ctx(struct aie2_partition *part, bool force)
 		else
 			ctx->priv->idle_cnt = 0;
 
-		if (ctx->priv->idle_cnt == RQ_CTX_IDLE_COUNT ||
-		    (ctx->priv->idle_cnt && force)) {
-			XDNA_DBG(xdna, "%s idle, cnt %d try swap out",
-				 ctx->name, ctx->priv->idle_cnt);
+		if (ctx->priv->idle_cnt &&
+		    (force || ctx_idle_time(ctx, now) >= ctx_idle_timeout(ctx))) {
+			XDNA_DBG(xdna, "%s idle %llu ms, cnt %d try swap out", ctx->name,
+				 ctx_idle_time(ctx, now) / NSEC_PER_MSEC, ctx->priv->idle_cnt);
 			ctx->priv->force_yield = true;
 			ctx->priv->status = CTX_STATE_DISCONNECTING;
 			queue_work(part->rq->work_q, &ctx->yield_work);
@@ -165,6 +329,7 @@ static bool part_handle_idle_ctx(struct aie2_partition *part, bool force)
 static bool
 part_is_all_ctx_stuck(struct aie2_partition *part)
 {
+	unsigned long now = jiffies;
 	struct amdxdna_dev *xdna;
 	struct amdxdna_ctx *ctx;
 	int progress_cnt = 0;
@@ -172,21 +337,21 @@ part_is_all_ctx_stuck(struct aie2_partition *part)
 
 	xdna = ctx_rq_to_xdna_dev(part->rq);
 	list_for_each_entry(ctx, &part->conn_list, entry) {
+		unsigned long last = READ_ONCE(ctx->progress_ts);
+		u32 timeout = amdxdna_ctx_timeout_ms(ctx);
 		u64 completed = ctx->completed;
-		u64 last = ctx->last_completed;
 		u64 submitted = ctx->submitted;
 
-		XDNA_DBG(xdna, "%s @[%d, %d] submitted %lld completed %lld last %lld",
+		XDNA_DBG(xdna, "%s @[%d, %d] submitted %lld completed %lld idle %u ms",
 			 ctx->name, part->start_col, part->end_col,
-			 submitted, completed, last);
+			 submitted, completed, jiffies_to_msecs(now - last));
+		amdxdna_tdr_note_timeout(&xdna->tdr, timeout);
 		if (submitted == completed)
 			continue;
 
 		running_cnt++;
-		if (last != completed) {
-			ctx->last_completed = completed;
+		if (time_before(now, last + msecs_to_jiffies(timeout)))
 			progress_cnt++;
-		}
 	}
 
 	return running_cnt && !progress_cnt;
@@ -245,15 +410,91 @@ rq_part_non_rt_select(struct aie2_ctx_rq *rq)
 	return min;
 }
 
+/* The partition holding columns [col, col + width) */
+static struct aie2_partition *
+rq_part_of_cols(struct aie2_ctx_rq *rq, u32 col, u32 width)
+{
+	struct aie2_partition *part;
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		if (col >= part->start_col && col + width - 1 <= part->end_col)
+			return part;
+	}
+
+	return NULL;
+}
+
 static struct aie2_partition *
 rq_part_select(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
+	struct aie2_partition *part;
+
+	if (ctx->priv->migrate) {
+		part = rq_part_of_cols(rq, ctx->priv->migrate_col, ctx->priv->orig_num_col);
+		if (part && (!ctx_is_rt(ctx) || part->rt_ctx_cnt < part->max_rt_ctx))
+			return part;
+		/* Partitions were rebuilt since the request, drop it */
+		ctx->priv->migrate = false;
+	}
+
 	if (ctx_is_rt(ctx))
 		return rq_part_rt_select(rq);
 	else
 		return rq_part_non_rt_select(rq);
 }
 
+static inline u32 part_waiting_ctx(struct aie2_partition *part)
+{
+	return part->ctx_cnt - part->hwctx_cnt;
+}
+
+static inline bool part_is_saturated(struct aie2_partition *part)
+{
+	return part_connect_is_full(part) && part_waiting_ctx(part);
+}
+
+static inline bool part_is_underloaded(struct aie2_partition *part)
+{
+	return !part_connect_is_full(part) && !part_waiting_ctx(part);
+}
+
+/* The saturated partition with the deepest backlog */
+static struct aie2_partition *
+rq_part_busiest(struct aie2_ctx_rq *rq)
+{
+	struct aie2_partition *max = NULL;
+	struct aie2_partition *part;
+	int i;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		if (!part_is_saturated(part))
+			continue;
+
+		if (!max || part_waiting_ctx(part) > part_waiting_ctx(max))
+			max = part;
+	}
+
+	return max;
+}
+
+static bool rq_parts_unbalanced(struct aie2_ctx_rq *rq)
+{
+	int i;
+
+	if (rq->paused || rq->num_parts < 2 || !rq_part_busiest(rq))
+		return false;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		if (part_is_underloaded(&rq->parts[i]))
+			return true;
+	}
+
+	return false;
+}
+
 static struct amdxdna_ctx *
 select_next_ctx(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 {
@@ -336,54 +577,186 @@ out:
 	part->hwctx_cnt++;
 }
 
+/*
+ * Expensive to switch context must have used that much more NPU time to be
+ * picked. Preemption buffer size breaks the tie, smaller state is cheaper.
+ */
+static bool ctx_better_victim(struct amdxdna_ctx *ctx, struct amdxdna_ctx *victim)
+{
+	s64 ctx_score, victim_score;
+
+	if (ctx_has_deadline(ctx) != ctx_has_deadline(victim))
+		return !ctx_has_deadline(ctx);
+
+	ctx_score = ctx_vruntime(ctx) - ctx->priv->switch_cost;
+	victim_score = ctx_vruntime(victim) - victim->priv->switch_cost;
+	if (ctx_score != victim_score)
+		return ctx_score > victim_score;
+
+	return READ_ONCE(ctx->priv->preempt_buf_size) <
+		READ_ONCE(victim->priv->preempt_buf_size);
+}
+
+/*
+ * Block from the lowest priority level. Within that level, block the context
+ * used most NPU time, so a busy context can not hold hwctx from the others.
+ */
 static struct amdxdna_ctx *
 select_ctx_to_block(struct aie2_partition *part, int prio)
 {
+	struct amdxdna_ctx *victim = NULL;
 	struct amdxdna_ctx *ctx;
 
 	list_for_each_entry_reverse(ctx, &part->conn_list, entry) {
-		if (ctx->priv->priority < prio)
+		if (ctx_eff_prio(ctx) < prio)
 			continue;
 
 		if (ctx->priv->should_block)
 			continue;
 
-		return ctx;
+		if (victim && victim->priv->priority != ctx->priv->priority)
+			break;
+
+		if (!victim || ctx_better_victim(ctx, victim))
+			victim = ctx;
 	}
 
-	return NULL;
+	return victim;
 }
 
+static void ctx_update_switch_cost(struct amdxdna_ctx *ctx)
+{
+	u64 sample, cost;
+
+	/* First connect has no disconnect before, not a switch */
+	if (!ctx->priv->last_stop_ns)
+		return;
+
+	sample = ctx->priv->last_stop_ns + ctx->priv->last_start_ns;
+	cost = ctx->priv->switch_cost;
+	WRITE_ONCE(ctx->priv->switch_cost, cost ? (cost * 7 + sample) / 8 : sample);
+}
+
+/*
+ * A context narrower than its partition takes only its own columns, so small
+ * contexts can run side by side on disjoint columns instead of time sharing
+ * the whole partition. Which of its start columns inside the partition it
+ * gets is left to the solver, see aie2_fill_xrs_req().
+ */
+static void part_ctx_place(struct aie2_partition *part, struct amdxdna_ctx *ctx)
+{
+	u32 width = ctx->priv->orig_num_col;
+	u32 col;
+
+	ctx->start_col = part->start_col;
+	ctx->num_col = part_num_col(part);
+	ctx->priv->place_end_col = part->end_col;
+	if (!spatial_share || width >= ctx->num_col)
+		goto out;
+
+	ctx->num_col = width;
+	if (ctx->priv->migrate) {
+		col = ctx->priv->migrate_col;
+		if (col >= part->start_col && col + width - 1 <= part->end_col) {
+			ctx->start_col = col;
+			ctx->priv->place_end_col = col + width - 1;
+		}
+	}
+out:
+	ctx->priv->migrate = false;
+}
+
+/*
+ * Connected or failed context leaves connect_list. Caller holds dev_lock and
+ * the connect is finished, that is the caller did the connect or holds the
+ * context's io_sem.
+ */
+static void part_ctx_connect_done(struct aie2_partition *part, struct amdxdna_ctx *ctx)
+{
+	struct aie2_ctx_rq *rq = part->rq;
+
+	ctx->priv->connecting = false;
+	/* Drop the reserved hwctx, connected list takes it again */
+	part->hwctx_cnt--;
+	if (ctx->priv->status == CTX_STATE_DEAD) {
+		list_move_tail(&ctx->entry, &rq->disconn_list);
+		part->ctx_cnt--;
+		if (ctx_is_rt(ctx))
+			part->rt_ctx_cnt--;
+		return;
+	}
+
+	insert_ctx_to_conn_list(part, ctx);
+	if (ctx_vruntime(ctx) > rq->min_vruntime[ctx->priv->priority])
+		rq->min_vruntime[ctx->priv->priority] = ctx_vruntime(ctx);
+	/* Connected while partitions are reshaped, get it swapped out too */
+	if (rq->paused)
+		queue_work(rq->work_q, &rq->parts_work);
+}
+
+/* Wait for contexts still talking to firmware, caller holds dev_lock */
+static void part_connect_list_flush(struct aie2_partition *part)
+{
+	struct amdxdna_ctx *ctx, *tmp;
+
+	list_for_each_entry_safe(ctx, tmp, &part->connect_list, entry) {
+		down_write(&ctx->priv->io_sem);
+		part_ctx_connect_done(part, ctx);
+		up_write(&ctx->priv->io_sem);
+	}
+}
+
+/*
+ * Connect sends several firmware messages. To not hold dev_lock that long,
+ * the hwctx is reserved on connect_list under dev_lock, then the context is
+ * connected holding only its io_sem. Submit, add, delete and the other
+ * partitions go on meanwhile. Anyone else getting the io_sem of a connecting
+ * context sees the connect finished and may complete it by
+ * part_ctx_connect_done().
+ *
+ * Called with dev_lock held, returns with dev_lock held again. ctx must not
+ * be touched after, it may be deleted once dev_lock is dropped.
+ */
 static void part_ctx_start(struct aie2_partition *part, struct amdxdna_ctx *ctx)
 {
+	struct amdxdna_ctx *done, *tmp;
 	struct amdxdna_dev *xdna;
+	u64 wait_ns;
 	int err;
 
 	xdna = ctx_rq_to_xdna_dev(part->rq);
 
 	down_write(&ctx->priv->io_sem);
-	ctx->start_col = part->start_col;
-	ctx->num_col = part_num_col(part);
+	part_ctx_place(part, ctx);
+	list_move_tail(&ctx->entry, &part->connect_list);
+	part->hwctx_cnt++;
+	ctx->priv->connecting = true;
+	ctx->priv->status = CTX_STATE_CONNECTING;
+	mutex_unlock(&xdna->dev_lock);
+
 	err = aie2_ctx_connect(ctx);
+	wait_ns = rq_ctx_stats_account(ctx);
 	if (err) {
 		ctx->priv->status = CTX_STATE_DEAD;
 		ctx->priv->errno = err;
-		up_write(&ctx->priv->io_sem);
 		XDNA_ERR(xdna, "%s connect failed, err %d", ctx->name, err);
-		goto ctx_dead;
+	} else {
+		ctx_update_switch_cost(ctx);
+		rq_ctx_stats_wait(ctx, wait_ns);
+		/* Time waiting disconnected is not a hang, timeout starts over */
+		WRITE_ONCE(ctx->progress_ts, jiffies);
+		WRITE_ONCE(ctx->priv->rq_stats.connects, ctx->priv->rq_stats.connects + 1);
+		ctx->priv->status = CTX_STATE_CONNECTED;
+		XDNA_DBG(xdna, "%s connected", ctx->name);
 	}
-
-	insert_ctx_to_conn_list(part, ctx);
-	ctx->priv->status = CTX_STATE_CONNECTED;
-	XDNA_DBG(xdna, "%s connected", ctx->name);
+	wake_up_all(&ctx->priv->connect_waitq);
 	up_write(&ctx->priv->io_sem);
-	return;
 
-ctx_dead:
-	list_move_tail(&ctx->entry, &part->rq->disconn_list);
-	part->ctx_cnt--;
-	if (ctx_is_rt(ctx))
-		part->rt_ctx_cnt--;
+	mutex_lock(&xdna->dev_lock);
+	list_for_each_entry_safe(done, tmp, &part->connect_list, entry) {
+		if (!ctx_is_connecting(done))
+			part_ctx_connect_done(part, done);
+	}
 }
 
 static void part_ctx_stop_wait(struct amdxdna_ctx *ctx, bool wait)
@@ -395,12 +768,16 @@ static void part_ctx_stop_wait(struct amdxdna_ctx *ctx, bool wait)
 	xdna = ctx->client->xdna;
 	rq = &xdna->dev_handle->ctx_rq;
 	drm_WARN_ON(&xdna->ddev, !rwsem_is_locked(&ctx->priv->io_sem));
+	if (ctx->priv->connecting)
+		part_ctx_connect_done(ctx->priv->part, ctx);
 	if (!ctx_should_stop(ctx)) {
 		XDNA_DBG(xdna, "%s skip stop, status %d", ctx->name, ctx->priv->status);
 		return;
 	}
 	aie2_ctx_disconnect(ctx, wait);
 	list_move_tail(&ctx->entry, &rq->disconn_list);
+	rq_ctx_stats_account(ctx);
+	WRITE_ONCE(ctx->priv->rq_stats.disconnects, ctx->priv->rq_stats.disconnects + 1);
 	ctx->priv->status = CTX_STATE_DISCONNECTED;
 	part = ctx->priv->part;
 	if (part) {
@@ -431,6 +808,7 @@ static void rq_ctx_cancel(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 	down_write(&ctx->priv->io_sem);
 	prio_q = ctx->priv->priority;
 	list_move_tail(&ctx->entry, &rq->disconn_list);
+	rq_ctx_stats_account(ctx);
 	ctx->priv->status = CTX_STATE_DISCONNECTED;
 	part = ctx->priv->part;
 	if (part) {
@@ -492,10 +870,11 @@ static void part_sched_work(struct work_struct *work)
 	XDNA_DBG(xdna, "partition [%d, %d] max_hwctx %d hwctx %d cnt %d",
 		 part->start_col, part->end_col, part->max_hwctx,
 		 part->hwctx_cnt, part->ctx_cnt);
-	if (part->rq->paused)
-		goto out;
-
 	do {
+		/* dev_lock is dropped while connecting, check again each time */
+		if (part->rq->paused)
+			goto out;
+
 		next = select_highest_prio_ctx(part);
 		if (!next)
 			break;
@@ -504,7 +883,6 @@ static void part_sched_work(struct work_struct *work)
 			break;
 
 		part_ctx_start(part, next);
-		wake_up_all(&next->priv->connect_waitq);
 	} while (1);
 
 	if (!part_connect_is_full(part))
@@ -559,13 +937,17 @@ static void rq_yield_work(struct work_struct *work)
 		goto out;
 	}
 
+	/* Blocked for another context, not swapped out for idle */
+	if (!ctx->priv->force_yield)
+		WRITE_ONCE(ctx->priv->preempt_cnt, ctx->priv->preempt_cnt + 1);
+	WRITE_ONCE(ctx->priv->rq_stats.yields, ctx->priv->rq_stats.yields + 1);
 	ctx->priv->should_block = false;
 	part_ctx_stop(ctx);
 	rq = part->rq;
 	if (rq->paused)
 		queue_work(rq->work_q, &rq->parts_work);
 	else
-		queue_work(rq->work_q, &part->sched_work);
+		queue_work(rq->sched_wq, &part->sched_work);
 	if (atomic64_read(&ctx->priv->job_pending_cnt))
 		queue_work(rq->work_q, &ctx->dispatch_work);
 out:
@@ -599,15 +981,90 @@ static void rq_dispatch_work(struct work_struct *work)
 
 	part = rq_part_select(rq, ctx);
 	WARN_ON(!part);
+	rq_ctx_set_deadline(ctx);
 	XDNA_DBG(xdna, "%s -> partition [%d, %d]",
 		 ctx->name, part->start_col, part->end_col);
 	part_ctx_dispatch(part, ctx);
-	queue_work(rq->work_q, &part->sched_work);
+	queue_work(rq->sched_wq, &part->sched_work);
 out:
 	up_write(&ctx->priv->io_sem);
 	mutex_unlock(&xdna->dev_lock);
 }
 
+/*
+ * Waiting contexts are only on runqueue. RT context never waits for a free
+ * hwctx, so only non RT queues are looked at.
+ */
+static struct amdxdna_ctx *
+part_first_waiting_non_rt(struct aie2_partition *part)
+{
+	struct list_head *q;
+	int i;
+
+	for (i = CTX_RQ_HIGH; i < ARRAY_SIZE(part->runqueue); i++) {
+		q = &part->runqueue[i];
+		if (!list_empty(q))
+			return list_first_entry(q, struct amdxdna_ctx, entry);
+	}
+
+	return NULL;
+}
+
+static void part_ctx_migrate(struct aie2_partition *src, struct aie2_partition *dst,
+			     struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna;
+
+	xdna = ctx_rq_to_xdna_dev(src->rq);
+	down_write(&ctx->priv->io_sem);
+	src->ctx_cnt--;
+	if (ctx_is_rt(ctx))
+		src->rt_ctx_cnt--;
+	part_ctx_dispatch(dst, ctx);
+	up_write(&ctx->priv->io_sem);
+	XDNA_DBG(xdna, "%s migrated [%d, %d] -> [%d, %d]", ctx->name,
+		 src->start_col, src->end_col, dst->start_col, dst->end_col);
+}
+
+/*
+ * Move waiting contexts from saturated partitions to partitions with free
+ * hwctx. A context is only bound to a partition by dispatch, it has no
+ * hardware state there until it is connected, so moving is cheap.
+ */
+static void rq_parts_balance(struct aie2_ctx_rq *rq)
+{
+	struct aie2_partition *src;
+	struct aie2_partition *dst;
+	struct amdxdna_ctx *ctx;
+	int free, moved;
+	int i;
+
+	if (!rq_parts_unbalanced(rq))
+		return;
+
+	for (i = 0; i < rq->num_parts; i++) {
+		dst = &rq->parts[i];
+		if (!part_is_underloaded(dst))
+			continue;
+
+		free = part_max_non_rt_hwctx(dst) - (dst->hwctx_cnt - dst->rt_ctx_cnt);
+		for (moved = 0; moved < free; moved++) {
+			src = rq_part_busiest(rq);
+			if (!src)
+				break;
+
+			ctx = part_first_waiting_non_rt(src);
+			if (!ctx)
+				break;
+
+			part_ctx_migrate(src, dst, ctx);
+		}
+
+		if (moved)
+			queue_work(rq->sched_wq, &dst->sched_work);
+	}
+}
+
 static void rq_part_ctx_limit_calc(struct aie2_ctx_rq *rq, int i)
 {
 	struct aie2_partition *part;
@@ -655,6 +1112,7 @@ static void rq_part_reinit(struct aie2_ctx_rq *rq, bool all)
 			 part->start_col, part->end_col);
 		part->rq = rq;
 		INIT_LIST_HEAD(&part->conn_list);
+		INIT_LIST_HEAD(&part->connect_list);
 		for (j = 0; j < ARRAY_SIZE(part->runqueue); j++)
 			INIT_LIST_HEAD(&part->runqueue[j]);
 		INIT_WORK(&part->sched_work, part_sched_work);
@@ -685,8 +1143,10 @@ static void rq_parts_work(struct work_struct *work)
 		part_rt_ctx += rq->parts[i].max_rt_ctx;
 	part_col = rq->parts[0].end_col - rq->parts[0].start_col + 1;
 	if (rq->col_arr[rq->max_cols] && rq->max_cols == part_col &&
-	    part_rt_ctx == rq->rt_ctx_cnt)
+	    part_rt_ctx == rq->rt_ctx_cnt) {
+		rq_parts_balance(rq);
 		goto out;
+	}
 
 	/* Partition expanding or trimming is needed */
 	rq->paused = true;
@@ -727,44 +1187,83 @@ out:
 }
 
 /*
- * aie2_rq_is_all_context_stuck - Check if all connected contexts stuck
+ * aie2_rq_stuck_cols - Get columns of partitions whose contexts all stuck
  *
  * This function is helpful to implement TDR (Timeout Detecting & Recovering).
- * Return true when all running context(s) did NOT making progress. Otherwise
- * return false.
+ * Return the column bitmap of partitions where all running context(s) did
+ * NOT make progress, 0 if there is none.
  *
  * Where running context is
  *   - A connected context
  *   - A context with outstanding commands
  *
  * Where making progress context is
- *   - Completed counter changed from last check
+ *   - A command completed within the context timeout, or the context
+ *     became busy within it
  *
- * NOTE: Based on above definition, caller needs to call this twice to know if
- * all context stuck. It is caller determine when to call.
+ * Each context is judged by its own timeout, so a context running long
+ * commands does not look stuck while a short job context still can.
  */
-bool aie2_rq_is_all_context_stuck(struct aie2_ctx_rq *rq)
+u32 aie2_rq_stuck_cols(struct aie2_ctx_rq *rq)
 {
 	struct aie2_partition *part;
+	struct amdxdna_ctx *ctx;
 	struct amdxdna_dev *xdna;
-	int active_cnt = 0;
-	int stuck_cnt = 0;
+	u32 cols = 0;
 	int i;
 
 	xdna = ctx_rq_to_xdna_dev(rq);
 	mutex_lock(&xdna->dev_lock);
+	/* Waiting contexts can not be stuck, but get checked once connected */
+	list_for_each_entry(ctx, &rq->disconn_list, entry)
+		amdxdna_tdr_note_timeout(&xdna->tdr, amdxdna_ctx_timeout_ms(ctx));
+
 	for (i = 0; i < rq->num_parts; i++) {
 		part = &rq->parts[i];
 		if (!part->hwctx_cnt)
 			continue;
 
-		active_cnt++;
 		if (part_is_all_ctx_stuck(part))
-			stuck_cnt++;
+			cols |= part_col_mask(part);
 	}
 	mutex_unlock(&xdna->dev_lock);
 
-	return active_cnt && active_cnt == stuck_cnt;
+	return cols;
+}
+
+/*
+ * aie2_rq_reset_cols - Reset partitions overlapping the given columns
+ *
+ * Connected contexts of these partitions are stopped, which aborts their
+ * outstanding commands and destroys their firmware contexts, then the
+ * partitions are scheduled again. Other partitions keep running.
+ */
+void aie2_rq_reset_cols(struct aie2_ctx_rq *rq, u32 cols)
+{
+	struct aie2_partition *part;
+	struct amdxdna_ctx *ctx, *tmp;
+	struct amdxdna_dev *xdna;
+	int i;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	for (i = 0; i < rq->num_parts; i++) {
+		part = &rq->parts[i];
+		if (!(part_col_mask(part) & cols))
+			continue;
+
+		XDNA_WARN(xdna, "Reset partition [%d, %d]", part->start_col, part->end_col);
+		part_connect_list_flush(part);
+		list_for_each_entry_safe(ctx, tmp, &part->conn_list, entry) {
+			down_write(&ctx->priv->io_sem);
+			part_ctx_stop_wait(ctx, false);
+			if (atomic64_read(&ctx->priv->job_pending_cnt))
+				queue_work(rq->work_q, &ctx->dispatch_work);
+			up_write(&ctx->priv->io_sem);
+		}
+		queue_work(rq->sched_wq, &part->sched_work);
+	}
+	mutex_unlock(&xdna->dev_lock);
 }
 
 bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq)
@@ -783,6 +1282,8 @@ bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq)
 
 		found = true;
 	}
+	if (rq_parts_unbalanced(rq))
+		queue_work(rq->work_q, &rq->parts_work);
 	mutex_unlock(&xdna->dev_lock);
 
 	return found;
@@ -800,6 +1301,7 @@ void aie2_rq_stop_all(struct aie2_ctx_rq *rq)
 	mutex_lock(&xdna->dev_lock);
 	for (i = 0; i < rq->num_parts; i++) {
 		part = &rq->parts[i];
+		part_connect_list_flush(part);
 		list_for_each_entry_safe(ctx, tmp, &part->conn_list, entry) {
 			down_write(&ctx->priv->io_sem);
 			XDNA_DBG(xdna, "%s @[%d, %d] stop", ctx->name,
@@ -821,11 +1323,104 @@ void aie2_rq_restart_all(struct aie2_ctx_rq *rq)
 	mutex_lock(&xdna->dev_lock);
 	for (i = 0; i < rq->num_parts; i++) {
 		part = &rq->parts[i];
-		queue_work(rq->work_q, &part->sched_work);
+		queue_work(rq->sched_wq, &part->sched_work);
+	}
+	mutex_unlock(&xdna->dev_lock);
+}
+
+/* Connect ctx ahead of its next submit, do not wait for it */
+void aie2_rq_prewarm(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	/* Connecting a context without CUs makes it dead */
+	if (ctx->cus && ctx_is_disconnected(ctx) && !rq->paused) {
+		XDNA_DBG(xdna, "%s pre-warm", ctx->name);
+		queue_work(rq->work_q, &ctx->dispatch_work);
 	}
 	mutex_unlock(&xdna->dev_lock);
 }
 
+/*
+ * Move ctx to the columns starting at start_col. A waiting context is moved
+ * to the destination partition right away. A connected context is yielded
+ * once its submitted commands completed, so no job is cut in half, and it
+ * reconnects at start_col with the CONFIG_CU request and PDIs it already
+ * has. The request is only a placement hint for a disconnected context.
+ */
+int aie2_rq_migrate(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx, u32 start_col)
+{
+	struct aie2_partition *src, *dst;
+	struct amdxdna_dev *xdna;
+	int ret = 0;
+	int i;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	if (ctx_is_fatal(ctx)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	for (i = 0; i < ctx->col_list_len; i++) {
+		if (ctx->col_list[i] == start_col)
+			break;
+	}
+	if (i == ctx->col_list_len) {
+		XDNA_ERR(xdna, "%s can not start at column %d", ctx->name, start_col);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dst = rq_part_of_cols(rq, start_col, ctx->priv->orig_num_col);
+	if (!dst) {
+		XDNA_ERR(xdna, "%s columns [%d, %d] cross partitions", ctx->name,
+			 start_col, start_col + ctx->priv->orig_num_col - 1);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	src = ctx->priv->part;
+	if (ctx_is_rt(ctx) && src != dst && dst->rt_ctx_cnt == dst->max_rt_ctx) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (ctx_is_connected(ctx) && ctx->start_col == start_col)
+		goto out;
+
+	ctx->priv->migrate = true;
+	ctx->priv->migrate_col = start_col;
+	XDNA_DBG(xdna, "%s migrate to column %d, status %d", ctx->name,
+		 start_col, ctx->priv->status);
+
+	if (ctx_is_dispatched(ctx)) {
+		if (src != dst)
+			part_ctx_migrate(src, dst, ctx);
+		if (!rq->paused)
+			queue_work(rq->sched_wq, &dst->sched_work);
+		goto out;
+	}
+
+	if (!ctx_is_connected(ctx))
+		goto out;
+
+	down_write(&ctx->priv->io_sem);
+	ctx->priv->force_yield = true;
+	ctx->priv->should_block = true;
+	if (!atomic64_read(&ctx->priv->job_pending_cnt) &&
+	    ctx->submitted == ctx->completed) {
+		ctx->priv->status = CTX_STATE_DISCONNECTING;
+		queue_work(rq->work_q, &ctx->yield_work);
+	}
+	up_write(&ctx->priv->io_sem);
+out:
+	mutex_unlock(&xdna->dev_lock);
+	return ret;
+}
+
 /* This is called when command completed. Do NOT hold lock */
 void aie2_rq_yield(struct amdxdna_ctx *ctx)
 {
@@ -840,6 +1435,31 @@ void aie2_rq_yield(struct amdxdna_ctx *ctx)
 		queue_work(rq->work_q, &ctx->yield_work);
 }
 
+/*
+ * Priority inheritance. A waiter with priority prio depends on ctx's pending
+ * work. Keep ctx from being blocked by contexts below prio until the work
+ * submitted so far completes. A waiting ctx is moved to the head of its
+ * queue, its own priority queue is kept so the runqueue accounting holds.
+ */
+void aie2_rq_boost(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx, int prio)
+{
+	struct amdxdna_dev *xdna;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	if (prio >= ctx_eff_prio(ctx) || ctx->submitted == ctx->completed)
+		goto out;
+
+	ctx->priv->boost_until = ctx->submitted;
+	WRITE_ONCE(ctx->priv->boost_prio, prio);
+	if (ctx_is_dispatched(ctx) && ctx->priv->part)
+		list_move(&ctx->entry, &ctx->priv->part->runqueue[ctx->priv->priority]);
+	XDNA_DBG(xdna, "%s boosted to priority %d until %lld",
+		 ctx->name, prio, ctx->priv->boost_until);
+out:
+	mutex_unlock(&xdna->dev_lock);
+}
+
 static int rq_submit_enter_slow(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna;
@@ -914,6 +1534,17 @@ int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 	int ret;
 
 	xdna = ctx_rq_to_xdna_dev(rq);
+	/* Nothing below touches the runqueue, keep it out of dev_lock */
+	INIT_WORK(&ctx->dispatch_work, rq_dispatch_work);
+	INIT_WORK(&ctx->yield_work, rq_yield_work);
+	ctx->priv->status = CTX_STATE_DISCONNECTED;
+	ctx->priv->rq_stats.state_ts = ktime_get();
+	ctx->priv->should_block = false;
+	ctx->priv->boost_prio = CTX_RQ_NUM_QUEUE;
+	qos_to_rq_prio(ctx);
+	qos_to_rq_deadline(ctx);
+	num_col = ctx->priv->orig_num_col;
+
 	mutex_lock(&xdna->dev_lock);
 	if (rq->ctx_limit == rq->ctx_cnt) {
 		XDNA_ERR(xdna, "Not allow more than %d context(s)", rq->ctx_limit);
@@ -934,7 +1565,6 @@ int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 		goto error;
 	}
 
-	num_col = ctx->priv->orig_num_col;
 	if (num_col > rq->total_cols) {
 		XDNA_ERR(xdna, "Require %d columns exceed %d",
 			 num_col, rq->total_cols);
@@ -942,12 +1572,6 @@ int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 		goto error;
 	}
 
-	INIT_WORK(&ctx->dispatch_work, rq_dispatch_work);
-	INIT_WORK(&ctx->yield_work, rq_yield_work);
-	ctx->priv->status = CTX_STATE_DISCONNECTED;
-	ctx->priv->should_block = false;
-	qos_to_rq_prio(ctx);
-
 	rq->col_arr[num_col]++;
 	if (num_col > rq->max_cols) {
 		rq->max_cols = num_col;
@@ -973,6 +1597,71 @@ error:
 	return ret;
 }
 
+/*
+ * Apply new QoS to a live context. The context keeps its connection or its
+ * place in a partition, only queue position and accounting are updated.
+ */
+int aie2_rq_update_qos(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx,
+		       const struct amdxdna_qos_info *qos)
+{
+	struct amdxdna_qos_info old_qos;
+	struct aie2_partition *part;
+	struct amdxdna_dev *xdna;
+	bool was_rt, is_rt;
+	u32 old_prio;
+	int ret = 0;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	down_write(&ctx->priv->io_sem);
+	if (ctx->priv->connecting)
+		part_ctx_connect_done(ctx->priv->part, ctx);
+	old_qos = ctx->qos;
+	old_prio = ctx->priv->priority;
+	was_rt = ctx_is_rt(ctx);
+
+	ctx->qos = *qos;
+	qos_to_rq_prio(ctx);
+	is_rt = ctx_is_rt(ctx);
+	if (!was_rt && is_rt &&
+	    (rq->hwctx_limit == rq->rt_ctx_cnt ||
+	     (rq->ctx_cnt - 1 > rq->rt_ctx_cnt && rq->rt_ctx_cnt + 1 == rq->hwctx_limit))) {
+		XDNA_ERR(xdna, "Not more hwctx for RT");
+		ctx->qos = old_qos;
+		ctx->priv->priority = old_prio;
+		ret = -ENOENT;
+		goto out;
+	}
+	qos_to_rq_deadline(ctx);
+
+	part = ctx->priv->part;
+	if (was_rt != is_rt) {
+		rq->rt_ctx_cnt += is_rt ? 1 : -1;
+		if (part)
+			part->rt_ctx_cnt += is_rt ? 1 : -1;
+		queue_work(rq->work_q, &rq->parts_work);
+	}
+
+	if (!part || ctx->priv->priority == old_prio)
+		goto out;
+
+	if (ctx_is_dispatched(ctx)) {
+		/* Waiting, a higher priority may connect it now */
+		part_runqueue_insert(part, ctx);
+		queue_work(rq->sched_wq, &part->sched_work);
+	} else if (ctx_is_connected(ctx) || ctx_is_disconnecting(ctx)) {
+		/* Connect list is ordered by priority */
+		part->hwctx_cnt--;
+		insert_ctx_to_conn_list(part, ctx);
+	}
+out:
+	up_write(&ctx->priv->io_sem);
+	XDNA_DBG(xdna, "%s QoS updated, priority %d -> %d, ret %d",
+		 ctx->name, old_prio, ctx->priv->priority, ret);
+	mutex_unlock(&xdna->dev_lock);
+	return ret;
+}
+
 void aie2_rq_del(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna;
@@ -1058,6 +1747,10 @@ int aie2_rq_init(struct aie2_ctx_rq *rq)
 	if (!rq->work_q)
 		goto free_col_arr;
 
+	rq->sched_wq = alloc_workqueue("ctx_part_sched", WQ_UNBOUND, 0);
+	if (!rq->sched_wq)
+		goto destroy_work_q;
+
 	INIT_WORK(&rq->parts_work, rq_parts_work);
 	INIT_LIST_HEAD(&rq->disconn_list);
 
@@ -1065,6 +1758,8 @@ int aie2_rq_init(struct aie2_ctx_rq *rq)
 
 	return 0;
 
+destroy_work_q:
+	destroy_workqueue(rq->work_q);
 free_col_arr:
 	kfree(rq->col_arr);
 free_parts:
@@ -1074,11 +1769,61 @@ free_parts:
 
 void aie2_rq_fini(struct aie2_ctx_rq *rq)
 {
+	struct amdxdna_dev *xdna = ctx_rq_to_xdna_dev(rq);
+
+	/* AIE error worker may still look for partitions to reset */
+	mutex_lock(&xdna->dev_lock);
+	rq->num_parts = 0;
+	mutex_unlock(&xdna->dev_lock);
+	destroy_workqueue(rq->sched_wq);
 	destroy_workqueue(rq->work_q);
 	kfree(rq->col_arr);
 	kfree(rq->parts);
 }
 
+/*
+ * Lockless, so monitoring never waits behind a connect. Each counter is
+ * read once, a snapshot taken across a state move may be off by that move.
+ */
+void aie2_rq_ctx_stats(struct amdxdna_ctx *ctx, struct amdxdna_drm_query_ctx_rq_stats *stats)
+{
+	struct aie2_rq_stats *st = &ctx->priv->rq_stats;
+	u32 status = READ_ONCE(ctx->priv->status);
+	u64 delta;
+	int i;
+
+	stats->disconnected_ns = READ_ONCE(st->disconn_ns);
+	stats->wait_ns = READ_ONCE(st->wait_ns);
+	stats->connected_ns = READ_ONCE(st->conn_ns);
+	stats->connects = READ_ONCE(st->connects);
+	stats->disconnects = READ_ONCE(st->disconnects);
+	stats->yields = READ_ONCE(st->yields);
+	stats->preemptions = READ_ONCE(ctx->priv->preempt_cnt);
+	for (i = 0; i < AMDXDNA_RQ_WAIT_BUCKETS; i++)
+		stats->wait_hist[i] = READ_ONCE(st->wait_hist[i]);
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), READ_ONCE(st->state_ts)));
+	switch (status) {
+	case CTX_STATE_DISCONNECTED:
+		stats->status = 0;
+		stats->disconnected_ns += delta;
+		break;
+	case CTX_STATE_DISPATCHED:
+	case CTX_STATE_CONNECTING:
+		stats->status = 1;
+		stats->wait_ns += delta;
+		break;
+	case CTX_STATE_CONNECTED:
+	case CTX_STATE_DISCONNECTING:
+		stats->status = 2;
+		stats->connected_ns += delta;
+		break;
+	default:
+		stats->status = 0;
+		break;
+	}
+}
+
 #if defined(CONFIG_DEBUG_FS)
 int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 {
@@ -1098,9 +1843,10 @@ int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 	seq_printf(m, "Max cols %d\n", rq->max_cols);
 
 	list_for_each_entry(ctx, &rq->disconn_list, entry) {
-		seq_printf(m, "%s status %d pending %lld\n",
+		seq_printf(m, "%s status %d pending %lld vruntime %llu\n",
 			   ctx->name, ctx->priv->status,
-			   atomic64_read(&ctx->priv->job_pending_cnt));
+			   atomic64_read(&ctx->priv->job_pending_cnt),
+			   ctx_vruntime(ctx));
 	}
 
 	for (i = 0; i < rq->num_parts; i++) {
@@ -1111,6 +1857,62 @@ int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m)
 		seq_printf(m, "  Number of ctx %d\n", part->ctx_cnt);
 		seq_printf(m, "  Number of RT ctx %d\n", part->rt_ctx_cnt);
 		seq_printf(m, "  Number of hwctx %d\n", part->hwctx_cnt);
+		list_for_each_entry(ctx, &part->conn_list, entry) {
+			seq_printf(m, "  %s vruntime %llu deadline miss %llu idle timeout %llu ms\n",
+				   ctx->name, ctx_vruntime(ctx),
+				   READ_ONCE(ctx->priv->deadline_miss),
+				   ctx_idle_timeout(ctx) / NSEC_PER_MSEC);
+			seq_printf(m, "    switch cost %llu us preempt buf %u preempted %llu pdi loads %llu\n",
+				   ctx->priv->switch_cost / NSEC_PER_USEC,
+				   READ_ONCE(ctx->priv->preempt_buf_size),
+				   ctx->priv->preempt_cnt,
+				   READ_ONCE(ctx->priv->pdi_loads));
+		}
+		list_for_each_entry(ctx, &part->connect_list, entry)
+			seq_printf(m, "  %s connecting\n", ctx->name);
+	}
+	mutex_unlock(&xdna->dev_lock);
+
+	return 0;
+}
+
+int aie2_rq_stats_show(struct aie2_ctx_rq *rq, struct seq_file *m)
+{
+	struct amdxdna_drm_query_ctx_rq_stats stats;
+	struct amdxdna_client *client;
+	struct amdxdna_dev *xdna;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+	int idx, i;
+
+	xdna = ctx_rq_to_xdna_dev(rq);
+	mutex_lock(&xdna->dev_lock);
+	list_for_each_entry(client, &xdna->client_list, node) {
+		idx = srcu_read_lock(&client->ctx_srcu);
+		amdxdna_for_each_ctx(client, ctx_id, ctx) {
+			if (!ctx->priv)
+				continue;
+
+			aie2_rq_ctx_stats(ctx, &stats);
+			seq_printf(m, "%s pid %d status %u\n", ctx->name, client->pid, stats.status);
+			seq_printf(m, "  disconnected %llu us wait %llu us connected %llu us\n",
+				   stats.disconnected_ns / NSEC_PER_USEC,
+				   stats.wait_ns / NSEC_PER_USEC,
+				   stats.connected_ns / NSEC_PER_USEC);
+			seq_printf(m, "  connects %llu disconnects %llu yields %llu preemptions %llu\n",
+				   stats.connects, stats.disconnects, stats.yields,
+				   stats.preemptions);
+			seq_printf(m, "  pdi loads %llu\n", READ_ONCE(ctx->priv->pdi_loads));
+			seq_puts(m, "  wait us:");
+			for (i = 0; i < AMDXDNA_RQ_WAIT_BUCKETS - 1; i++) {
+				if (stats.wait_hist[i])
+					seq_printf(m, " <%lu:%llu", 1UL << i, stats.wait_hist[i]);
+			}
+			if (stats.wait_hist[i])
+				seq_printf(m, " >=%lu:%llu", 1UL << (i - 1), stats.wait_hist[i]);
+			seq_puts(m, "\n");
+		}
+		srcu_read_unlock(&client->ctx_srcu, idx);
 	}
 	mutex_unlock(&xdna->dev_lock);
 
@@ -10,6 +10,7 @@
 #include <linux/vmalloc.h>
 #include <linux/completion.h>
 #include <linux/pm_runtime.h>
+#include <linux/sort.h>
 #include <drm/drm_debugfs.h>
 #include <drm/drm_cache.h>
 
@@ -296,6 +297,45 @@ static int aie2_event_trace_show(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(event_trace, aie2_event_trace_show, aie2_event_trace_write);
 
+/* Raw firmware events for a tool to mmap, see struct event_trace_ring_hdr */
+static int aie2_event_trace_ring_fopen(struct inode *inode, struct file *file)
+{
+	struct amdxdna_dev_hdl *ndev = inode->i_private;
+	int ret;
+
+	ret = aie2_event_trace_ring_open(ndev);
+	if (ret)
+		return ret;
+
+	file->private_data = ndev;
+	return nonseekable_open(inode, file);
+}
+
+static int aie2_event_trace_ring_frelease(struct inode *inode, struct file *file)
+{
+	aie2_event_trace_ring_release(file->private_data);
+	return 0;
+}
+
+static int aie2_event_trace_ring_fmmap(struct file *file, struct vm_area_struct *vma)
+{
+	return aie2_event_trace_ring_mmap(file->private_data, vma);
+}
+
+static __poll_t aie2_event_trace_ring_fpoll(struct file *file, poll_table *wait)
+{
+	return aie2_event_trace_ring_poll(file->private_data, file, wait);
+}
+
+static const struct file_operations aie2_fops_event_trace_ring = {
+	.owner = THIS_MODULE,
+	.open = aie2_event_trace_ring_fopen,
+	.release = aie2_event_trace_ring_frelease,
+	.mmap = aie2_event_trace_ring_fmmap,
+	.poll = aie2_event_trace_ring_fpoll,
+	.llseek = noop_llseek,
+};
+
 static int test_case01(struct amdxdna_dev_hdl *ndev)
 {
 	int ret;
@@ -399,6 +439,193 @@ static int test_case02(struct amdxdna_dev_hdl *ndev, u32 argc, const u32 *args)
 	return ret;
 }
 
+#define MBOX_PING_MAX_CNT	100000
+
+struct mbox_ping;
+
+struct mbox_ping_slot {
+	struct mbox_ping	*ping;
+	u64			sent_ns;
+	u64			lat_ns;
+};
+
+struct mbox_ping {
+	struct completion	comp;
+	struct mbox_ping_slot	*slots;
+};
+
+static int mbox_ping_cb(void *handle, void __iomem *data, size_t size)
+{
+	struct mbox_ping_slot *slot = handle;
+
+	slot->lat_ns = ktime_get_ns() - slot->sent_ns;
+	/* Completion count is the number of responses not yet consumed */
+	complete(&slot->ping->comp);
+	return 0;
+}
+
+static int mbox_ping_cmp(const void *a, const void *b)
+{
+	const struct mbox_ping_slot *sa = a, *sb = b;
+
+	if (sa->lat_ns == sb->lat_ns)
+		return 0;
+	return sa->lat_ns < sb->lat_ns ? -1 : 1;
+}
+
+/* Nearest-rank percentile in permille, slots are sorted */
+static u64 mbox_ping_pct(struct mbox_ping *ping, u32 cnt, u32 permille)
+{
+	u32 rank = DIV_ROUND_UP(cnt * (u64)permille, 1000);
+
+	return ping->slots[max(rank, 1U) - 1].lat_ns;
+}
+
+static int mbox_ping_run(struct amdxdna_dev_hdl *ndev, struct mailbox_channel *chann,
+			 const char *name, u32 cnt, u32 concurrency)
+{
+	/* Echo opcode, first word is response length in words */
+	u32 data[2] = { 1, 0x5a5a5a5a };
+	struct xdna_mailbox_msg msg;
+	struct mbox_ping *ping;
+	u32 sent = 0, done = 0;
+	u64 start, total;
+	int ret = 0;
+
+	ping = kzalloc(sizeof(*ping), GFP_KERNEL);
+	if (!ping)
+		return -ENOMEM;
+
+	ping->slots = kvcalloc(cnt, sizeof(*ping->slots), GFP_KERNEL);
+	if (!ping->slots) {
+		kfree(ping);
+		return -ENOMEM;
+	}
+	init_completion(&ping->comp);
+
+	msg.opcode = 0x101010;
+	msg.notify_cb = mbox_ping_cb;
+	msg.send_data = (u8 *)data;
+	msg.send_size = sizeof(data);
+
+	start = ktime_get_ns();
+	while (done < cnt) {
+		/* Keep the window full */
+		while (!ret && sent < cnt && sent - done < concurrency) {
+			ping->slots[sent].ping = ping;
+			ping->slots[sent].sent_ns = ktime_get_ns();
+			msg.handle = &ping->slots[sent];
+			ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
+			if (ret) {
+				XDNA_ERR(ndev->xdna, "Send ping %u failed, ret %d", sent, ret);
+				break;
+			}
+			sent++;
+		}
+
+		if (done == sent)
+			break;
+
+		if (!wait_for_completion_timeout(&ping->comp, msecs_to_jiffies(RX_TIMEOUT))) {
+			/* Callback may still fire on the slots, do not free them */
+			XDNA_ERR(ndev->xdna, "Ping response timeout, %u outstanding", sent - done);
+			return -ETIME;
+		}
+		done++;
+	}
+	total = ktime_get_ns() - start;
+
+	if (done) {
+		sort(ping->slots, done, sizeof(*ping->slots), mbox_ping_cmp, NULL);
+		XDNA_INFO(ndev->xdna, "Mailbox ping %s: %u msgs, concurrency %u, %llu msgs/s",
+			  name, done, concurrency, div64_u64(done * (u64)NSEC_PER_SEC, total ?: 1));
+		XDNA_INFO(ndev->xdna, "Latency ns p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu",
+			  mbox_ping_pct(ping, done, 500), mbox_ping_pct(ping, done, 900),
+			  mbox_ping_pct(ping, done, 990), mbox_ping_pct(ping, done, 999),
+			  ping->slots[done - 1].lat_ns);
+	}
+
+	kvfree(ping->slots);
+	kfree(ping);
+	return ret;
+}
+
+static int test_case04(struct amdxdna_dev_hdl *ndev, u32 argc, const u32 *args)
+{
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct amdxdna_client *client;
+	u32 fw_id, cnt, concurrency;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+	bool found = false;
+	int ret = -EINVAL;
+	bool poll;
+	int idx;
+
+	if (argc < 4) {
+		XDNA_ERR(xdna, "Too few parameters");
+		return -EINVAL;
+	}
+
+	fw_id = args[1];
+	cnt = args[2];
+	concurrency = args[3];
+	poll = argc >= 5 && args[4];
+	if (!cnt || cnt > MBOX_PING_MAX_CNT) {
+		XDNA_ERR(xdna, "Invalid ping count %u", cnt);
+		return -EINVAL;
+	}
+	if (!concurrency) {
+		XDNA_ERR(xdna, "Invalid concurrency %u", concurrency);
+		return -EINVAL;
+	}
+
+	if (!fw_id) {
+		mutex_lock(&ndev->aie2_lock);
+		if (poll)
+			XDNA_WARN(xdna, "Management channel only runs on interrupt");
+		if (ndev->mgmt_chann)
+			ret = mbox_ping_run(ndev, ndev->mgmt_chann, "mgmt irq", cnt, concurrency);
+		mutex_unlock(&ndev->aie2_lock);
+		return ret;
+	}
+
+	/* Context stays connected while dev_lock is held */
+	mutex_lock(&xdna->dev_lock);
+	list_for_each_entry(client, &xdna->client_list, node) {
+		idx = srcu_read_lock(&client->ctx_srcu);
+		amdxdna_for_each_ctx(client, ctx_id, ctx) {
+			struct mailbox_channel *chann;
+			int rate;
+
+			/* Connect runs without dev_lock, its channel may go away */
+			if (!ctx->priv || ctx->priv->connecting)
+				continue;
+
+			if (!ctx->priv->mbox_chann || ctx->priv->id != fw_id)
+				continue;
+
+			chann = ctx->priv->mbox_chann;
+			/* Poll from the first response, or never */
+			rate = xdna_mailbox_set_poll_rate(chann, poll ? 1 : 0);
+			ret = mbox_ping_run(ndev, chann, poll ? "ctx poll" : "ctx irq",
+					    cnt, concurrency);
+			if (rate >= 0)
+				xdna_mailbox_set_poll_rate(chann, rate);
+			found = true;
+			break;
+		}
+		srcu_read_unlock(&client->ctx_srcu, idx);
+		if (found)
+			break;
+	}
+	mutex_unlock(&xdna->dev_lock);
+
+	if (!found)
+		XDNA_ERR(xdna, "No connected context with firmware id %u", fw_id);
+	return ret;
+}
+
 #define NPUTEST_MAX_PARAM 5
 static ssize_t aie2_dbgfs_nputest(struct file *file, const char __user *ptr,
 				  size_t len, loff_t *off)
@@ -430,6 +657,12 @@ static ssize_t aie2_dbgfs_nputest(struct file *file, const char __user *ptr,
 	}
 	XDNA_DBG(ndev->xdna, "Got %d parameters\n", argc);
 
+	/* Takes dev_lock, which is ordered before aie2_lock */
+	if (args[0] == 4) {
+		ret = test_case04(ndev, argc, args);
+		goto free_and_out;
+	}
+
 	mutex_lock(&ndev->aie2_lock);
 	/* args[0] is test case ID */
 	switch (args[0]) {
@@ -456,7 +689,7 @@ static int aie2_dbgfs_nputest_show(struct seq_file *m, void *unused)
 {
 	seq_puts(m, "nputest usage:\n");
 	seq_puts(m, "\techo id [args] > <debugfs_path>/dri/<render_id>/nputest\n");
-	seq_puts(m, "\t\tid - test case id (1 - 2), bad id will be ignore\n");
+	seq_puts(m, "\t\tid - test case id (1 - 4), bad id will be ignore\n");
 	seq_puts(m, "\t\targs - arguments for test case, optional\n");
 	seq_puts(m, "\n");
 	seq_puts(m, "test case 1 usage:\n");
@@ -468,6 +701,14 @@ static int aie2_dbgfs_nputest_show(struct seq_file *m, void *unused)
 	seq_puts(m, "\t\tresp_len - response length in words (1 - 28)\n");
 	seq_puts(m, "\t\tpattern - data to fill message and response\n");
 	seq_puts(m, "\t\tcnt - send cnt messages without wait, optional (default 1)\n");
+	seq_puts(m, "\n");
+	seq_puts(m, "test case 4 usage:\n");
+	seq_puts(m, "\techo 4 ctx_id cnt concurrency [poll] > <nputest file>\n");
+	seq_puts(m, "\t\tctx_id - firmware context id, 0 for management channel\n");
+	seq_puts(m, "\t\tcnt - number of ping messages (1 - 100000)\n");
+	seq_puts(m, "\t\tconcurrency - max messages in flight\n");
+	seq_puts(m, "\t\tpoll - 1 to let context channel switch to polling, optional (default 0)\n");
+	seq_puts(m, "\t\tlatency percentiles and message rate are printed in dmesg\n");
 
 	return 0;
 }
@@ -523,6 +764,32 @@ static int aie2_msg_queue_show(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(msg_queue, aie2_msg_queue_show, NULL);
 
+static ssize_t aie2_msg_latency_write(struct file *file, const char __user *ptr,
+				      size_t len, loff_t *off)
+{
+	struct amdxdna_dev_hdl *ndev = file_to_ndev_rw(file);
+	u32 val;
+	int ret;
+
+	ret = kstrtouint_from_user(ptr, len, 10, &val);
+	if (ret || val) {
+		XDNA_ERR(ndev->xdna, "Write 0 to reset latency histograms");
+		return ret ? ret : -EINVAL;
+	}
+
+	xdna_mailbox_latency_reset(ndev->mbox);
+	return len;
+}
+
+static int aie2_msg_latency_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	return xdna_mailbox_latency_show(ndev->mbox, m);
+}
+
+AIE2_DBGFS_FOPS(msg_latency, aie2_msg_latency_show, aie2_msg_latency_write);
+
 static int aie2_telemetry(struct seq_file *m, u32 type)
 {
 	struct amdxdna_dev_hdl *ndev = m->private;
@@ -597,6 +864,47 @@ static int aie2_ctx_rq_show(struct seq_file *m, void *unused)
 
 AIE2_DBGFS_FOPS(ctx_rq, aie2_ctx_rq_show, NULL);
 
+static int aie2_ctx_rq_stats_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	return aie2_rq_stats_show(&ndev->ctx_rq, m);
+}
+
+AIE2_DBGFS_FOPS(ctx_rq_stats, aie2_ctx_rq_stats_show, NULL);
+
+static int aie2_clk_gating_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+
+	return aie2_pm_clk_gating_show(ndev, m);
+}
+
+AIE2_DBGFS_FOPS(clk_gating, aie2_clk_gating_show, NULL);
+
+static int aie2_heap_show(struct seq_file *m, void *unused)
+{
+	struct amdxdna_dev_hdl *ndev = m->private;
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct amdxdna_client *client;
+
+	mutex_lock(&xdna->dev_lock);
+	list_for_each_entry(client, &xdna->client_list, node)
+		amdxdna_gem_heap_show(client, m);
+	mutex_unlock(&xdna->dev_lock);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(heap, aie2_heap_show, NULL);
+
+static int aie2_carvedout_show(struct seq_file *m, void *unused)
+{
+	amdxdna_carvedout_show(m);
+	return 0;
+}
+
+AIE2_DBGFS_FOPS(carvedout, aie2_carvedout_show, NULL);
+
 const struct {
 	const char *name;
 	const struct file_operations *fops;
@@ -609,6 +917,7 @@ const struct {
 	AIE2_DBGFS_FILE(dpm_level, 0600),
 	AIE2_DBGFS_FILE(ringbuf, 0400),
 	AIE2_DBGFS_FILE(msg_queue, 0400),
+	AIE2_DBGFS_FILE(msg_latency, 0600),
 	AIE2_DBGFS_FILE(ioctl_id, 0400),
 	AIE2_DBGFS_FILE(telemetry_disabled, 0400),
 	AIE2_DBGFS_FILE(telemetry_health, 0400),
@@ -616,7 +925,12 @@ const struct {
 	AIE2_DBGFS_FILE(telemetry_profiling, 0400),
 	AIE2_DBGFS_FILE(telemetry_debug, 0400),
 	AIE2_DBGFS_FILE(event_trace, 0600),
+	AIE2_DBGFS_FILE(event_trace_ring, 0600),
 	AIE2_DBGFS_FILE(ctx_rq, 0400),
+	AIE2_DBGFS_FILE(ctx_rq_stats, 0400),
+	AIE2_DBGFS_FILE(clk_gating, 0400),
+	AIE2_DBGFS_FILE(heap, 0400),
+	AIE2_DBGFS_FILE(carvedout, 0400),
 };
 
 void aie2_debugfs_init(struct amdxdna_dev *xdna)
@@ -6,22 +6,56 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/dma-mapping.h>
+#include <linux/ratelimit.h>
 #include <drm/drm_cache.h>
 #include "aie2_msg_priv.h"
 #include "aie2_pci.h"
 
+static uint aie2_error_storm_delay_ms = 100;
+module_param(aie2_error_storm_delay_ms, uint, 0600);
+MODULE_PARM_DESC(aie2_error_storm_delay_ms,
+		 "Delay in ms to give event buffers back to firmware when a column is storming");
+
+/* Assume that AIE has less than 32 columns */
+#define AIE2_ERR_MAX_COLS		32
+/* Batches with errors on one column per second before it is storming */
+#define AIE2_ERR_COL_BURST		4
+/* Distinct errors logged per batch, the rest are only counted */
+#define AIE2_ERR_SUM_MAX		16
+
 struct async_event {
 	struct amdxdna_dev_hdl		*ndev;
 	struct async_event_msg_resp	resp;
-	struct workqueue_struct		*wq;
-	struct work_struct		work;
+	/* Handled, to be registered to firmware again */
+	bool				rearm;
 	u8				*buf;
 	dma_addr_t			addr;
 	u32				size;
 };
 
+struct aie2_err_sum {
+	u8				row;
+	u8				col;
+	u8				event_id;
+	u32				mod_type;
+	u32				cnt;
+};
+
+/*
+ * Responses only mark their event and kick one work, which handles all
+ * responded events in a batch. All errors of a batch cause one column reset
+ * and one log line per distinct error. Event buffers are registered again
+ * together under one aie2_lock, later if a column is storming.
+ */
 struct async_events {
+	struct amdxdna_dev_hdl		*ndev;
 	struct workqueue_struct		*wq;
+	struct work_struct		work;
+	struct delayed_work		rearm_work;
+	struct ratelimit_state		col_rs[AIE2_ERR_MAX_COLS];
+	struct aie2_err_sum		sum[AIE2_ERR_SUM_MAX];
+	u32				nr_sum;
+	u64				suppressed;
 	u8				*buf;
 	dma_addr_t			addr;
 	u32				size;
@@ -176,28 +210,50 @@ aie_get_error_category(u8 row, u8 event_id, enum aie_module_type mod_type)
 	return AIE_ERROR_UNKNOWN;
 }
 
-static u32 aie2_error_backtrack(struct amdxdna_dev_hdl *ndev, void *err_info, u32 num_err)
+static void aie2_error_sum_add(struct async_events *events, struct aie_error *err)
+{
+	struct aie2_err_sum *sum;
+	u32 i;
+
+	for (i = 0; i < events->nr_sum; i++) {
+		sum = &events->sum[i];
+		if (sum->row == err->row && sum->col == err->col &&
+		    sum->mod_type == err->mod_type && sum->event_id == err->event_id) {
+			sum->cnt++;
+			return;
+		}
+	}
+
+	if (events->nr_sum == AIE2_ERR_SUM_MAX) {
+		events->suppressed++;
+		return;
+	}
+
+	sum = &events->sum[events->nr_sum++];
+	sum->row = err->row;
+	sum->col = err->col;
+	sum->mod_type = err->mod_type;
+	sum->event_id = err->event_id;
+	sum->cnt = 1;
+}
+
+static u32 aie2_error_backtrack(struct async_events *events, void *err_info, u32 num_err)
 {
 	struct aie_error *errs = err_info;
-	u32 err_col = 0; /* assume that AIE has less than 32 columns */
+	u32 err_col = 0;
 	int i;
 
 	/* Get err column bitmap */
 	for (i = 0; i < num_err; i++) {
 		struct aie_error *err = &errs[i];
-		enum aie_error_category cat;
 
-		cat = aie_get_error_category(err->row, err->event_id, err->mod_type);
-		XDNA_ERR(ndev->xdna, "Row: %d, Col: %d, module %d, event ID %d, category %d",
-			 err->row, err->col, err->mod_type,
-			 err->event_id, cat);
-
-		if (err->col >= 32) {
+		if (err->col >= AIE2_ERR_MAX_COLS) {
 			/* If you see this, contact NPU firmware team */
-			XDNA_WARN(ndev->xdna, "Device has more than 32 columns?");
+			XDNA_WARN(events->ndev->xdna, "Device has more than 32 columns?");
 			break;
 		}
 
+		aie2_error_sum_add(events, err);
 		err_col |= (1 << err->col);
 	}
 
@@ -206,6 +262,48 @@ static u32 aie2_error_backtrack(struct amdxdna_dev_hdl *ndev, void *err_info, u3
 	return err_col;
 }
 
+/* One line per distinct error, errors on storming columns are only counted */
+static void aie2_error_summary(struct async_events *events, u32 storm_col)
+{
+	struct amdxdna_dev *xdna = events->ndev->xdna;
+	u32 i;
+
+	for (i = 0; i < events->nr_sum; i++) {
+		struct aie2_err_sum *sum = &events->sum[i];
+		enum aie_error_category cat;
+
+		if (storm_col & BIT(sum->col)) {
+			events->suppressed += sum->cnt;
+			continue;
+		}
+
+		cat = aie_get_error_category(sum->row, sum->event_id, sum->mod_type);
+		XDNA_ERR(xdna, "Row: %d, Col: %d, module %d, event ID %d, category %d, count %d",
+			 sum->row, sum->col, sum->mod_type, sum->event_id, cat, sum->cnt);
+	}
+	events->nr_sum = 0;
+}
+
+static u32 aie2_error_event_handle(struct async_event *e)
+{
+	struct amdxdna_dev *xdna = e->ndev->xdna;
+	struct aie_err_info *info;
+	u32 max_err;
+
+	print_hex_dump_debug("AIE error: ", DUMP_PREFIX_OFFSET, 16, 4,
+			     e->buf, 0x100, false);
+
+	info = (struct aie_err_info *)e->buf;
+	XDNA_DBG(xdna, "Error count %d return code %d", info->err_cnt, info->ret_code);
+
+	max_err = (e->size - sizeof(*info)) / sizeof(struct aie_error);
+	if (unlikely(info->err_cnt > max_err)) {
+		WARN_ONCE(1, "Error count too large %d\n", info->err_cnt);
+		return 0;
+	}
+	return aie2_error_backtrack(e->ndev->async_events, info->payload, info->err_cnt);
+}
+
 static int aie2_error_async_cb(void *handle, void __iomem *data, size_t size)
 {
 	struct async_event *e = handle;
@@ -215,7 +313,7 @@ static int aie2_error_async_cb(void *handle, void __iomem *data, size_t size)
 		wmb(); /* Update status in the end, so that no lock for here */
 		e->resp.status = readl(data + offsetof(struct async_event_msg_resp, status));
 	}
-	queue_work(e->wq, &e->work);
+	queue_work(e->ndev->async_events->wq, &e->ndev->async_events->work);
 	return 0;
 }
 
@@ -226,45 +324,84 @@ static int aie2_error_event_send(struct async_event *e)
 					    aie2_error_async_cb);
 }
 
-static void aie2_error_worker(struct work_struct *err_work)
+static void aie2_error_rearm(struct async_events *events)
 {
-	struct aie_err_info *info;
-	struct amdxdna_dev *xdna;
+	struct amdxdna_dev_hdl *ndev = events->ndev;
 	struct async_event *e;
-	u32 max_err;
-	u32 err_col;
+	int i;
 
-	e = container_of(err_work, struct async_event, work);
+	mutex_lock(&ndev->aie2_lock);
+	for (i = 0; i < events->event_cnt; i++) {
+		e = &events->event[i];
+		if (!e->rearm)
+			continue;
 
-	xdna = e->ndev->xdna;
+		e->rearm = false;
+		/* Re-sent this event to firmware */
+		if (aie2_error_event_send(e))
+			XDNA_WARN(ndev->xdna, "Unable to register async event");
+	}
+	mutex_unlock(&ndev->aie2_lock);
+}
 
-	if (e->resp.status == MAX_AIE2_STATUS_CODE)
-		return;
+static void aie2_error_rearm_work(struct work_struct *work)
+{
+	struct async_events *events;
 
-	e->resp.status = MAX_AIE2_STATUS_CODE;
+	events = container_of(to_delayed_work(work), struct async_events, rearm_work);
+	aie2_error_rearm(events);
+}
 
-	print_hex_dump_debug("AIE error: ", DUMP_PREFIX_OFFSET, 16, 4,
-			     e->buf, 0x100, false);
+static void aie2_error_worker(struct work_struct *err_work)
+{
+	struct async_events *events;
+	struct amdxdna_dev *xdna;
+	struct async_event *e;
+	u32 storm_col = 0;
+	u32 err_col = 0;
+	u32 handled = 0;
+	int i;
 
-	info = (struct aie_err_info *)e->buf;
-	XDNA_DBG(xdna, "Error count %d return code %d", info->err_cnt, info->ret_code);
+	events = container_of(err_work, struct async_events, work);
+	xdna = events->ndev->xdna;
 
-	max_err = (e->size - sizeof(*info)) / sizeof(struct aie_error);
-	if (unlikely(info->err_cnt > max_err)) {
-		WARN_ONCE(1, "Error count too large %d\n", info->err_cnt);
+	for (i = 0; i < events->event_cnt; i++) {
+		e = &events->event[i];
+		if (READ_ONCE(e->resp.status) == MAX_AIE2_STATUS_CODE)
+			continue;
+
+		e->resp.status = MAX_AIE2_STATUS_CODE;
+		err_col |= aie2_error_event_handle(e);
+		e->rearm = true;
+		handled++;
+	}
+	if (!handled)
 		return;
+
+	for (i = 0; i < AIE2_ERR_MAX_COLS; i++) {
+		if ((err_col & BIT(i)) && !__ratelimit(&events->col_rs[i]))
+			storm_col |= BIT(i);
 	}
-	err_col = aie2_error_backtrack(e->ndev, info->payload, info->err_cnt);
-	if (!err_col) {
+	aie2_error_summary(events, storm_col);
+
+	if (err_col) {
+		/* Contexts on the faulted columns can not make progress anymore */
+		aie2_rq_reset_cols(&events->ndev->ctx_rq, err_col);
+	} else {
 		XDNA_WARN(xdna, "Did not get error column");
-		return;
 	}
 
-	mutex_lock(&xdna->dev_handle->aie2_lock);
-	/* Re-sent this event to firmware */
-	if (aie2_error_event_send(e))
-		XDNA_WARN(xdna, "Unable to register async event");
-	mutex_unlock(&xdna->dev_handle->aie2_lock);
+	if (delayed_work_pending(&events->rearm_work))
+		return;
+	if (storm_col) {
+		XDNA_WARN(xdna, "Error storm on columns 0x%x, %llu errors not logged",
+			  storm_col, events->suppressed);
+		events->suppressed = 0;
+		queue_delayed_work(events->wq, &events->rearm_work,
+				   msecs_to_jiffies(READ_ONCE(aie2_error_storm_delay_ms)));
+		return;
+	}
+	aie2_error_rearm(events);
 }
 
 int aie2_error_async_events_send(struct amdxdna_dev_hdl *ndev)
@@ -276,6 +413,8 @@ int aie2_error_async_events_send(struct amdxdna_dev_hdl *ndev)
 	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
 	for (i = 0; i < ndev->async_events->event_cnt; i++) {
 		e = &ndev->async_events->event[i];
+		/* All are registered, nothing left for aie2_error_rearm() */
+		e->rearm = false;
 		ret = aie2_error_event_send(e);
 		if (ret)
 			return ret;
@@ -291,6 +430,8 @@ void aie2_error_async_events_free(struct amdxdna_dev_hdl *ndev)
 
 	drm_WARN_ON(&xdna->ddev, mutex_is_locked(&ndev->aie2_lock));
 	events = ndev->async_events;
+	cancel_work_sync(&events->work);
+	cancel_delayed_work_sync(&events->rearm_work);
 	destroy_workqueue(events->wq);
 
 	dma_free_noncoherent(xdna->ddev.dev, events->size, events->buf,
@@ -325,17 +466,23 @@ int aie2_error_async_events_alloc(struct amdxdna_dev_hdl *ndev)
 		goto free_buf;
 	}
 
+	events->ndev = ndev;
+	INIT_WORK(&events->work, aie2_error_worker);
+	INIT_DELAYED_WORK(&events->rearm_work, aie2_error_rearm_work);
+	for (i = 0; i < AIE2_ERR_MAX_COLS; i++) {
+		ratelimit_state_init(&events->col_rs[i], HZ, AIE2_ERR_COL_BURST);
+		ratelimit_set_flags(&events->col_rs[i], RATELIMIT_MSG_ON_RELEASE);
+	}
+
 	for (i = 0; i < events->event_cnt; i++) {
 		struct async_event *e = &events->event[i];
 		u32 offset = i * ASYNC_BUF_SIZE;
 
 		e->ndev = ndev;
-		e->wq = events->wq;
 		e->buf = &events->buf[offset];
 		e->addr = events->addr + offset;
 		e->size = ASYNC_BUF_SIZE;
 		e->resp.status = MAX_AIE2_STATUS_CODE;
-		INIT_WORK(&e->work, aie2_error_worker);
 	}
 
 	ndev->async_events = events;
@@ -6,12 +6,42 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/dma-mapping.h>
+#include <linux/math64.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
 #include <drm/drm_cache.h>
 #include "aie2_msg_priv.h"
 #include "aie2_pci.h"
 #include "amdxdna_trace.h"
 #include "amdxdna_mailbox.h"
 
+struct event_trace_ring_hdr;
+
+/*
+ * Maps firmware ticks to CLOCK_MONOTONIC ns, the clock of the job stage
+ * time stamps. Anchored when tracing starts and re-anchored once per
+ * calibration window, see event_trace_clock_sample().
+ */
+struct event_trace_clock {
+	u64 fw_base;		/* Firmware counter at host_base */
+	u64 host_base;		/* ns */
+	u64 mult;		/* ns per firmware tick, 32.32 fixed point */
+	/* Lowest host - firmware offset seen in the current window */
+	u64 win_start;
+	s64 win_min;
+	u64 win_fw;
+	u64 win_host;
+	/* Lowest offset point of the previous window */
+	u64 ref_fw;
+	u64 ref_host;
+};
+
+#define EVENT_TRACE_FW_HZ	24000000ULL
+#define EVENT_TRACE_NOMINAL_MULT	(((u64)NSEC_PER_SEC << 32) / EVENT_TRACE_FW_HZ)
+/* Largest tick rate correction trusted, anything beyond is a bad sample */
+#define EVENT_TRACE_MAX_PPM	500
+#define EVENT_TRACE_CALIB_NS	NSEC_PER_SEC
+
 struct event_trace_req_buf {
 	struct amdxdna_dev_hdl   *ndev;
 	struct workqueue_struct  *wq;
@@ -19,14 +49,46 @@ struct event_trace_req_buf {
 	u8                       *kern_log_buf;
 	u8                       *buf;
 	u64                      dram_buffer_address;
-	u64                      resp_timestamp;
-	u64                      sys_start_time;
+	struct event_trace_clock clk;
 	u32                      dram_buffer_size;
 	u32			 msi_address;
 	int                      log_ch_irq;
 	bool                     enabled;
+	/* Ring mapped by the event_trace_ring reader, NULL if not opened */
+	struct mutex             ring_lock;
+	wait_queue_head_t        ring_wq;
+	struct event_trace_ring_hdr *ring;
+};
+
+/*
+ * Layout of the event_trace_ring debugfs file mapping. The first page is
+ * this header, the data ring of size bytes follows at the second page.
+ * head and tail only grow, a byte count modulo size is its data offset.
+ * Driver advances head, reader advances tail once it is done with the
+ * entries. Entries are struct trace_event_log_data. Firmware ticks convert
+ * to CLOCK_MONOTONIC ns as
+ *   clk_host_ns + ((counter - clk_fw_base) * clk_mult >> 32)
+ * where counter may be below clk_fw_base. The driver re-anchors these as it
+ * corrects drift, the latest values are valid for all entries in the ring.
+ * (counter - fw_timestamp) / 24 + sys_start_us is the same anchor at the
+ * nominal rate, in us.
+ */
+struct event_trace_ring_hdr {
+	u64 head;
+	u64 tail;
+	u64 dropped;
+	u64 fw_timestamp;
+	u64 sys_start_us;
+	u32 size;
+	u32 entry_size;
+	u64 clk_fw_base;
+	u64 clk_host_ns;
+	u64 clk_mult;
 };
 
+#define EVENT_TRACE_RING_SIZE	SZ_256K
+#define ring_data(hdr)		((u8 *)(hdr) + PAGE_SIZE)
+
 struct trace_event_metadata {
 	u64 tail_offset;
 	u64 head_offset;
@@ -40,6 +102,67 @@ struct trace_event_log_data {
 	u32 payload_low;
 };
 
+static void event_trace_clock_init(struct event_trace_clock *clk, u64 fw, u64 host)
+{
+	clk->fw_base = fw;
+	clk->host_base = host;
+	clk->mult = EVENT_TRACE_NOMINAL_MULT;
+	clk->win_start = host;
+	clk->win_min = S64_MAX;
+	clk->ref_fw = fw;
+	clk->ref_host = host;
+}
+
+static u64 event_trace_fw_to_ns(const struct event_trace_clock *clk, u64 fw)
+{
+	if (fw >= clk->fw_base)
+		return clk->host_base + mul_u64_u64_shr(fw - clk->fw_base, clk->mult, 32);
+	return clk->host_base - mul_u64_u64_shr(clk->fw_base - fw, clk->mult, 32);
+}
+
+/*
+ * Feed the newest entry of a batch and the host time right after it was
+ * copied out. The entry happened before the copy, so the offset of the
+ * pair is delivery latency plus drift so far. The lowest offset of a
+ * window is the pair closest to the true mapping; the slope between two
+ * such pairs is the tick rate. At the end of each window the mapping is
+ * re-anchored at that pair without a jump, except that it is pulled back
+ * if events would land after their copy.
+ */
+static void event_trace_clock_sample(struct event_trace_clock *clk, u64 fw, u64 host)
+{
+	s64 off = host - event_trace_fw_to_ns(clk, fw);
+	u64 mult = clk->mult;
+
+	if (off < clk->win_min) {
+		clk->win_min = off;
+		clk->win_fw = fw;
+		clk->win_host = host;
+	}
+	if (host - clk->win_start < EVENT_TRACE_CALIB_NS)
+		return;
+
+	if (clk->win_fw > clk->ref_fw && clk->win_host > clk->ref_host) {
+		u64 tol = EVENT_TRACE_NOMINAL_MULT * EVENT_TRACE_MAX_PPM / 1000000;
+
+		mult = mul_u64_u64_div_u64(clk->win_host - clk->ref_host, 1ULL << 32,
+					   clk->win_fw - clk->ref_fw);
+		mult = clamp_t(u64, mult, EVENT_TRACE_NOMINAL_MULT - tol,
+			       EVENT_TRACE_NOMINAL_MULT + tol);
+	}
+
+	clk->host_base = event_trace_fw_to_ns(clk, clk->win_fw);
+	if (clk->win_min < 0)
+		clk->host_base += clk->win_min;
+	clk->fw_base = clk->win_fw;
+	clk->mult = mult;
+
+	clk->ref_fw = clk->win_fw;
+	clk->ref_host = clk->win_host;
+	clk->win_start = host;
+	clk->win_min = S64_MAX;
+}
+
 static void clear_event_trace_msix(struct amdxdna_dev_hdl *ndev)
 {
 	u64 iohub_ptr = ndev->event_trace_req->msi_address;
@@ -98,15 +221,54 @@ static u32 aie2_get_trace_event_content(struct event_trace_req_buf *trace_req_bu
 	return total_log_size;
 }
 
+/* Returns false if there is no reader, the entries are logged instead */
+static bool aie2_event_trace_ring_push(struct event_trace_req_buf *req_buf, u32 size)
+{
+	struct event_trace_ring_hdr *hdr;
+	u64 head, used;
+	u32 off, len;
+
+	mutex_lock(&req_buf->ring_lock);
+	hdr = req_buf->ring;
+	if (!hdr) {
+		mutex_unlock(&req_buf->ring_lock);
+		return false;
+	}
+
+	head = hdr->head;
+	/* tail is written by the reader, do not trust it */
+	used = min_t(u64, head - READ_ONCE(hdr->tail), EVENT_TRACE_RING_SIZE);
+	len = min_t(u64, size, EVENT_TRACE_RING_SIZE - used);
+	len = rounddown(len, MAX_ONE_TIME_LOG_INFO_LEN);
+	hdr->dropped += (size - len) / MAX_ONE_TIME_LOG_INFO_LEN;
+	hdr->fw_timestamp = req_buf->clk.fw_base;
+	hdr->sys_start_us = div_u64(req_buf->clk.host_base, NSEC_PER_USEC);
+	hdr->clk_fw_base = req_buf->clk.fw_base;
+	hdr->clk_host_ns = req_buf->clk.host_base;
+	hdr->clk_mult = req_buf->clk.mult;
+
+	off = head & (EVENT_TRACE_RING_SIZE - 1);
+	size = min_t(u32, len, EVENT_TRACE_RING_SIZE - off);
+	memcpy(ring_data(hdr) + off, req_buf->kern_log_buf, size);
+	memcpy(ring_data(hdr), req_buf->kern_log_buf + size, len - size);
+	smp_wmb(); /* Entries before head */
+	WRITE_ONCE(hdr->head, head + len);
+	mutex_unlock(&req_buf->ring_lock);
+
+	wake_up_interruptible(&req_buf->ring_wq);
+	return true;
+}
+
 static void aie2_print_trace_event_log(struct amdxdna_dev_hdl *ndev)
 {
 	struct event_trace_req_buf *trace_req_buf;
 	struct trace_event_log_data *log_content;
-	u64 payload;
+	u64 payload, now;
 	u32 log_size;
 
 	trace_req_buf = ndev->event_trace_req;
 	log_size = aie2_get_trace_event_content(trace_req_buf);
+	now = ktime_get_ns();
 	XDNA_DBG(ndev->xdna, "FW log size in bytes %u", log_size);
 
 	if (!log_size) {
@@ -114,19 +276,37 @@ static void aie2_print_trace_event_log(struct amdxdna_dev_hdl *ndev)
 		return;
 	}
 
+	if (log_size >= MAX_ONE_TIME_LOG_INFO_LEN) {
+		log_content = (struct trace_event_log_data *)
+			(trace_req_buf->kern_log_buf + log_size - MAX_ONE_TIME_LOG_INFO_LEN);
+		event_trace_clock_sample(&trace_req_buf->clk, log_content->counter, now);
+	}
+
 	char *str = (char *)trace_req_buf->kern_log_buf;
 	char *end = str + log_size;
-	u64 fwTicks;
+	u64 ts;
+
+	if (trace_xdna_fw_event_enabled()) {
+		for (; str < end; str += MAX_ONE_TIME_LOG_INFO_LEN) {
+			log_content = (struct trace_event_log_data *)str;
+			payload = ((u64)log_content->payload_hi << 32) | log_content->payload_low;
+			ts = event_trace_fw_to_ns(&trace_req_buf->clk, log_content->counter);
+			trace_xdna_fw_event(ts, log_content->type, payload);
+		}
+		str = (char *)trace_req_buf->kern_log_buf;
+	}
+
+	if (aie2_event_trace_ring_push(trace_req_buf, log_size))
+		return;
 
 	trace_req_buf->kern_log_buf[log_size] = 0;
 
 	while (str < end) {
 		log_content = (struct trace_event_log_data *)str;
 		payload = ((u64)log_content->payload_hi << 32) | log_content->payload_low;
-		fwTicks = log_content->counter - trace_req_buf->resp_timestamp;
-		fwTicks = fwTicks / 24 + ndev->event_trace_req->sys_start_time;
+		ts = event_trace_fw_to_ns(&trace_req_buf->clk, log_content->counter);
 		pr_debug("[NPU]::[%llu] type: 0x%04x payload:0x%016llx",
-			 fwTicks, log_content->type, payload);
+			 div_u64(ts, NSEC_PER_USEC), log_content->type, payload);
 		str += MAX_ONE_TIME_LOG_INFO_LEN;
 	}
 }
@@ -332,16 +512,14 @@ bool aie2_is_event_trace_enable(struct amdxdna_dev_hdl *ndev)
 
 void aie2_set_trace_timestamp(struct amdxdna_dev_hdl *ndev,  struct start_event_trace_resp *resp)
 {
-	ndev->event_trace_req->resp_timestamp = resp->current_timestamp;
-	ndev->event_trace_req->sys_start_time = ktime_get_ns() / 1000; /*Convert ns to us*/
+	event_trace_clock_init(&ndev->event_trace_req->clk, resp->current_timestamp,
+			       ktime_get_ns());
 	ndev->event_trace_req->msi_address = resp->msi_address & 0x00FFFFFF;
 	aie2_register_log_buf_irq_hdl(ndev, resp->msi_idx);
 }
 
 void aie2_unset_trace_timestamp(struct amdxdna_dev_hdl *ndev)
 {
-	ndev->event_trace_req->resp_timestamp = 0;
-	ndev->event_trace_req->sys_start_time = 0;
 	aie2_deregister_log_buf_irq_hdl(ndev);
 }
 
@@ -362,6 +540,8 @@ int aie2_event_trace_init(struct amdxdna_dev_hdl *ndev)
 
 	req_buf->ndev = ndev;
 	req_buf->enabled = false;
+	mutex_init(&req_buf->ring_lock);
+	init_waitqueue_head(&req_buf->ring_wq);
 	ndev->event_trace_req = req_buf;
 
 	return 0;
@@ -375,6 +555,78 @@ void aie2_event_trace_fini(struct amdxdna_dev_hdl *ndev)
 	if (aie2_is_event_trace_enable(ndev))
 		aie2_assign_event_trace_state(ndev, false);
 
+	mutex_destroy(&ndev->event_trace_req->ring_lock);
 	kfree(ndev->event_trace_req);
 	ndev->event_trace_req = NULL;
 }
+
+/* Only one reader, it owns the tail */
+int aie2_event_trace_ring_open(struct amdxdna_dev_hdl *ndev)
+{
+	struct event_trace_req_buf *req_buf = ndev->event_trace_req;
+	struct event_trace_ring_hdr *hdr;
+	int ret = 0;
+
+	if (!req_buf)
+		return -ENODEV;
+
+	hdr = vmalloc_user(PAGE_SIZE + EVENT_TRACE_RING_SIZE);
+	if (!hdr)
+		return -ENOMEM;
+
+	hdr->size = EVENT_TRACE_RING_SIZE;
+	hdr->entry_size = MAX_ONE_TIME_LOG_INFO_LEN;
+
+	mutex_lock(&req_buf->ring_lock);
+	if (req_buf->ring) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+	req_buf->ring = hdr;
+	hdr = NULL;
+unlock:
+	mutex_unlock(&req_buf->ring_lock);
+	vfree(hdr);
+	return ret;
+}
+
+void aie2_event_trace_ring_release(struct amdxdna_dev_hdl *ndev)
+{
+	struct event_trace_req_buf *req_buf = ndev->event_trace_req;
+	struct event_trace_ring_hdr *hdr;
+
+	mutex_lock(&req_buf->ring_lock);
+	hdr = req_buf->ring;
+	req_buf->ring = NULL;
+	mutex_unlock(&req_buf->ring_lock);
+	vfree(hdr);
+}
+
+int aie2_event_trace_ring_mmap(struct amdxdna_dev_hdl *ndev, struct vm_area_struct *vma)
+{
+	struct event_trace_req_buf *req_buf = ndev->event_trace_req;
+	int ret;
+
+	mutex_lock(&req_buf->ring_lock);
+	ret = remap_vmalloc_range(vma, req_buf->ring, vma->vm_pgoff);
+	mutex_unlock(&req_buf->ring_lock);
+	return ret;
+}
+
+__poll_t aie2_event_trace_ring_poll(struct amdxdna_dev_hdl *ndev, struct file *file,
+				    poll_table *wait)
+{
+	struct event_trace_req_buf *req_buf = ndev->event_trace_req;
+	struct event_trace_ring_hdr *hdr;
+	__poll_t mask = 0;
+
+	poll_wait(file, &req_buf->ring_wq, wait);
+
+	mutex_lock(&req_buf->ring_lock);
+	hdr = req_buf->ring;
+	if (hdr && READ_ONCE(hdr->head) != READ_ONCE(hdr->tail))
+		mask = EPOLLIN | EPOLLRDNORM;
+	mutex_unlock(&req_buf->ring_lock);
+
+	return mask;
+}
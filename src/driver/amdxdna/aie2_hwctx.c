@@ -15,19 +15,28 @@
 
 extern const struct drm_sched_backend_ops sched_ops;
 
-static int aie2_alloc_resource(struct amdxdna_ctx *ctx)
+/*
+ * Run queue has picked the partition. Start columns of the context inside it
+ * go to the solver as candidates, it picks one. cols holds col_list_len + 1
+ * entries, or is NULL when no columns are to be allocated.
+ */
+static void aie2_fill_xrs_req(struct amdxdna_ctx *ctx, struct alloc_requests *xrs_req,
+			      u32 *cols)
 {
-	struct alloc_requests *xrs_req;
-	struct amdxdna_dev *xdna;
-	int ret;
-
-	xdna = ctx->client->xdna;
-	xrs_req = kzalloc(sizeof(*xrs_req), GFP_KERNEL);
-	if (!xrs_req)
-		return -ENOMEM;
+	u32 last = ctx->priv->place_end_col + 1 - ctx->num_col;
+	u32 col, n = 0;
+	int i;
+
+	for (i = 0; cols && i < ctx->col_list_len; i++) {
+		col = ctx->col_list[i];
+		if (col >= ctx->start_col && col <= last)
+			cols[n++] = col;
+	}
+	if (cols && !n)
+		cols[n++] = ctx->start_col;
 
-	xrs_req->cdo.start_cols = ctx->col_list;
-	xrs_req->cdo.cols_len = ctx->col_list_len;
+	xrs_req->cdo.start_cols = cols;
+	xrs_req->cdo.cols_len = n;
 	xrs_req->cdo.ncols = ctx->num_col;
 	xrs_req->cdo.qos_cap.opc = ctx->max_opc;
 
@@ -39,10 +48,30 @@ static int aie2_alloc_resource(struct amdxdna_ctx *ctx)
 	xrs_req->rqos.priority = ctx->qos.priority;
 
 	xrs_req->rid = (uintptr_t)ctx;
+}
 
-	ret = xrs_allocate_resource(xdna->dev_handle->xrs_hdl, xrs_req, ctx);
-	if (ret)
+static int aie2_alloc_resource(struct amdxdna_ctx *ctx)
+{
+	struct {
+		struct alloc_requests	req;
+		u32			cols[];
+	} *xrs_req;
+	struct amdxdna_dev *xdna;
+	int ret;
+
+	xdna = ctx->client->xdna;
+	xrs_req = kzalloc(struct_size(xrs_req, cols, ctx->col_list_len + 1), GFP_KERNEL);
+	if (!xrs_req)
+		return -ENOMEM;
+
+	aie2_fill_xrs_req(ctx, &xrs_req->req, xrs_req->cols);
+	ret = xrs_allocate_resource(xdna->dev_handle->xrs_hdl, &xrs_req->req, ctx);
+	if (ret) {
 		XDNA_ERR(xdna, "Allocate AIE resource failed, ret %d", ret);
+	} else {
+		ctx->start_col = xrs_req->req.part.start_col;
+		ctx->num_col = xrs_req->req.part.ncols;
+	}
 
 	kfree(xrs_req);
 	return ret;
@@ -106,9 +135,15 @@ static int aie2_unload_hwctx(struct amdxdna_ctx *ctx)
 
 	xdna = ctx->client->xdna;
 	xdna_mailbox_stop_channel(ctx->priv->mbox_chann);
-	ret = aie2_destroy_context(xdna->dev_handle, ctx);
-	if (ret)
-		XDNA_ERR(xdna, "destroy context failed, ret %d", ret);
+	if (xdna->dev_handle->fw_stopping) {
+		/* Firmware context goes away with firmware */
+		ctx->priv->id = -1;
+		ret = 0;
+	} else {
+		ret = aie2_destroy_context(xdna->dev_handle, ctx);
+		if (ret)
+			XDNA_ERR(xdna, "destroy context failed, ret %d", ret);
+	}
 
 	/*
 	 * The DRM scheduler thread might still running.
@@ -118,21 +153,33 @@ static int aie2_unload_hwctx(struct amdxdna_ctx *ctx)
 	return ret;
 }
 
-int aie2_hwctx_start(struct amdxdna_ctx *ctx)
+/* Caller holds aie2_lock */
+int aie2_hwctx_map_heap(struct amdxdna_ctx *ctx, struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	u64 addr = heap->mem.userptr;
+	int ret;
+
+#ifdef AMDXDNA_DEVEL
+	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID)
+		addr = heap->mem.dma_addr;
+#endif
+	ret = aie2_map_host_buf(xdna->dev_handle, ctx->priv->id, addr, heap->mem.size);
+	if (ret)
+		XDNA_ERR(xdna, "Map host buffer 0x%llx failed, ret %d", heap->mem.dev_addr, ret);
+	return ret;
+}
+
+/* No firmware message, called before aie2_lock is taken */
+int aie2_hwctx_sched_init(struct amdxdna_ctx *ctx)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct drm_gpu_scheduler *sched;
-	struct amdxdna_gem_obj *heap;
-	struct amdxdna_dev_hdl *ndev;
 	int ret;
 
-	ndev = xdna->dev_handle;
 	sched = &ctx->priv->sched;
-	heap = ctx->priv->heap;
-
-	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
 	ret = drm_sched_init(sched, &sched_ops, NULL, DRM_SCHED_PRIORITY_COUNT,
-			     CTX_MAX_CMDS, 0, MAX_SCHEDULE_TIMEOUT,
+			     ctx->priv->num_cmds, 0, MAX_SCHEDULE_TIMEOUT,
 			     NULL, NULL, ctx->name, xdna->ddev.dev);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to init DRM scheduler. ret %d", ret);
@@ -143,13 +190,34 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 				    &sched, 1, NULL);
 	if (ret) {
 		XDNA_ERR(xdna, "Failed to initial sched entiry. ret %d", ret);
-		goto fini_sched;
+		drm_sched_fini(sched);
 	}
+	return ret;
+}
+
+/* Undo aie2_hwctx_sched_init() when aie2_hwctx_start() failed */
+void aie2_hwctx_sched_fini(struct amdxdna_ctx *ctx)
+{
+	drm_sched_entity_destroy(&ctx->priv->entity);
+	drm_sched_fini(&ctx->priv->sched);
+}
 
+int aie2_hwctx_start(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct amdxdna_gem_obj *heap;
+	struct amdxdna_dev_hdl *ndev;
+	u32 nr, i;
+	int ret;
+
+	ndev = xdna->dev_handle;
+	heap = ctx->priv->heap;
+
+	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
 	ret = aie2_alloc_resource(ctx);
 	if (ret) {
 		XDNA_ERR(xdna, "Alloc hw resource failed, ret %d", ret);
-		goto destroy_entity;
+		return ret;
 	}
 
 	ret = aie2_load_hwctx(ctx);
@@ -158,21 +226,19 @@ int aie2_hwctx_start(struct amdxdna_ctx *ctx)
 		goto release_resource;
 	}
 
-#ifdef AMDXDNA_DEVEL
-	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
-		ret = aie2_map_host_buf(xdna->dev_handle, ctx->priv->id,
-					heap->mem.dma_addr, heap->mem.size);
-		goto skip;
-	}
-#endif
-	ret = aie2_map_host_buf(xdna->dev_handle, ctx->priv->id,
-				heap->mem.userptr, heap->mem.size);
-#ifdef AMDXDNA_DEVEL
-skip:
-#endif
-	if (ret) {
-		XDNA_ERR(xdna, "Map host buffer failed, ret %d", ret);
+	ret = aie2_hwctx_map_heap(ctx, heap);
+	if (ret)
 		goto unload_hwctx;
+
+	/* Heap chunks grown so far, in device address order */
+	nr = smp_load_acquire(&ctx->client->nr_heap_chunks);
+	for (i = 1; i < nr; i++) {
+		heap = ctx->client->heap_chunks[i];
+		if (!heap->heap_mapped)
+			break;
+		ret = aie2_hwctx_map_heap(ctx, heap);
+		if (ret)
+			goto unload_hwctx;
 	}
 
 	ndev->hwctx_cnt++;
@@ -182,10 +248,29 @@ unload_hwctx:
 	aie2_unload_hwctx(ctx);
 release_resource:
 	aie2_release_resource(ctx);
-destroy_entity:
-	drm_sched_entity_destroy(&ctx->priv->entity);
-fini_sched:
-	drm_sched_fini(&ctx->priv->sched);
+	return ret;
+}
+
+/* Disconnected context picks up its QoS on next connect */
+int aie2_hwctx_update_qos(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct alloc_requests *xrs_req;
+	int ret;
+
+	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&xdna->dev_handle->aie2_lock));
+	xrs_req = kzalloc(sizeof(*xrs_req), GFP_KERNEL);
+	if (!xrs_req)
+		return -ENOMEM;
+
+	aie2_fill_xrs_req(ctx, xrs_req, NULL);
+	ret = xrs_update_qos(xdna->dev_handle->xrs_hdl, xrs_req);
+	if (ret == -ENODEV)
+		ret = 0;
+	else if (ret)
+		XDNA_ERR(xdna, "Update QoS failed, ret %d", ret);
+
+	kfree(xrs_req);
 	return ret;
 }
 
@@ -253,9 +338,15 @@ int aie2_xrs_unload_hwctx(struct amdxdna_ctx *ctx)
 
 	xdna = ctx->client->xdna;
 	xdna_mailbox_stop_channel(ctx->priv->mbox_chann);
-	ret = aie2_destroy_context(xdna->dev_handle, ctx);
-	if (ret)
-		XDNA_ERR(xdna, "destroy context failed, ret %d", ret);
+	if (xdna->dev_handle->fw_stopping) {
+		/* Firmware context goes away with firmware */
+		ctx->priv->id = -1;
+		ret = 0;
+	} else {
+		ret = aie2_destroy_context(xdna->dev_handle, ctx);
+		if (ret)
+			XDNA_ERR(xdna, "destroy context failed, ret %d", ret);
+	}
 
 	/*
 	 * The DRM scheduler thread might still running.
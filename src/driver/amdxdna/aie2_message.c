@@ -48,6 +48,39 @@ aie2_send_mgmt_msg_wait_offset(struct amdxdna_dev_hdl *ndev,
 	return ret;
 }
 
+static int
+aie2_send_mgmt_msgs_wait(struct amdxdna_dev_hdl *ndev,
+			 struct xdna_mailbox_msg **msgs, int cnt)
+{
+	struct amdxdna_dev *xdna = ndev->xdna;
+	struct xdna_notify *hdl;
+	int ret, i;
+
+	if (!ndev->mgmt_chann)
+		return -ENODEV;
+
+	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
+	ret = xdna_send_msg_wait_all(xdna, ndev->mgmt_chann, msgs, cnt);
+	if (ret == -ETIME) {
+		xdna_mailbox_stop_channel(ndev->mgmt_chann);
+		xdna_mailbox_destroy_channel(ndev->mgmt_chann);
+		ndev->mgmt_chann = NULL;
+	}
+	if (ret)
+		return ret;
+
+	for (i = 0; i < cnt; i++) {
+		hdl = msgs[i]->handle;
+		if (hdl->data[0] != AIE2_STATUS_SUCCESS) {
+			XDNA_ERR(xdna, "command opcode 0x%x failed, status 0x%x",
+				 msgs[i]->opcode, *hdl->data);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 int aie2_suspend_fw(struct amdxdna_dev_hdl *ndev)
 {
 	DECLARE_AIE2_MSG(suspend, MSG_OP_SUSPEND);
@@ -158,22 +191,69 @@ int aie2_assign_mgmt_pasid(struct amdxdna_dev_hdl *ndev, u16 pasid)
 	return aie2_send_mgmt_msg_wait(ndev, &msg);
 }
 
+static void aie2_parse_aie_version(struct amdxdna_dev_hdl *ndev,
+				   const struct aie_version_info_resp *resp,
+				   struct aie_version *version)
+{
+	XDNA_DBG(ndev->xdna, "Query AIE version - major: %u minor: %u completed",
+		 resp->major, resp->minor);
+
+	version->major = resp->major;
+	version->minor = resp->minor;
+}
+
+static void aie2_parse_aie_metadata(const struct aie_tile_info_resp *resp,
+				    struct aie_metadata *metadata)
+{
+	metadata->size = resp->info.size;
+	metadata->cols = resp->info.cols;
+	metadata->rows = resp->info.rows;
+
+	metadata->version.major = resp->info.major;
+	metadata->version.minor = resp->info.minor;
+
+	metadata->core.row_count = resp->info.core_rows;
+	metadata->core.row_start = resp->info.core_row_start;
+	metadata->core.dma_channel_count = resp->info.core_dma_channels;
+	metadata->core.lock_count = resp->info.core_locks;
+	metadata->core.event_reg_count = resp->info.core_events;
+
+	metadata->mem.row_count = resp->info.mem_rows;
+	metadata->mem.row_start = resp->info.mem_row_start;
+	metadata->mem.dma_channel_count = resp->info.mem_dma_channels;
+	metadata->mem.lock_count = resp->info.mem_locks;
+	metadata->mem.event_reg_count = resp->info.mem_events;
+
+	metadata->shim.row_count = resp->info.shim_rows;
+	metadata->shim.row_start = resp->info.shim_row_start;
+	metadata->shim.dma_channel_count = resp->info.shim_dma_channels;
+	metadata->shim.lock_count = resp->info.shim_locks;
+	metadata->shim.event_reg_count = resp->info.shim_events;
+}
+
+static void aie2_parse_firmware_version(struct amdxdna_dev_hdl *ndev,
+					const struct firmware_version_resp *resp,
+					struct amdxdna_fw_ver *fw_ver)
+{
+	fw_ver->major = resp->major;
+	fw_ver->minor = resp->minor;
+	fw_ver->sub = resp->sub;
+	fw_ver->build = resp->build;
+
+	XDNA_DBG(ndev->xdna, "FW version %d.%d.%d.%d", fw_ver->major,
+		 fw_ver->minor, fw_ver->sub, fw_ver->build);
+}
+
 int aie2_query_aie_version(struct amdxdna_dev_hdl *ndev, struct aie_version *version)
 {
 	DECLARE_AIE2_MSG(aie_version_info, MSG_OP_QUERY_AIE_VERSION);
-	struct amdxdna_dev *xdna = ndev->xdna;
 	int ret;
 
 	ret = aie2_send_mgmt_msg_wait(ndev, &msg);
 	if (ret)
 		return ret;
 
-	XDNA_DBG(xdna, "Query AIE version - major: %u minor: %u completed",
-		 resp.major, resp.minor);
-
-	version->major = resp.major;
-	version->minor = resp.minor;
-
+	aie2_parse_aie_version(ndev, &resp, version);
 	return 0;
 }
 
@@ -186,31 +266,7 @@ int aie2_query_aie_metadata(struct amdxdna_dev_hdl *ndev, struct aie_metadata *m
 	if (ret)
 		return ret;
 
-	metadata->size = resp.info.size;
-	metadata->cols = resp.info.cols;
-	metadata->rows = resp.info.rows;
-
-	metadata->version.major = resp.info.major;
-	metadata->version.minor = resp.info.minor;
-
-	metadata->core.row_count = resp.info.core_rows;
-	metadata->core.row_start = resp.info.core_row_start;
-	metadata->core.dma_channel_count = resp.info.core_dma_channels;
-	metadata->core.lock_count = resp.info.core_locks;
-	metadata->core.event_reg_count = resp.info.core_events;
-
-	metadata->mem.row_count = resp.info.mem_rows;
-	metadata->mem.row_start = resp.info.mem_row_start;
-	metadata->mem.dma_channel_count = resp.info.mem_dma_channels;
-	metadata->mem.lock_count = resp.info.mem_locks;
-	metadata->mem.event_reg_count = resp.info.mem_events;
-
-	metadata->shim.row_count = resp.info.shim_rows;
-	metadata->shim.row_start = resp.info.shim_row_start;
-	metadata->shim.dma_channel_count = resp.info.shim_dma_channels;
-	metadata->shim.lock_count = resp.info.shim_locks;
-	metadata->shim.event_reg_count = resp.info.shim_events;
-
+	aie2_parse_aie_metadata(&resp, metadata);
 	return 0;
 }
 
@@ -224,14 +280,33 @@ int aie2_query_firmware_version(struct amdxdna_dev_hdl *ndev,
 	if (ret)
 		return ret;
 
-	fw_ver->major = resp.major;
-	fw_ver->minor = resp.minor;
-	fw_ver->sub = resp.sub;
-	fw_ver->build = resp.build;
+	aie2_parse_firmware_version(ndev, &resp, fw_ver);
+	return 0;
+}
 
-	XDNA_DBG(ndev->xdna, "FW version %d.%d.%d.%d", fw_ver->major,
-		 fw_ver->minor, fw_ver->sub, fw_ver->build);
+int aie2_query_fw_info(struct amdxdna_dev_hdl *ndev, struct amdxdna_fw_ver *fw_ver,
+		       struct aie_version *version, struct aie_metadata *metadata)
+{
+	DECLARE_XDNA_MSG_NAMED(firmware_version, MSG_OP_GET_FIRMWARE_VERSION,
+			       MAX_AIE2_STATUS_CODE);
+	DECLARE_XDNA_MSG_NAMED(aie_version_info, MSG_OP_QUERY_AIE_VERSION,
+			       MAX_AIE2_STATUS_CODE);
+	DECLARE_XDNA_MSG_NAMED(aie_tile_info, MSG_OP_QUERY_AIE_TILE_INFO,
+			       MAX_AIE2_STATUS_CODE);
+	struct xdna_mailbox_msg *msgs[] = {
+		&firmware_version_msg,
+		&aie_version_info_msg,
+		&aie_tile_info_msg,
+	};
+	int ret;
+
+	ret = aie2_send_mgmt_msgs_wait(ndev, msgs, ARRAY_SIZE(msgs));
+	if (ret)
+		return ret;
 
+	aie2_parse_firmware_version(ndev, &firmware_version_resp, fw_ver);
+	aie2_parse_aie_version(ndev, &aie_version_info_resp, version);
+	aie2_parse_aie_metadata(&aie_tile_info_resp, metadata);
 	return 0;
 }
 
@@ -456,48 +531,109 @@ int aie2_register_asyn_event_msg(struct amdxdna_dev_hdl *ndev, dma_addr_t addr,
 	return xdna_mailbox_send_msg(ndev->mgmt_chann, &msg, TX_TIMEOUT);
 }
 
-/* Below messages are to hardware context mailbox channel */
-int aie2_config_cu(struct amdxdna_ctx *ctx)
+static int aie2_get_cu_bos(struct amdxdna_ctx *ctx)
 {
-	struct mailbox_channel *chann = ctx->priv->mbox_chann;
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	u32 shift = xdna->dev_info->dev_mem_buf_shift;
-	DECLARE_AIE2_MSG(config_cu, MSG_OP_CONFIG_CU);
-	struct drm_gem_object *gobj;
+	int num_cus = ctx->cus->num_cus;
+	struct drm_gem_object **bos;
 	struct amdxdna_gem_obj *abo;
+	u32 *cfgs;
 	int ret, i;
 
-	if (!chann)
-		return -ENODEV;
-
-	if (ctx->cus->num_cus > MAX_NUM_CUS) {
-		XDNA_DBG(xdna, "Exceed maximum CU %d", MAX_NUM_CUS);
-		return -EINVAL;
+	bos = kcalloc(num_cus, sizeof(*bos), GFP_KERNEL);
+	cfgs = kcalloc(num_cus, sizeof(*cfgs), GFP_KERNEL);
+	if (!bos || !cfgs) {
+		ret = -ENOMEM;
+		goto free;
 	}
 
-	for (i = 0; i < ctx->cus->num_cus; i++) {
+	for (i = 0; i < num_cus; i++) {
 		struct amdxdna_cu_config *cu = &ctx->cus->cu_configs[i];
 
-		gobj = drm_gem_object_lookup(ctx->client->filp, cu->cu_bo);
-		if (!gobj) {
+		bos[i] = drm_gem_object_lookup(ctx->client->filp, cu->cu_bo);
+		if (!bos[i]) {
 			XDNA_ERR(xdna, "Lookup GEM object failed");
-			return -EINVAL;
+			ret = -EINVAL;
+			goto put_bos;
 		}
-		abo = to_xdna_obj(gobj);
+		abo = to_xdna_obj(bos[i]);
 
 		if (abo->type != AMDXDNA_BO_DEV) {
-			drm_gem_object_put(gobj);
 			XDNA_ERR(xdna, "Invalid BO type");
-			return -EINVAL;
+			ret = -EINVAL;
+			goto put_bos;
 		}
 
-		req.cfgs[i] = FIELD_PREP(AIE2_MSG_CFG_CU_PDI_ADDR,
-					 abo->mem.dev_addr >> shift);
-		req.cfgs[i] |= FIELD_PREP(AIE2_MSG_CFG_CU_FUNC, cu->cu_func);
+		cfgs[i] = FIELD_PREP(AIE2_MSG_CFG_CU_PDI_ADDR,
+				     abo->mem.dev_addr >> shift);
+		cfgs[i] |= FIELD_PREP(AIE2_MSG_CFG_CU_FUNC, cu->cu_func);
 		XDNA_DBG(xdna, "CU %d full addr 0x%llx, cfg 0x%x", i,
-			 abo->mem.dev_addr, req.cfgs[i]);
-		drm_gem_object_put(gobj);
+			 abo->mem.dev_addr, cfgs[i]);
+	}
+
+	ctx->priv->cu_bos = bos;
+	ctx->priv->cu_cfgs = cfgs;
+	return 0;
+
+put_bos:
+	for (i = 0; i < num_cus; i++) {
+		if (bos[i])
+			drm_gem_object_put(bos[i]);
 	}
+free:
+	kfree(cfgs);
+	kfree(bos);
+	return ret;
+}
+
+void aie2_put_cu_bos(struct amdxdna_ctx *ctx)
+{
+	int i;
+
+	if (!ctx->priv->cu_bos)
+		return;
+
+	for (i = 0; i < ctx->cus->num_cus; i++)
+		drm_gem_object_put(ctx->priv->cu_bos[i]);
+	kfree(ctx->priv->cu_bos);
+	kfree(ctx->priv->cu_cfgs);
+	ctx->priv->cu_bos = NULL;
+	ctx->priv->cu_cfgs = NULL;
+}
+
+/* Below messages are to hardware context mailbox channel */
+int aie2_config_cu(struct amdxdna_ctx *ctx)
+{
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	DECLARE_AIE2_MSG(config_cu, MSG_OP_CONFIG_CU);
+	int ret;
+
+	if (!chann)
+		return -ENODEV;
+
+	if (ctx->cus->num_cus > MAX_NUM_CUS) {
+		XDNA_DBG(xdna, "Exceed maximum CU %d", MAX_NUM_CUS);
+		return -EINVAL;
+	}
+
+	/*
+	 * CU BOs are held from first connect till context is destroyed, so the
+	 * request built then is still valid on reconnect.
+	 *
+	 * The message itself can't be skipped, even when the same PDIs were
+	 * loaded on the columns before. Every connect creates a new firmware
+	 * context, firmware drops CU config with DESTROY_CONTEXT and has no way
+	 * to adopt what a previous context left on the columns.
+	 */
+	if (!ctx->priv->cu_cfgs) {
+		ret = aie2_get_cu_bos(ctx);
+		if (ret)
+			return ret;
+	}
+	memcpy(req.cfgs, ctx->priv->cu_cfgs, ctx->cus->num_cus * sizeof(u32));
+
 	req.num_cus = ctx->cus->num_cus;
 
 	ret = xdna_send_msg_wait(xdna, chann, &msg);
@@ -517,22 +653,74 @@ int aie2_config_cu(struct amdxdna_ctx *ctx)
 	return ret;
 }
 
+/*
+ * Requests are built in the mailbox ring buffer. Payload beyond what command
+ * provides is cleared, ring buffer has stale data from previous messages.
+ */
+static void aie2_execbuf_copy_payload(void __iomem *dst, size_t dst_size,
+				      const void *src, size_t src_size)
+{
+	size_t len = min(dst_size, src_size);
+
+	memcpy_toio(dst, src, len);
+	if (len < dst_size)
+		memset_io(dst + len, 0, dst_size - len);
+}
+
+static void aie2_execbuf_write64(u64 val, void __iomem *addr)
+{
+	writel(lower_32_bits(val), addr);
+	writel(upper_32_bits(val), addr + sizeof(u32));
+}
+
+/*
+ * Firmware loads the PDI of a command's CU if it differs from the one used
+ * by the previous command on the hwctx. CUs sharing a PDI BO need no load.
+ * A new hwctx has none loaded.
+ */
+static void aie2_track_pdi(struct amdxdna_ctx *ctx, int cu_idx)
+{
+	struct amdxdna_ctx_priv *priv = ctx->priv;
+	u32 pdi = cu_idx;
+
+	if (priv->cu_cfgs && cu_idx < ctx->cus->num_cus)
+		pdi = FIELD_GET(AIE2_MSG_CFG_CU_PDI_ADDR, priv->cu_cfgs[cu_idx]);
+	if (priv->cur_pdi == pdi)
+		return;
+
+	priv->cur_pdi = pdi;
+	WRITE_ONCE(priv->pdi_loads, priv->pdi_loads + 1);
+}
+
+/*
+ * Arguments of ERT_START_CU beyond the mailbox message payload go through a
+ * single slot command list instead. The slot sits in the per-context command
+ * buffer and takes up to a page, so userspace needs no extra BO for them.
+ */
+bool aie2_execbuf_fits_msg(struct amdxdna_gem_obj *cmd_abo)
+{
+	u32 payload_len;
+
+	if (amdxdna_cmd_get_op(cmd_abo) != ERT_START_CU)
+		return true;
+
+	if (!amdxdna_cmd_get_payload(cmd_abo, &payload_len))
+		return true;
+
+	return payload_len <= sizeof_field(struct execute_buffer_req, payload);
+}
+
 int aie2_execbuf(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t))
 {
 	struct mailbox_channel *chann = ctx->priv->mbox_chann;
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
-	union {
-		struct exec_dpu_preempt_req dpu_pmpt;
-		struct execute_buffer_req ebuf;
-		struct exec_dpu_req dpu;
-	} req;
 	struct xdna_mailbox_msg msg;
+	void __iomem *buf;
 	u32 payload_len;
 	void *payload;
 	int cu_idx;
-	int ret;
 	u32 op;
 
 	if (!chann)
@@ -553,74 +741,122 @@ int aie2_execbuf(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 	op = amdxdna_cmd_get_op(cmd_abo);
 	switch (op) {
 	case ERT_START_CU:
-		if (unlikely(payload_len > sizeof(req.ebuf.payload)))
-			XDNA_DBG(xdna, "Invalid ebuf payload len: %d", payload_len);
-		req.ebuf.cu_idx = cu_idx;
-		memcpy(req.ebuf.payload, payload, sizeof(req.ebuf.payload));
-		msg.send_size = sizeof(req.ebuf);
+		msg.send_size = sizeof(struct execute_buffer_req);
 		msg.opcode = MSG_OP_EXECUTE_BUFFER_CF;
 		break;
+	case ERT_START_NPU:
+		msg.send_size = sizeof(struct exec_dpu_req);
+		msg.opcode = MSG_OP_EXEC_DPU;
+		break;
+	case ERT_START_NPU_PREEMPT:
+		msg.send_size = sizeof(struct exec_dpu_preempt_req);
+		msg.opcode = MSG_OP_EXEC_DPU_PREEMPT;
+		break;
+	default:
+		XDNA_DBG(xdna, "Invalid ERT cmd op code: %d", op);
+		return -EINVAL;
+	}
+	msg.handle = job;
+	msg.notify_cb = notify_cb;
+	msg.send_data = NULL;
+
+	/* First word of all requests is cu_idx or instruction buffer address */
+	buf = xdna_mailbox_reserve_msg(chann, &msg);
+	if (IS_ERR(buf)) {
+		XDNA_ERR(xdna, "Send message failed");
+		return PTR_ERR(buf);
+	}
+
+	switch (op) {
+	case ERT_START_CU: {
+		struct execute_buffer_req __iomem *req = buf;
+
+		if (unlikely(payload_len > sizeof(req->payload)))
+			XDNA_DBG(xdna, "Invalid ebuf payload len: %d", payload_len);
+		writel(cu_idx, &req->cu_idx);
+		aie2_execbuf_copy_payload(req->payload, sizeof(req->payload),
+					  payload, payload_len);
+		break;
+	}
 	case ERT_START_NPU: {
+		struct exec_dpu_req __iomem *req = buf;
 		struct amdxdna_cmd_start_npu *sn = payload;
 
-		if (unlikely(payload_len - sizeof(*sn) > sizeof(req.dpu.payload)))
+		if (unlikely(payload_len - sizeof(*sn) > sizeof(req->payload)))
 			XDNA_DBG(xdna, "Invalid dpu payload len: %d", payload_len);
-		req.dpu.inst_buf_addr = sn->buffer;
-		req.dpu.inst_size = sn->buffer_size;
-		req.dpu.inst_prop_cnt = sn->prop_count;
-		req.dpu.cu_idx = cu_idx;
-		memcpy(req.dpu.payload, sn->prop_args, sizeof(req.dpu.payload));
-		msg.send_size = sizeof(req.dpu);
-		msg.opcode = MSG_OP_EXEC_DPU;
+		aie2_execbuf_write64(sn->buffer, &req->inst_buf_addr);
+		writel(sn->buffer_size, &req->inst_size);
+		writel(sn->prop_count, &req->inst_prop_cnt);
+		writel(cu_idx, &req->cu_idx);
+		aie2_execbuf_copy_payload(req->payload, sizeof(req->payload), sn->prop_args,
+					  payload_len - sizeof(*sn));
 		break;
 	}
 	case ERT_START_NPU_PREEMPT: {
+		struct exec_dpu_preempt_req __iomem *req = buf;
 		struct amdxdna_cmd_preempt_data *pd = payload;
 
-		if (unlikely(payload_len - sizeof(*pd) > sizeof(req.dpu.payload)))
+		if (unlikely(payload_len - sizeof(*pd) > sizeof(req->payload)))
 			XDNA_DBG(xdna, "Invalid dpu payload len: %d", payload_len);
 
-		req.dpu_pmpt.inst_buf_addr = pd->inst_buf;
-		req.dpu_pmpt.save_buf_addr = pd->save_buf;
-		req.dpu_pmpt.restore_buf_addr = pd->restore_buf;
-		req.dpu_pmpt.inst_size = pd->inst_size;
-		req.dpu_pmpt.save_size = pd->save_size;
-		req.dpu_pmpt.restore_size = pd->restore_size;
-		req.dpu_pmpt.inst_prop_cnt = pd->inst_prop_cnt;
-		req.dpu_pmpt.cu_idx = cu_idx;
-		memcpy(req.dpu_pmpt.payload, pd->prop_args, sizeof(req.dpu_pmpt.payload));
-		msg.send_size = sizeof(req.dpu_pmpt);
-		msg.opcode = MSG_OP_EXEC_DPU_PREEMPT;
+		aie2_execbuf_write64(pd->inst_buf, &req->inst_buf_addr);
+		aie2_execbuf_write64(pd->save_buf, &req->save_buf_addr);
+		aie2_execbuf_write64(pd->restore_buf, &req->restore_buf_addr);
+		writel(pd->inst_size, &req->inst_size);
+		writel(pd->save_size, &req->save_size);
+		writel(pd->restore_size, &req->restore_size);
+		writel(pd->inst_prop_cnt, &req->inst_prop_cnt);
+		writel(cu_idx, &req->cu_idx);
+		if (pd->save_size + pd->restore_size > ctx->priv->preempt_buf_size)
+			WRITE_ONCE(ctx->priv->preempt_buf_size, pd->save_size + pd->restore_size);
+		aie2_execbuf_copy_payload(req->payload, sizeof(req->payload), pd->prop_args,
+					  payload_len - sizeof(*pd));
 		break;
 	}
-	default:
-		XDNA_DBG(xdna, "Invalid ERT cmd op code: %d", op);
-		return -EINVAL;
 	}
-	msg.handle = job;
-	msg.notify_cb = notify_cb;
-	msg.send_data = (u8 *)&req;
 #ifdef AMDXDNA_DEVEL
-	print_hex_dump_debug("cmd: ", DUMP_PREFIX_OFFSET, 16, 4, &req,
+	print_hex_dump_debug("cmd: ", DUMP_PREFIX_OFFSET, 16, 4, (void __force *)buf,
 			     msg.send_size, false);
 #endif
 
-	ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
-	if (ret) {
-		XDNA_ERR(xdna, "Send message failed");
-		return ret;
-	}
+	xdna_mailbox_commit_msg(chann, &msg);
 	job->msg_id = msg.id;
+	aie2_track_pdi(ctx, cu_idx);
 
 	return 0;
 }
 
+/*
+ * Chain slots are written by host and only read by device. With non-temporal
+ * copies they go around the CPU cache, so filled slots need a store fence
+ * instead of a cache flush before firmware is told about them.
+ */
+static inline void aie2_cmdlist_copy(void *dst, const void *src, size_t len)
+{
+#ifdef __HAVE_ARCH_MEMCPY_FLUSHCACHE
+	memcpy_flushcache(dst, src, len);
+#else
+	memcpy(dst, src, len);
+#endif
+}
+
+static inline void aie2_cmdlist_flush(void *kva, u32 size)
+{
+#ifdef __HAVE_ARCH_MEMCPY_FLUSHCACHE
+	wmb(); /* Non-temporal stores before the mailbox message */
+#else
+	drm_clflush_virt_range(kva, size);
+#endif
+}
+
+/* A NULL cmd_buf only sizes the slot, used to size chain buffers at submit */
 static inline int
 aie2_cmdlist_fill_one_slot_cf(void *cmd_buf, u32 offset,
 			      struct amdxdna_gem_obj *abo, u32 *size)
 {
-	struct cmd_chain_slot_execbuf_cf *buf = cmd_buf + offset;
+	struct cmd_chain_slot_execbuf_cf *buf;
 	int cu_idx = amdxdna_cmd_get_cu_idx(abo);
+	struct cmd_chain_slot_execbuf_cf hdr;
 	u32 payload_len;
 	void *payload;
 
@@ -634,9 +870,13 @@ aie2_cmdlist_fill_one_slot_cf(void *cmd_buf, u32 offset,
 	if (!slot_cf_has_space(offset, payload_len))
 		return -ENOSPC;
 
-	buf->cu_idx = cu_idx;
-	buf->arg_cnt = payload_len / sizeof(u32);
-	memcpy(buf->args, payload, payload_len);
+	if (cmd_buf) {
+		buf = cmd_buf + offset;
+		hdr.cu_idx = cu_idx;
+		hdr.arg_cnt = payload_len / sizeof(u32);
+		aie2_cmdlist_copy(buf, &hdr, sizeof(hdr));
+		aie2_cmdlist_copy(buf->args, payload, payload_len);
+	}
 	/* Accurate buf size to hint firmware to do necessary copy */
 	*size = sizeof(*buf) + payload_len;
 	return 0;
@@ -646,9 +886,10 @@ static inline int
 aie2_cmdlist_fill_one_slot_dpu(void *cmd_buf, u32 offset,
 			       struct amdxdna_gem_obj *abo, u32 *size)
 {
-	struct cmd_chain_slot_dpu *buf = cmd_buf + offset;
 	int cu_idx = amdxdna_cmd_get_cu_idx(abo);
 	struct amdxdna_cmd_start_npu *sn;
+	struct cmd_chain_slot_dpu *buf;
+	struct cmd_chain_slot_dpu hdr;
 	u32 payload_len;
 	void *payload;
 	u32 arg_sz;
@@ -667,12 +908,16 @@ aie2_cmdlist_fill_one_slot_dpu(void *cmd_buf, u32 offset,
 	if (!slot_dpu_has_space(offset, arg_sz))
 		return -ENOSPC;
 
-	buf->inst_buf_addr = sn->buffer;
-	buf->inst_size = sn->buffer_size;
-	buf->inst_prop_cnt = sn->prop_count;
-	buf->cu_idx = cu_idx;
-	buf->arg_cnt = arg_sz / sizeof(u32);
-	memcpy(buf->args, sn->prop_args, arg_sz);
+	if (cmd_buf) {
+		buf = cmd_buf + offset;
+		hdr.inst_buf_addr = sn->buffer;
+		hdr.inst_size = sn->buffer_size;
+		hdr.inst_prop_cnt = sn->prop_count;
+		hdr.cu_idx = cu_idx;
+		hdr.arg_cnt = arg_sz / sizeof(u32);
+		aie2_cmdlist_copy(buf, &hdr, sizeof(hdr));
+		aie2_cmdlist_copy(buf->args, sn->prop_args, arg_sz);
+	}
 
 	/* Accurate buf size to hint firmware to do necessary copy */
 	*size = sizeof(*buf) + arg_sz;
@@ -683,8 +928,8 @@ static inline int
 aie2_cmdlist_fill_one_slot(u32 op, struct amdxdna_gem_obj *cmdbuf_abo, u32 offset,
 			   struct amdxdna_gem_obj *abo, u32 *size)
 {
+	void *cmd_buf = cmdbuf_abo ? cmdbuf_abo->mem.kva : NULL;
 	u32 this_op = amdxdna_cmd_get_op(abo);
-	void *cmd_buf = cmdbuf_abo->mem.kva;
 	int ret;
 
 	if (this_op != op) {
@@ -704,7 +949,8 @@ aie2_cmdlist_fill_one_slot(u32 op, struct amdxdna_gem_obj *cmdbuf_abo, u32 offse
 	}
 
 done:
-	if (ret) {
+	/* Out of space is not an error for command chain, see caller */
+	if (ret && ret != -ENOSPC) {
 		XDNA_ERR(abo->client->xdna, "Can't fill slot for cmd op %d ret %d",
 			 op, ret);
 	}
@@ -714,7 +960,7 @@ done:
 static inline struct amdxdna_gem_obj *
 aie2_cmdlist_get_cmd_buf(struct amdxdna_sched_job *job)
 {
-	int idx = get_job_idx(job->seq);
+	int idx = get_job_idx(job->ctx->priv, job->seq);
 
 	return job->ctx->priv->cmd_buf[idx];
 }
@@ -726,7 +972,7 @@ aie2_cmdlist_prepare_request(struct cmd_chain_req *req,
 	req->buf_addr = cmdbuf_abo->mem.dev_addr;
 	req->buf_size = size;
 	req->count = cnt;
-	drm_clflush_virt_range(cmdbuf_abo->mem.kva, size);
+	aie2_cmdlist_flush(cmdbuf_abo->mem.kva, size);
 	XDNA_DBG(cmdbuf_abo->client->xdna, "Command buf addr 0x%llx size 0x%x count %d",
 		 req->buf_addr, size, cnt);
 }
@@ -744,29 +990,47 @@ aie2_cmd_op_to_msg_op(u32 op)
 	}
 }
 
-int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
-			       struct amdxdna_sched_job *job,
-			       int (*notify_cb)(void *, void __iomem *, size_t))
+/* Buffers are set up by aie2_cmdlist_prepare_chain() at submit */
+static struct aie2_chain_seg *
+aie2_cmdlist_get_seg(struct amdxdna_sched_job *job, u32 seg)
 {
-	struct amdxdna_gem_obj *cmdbuf_abo = aie2_cmdlist_get_cmd_buf(job);
-	struct mailbox_channel *chann = ctx->priv->mbox_chann;
-	struct amdxdna_client *client = ctx->client;
-	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
-	struct amdxdna_cmd_chain *payload;
-	struct xdna_mailbox_msg msg;
-	struct cmd_chain_req req;
-	u32 payload_len;
-	u32 offset = 0;
+	struct amdxdna_ctx *ctx = job->ctx;
+	struct aie2_cmd_chain *chain;
+
+	chain = &ctx->priv->chains[get_job_idx(ctx->priv, job->seq)];
+	if (seg < chain->nr_segs)
+		return &chain->segs[seg];
+
+	/* Sub-commands changed after submit */
+	XDNA_ERR(ctx->client->xdna, "%s command chain needs buf %d, has %d",
+		 ctx->name, seg, chain->nr_segs);
+	return ERR_PTR(-EINVAL);
+}
+
+/*
+ * Fill sub-commands into cmd buffers. When one is full, continue in the
+ * next one. Return number of buffers filled, or error. With measure set
+ * nothing is written, only the number of buffers needed is returned.
+ */
+static int
+aie2_cmdlist_fill_chain(struct amdxdna_sched_job *job, struct amdxdna_cmd_chain *payload,
+			u32 *op, bool measure)
+{
+	struct amdxdna_client *client = job->ctx->client;
+	u32 limit = job->chain_limit;
+	struct aie2_chain_seg tmp;
+	struct aie2_chain_seg *seg;
+	u32 nr_segs = 0;
 	u32 size;
 	int ret;
-	u32 op;
 	u32 i;
 
-	op = amdxdna_cmd_get_op(cmd_abo);
-	payload = amdxdna_cmd_get_payload(cmd_abo, &payload_len);
-	if (op != ERT_CMD_CHAIN || !payload ||
-	    payload_len < struct_size(payload, data, payload->command_count))
-		return -EINVAL;
+	seg = measure ? &tmp : aie2_cmdlist_get_seg(job, nr_segs);
+	if (IS_ERR(seg))
+		return PTR_ERR(seg);
+	nr_segs++;
+	seg->first = 0;
+	seg->size = 0;
 
 	for (i = 0; i < payload->command_count; i++) {
 		u32 boh = (u32)(payload->data[i]);
@@ -780,18 +1044,126 @@ int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 
 		/* All sub-cmd should have same op, use the first one. */
 		if (i == 0)
-			op = amdxdna_cmd_get_op(abo);
-
-		ret = aie2_cmdlist_fill_one_slot(op, cmdbuf_abo, offset, abo, &size);
+			*op = amdxdna_cmd_get_op(abo);
+
+		/* A full message in progress mode is treated like a full buffer */
+		if (limit && i - seg->first == limit)
+			ret = -ENOSPC;
+		else
+			ret = aie2_cmdlist_fill_one_slot(*op, measure ? NULL : seg->bo,
+							 seg->size, abo, &size);
+		if (ret == -ENOSPC && i > seg->first) {
+			seg->cnt = i - seg->first;
+			if (!measure) {
+				seg = aie2_cmdlist_get_seg(job, nr_segs);
+				if (IS_ERR(seg)) {
+					amdxdna_gem_put_obj(abo);
+					return PTR_ERR(seg);
+				}
+			}
+			nr_segs++;
+			seg->first = i;
+			seg->size = 0;
+			ret = aie2_cmdlist_fill_one_slot(*op, measure ? NULL : seg->bo,
+							 0, abo, &size);
+		}
+		if (!ret && !measure)
+			aie2_track_pdi(job->ctx, amdxdna_cmd_get_cu_idx(abo));
 		amdxdna_gem_put_obj(abo);
 		if (ret)
 			return -EINVAL;
 
-		offset += size;
+		/* The size is the accumulated total size of the cmd buffer */
+		seg->size += size;
 	}
+	seg->cnt = i - seg->first;
 
-	/* The offset is the accumulated total size of the cmd buffer */
-	aie2_cmdlist_prepare_request(&req, cmdbuf_abo, offset, payload->command_count);
+	return nr_segs;
+}
+
+/*
+ * Called at submit for the slot of @seq, run_job is on the fence signalling
+ * path and must not allocate. A chain may need more than cmd_buf[idx], the
+ * extra buffers are allocated here and kept in the slot for reuse.
+ */
+int aie2_cmdlist_prepare_chain(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+			       u64 seq)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct amdxdna_drm_create_bo args = {
+		.type = AMDXDNA_BO_DEV,
+		.size = MAX_CHAIN_CMDBUF_SIZE,
+	};
+	struct amdxdna_cmd_chain *payload;
+	struct aie2_chain_seg *segs;
+	struct aie2_cmd_chain *chain;
+	struct amdxdna_gem_obj *abo;
+	u32 payload_len;
+	int nr_segs;
+	u32 op;
+
+	if (job->opcode != OP_USER || amdxdna_cmd_get_op(job->cmd_bo) != ERT_CMD_CHAIN)
+		return 0;
+
+	payload = amdxdna_cmd_get_payload(job->cmd_bo, &payload_len);
+	if (!payload || payload_len < struct_size(payload, data, payload->command_count))
+		return -EINVAL;
+
+	job->chain_limit = READ_ONCE(ctx->priv->chain_progress);
+	nr_segs = aie2_cmdlist_fill_chain(job, payload, &op, true);
+	if (nr_segs < 0)
+		return nr_segs;
+
+	chain = &ctx->priv->chains[get_job_idx(ctx->priv, seq)];
+	if (nr_segs <= chain->nr_segs)
+		return 0;
+
+	segs = krealloc_array(chain->segs, nr_segs, sizeof(*segs), GFP_KERNEL);
+	if (!segs)
+		return -ENOMEM;
+	chain->segs = segs;
+
+	for (; chain->nr_segs < nr_segs; chain->nr_segs++) {
+		if (!chain->nr_segs) {
+			abo = ctx->priv->cmd_buf[get_job_idx(ctx->priv, seq)];
+		} else {
+			abo = amdxdna_drm_create_dev_bo(&xdna->ddev, &args, ctx->client->filp);
+			if (IS_ERR(abo))
+				return PTR_ERR(abo);
+			XDNA_DBG(xdna, "%s command chain buf %d addr 0x%llx", ctx->name,
+				 chain->nr_segs, abo->mem.dev_addr);
+		}
+		segs[chain->nr_segs].bo = abo;
+	}
+
+	return 0;
+}
+
+int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
+			       struct amdxdna_sched_job *job,
+			       int (*notify_cb)(void *, void __iomem *, size_t))
+{
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_gem_obj *cmd_abo = job->cmd_bo;
+	struct amdxdna_cmd_chain *payload;
+	struct xdna_mailbox_msg msg;
+	struct aie2_chain_seg *seg;
+	struct cmd_chain_req req;
+	u32 payload_len;
+	int nr_segs;
+	int ret;
+	u32 op;
+	int i;
+
+	op = amdxdna_cmd_get_op(cmd_abo);
+	payload = amdxdna_cmd_get_payload(cmd_abo, &payload_len);
+	if (op != ERT_CMD_CHAIN || !payload ||
+	    payload_len < struct_size(payload, data, payload->command_count))
+		return -EINVAL;
+
+	nr_segs = aie2_cmdlist_fill_chain(job, payload, &op, false);
+	if (nr_segs < 0)
+		return nr_segs;
 
 	msg.opcode = aie2_cmd_op_to_msg_op(op);
 	if (msg.opcode == MSG_OP_MAX_OPCODE)
@@ -800,14 +1172,35 @@ int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 	msg.notify_cb = notify_cb;
 	msg.send_data = (u8 *)&req;
 	msg.send_size = sizeof(req);
-	ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
-	if (ret) {
-		XDNA_ERR(ctx->client->xdna, "Send message failed");
-		return ret;
+
+	/* Job completes when all messages responded */
+	atomic_set(&job->chain_left, nr_segs);
+	for (i = 0; i < nr_segs; i++) {
+		seg = aie2_cmdlist_get_seg(job, i);
+		aie2_cmdlist_prepare_request(&req, seg->bo, seg->size, seg->cnt);
+		ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
+		if (ret)
+			goto send_failed;
+		job->msg_id = msg.id;
 	}
-	job->msg_id = msg.id;
 
 	return 0;
+
+send_failed:
+	XDNA_ERR(ctx->client->xdna, "Send message failed");
+	if (!i)
+		return ret;
+
+	/*
+	 * Earlier messages are on device, the last response completes the job
+	 * as aborted. If they all responded already, fail it like a not sent.
+	 */
+	job->chain_failed = true;
+	amdxdna_cmd_set_state(cmd_abo, ERT_CMD_STATE_ABORT);
+	payload->error_index = seg->first;
+	if (atomic_sub_and_test(nr_segs - i, &job->chain_left))
+		return ret;
+	return 0;
 }
 
 int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
@@ -843,6 +1236,7 @@ int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
 		return ret;
 	}
 	job->msg_id = msg.id;
+	aie2_track_pdi(ctx, amdxdna_cmd_get_cu_idx(cmd_abo));
 
 	return 0;
 }
@@ -851,21 +1245,104 @@ int aie2_sync_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t))
 {
 	struct mailbox_channel *chann = ctx->priv->mbox_chann;
-	struct amdxdna_gem_obj *abo = to_xdna_obj(job->bos[0].obj);
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 	struct xdna_mailbox_msg msg;
+	struct amdxdna_gem_obj *abo;
 	struct sync_bo_req req;
-	int ret;
+	int ret = 0;
+	int i;
 
-	req.src_addr = 0;
-	req.dst_addr = 0;
-	req.size = abo->mem.size;
+	msg.handle = job;
+	msg.notify_cb = notify_cb;
+	msg.send_data = (u8 *)&req;
+	msg.send_size = sizeof(req);
+	msg.opcode = MSG_OP_SYNC_BO;
+
+	/* One message per BO, job completes when all of them responded */
+	atomic_set(&job->chain_left, job->bo_cnt);
+	for (i = 0; i < job->bo_cnt; i++) {
+		abo = to_xdna_obj(job->bos[i].obj);
+		req.src_addr = 0;
+		req.dst_addr = 0;
+		req.size = abo->mem.size;
+
+		/* Device to Host */
+		req.type = FIELD_PREP(AIE2_MSG_SYNC_BO_SRC_TYPE, SYNC_BO_DEV_MEM) |
+			FIELD_PREP(AIE2_MSG_SYNC_BO_DST_TYPE, SYNC_BO_HOST_MEM);
+
+		XDNA_DBG(xdna, "sync %d bytes src(0x%llx) to dst(0x%llx) completed",
+			 req.size, req.src_addr, req.dst_addr);
+
+		ret = xdna_mailbox_send_msg(chann, &msg, TX_TIMEOUT);
+		if (ret) {
+			XDNA_ERR(xdna, "Send message %d of %zu failed", i, job->bo_cnt);
+			break;
+		}
+		job->msg_id = msg.id;
+	}
+
+	if (!ret)
+		return 0;
+
+	/*
+	 * Messages sent before the failure still complete the job, with error
+	 * since some BOs were not synced. Fence can't signal before the unsent
+	 * messages are taken off chain_left, set the error first.
+	 */
+	dma_fence_set_error(job->fence, ret);
+	if (!atomic_sub_and_test(job->bo_cnt - i, &job->chain_left))
+		return 0;
+	return ret;
+}
+
+static int aie2_copy_bo_endpoint(struct amdxdna_gem_obj *abo, u64 offset,
+				 u64 *addr, u32 *type)
+{
+	if (abo->type == AMDXDNA_BO_DEV) {
+		*addr = abo->mem.dev_addr + offset;
+		*type = SYNC_BO_DEV_MEM;
+		return 0;
+	}
+
+	/* userptr is only known once the BO is mmapped */
+	if (abo->mem.dev_addr != AMDXDNA_INVALID_ADDR)
+		*addr = abo->mem.dev_addr + offset;
+	else if (abo->mem.userptr != AMDXDNA_INVALID_ADDR)
+		*addr = abo->mem.userptr + offset;
+	else
+		return -EINVAL;
+	*type = SYNC_BO_HOST_MEM;
+	return 0;
+}
 
-	/* Device to Host */
-	req.type = FIELD_PREP(AIE2_MSG_SYNC_BO_SRC_TYPE, SYNC_BO_DEV_MEM) |
-		FIELD_PREP(AIE2_MSG_SYNC_BO_DST_TYPE, SYNC_BO_HOST_MEM);
+/*
+ * BO to BO copy reuses the firmware SYNC_BO DMA with explicit addresses.
+ * bos[0] is destination and bos[1] is source, range checked at submit.
+ */
+int aie2_copy_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+		 int (*notify_cb)(void *, void __iomem *, size_t))
+{
+	struct amdxdna_gem_obj *dst = to_xdna_obj(job->bos[0].obj);
+	struct amdxdna_gem_obj *src = to_xdna_obj(job->bos[1].obj);
+	struct mailbox_channel *chann = ctx->priv->mbox_chann;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct xdna_mailbox_msg msg;
+	struct sync_bo_req req;
+	u32 src_type, dst_type;
+	int ret;
+
+	ret = aie2_copy_bo_endpoint(src, job->copy.src_offset, &req.src_addr, &src_type);
+	if (!ret)
+		ret = aie2_copy_bo_endpoint(dst, job->copy.dst_offset, &req.dst_addr, &dst_type);
+	if (ret) {
+		XDNA_ERR(xdna, "Copy BO has no device address");
+		return ret;
+	}
+	req.size = job->copy.size;
+	req.type = FIELD_PREP(AIE2_MSG_SYNC_BO_SRC_TYPE, src_type) |
+		FIELD_PREP(AIE2_MSG_SYNC_BO_DST_TYPE, dst_type);
 
-	XDNA_DBG(xdna, "sync %d bytes src(0x%llx) to dst(0x%llx) completed",
+	XDNA_DBG(xdna, "copy %d bytes src(0x%llx) to dst(0x%llx)",
 		 req.size, req.src_addr, req.dst_addr);
 
 	msg.handle = job;
@@ -6,8 +6,11 @@
 #include <linux/errno.h>
 #include <linux/kthread.h>
 #include <linux/iommu.h>
+#include <linux/capability.h>
 #include <linux/firmware.h>
 #include <linux/uaccess.h>
+#include <linux/pm_runtime.h>
+#include <linux/ratelimit.h>
 #include <drm/drm_cache.h>
 #include "drm_local/amdxdna_accel.h"
 
@@ -38,6 +41,15 @@ bool disable_fine_preemption;
 module_param(disable_fine_preemption, bool, 0600);
 MODULE_PARM_DESC(disable_fine_preemption, "Disable fine grain preemption");
 
+static uint aie2_mgmt_query_interval_ms = 100;
+module_param(aie2_mgmt_query_interval_ms, uint, 0444);
+MODULE_PARM_DESC(aie2_mgmt_query_interval_ms,
+		 "Rate limit window in ms for unprivileged user queries sent to management channel, 0 no limit");
+
+static uint aie2_mgmt_query_burst = 32;
+module_param(aie2_mgmt_query_burst, uint, 0444);
+MODULE_PARM_DESC(aie2_mgmt_query_burst, "User queries allowed to management channel per window");
+
 /*
  * The management mailbox channel is allocated by firmware.
  * The related register and ring buffer information is on SRAM BAR.
@@ -289,27 +301,65 @@ static int aie2_mgmt_fw_init(struct amdxdna_dev_hdl *ndev)
 
 static int aie2_mgmt_fw_query(struct amdxdna_dev_hdl *ndev)
 {
+	struct amdxdna_fw_ver fw_ver;
 	int ret;
 
-	ret = aie2_query_firmware_version(ndev, &ndev->xdna->fw_ver);
+	/* Independent queries, send them in one batch */
+	ret = aie2_query_fw_info(ndev, &fw_ver, &ndev->version, &ndev->metadata);
 	if (ret) {
-		XDNA_ERR(ndev->xdna, "query firmware version failed");
+		XDNA_ERR(ndev->xdna, "Query firmware info failed");
 		return ret;
 	}
 
-	ret = aie2_query_aie_version(ndev, &ndev->version);
+	write_seqcount_begin(&ndev->info_seq);
+	ndev->xdna->fw_ver = fw_ver;
+	write_seqcount_end(&ndev->info_seq);
+	return 0;
+}
+
+/*
+ * Error async events are not needed to run a context. Register them after
+ * probe so that they are not on the way of device ready.
+ */
+static void aie2_late_init_work(struct work_struct *work)
+{
+	struct amdxdna_fw_ver fw_ver;
+	struct amdxdna_dev_hdl *ndev;
+	struct amdxdna_dev *xdna;
+	int ret;
+
+	ndev = container_of(work, struct amdxdna_dev_hdl, late_init_work);
+	xdna = ndev->xdna;
+
+	/* aie2_mgmt_fw_init() sends the events on resume once allocated */
+	mutex_lock(&ndev->aie2_lock);
+	ret = aie2_error_async_events_alloc(ndev);
 	if (ret) {
-		XDNA_ERR(ndev->xdna, "Query AIE version failed");
-		return ret;
+		XDNA_ERR(xdna, "Allocate async events failed, ret %d", ret);
+		goto unlock;
+	}
+
+	if (ndev->dev_status < AIE2_DEV_START)
+		goto unlock;
+
+	ret = aie2_error_async_events_send(ndev);
+	if (ret) {
+		XDNA_ERR(xdna, "Send async events failed, ret %d", ret);
+		goto unlock;
 	}
 
-	ret = aie2_query_aie_metadata(ndev, &ndev->metadata);
+	/* Just to make sure firmware handled async events */
+	ret = aie2_query_firmware_version(ndev, &fw_ver);
 	if (ret) {
-		XDNA_ERR(ndev->xdna, "Query AIE metadata failed");
-		return ret;
+		XDNA_ERR(xdna, "Re-query firmware version failed");
+		goto unlock;
 	}
 
-	return 0;
+	write_seqcount_begin(&ndev->info_seq);
+	xdna->fw_ver = fw_ver;
+	write_seqcount_end(&ndev->info_seq);
+unlock:
+	mutex_unlock(&ndev->aie2_lock);
 }
 
 static void aie2_mgmt_fw_fini(struct amdxdna_dev_hdl *ndev)
@@ -327,6 +377,10 @@ static int aie2_xrs_set_dft_dpm_level(struct drm_device *ddev, u32 dpm_level)
 	ndev = xdna->dev_handle;
 	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
 	ndev->dft_dpm_level = dpm_level;
+	/* Governor picks the level from device load */
+	if (aie2_pm_gov_enabled())
+		return 0;
+
 	if (ndev->pw_mode != POWER_MODE_DEFAULT || ndev->dpm_level == dpm_level)
 		return 0;
 
@@ -349,6 +403,7 @@ static void aie2_hw_stop(struct amdxdna_dev *xdna)
 		return;
 	}
 
+	aie2_pm_gov_stop(ndev);
 	mutex_lock(&ndev->aie2_lock);
 	aie2_pm_fini(ndev);
 	aie2_mgmt_fw_fini(ndev);
@@ -466,11 +521,20 @@ disable_dev:
 	return ret;
 }
 
+/*
+ * Contexts are not reconnected on resume. A context connects again through
+ * aie2_rq_submit_enter() on its next submit, only waiting contexts are
+ * scheduled by aie2_rq_restart_all().
+ */
 static void aie2_hw_suspend(struct amdxdna_dev *xdna)
 {
-	aie2_assign_event_trace_state(xdna->dev_handle, false);
-	aie2_rq_stop_all(&xdna->dev_handle->ctx_rq);
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+
+	aie2_assign_event_trace_state(ndev, false);
+	ndev->fw_stopping = true;
+	aie2_rq_stop_all(&ndev->ctx_rq);
 	aie2_hw_stop(xdna);
+	ndev->fw_stopping = false;
 }
 
 static int aie2_hw_resume(struct amdxdna_dev *xdna)
@@ -508,6 +572,10 @@ static int aie2_init(struct amdxdna_dev *xdna)
 	ndev->priv = xdna->dev_info->dev_priv;
 	ndev->xdna = xdna;
 	mutex_init(&ndev->aie2_lock);
+	seqcount_mutex_init(&ndev->info_seq, &ndev->aie2_lock);
+	ratelimit_state_init(&ndev->mgmt_query_rs, msecs_to_jiffies(aie2_mgmt_query_interval_ms),
+			     aie2_mgmt_query_burst);
+	ratelimit_set_flags(&ndev->mgmt_query_rs, RATELIMIT_MSG_ON_RELEASE);
 
 	XDNA_DBG(xdna, "Request fw %s", ndev->priv->fw_path);
 	ret = request_firmware(&fw, ndev->priv->fw_path, &pdev->dev);
@@ -635,38 +703,17 @@ skip_pasid:
 		goto fini_rq;
 	}
 
-	ret = aie2_error_async_events_alloc(ndev);
-	if (ret) {
-		XDNA_ERR(xdna, "Allocate async events failed, ret %d", ret);
-		goto fini_rq;
-	}
-
-	mutex_lock(&ndev->aie2_lock);
-	ret = aie2_error_async_events_send(ndev);
-	mutex_unlock(&ndev->aie2_lock);
-	if (ret) {
-		XDNA_ERR(xdna, "Send async events failed, ret %d", ret);
-		goto async_event_free;
-	}
-
-	/* Just to make sure firmware handled async events */
-	mutex_lock(&ndev->aie2_lock);
-	ret = aie2_query_firmware_version(ndev, &ndev->xdna->fw_ver);
-	mutex_unlock(&ndev->aie2_lock);
-	if (ret) {
-		XDNA_ERR(xdna, "Re-query firmware version failed");
-		goto async_event_free;
-	}
-
 	ret = aie2_event_trace_init(ndev);
 	if (ret)
 		XDNA_DBG(xdna, "Event trace init failed, ret %d", ret);
 
+	aie2_telemetry_init(ndev);
+	INIT_WORK(&ndev->late_init_work, aie2_late_init_work);
+	schedule_work(&ndev->late_init_work);
+
 	release_firmware(fw);
 	return 0;
 
-async_event_free:
-	aie2_error_async_events_free(ndev);
 fini_rq:
 	aie2_rq_fini(&ndev->ctx_rq);
 stop_hw:
@@ -686,10 +733,13 @@ static void aie2_fini(struct amdxdna_dev *xdna)
 	struct pci_dev *pdev = to_pci_dev(xdna->ddev.dev);
 	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
 
+	cancel_work_sync(&ndev->late_init_work);
+	aie2_telemetry_fini(ndev);
 	aie2_event_trace_fini(ndev);
 	aie2_rq_fini(&ndev->ctx_rq);
 	aie2_hw_stop(xdna);
-	aie2_error_async_events_free(ndev);
+	if (ndev->async_events)
+		aie2_error_async_events_free(ndev);
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode != AMDXDNA_IOMMU_PASID)
 		goto skip_pasid;
@@ -710,7 +760,7 @@ static bool aie2_detect(struct amdxdna_dev *xdna)
 	if (aie2_rq_handle_idle_ctx(rq))
 		return false;
 
-	return aie2_rq_is_all_context_stuck(rq);
+	return !!aie2_rq_stuck_cols(rq);
 }
 
 static void aie2_recover(struct amdxdna_dev *xdna, bool dump_only)
@@ -726,8 +776,26 @@ static void aie2_recover(struct amdxdna_dev *xdna, bool dump_only)
 		return;
 	}
 
-	aie2_rq_stop_all(rq);
-	aie2_rq_restart_all(rq);
+	/* Only partitions that stopped making progress, the rest keep running */
+	aie2_rq_reset_cols(rq, aie2_rq_stuck_cols(rq));
+}
+
+/*
+ * User queries that go to firmware share the management channel with context
+ * configuration. Limit how often unprivileged userspace can issue them, so
+ * polling tools do not keep the channel busy. Admin tools such as xrt-smi
+ * run as root and are not limited. Caller holds aie2_lock.
+ */
+static int aie2_mgmt_query_ratelimit(struct amdxdna_dev_hdl *ndev)
+{
+	if (capable(CAP_SYS_ADMIN))
+		return 0;
+
+	if (__ratelimit(&ndev->mgmt_query_rs))
+		return 0;
+
+	XDNA_DBG(ndev->xdna, "Management query rate limited");
+	return -EAGAIN;
 }
 
 static int aie2_get_aie_status(struct amdxdna_client *client,
@@ -832,11 +900,15 @@ static int aie2_get_firmware_version(struct amdxdna_client *client,
 {
 	struct amdxdna_drm_query_firmware_version version;
 	struct amdxdna_dev *xdna = client->xdna;
+	unsigned int seq;
 
-	version.major = xdna->fw_ver.major;
-	version.minor = xdna->fw_ver.minor;
-	version.patch = xdna->fw_ver.sub;
-	version.build = xdna->fw_ver.build;
+	do {
+		seq = read_seqcount_begin(&xdna->dev_handle->info_seq);
+		version.major = xdna->fw_ver.major;
+		version.minor = xdna->fw_ver.minor;
+		version.patch = xdna->fw_ver.sub;
+		version.build = xdna->fw_ver.build;
+	} while (read_seqcount_retry(&xdna->dev_handle->info_seq, seq));
 
 	if (copy_to_user(u64_to_user_ptr(args->buffer), &version, sizeof(version)))
 		return -EFAULT;
@@ -852,7 +924,7 @@ static int aie2_get_power_mode(struct amdxdna_client *client,
 	struct amdxdna_dev_hdl *ndev;
 
 	ndev = xdna->dev_handle;
-	mode.power_mode = ndev->pw_mode;
+	mode.power_mode = READ_ONCE(ndev->pw_mode);
 
 	if (copy_to_user(u64_to_user_ptr(args->buffer), &mode, sizeof(mode)))
 		return -EFAULT;
@@ -866,6 +938,7 @@ static int aie2_get_clock_metadata(struct amdxdna_client *client,
 	struct amdxdna_drm_query_clock_metadata *clock;
 	struct amdxdna_dev *xdna = client->xdna;
 	struct amdxdna_dev_hdl *ndev;
+	unsigned int seq;
 	int ret = 0;
 
 	ndev = xdna->dev_handle;
@@ -875,9 +948,12 @@ static int aie2_get_clock_metadata(struct amdxdna_client *client,
 
 	snprintf(clock->mp_npu_clock.name, sizeof(clock->mp_npu_clock.name),
 		 "MP-NPU Clock");
-	clock->mp_npu_clock.freq_mhz = ndev->npuclk_freq;
 	snprintf(clock->h_clock.name, sizeof(clock->h_clock.name), "H Clock");
-	clock->h_clock.freq_mhz = ndev->hclk_freq;
+	do {
+		seq = read_seqcount_begin(&ndev->info_seq);
+		clock->mp_npu_clock.freq_mhz = ndev->npuclk_freq;
+		clock->h_clock.freq_mhz = ndev->hclk_freq;
+	} while (read_seqcount_retry(&ndev->info_seq, seq));
 
 	if (copy_to_user(u64_to_user_ptr(args->buffer), clock, sizeof(*clock)))
 		ret = -EFAULT;
@@ -951,7 +1027,7 @@ static int aie2_get_ctx_status(struct amdxdna_client *client,
 			tmp->command_submissions = ctx->submitted;
 			tmp->command_completions = ctx->completed;
 			tmp->migrations = 0;
-			tmp->preemptions = 0;
+			tmp->preemptions = ctx->priv->preempt_cnt;
 			tmp->errors = 0;
 			tmp->priority = ctx->qos.priority;
 
@@ -1036,7 +1112,7 @@ static int aie2_get_force_preempt_state(struct amdxdna_client *client,
 	struct amdxdna_dev_hdl *ndev;
 
 	ndev = xdna->dev_handle;
-	force.state = ndev->force_preempt_enabled;
+	force.state = READ_ONCE(ndev->force_preempt_enabled);
 
 	if (copy_to_user(u64_to_user_ptr(args->buffer), &force, sizeof(force)))
 		return -EFAULT;
@@ -1044,6 +1120,246 @@ static int aie2_get_force_preempt_state(struct amdxdna_client *client,
 	return 0;
 }
 
+static int aie2_get_job_timestamp(struct amdxdna_client *client,
+				  struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_drm_query_job_timestamp query;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx *ctx;
+	struct aie2_job_ts ts;
+	int ret, idx;
+
+	if (args->buffer_size != sizeof(query)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(query));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&query, u64_to_user_ptr(args->buffer), sizeof(query))) {
+		XDNA_ERR(xdna, "Failed to copy job timestamp query into kernel");
+		return -EFAULT;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, query.ctx_handle);
+	if (ctx)
+		ret = aie2_ctx_job_ts(ctx, query.seq, &ts);
+	else
+		ret = -EINVAL;
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	if (ret)
+		return ret;
+
+	query.submit_ns = ktime_to_ns(ts.submit);
+	query.run_ns = ktime_to_ns(ts.run);
+	query.sent_ns = ktime_to_ns(ts.sent);
+	query.done_ns = ktime_to_ns(ts.done);
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &query, sizeof(query)))
+		return -EFAULT;
+
+	return 0;
+}
+
+#ifdef AMDXDNA_AIE2_PRIV
+static int aie2_read_aie_batch(struct amdxdna_client *client,
+			       struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	struct amdxdna_drm_aie_batch_entry *ents, *e;
+	struct amdxdna_drm_aie_batch req;
+	struct amdxdna_gem_obj *abo;
+	struct iosys_map map;
+	size_t bo_sz;
+	u32 i;
+	int ret;
+
+	if (args->buffer_size != sizeof(req)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(req));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&req, u64_to_user_ptr(args->buffer), sizeof(req))) {
+		XDNA_ERR(xdna, "Failed to copy AIE batch request into kernel");
+		return -EFAULT;
+	}
+
+	if (!req.num_entries || req.num_entries > AMDXDNA_AIE_BATCH_MAX_ENTRIES) {
+		XDNA_ERR(xdna, "Invalid AIE batch entries %u", req.num_entries);
+		return -EINVAL;
+	}
+
+	ents = vmemdup_user(u64_to_user_ptr(req.entries),
+			    array_size(req.num_entries, sizeof(*ents)));
+	if (IS_ERR(ents)) {
+		XDNA_ERR(xdna, "Failed to copy AIE batch entries into kernel");
+		return PTR_ERR(ents);
+	}
+
+	abo = amdxdna_gem_get_obj(client, req.bo_handle, AMDXDNA_BO_SHARE);
+	if (!abo) {
+		XDNA_ERR(xdna, "AIE batch bo %d is not a share bo", req.bo_handle);
+		ret = -EINVAL;
+		goto free_ents;
+	}
+
+	bo_sz = to_gobj(abo)->size;
+	for (i = 0; i < req.num_entries; i++) {
+		e = &ents[i];
+		if (e->col >= ndev->metadata.cols || e->row >= ndev->metadata.rows ||
+		    !e->size || !IS_ALIGNED(e->addr | e->size | e->bo_offset, 4) ||
+		    (u64)e->bo_offset + e->size > bo_sz || e->pad) {
+			XDNA_ERR(xdna, "Invalid AIE batch entry %u, col %u row %u addr 0x%x size %u",
+				 i, e->col, e->row, e->addr, e->size);
+			ret = -EINVAL;
+			goto put_obj;
+		}
+	}
+
+	ret = drm_gem_vmap_unlocked(to_gobj(abo), &map);
+	if (ret) {
+		XDNA_ERR(xdna, "Vmap AIE batch bo failed, ret %d", ret);
+		goto put_obj;
+	}
+
+	mutex_lock(&ndev->aie2_lock);
+	ret = aie2_read_aie_mem_vec(ndev, ents, req.num_entries, map.vaddr);
+	mutex_unlock(&ndev->aie2_lock);
+
+	drm_gem_vunmap_unlocked(to_gobj(abo), &map);
+put_obj:
+	amdxdna_gem_put_obj(abo);
+free_ents:
+	kvfree(ents);
+	return ret;
+}
+#endif
+
+static int aie2_get_ctx_rq_stats(struct amdxdna_client *client,
+				 struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_drm_query_ctx_rq_stats stats;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx *ctx;
+	int ret = 0, idx;
+
+	if (args->buffer_size != sizeof(stats)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(stats));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&stats, u64_to_user_ptr(args->buffer), sizeof(stats))) {
+		XDNA_ERR(xdna, "Failed to copy runqueue stats query into kernel");
+		return -EFAULT;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, stats.ctx_handle);
+	if (ctx)
+		aie2_rq_ctx_stats(ctx, &stats);
+	else
+		ret = -EINVAL;
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &stats, sizeof(stats)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int aie2_get_ctx_preempt(struct amdxdna_client *client,
+				struct amdxdna_drm_get_info *args)
+{
+	struct amdxdna_drm_query_ctx_preempt pmpt;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx *ctx;
+	int ret = 0, idx;
+
+	if (args->buffer_size != sizeof(pmpt)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(pmpt));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&pmpt, u64_to_user_ptr(args->buffer), sizeof(pmpt))) {
+		XDNA_ERR(xdna, "Failed to copy preempt query into kernel");
+		return -EFAULT;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, pmpt.ctx_handle);
+	if (ctx && ctx->priv) {
+		pmpt.preempt_buf_size = READ_ONCE(ctx->priv->preempt_buf_size);
+		pmpt.preemptions = READ_ONCE(ctx->priv->preempt_cnt);
+		pmpt.preempt_cost_us = READ_ONCE(ctx->priv->switch_cost) / NSEC_PER_USEC;
+	} else {
+		ret = -EINVAL;
+	}
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(u64_to_user_ptr(args->buffer), &pmpt, sizeof(pmpt)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * Answered from state the driver keeps up to date, so monitoring tools
+ * polling these never queue up behind firmware messages on aie2_lock.
+ */
+static int aie2_get_cached_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args)
+{
+	switch (args->param) {
+	case DRM_AMDXDNA_QUERY_AIE_METADATA:
+		return aie2_get_aie_metadata(client, args);
+	case DRM_AMDXDNA_QUERY_AIE_VERSION:
+		return aie2_get_aie_version(client, args);
+	case DRM_AMDXDNA_QUERY_CLOCK_METADATA:
+		return aie2_get_clock_metadata(client, args);
+	case DRM_AMDXDNA_QUERY_SENSORS:
+		return aie2_get_sensors(client, args);
+	case DRM_AMDXDNA_QUERY_FIRMWARE_VERSION:
+		return aie2_get_firmware_version(client, args);
+	case DRM_AMDXDNA_GET_POWER_MODE:
+		return aie2_get_power_mode(client, args);
+	case DRM_AMDXDNA_GET_FORCE_PREEMPT_STATE:
+		return aie2_get_force_preempt_state(client, args);
+	case DRM_AMDXDNA_QUERY_JOB_TIMESTAMP:
+		return aie2_get_job_timestamp(client, args);
+	case DRM_AMDXDNA_QUERY_CTX_RQ_STATS:
+		return aie2_get_ctx_rq_stats(client, args);
+	case DRM_AMDXDNA_QUERY_CTX_PREEMPT:
+		return aie2_get_ctx_preempt(client, args);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static bool aie2_is_cached_info(u32 param)
+{
+	switch (param) {
+	case DRM_AMDXDNA_QUERY_AIE_METADATA:
+	case DRM_AMDXDNA_QUERY_AIE_VERSION:
+	case DRM_AMDXDNA_QUERY_CLOCK_METADATA:
+	case DRM_AMDXDNA_QUERY_SENSORS:
+	case DRM_AMDXDNA_QUERY_FIRMWARE_VERSION:
+	case DRM_AMDXDNA_GET_POWER_MODE:
+	case DRM_AMDXDNA_GET_FORCE_PREEMPT_STATE:
+	case DRM_AMDXDNA_QUERY_JOB_TIMESTAMP:
+	case DRM_AMDXDNA_QUERY_CTX_RQ_STATS:
+	case DRM_AMDXDNA_QUERY_CTX_PREEMPT:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_info *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -1052,22 +1368,25 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 	if (!drm_dev_enter(&xdna->ddev, &idx))
 		return -ENODEV;
 
+	if (aie2_is_cached_info(args->param)) {
+		ret = aie2_get_cached_info(client, args);
+		goto exit;
+	}
+
+#ifdef AMDXDNA_AIE2_PRIV
+	/* Maps a user BO, takes aie2_lock itself */
+	if (args->param == DRM_AMDXDNA_READ_AIE_BATCH) {
+		ret = aie2_read_aie_batch(client, args);
+		goto exit;
+	}
+#endif
+
 	mutex_lock(&xdna->dev_handle->aie2_lock);
 	switch (args->param) {
 	case DRM_AMDXDNA_QUERY_AIE_STATUS:
-		ret = aie2_get_aie_status(client, args);
-		break;
-	case DRM_AMDXDNA_QUERY_AIE_METADATA:
-		ret = aie2_get_aie_metadata(client, args);
-		break;
-	case DRM_AMDXDNA_QUERY_AIE_VERSION:
-		ret = aie2_get_aie_version(client, args);
-		break;
-	case DRM_AMDXDNA_QUERY_CLOCK_METADATA:
-		ret = aie2_get_clock_metadata(client, args);
-		break;
-	case DRM_AMDXDNA_QUERY_SENSORS:
-		ret = aie2_get_sensors(client, args);
+		ret = aie2_mgmt_query_ratelimit(xdna->dev_handle);
+		if (!ret)
+			ret = aie2_get_aie_status(client, args);
 		break;
 	case DRM_AMDXDNA_QUERY_HW_CONTEXTS:
 		mutex_unlock(&xdna->dev_handle->aie2_lock);
@@ -1082,25 +1401,19 @@ static int aie2_get_info(struct amdxdna_client *client, struct amdxdna_drm_get_i
 		ret = aie2_read_aie_reg(client, args);
 		break;
 #endif
-	case DRM_AMDXDNA_QUERY_FIRMWARE_VERSION:
-		ret = aie2_get_firmware_version(client, args);
-		break;
-	case DRM_AMDXDNA_GET_POWER_MODE:
-		ret = aie2_get_power_mode(client, args);
-		break;
 	case DRM_AMDXDNA_QUERY_TELEMETRY:
-		ret = aie2_get_telemetry(client, args);
-		break;
-	case DRM_AMDXDNA_GET_FORCE_PREEMPT_STATE:
-		ret = aie2_get_force_preempt_state(client, args);
+		ret = aie2_mgmt_query_ratelimit(xdna->dev_handle);
+		if (!ret)
+			ret = aie2_get_telemetry(client, args);
 		break;
 	default:
 		XDNA_ERR(xdna, "Not supported request parameter %u", args->param);
 		ret = -EOPNOTSUPP;
 	}
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
-	XDNA_DBG(xdna, "Got param %d", args->param);
 
+exit:
+	XDNA_DBG(xdna, "Got param %d", args->param);
 	drm_dev_exit(idx);
 	return ret;
 }
@@ -1148,13 +1461,94 @@ static int aie2_set_force_preempt_state(struct amdxdna_client *client,
 		return -EFAULT;
 	}
 
-	xdna->dev_handle->force_preempt_enabled = force.state;
+	WRITE_ONCE(xdna->dev_handle->force_preempt_enabled, force.state);
 
 	XDNA_WARN(xdna, "Force preemption %s", force.state ? "enabled" : "disabled");
 
 	return 0;
 }
 
+static int aie2_set_prewarm(struct amdxdna_client *client, struct amdxdna_drm_set_state *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_drm_set_prewarm prewarm;
+	struct amdxdna_ctx *ctx;
+	int ret, idx;
+
+	if (args->buffer_size != sizeof(prewarm)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(prewarm));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&prewarm, u64_to_user_ptr(args->buffer), sizeof(prewarm))) {
+		XDNA_ERR(xdna, "Failed to copy pre-warm request into kernel");
+		return -EFAULT;
+	}
+
+	/* Not root only, a long lead would pin clocks ungated and DPM at max */
+	if (!aie2_pm_prewarm_lead_valid(prewarm.lead_us)) {
+		XDNA_ERR(xdna, "Pre-warm lead %u us longer than keep-warm window", prewarm.lead_us);
+		return -EINVAL;
+	}
+
+	/* Resume takes aie2_lock */
+	ret = pm_runtime_resume_and_get(xdna->ddev.dev);
+	if (ret) {
+		XDNA_ERR(xdna, "Failed to get rpm, ret %d", ret);
+		return ret;
+	}
+
+	mutex_lock(&xdna->dev_handle->aie2_lock);
+	aie2_pm_prewarm(xdna->dev_handle, prewarm.lead_us);
+	mutex_unlock(&xdna->dev_handle->aie2_lock);
+
+	if (prewarm.ctx_handle == AMDXDNA_INVALID_CTX_HANDLE)
+		goto put_rpm;
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, prewarm.ctx_handle);
+	if (ctx)
+		aie2_rq_prewarm(&xdna->dev_handle->ctx_rq, ctx);
+	else
+		ret = -EINVAL;
+	srcu_read_unlock(&client->ctx_srcu, idx);
+
+put_rpm:
+	pm_runtime_mark_last_busy(xdna->ddev.dev);
+	pm_runtime_put_autosuspend(xdna->ddev.dev);
+	return ret;
+}
+
+static int aie2_set_ctx_migrate(struct amdxdna_client *client, struct amdxdna_drm_set_state *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_drm_set_ctx_migrate migrate;
+	struct amdxdna_ctx *ctx;
+	int ret, idx;
+
+	if (args->buffer_size != sizeof(migrate)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(migrate));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&migrate, u64_to_user_ptr(args->buffer), sizeof(migrate))) {
+		XDNA_ERR(xdna, "Failed to copy migrate request into kernel");
+		return -EFAULT;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, migrate.ctx_handle);
+	if (ctx)
+		ret = aie2_rq_migrate(&xdna->dev_handle->ctx_rq, ctx, migrate.start_col);
+	else
+		ret = -EINVAL;
+	srcu_read_unlock(&client->ctx_srcu, idx);
+
+	return ret;
+}
+
 static int aie2_set_state(struct amdxdna_client *client, struct amdxdna_drm_set_state *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
@@ -1163,6 +1557,23 @@ static int aie2_set_state(struct amdxdna_client *client, struct amdxdna_drm_set_
 	if (!drm_dev_enter(&xdna->ddev, &idx))
 		return -ENODEV;
 
+	if (args->param == DRM_AMDXDNA_SET_PREWARM) {
+		ret = aie2_set_prewarm(client, args);
+		goto exit;
+	}
+
+	/* Runqueue takes dev_lock, reconnecting is done by its workqueue */
+	if (args->param == DRM_AMDXDNA_SET_CTX_MIGRATE) {
+		ret = aie2_set_ctx_migrate(client, args);
+		goto exit;
+	}
+
+	/* Takes aie2_lock itself, the ring BO is released without it */
+	if (args->param == DRM_AMDXDNA_SET_TELEMETRY_RING) {
+		ret = aie2_set_telemetry_ring(client, args);
+		goto exit;
+	}
+
 	mutex_lock(&xdna->dev_handle->aie2_lock);
 	switch (args->param) {
 	case DRM_AMDXDNA_SET_POWER_MODE:
@@ -1185,6 +1596,7 @@ static int aie2_set_state(struct amdxdna_client *client, struct amdxdna_drm_set_
 	}
 	mutex_unlock(&xdna->dev_handle->aie2_lock);
 
+exit:
 	drm_dev_exit(idx);
 	return ret;
 }
@@ -1205,6 +1617,7 @@ const struct amdxdna_dev_ops aie2_ops = {
 	.cmd_submit		= aie2_cmd_submit,
 	.cmd_wait		= aie2_cmd_wait,
 	.hmm_invalidate		= aie2_hmm_invalidate,
+	.heap_attach		= aie2_heap_attach,
 	.debugfs		= aie2_debugfs_init,
 	.cmd_get_out_fence	= aie2_cmd_get_out_fence,
 };
@@ -7,11 +7,16 @@
 #define _AIE2_PCI_H_
 
 #include <linux/device.h>
+#include <linux/hrtimer.h>
+#include <linux/iosys-map.h>
 #include <linux/iopoll.h>
+#include <linux/poll.h>
 #include <linux/wait.h>
 #include <linux/io.h>
 #include <linux/list.h>
+#include <linux/ratelimit_types.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/workqueue.h>
 #include <linux/completion.h>
 #include <drm/gpu_scheduler.h>
@@ -192,21 +197,66 @@ struct ctx_pdi {
  * Define the maximum number of pending commands in a context.
  * Must be power of 2!
  */
-#define CTX_MAX_CMDS		4
-#define get_job_idx(seq) ((seq) & (CTX_MAX_CMDS - 1))
+#define CTX_DEFAULT_CMDS	4
+#define get_job_idx(priv, seq) ((seq) & ((priv)->num_cmds - 1))
+
+/* One firmware message of a command chain */
+struct aie2_chain_seg {
+	struct amdxdna_gem_obj		*bo;
+	u32				first;	/* index of first command */
+	u32				cnt;
+	u32				size;
+};
+
+/*
+ * Command chain too large for one cmd_buf is split into messages. segs[0]
+ * is cmd_buf[idx], the others are allocated on demand and kept for reuse.
+ */
+struct aie2_cmd_chain {
+	u32				nr_segs;
+	struct aie2_chain_seg		*segs;
+};
+
+/* seq is U64_MAX while the entry is being rewritten */
+struct aie2_job_ts {
+	u64				seq;
+	ktime_t				submit;
+	ktime_t				run;
+	ktime_t				sent;
+	ktime_t				done;
+};
+
+/* Runqueue statistics of a context, updated under xdna->dev_lock */
+struct aie2_rq_stats {
+	/* Last move between disconnected, dispatched and connected */
+	ktime_t				state_ts;
+	u64				disconn_ns;
+	u64				wait_ns;
+	u64				conn_ns;
+	u64				connects;
+	u64				disconnects;
+	u64				yields;
+	u64				wait_hist[AMDXDNA_RQ_WAIT_BUCKETS];
+};
+
 struct amdxdna_ctx_priv {
 	struct amdxdna_gem_obj		*heap;
 #ifdef AMDXDNA_DEVEL
 	struct ctx_pdi			*pdi_infos;
 #endif
 
-	struct amdxdna_gem_obj		*cmd_buf[CTX_MAX_CMDS];
+	/* In-flight window, power of 2. Sizes cmd_buf[], chains[] and pending[] */
+	u32				num_cmds;
+	struct amdxdna_gem_obj		**cmd_buf;
+	struct aie2_cmd_chain		*chains;
 
-	struct mutex			io_lock; /* protect seq and cmd order */
-#ifdef AMDXDNA_DEVEL
-	struct amdxdna_sched_job	*pending[CTX_MAX_CMDS];
-#endif
+	struct mutex			io_lock; /* protect pending[] against dump */
+	/* Jobs pushed to DRM scheduler but not sent to device yet */
+	atomic_t			sched_queued;
+	struct amdxdna_sched_job	**pending;
 	struct semaphore		job_sem;
+	/* Stage timestamps of the last num_cmds completed jobs */
+	struct aie2_job_ts		*job_ts;
 
 	struct drm_syncobj		*syncobj;
 
@@ -214,6 +264,15 @@ struct amdxdna_ctx_priv {
 	wait_queue_head_t		job_free_waitq;
 
 	u32				orig_num_col;
+	/* Last column solver may place the context on, see part_ctx_place() */
+	u32				place_end_col;
+	/* CU BOs held and CONFIG_CU request built on first connect */
+	struct drm_gem_object		**cu_bos;
+	u32				*cu_cfgs;
+	/* PDI of the last command sent to the hwctx, U32_MAX after connect */
+	u32				cur_pdi;
+	/* Commands which made firmware load a different PDI than the last */
+	u64				pdi_loads;
 
 	/* For context runqueue */
 	/* When there is ongoing IO, use this sem avoid runqueue disconnect ctx */
@@ -221,18 +280,64 @@ struct amdxdna_ctx_priv {
 	atomic64_t			job_pending_cnt;
 	wait_queue_head_t		connect_waitq;
 	int				idle_cnt;
+	/* EWMA of gaps from going idle to next submit, for idle timeout */
+	u64				idle_gap_avg;
+	ktime_t				last_submit_ts;
 	bool				force_yield;
+	/* Start column requested by aie2_rq_migrate(), used on next dispatch */
+	bool				migrate;
+	u32				migrate_col;
 #define CTX_STATE_DISCONNECTED		0x0
 #define CTX_STATE_DISPATCHED		0x1
 #define CTX_STATE_CONNECTED		0x2
 #define CTX_STATE_DISCONNECTING		0x3
+#define CTX_STATE_CONNECTING		0x4
 #define CTX_STATE_DEBUG			0xFE
 #define CTX_STATE_DEAD			0xFF
 	u32				status;
 	int				errno; /* when CTX_STATE_DEAD */
+	/* On part connect_list, holds a reserved hwctx of the partition */
+	bool				connecting;
 	bool				should_block;
 	int				priority;
 	struct aie2_partition		*part;
+	/* NPU busy time in ns, orders same priority contexts on runqueue */
+	u64				vruntime;
+	ktime_t				last_done_ts;
+	/* From QoS latency/fps in ns, 0 if context has no deadline */
+	u64				rel_deadline;
+	u64				exec_budget;
+	/* Latest connect time of a waiting context, EDF key on runqueue */
+	ktime_t				deadline;
+	u64				deadline_miss;
+	/*
+	 * Inherited from a higher priority waiter on this context's fence,
+	 * CTX_RQ_NUM_QUEUE if none. Dropped once boost_until completed.
+	 */
+	int				boost_prio;
+	u64				boost_until;
+	/* Context switch cost, EWMA of hwctx save plus restore time in ns */
+	u64				switch_cost;
+	u64				last_stop_ns;
+	u64				last_start_ns;
+	/* Largest save plus restore buffer of preemptible commands */
+	u32				preempt_buf_size;
+	u64				preempt_cnt;
+	struct aie2_rq_stats		rq_stats;
+
+	/* Efficiency mode, 0 if off. Holds jobs of an idle context */
+	u32				coalesce_us;
+	spinlock_t			coalesce_lock; /* protect coalesce_gate */
+	struct dma_fence		*coalesce_gate;
+	struct hrtimer			coalesce_timer;
+
+	/* Max sub-commands per chain message, 0 if not limited */
+	u32				chain_progress;
+
+	/* User mapped completion state, see struct amdxdna_ctx_seq_page */
+	struct amdxdna_gem_obj		*seq_abo;
+	struct iosys_map		seq_map;
+	struct amdxdna_ctx_seq_page	*seq_page;
 
 	/* Hardware context related in below */
 	u32				id;
@@ -260,6 +365,8 @@ struct aie2_partition {
 #define CTX_RQ_NUM_QUEUE	4
 	struct list_head	runqueue[CTX_RQ_NUM_QUEUE];
 	struct list_head	conn_list;
+	/* Contexts talking to firmware without dev_lock, see part_ctx_start() */
+	struct list_head	connect_list;
 	struct aie2_ctx_rq	*rq;
 
 	struct work_struct	sched_work;
@@ -281,6 +388,8 @@ struct aie2_ctx_rq {
 	u32			total_cols;
 
 	struct workqueue_struct	*work_q;
+	/* Partition sched_work, unbound so partitions connect in parallel */
+	struct workqueue_struct	*sched_wq;
 	struct work_struct	parts_work;
 	bool			paused;
 
@@ -296,6 +405,8 @@ struct aie2_ctx_rq {
 	u32			rt_ctx_cnt;
 	int			*col_arr;
 	u32			max_cols;
+	/* Floor for vruntime of newly dispatched context, per priority */
+	u64			min_vruntime[CTX_RQ_NUM_QUEUE];
 };
 
 struct async_events;
@@ -327,15 +438,38 @@ struct amdxdna_dev_hdl {
 	u32				npuclk_freq;
 	u32				hclk_freq;
 	bool				force_preempt_enabled;
+	/* Writers hold aie2_lock, cached GET_INFO queries read without it */
+	seqcount_mutex_t		info_seq;
+	/* DPM governor, busy time is accumulated on job completion */
+	struct delayed_work		dpm_gov_work;
+	atomic_t			dpm_gov_armed; /* PM_GOV_*, see aie2_pm.c */
+	atomic64_t			busy_ns;
+	atomic64_t			busy_last_ns;
+	u64				gov_busy_ns;
+	ktime_t				gov_ts;
+	u32				gov_down_cnt;
+	/* Clock gating keep-warm, see aie2_pm.c */
+	atomic64_t			last_submit_ns;
+	u64				arrival_ns;
+	u64				gate_cnt;
+	u64				ungate_cnt;
 
 	/* Mailbox and the management channel */
 	struct mailbox			*mbox;
 	struct mailbox_channel		*mgmt_chann;
+	/* User queries sent to mgmt_chann, see aie2_mgmt_query_ratelimit() */
+	struct ratelimit_state		mgmt_query_rs;
 	struct async_events		*async_events;
 	struct event_trace_req_buf	*event_trace_req;
+	struct work_struct		late_init_work;
+	/* Telemetry rings sampled into client BOs, see aie2_telemetry.c */
+	struct list_head		telemetry_rings;
+	struct delayed_work		telemetry_work;
 
 	u32				dev_status;
 	u32				hwctx_cnt;
+	/* Firmware is stopped next, skip per context teardown messages */
+	bool				fw_stopping;
 
 	/*
 	 * The aie2_lock should be used in non critical path for below purposes
@@ -380,6 +514,7 @@ struct amdxdna_dev_priv {
 	u32				mbox_size;
 	u32				hwctx_limit; /* Hardware determine */
 	u32				ctx_limit; /* Driver determine */
+	u32				ctx_max_cmds; /* Max in-flight cmds per ctx, power of 2 */
 	u32				sram_dev_addr;
 	struct aie2_bar_off_pair	sram_offs[SRAM_MAX_INDEX];
 	struct aie2_bar_off_pair	psp_regs_off[PSP_MAX_REGS];
@@ -429,6 +564,13 @@ int aie2_smu_get_power_state(struct amdxdna_dev_hdl *ndev);
 int aie2_pm_init(struct amdxdna_dev_hdl *ndev);
 void aie2_pm_fini(struct amdxdna_dev_hdl *ndev);
 int aie2_pm_set_mode(struct amdxdna_dev_hdl *ndev, int target);
+void aie2_pm_gov_stop(struct amdxdna_dev_hdl *ndev);
+bool aie2_pm_gov_enabled(void);
+void aie2_pm_account_busy(struct amdxdna_dev_hdl *ndev, ktime_t start, ktime_t now);
+void aie2_pm_note_submit(struct amdxdna_dev_hdl *ndev, ktime_t now);
+bool aie2_pm_prewarm_lead_valid(u32 lead_us);
+void aie2_pm_prewarm(struct amdxdna_dev_hdl *ndev, u32 lead_us);
+int aie2_pm_clk_gating_show(struct amdxdna_dev_hdl *ndev, struct seq_file *m);
 
 static inline bool aie2_pm_is_turbo(struct amdxdna_dev_hdl *ndev)
 {
@@ -449,6 +591,11 @@ void aie2_error_async_events_free(struct amdxdna_dev_hdl *ndev);
 int aie2_error_async_events_send(struct amdxdna_dev_hdl *ndev);
 int aie2_error_async_msg_thread(void *data);
 
+/* aie2_telemetry.c */
+void aie2_telemetry_init(struct amdxdna_dev_hdl *ndev);
+void aie2_telemetry_fini(struct amdxdna_dev_hdl *ndev);
+int aie2_set_telemetry_ring(struct amdxdna_client *client, struct amdxdna_drm_set_state *args);
+
 /* aie2_event_trace.c */
 bool aie2_is_event_trace_enable(struct amdxdna_dev_hdl *ndev);
 int aie2_event_trace_init(struct amdxdna_dev_hdl *ndev);
@@ -456,6 +603,11 @@ void aie2_event_trace_fini(struct amdxdna_dev_hdl *ndev);
 void aie2_set_trace_timestamp(struct amdxdna_dev_hdl *ndev, struct start_event_trace_resp *resp);
 void aie2_unset_trace_timestamp(struct amdxdna_dev_hdl *ndev);
 void aie2_assign_event_trace_state(struct amdxdna_dev_hdl *ndev, bool state);
+int aie2_event_trace_ring_open(struct amdxdna_dev_hdl *ndev);
+void aie2_event_trace_ring_release(struct amdxdna_dev_hdl *ndev);
+int aie2_event_trace_ring_mmap(struct amdxdna_dev_hdl *ndev, struct vm_area_struct *vma);
+__poll_t aie2_event_trace_ring_poll(struct amdxdna_dev_hdl *ndev, struct file *file,
+				    poll_table *wait);
 
 /* aie2_message.c */
 int aie2_suspend_fw(struct amdxdna_dev_hdl *ndev);
@@ -468,6 +620,8 @@ int aie2_query_telemetry(struct amdxdna_dev_hdl *ndev, u32 type, dma_addr_t addr
 			 u32 size, struct aie_version *version);
 int aie2_query_aie_version(struct amdxdna_dev_hdl *ndev, struct aie_version *version);
 int aie2_query_aie_metadata(struct amdxdna_dev_hdl *ndev, struct aie_metadata *metadata);
+int aie2_query_fw_info(struct amdxdna_dev_hdl *ndev, struct amdxdna_fw_ver *fw_ver,
+		       struct aie_version *version, struct aie_metadata *metadata);
 int aie2_query_firmware_version(struct amdxdna_dev_hdl *ndev,
 				struct amdxdna_fw_ver *fw_ver);
 int aie2_start_event_trace(struct amdxdna_dev_hdl *ndev, dma_addr_t addr, u32 size);
@@ -487,6 +641,8 @@ int aie2_legacy_config_cu(struct amdxdna_ctx *ctx);
 #endif
 
 int aie2_config_cu(struct amdxdna_ctx *ctx);
+void aie2_put_cu_bos(struct amdxdna_ctx *ctx);
+bool aie2_execbuf_fits_msg(struct amdxdna_gem_obj *cmd_abo);
 int aie2_execbuf(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
@@ -495,8 +651,12 @@ int aie2_cmdlist_single_execbuf(struct amdxdna_ctx *ctx,
 int aie2_cmdlist_multi_execbuf(struct amdxdna_ctx *ctx,
 			       struct amdxdna_sched_job *job,
 			       int (*notify_cb)(void *, void __iomem *, size_t));
+int aie2_cmdlist_prepare_chain(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+			       u64 seq);
 int aie2_sync_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		 int (*notify_cb)(void *, void __iomem *, size_t));
+int aie2_copy_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+		 int (*notify_cb)(void *, void __iomem *, size_t));
 int aie2_config_debug_bo(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 			 int (*notify_cb)(void *, void __iomem *, size_t));
 
@@ -505,17 +665,23 @@ int aie2_ctx_init(struct amdxdna_ctx *ctx);
 void aie2_ctx_fini(struct amdxdna_ctx *ctx);
 int aie2_ctx_connect(struct amdxdna_ctx *ctx);
 void aie2_ctx_disconnect(struct amdxdna_ctx *ctx, bool wait);
+int aie2_ctx_job_ts(struct amdxdna_ctx *ctx, u64 seq, struct aie2_job_ts *out);
 int aie2_ctx_config(struct amdxdna_ctx *ctx, u32 type, u64 value, void *buf, u32 size);
 int aie2_cmd_submit(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
 		    u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt, u64 *seq);
 int aie2_cmd_wait(struct amdxdna_ctx *ctx, u64 seq, u32 timeout);
 struct dma_fence *aie2_cmd_get_out_fence(struct amdxdna_ctx *ctx, u64 seq);
 void aie2_hmm_invalidate(struct amdxdna_gem_obj *abo, unsigned long cur_seq);
+int aie2_heap_attach(struct amdxdna_client *client, struct amdxdna_gem_obj *heap);
 void aie2_dump_ctx(struct amdxdna_client *client);
 
 /* aie2_hwctx.c */
+int aie2_hwctx_map_heap(struct amdxdna_ctx *ctx, struct amdxdna_gem_obj *heap);
+int aie2_hwctx_sched_init(struct amdxdna_ctx *ctx);
+void aie2_hwctx_sched_fini(struct amdxdna_ctx *ctx);
 int aie2_hwctx_start(struct amdxdna_ctx *ctx);
 void aie2_hwctx_stop(struct amdxdna_ctx *ctx);
+int aie2_hwctx_update_qos(struct amdxdna_ctx *ctx);
 int aie2_xrs_load_hwctx(struct amdxdna_ctx *ctx, struct xrs_action_load *action);
 int aie2_xrs_unload_hwctx(struct amdxdna_ctx *ctx);
 
@@ -523,15 +689,23 @@ int aie2_xrs_unload_hwctx(struct amdxdna_ctx *ctx);
 int aie2_rq_init(struct aie2_ctx_rq *rq);
 void aie2_rq_fini(struct aie2_ctx_rq *rq);
 bool aie2_rq_handle_idle_ctx(struct aie2_ctx_rq *rq);
-bool aie2_rq_is_all_context_stuck(struct aie2_ctx_rq *rq);
+u32 aie2_rq_stuck_cols(struct aie2_ctx_rq *rq);
+void aie2_rq_reset_cols(struct aie2_ctx_rq *rq, u32 cols);
 void aie2_rq_stop_all(struct aie2_ctx_rq *rq);
 void aie2_rq_restart_all(struct aie2_ctx_rq *rq);
+void aie2_rq_prewarm(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
+int aie2_rq_migrate(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx, u32 start_col);
+int aie2_rq_update_qos(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx,
+		       const struct amdxdna_qos_info *qos);
 int aie2_rq_show(struct aie2_ctx_rq *rq, struct seq_file *m);
+int aie2_rq_stats_show(struct aie2_ctx_rq *rq, struct seq_file *m);
+void aie2_rq_ctx_stats(struct amdxdna_ctx *ctx, struct amdxdna_drm_query_ctx_rq_stats *stats);
 
 int aie2_rq_add(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
 void aie2_rq_del(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
 int aie2_rq_submit_enter(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx);
 void aie2_rq_submit_exit(struct amdxdna_ctx *ctx);
 void aie2_rq_yield(struct amdxdna_ctx *ctx);
+void aie2_rq_boost(struct aie2_ctx_rq *rq, struct amdxdna_ctx *ctx, int prio);
 
 #endif /* _AIE2_PCI_H_ */
@@ -3,11 +3,36 @@
  * Copyright (C) 2024-2025, Advanced Micro Devices, Inc.
  */
 
+#include <linux/seq_file.h>
+
 #include "aie2_pci.h"
 
 #define AIE2_CLK_GATING_ENABLE	1
 #define AIE2_CLK_GATING_DISABLE	0
 
+/* Step up at once when busy, step down only after a few idle samples */
+#define PM_GOV_UP_UTIL		80
+#define PM_GOV_DOWN_UTIL	40
+#define PM_GOV_DOWN_SAMPLES	3
+
+/* Keep-warm window is at most this many times clk_gating_delay_ms */
+#define PM_WARM_MAX_DELAYS	10
+
+/* dpm_gov_armed, work is queued by a submit or re-armed by itself */
+#define PM_GOV_IDLE		0
+#define PM_GOV_ARMED		1
+#define PM_GOV_RUNNING		2
+
+static uint dpm_gov_interval_ms;
+module_param(dpm_gov_interval_ms, uint, 0400);
+MODULE_PARM_DESC(dpm_gov_interval_ms,
+		 "DPM governor sample interval in ms while device is busy, 0 to select DPM level by QoS (Default 0)");
+
+static uint clk_gating_delay_ms = 100;
+module_param(clk_gating_delay_ms, uint, 0600);
+MODULE_PARM_DESC(clk_gating_delay_ms,
+		 "Minimum idle time in ms before clock gating, 0 to always gate (Default 100)");
+
 static int pm_set_clk_gating(struct amdxdna_dev_hdl *ndev, u32 val)
 {
 	int ret;
@@ -65,11 +90,271 @@ static int pm_set_mode(struct amdxdna_dev_hdl *ndev, int target, bool cache_pw_m
 		return ret;
 
 	if (cache_pw_mode)
-		ndev->pw_mode = target;
+		WRITE_ONCE(ndev->pw_mode, target);
 
 	return 0;
 }
 
+bool aie2_pm_gov_enabled(void)
+{
+	return dpm_gov_interval_ms;
+}
+
+/*
+ * Jobs of all contexts overlap on device. Count the time since the later of
+ * job start and the last completion on device, so the sum is busy time.
+ */
+void aie2_pm_account_busy(struct amdxdna_dev_hdl *ndev, ktime_t start, ktime_t now)
+{
+	s64 last, from;
+
+	last = atomic64_xchg(&ndev->busy_last_ns, ktime_to_ns(now));
+	from = max(ktime_to_ns(start), last);
+	if (ktime_to_ns(now) > from)
+		atomic64_add(ktime_to_ns(now) - from, &ndev->busy_ns);
+}
+
+static bool pm_work_wanted(void)
+{
+	return dpm_gov_interval_ms || READ_ONCE(clk_gating_delay_ms);
+}
+
+/* Governor and keep-warm only run while there is work, armed by submits */
+static void pm_gov_arm(struct amdxdna_dev_hdl *ndev)
+{
+	if (!pm_work_wanted())
+		return;
+	if (atomic_cmpxchg(&ndev->dpm_gov_armed, PM_GOV_IDLE, PM_GOV_ARMED) != PM_GOV_IDLE)
+		return;
+
+	queue_delayed_work(system_wq, &ndev->dpm_gov_work, 0);
+}
+
+/* Inter-arrival time of jobs on device, for clock gating keep-warm window */
+void aie2_pm_note_submit(struct amdxdna_dev_hdl *ndev, ktime_t now)
+{
+	s64 prev, gap;
+
+	prev = atomic64_xchg(&ndev->last_submit_ns, ktime_to_ns(now));
+	pm_gov_arm(ndev);
+	gap = ktime_to_ns(now) - prev;
+	if (!prev || gap <= 0 || gap > NSEC_PER_SEC)
+		return;
+
+	WRITE_ONCE(ndev->arrival_ns, (7 * READ_ONCE(ndev->arrival_ns) + gap) / 8);
+}
+
+/*
+ * Expect next job within twice the average inter-arrival time. Keep clocks
+ * ungated in that window, so that periodic work does not pay the ungate
+ * latency for every job.
+ */
+static u64 pm_warm_window_ns(struct amdxdna_dev_hdl *ndev)
+{
+	u64 delay = (u64)clk_gating_delay_ms * NSEC_PER_MSEC;
+
+	return clamp(2 * READ_ONCE(ndev->arrival_ns), delay, delay * PM_WARM_MAX_DELAYS);
+}
+
+/* Returns ns left in the keep-warm window, 0 once clocks may be gated */
+static u64 pm_gating_update(struct amdxdna_dev_hdl *ndev, ktime_t now)
+{
+	u32 gating = AIE2_CLK_GATING_ENABLE;
+	u64 window;
+	s64 idle;
+
+	if (!READ_ONCE(clk_gating_delay_ms) || ndev->pw_mode != POWER_MODE_DEFAULT)
+		return 0;
+
+	idle = ktime_to_ns(now) - atomic64_read(&ndev->last_submit_ns);
+	window = pm_warm_window_ns(ndev);
+	if (idle < (s64)window)
+		gating = AIE2_CLK_GATING_DISABLE;
+	if (gating == ndev->clk_gating)
+		goto out;
+
+	if (pm_set_clk_gating(ndev, gating)) {
+		XDNA_WARN(ndev->xdna, "Set clock gating %d failed", gating);
+		goto out;
+	}
+
+	if (gating == AIE2_CLK_GATING_ENABLE)
+		ndev->gate_cnt++;
+	else
+		ndev->ungate_cnt++;
+out:
+	return gating == AIE2_CLK_GATING_DISABLE ? window - max_t(s64, idle, 0) : 0;
+}
+
+/*
+ * Lead time can not be longer than the largest keep-warm window. Otherwise a
+ * single call keeps clocks ungated and last_submit_ns in the future for long.
+ */
+bool aie2_pm_prewarm_lead_valid(u32 lead_us)
+{
+	u64 max_ns = (u64)READ_ONCE(clk_gating_delay_ms) * NSEC_PER_MSEC * PM_WARM_MAX_DELAYS;
+
+	return (u64)lead_us * NSEC_PER_USEC <= max_ns;
+}
+
+/*
+ * Work is expected in lead_us. Keep-warm window counts from then, and DPM
+ * starts from the top, governor brings it down if the device stays idle.
+ */
+void aie2_pm_prewarm(struct amdxdna_dev_hdl *ndev, u32 lead_us)
+{
+	struct amdxdna_dev *xdna = ndev->xdna;
+	ktime_t arrive;
+
+	drm_WARN_ON(&xdna->ddev, !mutex_is_locked(&ndev->aie2_lock));
+	if (ndev->pw_mode != POWER_MODE_DEFAULT)
+		return;
+
+	/* Checked by caller, but clk_gating_delay_ms may have changed since */
+	if (!aie2_pm_prewarm_lead_valid(lead_us))
+		lead_us = 0;
+	arrive = ktime_add_us(ktime_get(), lead_us);
+	if (ktime_to_ns(arrive) > atomic64_read(&ndev->last_submit_ns))
+		atomic64_set(&ndev->last_submit_ns, ktime_to_ns(arrive));
+	pm_gating_update(ndev, ktime_get());
+	/* Gates clocks again if the work does not show up */
+	pm_gov_arm(ndev);
+
+	if (!aie2_pm_gov_enabled() || ndev->dpm_level == ndev->max_dpm_level)
+		return;
+
+	XDNA_DBG(xdna, "Pre-warm in %u us, DPM level %d -> %d", lead_us,
+		 ndev->dpm_level, ndev->max_dpm_level);
+	if (ndev->priv->hw_ops.set_dpm(ndev, ndev->max_dpm_level))
+		XDNA_WARN(xdna, "Pre-warm set DPM level failed");
+	ndev->gov_down_cnt = 0;
+}
+
+int aie2_pm_clk_gating_show(struct amdxdna_dev_hdl *ndev, struct seq_file *m)
+{
+	mutex_lock(&ndev->aie2_lock);
+	seq_printf(m, "Clock gating %s, delay %u ms, keep-warm window %llu us\n",
+		   ndev->clk_gating ? "enabled" : "disabled", clk_gating_delay_ms,
+		   div_u64(pm_warm_window_ns(ndev), NSEC_PER_USEC));
+	seq_printf(m, "Average inter-arrival %llu us, gate %llu ungate %llu\n",
+		   div_u64(READ_ONCE(ndev->arrival_ns), NSEC_PER_USEC),
+		   ndev->gate_cnt, ndev->ungate_cnt);
+	mutex_unlock(&ndev->aie2_lock);
+	return 0;
+}
+
+static void pm_gov_reset(struct amdxdna_dev_hdl *ndev)
+{
+	ndev->gov_ts = ktime_get();
+	ndev->gov_busy_ns = atomic64_read(&ndev->busy_ns);
+	ndev->gov_down_cnt = 0;
+}
+
+static u32 pm_gov_next_level(struct amdxdna_dev_hdl *ndev, u64 util)
+{
+	u32 level = ndev->dpm_level;
+
+	if (util >= PM_GOV_UP_UTIL) {
+		ndev->gov_down_cnt = 0;
+		return min(level + 1, ndev->max_dpm_level);
+	}
+
+	if (util >= PM_GOV_DOWN_UTIL || !level) {
+		ndev->gov_down_cnt = 0;
+		return level;
+	}
+
+	if (++ndev->gov_down_cnt < PM_GOV_DOWN_SAMPLES)
+		return level;
+
+	ndev->gov_down_cnt = 0;
+	return level - 1;
+}
+
+/*
+ * Samples device load and the keep-warm window. Re-arms itself while the
+ * device is busy, clocks are held ungated or DPM can still step down, and
+ * stops once there is nothing left to do. The next submit arms it again.
+ */
+static void pm_gov_work(struct work_struct *work)
+{
+	struct amdxdna_dev_hdl *ndev;
+	u64 busy, elapsed, util;
+	u64 warm_ns, next_ns;
+	s64 last_submit;
+	bool fresh;
+	u32 level;
+	ktime_t now;
+
+	ndev = container_of(to_delayed_work(work), struct amdxdna_dev_hdl, dpm_gov_work);
+
+	mutex_lock(&ndev->aie2_lock);
+	/* Stopped or suspended, next submit after resume arms it */
+	if (ndev->dev_status != AIE2_DEV_START) {
+		atomic_set(&ndev->dpm_gov_armed, PM_GOV_IDLE);
+		mutex_unlock(&ndev->aie2_lock);
+		return;
+	}
+
+	now = ktime_get();
+	last_submit = atomic64_read(&ndev->last_submit_ns);
+	busy = atomic64_read(&ndev->busy_ns);
+	elapsed = ktime_to_ns(ktime_sub(now, ndev->gov_ts));
+	warm_ns = pm_gating_update(ndev, now);
+	next_ns = warm_ns;
+	/* Time since the work last stopped is not a load sample */
+	fresh = atomic_xchg(&ndev->dpm_gov_armed, PM_GOV_RUNNING) == PM_GOV_ARMED;
+	/* Other power modes have a fixed level */
+	if (!dpm_gov_interval_ms || ndev->pw_mode != POWER_MODE_DEFAULT)
+		goto out;
+
+	next_ns = (u64)dpm_gov_interval_ms * NSEC_PER_MSEC;
+	if (warm_ns)
+		next_ns = min(next_ns, warm_ns);
+	if (fresh || !elapsed)
+		goto out;
+
+	util = div64_u64((busy - ndev->gov_busy_ns) * 100, elapsed);
+	level = pm_gov_next_level(ndev, util);
+	/* Nothing to sample or step down anymore */
+	if (!util && !level && !warm_ns)
+		next_ns = 0;
+	if (level == ndev->dpm_level)
+		goto out;
+
+	XDNA_DBG(ndev->xdna, "Busy %llu%%, DPM level %d -> %d", util, ndev->dpm_level, level);
+	if (ndev->priv->hw_ops.set_dpm(ndev, level))
+		XDNA_WARN(ndev->xdna, "Governor set DPM level %d failed", level);
+out:
+	ndev->gov_ts = now;
+	ndev->gov_busy_ns = busy;
+	if (next_ns) {
+		mutex_unlock(&ndev->aie2_lock);
+		schedule_delayed_work(&ndev->dpm_gov_work, nsecs_to_jiffies(next_ns) + 1);
+		return;
+	}
+
+	atomic_set(&ndev->dpm_gov_armed, PM_GOV_IDLE);
+	mutex_unlock(&ndev->aie2_lock);
+	/* A submit that still saw it running must not be missed */
+	smp_mb__after_atomic();
+	if (atomic64_read(&ndev->last_submit_ns) != last_submit)
+		pm_gov_arm(ndev);
+}
+
+static void pm_gov_start(struct amdxdna_dev_hdl *ndev)
+{
+	pm_gov_reset(ndev);
+	atomic_set(&ndev->dpm_gov_armed, PM_GOV_IDLE);
+}
+
+/* Do NOT hold aie2_lock, the governor work takes it */
+void aie2_pm_gov_stop(struct amdxdna_dev_hdl *ndev)
+{
+	cancel_delayed_work_sync(&ndev->dpm_gov_work);
+	atomic_set(&ndev->dpm_gov_armed, PM_GOV_IDLE);
+}
+
 int aie2_pm_set_mode(struct amdxdna_dev_hdl *ndev, int target)
 {
 	struct amdxdna_dev *xdna = ndev->xdna;
@@ -94,6 +379,7 @@ int aie2_pm_init(struct amdxdna_dev_hdl *ndev)
 		if (ret)
 			return ret;
 
+		pm_gov_start(ndev);
 		return 0;
 	}
 
@@ -112,6 +398,8 @@ int aie2_pm_init(struct amdxdna_dev_hdl *ndev)
 	ndev->pw_mode = POWER_MODE_DEFAULT;
 	ndev->dft_dpm_level = ndev->max_dpm_level;
 
+	INIT_DELAYED_WORK(&ndev->dpm_gov_work, pm_gov_work);
+	pm_gov_start(ndev);
 	return 0;
 }
 
@@ -69,7 +69,7 @@ static int aie2_smu_exec(struct amdxdna_dev_hdl *ndev, u32 reg_cmd,
 
 int npu1_set_dpm(struct amdxdna_dev_hdl *ndev, u32 dpm_level)
 {
-	u32 freq;
+	u32 npuclk, freq;
 	int ret;
 
 	ret = aie2_smu_exec(ndev, AIE2_SMU_SET_MPNPUCLK_FREQ,
@@ -78,7 +78,7 @@ int npu1_set_dpm(struct amdxdna_dev_hdl *ndev, u32 dpm_level)
 		XDNA_ERR(ndev->xdna, "Set npu clock to %d failed, ret %d\n",
 			 ndev->priv->dpm_clk_tbl[dpm_level].npuclk, ret);
 	}
-	ndev->npuclk_freq = freq;
+	npuclk = freq;
 
 	ret = aie2_smu_exec(ndev, AIE2_SMU_SET_HCLK_FREQ,
 			    ndev->priv->dpm_clk_tbl[dpm_level].hclk, &freq);
@@ -86,7 +86,11 @@ int npu1_set_dpm(struct amdxdna_dev_hdl *ndev, u32 dpm_level)
 		XDNA_ERR(ndev->xdna, "Set h clock to %d failed, ret %d\n",
 			 ndev->priv->dpm_clk_tbl[dpm_level].hclk, ret);
 	}
+
+	write_seqcount_begin(&ndev->info_seq);
+	ndev->npuclk_freq = npuclk;
 	ndev->hclk_freq = freq;
+	write_seqcount_end(&ndev->info_seq);
 	ndev->dpm_level = dpm_level;
 
 	XDNA_DBG(ndev->xdna, "MP-NPU clock %d, H clock %d\n",
@@ -113,8 +117,10 @@ int npu4_set_dpm(struct amdxdna_dev_hdl *ndev, u32 dpm_level)
 		return ret;
 	}
 
+	write_seqcount_begin(&ndev->info_seq);
 	ndev->npuclk_freq = ndev->priv->dpm_clk_tbl[dpm_level].npuclk;
 	ndev->hclk_freq = ndev->priv->dpm_clk_tbl[dpm_level].hclk;
+	write_seqcount_end(&ndev->info_seq);
 	ndev->dpm_level = dpm_level;
 
 	XDNA_DBG(ndev->xdna, "MP-NPU clock %d, H clock %d\n",
@@ -36,6 +36,8 @@ struct solver_rgroup {
 	u32				npartition_node;
 
 	DECLARE_BITMAP(resbit, XRS_MAX_COL);
+	/* Partition nodes on each column, they overlap with spatial sharing */
+	u16				col_users[XRS_MAX_COL];
 	struct list_head		node_list;
 	struct list_head		pt_node_list;
 };
@@ -156,6 +158,8 @@ static struct solver_node *rg_search_node(struct solver_rgroup *rgp, u64 rid)
 static void remove_partition_node(struct solver_rgroup *rgp,
 				  struct partition_node *pt_node)
 {
+	u32 col;
+
 	pt_node->nshared--;
 	if (pt_node->nshared > 0)
 		return;
@@ -163,10 +167,44 @@ static void remove_partition_node(struct solver_rgroup *rgp,
 	list_del(&pt_node->list);
 	rgp->npartition_node--;
 
-	bitmap_clear(rgp->resbit, pt_node->start_col, pt_node->ncols);
+	for (col = pt_node->start_col; col < pt_node->start_col + pt_node->ncols; col++) {
+		if (!--rgp->col_users[col])
+			clear_bit(col, rgp->resbit);
+	}
 	kfree(pt_node);
 }
 
+static int add_partition_node(struct solver_state *xrs, struct solver_node *snode,
+			      u32 start_col, u32 ncols)
+{
+	struct partition_node *pt_node;
+	u32 col;
+
+	pt_node = kzalloc(sizeof(*pt_node), GFP_KERNEL);
+	if (!pt_node)
+		return -ENOMEM;
+
+	pt_node->nshared = 1;
+	pt_node->start_col = start_col;
+	pt_node->ncols = ncols;
+
+	/*
+	 * Always set exclusive to false for now.
+	 */
+	pt_node->exclusive = false;
+
+	list_add_tail(&pt_node->list, &xrs->rgp.pt_node_list);
+	xrs->rgp.npartition_node++;
+	for (col = start_col; col < start_col + ncols; col++) {
+		xrs->rgp.col_users[col]++;
+		set_bit(col, xrs->rgp.resbit);
+	}
+
+	snode->pt_node = pt_node;
+
+	return 0;
+}
+
 static void remove_solver_node(struct solver_rgroup *rgp,
 			       struct solver_node *node)
 {
@@ -179,43 +217,111 @@ static void remove_solver_node(struct solver_rgroup *rgp,
 	kfree(node);
 }
 
+/*
+ * Length of the free column run containing col. The caller makes sure col
+ * is free.
+ */
+static u32 free_run_len(struct solver_state *xrs, u32 col)
+{
+	u32 total = xrs->cfg.total_col;
+	u32 start = col;
+	u32 end;
+
+	while (start > 0 && !test_bit(start - 1, xrs->rgp.resbit))
+		start--;
+	end = find_next_bit(xrs->rgp.resbit, total, col);
+
+	return min(end, total) - start;
+}
+
+/*
+ * Fragmentation score in percent. 0 means all free columns are contiguous,
+ * close to 100 means free columns are scattered in 1 column holes.
+ */
+static u32 frag_score(struct solver_state *xrs)
+{
+	u32 total = xrs->cfg.total_col;
+	u32 free_cols = 0, largest = 0;
+	u32 start, end;
+
+	start = find_first_zero_bit(xrs->rgp.resbit, total);
+	while (start < total) {
+		end = find_next_bit(xrs->rgp.resbit, total, start);
+		free_cols += end - start;
+		largest = max(largest, end - start);
+		start = find_next_zero_bit(xrs->rgp.resbit, total, end);
+	}
+
+	if (!free_cols)
+		return 0;
+
+	return 100 - largest * 100 / free_cols;
+}
+
 static int get_free_partition(struct solver_state *xrs,
 			      struct solver_node *snode,
 			      struct alloc_requests *req)
 {
-	struct partition_node *pt_node;
 	u32 ncols = req->cdo.ncols;
-	u32 col, i;
+	u32 best_len = U32_MAX;
+	u32 col = 0, len, i;
 
+	/*
+	 * Best fit, take the candidate from the smallest free run that holds
+	 * it. Large runs stay intact for wide contexts.
+	 */
 	for (i = 0; i < snode->cols_len; i++) {
+		if (find_next_bit(xrs->rgp.resbit, XRS_MAX_COL,
+				  snode->start_cols[i]) < snode->start_cols[i] + ncols)
+			continue;
+
+		len = free_run_len(xrs, snode->start_cols[i]);
+		if (len >= best_len)
+			continue;
+
+		best_len = len;
 		col = snode->start_cols[i];
-		if (find_next_bit(xrs->rgp.resbit, XRS_MAX_COL, col) >= col + ncols)
+		if (len == ncols)
 			break;
 	}
 
-	if (i == snode->cols_len)
+	if (best_len == U32_MAX)
 		return -ENODEV;
 
-	pt_node = kzalloc(sizeof(*pt_node), GFP_KERNEL);
-	if (!pt_node)
-		return -ENOMEM;
+	return add_partition_node(xrs, snode, col, ncols);
+}
 
-	pt_node->nshared = 1;
-	pt_node->start_col = col;
-	pt_node->ncols = ncols;
+/*
+ * Candidates all come from one run queue partition, where contexts of
+ * different width overlap and time share the overlapped columns. Take the
+ * candidate whose columns have the fewest users, the first one on a tie.
+ */
+static int get_overlap_partition(struct solver_state *xrs,
+				 struct solver_node *snode,
+				 struct alloc_requests *req)
+{
+	u32 ncols = req->cdo.ncols;
+	u32 best_users = U32_MAX;
+	u32 col = 0, users, c, i;
 
-	/*
-	 * Always set exclusive to false for now.
-	 */
-	pt_node->exclusive = false;
+	for (i = 0; i < snode->cols_len; i++) {
+		if (snode->start_cols[i] + ncols > xrs->cfg.total_col)
+			continue;
 
-	list_add_tail(&pt_node->list, &xrs->rgp.pt_node_list);
-	xrs->rgp.npartition_node++;
-	bitmap_set(xrs->rgp.resbit, pt_node->start_col, pt_node->ncols);
+		users = 0;
+		for (c = snode->start_cols[i]; c < snode->start_cols[i] + ncols; c++)
+			users += xrs->rgp.col_users[c];
+		if (users >= best_users)
+			continue;
 
-	snode->pt_node = pt_node;
+		best_users = users;
+		col = snode->start_cols[i];
+	}
 
-	return 0;
+	if (best_users == U32_MAX)
+		return -ENODEV;
+
+	return add_partition_node(xrs, snode, col, ncols);
 }
 
 static int allocate_partition(struct solver_state *xrs,
@@ -250,7 +356,7 @@ static int allocate_partition(struct solver_state *xrs,
 	}
 
 	if (!rpt_node)
-		return -ENODEV;
+		return get_overlap_partition(xrs, snode, req);
 
 	rpt_node->nshared++;
 	snode->pt_node = rpt_node;
@@ -321,6 +427,7 @@ int xrs_allocate_resource(void *hdl, struct alloc_requests *req, struct amdxdna_
 		return PTR_ERR(snode);
 
 	fill_load_action(xrs, snode, &load_act);
+	req->part = load_act.part;
 	//ret = xrs->cfg.actions->load_hwctx(ctx, &load_act);
 	//if (ret)
 	//	goto free_node;
@@ -332,8 +439,8 @@ int xrs_allocate_resource(void *hdl, struct alloc_requests *req, struct amdxdna_
 	snode->dpm_level = dpm_level;
 	snode->ctx = ctx;
 
-	drm_dbg(xrs->cfg.ddev, "start col %d ncols %d\n",
-		snode->pt_node->start_col, snode->pt_node->ncols);
+	drm_dbg(xrs->cfg.ddev, "start col %d ncols %d, fragmentation %d%%\n",
+		snode->pt_node->start_col, snode->pt_node->ncols, frag_score(xrs));
 
 	return 0;
 
@@ -360,6 +467,30 @@ int xrs_release_resource(void *hdl, u64 rid)
 	return 0;
 }
 
+int xrs_update_qos(void *hdl, struct alloc_requests *req)
+{
+	struct solver_state *xrs = hdl;
+	struct solver_node *node;
+	u32 dpm_level, old_level;
+	int ret;
+
+	node = rg_search_node(&xrs->rgp, req->rid);
+	if (!node)
+		return -ENODEV;
+
+	/* Old request of this node should not hold the level */
+	old_level = node->dpm_level;
+	node->dpm_level = 0;
+	ret = set_dpm_level(xrs, req, &dpm_level);
+	if (ret) {
+		node->dpm_level = old_level;
+		return ret;
+	}
+
+	node->dpm_level = dpm_level;
+	return 0;
+}
+
 void *xrsm_init(struct init_config *cfg)
 {
 	struct solver_rgroup *rgp;
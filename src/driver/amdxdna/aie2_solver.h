@@ -58,6 +58,7 @@ struct alloc_requests {
 	u64			rid;
 	struct cdo_parts	cdo;
 	struct aie_qos		rqos;		/* Requested QoS */
+	struct aie_part		part;		/* Allocated columns, set on success */
 };
 
 /*
@@ -136,4 +137,16 @@ int xrs_allocate_resource(void *hdl, struct alloc_requests *req, struct amdxdna_
  * @rid:	The Request ID to identify the requesting context
  */
 int xrs_release_resource(void *hdl, u64 rid);
+
+/*
+ * xrs_update_qos() - Re-evaluate DPM level for new QoS of an allocated context.
+ *
+ * @hdl:	Resource solver handle obtained from xrs_init()
+ * @req:	Request with the same request id and partition metadata as
+ *		when allocated, and the new QoS.
+ *
+ * Return:	0 when successful, -ENODEV if nothing is allocated for the
+ *		request id. Or standard error number when failing
+ */
+int xrs_update_qos(void *hdl, struct alloc_requests *req);
 #endif /* _AIE2_SOLVER_H */
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/iosys-map.h>
+#include <drm/drm_cache.h>
+#include "aie2_msg_priv.h"
+#include "aie2_pci.h"
+#include "amdxdna_gem.h"
+
+/*
+ * Firmware only answers one-shot telemetry queries. A telemetry ring is
+ * sampled here instead, one query per period into a buffer kept for the
+ * lifetime of the ring, and the result is published to a BO that any
+ * number of readers can map.
+ */
+#define TELEMETRY_MAX_RINGS		4
+#define TELEMETRY_MIN_INTERVAL_MS	10
+#define TELEMETRY_MAX_SLOT_SIZE		SZ_64K
+#define TELEMETRY_MIN_SLOTS		2
+
+struct telemetry_ring {
+	struct list_head			entry;
+	struct amdxdna_client			*client;
+	struct amdxdna_gem_obj			*abo;
+	struct iosys_map			map;
+	struct amdxdna_telemetry_ring_hdr	*hdr;
+	void					*slots;
+	void					*buf;
+	dma_addr_t				dma_addr;
+	size_t					buf_sz;
+	u32					payload_sz;
+	u32					slot_size;
+	u32					nr_slots;
+	u32					type;
+	u32					interval_ms;
+	unsigned long				next;
+	u32					head;
+	u64					seq;
+};
+
+static void telemetry_ring_free(struct amdxdna_dev_hdl *ndev, struct telemetry_ring *ring)
+{
+	struct amdxdna_dev *xdna = ndev->xdna;
+
+	dma_free_noncoherent(xdna->ddev.dev, ring->buf_sz, ring->buf, ring->dma_addr,
+			     DMA_FROM_DEVICE);
+	drm_gem_vunmap_unlocked(to_gobj(ring->abo), &ring->map);
+	amdxdna_gem_put_obj(ring->abo);
+	kfree(ring);
+}
+
+/* BO release may wait on other locks, free rings after aie2_lock is dropped */
+static void telemetry_ring_free_list(struct amdxdna_dev_hdl *ndev, struct list_head *list)
+{
+	struct telemetry_ring *ring, *tmp;
+
+	list_for_each_entry_safe(ring, tmp, list, entry) {
+		list_del(&ring->entry);
+		telemetry_ring_free(ndev, ring);
+	}
+}
+
+static void telemetry_sample(struct amdxdna_dev_hdl *ndev, struct telemetry_ring *ring)
+{
+	struct amdxdna_telemetry_sample *slot;
+	struct aie_version ver;
+	u64 seq;
+	int ret;
+
+	memset(ring->buf, 0, ring->buf_sz);
+	drm_clflush_virt_range(ring->buf, ring->buf_sz); /* device can access */
+	ret = aie2_query_telemetry(ndev, ring->type, ring->dma_addr, ring->payload_sz, &ver);
+	if (ret)
+		return;
+
+	seq = ++ring->seq;
+	slot = ring->slots + (size_t)ring->head * ring->slot_size;
+	ring->head = (ring->head + 1) % ring->nr_slots;
+
+	/* Zero seq tells readers the slot is being rewritten */
+	WRITE_ONCE(slot->seq, 0);
+	smp_wmb();
+	slot->timestamp_ns = ktime_get_ns();
+	slot->major = ver.major;
+	slot->minor = ver.minor;
+	memcpy(slot->data, ring->buf, ring->payload_sz);
+	smp_wmb();
+	WRITE_ONCE(slot->seq, seq);
+	smp_wmb();
+	WRITE_ONCE(ring->hdr->seq, seq);
+}
+
+static void telemetry_schedule(struct amdxdna_dev_hdl *ndev)
+{
+	struct telemetry_ring *ring;
+	unsigned long next = 0;
+	long delay;
+
+	list_for_each_entry(ring, &ndev->telemetry_rings, entry) {
+		if (!next || time_before(ring->next, next))
+			next = ring->next;
+	}
+	if (!next)
+		return;
+
+	delay = max_t(long, (long)(next - jiffies), 1);
+	mod_delayed_work(system_wq, &ndev->telemetry_work, delay);
+}
+
+static void telemetry_work(struct work_struct *work)
+{
+	struct telemetry_ring *ring, *tmp;
+	struct amdxdna_dev_hdl *ndev;
+	unsigned long now;
+	LIST_HEAD(dead);
+
+	ndev = container_of(to_delayed_work(work), struct amdxdna_dev_hdl, telemetry_work);
+
+	mutex_lock(&ndev->aie2_lock);
+	now = jiffies;
+	list_for_each_entry_safe(ring, tmp, &ndev->telemetry_rings, entry) {
+		/* The owner closed the BO handle, nobody can map it anymore */
+		if (!READ_ONCE(to_gobj(ring->abo)->handle_count)) {
+			list_move(&ring->entry, &dead);
+			continue;
+		}
+
+		if (time_before(now, ring->next))
+			continue;
+
+		ring->next = now + msecs_to_jiffies(ring->interval_ms);
+		/* Firmware is not running while suspended, skip the period */
+		if (ndev->dev_status == AIE2_DEV_START)
+			telemetry_sample(ndev, ring);
+	}
+	telemetry_schedule(ndev);
+	mutex_unlock(&ndev->aie2_lock);
+
+	telemetry_ring_free_list(ndev, &dead);
+}
+
+static struct telemetry_ring *
+telemetry_ring_alloc(struct amdxdna_client *client, struct amdxdna_drm_set_telemetry_ring *req)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct telemetry_ring *ring;
+	size_t ring_sz;
+	int ret;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return ERR_PTR(-ENOMEM);
+
+	ring->abo = amdxdna_gem_get_obj(client, req->bo_handle, AMDXDNA_BO_SHARE);
+	if (!ring->abo) {
+		XDNA_ERR(xdna, "Telemetry ring bo %d is not a share bo", req->bo_handle);
+		ret = -EINVAL;
+		goto free_ring;
+	}
+
+	ring_sz = to_gobj(ring->abo)->size;
+	if (ring_sz < sizeof(*ring->hdr) + (size_t)req->slot_size * TELEMETRY_MIN_SLOTS) {
+		XDNA_ERR(xdna, "Telemetry ring bo size 0x%zx too small", ring_sz);
+		ret = -EINVAL;
+		goto put_obj;
+	}
+
+	ret = drm_gem_vmap_unlocked(to_gobj(ring->abo), &ring->map);
+	if (ret) {
+		XDNA_ERR(xdna, "Vmap telemetry ring bo failed, ret %d", ret);
+		goto put_obj;
+	}
+
+	ring->payload_sz = req->slot_size - sizeof(struct amdxdna_telemetry_sample);
+	ring->buf_sz = PAGE_ALIGN(ring->payload_sz);
+	ring->buf = dma_alloc_noncoherent(xdna->ddev.dev, ring->buf_sz, &ring->dma_addr,
+					  DMA_FROM_DEVICE, GFP_KERNEL);
+	if (!ring->buf) {
+		ret = -ENOMEM;
+		goto vunmap;
+	}
+
+	ring->client = client;
+	ring->type = req->type;
+	ring->interval_ms = req->interval_ms;
+	ring->slot_size = req->slot_size;
+	ring->nr_slots = (ring_sz - sizeof(*ring->hdr)) / req->slot_size;
+	ring->hdr = ring->map.vaddr;
+	ring->slots = ring->map.vaddr + sizeof(*ring->hdr);
+
+	memset(ring->map.vaddr, 0, ring_sz);
+	ring->hdr->type = ring->type;
+	ring->hdr->slot_size = ring->slot_size;
+	ring->hdr->nr_slots = ring->nr_slots;
+	return ring;
+
+vunmap:
+	drm_gem_vunmap_unlocked(to_gobj(ring->abo), &ring->map);
+put_obj:
+	amdxdna_gem_put_obj(ring->abo);
+free_ring:
+	kfree(ring);
+	return ERR_PTR(ret);
+}
+
+static int telemetry_ring_check(struct amdxdna_dev *xdna,
+				struct amdxdna_drm_set_telemetry_ring *req)
+{
+	if (req->type == TELEMETRY_TYPE_DISABLED || req->type >= MAX_TELEMETRY_TYPE) {
+		XDNA_ERR(xdna, "Invalid telemetry type %d", req->type);
+		return -EINVAL;
+	}
+
+	if (req->interval_ms < TELEMETRY_MIN_INTERVAL_MS) {
+		XDNA_ERR(xdna, "Telemetry interval %u ms below %u ms",
+			 req->interval_ms, TELEMETRY_MIN_INTERVAL_MS);
+		return -EINVAL;
+	}
+
+	if (req->slot_size <= sizeof(struct amdxdna_telemetry_sample) ||
+	    req->slot_size > TELEMETRY_MAX_SLOT_SIZE ||
+	    !IS_ALIGNED(req->slot_size, sizeof(u64))) {
+		XDNA_ERR(xdna, "Invalid telemetry slot size %u", req->slot_size);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void telemetry_ring_stop(struct amdxdna_dev_hdl *ndev, struct amdxdna_client *client)
+{
+	struct telemetry_ring *ring, *tmp;
+	LIST_HEAD(dead);
+
+	mutex_lock(&ndev->aie2_lock);
+	list_for_each_entry_safe(ring, tmp, &ndev->telemetry_rings, entry) {
+		if (ring->client == client)
+			list_move(&ring->entry, &dead);
+	}
+	mutex_unlock(&ndev->aie2_lock);
+
+	telemetry_ring_free_list(ndev, &dead);
+}
+
+int aie2_set_telemetry_ring(struct amdxdna_client *client, struct amdxdna_drm_set_state *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_dev_hdl *ndev = xdna->dev_handle;
+	struct amdxdna_drm_set_telemetry_ring req;
+	struct telemetry_ring *ring, *iter;
+	u32 cnt = 0;
+	int ret;
+
+	if (args->buffer_size != sizeof(req)) {
+		XDNA_ERR(xdna, "Invalid buffer size. Given: %u Need: %lu.",
+			 args->buffer_size, sizeof(req));
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&req, u64_to_user_ptr(args->buffer), sizeof(req))) {
+		XDNA_ERR(xdna, "Failed to copy telemetry ring request into kernel");
+		return -EFAULT;
+	}
+
+	if (req.bo_handle == AMDXDNA_INVALID_BO_HANDLE) {
+		telemetry_ring_stop(ndev, client);
+		return 0;
+	}
+
+	ret = telemetry_ring_check(xdna, &req);
+	if (ret)
+		return ret;
+
+	ring = telemetry_ring_alloc(client, &req);
+	if (IS_ERR(ring))
+		return PTR_ERR(ring);
+
+	mutex_lock(&ndev->aie2_lock);
+	list_for_each_entry(iter, &ndev->telemetry_rings, entry) {
+		if (iter->abo == ring->abo) {
+			XDNA_ERR(xdna, "Telemetry ring bo %d already sampled", req.bo_handle);
+			ret = -EBUSY;
+			goto unlock;
+		}
+		cnt++;
+	}
+
+	if (cnt >= TELEMETRY_MAX_RINGS) {
+		XDNA_ERR(xdna, "Too many telemetry rings, max %d", TELEMETRY_MAX_RINGS);
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	ring->next = jiffies;
+	list_add_tail(&ring->entry, &ndev->telemetry_rings);
+	telemetry_schedule(ndev);
+	mutex_unlock(&ndev->aie2_lock);
+
+	XDNA_DBG(xdna, "Telemetry ring type %d, %d slots every %d ms",
+		 ring->type, ring->nr_slots, ring->interval_ms);
+	return 0;
+
+unlock:
+	mutex_unlock(&ndev->aie2_lock);
+	telemetry_ring_free(ndev, ring);
+	return ret;
+}
+
+void aie2_telemetry_init(struct amdxdna_dev_hdl *ndev)
+{
+	INIT_LIST_HEAD(&ndev->telemetry_rings);
+	INIT_DELAYED_WORK(&ndev->telemetry_work, telemetry_work);
+}
+
+/* Do NOT hold aie2_lock, the sampler work takes it */
+void aie2_telemetry_fini(struct amdxdna_dev_hdl *ndev)
+{
+	LIST_HEAD(dead);
+
+	cancel_delayed_work_sync(&ndev->telemetry_work);
+
+	mutex_lock(&ndev->aie2_lock);
+	list_splice_init(&ndev->telemetry_rings, &dead);
+	mutex_unlock(&ndev->aie2_lock);
+
+	telemetry_ring_free_list(ndev, &dead);
+}
@@ -5,6 +5,7 @@
 
 #include <linux/version.h>
 #include <linux/kref.h>
+#include <linux/slab.h>
 #include <drm/drm_file.h>
 #include <drm/drm_cache.h>
 #include <drm/drm_syncobj.h>
@@ -16,6 +17,7 @@
 
 #define MAX_CTX_ID		255
 #define MAX_ARG_COUNT		4095
+#define MAX_CMD_COUNT		128
 
 struct amdxdna_fence {
 	struct dma_fence	base;
@@ -56,13 +58,152 @@ static struct dma_fence *amdxdna_fence_create(struct amdxdna_ctx *ctx)
 	return &fence->base;
 }
 
+/* Look up a BO used by a submission and make sure it is pinned */
+static struct drm_gem_object *
+amdxdna_submit_bo_get(struct amdxdna_client *client, u32 bo_hdl)
+{
+	struct drm_gem_object *gobj;
+	int ret;
+
+	gobj = drm_gem_object_lookup(client->filp, bo_hdl);
+	if (!gobj)
+		return ERR_PTR(-ENOENT);
+
+	ret = amdxdna_gem_submit_pin(to_xdna_obj(gobj));
+	if (ret) {
+		drm_gem_object_put(gobj);
+		return ERR_PTR(ret);
+	}
+
+	return gobj;
+}
+
+/* BO stays pinned, shrinker may unpin it once idle */
+static void amdxdna_submit_bo_put(struct drm_gem_object *gobj)
+{
+	amdxdna_gem_submit_unpin(to_xdna_obj(gobj));
+	drm_gem_object_put(gobj);
+}
+
+static void amdxdna_rset_release(struct kref *ref)
+{
+	struct amdxdna_resident_set *rset;
+	int i;
+
+	rset = container_of(ref, struct amdxdna_resident_set, refcnt);
+	for (i = 0; i < rset->bo_cnt; i++)
+		amdxdna_submit_bo_put(rset->bos[i]);
+	kfree(rset);
+}
+
+static void amdxdna_rset_put(struct amdxdna_resident_set *rset)
+{
+	if (rset)
+		kref_put(&rset->refcnt, amdxdna_rset_release);
+}
+
+static struct amdxdna_resident_set *
+amdxdna_rset_get(struct amdxdna_ctx *ctx, u32 id)
+{
+	struct amdxdna_resident_set *rset;
+
+	xa_lock(&ctx->rset_xa);
+	rset = xa_load(&ctx->rset_xa, id);
+	if (rset)
+		kref_get(&rset->refcnt);
+	xa_unlock(&ctx->rset_xa);
+
+	return rset;
+}
+
+static void amdxdna_rset_remove_all(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_resident_set *rset;
+	unsigned long id;
+
+	xa_for_each(&ctx->rset_xa, id, rset) {
+		xa_erase(&ctx->rset_xa, id);
+		amdxdna_rset_put(rset);
+	}
+	xa_destroy(&ctx->rset_xa);
+}
+
+static int amdxdna_rset_add(struct amdxdna_ctx *ctx, void *buf, u32 size, u64 uptr)
+{
+	struct amdxdna_ctx_param_resident_set *param = buf;
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	struct amdxdna_resident_set *rset;
+	int ret, i;
+
+	if (size < sizeof(*param) || !param->num_bos ||
+	    param->num_bos > (size - sizeof(*param)) / sizeof(u32)) {
+		XDNA_ERR(xdna, "Invalid resident set, size %d", size);
+		return -EINVAL;
+	}
+
+	rset = kzalloc(struct_size(rset, bos, param->num_bos), GFP_KERNEL);
+	if (!rset)
+		return -ENOMEM;
+
+	for (i = 0; i < param->num_bos; i++) {
+		rset->bos[i] = amdxdna_submit_bo_get(ctx->client, param->bo_handles[i]);
+		if (IS_ERR(rset->bos[i])) {
+			ret = PTR_ERR(rset->bos[i]);
+			XDNA_ERR(xdna, "Resident BO %d lookup failed, ret %d",
+				 param->bo_handles[i], ret);
+			goto put_bos;
+		}
+		rset->bo_cnt++;
+	}
+	kref_init(&rset->refcnt);
+
+	ret = xa_alloc_cyclic(&ctx->rset_xa, &rset->id, rset, xa_limit_32b,
+			      &ctx->next_rset_id, GFP_KERNEL);
+	if (ret < 0) {
+		XDNA_ERR(xdna, "Allocate resident set ID failed, ret %d", ret);
+		goto put_bos;
+	}
+
+	if (put_user(rset->id, (u32 __user *)u64_to_user_ptr(uptr))) {
+		xa_erase(&ctx->rset_xa, rset->id);
+		ret = -EFAULT;
+		goto put_bos;
+	}
+
+	XDNA_DBG(xdna, "%s resident set %d with %d BOs", ctx->name, rset->id, rset->bo_cnt);
+	return 0;
+
+put_bos:
+	amdxdna_rset_release(&rset->refcnt);
+	return ret;
+}
+
+static int amdxdna_rset_remove(struct amdxdna_ctx *ctx, u32 id)
+{
+	struct amdxdna_resident_set *rset;
+
+	/* In-flight jobs keep their own reference */
+	rset = xa_erase(&ctx->rset_xa, id);
+	if (!rset) {
+		XDNA_DBG(ctx->client->xdna, "%s resident set %d not exist", ctx->name, id);
+		return -EINVAL;
+	}
+
+	amdxdna_rset_put(rset);
+	return 0;
+}
+
 static void amdxdna_ctx_destroy_rcu(struct amdxdna_ctx *ctx, struct srcu_struct *ss)
 {
 	struct amdxdna_dev *xdna = ctx->client->xdna;
 
 	synchronize_srcu(ss);
 
+	/* Stop consuming SQEs before the device layer tears down the queue */
+	amdxdna_ring_fini(ctx);
 	xdna->dev_info->ops->ctx_fini(ctx);
+	amdxdna_rset_remove_all(ctx);
+	mutex_destroy(&ctx->submit_lock);
 	kfree(ctx->name);
 	kfree(ctx);
 }
@@ -104,6 +245,9 @@ int amdxdna_drm_create_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 		ret = -ENOMEM;
 		goto exit;
 	}
+	mutex_init(&ctx->submit_lock);
+	spin_lock_init(&ctx->usage_lock);
+	xa_init_flags(&ctx->rset_xa, XA_FLAGS_ALLOC1);
 
 	if (copy_from_user(&ctx->qos, u64_to_user_ptr(args->qos_p), sizeof(ctx->qos))) {
 		XDNA_ERR(xdna, "Access QoS info failed");
@@ -112,12 +256,15 @@ int amdxdna_drm_create_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 	}
 
 	ctx->client = client;
-	ctx->last_completed = -1;
+	ctx->progress_ts = jiffies;
+	if (args->timeout_ms)
+		ctx->timeout_ms = max(args->timeout_ms, TDR_MIN_TIMEOUT_MS);
 	ctx->num_tiles = args->num_tiles;
 	ctx->mem_size = args->mem_size;
 	ctx->max_opc = args->max_opc;
 	ctx->umq_bo = args->umq_bo;
 	ctx->log_buf_bo = args->log_buf_bo;
+	ctx->max_cmds = args->max_cmds;
 	ret = xa_alloc_cyclic(&client->ctx_xa, &ctx->id, ctx,
 			      XA_LIMIT(AMDXDNA_INVALID_CTX_HANDLE + 1, MAX_CTX_ID),
 			      &client->next_ctxid, GFP_KERNEL);
@@ -142,6 +289,10 @@ int amdxdna_drm_create_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 	args->handle = ctx->id;
 	args->syncobj_handle = ctx->syncobj_hdl;
 	args->umq_doorbell = ctx->doorbell_offset;
+	args->max_cmds = ctx->max_cmds;
+	args->timeout_ms = ctx->timeout_ms;
+	if (ctx->timeout_ms)
+		amdxdna_tdr_kick(&xdna->tdr, ctx->timeout_ms);
 
 	XDNA_DBG(xdna, "PID %d create context %d, ret %d", client->pid, args->handle, ret);
 	drm_dev_exit(idx);
@@ -152,6 +303,7 @@ free_name:
 rm_id:
 	xa_erase(&client->ctx_xa, ctx->id);
 free_ctx:
+	mutex_destroy(&ctx->submit_lock);
 	kfree(ctx);
 exit:
 	drm_dev_exit(idx);
@@ -204,6 +356,9 @@ int amdxdna_drm_config_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 
 	switch (args->param_type) {
 	case DRM_AMDXDNA_CTX_CONFIG_CU:
+	case DRM_AMDXDNA_CTX_ADD_RESIDENT_SET:
+	case DRM_AMDXDNA_CTX_CONFIG_QOS:
+	case DRM_AMDXDNA_CTX_CONFIG_SUBMIT_RING:
 		/* For those types that param_val is pointer */
 		if (buf_size > PAGE_SIZE) {
 			XDNA_ERR(xdna, "Config CU param buffer too large");
@@ -222,6 +377,11 @@ int amdxdna_drm_config_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 		break;
 	case DRM_AMDXDNA_CTX_ASSIGN_DBG_BUF:
 	case DRM_AMDXDNA_CTX_REMOVE_DBG_BUF:
+	case DRM_AMDXDNA_CTX_REMOVE_RESIDENT_SET:
+	case DRM_AMDXDNA_CTX_KICK_SUBMIT_RING:
+	case DRM_AMDXDNA_CTX_CONFIG_COALESCE:
+	case DRM_AMDXDNA_CTX_CONFIG_SEQ_PAGE:
+	case DRM_AMDXDNA_CTX_CONFIG_CHAIN_PROGRESS:
 		/* For those types that param_val is a value */
 		buf = NULL;
 		buf_size = 0;
@@ -239,7 +399,17 @@ int amdxdna_drm_config_ctx_ioctl(struct drm_device *dev, void *data, struct drm_
 		goto unlock_srcu;
 	}
 
-	ret = xdna->dev_info->ops->ctx_config(ctx, args->param_type, val, buf, buf_size);
+	/* Resident sets and submit rings are device independent */
+	if (args->param_type == DRM_AMDXDNA_CTX_ADD_RESIDENT_SET)
+		ret = amdxdna_rset_add(ctx, buf, buf_size, val);
+	else if (args->param_type == DRM_AMDXDNA_CTX_REMOVE_RESIDENT_SET)
+		ret = amdxdna_rset_remove(ctx, (u32)val);
+	else if (args->param_type == DRM_AMDXDNA_CTX_CONFIG_SUBMIT_RING)
+		ret = amdxdna_ring_config(ctx, buf, buf_size);
+	else if (args->param_type == DRM_AMDXDNA_CTX_KICK_SUBMIT_RING)
+		ret = amdxdna_ring_kick(ctx);
+	else
+		ret = xdna->dev_info->ops->ctx_config(ctx, args->param_type, val, buf, buf_size);
 
 unlock_srcu:
 	srcu_read_unlock(&client->ctx_srcu, idx);
@@ -255,7 +425,7 @@ amdxdna_arg_bos_put(struct amdxdna_sched_job *job)
 	for (i = 0; i < job->bo_cnt; i++) {
 		if (!job->bos[i].obj)
 			break;
-		drm_gem_object_put(job->bos[i].obj);
+		amdxdna_submit_bo_put(job->bos[i].obj);
 	}
 }
 
@@ -269,31 +439,11 @@ amdxdna_arg_bos_lookup(struct amdxdna_client *client,
 
 	job->bo_cnt = bo_cnt;
 	for (i = 0; i < job->bo_cnt; i++) {
-		struct amdxdna_gem_obj *abo;
-
-		gobj = drm_gem_object_lookup(client->filp, bo_hdls[i]);
-		if (!gobj) {
-			ret = -ENOENT;
-			goto put_arg_bos;
-		}
-		abo = to_xdna_obj(gobj);
-
-		mutex_lock(&abo->lock);
-		if (abo->flags & BO_SUBMIT_PINNED) {
-			mutex_unlock(&abo->lock);
-			job->bos[i].obj = gobj;
-			continue;
-		}
-
-		ret = amdxdna_gem_pin_nolock(abo);
-		if (ret) {
-			mutex_unlock(&abo->lock);
-			drm_gem_object_put(gobj);
+		gobj = amdxdna_submit_bo_get(client, bo_hdls[i]);
+		if (IS_ERR(gobj)) {
+			ret = PTR_ERR(gobj);
 			goto put_arg_bos;
 		}
-		abo->flags |= BO_SUBMIT_PINNED;
-		mutex_unlock(&abo->lock);
-
 		job->bos[i].obj = gobj;
 	}
 
@@ -306,8 +456,10 @@ put_arg_bos:
 
 void amdxdna_sched_job_cleanup(struct amdxdna_sched_job *job)
 {
-	trace_amdxdna_debug_point(job->ctx->name, job->seq, "job release");
+	trace_xdna_job_stage(job->ctx->client->pid, job->ctx->id, job->ctx->name, job->seq,
+			     job->opcode, "release");
 	amdxdna_arg_bos_put(job);
+	amdxdna_rset_put(job->rset);
 	amdxdna_gem_put_obj(job->cmd_bo);
 }
 
@@ -316,6 +468,20 @@ int amdxdna_lock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx *c
 	struct amdxdna_dev *xdna = job->ctx->client->xdna;
 	int contended = -1, i, ret;
 
+	/* Nothing to order against with one BO, skip the ww acquire context */
+	if (job->bo_cnt <= 1) {
+		if (!job->bo_cnt)
+			return 0;
+
+		ret = dma_resv_lock_interruptible(job->bos[0].obj->resv, NULL);
+		if (ret) {
+			XDNA_ERR(xdna, "Lock BO failed, ret %d", ret);
+			return ret;
+		}
+		job->bos[0].locked = true;
+		return 0;
+	}
+
 	ww_acquire_init(ctx, &reservation_ww_class);
 
 retry:
@@ -383,23 +549,103 @@ void amdxdna_unlock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx
 		job->bos[i].locked = false;
 	}
 
-	ww_acquire_fini(ctx);
+	if (job->bo_cnt > 1)
+		ww_acquire_fini(ctx);
 }
 
-int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
-		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
-		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
-		       u32 ctx_hdl, u64 *seq)
+/*
+ * Jobs are allocated from caches sized by argument BO count, jobs with more
+ * argument BOs than the largest class fall back to kmalloc.
+ */
+static const struct {
+	const char	*name;
+	u32		bo_cnt;
+} amdxdna_job_classes[] = {
+	{ "amdxdna_job_4", 4 },
+	{ "amdxdna_job_16", 16 },
+	{ "amdxdna_job_64", 64 },
+};
+
+static struct kmem_cache *amdxdna_job_caches[ARRAY_SIZE(amdxdna_job_classes)];
+
+int amdxdna_job_cache_init(void)
+{
+	struct amdxdna_sched_job *job;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(amdxdna_job_classes); i++) {
+		amdxdna_job_caches[i] =
+			kmem_cache_create(amdxdna_job_classes[i].name,
+					  struct_size(job, bos, amdxdna_job_classes[i].bo_cnt),
+					  0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!amdxdna_job_caches[i]) {
+			amdxdna_job_cache_fini();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void amdxdna_job_cache_fini(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(amdxdna_job_classes); i++) {
+		kmem_cache_destroy(amdxdna_job_caches[i]);
+		amdxdna_job_caches[i] = NULL;
+	}
+}
+
+static struct amdxdna_sched_job *amdxdna_job_zalloc(u32 arg_bo_cnt)
+{
+	struct amdxdna_sched_job *job;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(amdxdna_job_classes); i++) {
+		if (arg_bo_cnt <= amdxdna_job_classes[i].bo_cnt)
+			break;
+	}
+
+	if (i < ARRAY_SIZE(amdxdna_job_classes))
+		job = kmem_cache_zalloc(amdxdna_job_caches[i], GFP_KERNEL);
+	else
+		job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
+	if (!job)
+		return NULL;
+
+	job->cache_idx = i;
+	return job;
+}
+
+void amdxdna_sched_job_free(struct amdxdna_sched_job *job)
+{
+	dma_fence_chain_free(job->chain);
+	if (job->cache_idx < ARRAY_SIZE(amdxdna_job_classes))
+		kmem_cache_free(amdxdna_job_caches[job->cache_idx], job);
+	else
+		kfree(job);
+}
+
+static struct amdxdna_sched_job *
+amdxdna_job_alloc(struct amdxdna_client *client, u32 opcode, u32 cmd_bo_hdl,
+		  u32 *arg_bo_hdls, u32 arg_bo_cnt)
 {
 	struct amdxdna_dev *xdna = client->xdna;
 	struct amdxdna_sched_job *job;
-	struct amdxdna_ctx *ctx;
-	int ret, idx;
+	int ret;
 
 	XDNA_DBG(xdna, "Command BO hdl %d, Arg BO count %d", cmd_bo_hdl, arg_bo_cnt);
-	job = kzalloc(struct_size(job, bos, arg_bo_cnt), GFP_KERNEL);
+	job = amdxdna_job_zalloc(arg_bo_cnt);
 	if (!job)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
+
+	/* Allocated here so that submit under ctx->submit_lock does not allocate */
+	job->chain = dma_fence_chain_alloc();
+	if (!job->chain) {
+		ret = -ENOMEM;
+		goto free_job;
+	}
 
 	if (cmd_bo_hdl != AMDXDNA_INVALID_BO_HANDLE) {
 		job->cmd_bo = amdxdna_gem_get_obj(client, cmd_bo_hdl, AMDXDNA_BO_CMD);
@@ -421,24 +667,51 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 		}
 	}
 
-	idx = srcu_read_lock(&client->ctx_srcu);
-	ctx = xa_load(&client->ctx_xa, ctx_hdl);
-	if (!ctx) {
-		XDNA_ERR(xdna, "PID %d failed to get ctx %d",
-			 client->pid, ctx_hdl);
-		ret = -EINVAL;
-		goto unlock_srcu;
-	}
-
-	job->ctx = ctx;
 	job->mm = current->mm;
 	job->opcode = opcode;
+	return job;
+
+cmd_put:
+	amdxdna_gem_put_obj(job->cmd_bo);
+free_job:
+	amdxdna_sched_job_free(job);
+	return ERR_PTR(ret);
+}
+
+static void amdxdna_job_free(struct amdxdna_sched_job *job)
+{
+	amdxdna_arg_bos_put(job);
+	amdxdna_rset_put(job->rset);
+	amdxdna_gem_put_obj(job->cmd_bo);
+	amdxdna_sched_job_free(job);
+}
+
+/*
+ * Caller must be in ctx_srcu read side and hold ctx->submit_lock. On success
+ * the job is owned by the device layer. On failure the caller still owns it.
+ */
+static int amdxdna_job_push(struct amdxdna_ctx *ctx, struct amdxdna_sched_job *job,
+			    u32 rset_id, u32 *syncobj_hdls, u64 *syncobj_points,
+			    u32 syncobj_cnt, u64 *seq)
+{
+	struct amdxdna_dev *xdna = ctx->client->xdna;
+	int ret;
 
+	lockdep_assert_held(&ctx->submit_lock);
+
+	if (rset_id) {
+		job->rset = amdxdna_rset_get(ctx, rset_id);
+		if (!job->rset) {
+			XDNA_ERR(xdna, "%s resident set %d not exist", ctx->name, rset_id);
+			return -EINVAL;
+		}
+	}
+
+	job->ctx = ctx;
 	job->fence = amdxdna_fence_create(ctx);
 	if (!job->fence) {
 		XDNA_ERR(xdna, "Failed to create fence");
-		ret = -ENOMEM;
-		goto unlock_srcu;
+		return -ENOMEM;
 	}
 	kref_init(&job->refcnt);
 
@@ -446,9 +719,40 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 					      syncobj_points, syncobj_cnt, seq);
 	if (ret) {
 		XDNA_ERR(xdna, "Submit cmds failed, ret %d", ret);
-		goto put_fence;
+		dma_fence_put(job->fence);
+		job->fence = NULL;
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Push an allocated job to ctx. The job is freed on failure. */
+static int amdxdna_cmd_submit_job(struct amdxdna_client *client,
+				  struct amdxdna_sched_job *job, u32 rset_id,
+				  u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+				  u32 ctx_hdl, u64 *seq)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_ctx *ctx;
+	int ret, idx;
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, ctx_hdl);
+	if (!ctx) {
+		XDNA_ERR(xdna, "PID %d failed to get ctx %d",
+			 client->pid, ctx_hdl);
+		ret = -EINVAL;
+		goto unlock_srcu;
 	}
 
+	mutex_lock(&ctx->submit_lock);
+	ret = amdxdna_job_push(ctx, job, rset_id, syncobj_hdls, syncobj_points,
+			       syncobj_cnt, seq);
+	mutex_unlock(&ctx->submit_lock);
+	if (ret)
+		goto unlock_srcu;
+
 	/*
 	 * The amdxdna_ctx_destroy_rcu() will release ctx and associated
 	 * resource after synchronize_srcu(). The submitted jobs should be
@@ -456,19 +760,288 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 	 * For here we can unlock SRCU.
 	 */
 	srcu_read_unlock(&client->ctx_srcu, idx);
-	trace_amdxdna_debug_point(ctx->name, *seq, "job pushed");
-
 	return 0;
 
-put_fence:
-	dma_fence_put(job->fence);
 unlock_srcu:
 	srcu_read_unlock(&client->ctx_srcu, idx);
-	amdxdna_arg_bos_put(job);
-cmd_put:
-	amdxdna_gem_put_obj(job->cmd_bo);
-free_job:
-	kfree(job);
+	amdxdna_job_free(job);
+	return ret;
+}
+
+int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
+		       u32 cmd_bo_hdl, u32 *arg_bo_hdls, u32 arg_bo_cnt,
+		       u32 *syncobj_hdls, u64 *syncobj_points, u32 syncobj_cnt,
+		       u32 ctx_hdl, u64 *seq)
+{
+	struct amdxdna_sched_job *job;
+
+	job = amdxdna_job_alloc(client, opcode, cmd_bo_hdl, arg_bo_hdls, arg_bo_cnt);
+	if (IS_ERR(job))
+		return PTR_ERR(job);
+
+	return amdxdna_cmd_submit_job(client, job, 0, syncobj_hdls, syncobj_points,
+				      syncobj_cnt, ctx_hdl, seq);
+}
+
+/*
+ * Submit several independent command BOs in one go. All jobs are looked up
+ * and pinned before any of them is pushed, then pushed back to back under
+ * ctx->submit_lock so that they get contiguous sequence numbers.
+ */
+static int amdxdna_drm_submit_execbuf_multi(struct amdxdna_client *client,
+					    struct amdxdna_drm_exec_cmd *args, u32 rset_id)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_sched_job **jobs;
+	u32 cmd_cnt = args->cmd_count;
+	u32 *cmd_bo_hdls, *arg_buf;
+	struct amdxdna_ctx *ctx;
+	u32 i, off, cnt;
+	u32 pushed = 0;
+	int ret, idx;
+	u64 seq;
+
+	/* Nothing is queued until proven otherwise */
+	args->cmd_count = 0;
+	if (cmd_cnt > MAX_CMD_COUNT) {
+		XDNA_ERR(xdna, "Invalid cmd bo count %d", cmd_cnt);
+		return -EINVAL;
+	}
+	if (args->arg_count < cmd_cnt * (rset_id ? 1 : 2) ||
+	    args->arg_count > cmd_cnt * (MAX_ARG_COUNT + 1)) {
+		XDNA_ERR(xdna, "Invalid arg count %d for %d cmds", args->arg_count, cmd_cnt);
+		return -EINVAL;
+	}
+
+	cmd_bo_hdls = kcalloc(cmd_cnt, sizeof(u32), GFP_KERNEL);
+	if (!cmd_bo_hdls)
+		return -ENOMEM;
+	arg_buf = kvcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+	if (!arg_buf) {
+		ret = -ENOMEM;
+		goto free_cmd_bo_hdls;
+	}
+	jobs = kcalloc(cmd_cnt, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto free_arg_buf;
+	}
+
+	if (copy_from_user(cmd_bo_hdls, u64_to_user_ptr(args->cmd_handles),
+			   cmd_cnt * sizeof(u32)) ||
+	    copy_from_user(arg_buf, u64_to_user_ptr(args->args),
+			   args->arg_count * sizeof(u32))) {
+		ret = -EFAULT;
+		goto free_jobs;
+	}
+
+	for (i = 0, off = 0; i < cmd_cnt; i++) {
+		if (off >= args->arg_count) {
+			ret = -EINVAL;
+			goto put_jobs;
+		}
+		cnt = arg_buf[off++];
+		if ((!cnt && !rset_id) || cnt > MAX_ARG_COUNT || cnt > args->arg_count - off) {
+			XDNA_ERR(xdna, "Invalid arg bo count %d for cmd %d", cnt, i);
+			ret = -EINVAL;
+			goto put_jobs;
+		}
+
+		jobs[i] = amdxdna_job_alloc(client, OP_USER, cmd_bo_hdls[i],
+					    cnt ? &arg_buf[off] : NULL, cnt);
+		if (IS_ERR(jobs[i])) {
+			ret = PTR_ERR(jobs[i]);
+			jobs[i] = NULL;
+			goto put_jobs;
+		}
+		off += cnt;
+	}
+	if (off != args->arg_count) {
+		XDNA_ERR(xdna, "Trailing %d args after %d cmds", args->arg_count - off, cmd_cnt);
+		ret = -EINVAL;
+		goto put_jobs;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	ctx = xa_load(&client->ctx_xa, args->ctx);
+	if (!ctx) {
+		XDNA_ERR(xdna, "PID %d failed to get ctx %d", client->pid, args->ctx);
+		ret = -EINVAL;
+		goto unlock_srcu;
+	}
+
+	mutex_lock(&ctx->submit_lock);
+	for (pushed = 0; pushed < cmd_cnt; pushed++) {
+		ret = amdxdna_job_push(ctx, jobs[pushed], rset_id, NULL, NULL, 0, &seq);
+		if (ret)
+			break;
+		if (!pushed)
+			args->seq = seq;
+		jobs[pushed] = NULL;
+	}
+	mutex_unlock(&ctx->submit_lock);
+
+unlock_srcu:
+	srcu_read_unlock(&client->ctx_srcu, idx);
+	args->cmd_count = pushed;
+put_jobs:
+	for (i = 0; i < cmd_cnt; i++) {
+		if (jobs[i])
+			amdxdna_job_free(jobs[i]);
+	}
+free_jobs:
+	kfree(jobs);
+free_arg_buf:
+	kvfree(arg_buf);
+free_cmd_bo_hdls:
+	kfree(cmd_bo_hdls);
+	if (pushed)
+		XDNA_DBG(xdna, "Pushed cmds [%lld, %lld] to scheduler",
+			 args->seq, args->seq + pushed - 1);
+	return ret;
+}
+
+/*
+ * Submit a DAG of commands, possibly across contexts, in one go. Nodes come in
+ * topological order. Each one is pushed with the out fences of the nodes it
+ * depends on as scheduler dependencies, no syncobj round trip needed.
+ */
+static int amdxdna_drm_submit_graph(struct amdxdna_client *client,
+				    struct amdxdna_drm_exec_cmd *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct dma_fence **fences, **deps;
+	struct amdxdna_sched_job **jobs;
+	struct amdxdna_graph_node *nodes;
+	struct amdxdna_graph_node *n;
+	u32 node_cnt = args->cmd_count;
+	struct amdxdna_ctx *ctx;
+	u32 i, j, off, dep_cnt;
+	u32 pushed = 0;
+	u32 *arg_buf;
+	int ret, idx;
+
+	/* Nothing is queued until proven otherwise */
+	args->cmd_count = 0;
+	if (!node_cnt || node_cnt > MAX_CMD_COUNT) {
+		XDNA_ERR(xdna, "Invalid graph node count %d", node_cnt);
+		return -EINVAL;
+	}
+	if (args->arg_count < node_cnt ||
+	    args->arg_count > node_cnt * (MAX_ARG_COUNT + MAX_CMD_COUNT)) {
+		XDNA_ERR(xdna, "Invalid arg count %d for %d nodes", args->arg_count, node_cnt);
+		return -EINVAL;
+	}
+
+	nodes = kcalloc(node_cnt, sizeof(*nodes), GFP_KERNEL);
+	if (!nodes)
+		return -ENOMEM;
+	arg_buf = kvcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+	if (!arg_buf) {
+		ret = -ENOMEM;
+		goto free_nodes;
+	}
+	jobs = kcalloc(node_cnt, sizeof(*jobs) + 2 * sizeof(*fences), GFP_KERNEL);
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto free_arg_buf;
+	}
+	fences = (struct dma_fence **)(jobs + node_cnt);
+	deps = fences + node_cnt;
+
+	if (copy_from_user(nodes, u64_to_user_ptr(args->cmd_handles),
+			   node_cnt * sizeof(*nodes)) ||
+	    copy_from_user(arg_buf, u64_to_user_ptr(args->args),
+			   args->arg_count * sizeof(u32))) {
+		ret = -EFAULT;
+		goto free_jobs;
+	}
+
+	for (i = 0, off = 0; i < node_cnt; i++) {
+		n = &nodes[i];
+		if (!n->arg_count || n->arg_count > MAX_ARG_COUNT || n->dep_count > i ||
+		    n->arg_count + n->dep_count > args->arg_count - off) {
+			XDNA_ERR(xdna, "Invalid arg %d or dep %d count for node %d",
+				 n->arg_count, n->dep_count, i);
+			ret = -EINVAL;
+			goto put_jobs;
+		}
+		for (j = 0; j < n->dep_count; j++) {
+			if (arg_buf[off + n->arg_count + j] >= i) {
+				XDNA_ERR(xdna, "Node %d depends on later node %d",
+					 i, arg_buf[off + n->arg_count + j]);
+				ret = -EINVAL;
+				goto put_jobs;
+			}
+		}
+
+		jobs[i] = amdxdna_job_alloc(client, OP_USER, n->cmd_handle,
+					    &arg_buf[off], n->arg_count);
+		if (IS_ERR(jobs[i])) {
+			ret = PTR_ERR(jobs[i]);
+			jobs[i] = NULL;
+			goto put_jobs;
+		}
+		off += n->arg_count + n->dep_count;
+	}
+	if (off != args->arg_count) {
+		XDNA_ERR(xdna, "Trailing %d args after %d nodes", args->arg_count - off, node_cnt);
+		ret = -EINVAL;
+		goto put_jobs;
+	}
+
+	idx = srcu_read_lock(&client->ctx_srcu);
+	for (i = 0, off = 0; i < node_cnt; i++) {
+		n = &nodes[i];
+		ctx = xa_load(&client->ctx_xa, n->ctx);
+		if (!ctx) {
+			XDNA_ERR(xdna, "PID %d failed to get ctx %d", client->pid, n->ctx);
+			ret = -EINVAL;
+			break;
+		}
+
+		/* A node without out fence has completed already */
+		for (j = 0, dep_cnt = 0; j < n->dep_count; j++) {
+			struct dma_fence *f = fences[arg_buf[off + n->arg_count + j]];
+
+			if (f)
+				deps[dep_cnt++] = f;
+		}
+		off += n->arg_count + n->dep_count;
+		jobs[i]->deps = deps;
+		jobs[i]->dep_cnt = dep_cnt;
+
+		mutex_lock(&ctx->submit_lock);
+		ret = amdxdna_job_push(ctx, jobs[i], 0, NULL, NULL, 0, &n->seq);
+		if (!ret)
+			fences[i] = xdna->dev_info->ops->cmd_get_out_fence(ctx, n->seq);
+		mutex_unlock(&ctx->submit_lock);
+		if (ret)
+			break;
+		jobs[i] = NULL;
+		pushed++;
+	}
+	srcu_read_unlock(&client->ctx_srcu, idx);
+
+	args->cmd_count = pushed;
+	if (pushed && copy_to_user(u64_to_user_ptr(args->cmd_handles), nodes,
+				   pushed * sizeof(*nodes)))
+		ret = -EFAULT;
+
+put_jobs:
+	for (i = 0; i < node_cnt; i++) {
+		if (jobs[i])
+			amdxdna_job_free(jobs[i]);
+		dma_fence_put(fences[i]);
+	}
+free_jobs:
+	kfree(jobs);
+free_arg_buf:
+	kvfree(arg_buf);
+free_nodes:
+	kfree(nodes);
+	if (pushed)
+		XDNA_DBG(xdna, "Pushed %d of %d graph nodes to scheduler", pushed, node_cnt);
 	return ret;
 }
 
@@ -481,34 +1054,54 @@ static int amdxdna_drm_submit_execbuf(struct amdxdna_client *client,
 				      struct amdxdna_drm_exec_cmd *args)
 {
 	struct amdxdna_dev *xdna = client->xdna;
-	u32 *arg_bo_hdls;
+	struct amdxdna_sched_job *job;
+	u32 *arg_bo_hdls = NULL;
 	u32 cmd_bo_hdl;
+	u32 rset_id = 0;
 	int ret;
 
-	if (!args->arg_count || args->arg_count > MAX_ARG_COUNT) {
-		XDNA_ERR(xdna, "Invalid arg bo count %d", args->arg_count);
-		return -EINVAL;
+	if (args->ext_flags & AMDXDNA_EXEC_FLAG_RESIDENT_SET) {
+		rset_id = (u32)args->ext;
+		if (!rset_id || rset_id != args->ext) {
+			XDNA_ERR(xdna, "Invalid resident set %lld", args->ext);
+			return -EINVAL;
+		}
 	}
 
-	/* Only support single command for now. */
-	if (args->cmd_count != 1) {
+	if (!args->cmd_count) {
 		XDNA_ERR(xdna, "Invalid cmd bo count %d", args->cmd_count);
 		return -EINVAL;
 	}
 
+	if (args->cmd_count > 1)
+		return amdxdna_drm_submit_execbuf_multi(client, args, rset_id);
+
+	if ((!args->arg_count && !rset_id) || args->arg_count > MAX_ARG_COUNT) {
+		XDNA_ERR(xdna, "Invalid arg bo count %d", args->arg_count);
+		return -EINVAL;
+	}
+
 	cmd_bo_hdl = (u32)args->cmd_handles;
-	arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
-	if (!arg_bo_hdls)
-		return -ENOMEM;
-	ret = copy_from_user(arg_bo_hdls, u64_to_user_ptr(args->args),
-			     args->arg_count * sizeof(u32));
-	if (ret) {
-		ret = -EFAULT;
+	if (args->arg_count) {
+		arg_bo_hdls = kcalloc(args->arg_count, sizeof(u32), GFP_KERNEL);
+		if (!arg_bo_hdls)
+			return -ENOMEM;
+		ret = copy_from_user(arg_bo_hdls, u64_to_user_ptr(args->args),
+				     args->arg_count * sizeof(u32));
+		if (ret) {
+			ret = -EFAULT;
+			goto free_cmd_bo_hdls;
+		}
+	}
+
+	job = amdxdna_job_alloc(client, OP_USER, cmd_bo_hdl, arg_bo_hdls, args->arg_count);
+	if (IS_ERR(job)) {
+		ret = PTR_ERR(job);
 		goto free_cmd_bo_hdls;
 	}
 
-	ret = amdxdna_cmd_submit(client, OP_USER, cmd_bo_hdl, arg_bo_hdls,
-				 args->arg_count, NULL, NULL, 0, args->ctx, &args->seq);
+	ret = amdxdna_cmd_submit_job(client, job, rset_id, NULL, NULL, 0,
+				     args->ctx, &args->seq);
 
 free_cmd_bo_hdls:
 	kfree(arg_bo_hdls);
@@ -638,12 +1231,89 @@ out:
 	return ret;
 }
 
+static bool amdxdna_copy_range_valid(struct drm_gem_object *gobj, u64 offset, u64 size)
+{
+	return size <= gobj->size && offset <= gobj->size - size;
+}
+
+static int amdxdna_drm_submit_copy_bo(struct amdxdna_client *client,
+				      struct amdxdna_drm_exec_cmd *args)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_cmd_copy_bo copy;
+	struct amdxdna_sched_job *job;
+	struct amdxdna_ctx *ctx;
+	unsigned long ctx_id;
+	u32 bo_hdls[2];
+	int ret, idx;
+
+	if (args->cmd_count != 1 || args->arg_count) {
+		XDNA_ERR(xdna, "Invalid copy bo cmd count %d arg count %d",
+			 args->cmd_count, args->arg_count);
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&copy, u64_to_user_ptr(args->cmd_handles), sizeof(copy)))
+		return -EFAULT;
+
+	/* Firmware DMA length is 32 bits */
+	if (!copy.size || copy.size > U32_MAX) {
+		XDNA_ERR(xdna, "Invalid copy size 0x%llx", copy.size);
+		return -EINVAL;
+	}
+
+	bo_hdls[0] = copy.dst_handle;
+	bo_hdls[1] = copy.src_handle;
+	job = amdxdna_job_alloc(client, OP_COPY_BO, AMDXDNA_INVALID_BO_HANDLE, bo_hdls, 2);
+	if (IS_ERR(job))
+		return PTR_ERR(job);
+
+	if (!amdxdna_copy_range_valid(job->bos[0].obj, copy.dst_offset, copy.size) ||
+	    !amdxdna_copy_range_valid(job->bos[1].obj, copy.src_offset, copy.size)) {
+		XDNA_ERR(xdna, "Copy out of range, dst 0x%llx src 0x%llx size 0x%llx",
+			 copy.dst_offset, copy.src_offset, copy.size);
+		ret = -EINVAL;
+		goto free_job;
+	}
+	job->copy.dst_offset = copy.dst_offset;
+	job->copy.src_offset = copy.src_offset;
+	job->copy.size = copy.size;
+
+	if (args->ctx == AMDXDNA_INVALID_CTX_HANDLE) {
+		ret = -ENOENT;
+		idx = srcu_read_lock(&client->ctx_srcu);
+		amdxdna_for_each_ctx(client, ctx_id, ctx) {
+			args->ctx = ctx_id;
+			ret = 0;
+			break;
+		}
+		srcu_read_unlock(&client->ctx_srcu, idx);
+		if (ret) {
+			XDNA_DBG(xdna, "PID %d has no ctx for copy bo", client->pid);
+			goto free_job;
+		}
+	}
+
+	ret = amdxdna_cmd_submit_job(client, job, 0, NULL, NULL, 0, args->ctx, &args->seq);
+	if (!ret)
+		XDNA_DBG(xdna, "Pushed copy bo cmd %lld to scheduler", args->seq);
+	return ret;
+
+free_job:
+	amdxdna_job_free(job);
+	return ret;
+}
+
 int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_file *filp)
 {
 	struct amdxdna_client *client = filp->driver_priv;
 	struct amdxdna_drm_exec_cmd *args = data;
 
-	if (args->ext || args->ext_flags)
+	if (args->ext_flags & ~AMDXDNA_EXEC_FLAG_RESIDENT_SET)
+		return -EINVAL;
+	if (args->ext && !(args->ext_flags & AMDXDNA_EXEC_FLAG_RESIDENT_SET))
+		return -EINVAL;
+	if (args->ext_flags && args->type != AMDXDNA_CMD_SUBMIT_EXEC_BUF)
 		return -EINVAL;
 
 	switch (args->type) {
@@ -653,6 +1323,10 @@ int amdxdna_drm_submit_cmd_ioctl(struct drm_device *dev, void *data, struct drm_
 		return amdxdna_drm_submit_dependency(client, args);
 	case AMDXDNA_CMD_SUBMIT_SIGNAL:
 		return amdxdna_drm_submit_signal(client, args);
+	case AMDXDNA_CMD_SUBMIT_COPY_BO:
+		return amdxdna_drm_submit_copy_bo(client, args);
+	case AMDXDNA_CMD_SUBMIT_GRAPH:
+		return amdxdna_drm_submit_graph(client, args);
 	}
 
 	XDNA_ERR(client->xdna, "Invalid command type %d", args->type);
@@ -13,6 +13,7 @@
 #include <drm/drm_drv.h>
 #include <drm/gpu_scheduler.h>
 #include "drm_local/amdxdna_accel.h"
+#include "amdxdna_tdr.h"
 
 #ifdef AMDXDNA_SHMEM
 #include "amdxdna_gem.h"
@@ -21,6 +22,7 @@
 #endif
 
 struct amdxdna_ctx_priv;
+struct amdxdna_submit_ring;
 
 enum ert_cmd_opcode {
 	ERT_START_CU		= 0,
@@ -106,19 +108,33 @@ struct amdxdna_ctx {
 	u32				umq_bo;
 	u32				log_buf_bo;
 	u32				doorbell_offset;
+	/* In-flight command window, device layer sets the effective value */
+	u32				max_cmds;
 
 	struct amdxdna_qos_info		     qos;
 	struct amdxdna_ctx_param_config_cu *cus;
 
+	/* Serializes job push so that a batch gets contiguous seq */
+	struct mutex			submit_lock;
+	/* Registered resident BO sets, see amdxdna_resident_set */
+	struct xarray			rset_xa;
+	u32				next_rset_id;
 	/* Submitted, completed, freed job counter */
 	u64				submitted;
 	u64				completed ____cacheline_aligned_in_smp;
 	/* Counter for freed job */
 	atomic64_t			job_free_cnt;
-	/* For context runqueue to keep last completed. low frequency update */
-	u64				last_completed;
+	/* Hang timeout, 0 for timeout_in_sec */
+	u32				timeout_ms;
+	/* Jiffies of last completion, or of submit when it was idle */
+	unsigned long			progress_ts;
+	/* Jobs on the device for fdinfo, see amdxdna_update_stats() */
+	spinlock_t			usage_lock;
+	u32				usage_depth;
 	/* For command completion notification. */
 	u32				syncobj_hdl;
+	/* Optional user mapped submission ring, see amdxdna_ring.c */
+	struct amdxdna_submit_ring	*ring;
 
 	struct list_head		entry;
 	struct work_struct		dispatch_work;
@@ -133,6 +149,17 @@ struct amdxdna_job_bo {
 	bool			locked;
 };
 
+/*
+ * BOs looked up and pinned once for a context. Jobs hold a reference to the
+ * set instead of per BO references.
+ */
+struct amdxdna_resident_set {
+	struct kref		refcnt;
+	u32			id;
+	u32			bo_cnt;
+	struct drm_gem_object	*bos[] __counted_by(bo_cnt);
+};
+
 struct amdxdna_sched_job {
 	struct drm_sched_job	base;
 	struct kref		refcnt;
@@ -149,13 +176,46 @@ struct amdxdna_sched_job {
 #define OP_REG_DEBUG_BO		2
 #define OP_UNREG_DEBUG_BO	3
 #define OP_NOOP			4
+#define OP_COPY_BO		5
 	u32			opcode;
 	int			msg_id;
+	/* Responses left and received of a split command chain */
+	atomic_t		chain_left;
+	u32			chain_done;
+	bool			chain_failed;
+	/* Max sub-commands per message fixed at submit, see CHAIN_PROGRESS */
+	u32			chain_limit;
+	/* When job is submitted, for deadline miss accounting */
+	ktime_t			submit_ts;
+	/* When job is sent to device, for runtime accounting */
+	ktime_t			start_ts;
+	/* When the job is written to the mailbox */
+	ktime_t			sent_ts;
 	struct amdxdna_gem_obj	*cmd_bo;
+	struct amdxdna_resident_set *rset;
+	/* Out fences of other jobs to wait for, only valid during submit */
+	struct dma_fence	**deps;
+	u32			dep_cnt;
+	/* Preallocated syncobj point, consumed by submit */
+	struct dma_fence_chain	*chain;
+	/* Job cache the job comes from, see amdxdna_job_cache_init() */
+	u32			cache_idx;
+	/* For OP_COPY_BO, bos[0] is destination and bos[1] is source */
+	struct {
+		u64		dst_offset;
+		u64		src_offset;
+		u64		size;
+	} copy;
 	size_t			bo_cnt;
 	struct amdxdna_job_bo	bos[] __counted_by(bo_cnt);
 };
 
+/* timeout_in_sec can be set to 0 at runtime, a zero period would find all hung */
+static inline u32 amdxdna_ctx_timeout_ms(struct amdxdna_ctx *ctx)
+{
+	return ctx->timeout_ms ?: max(READ_ONCE(timeout_in_sec) * MSEC_PER_SEC, TDR_MIN_TIMEOUT_MS);
+}
+
 static inline u32
 amdxdna_cmd_get_op(struct amdxdna_gem_obj *abo)
 {
@@ -236,6 +296,9 @@ amdxdna_ctx_col_map(struct amdxdna_ctx *ctx)
 
 void amdxdna_ctx_wait_jobs(struct amdxdna_ctx *ctx, long timeout);
 void amdxdna_sched_job_cleanup(struct amdxdna_sched_job *job);
+void amdxdna_sched_job_free(struct amdxdna_sched_job *job);
+int amdxdna_job_cache_init(void);
+void amdxdna_job_cache_fini(void);
 void amdxdna_ctx_remove_all(struct amdxdna_client *client);
 
 int amdxdna_lock_objects(struct amdxdna_sched_job *job, struct ww_acquire_ctx *ctx);
@@ -248,6 +311,10 @@ int amdxdna_cmd_submit(struct amdxdna_client *client, u32 opcode,
 int amdxdna_cmd_wait(struct amdxdna_client *client, u32 ctx_hdl,
 		     u64 seq, u32 timeout);
 
+int amdxdna_ring_config(struct amdxdna_ctx *ctx, void *buf, u32 size);
+int amdxdna_ring_kick(struct amdxdna_ctx *ctx);
+void amdxdna_ring_fini(struct amdxdna_ctx *ctx);
+
 int amdxdna_drm_create_ctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_config_ctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_destroy_ctx_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
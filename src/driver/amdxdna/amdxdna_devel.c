@@ -6,6 +6,8 @@
 #include <linux/version.h>
 #include <linux/dma-mapping.h>
 #include <linux/sched/clock.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
 
 #include "amdxdna_devel.h"
 #include "amdxdna_trace.h"
@@ -36,9 +38,37 @@ int start_col_index = -1;
 module_param(start_col_index, int, 0600);
 MODULE_PARM_DESC(start_col_index, "Force start column, default -1 (auto select)");
 
+/*
+ * Freed carvedout ranges of small power of 2 sizes are cached per size class
+ * and handed back to the next allocation of the same class. This keeps the
+ * best fit hole search out of the common create/free path and stops short
+ * lived BOs from scattering small holes across the chunk.
+ */
+#define CARVEDOUT_MIN_CLASS_SHIFT	PAGE_SHIFT
+#define CARVEDOUT_MAX_CLASS_SHIFT	20
+#define CARVEDOUT_NR_CLASSES		(CARVEDOUT_MAX_CLASS_SHIFT - CARVEDOUT_MIN_CLASS_SHIFT + 1)
+#define CARVEDOUT_CACHE_DEPTH		16
+
+struct amdxdna_carvedout_range {
+	struct list_head	entry;
+	struct drm_mm_node	node;
+};
+
+struct amdxdna_carvedout_class {
+	struct list_head	free;
+	u32			nr_free;
+	u64			hits;
+	u64			misses;
+};
+
 struct amdxdna_carvedout {
 	struct drm_mm	mm;
-	struct mutex	lock; /* protect mm */
+	struct mutex	lock; /* protect mm, classes and counters */
+	struct amdxdna_carvedout_class	cls[CARVEDOUT_NR_CLASSES];
+	u64		used;
+	u64		peak;
+	u64		nr_allocs;
+	u64		nr_failed;
 } carvedout;
 
 bool amdxdna_use_carvedout(void)
@@ -48,27 +78,136 @@ bool amdxdna_use_carvedout(void)
 
 void amdxdna_carvedout_init(void)
 {
+	int i;
+
 	if (!amdxdna_use_carvedout())
 		return;
 	mutex_init(&carvedout.lock);
 	drm_mm_init(&carvedout.mm, carvedout_addr, carvedout_size);
+	for (i = 0; i < CARVEDOUT_NR_CLASSES; i++)
+		INIT_LIST_HEAD(&carvedout.cls[i].free);
+}
+
+static void amdxdna_carvedout_drain_locked(void)
+{
+	struct amdxdna_carvedout_range *range, *tmp;
+	int i;
+
+	for (i = 0; i < CARVEDOUT_NR_CLASSES; i++) {
+		struct amdxdna_carvedout_class *cls = &carvedout.cls[i];
+
+		list_for_each_entry_safe(range, tmp, &cls->free, entry) {
+			list_del(&range->entry);
+			drm_mm_remove_node(&range->node);
+			kfree(range);
+		}
+		cls->nr_free = 0;
+	}
 }
 
 void amdxdna_carvedout_fini(void)
 {
 	if (!amdxdna_use_carvedout())
 		return;
+	mutex_lock(&carvedout.lock);
+	amdxdna_carvedout_drain_locked();
+	mutex_unlock(&carvedout.lock);
 	mutex_destroy(&carvedout.lock);
 	drm_mm_takedown(&carvedout.mm);
 }
 
+static int amdxdna_carvedout_class(u64 size)
+{
+	int shift;
+
+	if (size > BIT_ULL(CARVEDOUT_MAX_CLASS_SHIFT))
+		return -1;
+
+	shift = max_t(int, order_base_2(size), CARVEDOUT_MIN_CLASS_SHIFT);
+	return shift - CARVEDOUT_MIN_CLASS_SHIFT;
+}
+
+static bool amdxdna_carvedout_cache_get(struct drm_mm_node *node, int idx, u64 alignment)
+{
+	struct amdxdna_carvedout_class *cls = &carvedout.cls[idx];
+	struct amdxdna_carvedout_range *range;
+
+	list_for_each_entry(range, &cls->free, entry) {
+		if (alignment && !IS_ALIGNED(range->node.start, alignment))
+			continue;
+
+		list_del(&range->entry);
+		cls->nr_free--;
+		drm_mm_replace_node(&range->node, node);
+		kfree(range);
+		cls->hits++;
+		return true;
+	}
+
+	cls->misses++;
+	return false;
+}
+
+static bool amdxdna_carvedout_cache_put(struct drm_mm_node *node)
+{
+	struct amdxdna_carvedout_range *range;
+	struct amdxdna_carvedout_class *cls;
+	int idx;
+
+	idx = amdxdna_carvedout_class(node->size);
+	if (idx < 0 || node->size != BIT_ULL(idx + CARVEDOUT_MIN_CLASS_SHIFT))
+		return false;
+
+	cls = &carvedout.cls[idx];
+	if (cls->nr_free >= CARVEDOUT_CACHE_DEPTH)
+		return false;
+
+	range = kzalloc(sizeof(*range), GFP_KERNEL);
+	if (!range)
+		return false;
+
+	drm_mm_replace_node(node, &range->node);
+	list_add(&range->entry, &cls->free);
+	cls->nr_free++;
+	return true;
+}
+
+/*
+ * Sizes up to the largest class are rounded up to their power of 2 class, the
+ * caller sees the rounded size in node->size.
+ */
 int amdxdna_carvedout_alloc(struct drm_mm_node *node, u64 size, u64 alignment)
 {
+	int idx = amdxdna_carvedout_class(size);
 	int ret;
 
+	if (idx >= 0)
+		size = BIT_ULL(idx + CARVEDOUT_MIN_CLASS_SHIFT);
+
 	mutex_lock(&carvedout.lock);
+	if (idx >= 0 && amdxdna_carvedout_cache_get(node, idx, alignment)) {
+		ret = 0;
+		goto account;
+	}
+
 	ret = drm_mm_insert_node_generic(&carvedout.mm, node, size, alignment,
 					 0, DRM_MM_INSERT_BEST);
+	if (ret == -ENOSPC) {
+		/* Cached ranges may be what is keeping the request from fitting */
+		amdxdna_carvedout_drain_locked();
+		ret = drm_mm_insert_node_generic(&carvedout.mm, node, size, alignment,
+						 0, DRM_MM_INSERT_BEST);
+	}
+	if (ret) {
+		carvedout.nr_failed++;
+		goto unlock;
+	}
+
+account:
+	carvedout.used += node->size;
+	carvedout.peak = max(carvedout.peak, carvedout.used);
+	carvedout.nr_allocs++;
+unlock:
 	mutex_unlock(&carvedout.lock);
 	return ret;
 }
@@ -76,7 +215,43 @@ int amdxdna_carvedout_alloc(struct drm_mm_node *node, u64 size, u64 alignment)
 void amdxdna_carvedout_free(struct drm_mm_node *node)
 {
 	mutex_lock(&carvedout.lock);
-	drm_mm_remove_node(node);
+	carvedout.used -= node->size;
+	carvedout.nr_allocs--;
+	if (!amdxdna_carvedout_cache_put(node))
+		drm_mm_remove_node(node);
+	mutex_unlock(&carvedout.lock);
+}
+
+void amdxdna_carvedout_show(struct seq_file *m)
+{
+	u64 hole_start, hole_end, free = 0, largest = 0, holes = 0;
+	struct drm_mm_node *hole;
+	int i;
+
+	if (!amdxdna_use_carvedout()) {
+		seq_puts(m, "carvedout memory not in use\n");
+		return;
+	}
+
+	mutex_lock(&carvedout.lock);
+	drm_mm_for_each_hole(hole, &carvedout.mm, hole_start, hole_end) {
+		free += hole_end - hole_start;
+		largest = max(largest, hole_end - hole_start);
+		holes++;
+	}
+	seq_printf(m, "carvedout 0x%llx size 0x%llx used 0x%llx peak 0x%llx allocs %llu failed %llu\n",
+		   carvedout_addr, carvedout_size, carvedout.used, carvedout.peak,
+		   carvedout.nr_allocs, carvedout.nr_failed);
+	seq_printf(m, "  free 0x%llx holes %llu largest free 0x%llx fragmentation %llu%%\n",
+		   free, holes, largest, free ? 100 - div64_u64(largest * 100, free) : 0);
+
+	for (i = 0; i < CARVEDOUT_NR_CLASSES; i++) {
+		struct amdxdna_carvedout_class *cls = &carvedout.cls[i];
+
+		seq_printf(m, "    class 0x%llx cached %u hits %llu misses %llu\n",
+			   BIT_ULL(i + CARVEDOUT_MIN_CLASS_SHIFT), cls->nr_free,
+			   cls->hits, cls->misses);
+	}
 	mutex_unlock(&carvedout.lock);
 }
 
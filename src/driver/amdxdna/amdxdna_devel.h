@@ -23,6 +23,7 @@ void amdxdna_carvedout_init(void);
 void amdxdna_carvedout_fini(void);
 int amdxdna_carvedout_alloc(struct drm_mm_node *node, u64 size, u64 alignment);
 void amdxdna_carvedout_free(struct drm_mm_node *node);
+void amdxdna_carvedout_show(struct seq_file *m);
 
 int amdxdna_iommu_mode_setup(struct amdxdna_dev *aie);
 struct sg_table *amdxdna_alloc_sgt(struct amdxdna_dev *aie, size_t sz,
@@ -37,6 +37,7 @@ static int amdxdna_drm_open(struct drm_device *ddev, struct drm_file *filp)
 
 	client->pid = pid_nr(filp->pid);
 	client->xdna = xdna;
+	spin_lock_init(&client->stats.lock);
 
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode != AMDXDNA_IOMMU_PASID)
@@ -65,11 +66,6 @@ skip_sva_bind:
 	list_add_tail(&client->node, &xdna->client_list);
 	mutex_unlock(&xdna->dev_lock);
 
-	spin_lock_init(&client->stats.lock);
-	client->stats.job_depth = 0;
-	client->stats.busy_time = ns_to_ktime(0);
-	client->stats.start_time = ns_to_ktime(0);
-
 	filp->driver_priv = client;
 	client->filp = filp;
 
@@ -91,14 +87,15 @@ static void amdxdna_drm_close(struct drm_device *ddev, struct drm_file *filp)
 {
 	struct amdxdna_client *client = filp->driver_priv;
 	struct amdxdna_dev *xdna = to_xdna_dev(ddev);
+	int i;
 
 	XDNA_DBG(xdna, "Closing PID %d", client->pid);
 
 	xa_destroy(&client->ctx_xa);
 	cleanup_srcu_struct(&client->ctx_srcu);
 	mutex_destroy(&client->mm_lock);
-	if (client->dev_heap)
-		drm_gem_object_put(to_gobj(client->dev_heap));
+	for (i = 0; i < client->nr_heap_chunks; i++)
+		drm_gem_object_put(to_gobj(client->heap_chunks[i]));
 
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode != AMDXDNA_IOMMU_PASID)
@@ -189,6 +186,10 @@ static int amdxdna_drm_set_state_ioctl(struct drm_device *dev, void *data, struc
 	if (!xdna->dev_info->ops->set_aie_state)
 		return -EOPNOTSUPP;
 
+	/* Pre-warm is a hint for any client, the rest changes device state */
+	if (args->param != DRM_AMDXDNA_SET_PREWARM && !capable(CAP_SYS_ADMIN))
+		return -EACCES;
+
 	XDNA_DBG(xdna, "Request parameter %u", args->param);
 	ret = xdna->dev_info->ops->set_aie_state(client, args);
 	return ret;
@@ -203,48 +204,81 @@ static const struct drm_ioctl_desc amdxdna_drm_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(AMDXDNA_CREATE_BO, amdxdna_drm_create_bo_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_BO_INFO, amdxdna_drm_get_bo_info_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_SYNC_BO, amdxdna_drm_sync_bo_ioctl, 0),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_SYNC_BOS, amdxdna_drm_sync_bos_ioctl, 0),
 	/* Exectuion */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_EXEC_CMD, amdxdna_drm_submit_cmd_ioctl, 0),
 	DRM_IOCTL_DEF_DRV(AMDXDNA_WAIT_CMD, amdxdna_drm_wait_cmd_ioctl, 0),
 	/* AIE hardware */
 	DRM_IOCTL_DEF_DRV(AMDXDNA_GET_INFO, amdxdna_drm_get_info_ioctl, 0),
-	DRM_IOCTL_DEF_DRV(AMDXDNA_SET_STATE, amdxdna_drm_set_state_ioctl, DRM_ROOT_ONLY),
+	DRM_IOCTL_DEF_DRV(AMDXDNA_SET_STATE, amdxdna_drm_set_state_ioctl, 0),
 };
 
-void amdxdna_update_stats(struct amdxdna_client *client, ktime_t time, bool start)
+/*
+ * Called when a job is sent to and completed by the device. The client is
+ * busy while any of its contexts has a job on the device, contexts running
+ * in parallel are not added up. Only the context lock is taken per job, the
+ * client lock only when a context goes busy or idle.
+ */
+void amdxdna_update_stats(struct amdxdna_ctx *ctx, ktime_t time, bool start)
 {
+	struct amdxdna_stats *stats = &ctx->client->stats;
 	unsigned long flags;
 
-	spin_lock_irqsave(&client->stats.lock, flags);
+	spin_lock_irqsave(&ctx->usage_lock, flags);
 	if (start) {
-		client->stats.job_depth++;
-		if (client->stats.job_depth == 1)
-			client->stats.start_time = time;
-	} else {
-		client->stats.job_depth--;
-		if (client->stats.job_depth == 0)
-			client->stats.busy_time =
-				ktime_add(client->stats.busy_time,
-					  ktime_sub(time, client->stats.start_time));
+		if (ctx->usage_depth++)
+			goto out;
+
+		spin_lock(&stats->lock);
+		if (!stats->busy_ctx++)
+			stats->start_time = time;
+		spin_unlock(&stats->lock);
+	} else if (ctx->usage_depth) {
+		if (--ctx->usage_depth)
+			goto out;
+
+		spin_lock(&stats->lock);
+		/* Times are taken before the locks, keep the interval sane */
+		if (!--stats->busy_ctx && ktime_after(time, stats->start_time))
+			stats->busy_time = ktime_add(stats->busy_time,
+						     ktime_sub(time, stats->start_time));
+		spin_unlock(&stats->lock);
 	}
-	spin_unlock_irqrestore(&client->stats.lock, flags);
+out:
+	spin_unlock_irqrestore(&ctx->usage_lock, flags);
 }
 
-static void amdxdna_show_fdinfo(struct drm_printer *p, struct drm_file *filp)
+static u64 amdxdna_client_busy_ns(struct amdxdna_client *client)
 {
-	struct amdxdna_client *client = filp->driver_priv;
-	const char *engine_npu_name = "npu-amdxdna";
+	struct amdxdna_stats *stats = &client->stats;
 	unsigned long flags;
+	ktime_t now;
 	u64 busy_ns;
 
-	spin_lock_irqsave(&client->stats.lock, flags);
-	busy_ns = ktime_to_ns(client->stats.busy_time);
-	if (client->stats.job_depth > 0)
-		busy_ns += ktime_to_ns(ktime_sub(ktime_get(), client->stats.start_time));
-	spin_unlock_irqrestore(&client->stats.lock, flags);
+	spin_lock_irqsave(&stats->lock, flags);
+	busy_ns = ktime_to_ns(stats->busy_time);
+	now = ktime_get();
+	if (stats->busy_ctx && ktime_after(now, stats->start_time))
+		busy_ns += ktime_to_ns(ktime_sub(now, stats->start_time));
+	/*
+	 * An idle time taken before this read may be accounted after it.
+	 * Never go backward, tools compute utilization by delta.
+	 */
+	busy_ns = max(busy_ns, stats->last_busy_ns);
+	stats->last_busy_ns = busy_ns;
+	spin_unlock_irqrestore(&stats->lock, flags);
+
+	return busy_ns;
+}
+
+static void amdxdna_show_fdinfo(struct drm_printer *p, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	const char *engine_npu_name = "npu-amdxdna";
 
 	/* see Documentation/gpu/drm-usage-stats.rst */
-	drm_printf(p, "drm-engine-%s:\t%llu ns\n", engine_npu_name, busy_ns);
+	drm_printf(p, "drm-engine-%s:\t%llu ns\n", engine_npu_name,
+		   amdxdna_client_busy_ns(client));
 
 	drm_show_memory_stats(p, filp);
 }
@@ -10,8 +10,11 @@
 #include <drm/drm_drv.h>
 #include <drm/drm_print.h>
 #include <drm/drm_file.h>
+#include <linux/hashtable.h>
 #include <linux/hmm.h>
+#include <linux/shrinker.h>
 #include <linux/timekeeping.h>
+#include <linux/version.h>
 #include <linux/workqueue.h>
 
 #include "amdxdna_ctx.h"
@@ -66,6 +69,7 @@ struct amdxdna_dev_ops {
 	int (*get_aie_info)(struct amdxdna_client *client, struct amdxdna_drm_get_info *args);
 	int (*set_aie_state)(struct amdxdna_client *client, struct amdxdna_drm_set_state *args);
 	struct dma_fence *(*cmd_get_out_fence)(struct amdxdna_ctx *ctx, u64 seq);
+	int (*heap_attach)(struct amdxdna_client *client, struct amdxdna_gem_obj *heap);
 };
 
 /*
@@ -124,15 +128,38 @@ struct amdxdna_dev {
 #endif
 	struct rw_semaphore		notifier_lock; /* for mmu notifier */
 	struct workqueue_struct		*notifier_wq;
+	struct vfsmount			*huge_mnt; /* tmpfs for huge page BOs */
+
+	/* Idle submit pinned BOs, unpinned under memory pressure */
+	spinlock_t			pin_lru_lock; /* protect pin_lru, unpin_list */
+	struct list_head		pin_lru;
+	struct list_head		unpin_list;
+	struct work_struct		unpin_work;
+#if KERNEL_VERSION(6, 7, 0) > LINUX_VERSION_CODE
+	struct shrinker			pin_shrinker_s;
+#endif
+	struct shrinker			*pin_shrinker;
+
+	/* Imported dma-bufs, shared by all clients importing the same one */
+	struct mutex			import_lock; /* protect import_ht */
+	DECLARE_HASHTABLE(import_ht, 6);
 };
 
+/*
+ * Client is busy while any of its contexts has a job on the device, see
+ * amdxdna_update_stats().
+ */
 struct amdxdna_stats {
 	spinlock_t			lock; /* protect stats */
-	u32				job_depth;
+	u32				busy_ctx;
 	ktime_t				busy_time;
 	ktime_t				start_time;
+	/* Last reported busy time, keeps fdinfo monotonic */
+	u64				last_busy_ns;
 };
 
+#define AMDXDNA_MAX_HEAP_CHUNKS	8
+
 /*
  * struct amdxdna_client - amdxdna client
  * A per fd data structure for managing context and other user process stuffs.
@@ -144,7 +171,10 @@ struct amdxdna_stats {
  * @xdna: XDNA device pointer
  * @filp: DRM file pointer
  * @mm_lock: lock for client wide memory related
- * @dev_heap: Shared device heap memory
+ * @dev_heap: Shared device heap memory, first chunk of the heap
+ * @heap_chunks: Device heap chunks, contiguous in device address space
+ * @nr_heap_chunks: Number of published heap chunks
+ * @heap_size: Total size of all heap chunks
  * @sva: iommu SVA handle
  * @pasid: PASID
  * @stats: record npu usage stats
@@ -161,6 +191,9 @@ struct amdxdna_client {
 
 	struct mutex			mm_lock; /* protect memory related */
 	struct amdxdna_gem_obj		*dev_heap;
+	struct amdxdna_gem_obj		*heap_chunks[AMDXDNA_MAX_HEAP_CHUNKS];
+	u32				nr_heap_chunks;
+	size_t				heap_size;
 
 	struct iommu_sva		*sva;
 	int				pasid;
@@ -173,6 +206,6 @@ struct amdxdna_client {
 #define amdxdna_no_ctx(client)				\
 	xa_empty(&(client)->ctx_xa)
 
-void amdxdna_update_stats(struct amdxdna_client *client, ktime_t time, bool start);
+void amdxdna_update_stats(struct amdxdna_ctx *ctx, ktime_t time, bool start);
 
 #endif /* _AMDXDNA_DRM_H_ */
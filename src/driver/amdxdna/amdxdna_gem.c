@@ -6,12 +6,18 @@
 #include "drm_local/amdxdna_accel.h"
 #include <linux/dma-buf.h>
 #include <linux/dma-direct.h>
+#include <linux/fs.h>
+#include <linux/huge_mm.h>
 #include <linux/iosys-map.h>
+#include <linux/mount.h>
+#include <linux/overflow.h>
 #include <linux/pagemap.h>
 #include <linux/pfn.h>
+#include <linux/seq_file.h>
 #include <linux/version.h>
 #include <linux/vmalloc.h>
 #include <drm/drm_cache.h>
+#include <drm/drm_managed.h>
 
 #include "amdxdna_drm.h"
 #include "amdxdna_gem.h"
@@ -22,67 +28,275 @@
 
 #define XDNA_MAX_CMD_BO_SIZE	SZ_32K
 
+static bool io_coherent;
+module_param(io_coherent, bool, 0600);
+MODULE_PARM_DESC(io_coherent, "Device DMA snoops CPU caches, skip cache flush in sync bo (Default false)");
+
+static bool deferred_bo_free;
+module_param(deferred_bo_free, bool, 0644);
+MODULE_PARM_DESC(deferred_bo_free, "Release host BOs from a worker once their fences signal (Default false)");
+
+/*
+ * Huge page BO needs drm_gem_shmem_create_with_mnt() for the private huge
+ * tmpfs and vmf_insert_folio_pmd() to map PMD sized shmem folios, the later
+ * one came last in 6.15.
+ */
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && KERNEL_VERSION(6, 15, 0) <= LINUX_VERSION_CODE
+#define AMDXDNA_HUGE_PAGE
+#endif
+
 #if KERNEL_VERSION(6, 13, 0) > LINUX_VERSION_CODE
 MODULE_IMPORT_NS(DMA_BUF);
 #else
 MODULE_IMPORT_NS("DMA_BUF");
 #endif
 
+static u32 amdxdna_heap_base_shift(struct amdxdna_dev *xdna)
+{
+	return max(PAGE_SHIFT, xdna->dev_info->dev_mem_buf_shift);
+}
+
+static int amdxdna_heap_cls_init(struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(heap)->dev);
+	u32 shift = amdxdna_heap_base_shift(xdna);
+	int i;
+
+	heap->heap_cls = kcalloc(AMDXDNA_HEAP_NR_CLASSES, sizeof(*heap->heap_cls), GFP_KERNEL);
+	if (!heap->heap_cls)
+		return -ENOMEM;
+
+	for (i = 0; i < AMDXDNA_HEAP_NR_CLASSES; i++) {
+		struct amdxdna_heap_class *cls = &heap->heap_cls[i];
+
+		spin_lock_init(&cls->lock);
+		INIT_LIST_HEAD(&cls->partial);
+		INIT_LIST_HEAD(&cls->full);
+		cls->chunk_shift = shift + i;
+		cls->nr_chunks = min_t(u32, BITS_PER_LONG,
+				       AMDXDNA_HEAP_SLAB_SIZE >> cls->chunk_shift);
+	}
+	return 0;
+}
+
+/* Called on heap free, all dev BOs are gone by then */
+static void amdxdna_heap_cls_fini(struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_heap_slab *slab, *tmp;
+	int i;
+
+	if (!heap->heap_cls)
+		return;
+
+	for (i = 0; i < AMDXDNA_HEAP_NR_CLASSES; i++) {
+		struct amdxdna_heap_class *cls = &heap->heap_cls[i];
+
+		WARN_ON(!list_empty(&cls->full));
+		list_for_each_entry_safe(slab, tmp, &cls->partial, node) {
+			list_del(&slab->node);
+			drm_mm_remove_node(&slab->mm_node);
+			kfree(slab);
+		}
+	}
+	kfree(heap->heap_cls);
+	heap->heap_cls = NULL;
+}
+
+static int amdxdna_heap_cls_idx(struct amdxdna_gem_obj *heap, size_t size)
+{
+	int i;
+
+	for (i = 0; i < AMDXDNA_HEAP_NR_CLASSES; i++) {
+		if (size <= (1UL << heap->heap_cls[i].chunk_shift))
+			return i;
+	}
+	return -1;
+}
+
+static struct amdxdna_heap_slab *
+amdxdna_heap_slab_alloc(struct amdxdna_client *client, struct amdxdna_gem_obj *heap,
+			struct amdxdna_heap_class *cls)
+{
+	u64 slab_size = (u64)cls->nr_chunks << cls->chunk_shift;
+	struct amdxdna_heap_slab *slab;
+	int ret;
+
+	slab = kzalloc(sizeof(*slab), GFP_KERNEL);
+	if (!slab)
+		return ERR_PTR(-ENOMEM);
+
+	/* Align slab to chunk size, so are all chunks in it */
+	mutex_lock(&client->mm_lock);
+	ret = drm_mm_insert_node_generic(&heap->mm, &slab->mm_node, slab_size,
+					 1UL << cls->chunk_shift, 0, DRM_MM_INSERT_BEST);
+	mutex_unlock(&client->mm_lock);
+	if (ret) {
+		kfree(slab);
+		return ERR_PTR(ret);
+	}
+
+	slab->cls = cls;
+	slab->nr_free = cls->nr_chunks;
+	slab->free_map = cls->nr_chunks == BITS_PER_LONG ? ~0UL : BIT(cls->nr_chunks) - 1;
+	return slab;
+}
+
 static int
-amdxdna_gem_heap_alloc(struct amdxdna_gem_obj *abo)
+amdxdna_heap_cls_alloc(struct amdxdna_gem_obj *abo, struct amdxdna_gem_obj *heap, int idx)
+{
+	struct amdxdna_heap_class *cls = &heap->heap_cls[idx];
+	struct amdxdna_heap_slab *slab, *new_slab = NULL;
+	unsigned long bit;
+
+	spin_lock(&cls->lock);
+	slab = list_first_entry_or_null(&cls->partial, struct amdxdna_heap_slab, node);
+	if (!slab) {
+		spin_unlock(&cls->lock);
+		new_slab = amdxdna_heap_slab_alloc(abo->client, heap, cls);
+		if (IS_ERR(new_slab))
+			return PTR_ERR(new_slab);
+		spin_lock(&cls->lock);
+		list_add(&new_slab->node, &cls->partial);
+		cls->nr_slabs++;
+		slab = list_first_entry(&cls->partial, struct amdxdna_heap_slab, node);
+	}
+
+	bit = __ffs(slab->free_map);
+	__clear_bit(bit, &slab->free_map);
+	if (!--slab->nr_free)
+		list_move(&slab->node, &cls->full);
+	cls->nr_used++;
+	spin_unlock(&cls->lock);
+
+	abo->heap_slab = slab;
+	abo->mem.dev_addr = slab->mm_node.start + ((u64)bit << cls->chunk_shift);
+	return 0;
+}
+
+static void amdxdna_heap_cls_free(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_heap_slab *slab = abo->heap_slab;
+	struct amdxdna_heap_class *cls = slab->cls;
+	unsigned long bit;
+	bool release;
+
+	bit = (abo->mem.dev_addr - slab->mm_node.start) >> cls->chunk_shift;
+
+	spin_lock(&cls->lock);
+	__set_bit(bit, &slab->free_map);
+	if (!slab->nr_free++)
+		list_move(&slab->node, &cls->partial);
+	cls->nr_used--;
+	/* Keep one empty slab around to avoid thrashing */
+	release = slab->nr_free == cls->nr_chunks && !list_is_singular(&cls->partial);
+	if (release) {
+		list_del(&slab->node);
+		cls->nr_slabs--;
+	}
+	spin_unlock(&cls->lock);
+
+	abo->heap_slab = NULL;
+	if (!release)
+		return;
+
+	mutex_lock(&abo->client->mm_lock);
+	drm_mm_remove_node(&slab->mm_node);
+	mutex_unlock(&abo->client->mm_lock);
+	kfree(slab);
+}
+
+/*
+ * Chunks created after the first one are not known by firmware until mapped
+ * into the client's contexts. Do that the first time a BO is carved out of it,
+ * by then user space has mapped the chunk and its userptr is valid.
+ */
+static int
+amdxdna_heap_chunk_activate(struct amdxdna_client *client, struct amdxdna_gem_obj *heap)
+{
+	struct amdxdna_dev *xdna = client->xdna;
+	int ret = 0;
+
+	if (READ_ONCE(heap->heap_mapped))
+		return 0;
+
+	mutex_lock(&heap->lock);
+	if (!(heap->flags & BO_SUBMIT_PINNED)) {
+		ret = amdxdna_gem_pin_nolock(heap);
+		if (!ret)
+			heap->flags |= BO_SUBMIT_PINNED;
+	}
+	mutex_unlock(&heap->lock);
+	if (ret) {
+		XDNA_ERR(xdna, "Pin heap chunk failed, ret %d", ret);
+		return ret;
+	}
+
+	mutex_lock(&client->mm_lock);
+	if (heap->heap_mapped)
+		goto unlock;
+
+	if (xdna->dev_info->ops->heap_attach)
+		ret = xdna->dev_info->ops->heap_attach(client, heap);
+	else
+		WRITE_ONCE(heap->heap_mapped, true);
+	if (ret)
+		XDNA_ERR(xdna, "Attach heap chunk 0x%llx failed, ret %d", heap->mem.dev_addr, ret);
+unlock:
+	mutex_unlock(&client->mm_lock);
+	return ret;
+}
+
+static int
+amdxdna_gem_heap_chunk_alloc(struct amdxdna_gem_obj *abo, struct amdxdna_gem_obj *heap)
 {
 	struct amdxdna_client *client = abo->client;
 	struct amdxdna_dev *xdna = client->xdna;
 	struct amdxdna_mem *mem = &abo->mem;
-	struct amdxdna_gem_obj *heap;
 	struct page **pages;
 	u64 offset;
 	u32 align;
 	int ret;
+	int idx;
 
-	mutex_lock(&client->mm_lock);
-
-	heap = client->dev_heap;
-	if (!heap) {
-		mutex_unlock(&client->mm_lock);
-		return -EINVAL;
-	}
-
+	/* Chunks have to be attached in order, stop at the first one not ready */
 	if (heap->mem.userptr == AMDXDNA_INVALID_ADDR) {
-		XDNA_ERR(xdna, "Invalid dev heap userptr");
-		mutex_unlock(&client->mm_lock);
-		return -EINVAL;
+		XDNA_DBG(xdna, "Heap chunk 0x%llx is not mapped", heap->mem.dev_addr);
+		return READ_ONCE(heap->heap_mapped) ? -ENOSPC : -ENOENT;
 	}
 
-	if (mem->size == 0 || mem->size > heap->mem.size) {
-		XDNA_ERR(xdna, "Invalid dev bo size 0x%lx, limit 0x%lx",
-			 mem->size, heap->mem.size);
-		mutex_unlock(&client->mm_lock);
-		return -EINVAL;
-	}
+	if (mem->size > heap->mem.size)
+		return -ENOSPC;
 
 	if (heap->mem.pages) {
 		pages = heap->mem.pages;
-	} else if (client->dev_heap->base.pages) {
+	} else if (heap->base.pages) {
 		pages = heap->base.pages;
 	} else {
 		XDNA_ERR(xdna, "Can not get pages");
-		mutex_unlock(&client->mm_lock);
 		return -EINVAL;
 	}
 
-	align = 1 << max(PAGE_SHIFT, xdna->dev_info->dev_mem_buf_shift);
+	ret = amdxdna_heap_chunk_activate(client, heap);
+	if (ret)
+		return ret;
+
+	idx = amdxdna_heap_cls_idx(heap, mem->size);
+	if (idx >= 0 && !amdxdna_heap_cls_alloc(abo, heap, idx))
+		goto done;
+
+	/* Large BO, or no room for a new slab */
+	align = 1 << amdxdna_heap_base_shift(xdna);
+	mutex_lock(&client->mm_lock);
 	ret = drm_mm_insert_node_generic(&heap->mm, &abo->mm_node, mem->size,
 					 align, 0, DRM_MM_INSERT_BEST);
-	if (ret) {
-		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
-		mutex_unlock(&client->mm_lock);
+	mutex_unlock(&client->mm_lock);
+	if (ret)
 		return ret;
-	}
-
 	mem->dev_addr = abo->mm_node.start;
-	offset = mem->dev_addr - client->dev_heap->mem.dev_addr;
-	mem->userptr = client->dev_heap->mem.userptr + offset;
+
+done:
+	offset = mem->dev_addr - heap->mem.dev_addr;
+	mem->userptr = heap->mem.userptr + offset;
 
 	if (pages) {
 		mem->pages = &pages[offset >> PAGE_SHIFT];
@@ -90,24 +304,102 @@ amdxdna_gem_heap_alloc(struct amdxdna_gem_obj *abo)
 	}
 
 	drm_gem_object_get(to_gobj(heap));
-
-	mutex_unlock(&client->mm_lock);
+	abo->heap = heap;
 	return 0;
 }
 
+static int
+amdxdna_gem_heap_alloc(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_client *client = abo->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_mem *mem = &abo->mem;
+	int ret = -ENOSPC;
+	u32 nr, i;
+
+	/* Chunks are published once and stay till client is gone */
+	nr = smp_load_acquire(&client->nr_heap_chunks);
+	if (!nr)
+		return -EINVAL;
+
+	if (mem->size == 0 || mem->size > xdna->dev_info->dev_mem_size) {
+		XDNA_ERR(xdna, "Invalid dev bo size 0x%lx, limit 0x%lx",
+			 mem->size, xdna->dev_info->dev_mem_size);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ret = amdxdna_gem_heap_chunk_alloc(abo, client->heap_chunks[i]);
+		if (ret != -ENOSPC)
+			break;
+	}
+	if (ret == -ENOENT)
+		ret = -ENOSPC;
+
+	if (ret)
+		XDNA_ERR(xdna, "Failed to alloc dev bo memory, ret %d", ret);
+	return ret;
+}
+
 static void
 amdxdna_gem_heap_free(struct amdxdna_gem_obj *abo)
 {
-	if (!abo->mem.nr_pages)
+	if (!abo->heap)
 		return;
 
-	mutex_lock(&abo->client->mm_lock);
-
-	if (abo->mem.dev_addr != AMDXDNA_INVALID_ADDR)
+	if (abo->heap_slab) {
+		amdxdna_heap_cls_free(abo);
+	} else if (abo->mem.dev_addr != AMDXDNA_INVALID_ADDR) {
+		mutex_lock(&abo->client->mm_lock);
 		drm_mm_remove_node(&abo->mm_node);
-	drm_gem_object_put(to_gobj(abo->client->dev_heap));
+		mutex_unlock(&abo->client->mm_lock);
+	}
+	drm_gem_object_put(to_gobj(abo->heap));
+	abo->heap = NULL;
+}
 
-	mutex_unlock(&abo->client->mm_lock);
+static void amdxdna_gem_heap_chunk_show(struct amdxdna_gem_obj *heap, struct seq_file *m)
+{
+	u64 hole_start, hole_end, free = 0, largest = 0;
+	struct drm_mm_node *hole;
+	int i;
+
+	drm_mm_for_each_hole(hole, &heap->mm, hole_start, hole_end) {
+		free += hole_end - hole_start;
+		largest = max(largest, hole_end - hole_start);
+	}
+	seq_printf(m, "  chunk 0x%llx size 0x%lx %s free 0x%llx largest free 0x%llx fragmentation %llu%%\n",
+		   heap->mem.dev_addr, heap->mem.size, heap->heap_mapped ? "mapped" : "unmapped",
+		   free, largest, free ? 100 - div64_u64(largest * 100, free) : 0);
+
+	for (i = 0; i < AMDXDNA_HEAP_NR_CLASSES; i++) {
+		struct amdxdna_heap_class *cls = &heap->heap_cls[i];
+		u64 total;
+
+		spin_lock(&cls->lock);
+		total = (u64)cls->nr_slabs * cls->nr_chunks;
+		seq_printf(m, "    class 0x%lx slabs %u chunks used %llu free %llu\n",
+			   1UL << cls->chunk_shift, cls->nr_slabs, cls->nr_used,
+			   total - cls->nr_used);
+		spin_unlock(&cls->lock);
+	}
+}
+
+void amdxdna_gem_heap_show(struct amdxdna_client *client, struct seq_file *m)
+{
+	u32 i;
+
+	mutex_lock(&client->mm_lock);
+	if (!client->nr_heap_chunks) {
+		mutex_unlock(&client->mm_lock);
+		return;
+	}
+
+	seq_printf(m, "pid %d heap 0x%lx chunks %u\n", client->pid, client->heap_size,
+		   client->nr_heap_chunks);
+	for (i = 0; i < client->nr_heap_chunks; i++)
+		amdxdna_gem_heap_chunk_show(client->heap_chunks[i], m);
+	mutex_unlock(&client->mm_lock);
 }
 
 static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
@@ -116,17 +408,29 @@ static bool amdxdna_hmm_invalidate(struct mmu_interval_notifier *mni,
 {
 	struct amdxdna_umap *mapp = container_of(mni, struct amdxdna_umap, notifier);
 	struct amdxdna_gem_obj *abo = mapp->abo;
+	unsigned long start, end;
 	struct amdxdna_dev *xdna;
 
+	start = max(range->start, mapp->range.start) & PAGE_MASK;
+	end = PAGE_ALIGN(min(range->end, mapp->range.end));
+
 	xdna = to_xdna_dev(to_gobj(abo)->dev);
-	XDNA_DBG(xdna, "Invalidating range 0x%lx, 0x%lx, type %d",
-		 mapp->vma->vm_start, mapp->vma->vm_end, abo->type);
+	XDNA_DBG(xdna, "Invalidating range 0x%lx, 0x%lx of 0x%lx, 0x%lx, type %d",
+		 start, end, mapp->range.start, mapp->range.end, abo->type);
 
 	if (!mmu_notifier_range_blockable(range))
 		return false;
 
 	down_write(&xdna->notifier_lock);
 	abo->mem.map_invalid = true;
+	/* Pending invalid ranges are merged, next populate faults only those pages */
+	if (mapp->invalid) {
+		mapp->invalid_start = min(mapp->invalid_start, start);
+		mapp->invalid_end = max(mapp->invalid_end, end);
+	} else {
+		mapp->invalid_start = start;
+		mapp->invalid_end = end;
+	}
 	mapp->invalid = true;
 	mmu_interval_set_seq(&mapp->notifier, cur_seq);
 	up_write(&xdna->notifier_lock);
@@ -249,9 +553,17 @@ static int amdxdna_hmm_register(struct amdxdna_gem_obj *abo,
 	INIT_WORK(&mapp->hmm_unreg_work, amdxdna_hmm_unreg_work);
 	if (is_import_bo(abo) && vma->vm_file && vma->vm_file->f_mapping)
 		mapping_set_unevictable(vma->vm_file->f_mapping);
+	/* Not faulted in by mmap, see amdxdna_gem_populate_async() */
+	if (abo->flags & BO_ASYNC_POPULATE) {
+		mapp->invalid = true;
+		mapp->invalid_start = mapp->range.start;
+		mapp->invalid_end = mapp->range.end;
+	}
 
 	down_write(&xdna->notifier_lock);
 	list_add_tail(&mapp->node, &abo->mem.umap_list);
+	if (mapp->invalid)
+		abo->mem.map_invalid = true;
 	up_write(&xdna->notifier_lock);
 
 	return 0;
@@ -263,6 +575,126 @@ free_map:
 	return ret;
 }
 
+/*
+ * Only the pages covered by invalidations since the last populate are faulted
+ * back in. The notifier sequence is sampled before the invalid range is read,
+ * any invalidation after that point forces a retry with the merged range.
+ */
+static int amdxdna_gem_populate_range_nolock(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	struct amdxdna_umap *mapp;
+	struct hmm_range range;
+	unsigned long timeout;
+	struct mm_struct *mm;
+	unsigned long seq;
+	bool found;
+	int ret;
+
+	timeout = jiffies + msecs_to_jiffies(HMM_RANGE_DEFAULT_TIMEOUT);
+again:
+	found = false;
+	down_write(&xdna->notifier_lock);
+	list_for_each_entry(mapp, &abo->mem.umap_list, node) {
+		if (mapp->invalid) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		abo->mem.map_invalid = false;
+		up_write(&xdna->notifier_lock);
+		return 0;
+	}
+	kref_get(&mapp->refcnt);
+	up_write(&xdna->notifier_lock);
+
+	mm = mapp->notifier.mm;
+	if (!mmget_not_zero(mm)) {
+		amdxdna_umap_put(mapp);
+		return -EFAULT;
+	}
+
+	seq = mmu_interval_read_begin(&mapp->notifier);
+	down_read(&xdna->notifier_lock);
+	range = mapp->range;
+	range.start = mapp->invalid_start;
+	range.end = mapp->invalid_end;
+	found = mapp->invalid;
+	up_read(&xdna->notifier_lock);
+	if (!found)
+		goto next;
+
+	XDNA_DBG(xdna, "populate memory range %lx %lx of %lx %lx",
+		 range.start, range.end, mapp->range.start, mapp->range.end);
+	range.hmm_pfns += (range.start - mapp->range.start) >> PAGE_SHIFT;
+	range.notifier_seq = seq;
+	mmap_read_lock(mm);
+	ret = hmm_range_fault(&range);
+	mmap_read_unlock(mm);
+	if (ret) {
+		if (time_after(jiffies, timeout)) {
+			ret = -ETIME;
+			goto put_mm;
+		}
+
+		if (ret == -EBUSY)
+			goto next;
+
+		goto put_mm;
+	}
+
+	down_write(&xdna->notifier_lock);
+	if (!mmu_interval_read_retry(&mapp->notifier, seq))
+		mapp->invalid = false;
+	up_write(&xdna->notifier_lock);
+next:
+	amdxdna_umap_put(mapp);
+	mmput(mm);
+	goto again;
+
+put_mm:
+	amdxdna_umap_put(mapp);
+	mmput(mm);
+	return ret;
+}
+
+/* Submit and async populate worker share the hmm_pfns array of each umap */
+int amdxdna_gem_populate_range(struct amdxdna_gem_obj *abo)
+{
+	int ret;
+
+	mutex_lock(&abo->lock);
+	ret = amdxdna_gem_populate_range_nolock(abo);
+	mutex_unlock(&abo->lock);
+	return ret;
+}
+
+static void amdxdna_gem_populate_work(struct work_struct *work)
+{
+	struct amdxdna_gem_obj *abo = container_of(work, struct amdxdna_gem_obj, populate_work);
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	int ret;
+
+	ret = amdxdna_gem_populate_range(abo);
+	if (ret)
+		XDNA_DBG(xdna, "Async populate BO failed, ret %d, left to first submit", ret);
+	drm_gem_object_put(to_gobj(abo));
+}
+
+/*
+ * Fault in a new mapping of BO_ASYNC_POPULATE BO off the mmap path. The
+ * mapping is registered as invalid, so a submit before the worker is done
+ * populates the rest by itself.
+ */
+static void amdxdna_gem_populate_async(struct amdxdna_gem_obj *abo)
+{
+	drm_gem_object_get(to_gobj(abo));
+	if (!queue_work(system_unbound_wq, &abo->populate_work))
+		drm_gem_object_put(to_gobj(abo));
+}
+
 static struct amdxdna_gem_obj *
 amdxdna_gem_create_obj(struct drm_device *dev, size_t size)
 {
@@ -274,6 +706,7 @@ amdxdna_gem_create_obj(struct drm_device *dev, size_t size)
 
 	abo->assigned_ctx = AMDXDNA_INVALID_CTX_HANDLE;
 	mutex_init(&abo->lock);
+	INIT_LIST_HEAD(&abo->pin_lru);
 
 	abo->mem.userptr = AMDXDNA_INVALID_ADDR;
 	abo->mem.dev_addr = AMDXDNA_INVALID_ADDR;
@@ -299,6 +732,25 @@ static void amdxdna_gem_vunmap(struct amdxdna_gem_obj *abo)
 	drm_gem_vunmap_unlocked(to_gobj(abo), &map);
 }
 
+static bool amdxdna_gem_lru_eligible(struct amdxdna_gem_obj *abo)
+{
+	/* Only SHARE BOs own pages the shrinker can give back */
+	return abo->type == AMDXDNA_BO_SHARE && !is_import_bo(abo) && !amdxdna_use_carvedout();
+}
+
+/* Called with BO_SUBMIT_PINNED set, before the pin is dropped */
+static void amdxdna_gem_lru_del(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+
+	if (!amdxdna_gem_lru_eligible(abo))
+		return;
+
+	spin_lock(&xdna->pin_lru_lock);
+	list_del_init(&abo->pin_lru);
+	spin_unlock(&xdna->pin_lru_lock);
+}
+
 static void amdxdna_gem_dev_obj_free(struct drm_gem_object *gobj)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
@@ -327,30 +779,72 @@ static void amdxdna_gem_carvedout_obj_free(struct drm_gem_object *gobj)
 	amdxdna_gem_destroy_obj(abo);
 }
 
+/*
+ * Each drm_file dedups its own imports, but every other client importing the
+ * same dma-buf would attach and map it again. Only the attachment and its
+ * sg_table are shared across clients of the device. Every import still gets
+ * its own object, so that mmap, userptr and umap state stay with the client.
+ */
+struct amdxdna_gem_import {
+	struct kref			refcnt;
+	struct amdxdna_dev		*xdna;
+	struct dma_buf			*dma_buf;
+	struct dma_buf_attachment	*attach;
+	struct sg_table			*sgt;
+	struct hlist_node		node; /* On xdna->import_ht */
+};
+
+static void amdxdna_gem_import_unmap(struct dma_buf *dma_buf,
+				     struct dma_buf_attachment *attach,
+				     struct sg_table *sgt)
+{
+	dma_buf_unmap_attachment_unlocked(attach, sgt, DMA_BIDIRECTIONAL);
+	dma_buf_detach(dma_buf, attach);
+	dma_buf_put(dma_buf);
+}
+
+/* Called with import_lock held, unmap must not nest in it */
+static void amdxdna_gem_import_release(struct kref *ref)
+{
+	struct amdxdna_gem_import *imp = container_of(ref, struct amdxdna_gem_import, refcnt);
+
+	hash_del(&imp->node);
+	mutex_unlock(&imp->xdna->import_lock);
+
+	amdxdna_gem_import_unmap(imp->dma_buf, imp->attach, imp->sgt);
+	kfree(imp);
+}
+
+static void amdxdna_gem_import_put(struct amdxdna_gem_import *imp)
+{
+	kref_put_mutex(&imp->refcnt, amdxdna_gem_import_release, &imp->xdna->import_lock);
+}
+
 static void amdxdna_imported_obj_free(struct amdxdna_gem_obj *abo)
 {
-	dma_buf_unmap_attachment_unlocked(abo->attach, abo->base.sgt, DMA_BIDIRECTIONAL);
-	dma_buf_detach(abo->dma_buf, abo->attach);
-	dma_buf_put(abo->dma_buf);
+	if (abo->import)
+		amdxdna_gem_import_put(abo->import);
+	else
+		amdxdna_gem_import_unmap(abo->dma_buf, abo->attach, abo->base.sgt);
 	drm_gem_object_release(to_gobj(abo));
 	kfree(abo);
 }
 
-static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
+static void amdxdna_gem_shmem_obj_release(struct amdxdna_gem_obj *abo)
 {
-	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
-	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
-
-	XDNA_DBG(xdna, "BO type %d xdna_addr 0x%llx", abo->type, abo->mem.dev_addr);
-
-	amdxdna_hmm_unregister(abo, NULL);
-	flush_workqueue(xdna->notifier_wq);
+#ifdef AMDXDNA_DEVEL
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+#endif
 
-	if (abo->flags & BO_SUBMIT_PINNED)
+	if (abo->flags & BO_SUBMIT_PINNED) {
+		amdxdna_gem_lru_del(abo);
 		amdxdna_gem_unpin(abo);
+	}
 
-	if (abo->type == AMDXDNA_BO_DEV_HEAP)
+	if (abo->type == AMDXDNA_BO_DEV_HEAP) {
+		amdxdna_heap_cls_fini(abo);
 		drm_mm_takedown(&abo->mm);
+	}
 
 #ifdef AMDXDNA_DEVEL
 	if (abo->type == AMDXDNA_BO_CMD)
@@ -371,6 +865,217 @@ static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
 	drm_gem_shmem_free(&abo->base);
 }
 
+static void amdxdna_gem_free_work(struct work_struct *work)
+{
+	struct amdxdna_gem_obj *abo = container_of(work, struct amdxdna_gem_obj, free_work);
+
+	/* No job of ours holds it, but a shared resv may have others' fences */
+	dma_resv_wait_timeout(to_gobj(abo)->resv, DMA_RESV_USAGE_BOOKKEEP, false,
+			      MAX_SCHEDULE_TIMEOUT);
+	amdxdna_gem_shmem_obj_release(abo);
+}
+
+static void amdxdna_gem_shmem_obj_free(struct drm_gem_object *gobj)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(gobj->dev);
+	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
+
+	XDNA_DBG(xdna, "BO type %d xdna_addr 0x%llx", abo->type, abo->mem.dev_addr);
+
+	amdxdna_hmm_unregister(abo, NULL);
+
+	/*
+	 * The last put, usually GEM_CLOSE, returns without waiting for notifier
+	 * works and page release. Ordered workqueue runs the free after the
+	 * unregister works queued above. Device heap is still freed inline.
+	 */
+	if (deferred_bo_free && abo->type != AMDXDNA_BO_DEV_HEAP) {
+		INIT_WORK(&abo->free_work, amdxdna_gem_free_work);
+		queue_work(xdna->notifier_wq, &abo->free_work);
+		return;
+	}
+
+	flush_workqueue(xdna->notifier_wq);
+	amdxdna_gem_shmem_obj_release(abo);
+}
+
+#ifdef AMDXDNA_HUGE_PAGE
+static struct page *amdxdna_gem_huge_fault_page(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct amdxdna_gem_obj *abo = to_xdna_obj(vma->vm_private_data);
+	pgoff_t pgoff = (vmf->address - vma->vm_start) >> PAGE_SHIFT;
+
+	if (pgoff >= to_gobj(abo)->size >> PAGE_SHIFT)
+		return NULL;
+	return abo->base.pages[pgoff];
+}
+
+static vm_fault_t amdxdna_gem_huge_fault(struct vm_fault *vmf, unsigned int order)
+{
+	struct folio *folio;
+	struct page *page;
+
+	if (order != PMD_ORDER || !IS_ALIGNED(vmf->address, PMD_SIZE) ||
+	    vmf->address + PMD_SIZE > vmf->vma->vm_end)
+		return VM_FAULT_FALLBACK;
+
+	page = amdxdna_gem_huge_fault_page(vmf);
+	if (!page)
+		return VM_FAULT_FALLBACK;
+
+	folio = page_folio(page);
+	if (folio_order(folio) < PMD_ORDER || &folio->page != page)
+		return VM_FAULT_FALLBACK;
+
+	return vmf_insert_folio_pmd(vmf, folio, vmf->flags & FAULT_FLAG_WRITE);
+}
+
+static vm_fault_t amdxdna_gem_huge_pte_fault(struct vm_fault *vmf)
+{
+	struct page *page;
+	int ret;
+
+	page = amdxdna_gem_huge_fault_page(vmf);
+	if (!page)
+		return VM_FAULT_SIGBUS;
+
+	ret = vm_insert_page(vmf->vma, vmf->address & PAGE_MASK, page);
+	if (ret && ret != -EBUSY)
+		return vmf_error(ret);
+	return VM_FAULT_NOPAGE;
+}
+
+static void amdxdna_gem_huge_vm_open(struct vm_area_struct *vma)
+{
+	drm_gem_shmem_vm_ops.open(vma);
+}
+
+static void amdxdna_gem_huge_vm_close(struct vm_area_struct *vma)
+{
+	drm_gem_shmem_vm_ops.close(vma);
+}
+
+static const struct vm_operations_struct amdxdna_gem_huge_vm_ops = {
+	.fault = amdxdna_gem_huge_pte_fault,
+	.huge_fault = amdxdna_gem_huge_fault,
+	.open = amdxdna_gem_huge_vm_open,
+	.close = amdxdna_gem_huge_vm_close,
+};
+
+static bool amdxdna_gem_huge_pmd_mappable(struct vm_area_struct *vma, unsigned long addr,
+					  struct page *page)
+{
+	struct folio *folio = page_folio(page);
+
+	return IS_ALIGNED(addr, PMD_SIZE) && addr + PMD_SIZE <= vma->vm_end &&
+	       folio_order(folio) >= PMD_ORDER && &folio->page == page;
+}
+
+/*
+ * Huge page BO is populated up front. Each PMD sized folio at a PMD aligned
+ * address gets one PMD mapping through the huge fault handler above, with SVA
+ * the IOMMU walks the same page table and gets 2M IOTLB entries as well. The
+ * rest of the BO, e.g. the tail that does not fill a folio, is inserted in one
+ * vm_insert_pages() batch per PMD range instead of faulting each page in.
+ */
+static int amdxdna_gem_huge_insert_pages(struct amdxdna_gem_obj *abo,
+					 struct vm_area_struct *vma)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long offset = 0;
+	int ret;
+
+	ret = drm_gem_shmem_mmap(&abo->base, vma);
+	if (ret) {
+		XDNA_ERR(xdna, "Failed shmem mmap %d", ret);
+		return ret;
+	}
+
+	vm_flags_mod(vma, VM_MIXEDMAP | VM_HUGEPAGE, VM_PFNMAP);
+	vma->vm_ops = &amdxdna_gem_huge_vm_ops;
+
+	while (offset < size) {
+		unsigned long addr = vma->vm_start + offset;
+		struct page **pages = &abo->base.pages[offset >> PAGE_SHIFT];
+		unsigned long len, num_pages;
+		vm_fault_t fault_ret;
+
+		if (amdxdna_gem_huge_pmd_mappable(vma, addr, *pages)) {
+			fault_ret = handle_mm_fault(vma, addr, FAULT_FLAG_WRITE, NULL);
+			if (fault_ret & VM_FAULT_ERROR) {
+				XDNA_ERR(xdna, "Fault in huge page BO failed");
+				ret = -EFAULT;
+				goto put_pages;
+			}
+			offset += PMD_SIZE;
+			continue;
+		}
+
+		len = min(ALIGN(addr + 1, PMD_SIZE), vma->vm_end) - addr;
+		num_pages = len >> PAGE_SHIFT;
+		ret = vm_insert_pages(vma, addr, pages, &num_pages);
+		if (ret) {
+			XDNA_ERR(xdna, "Failed to insert pages %d", ret);
+			goto put_pages;
+		}
+		offset += len;
+	}
+
+	return 0;
+
+put_pages:
+	/*
+	 * Failed mmap only zaps what got mapped, it does not call close. Drop
+	 * the pages drm_gem_shmem_mmap() got, drm_gem_mmap_obj() puts the object.
+	 */
+	dma_resv_lock(to_gobj(abo)->resv, NULL);
+	drm_gem_shmem_put_pages_locked(&abo->base);
+	dma_resv_unlock(to_gobj(abo)->resv);
+	return ret;
+}
+
+static void amdxdna_gem_huge_mnt_fini(struct drm_device *ddev, void *data)
+{
+	kern_unmount(data);
+}
+
+/*
+ * Private tmpfs mount with huge pages enabled. Shmem BOs created on it are
+ * backed by PMD sized folios whenever BO size allows. Failing to set it up
+ * is not fatal, huge page BOs just fall back to regular pages.
+ */
+void amdxdna_gem_huge_mnt_init(struct amdxdna_dev *xdna)
+{
+	char huge_opt[] = "huge=within_size";
+	struct file_system_type *type;
+	struct vfsmount *mnt;
+
+	type = get_fs_type("tmpfs");
+	if (!type) {
+		XDNA_WARN(xdna, "No tmpfs, huge page BO disabled");
+		return;
+	}
+
+	mnt = vfs_kern_mount(type, SB_KERNMOUNT, type->name, huge_opt);
+	if (IS_ERR(mnt)) {
+		XDNA_WARN(xdna, "Mount huge tmpfs failed %ld, huge page BO disabled",
+			  PTR_ERR(mnt));
+		return;
+	}
+
+	/* Unmount after the last BO is gone */
+	if (drmm_add_action_or_reset(&xdna->ddev, amdxdna_gem_huge_mnt_fini, mnt))
+		return;
+	xdna->huge_mnt = mnt;
+}
+#else
+void amdxdna_gem_huge_mnt_init(struct amdxdna_dev *xdna)
+{
+}
+#endif
+
 static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 					  struct vm_area_struct *vma)
 {
@@ -379,6 +1084,11 @@ static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 	unsigned long offset = 0;
 	int ret;
 
+#ifdef AMDXDNA_HUGE_PAGE
+	if (abo->flags & BO_HUGE_PAGE)
+		return amdxdna_gem_huge_insert_pages(abo, vma);
+#endif
+
 	if (!is_import_bo(abo)) {
 		ret = drm_gem_shmem_mmap(&abo->base, vma);
 		if (ret) {
@@ -407,6 +1117,9 @@ static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 		return ret;
 	}
 
+	if (abo->flags & BO_ASYNC_POPULATE)
+		goto out;
+
 	do {
 		vm_fault_t fault_ret;
 
@@ -421,6 +1134,7 @@ static int amdxdna_gem_shmem_insert_pages(struct amdxdna_gem_obj *abo,
 		offset += PAGE_SIZE;
 	} while (--num_pages);
 
+out:
 	/* Drop the reference drm_gem_mmap_obj() acquired.*/
 	drm_gem_object_put(to_gobj(abo));
 
@@ -444,6 +1158,9 @@ static int amdxdna_gem_shmem_obj_mmap(struct drm_gem_object *gobj,
 		goto hmm_unreg;
 	}
 
+	if (abo->flags & BO_ASYNC_POPULATE)
+		amdxdna_gem_populate_async(abo);
+
 	XDNA_DBG(xdna, "SHMEM BO map_offset 0x%llx type %d userptr 0x%lx size 0x%lx",
 		 drm_vma_node_offset_addr(&gobj->vma_node), abo->type,
 		 vma->vm_start, gobj->size);
@@ -538,8 +1255,8 @@ static int amdxdna_gem_obj_vmap(struct drm_gem_object *obj, struct iosys_map *ma
 	if (mem->pages) {
 		kva = vmap(mem->pages, mem->nr_pages, VM_MAP, PAGE_KERNEL);
 	} else if (abo->type == AMDXDNA_BO_DEV) {
-		offset = mem->dev_addr - client->dev_heap->mem.dev_addr;
-		kva = ioremap_uc(client->dev_heap->mm_node.start + offset, mem->size);
+		offset = mem->dev_addr - abo->heap->mem.dev_addr;
+		kva = ioremap_uc(abo->heap->mm_node.start + offset, mem->size);
 	} else {
 		kva = ioremap_uc(abo->mm_node.start, abo->mm_node.size);
 	}
@@ -594,7 +1311,22 @@ static struct dma_buf *amdxdna_gem_prime_export(struct drm_gem_object *gobj, int
 	exp_info.priv = gobj;
 	exp_info.resv = gobj->resv;
 
-	return drm_gem_dmabuf_export(gobj->dev, &exp_info);
+	return drm_gem_dmabuf_export(gobj->dev, &exp_info);
+}
+
+/* For drm-resident-* and drm-active-* in fdinfo */
+static enum drm_gem_object_status amdxdna_gem_shmem_obj_status(struct drm_gem_object *gobj)
+{
+	struct amdxdna_gem_obj *abo = to_xdna_obj(gobj);
+
+	if (abo->base.pages || abo->base.sgt || abo->mem.pages)
+		return DRM_GEM_OBJECT_RESIDENT;
+	return 0;
+}
+
+static enum drm_gem_object_status amdxdna_gem_carvedout_obj_status(struct drm_gem_object *gobj)
+{
+	return DRM_GEM_OBJECT_RESIDENT;
 }
 
 static const struct drm_gem_object_funcs amdxdna_gem_shmem_funcs = {
@@ -608,6 +1340,7 @@ static const struct drm_gem_object_funcs amdxdna_gem_shmem_funcs = {
 	.mmap = amdxdna_gem_shmem_obj_mmap,
 	.vm_ops = &drm_gem_shmem_vm_ops,
 	.export = amdxdna_gem_prime_export,
+	.status = amdxdna_gem_shmem_obj_status,
 };
 
 static const struct vm_operations_struct drm_vm_ops = {
@@ -627,6 +1360,7 @@ static const struct drm_gem_object_funcs amdxdna_gem_carvedout_obj_funcs = {
 	.vunmap = amdxdna_gem_obj_vunmap,
 	.mmap = amdxdna_gem_carvedout_obj_mmap,
 	.vm_ops = &drm_vm_ops,
+	.status = amdxdna_gem_carvedout_obj_status,
 };
 
 /* For drm_driver->gem_create_object callback, only support shmem */
@@ -645,14 +1379,30 @@ amdxdna_gem_create_shmem_object_cb(struct drm_device *dev, size_t size)
 }
 
 static struct amdxdna_gem_obj *
-amdxdna_gem_create_shmem_object(struct drm_device *dev, size_t size)
+amdxdna_gem_create_shmem_object(struct drm_device *dev, size_t size, bool huge)
 {
-	struct drm_gem_shmem_object *shmem = drm_gem_shmem_create(dev, size);
+	struct drm_gem_shmem_object *shmem;
+	struct amdxdna_gem_obj *abo;
+
+#ifdef AMDXDNA_HUGE_PAGE
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
 
+	huge = huge && xdna->huge_mnt;
+	if (huge)
+		shmem = drm_gem_shmem_create_with_mnt(dev, size, xdna->huge_mnt);
+	else
+		shmem = drm_gem_shmem_create(dev, size);
+#else
+	huge = false;
+	shmem = drm_gem_shmem_create(dev, size);
+#endif
 	if (IS_ERR(shmem))
 		return ERR_CAST(shmem);
 	shmem->map_wc = false;
-	return to_xdna_obj(&shmem->base);
+	abo = to_xdna_obj(&shmem->base);
+	if (huge)
+		abo->flags |= BO_HUGE_PAGE;
+	return abo;
 }
 
 static struct amdxdna_gem_obj *
@@ -690,6 +1440,9 @@ destroy_abo:
 	return ERR_PTR(ret);
 }
 
+static struct drm_gem_object *
+amdxdna_gem_import_attach(struct drm_device *dev, struct dma_buf *dma_buf);
+
 static struct amdxdna_gem_obj *
 amdxdna_gem_import_udma_object(struct drm_device *dev, int udma_fd)
 {
@@ -704,7 +1457,8 @@ amdxdna_gem_import_udma_object(struct drm_device *dev, int udma_fd)
 	if (IS_ERR(dma_buf))
 		return ERR_CAST(dma_buf);
 
-	gobj = dev->driver->gem_prime_import(dev, dma_buf);
+	/* Object is modified below, it can't be shared with other importers */
+	gobj = amdxdna_gem_import_attach(dev, dma_buf);
 	if (IS_ERR(gobj)) {
 		dma_buf_put(dma_buf);
 		return ERR_CAST(gobj);
@@ -751,7 +1505,8 @@ amdxdna_gem_create_share_object(struct drm_device *dev,
 		return amdxdna_gem_import_udma_object(dev, (int)args->udma_fd);
 
 	if (!amdxdna_use_carvedout())
-		return amdxdna_gem_create_shmem_object(dev, aligned_sz);
+		return amdxdna_gem_create_shmem_object(dev, aligned_sz,
+						       args->flags & AMDXDNA_BO_FLAG_HUGE_PAGE);
 	return amdxdna_gem_create_carvedout_object(dev, aligned_sz);
 }
 
@@ -764,55 +1519,145 @@ amdxdna_gem_destroy_share_object(struct amdxdna_gem_obj *abo)
 		amdxdna_gem_carvedout_obj_free(to_gobj(abo));
 }
 
-struct drm_gem_object *
-amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
+static struct amdxdna_gem_import *
+amdxdna_gem_import_lookup_locked(struct amdxdna_dev *xdna, struct dma_buf *dma_buf)
 {
-	struct dma_buf_attachment *attach;
-	struct amdxdna_gem_obj *abo;
-	struct drm_gem_object *gobj;
-	struct sg_table *sgt;
+	struct amdxdna_gem_import *imp;
+
+	lockdep_assert_held(&xdna->import_lock);
+
+	hash_for_each_possible(xdna->import_ht, imp, node, (unsigned long)dma_buf) {
+		if (imp->dma_buf == dma_buf && kref_get_unless_zero(&imp->refcnt)) {
+			XDNA_DBG(xdna, "Reuse attachment of dma-buf %p", dma_buf);
+			return imp;
+		}
+	}
+	return NULL;
+}
+
+static struct amdxdna_gem_import *
+amdxdna_gem_import_get(struct amdxdna_dev *xdna, struct dma_buf *dma_buf)
+{
+	struct amdxdna_gem_import *imp, *dup;
 	int ret;
 
+	mutex_lock(&xdna->import_lock);
+	imp = amdxdna_gem_import_lookup_locked(xdna, dma_buf);
+	mutex_unlock(&xdna->import_lock);
+	if (imp)
+		return imp;
+
+	imp = kzalloc(sizeof(*imp), GFP_KERNEL);
+	if (!imp)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&imp->refcnt);
+	imp->xdna = xdna;
+	imp->dma_buf = dma_buf;
 	get_dma_buf(dma_buf);
 
-	attach = dma_buf_attach(dma_buf, dev->dev);
-	if (IS_ERR(attach)) {
-		ret = PTR_ERR(attach);
+	/* Attach without import_lock, it must not nest in dma-buf resv lock */
+	imp->attach = dma_buf_attach(dma_buf, xdna->ddev.dev);
+	if (IS_ERR(imp->attach)) {
+		ret = PTR_ERR(imp->attach);
 		goto put_buf;
 	}
 
-	sgt = dma_buf_map_attachment_unlocked(attach, DMA_BIDIRECTIONAL);
-	if (IS_ERR(sgt)) {
-		ret = PTR_ERR(sgt);
-		goto fail_detach;
+	imp->sgt = dma_buf_map_attachment_unlocked(imp->attach, DMA_BIDIRECTIONAL);
+	if (IS_ERR(imp->sgt)) {
+		ret = PTR_ERR(imp->sgt);
+		goto detach;
+	}
+
+	mutex_lock(&xdna->import_lock);
+	dup = amdxdna_gem_import_lookup_locked(xdna, dma_buf);
+	if (!dup)
+		hash_add(xdna->import_ht, &imp->node, (unsigned long)dma_buf);
+	mutex_unlock(&xdna->import_lock);
+
+	/* Lost the race to another importer */
+	if (dup) {
+		amdxdna_gem_import_unmap(dma_buf, imp->attach, imp->sgt);
+		kfree(imp);
+		imp = dup;
 	}
+	return imp;
+
+detach:
+	dma_buf_detach(dma_buf, imp->attach);
+put_buf:
+	dma_buf_put(dma_buf);
+	kfree(imp);
+	return ERR_PTR(ret);
+}
+
+/*
+ * Object over a mapped attachment. It owns the attachment, or one reference
+ * of imp when shared, and gives it up when freed, or here on failure.
+ */
+static struct drm_gem_object *
+amdxdna_gem_import_sgt(struct drm_device *dev, struct dma_buf *dma_buf,
+		       struct dma_buf_attachment *attach, struct sg_table *sgt,
+		       struct amdxdna_gem_import *imp)
+{
+	struct amdxdna_gem_obj *abo;
+	struct drm_gem_object *gobj;
+#ifdef AMDXDNA_DEVEL
+	int ret;
+#endif
 
 	gobj = drm_gem_shmem_prime_import_sg_table(dev, attach, sgt);
 	if (IS_ERR(gobj)) {
-		ret = PTR_ERR(gobj);
-		goto fail_unmap;
+		if (imp)
+			amdxdna_gem_import_put(imp);
+		else
+			amdxdna_gem_import_unmap(dma_buf, attach, sgt);
+		return gobj;
 	}
 
 	abo = to_xdna_obj(gobj);
 	abo->attach = attach;
 	abo->dma_buf = dma_buf;
+	abo->import = imp;
 
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
-		abo = to_xdna_obj(gobj);
 		ret = amdxdna_bo_dma_map(abo);
 		if (ret) {
 			drm_gem_object_put(gobj);
-			goto fail_unmap;
+			return ERR_PTR(ret);
 		}
 		abo->mem.dev_addr = abo->mem.dma_addr;
 	}
 #endif
 
 	return gobj;
+}
+
+/* Private attachment, for an object which is modified after import */
+static struct drm_gem_object *
+amdxdna_gem_import_attach(struct drm_device *dev, struct dma_buf *dma_buf)
+{
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+	int ret;
+
+	get_dma_buf(dma_buf);
+
+	attach = dma_buf_attach(dma_buf, dev->dev);
+	if (IS_ERR(attach)) {
+		ret = PTR_ERR(attach);
+		goto put_buf;
+	}
+
+	sgt = dma_buf_map_attachment_unlocked(attach, DMA_BIDIRECTIONAL);
+	if (IS_ERR(sgt)) {
+		ret = PTR_ERR(sgt);
+		goto fail_detach;
+	}
+
+	return amdxdna_gem_import_sgt(dev, dma_buf, attach, sgt, NULL);
 
-fail_unmap:
-	dma_buf_unmap_attachment_unlocked(attach, sgt, DMA_BIDIRECTIONAL);
 fail_detach:
 	dma_buf_detach(dma_buf, attach);
 put_buf:
@@ -821,6 +1666,18 @@ put_buf:
 	return ERR_PTR(ret);
 }
 
+struct drm_gem_object *
+amdxdna_gem_prime_import(struct drm_device *dev, struct dma_buf *dma_buf)
+{
+	struct amdxdna_gem_import *imp;
+
+	imp = amdxdna_gem_import_get(to_xdna_dev(dev), dma_buf);
+	if (IS_ERR(imp))
+		return ERR_CAST(imp);
+
+	return amdxdna_gem_import_sgt(dev, imp->dma_buf, imp->attach, imp->sgt, imp);
+}
+
 static struct amdxdna_gem_obj *
 amdxdna_drm_create_share_bo(struct drm_device *dev,
 			    struct amdxdna_drm_create_bo *args, struct drm_file *filp)
@@ -857,6 +1714,7 @@ amdxdna_drm_create_dev_heap_bo(struct drm_device *dev,
 	struct amdxdna_client *client = filp->driver_priv;
 	struct amdxdna_dev *xdna = to_xdna_dev(dev);
 	struct amdxdna_gem_obj *abo;
+	u32 nr;
 	int ret;
 
 	if (args->size > xdna->dev_info->dev_mem_size) {
@@ -865,10 +1723,18 @@ amdxdna_drm_create_dev_heap_bo(struct drm_device *dev,
 		return ERR_PTR(-EINVAL);
 	}
 
+	/*
+	 * The first heap is what contexts are created with. Later ones grow the
+	 * heap, each chunk placed right after the previous one in device address
+	 * space, so device addresses stay relative to the first chunk.
+	 */
 	mutex_lock(&client->mm_lock);
-	if (client->dev_heap) {
-		XDNA_ERR(client->xdna, "dev heap is already created");
-		ret = -EBUSY;
+	nr = client->nr_heap_chunks;
+	if (nr == AMDXDNA_MAX_HEAP_CHUNKS ||
+	    client->heap_size + args->size > xdna->dev_info->dev_mem_size) {
+		XDNA_ERR(client->xdna, "Can not grow dev heap 0x%lx by 0x%llx, chunks %d",
+			 client->heap_size, args->size, nr);
+		ret = -ENOSPC;
 		goto mm_unlock;
 	}
 
@@ -880,9 +1746,16 @@ amdxdna_drm_create_dev_heap_bo(struct drm_device *dev,
 
 	abo->type = AMDXDNA_BO_DEV_HEAP;
 	abo->client = client;
-	abo->mem.dev_addr = client->xdna->dev_info->dev_mem_base;
+	abo->mem.dev_addr = client->xdna->dev_info->dev_mem_base + client->heap_size;
+	abo->heap_mapped = !nr;
 	drm_mm_init(&abo->mm, abo->mem.dev_addr, abo->mem.size);
 
+	ret = amdxdna_heap_cls_init(abo);
+	if (ret) {
+		drm_gem_object_put(to_gobj(abo));
+		goto mm_unlock;
+	}
+
 #ifdef AMDXDNA_DEVEL
 	if (iommu_mode == AMDXDNA_IOMMU_NO_PASID) {
 		ret = amdxdna_bo_dma_map(abo);
@@ -892,8 +1765,13 @@ amdxdna_drm_create_dev_heap_bo(struct drm_device *dev,
 		}
 	}
 #endif
-	client->dev_heap = abo;
 	drm_gem_object_get(to_gobj(abo));
+	client->heap_chunks[nr] = abo;
+	client->heap_size += abo->mem.size;
+	if (!nr)
+		client->dev_heap = abo;
+	/* Pairs with lockless lookup in amdxdna_gem_heap_alloc() */
+	smp_store_release(&client->nr_heap_chunks, nr + 1);
 	mutex_unlock(&client->mm_lock);
 
 	return abo;
@@ -995,7 +1873,16 @@ int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_f
 	struct amdxdna_gem_obj *abo;
 	int ret;
 
-	if (args->flags)
+	if (args->flags & ~(AMDXDNA_BO_FLAG_HUGE_PAGE | AMDXDNA_BO_FLAG_EXPLICIT_SYNC |
+			    AMDXDNA_BO_FLAG_ASYNC_POPULATE))
+		return -EINVAL;
+
+	if ((args->flags & AMDXDNA_BO_FLAG_ASYNC_POPULATE) &&
+	    (args->type != AMDXDNA_BO_SHARE || !args->udma_fd))
+		return -EINVAL;
+
+	if ((args->flags & AMDXDNA_BO_FLAG_HUGE_PAGE) &&
+	    args->type != AMDXDNA_BO_SHARE && args->type != AMDXDNA_BO_DEV_HEAP)
 		return -EINVAL;
 
 	XDNA_DBG(xdna, "BO arg type %d udma_fd 0x%llx size 0x%llx flags 0x%llx",
@@ -1031,6 +1918,13 @@ int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_f
 	if (IS_ERR(abo))
 		return PTR_ERR(abo);
 
+	if (args->flags & AMDXDNA_BO_FLAG_EXPLICIT_SYNC)
+		abo->flags |= BO_EXPLICIT_SYNC;
+	if (args->flags & AMDXDNA_BO_FLAG_ASYNC_POPULATE) {
+		INIT_WORK(&abo->populate_work, amdxdna_gem_populate_work);
+		abo->flags |= BO_ASYNC_POPULATE;
+	}
+
 	/* ready to publish object to userspace */
 	ret = drm_gem_handle_create(filp, to_gobj(abo), &args->handle);
 	if (ret) {
@@ -1061,7 +1955,7 @@ int amdxdna_gem_pin_nolock(struct amdxdna_gem_obj *abo)
 		ret = drm_gem_shmem_pin(&abo->base);
 		break;
 	case AMDXDNA_BO_DEV:
-		ret = drm_gem_shmem_pin(&abo->client->dev_heap->base);
+		ret = drm_gem_shmem_pin(&abo->heap->base);
 		break;
 	default:
 		ret = -EOPNOTSUPP;
@@ -1088,13 +1982,192 @@ void amdxdna_gem_unpin(struct amdxdna_gem_obj *abo)
 		return;
 
 	if (abo->type == AMDXDNA_BO_DEV)
-		abo = abo->client->dev_heap;
+		abo = abo->heap;
 
 	mutex_lock(&abo->lock);
 	drm_gem_shmem_unpin(&abo->base);
 	mutex_unlock(&abo->lock);
 }
 
+/*
+ * Pin a BO for a job or resident set. The pin is kept after use so that
+ * later submissions are cheap. Idle SHARE BOs sit on the device pin LRU, the
+ * shrinker unpins those no mapping holds pages of under memory pressure and
+ * they are pinned again here on next use.
+ */
+int amdxdna_gem_submit_pin(struct amdxdna_gem_obj *abo)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
+	bool lru = amdxdna_gem_lru_eligible(abo);
+	int ret;
+
+	mutex_lock(&abo->lock);
+	if (!(abo->flags & BO_SUBMIT_PINNED)) {
+		ret = amdxdna_gem_pin_nolock(abo);
+		if (ret) {
+			mutex_unlock(&abo->lock);
+			return ret;
+		}
+		abo->flags |= BO_SUBMIT_PINNED;
+	}
+	atomic_inc(&abo->submit_users);
+	if (lru) {
+		spin_lock(&xdna->pin_lru_lock);
+		list_move_tail(&abo->pin_lru, &xdna->pin_lru);
+		spin_unlock(&xdna->pin_lru_lock);
+	}
+	mutex_unlock(&abo->lock);
+
+	return 0;
+}
+
+void amdxdna_gem_submit_unpin(struct amdxdna_gem_obj *abo)
+{
+	atomic_dec(&abo->submit_users);
+}
+
+#if KERNEL_VERSION(6, 7, 0) > LINUX_VERSION_CODE
+#define to_pin_shrinker_xdna(s)	container_of(s, struct amdxdna_dev, pin_shrinker_s)
+#else
+#define to_pin_shrinker_xdna(s)	((struct amdxdna_dev *)(s)->private_data)
+#endif
+
+/*
+ * Dropping the pin only frees pages nothing else holds. A user mmap, kernel
+ * vmap or dma-buf export keeps them, the shrinker skips those BOs. Read
+ * without lock, a mapping showing up later only makes the estimate stale.
+ */
+static bool amdxdna_gem_unpin_frees(struct amdxdna_gem_obj *abo)
+{
+	return !atomic_read(&abo->submit_users) && !READ_ONCE(abo->mem.kva) &&
+		list_empty(&abo->mem.umap_list) && !READ_ONCE(to_gobj(abo)->dma_buf);
+}
+
+/*
+ * Unpinning needs BO resv lock, which may be held by someone allocating
+ * memory, e.g. reserving fences. So the shrinker only picks idle BOs and
+ * the unpin is done here outside of reclaim.
+ */
+static void amdxdna_gem_unpin_work(struct work_struct *work)
+{
+	struct amdxdna_dev *xdna = container_of(work, struct amdxdna_dev, unpin_work);
+	struct amdxdna_gem_obj *abo;
+
+	spin_lock(&xdna->pin_lru_lock);
+	while ((abo = list_first_entry_or_null(&xdna->unpin_list,
+					       struct amdxdna_gem_obj, pin_lru))) {
+		list_del_init(&abo->pin_lru);
+		/* Being freed, free path drops the pin */
+		if (!kref_get_unless_zero(&to_gobj(abo)->refcount))
+			continue;
+		spin_unlock(&xdna->pin_lru_lock);
+
+		/* Skip if it is used again, it is back on the LRU then */
+		mutex_lock(&abo->lock);
+		if ((abo->flags & BO_SUBMIT_PINNED) && list_empty(&abo->pin_lru) &&
+		    amdxdna_gem_unpin_frees(abo) &&
+		    dma_resv_test_signaled(to_gobj(abo)->resv, DMA_RESV_USAGE_BOOKKEEP)) {
+			drm_gem_shmem_unpin(&abo->base);
+			abo->flags &= ~BO_SUBMIT_PINNED;
+		}
+		mutex_unlock(&abo->lock);
+		drm_gem_object_put(to_gobj(abo));
+
+		spin_lock(&xdna->pin_lru_lock);
+	}
+	spin_unlock(&xdna->pin_lru_lock);
+}
+
+static unsigned long
+amdxdna_gem_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct amdxdna_dev *xdna = to_pin_shrinker_xdna(shrinker);
+	struct amdxdna_gem_obj *abo;
+	unsigned long pages = 0;
+
+	spin_lock(&xdna->pin_lru_lock);
+	list_for_each_entry(abo, &xdna->pin_lru, pin_lru) {
+		if (amdxdna_gem_unpin_frees(abo))
+			pages += to_gobj(abo)->size >> PAGE_SHIFT;
+	}
+	spin_unlock(&xdna->pin_lru_lock);
+
+	return pages ?: SHRINK_EMPTY;
+}
+
+static unsigned long
+amdxdna_gem_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct amdxdna_dev *xdna = to_pin_shrinker_xdna(shrinker);
+	struct amdxdna_gem_obj *abo, *tmp;
+	unsigned long nr = 0;
+
+	spin_lock(&xdna->pin_lru_lock);
+	list_for_each_entry_safe(abo, tmp, &xdna->pin_lru, pin_lru) {
+		if (nr >= sc->nr_to_scan)
+			break;
+		if (!amdxdna_gem_unpin_frees(abo))
+			continue;
+		list_move_tail(&abo->pin_lru, &xdna->unpin_list);
+		nr += to_gobj(abo)->size >> PAGE_SHIFT;
+	}
+	spin_unlock(&xdna->pin_lru_lock);
+
+	if (nr) {
+		queue_work(system_unbound_wq, &xdna->unpin_work);
+		sc->nr_scanned = nr;
+	}
+	/* Nothing is freed by this call, the worker gives the pages back later */
+	return SHRINK_STOP;
+}
+
+static void amdxdna_gem_shrinker_fini(struct drm_device *ddev, void *data)
+{
+	struct amdxdna_dev *xdna = to_xdna_dev(ddev);
+
+#if KERNEL_VERSION(6, 7, 0) > LINUX_VERSION_CODE
+	unregister_shrinker(xdna->pin_shrinker);
+#else
+	shrinker_free(xdna->pin_shrinker);
+#endif
+	flush_work(&xdna->unpin_work);
+}
+
+int amdxdna_gem_shrinker_init(struct amdxdna_dev *xdna)
+{
+	struct shrinker *shrinker;
+	int ret;
+
+	spin_lock_init(&xdna->pin_lru_lock);
+	INIT_LIST_HEAD(&xdna->pin_lru);
+	INIT_LIST_HEAD(&xdna->unpin_list);
+	INIT_WORK(&xdna->unpin_work, amdxdna_gem_unpin_work);
+
+#if KERNEL_VERSION(6, 7, 0) > LINUX_VERSION_CODE
+	shrinker = &xdna->pin_shrinker_s;
+	shrinker->count_objects = amdxdna_gem_shrinker_count;
+	shrinker->scan_objects = amdxdna_gem_shrinker_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(shrinker, "drm-amdxdna:%s", dev_name(xdna->ddev.dev));
+	if (ret)
+		return ret;
+#else
+	shrinker = shrinker_alloc(0, "drm-amdxdna:%s", dev_name(xdna->ddev.dev));
+	if (!shrinker)
+		return -ENOMEM;
+	shrinker->count_objects = amdxdna_gem_shrinker_count;
+	shrinker->scan_objects = amdxdna_gem_shrinker_scan;
+	shrinker->private_data = xdna;
+	shrinker_register(shrinker);
+#endif
+	xdna->pin_shrinker = shrinker;
+
+	ret = drmm_add_action_or_reset(&xdna->ddev, amdxdna_gem_shrinker_fini, NULL);
+	if (ret)
+		XDNA_ERR(xdna, "Add shrinker fini action failed, ret %d", ret);
+	return ret;
+}
+
 struct amdxdna_gem_obj *amdxdna_gem_get_obj(struct amdxdna_client *client,
 					    u32 bo_hdl, u8 bo_type)
 {
@@ -1149,55 +2222,112 @@ int amdxdna_drm_get_bo_info_ioctl(struct drm_device *dev, void *data, struct drm
 	return ret;
 }
 
+/*
+ * Flush through the kernel direct map, no vmap needed. Physically adjacent
+ * pages are virtually adjacent there too, so each contiguous run is flushed
+ * with one call and one pair of barriers instead of page by page.
+ */
+static void
+amdxdna_clflush_pages(struct page **pages, u64 start, u64 size)
+{
+	u64 end = start + size;
+	void *run = NULL;
+	u64 run_len = 0;
+	void *addr;
+	u32 off, len;
+
+	while (start < end) {
+		off = start & ~PAGE_MASK;
+		len = min_t(u64, PAGE_SIZE - off, end - start);
+		addr = page_to_virt(pages[start >> PAGE_SHIFT]) + off;
+		if (run && run + run_len == addr) {
+			run_len += len;
+		} else {
+			if (run)
+				drm_clflush_virt_range(run, run_len);
+			run = addr;
+			run_len = len;
+		}
+		start += len;
+	}
+	if (run)
+		drm_clflush_virt_range(run, run_len);
+}
+
+/* Same for imported BOs, only the part of the sg_table covering the range */
+static void
+amdxdna_clflush_sg(struct sg_table *sgt, u64 start, u64 size)
+{
+	u64 end = start + size;
+	struct scatterlist *sg;
+	u64 sg_start = 0;
+	u64 s, e;
+	int i;
+
+	for_each_sgtable_sg(sgt, sg, i) {
+		if (sg_start >= end)
+			break;
+		s = max(start, sg_start);
+		e = min(end, sg_start + sg->length);
+		if (s < e)
+			drm_clflush_virt_range(sg_virt(sg) + (s - sg_start), e - s);
+		sg_start += sg->length;
+	}
+}
+
 static void
-amdxdna_drm_clflush(struct amdxdna_gem_obj *abo, u32 start, u32 size)
+amdxdna_drm_clflush(struct amdxdna_gem_obj *abo, u64 start, u64 size)
 {
 	struct amdxdna_dev *xdna = to_xdna_dev(to_gobj(abo)->dev);
-	u32 start_page, start_page_off;
-	u32 end_page, end_page_size;
-	u32 end = start + size - 1;
-	u32 pages_in_middle;
 	struct page **pages;
-	void *addr;
 
-	start_page = start >> PAGE_SHIFT;
-	end_page = end >> PAGE_SHIFT;
-	start_page_off = start & ~PAGE_MASK;
-	end_page_size = (end & ~PAGE_MASK) + 1;
+	if (!size)
+		return;
+
+	XDNA_DBG(xdna, "Flush range [0x%llx, 0x%llx)", start, start + size);
+
+	if (is_import_bo(abo)) {
+		amdxdna_clflush_sg(abo->base.sgt, start, size);
+		return;
+	}
 
 	if (abo->type == AMDXDNA_BO_DEV)
 		pages = abo->mem.pages;
 	else
 		pages = abo->base.pages;
 
-	XDNA_DBG(xdna, "Flush range [%d, %d]. page,size: [%d, %d] to [%d, %d]",
-		 start, end, start_page, start_page_off, end_page, end_page_size);
-
-	/* If start and end are on the page, use lightweight kernel API for best
-	 * performance.
-	 */
-	addr = page_to_virt(pages[start_page]);
-	addr = (void *)((u64)addr + start_page_off);
-	if (start_page == end_page) {
-		drm_clflush_virt_range(addr, size);
+	/* Carved out memory has no struct page and is not mapped cached */
+	if (!pages)
 		return;
-	}
 
-	/* There are multiple pages */
-	if (start_page_off)
-		drm_clflush_virt_range(addr, PAGE_SIZE - start_page_off);
-	else
-		drm_clflush_pages(&pages[0], 1);
+	amdxdna_clflush_pages(pages, start, size);
+}
 
-	pages_in_middle = end_page - start_page - 1;
-	if (pages_in_middle)
-		drm_clflush_pages(&pages[1], pages_in_middle);
+static int
+amdxdna_sync_bo_cpu(struct amdxdna_gem_obj *abo, u64 offset, u64 size)
+{
+	int ret;
 
-	addr = page_to_virt(pages[end_page]);
-	if (end_page_size < PAGE_SIZE)
-		drm_clflush_virt_range(addr, end_page_size);
-	else
-		drm_clflush_pages(&pages[end_page], 1);
+	/* Coherent DMA needs no CPU cache maintenance, nor the pages pinned */
+	if (io_coherent)
+		return 0;
+
+	ret = amdxdna_gem_pin(abo);
+	if (ret)
+		return ret;
+
+	amdxdna_drm_clflush(abo, offset, size);
+
+	amdxdna_gem_unpin(abo);
+	return 0;
+}
+
+/* offset and size come from user, their sum may wrap */
+static bool amdxdna_gem_range_valid(struct drm_gem_object *gobj, u64 offset, u64 size)
+{
+	u64 end;
+
+	return !check_add_overflow(offset, size, &end) && end <= gobj->size;
 }
 
 /*
@@ -1225,25 +2355,17 @@ int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev,
 	}
 	abo = to_xdna_obj(gobj);
 
-	if (gobj->size < args->offset + args->size) {
+	if (!amdxdna_gem_range_valid(gobj, args->offset, args->size)) {
 		ret = -EINVAL;
 		goto put_obj;
 	}
 
-	ret = amdxdna_gem_pin(abo);
+	ret = amdxdna_sync_bo_cpu(abo, args->offset, args->size);
 	if (ret) {
 		XDNA_ERR(xdna, "Pin BO %d failed, ret %d", args->handle, ret);
 		goto put_obj;
 	}
 
-	/* For import bo, still sync whole BO */
-	if (is_import_bo(abo))
-		drm_clflush_sg(abo->base.sgt);
-	else
-		amdxdna_drm_clflush(abo, args->offset, args->size);
-
-	amdxdna_gem_unpin(abo);
-
 	if (abo->assigned_ctx != AMDXDNA_INVALID_CTX_HANDLE &&
 	    args->direction == SYNC_DIRECT_FROM_DEVICE) {
 		u64 seq;
@@ -1275,6 +2397,120 @@ put_obj:
 	return ret;
 }
 
+#define MAX_SYNC_BO_COUNT	1024
+
+/*
+ * Vectored sync bo. CPU caches are maintained entry by entry. Owner context
+ * BOs synced from device are gathered into one OP_SYNC_BO job per context,
+ * all the jobs are submitted before waiting for any of them.
+ */
+int amdxdna_drm_sync_bos_ioctl(struct drm_device *dev,
+			       void *data, struct drm_file *filp)
+{
+	struct amdxdna_client *client = filp->driver_priv;
+	struct amdxdna_dev *xdna = to_xdna_dev(dev);
+	struct amdxdna_drm_sync_bos *args = data;
+	struct amdxdna_drm_sync_bo *ents, *e;
+	u32 *ctx_hdls, *dev_hdls;
+	struct amdxdna_gem_obj *abo;
+	struct drm_gem_object *gobj;
+	u32 i, j, k, ctx_hdl;
+	u32 dev_cnt = 0;
+	u32 grp_cnt = 0;
+	int ret = 0, r;
+	u64 *seqs;
+
+	if (args->pad || !args->count || args->count > MAX_SYNC_BO_COUNT) {
+		XDNA_ERR(xdna, "Invalid sync bo count %d", args->count);
+		return -EINVAL;
+	}
+
+	ents = kvcalloc(args->count, sizeof(*ents) + sizeof(*seqs) + 2 * sizeof(u32),
+			GFP_KERNEL);
+	if (!ents)
+		return -ENOMEM;
+	seqs = (u64 *)(ents + args->count);
+	ctx_hdls = (u32 *)(seqs + args->count);
+	dev_hdls = ctx_hdls + args->count;
+
+	if (copy_from_user(ents, u64_to_user_ptr(args->entries),
+			   args->count * sizeof(*ents))) {
+		ret = -EFAULT;
+		goto free_ents;
+	}
+
+	for (i = 0; i < args->count; i++) {
+		e = &ents[i];
+		gobj = drm_gem_object_lookup(filp, e->handle);
+		if (!gobj) {
+			XDNA_ERR(xdna, "Lookup GEM object %d failed", e->handle);
+			ret = -ENOENT;
+			goto free_ents;
+		}
+		abo = to_xdna_obj(gobj);
+
+		if (!amdxdna_gem_range_valid(gobj, e->offset, e->size))
+			ret = -EINVAL;
+		else
+			ret = amdxdna_sync_bo_cpu(abo, e->offset, e->size);
+
+		if (!ret && abo->assigned_ctx != AMDXDNA_INVALID_CTX_HANDLE &&
+		    e->direction == SYNC_DIRECT_FROM_DEVICE) {
+			ctx_hdl = amdxdna_gem_get_assigned_ctx(client, e->handle);
+			if (ctx_hdl == AMDXDNA_INVALID_CTX_HANDLE)
+				ret = -EINVAL;
+
+			/* Device writes back the whole BO, once is enough */
+			for (j = 0; !ret && j < dev_cnt && dev_hdls[j] != e->handle; j++)
+				;
+			if (!ret && j == dev_cnt) {
+				ctx_hdls[dev_cnt] = ctx_hdl;
+				dev_hdls[dev_cnt++] = e->handle;
+			}
+		}
+		drm_gem_object_put(gobj);
+		if (ret) {
+			XDNA_ERR(xdna, "Sync bo %d entry %d failed, ret %d", e->handle, i, ret);
+			goto free_ents;
+		}
+	}
+
+	/* Group handles by context, in place, then one job per group */
+	for (i = 0; i < dev_cnt; i = j) {
+		ctx_hdl = ctx_hdls[i];
+		for (j = i + 1, k = i + 1; k < dev_cnt; k++) {
+			if (ctx_hdls[k] != ctx_hdl)
+				continue;
+			swap(ctx_hdls[j], ctx_hdls[k]);
+			swap(dev_hdls[j], dev_hdls[k]);
+			j++;
+		}
+
+		ret = amdxdna_cmd_submit(client, OP_SYNC_BO, AMDXDNA_INVALID_BO_HANDLE,
+					 &dev_hdls[i], j - i, NULL, NULL, 0, ctx_hdl,
+					 &seqs[grp_cnt]);
+		if (ret) {
+			XDNA_ERR(xdna, "Submit sync bo to ctx %d failed, ret %d", ctx_hdl, ret);
+			break;
+		}
+		/* Slots before i are consumed, reuse them for the group's context */
+		ctx_hdls[grp_cnt++] = ctx_hdl;
+	}
+
+	for (i = 0; i < grp_cnt; i++) {
+		r = amdxdna_cmd_wait(client, ctx_hdls[i], seqs[i], 3000 /* ms */);
+		if (r && !ret)
+			ret = r;
+	}
+
+	XDNA_DBG(xdna, "Synced %d entries, %d BOs by device in %d jobs",
+		 args->count, dev_cnt, grp_cnt);
+
+free_ents:
+	kvfree(ents);
+	return ret;
+}
+
 u32 amdxdna_gem_get_assigned_ctx(struct amdxdna_client *client, u32 bo_hdl)
 {
 	struct amdxdna_gem_obj *abo = amdxdna_gem_get_obj(client, bo_hdl, AMDXDNA_BO_INVALID);
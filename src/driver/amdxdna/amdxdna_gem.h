@@ -10,6 +10,10 @@
 #include <drm/drm_gem.h>
 #include <drm/drm_gem_shmem_helper.h>
 #include <linux/hmm.h>
+#include <linux/sizes.h>
+#include <linux/spinlock.h>
+
+struct seq_file;
 
 struct amdxdna_umap {
 	struct vm_area_struct		*vma;
@@ -19,6 +23,8 @@ struct amdxdna_umap {
 	struct amdxdna_gem_obj		*abo;
 	struct list_head		node;
 	struct kref			refcnt;
+	unsigned long			invalid_start;
+	unsigned long			invalid_end;
 	bool				invalid;
 	bool				unmapped;
 };
@@ -40,21 +46,64 @@ struct amdxdna_mem {
 #endif
 };
 
+/*
+ * Small dev BOs are served from per size class slabs carved out of the heap,
+ * so that they don't contend on client mm_lock and drm_mm best-fit search.
+ * Chunk sizes are powers of 2 starting at heap buffer alignment.
+ */
+#define AMDXDNA_HEAP_NR_CLASSES	4
+#define AMDXDNA_HEAP_SLAB_SIZE	SZ_2M
+
+struct amdxdna_heap_class;
+
+struct amdxdna_heap_slab {
+	struct list_head		node;
+	struct drm_mm_node		mm_node;
+	struct amdxdna_heap_class	*cls;
+	u32				nr_free;
+	unsigned long			free_map; /* Bit set for free chunk */
+};
+
+struct amdxdna_heap_class {
+	spinlock_t			lock; /* Protects slab lists and counters */
+	u32				chunk_shift;
+	u32				nr_chunks; /* Per slab */
+	struct list_head		partial;
+	struct list_head		full;
+	u32				nr_slabs;
+	u64				nr_used;
+};
+
 #define BO_SUBMIT_PINNED	BIT(0)
+#define BO_HUGE_PAGE		BIT(1)
+#define BO_EXPLICIT_SYNC	BIT(2)
+#define BO_ASYNC_POPULATE	BIT(3)
+
+struct amdxdna_gem_import;
+
 struct amdxdna_gem_obj {
 	struct drm_gem_shmem_object	base;
 	struct amdxdna_client		*client;
 	u8				type;
 	u64				flags;
 	struct mutex			lock; /* Protects: pinned, assigned_ctx */
+	struct list_head		pin_lru; /* On device pin LRU while submit pinned */
+	atomic_t			submit_users; /* Jobs and resident sets using it */
 	struct amdxdna_mem		mem;
 
 	/* Below members are initialized when needed */
 	struct drm_mm			mm; /* For AMDXDNA_BO_DEV_HEAP */
 	struct drm_mm_node		mm_node; /* For AMDXDNA_BO_DEV / carvedout */
+	struct amdxdna_heap_class	*heap_cls; /* For AMDXDNA_BO_DEV_HEAP */
+	struct amdxdna_heap_slab	*heap_slab; /* For AMDXDNA_BO_DEV from slab */
+	struct amdxdna_gem_obj		*heap; /* For AMDXDNA_BO_DEV, owning heap chunk */
+	bool				heap_mapped; /* For AMDXDNA_BO_DEV_HEAP, seen by firmware */
 	u32				assigned_ctx; /* For debug bo */
 	struct dma_buf			*dma_buf;
 	struct dma_buf_attachment	*attach;
+	struct amdxdna_gem_import	*import; /* Attachment shared with other imports */
+	struct work_struct		populate_work; /* For BO_ASYNC_POPULATE */
+	struct work_struct		free_work; /* For deferred free */
 };
 
 #define to_gobj(obj)    (&(obj)->base.base)
@@ -73,6 +122,7 @@ static inline void amdxdna_gem_put_obj(struct amdxdna_gem_obj *abo)
 }
 
 void amdxdna_umap_put(struct amdxdna_umap *mapp);
+int amdxdna_gem_populate_range(struct amdxdna_gem_obj *abo);
 
 struct drm_gem_object *
 amdxdna_gem_create_shmem_object_cb(struct drm_device *dev, size_t size);
@@ -82,8 +132,14 @@ struct amdxdna_gem_obj *
 amdxdna_drm_create_dev_bo(struct drm_device *dev, struct amdxdna_drm_create_bo *args,
 			  struct drm_file *filp);
 
+void amdxdna_gem_huge_mnt_init(struct amdxdna_dev *xdna);
+void amdxdna_gem_heap_show(struct amdxdna_client *client, struct seq_file *m);
+
 int amdxdna_gem_pin_nolock(struct amdxdna_gem_obj *abo);
 int amdxdna_gem_pin(struct amdxdna_gem_obj *abo);
+int amdxdna_gem_submit_pin(struct amdxdna_gem_obj *abo);
+void amdxdna_gem_submit_unpin(struct amdxdna_gem_obj *abo);
+int amdxdna_gem_shrinker_init(struct amdxdna_dev *xdna);
 void amdxdna_gem_unpin(struct amdxdna_gem_obj *abo);
 
 u32 amdxdna_gem_get_assigned_ctx(struct amdxdna_client *client, u32 bo_hdl);
@@ -93,5 +149,6 @@ void amdxdna_gem_clear_assigned_ctx(struct amdxdna_client *client, u32 bo_hdl);
 int amdxdna_drm_create_bo_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_get_bo_info_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 int amdxdna_drm_sync_bo_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
+int amdxdna_drm_sync_bos_ioctl(struct drm_device *dev, void *data, struct drm_file *filp);
 
 #endif /* _AMDXDNA_GEM_H_ */
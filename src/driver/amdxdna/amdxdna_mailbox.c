@@ -14,14 +14,16 @@
 #include <linux/vmalloc.h>
 #include <linux/build_bug.h>
 #include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/dev_printk.h>
 #if defined(CONFIG_DEBUG_FS)
 #include <linux/seq_file.h>
 #include <linux/wait.h>
 #endif
-#ifdef AMDXDNA_DEVEL
 #include <linux/kthread.h>
-#endif
+#include <linux/cpumask.h>
 #include <linux/irqreturn.h>
 #include "amdxdna_trace.h"
 #include "amdxdna_mailbox.h"
@@ -50,6 +52,36 @@
 #define MAX_MSG_ID_ENTRIES		256
 #define MAILBOX_NAME			"xdna_mailbox"
 #define MSG_ID2ENTRY(msg_id)		((msg_id) & ~MAGIC_VAL_MASK)
+/*
+ * While this many published messages wait for response, new messages are
+ * only written to ring buffer. Next response publishes them in one tail update.
+ */
+#define MB_TAIL_DEFER_DEPTH		2
+#define MB_POLL_RATE_WINDOW_NS		(10 * NSEC_PER_MSEC)
+
+/*
+ * Interrupt channel switches to polld when it receives this many responses
+ * in one window, and switches back after no response for the idle time.
+ */
+static uint mailbox_poll_rate = 64;
+module_param(mailbox_poll_rate, uint, 0600);
+MODULE_PARM_DESC(mailbox_poll_rate, "Responses per 10ms to switch a channel to polling, 0 to disable");
+
+static uint mailbox_poll_idle_us = 200;
+module_param(mailbox_poll_idle_us, uint, 0600);
+MODULE_PARM_DESC(mailbox_poll_idle_us, "Idle time in us before a polling channel goes back to interrupt");
+
+static uint mailbox_poll_budget = 16;
+module_param(mailbox_poll_budget, uint, 0600);
+MODULE_PARM_DESC(mailbox_poll_budget, "Max responses polld handles on one channel before moving to the next");
+
+static bool mailbox_rx_thread = true;
+module_param(mailbox_rx_thread, bool, 0444);
+MODULE_PARM_DESC(mailbox_rx_thread, "Handle context responses in threaded IRQ instead of workqueue (default true)");
+
+static char *mailbox_polld_cpus;
+module_param(mailbox_polld_cpus, charp, 0444);
+MODULE_PARM_DESC(mailbox_polld_cpus, "CPU list, one polld pinned on each. Default one unbound polld");
 
 #ifdef AMDXDNA_DEVEL
 int mailbox_polling;
@@ -68,15 +100,23 @@ enum channel_res_type {
 	CHAN_RES_NUM
 };
 
+struct mailbox_polld {
+	struct mailbox		*mb;
+	struct task_struct	*task;
+	spinlock_t		lock; /* protect chann_list */
+	struct list_head	chann_list;
+	struct wait_queue_head	poll_wait;
+	bool			sent_msg;
+	u32			nr_chann;
+};
+
 struct mailbox {
 	struct device		*dev;
 	struct xdna_mailbox_res	res;
 	spinlock_t		mbox_lock; /* protect channel list */
 	struct list_head        chann_list;
-	struct list_head        poll_chann_list;
-	struct task_struct	*polld;
-	struct wait_queue_head	poll_wait;
-	bool			sent_msg; /* For polld */
+	struct mailbox_polld	*polld;
+	u32			nr_polld;
 #if defined(CONFIG_DEBUG_FS)
 	struct list_head        res_records;
 #endif /* CONFIG_DEBUG_FS */
@@ -91,29 +131,72 @@ struct mailbox_res_record {
 	int				re_irq;
 	int				active;
 };
+
+/* Bucket 0 is below 1us, bucket n is [2^(n-1), 2^n) us, last one is open */
+#define MB_LAT_BUCKETS			20
+#define MB_LAT_OPCODES			16
+struct mailbox_lat_hist {
+	u32				opcode;
+	u64				cnt;
+	u64				total_us;
+	u64				bucket[MB_LAT_BUCKETS];
+};
 #endif /* CONFIG_DEBUG_FS */
 
 struct mailbox_channel {
 	struct mailbox			*mb;
 #if defined(CONFIG_DEBUG_FS)
 	struct mailbox_res_record	*record;
+	/* Send to response latency, updated only by response handling */
+	struct mailbox_lat_hist		lat[MB_LAT_OPCODES];
 #endif
 	struct list_head		chann_entry;
+	/* On polld->chann_list while it is polled */
+	struct list_head		poll_entry;
+	struct mailbox_polld		*polld;
 	struct xdna_mailbox_chann_res	res[CHAN_RES_NUM];
 	int				msix_irq;
 	u32				x2i_tail;
+	/* protect tail register update, x2i_published and x2i_deferred */
+	spinlock_t			x2i_lock;
+	u32				x2i_published;
+	u32				x2i_deferred;
+	/* message between xdna_mailbox_reserve_msg() and commit or cancel */
+	struct mailbox_msg		*resv_msg;
+	u32				resv_tail;
 	u32				iohub_int_addr;
 	enum xdna_mailbox_channel_type	type;
-	struct xarray			chan_xa;
+	/*
+	 * Outstanding messages indexed by MSG_ID2ENTRY(). Senders of a channel
+	 * are serialized, so next_msgid and msg_sent have one writer. Response
+	 * handling is the only writer of msg_done, keep it on its own line.
+	 */
+	struct mailbox_msg		*msg_slots[MAX_MSG_ID_ENTRIES];
 	u32				next_msgid;
+	u64				msg_sent;
+	u64				msg_done ____cacheline_aligned_in_smp;
 
 	/* Received msg related fields */
 	struct workqueue_struct		*work_q;
 	struct work_struct		rx_work;
+	/* Responses handled by threaded IRQ, rx_work is not used */
+	bool				rx_thread;
 	u32				i2x_head;
 	bool				bad_state;
 	u32				last_msg_id;
 
+	/* Adaptive polling, mode switch is protected by polld->lock */
+	bool				polling;
+	bool				poll_pending;
+	u32				poll_rate;
+	u64				poll_idle_ns;
+	ktime_t				rate_ts;
+	u32				rate_resp;
+	ktime_t				last_resp_ts;
+	u64				irq_resp_cnt;
+	u64				poll_resp_cnt;
+	u64				mode_switch_cnt;
+
 #ifdef AMDXDNA_DEVEL
 	struct timer_list		timer;
 #endif
@@ -144,9 +227,45 @@ struct mailbox_msg {
 	void			*handle;
 	int			(*notify_cb)(void *handle, void __iomem *data, size_t size);
 	size_t			pkg_size; /* package size in bytes */
+#if defined(CONFIG_DEBUG_FS)
+	ktime_t			send_ts;
+#endif
 	struct mailbox_pkg	pkg;
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static void mailbox_lat_record(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+{
+	struct mailbox_lat_hist *hist;
+	u32 opcode = mb_msg->pkg.header.opcode;
+	u64 us;
+	int i;
+
+	for (i = 0; i < MB_LAT_OPCODES; i++) {
+		hist = &mb_chann->lat[i];
+		if (hist->opcode == opcode)
+			break;
+		if (!hist->cnt) {
+			hist->opcode = opcode;
+			break;
+		}
+	}
+	/* Too many different opcodes on one channel, not expected */
+	if (i == MB_LAT_OPCODES)
+		return;
+
+	us = ktime_us_delta(ktime_get(), mb_msg->send_ts);
+	hist->cnt++;
+	hist->total_us += us;
+	hist->bucket[us ? min(ilog2(us) + 1, MB_LAT_BUCKETS - 1) : 0]++;
+}
+#else
+static inline void
+mailbox_lat_record(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+{
+}
+#endif
+
 static void mailbox_reg_write(struct mailbox_channel *mb_chann, u32 mbox_reg, u32 data)
 {
 	struct xdna_mailbox_res *mb_res = &mb_chann->mb->res;
@@ -200,6 +319,31 @@ mailbox_set_tailptr(struct mailbox_channel *mb_chann, u32 tailptr_val)
 	mb_chann->x2i_tail = tailptr_val;
 }
 
+static void mailbox_publish_tail(struct mailbox_channel *mb_chann)
+{
+	lockdep_assert_held(&mb_chann->x2i_lock);
+	if (!mb_chann->x2i_deferred)
+		return;
+
+	mailbox_set_tailptr(mb_chann, mb_chann->x2i_tail);
+	mb_chann->x2i_published += mb_chann->x2i_deferred;
+	mb_chann->x2i_deferred = 0;
+}
+
+/*
+ * Called on each response. Responses are in order, so the one just received
+ * was published. Publish deferred messages before firmware runs out of work.
+ */
+static void mailbox_tx_complete(struct mailbox_channel *mb_chann)
+{
+	spin_lock(&mb_chann->x2i_lock);
+	if (mb_chann->x2i_published)
+		mb_chann->x2i_published--;
+	if (mb_chann->x2i_published < MB_TAIL_DEFER_DEPTH)
+		mailbox_publish_tail(mb_chann);
+	spin_unlock(&mb_chann->x2i_lock);
+}
+
 static inline u32
 mailbox_get_headptr(struct mailbox_channel *mb_chann, enum channel_res_type type)
 {
@@ -240,14 +384,23 @@ static inline int mailbox_validate_msgid(struct mailbox_channel *mb_chann, u32 m
 
 static int mailbox_acquire_msgid(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 {
-	u32 msg_id;
-	int ret;
+	u32 msg_id, i;
 
-	ret = xa_alloc_cyclic_irq(&mb_chann->chan_xa, &msg_id, mb_msg,
-				  XA_LIMIT(0, MAX_MSG_ID_ENTRIES - 1),
-				  &mb_chann->next_msgid, GFP_NOWAIT);
-	if (ret < 0)
-		return ret;
+	/*
+	 * Responses come in order on user channel, next slot is free unless
+	 * all slots are in use. Management channel can have a long outstanding
+	 * message, e.g. async event, skip the slot like a cyclic allocator.
+	 */
+	for (i = 0; i < MAX_MSG_ID_ENTRIES; i++) {
+		msg_id = (mb_chann->next_msgid + i) % MAX_MSG_ID_ENTRIES;
+		if (!cmpxchg(&mb_chann->msg_slots[msg_id], NULL, mb_msg))
+			goto found;
+	}
+	return -EBUSY;
+
+found:
+	mb_chann->next_msgid = (msg_id + 1) % MAX_MSG_ID_ENTRIES;
+	WRITE_ONCE(mb_chann->msg_sent, mb_chann->msg_sent + 1);
 
 	/*
 	 * Add MAGIC_VAL to the higher bits.
@@ -258,13 +411,17 @@ static int mailbox_acquire_msgid(struct mailbox_channel *mb_chann, struct mailbo
 
 static bool mailbox_channel_no_msg(struct mailbox_channel *mb_chann)
 {
-	return xa_empty(&mb_chann->chan_xa);
+	return READ_ONCE(mb_chann->msg_sent) == READ_ONCE(mb_chann->msg_done);
 }
 
+/* Only for the sender to undo mailbox_acquire_msgid() */
 static void mailbox_release_msgid(struct mailbox_channel *mb_chann, int msg_id)
 {
 	msg_id = MSG_ID2ENTRY(msg_id);
-	xa_erase_irq(&mb_chann->chan_xa, msg_id);
+	WRITE_ONCE(mb_chann->msg_sent, mb_chann->msg_sent - 1);
+	xchg(&mb_chann->msg_slots[msg_id], NULL);
+	/* Keep message IDs contiguous for firmware */
+	mb_chann->next_msgid = msg_id;
 }
 
 static void mailbox_release_msg(struct mailbox_channel *mb_chann,
@@ -276,8 +433,13 @@ static void mailbox_release_msg(struct mailbox_channel *mb_chann,
 	kfree(mb_msg);
 }
 
-static int
-mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+/*
+ * Find room for a package of pkg_size bytes in x2i ring buffer. A tombstone
+ * is written if the package does not fit before the end of the ring.
+ * Return the ring address to write the package and its offset in @tail.
+ */
+static void __iomem *
+mailbox_ring_reserve(struct mailbox_channel *mb_chann, u32 pkg_size, u32 *tail_out)
 {
 	void __iomem *write_addr;
 	u32 ringbuf_size;
@@ -289,15 +451,19 @@ mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 	tail = mb_chann->x2i_tail;
 	ringbuf_size = mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I);
 	start_addr = mb_chann->res[CHAN_RES_X2I].rb_start_addr;
-	tmp_tail = tail + mb_msg->pkg_size;
+	tmp_tail = tail + pkg_size;
 
 	if (tail < head && tmp_tail >= head)
 		goto no_space;
 
 	if (tail >= head && (tmp_tail > ringbuf_size - sizeof(u32) &&
-			     mb_msg->pkg_size >= head))
+			     pkg_size >= head))
 		goto no_space;
 
+	/*
+	 * Write below is beyond the tail firmware knows. Only the tail
+	 * register update needs to be ordered with response handling.
+	 */
 	if (tail >= head && tmp_tail > ringbuf_size - sizeof(u32)) {
 		write_addr = mb_chann->mb->res.ringbuf_base + start_addr + tail;
 		writel(TOMBSTONE, write_addr);
@@ -306,18 +472,48 @@ mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
 		tail = 0;
 	}
 
-	write_addr = mb_chann->mb->res.ringbuf_base + start_addr + tail;
-	memcpy_toio(write_addr, &mb_msg->pkg, mb_msg->pkg_size);
-	mailbox_set_tailptr(mb_chann, tail + mb_msg->pkg_size);
+	*tail_out = tail;
+	return mb_chann->mb->res.ringbuf_base + start_addr + tail;
+
+no_space:
+	/* Let firmware drain what is already in ring buffer */
+	spin_lock(&mb_chann->x2i_lock);
+	mailbox_publish_tail(mb_chann);
+	spin_unlock(&mb_chann->x2i_lock);
+	return NULL;
+}
+
+/* Make a package written by mailbox_ring_reserve() caller visible */
+static void mailbox_ring_commit(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg,
+				u32 tail)
+{
+	spin_lock(&mb_chann->x2i_lock);
+	mb_chann->x2i_tail = tail + mb_msg->pkg_size;
+	mb_chann->x2i_deferred++;
+	/* Management messages are synchronous, nothing to batch with */
+	if (mb_chann->type == MB_CHANNEL_MGMT ||
+	    mb_chann->x2i_published < MB_TAIL_DEFER_DEPTH)
+		mailbox_publish_tail(mb_chann);
+	spin_unlock(&mb_chann->x2i_lock);
 
 	trace_mbox_set_tail(MAILBOX_NAME, mb_chann->msix_irq,
 			    mb_msg->pkg.header.opcode,
 			    mb_msg->pkg.header.id);
+}
 
-	return 0;
+static int
+mailbox_send_msg(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+{
+	void __iomem *write_addr;
+	u32 tail;
 
-no_space:
-	return -ENOSPC;
+	write_addr = mailbox_ring_reserve(mb_chann, mb_msg->pkg_size, &tail);
+	if (!write_addr)
+		return -ENOSPC;
+
+	memcpy_toio(write_addr, &mb_msg->pkg, mb_msg->pkg_size);
+	mailbox_ring_commit(mb_chann, mb_msg, tail);
+	return 0;
 }
 
 static int
@@ -334,11 +530,14 @@ mailbox_get_resp(struct mailbox_channel *mb_chann, struct xdna_msg_header *heade
 	mb_chann->last_msg_id = msg_id;
 
 	msg_id = MSG_ID2ENTRY(msg_id);
-	mb_msg = xa_erase_irq(&mb_chann->chan_xa, msg_id);
+	mb_msg = xchg(&mb_chann->msg_slots[msg_id], NULL);
 	if (!mb_msg) {
 		MB_ERR(mb_chann, "Cannot find msg 0x%x", msg_id);
 		return -EINVAL;
 	}
+	WRITE_ONCE(mb_chann->msg_done, mb_chann->msg_done + 1);
+	mailbox_lat_record(mb_chann, mb_msg);
+	mailbox_tx_complete(mb_chann);
 
 	MB_DBG(mb_chann, "opcode 0x%x size %d id 0x%x",
 	       header->opcode, header->total_size, header->id);
@@ -432,20 +631,85 @@ static int mailbox_get_msg(struct mailbox_channel *mb_chann)
 	return ret;
 }
 
-static void mailbox_rx_worker(struct work_struct *rx_work)
+static void mailbox_polld_wakeup(struct mailbox_polld *polld);
+
+static void mailbox_rx_kick(struct mailbox_channel *mb_chann)
 {
-	struct mailbox_channel *mb_chann;
+	if (mb_chann->rx_thread)
+		irq_wake_thread(mb_chann->msix_irq, mb_chann);
+	else
+		queue_work(mb_chann->work_q, &mb_chann->rx_work);
+}
+
+static bool mailbox_can_adapt(struct mailbox_channel *mb_chann)
+{
+#ifdef AMDXDNA_DEVEL
+	if (MB_PERIODIC_POLL)
+		return false;
+#endif
+	return mb_chann->type == MB_CHANNEL_USER_NORMAL && mb_chann->poll_rate;
+}
+
+/* Caller holds polld->lock */
+static void mailbox_enter_polling(struct mailbox_channel *mb_chann)
+{
+	disable_irq_nosync(mb_chann->msix_irq);
+	WRITE_ONCE(mb_chann->polling, true);
+	mb_chann->mode_switch_cnt++;
+	mb_chann->last_resp_ts = ktime_get();
+	list_add_tail(&mb_chann->poll_entry, &mb_chann->polld->chann_list);
+}
+
+/* Caller holds polld->lock */
+static void mailbox_exit_polling(struct mailbox_channel *mb_chann)
+{
+	WRITE_ONCE(mb_chann->polling, false);
+	mb_chann->mode_switch_cnt++;
+	mb_chann->rate_resp = 0;
+	list_del_init(&mb_chann->poll_entry);
+	enable_irq(mb_chann->msix_irq);
+	/* Response arrived after last poll might not raise interrupt */
+	mailbox_rx_kick(mb_chann);
+}
+
+static void mailbox_rx_rate_update(struct mailbox_channel *mb_chann, u32 resp)
+{
+	ktime_t now = ktime_get();
+
+	if (!mailbox_can_adapt(mb_chann))
+		return;
+
+	if (ktime_to_ns(ktime_sub(now, mb_chann->rate_ts)) > MB_POLL_RATE_WINDOW_NS) {
+		mb_chann->rate_ts = now;
+		mb_chann->rate_resp = 0;
+	}
+	mb_chann->rate_resp += resp;
+	if (mb_chann->rate_resp < mb_chann->poll_rate || mailbox_channel_no_msg(mb_chann))
+		return;
+
+	spin_lock(&mb_chann->polld->lock);
+	/* Stopping channel clears poll_rate */
+	if (mb_chann->poll_rate && !mb_chann->polling)
+		mailbox_enter_polling(mb_chann);
+	spin_unlock(&mb_chann->polld->lock);
+	mailbox_polld_wakeup(mb_chann->polld);
+}
+
+static void mailbox_rx(struct mailbox_channel *mb_chann)
+{
+	u32 resp = 0;
 	u32 iohub;
 	int ret;
 
-	mb_chann = container_of(rx_work, struct mailbox_channel, rx_work);
-	trace_mbox_rx_worker(MAILBOX_NAME, mb_chann->msix_irq);
-
 	if (READ_ONCE(mb_chann->bad_state)) {
 		MB_ERR(mb_chann, "Channel in bad state, work aborted");
 		return;
 	}
 
+	/* polld owns the ring buffer now */
+	if (READ_ONCE(mb_chann->polling))
+		return;
+
 again:
 	mailbox_reg_write(mb_chann, mb_chann->iohub_int_addr, 0);
 
@@ -457,12 +721,15 @@ again:
 		ret = mailbox_get_msg(mb_chann);
 		if (ret == -ENOENT)
 			break;
+		if (!ret)
+			resp++;
 
 		/* Other error means device doesn't look good, disable irq. */
 		if (unlikely(ret)) {
 			MB_ERR(mb_chann, "Unexpected ret %d, disable irq", ret);
 			WRITE_ONCE(mb_chann->bad_state, true);
-			disable_irq(mb_chann->msix_irq);
+			/* Can be in irq thread, waiting for itself deadlocks */
+			disable_irq_nosync(mb_chann->msix_irq);
 			return;
 		}
 	}
@@ -476,6 +743,32 @@ again:
 	iohub = mailbox_reg_read(mb_chann, mb_chann->iohub_int_addr);
 	if (iohub)
 		goto again;
+
+	mb_chann->irq_resp_cnt += resp;
+	mailbox_rx_rate_update(mb_chann, resp);
+}
+
+static void mailbox_rx_worker(struct work_struct *rx_work)
+{
+	struct mailbox_channel *mb_chann;
+
+	mb_chann = container_of(rx_work, struct mailbox_channel, rx_work);
+	trace_mbox_rx_worker(MAILBOX_NAME, mb_chann->msix_irq);
+	mailbox_rx(mb_chann);
+}
+
+/*
+ * Response callbacks signal fence and may free the job, which can sleep.
+ * So they can not run in hard irq, but the irq thread saves the hop to a
+ * workqueue worker.
+ */
+static irqreturn_t mailbox_irq_thread(int irq, void *p)
+{
+	struct mailbox_channel *mb_chann = p;
+
+	trace_mbox_rx_worker(MAILBOX_NAME, irq);
+	mailbox_rx(mb_chann);
+	return IRQ_HANDLED;
 }
 
 static irqreturn_t mailbox_irq_handler(int irq, void *p)
@@ -486,6 +779,9 @@ static irqreturn_t mailbox_irq_handler(int irq, void *p)
 	if (mb_chann->type == MB_CHANNEL_USER_POLL)
 		return IRQ_HANDLED;
 
+	if (mb_chann->rx_thread)
+		return IRQ_WAKE_THREAD;
+
 	/* Schedule a rx_work to call the callback functions */
 	queue_work(mb_chann->work_q, &mb_chann->rx_work);
 
@@ -507,17 +803,22 @@ static void mailbox_timer(struct timer_list *t)
 }
 #endif
 
-static void mailbox_polld_handle_chann(struct mailbox_channel *mb_chann)
+static u32 mailbox_polld_handle_chann(struct mailbox_channel *mb_chann, u32 budget)
 {
+	u32 resp = 0;
 	u32 iohub;
 	int ret;
 
 	if (mb_chann->bad_state)
-		return;
+		return 0;
+
+	/* Events were cleared on last visit, which ran out of budget */
+	if (mb_chann->poll_pending)
+		goto consume;
 
 	iohub = mailbox_reg_read(mb_chann, mb_chann->iohub_int_addr);
 	if (!iohub)
-		return;
+		return 0;
 
 	trace_mbox_poll_handle(MAILBOX_NAME, mb_chann->msix_irq);
 
@@ -525,87 +826,117 @@ static void mailbox_polld_handle_chann(struct mailbox_channel *mb_chann)
 	iohub = 0;
 	mailbox_reg_write(mb_chann, mb_chann->iohub_int_addr, iohub);
 
+consume:
 	/*
 	 * Consider the race with FW, host needs to handle all messages sent
 	 * before clear iohub register. But host is not able to exactly
 	 * know which message was sent before clear iohub.
 	 *
-	 * Based on the fact that mb->polld is running much faster than FW,
-	 * to simplify the design, just use below loop to consume all messages,
-	 * It should exit in a reasonable time.
-	 * Other channels should not be starved.
+	 * Based on the fact that polld is running much faster than FW,
+	 * to simplify the design, just use below loop to consume messages.
+	 * Stop at the budget, so other channels should not be starved. The
+	 * rest is consumed on next visit without checking iohub again.
 	 */
 	do {
 		ret = mailbox_get_msg(mb_chann);
-	} while (!ret);
+		if (!ret)
+			resp++;
+	} while (!ret && resp < budget);
+
+	mb_chann->poll_pending = !ret;
 
+	mb_chann->poll_resp_cnt += resp;
 	if (ret == -ENOENT)
-		return;
+		return resp;
 
 	if (unlikely(ret)) {
 		MB_ERR(mb_chann, "Unexpected error on channel %d ret %d",
 		       mb_chann->msix_irq, ret);
 		WRITE_ONCE(mb_chann->bad_state, true);
 	}
+	return resp;
 }
 
-static void mailbox_polld_wakeup(struct mailbox *mb)
+/* Caller holds polld->lock */
+static void mailbox_polld_check_idle(struct mailbox_channel *mb_chann, u32 resp)
 {
-	wake_up(&mb->poll_wait);
+	ktime_t now;
+
+	if (!READ_ONCE(mb_chann->polling))
+		return;
+
+	now = ktime_get();
+	if (resp) {
+		mb_chann->last_resp_ts = now;
+		return;
+	}
+
+	if (mailbox_channel_no_msg(mb_chann) ||
+	    ktime_to_ns(ktime_sub(now, mb_chann->last_resp_ts)) > mb_chann->poll_idle_ns)
+		mailbox_exit_polling(mb_chann);
 }
 
-static bool mailbox_polld_event(struct mailbox *mb)
+static void mailbox_polld_wakeup(struct mailbox_polld *polld)
 {
-	struct mailbox_channel *mb_chann;
+	wake_up(&polld->poll_wait);
+}
 
-	spin_lock(&mb->mbox_lock);
-	list_for_each_entry(mb_chann, &mb->poll_chann_list, chann_entry) {
-		if (mb_chann->type == MB_CHANNEL_MGMT)
-			break;
+static bool mailbox_polld_event(struct mailbox_polld *polld)
+{
+	struct mailbox_channel *mb_chann;
 
+	spin_lock(&polld->lock);
+	list_for_each_entry(mb_chann, &polld->chann_list, poll_entry) {
 		if (mailbox_channel_no_msg(mb_chann))
 			continue;
 
-		mb->sent_msg = true;
+		polld->sent_msg = true;
 		break;
 	}
-	spin_unlock(&mb->mbox_lock);
+	spin_unlock(&polld->lock);
 
-	return mb->sent_msg;
+	return polld->sent_msg;
 }
 
 static int mailbox_polld(void *data)
 {
-	struct mailbox *mb = (struct mailbox *)data;
-	struct mailbox_channel *mb_chann;
+	struct mailbox_polld *polld = data;
+	struct mailbox_channel *mb_chann, *next;
+	struct mailbox *mb = polld->mb;
 	int loop_cnt = 0;
+	u32 budget;
+	u32 resp;
 
 	dev_dbg(mb->dev, "polld start");
 	while (!kthread_should_stop()) {
 		bool chann_all_empty;
 
-		wait_event_interruptible(mb->poll_wait, mailbox_polld_event(mb) ||
+		wait_event_interruptible(polld->poll_wait, mailbox_polld_event(polld) ||
 					 kthread_should_stop());
 
-		if (!mb->sent_msg)
+		if (!polld->sent_msg)
 			continue;
 
-		spin_lock(&mb->mbox_lock);
+		budget = max(READ_ONCE(mailbox_poll_budget), 1U);
+		spin_lock(&polld->lock);
 		chann_all_empty = true;
-		list_for_each_entry(mb_chann, &mb->poll_chann_list, chann_entry) {
-			if (mb_chann->type == MB_CHANNEL_MGMT)
-				break;
-
-			if (mailbox_channel_no_msg(mb_chann))
+		list_for_each_entry_safe(mb_chann, next, &polld->chann_list, poll_entry) {
+			if (mailbox_channel_no_msg(mb_chann)) {
+				mailbox_polld_check_idle(mb_chann, 0);
 				continue;
+			}
 
 			chann_all_empty = false;
-			mailbox_polld_handle_chann(mb_chann);
+			resp = mailbox_polld_handle_chann(mb_chann, budget);
+			mailbox_polld_check_idle(mb_chann, resp);
 		}
-		spin_unlock(&mb->mbox_lock);
+		/* Round robin, next pass starts from the next channel */
+		if (!list_empty(&polld->chann_list))
+			list_rotate_left(&polld->chann_list);
+		spin_unlock(&polld->lock);
 
 		if (chann_all_empty)
-			mb->sent_msg = false;
+			polld->sent_msg = false;
 
 		loop_cnt++;
 		if (loop_cnt == 10) {
@@ -618,8 +949,12 @@ static int mailbox_polld(void *data)
 	return 0;
 }
 
-int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
-			  struct xdna_mailbox_msg *msg, u64 tx_timeout)
+/*
+ * Allocate a message and its ID. The payload is copied into the message only
+ * if @copy is set, otherwise the caller writes it into the ring buffer.
+ */
+static struct mailbox_msg *
+mailbox_msg_create(struct mailbox_channel *mb_chann, struct xdna_mailbox_msg *msg, bool copy)
 {
 	struct xdna_msg_header *header;
 	struct mailbox_msg *mb_msg;
@@ -629,32 +964,35 @@ int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
 	pkg_size = sizeof(*header) + msg->send_size;
 	if (pkg_size > mailbox_get_ringbuf_size(mb_chann, CHAN_RES_X2I)) {
 		MB_ERR(mb_chann, "Message size larger than ringbuf size");
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	if (unlikely(!IS_ALIGNED(msg->send_size, 4))) {
 		MB_ERR(mb_chann, "Message must be 4 bytes align");
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	/* The fist word in payload can NOT be TOMBSTONE */
-	if (unlikely(((u32 *)msg->send_data)[0] == TOMBSTONE)) {
+	if (copy && unlikely(((u32 *)msg->send_data)[0] == TOMBSTONE)) {
 		MB_ERR(mb_chann, "Tomb stone in data");
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	if (READ_ONCE(mb_chann->bad_state)) {
 		MB_ERR(mb_chann, "Channel in bad state");
-		return -EPIPE;
+		return ERR_PTR(-EPIPE);
 	}
 
-	mb_msg = kzalloc(sizeof(*mb_msg) + pkg_size, GFP_KERNEL);
+	mb_msg = kzalloc(sizeof(*mb_msg) + (copy ? msg->send_size : 0), GFP_KERNEL);
 	if (!mb_msg)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 
 	mb_msg->handle = msg->handle;
 	mb_msg->notify_cb = msg->notify_cb;
 	mb_msg->pkg_size = pkg_size;
+#if defined(CONFIG_DEBUG_FS)
+	mb_msg->send_ts = ktime_get();
+#endif
 
 	header = &mb_msg->pkg.header;
 	/*
@@ -665,34 +1003,122 @@ int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
 	header->sz_ver = FIELD_PREP(MSG_BODY_SZ, msg->send_size) |
 			FIELD_PREP(MSG_PROTO_VER, MSG_PROTOCOL_VERSION);
 	header->opcode = msg->opcode;
-	memcpy(mb_msg->pkg.payload, msg->send_data, msg->send_size);
+	if (copy)
+		memcpy(mb_msg->pkg.payload, msg->send_data, msg->send_size);
 
 	ret = mailbox_acquire_msgid(mb_chann, mb_msg);
 	if (unlikely(ret < 0)) {
 		MB_ERR(mb_chann, "mailbox_acquire_msgid failed");
-		goto msg_id_failed;
+		kfree(mb_msg);
+		return ERR_PTR(ret);
 	}
 	header->id = ret;
 	msg->id = header->id;
 
 	MB_DBG(mb_chann, "opcode 0x%x size %d id 0x%x",
 	       header->opcode, header->total_size, header->id);
+	return mb_msg;
+}
+
+static void mailbox_msg_destroy(struct mailbox_channel *mb_chann, struct mailbox_msg *mb_msg)
+{
+	mailbox_release_msgid(mb_chann, mb_msg->pkg.header.id);
+	kfree(mb_msg);
+}
+
+static void mailbox_msg_sent(struct mailbox_channel *mb_chann)
+{
+	if (mb_chann->type == MB_CHANNEL_USER_POLL || READ_ONCE(mb_chann->polling))
+		mailbox_polld_wakeup(mb_chann->polld);
+}
+
+int xdna_mailbox_send_msg(struct mailbox_channel *mb_chann,
+			  struct xdna_mailbox_msg *msg, u64 tx_timeout)
+{
+	struct mailbox_msg *mb_msg;
+	int ret;
+
+	mb_msg = mailbox_msg_create(mb_chann, msg, true);
+	if (IS_ERR(mb_msg))
+		return PTR_ERR(mb_msg);
 
 	ret = mailbox_send_msg(mb_chann, mb_msg);
 	if (ret) {
 		MB_DBG(mb_chann, "Error in mailbox send msg, ret %d", ret);
-		goto release_id;
+		mailbox_msg_destroy(mb_chann, mb_msg);
+		return ret;
 	}
 
-	if (mb_chann->type == MB_CHANNEL_USER_POLL)
-		mailbox_polld_wakeup(mb_chann->mb);
+	mailbox_msg_sent(mb_chann);
 	return 0;
+}
 
-release_id:
-	mailbox_release_msgid(mb_chann, header->id);
-msg_id_failed:
-	kfree(mb_msg);
-	return ret;
+void __iomem *xdna_mailbox_reserve_msg(struct mailbox_channel *mb_chann,
+				       struct xdna_mailbox_msg *msg)
+{
+	struct mailbox_msg *mb_msg;
+	void __iomem *write_addr;
+	u32 tail;
+
+	if (WARN_ON(mb_chann->resv_msg))
+		return IOMEM_ERR_PTR(-EBUSY);
+
+	mb_msg = mailbox_msg_create(mb_chann, msg, false);
+	if (IS_ERR(mb_msg))
+		return IOMEM_ERR_PTR(PTR_ERR(mb_msg));
+
+	write_addr = mailbox_ring_reserve(mb_chann, mb_msg->pkg_size, &tail);
+	if (!write_addr) {
+		MB_DBG(mb_chann, "No space to reserve msg 0x%x", msg->id);
+		mailbox_msg_destroy(mb_chann, mb_msg);
+		return IOMEM_ERR_PTR(-ENOSPC);
+	}
+
+	memcpy_toio(write_addr, &mb_msg->pkg.header, sizeof(mb_msg->pkg.header));
+	mb_chann->resv_msg = mb_msg;
+	mb_chann->resv_tail = tail;
+	return write_addr + sizeof(mb_msg->pkg.header);
+}
+
+void xdna_mailbox_commit_msg(struct mailbox_channel *mb_chann, struct xdna_mailbox_msg *msg)
+{
+	struct mailbox_msg *mb_msg = mb_chann->resv_msg;
+
+	if (WARN_ON(!mb_msg || mb_msg->pkg.header.id != msg->id))
+		return;
+
+	mb_chann->resv_msg = NULL;
+	mailbox_ring_commit(mb_chann, mb_msg, mb_chann->resv_tail);
+	mailbox_msg_sent(mb_chann);
+}
+
+void xdna_mailbox_cancel_msg(struct mailbox_channel *mb_chann, struct xdna_mailbox_msg *msg)
+{
+	struct mailbox_msg *mb_msg = mb_chann->resv_msg;
+
+	if (WARN_ON(!mb_msg || mb_msg->pkg.header.id != msg->id))
+		return;
+
+	/* Nothing is visible to firmware before commit */
+	mb_chann->resv_msg = NULL;
+	mailbox_msg_destroy(mb_chann, mb_msg);
+}
+
+int xdna_mailbox_set_poll_rate(struct mailbox_channel *mb_chann, u32 rate)
+{
+	u32 old;
+
+	if (mb_chann->type != MB_CHANNEL_USER_NORMAL || !mb_chann->polld)
+		return -EOPNOTSUPP;
+
+	spin_lock(&mb_chann->polld->lock);
+	old = mb_chann->poll_rate;
+	mb_chann->poll_rate = rate;
+	if (!rate && mb_chann->polling)
+		mailbox_exit_polling(mb_chann);
+	spin_unlock(&mb_chann->polld->lock);
+
+	return old;
 }
 
 #if defined(CONFIG_DEBUG_FS)
@@ -741,6 +1167,7 @@ int xdna_mailbox_info_show(struct mailbox *mb, struct seq_file *m)
 	static const char ring_fmt[] = "%4d  %3s  %5d  %4d  0x%08x  0x%04x  ";
 	static const char mbox_fmt[] = "0x%08x  0x%08x  0x%04x    0x%04x\n";
 	struct mailbox_res_record *record;
+	struct mailbox_channel *mb_chann;
 
 	/* If below two puts changed, make sure update fmt[] as well */
 	seq_puts(m, "mbox  dir  alive  type  ring addr   size    ");
@@ -764,11 +1191,26 @@ int xdna_mailbox_info_show(struct mailbox *mb, struct seq_file *m)
 	seq_printf(m, mbox_fmt, head_ptr, tail_ptr, head_val, tail_val); \
 }
 
+#define xdna_mbox_dump_poll(_chann) \
+	seq_printf(m, "%4d  %5d  %4s  %8llu  %9llu  %8llu  %4u  %7llu\n", \
+		   (_chann)->msix_irq, \
+		   (_chann)->polld ? (int)((_chann)->polld - mb->polld) : -1, \
+		   (_chann)->type == MB_CHANNEL_MGMT ? "mgmt" : \
+		   ((_chann)->type == MB_CHANNEL_USER_POLL || (_chann)->polling) ? \
+		   "poll" : "irq", \
+		   (_chann)->irq_resp_cnt, (_chann)->poll_resp_cnt, \
+		   (_chann)->mode_switch_cnt, (_chann)->poll_rate, \
+		   (_chann)->poll_idle_ns / NSEC_PER_USEC)
+
 	spin_lock(&mb->mbox_lock);
 	list_for_each_entry(record, &mb->res_records, re_entry) {
 		xdna_mbox_dump_queue(x2i, record->active);
 		xdna_mbox_dump_queue(i2x, record->active);
 	}
+
+	seq_puts(m, "\nmbox  polld  mode  irq resp  poll resp  switches  rate  idle us\n");
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry)
+		xdna_mbox_dump_poll(mb_chann);
 	spin_unlock(&mb->mbox_lock);
 
 	return 0;
@@ -803,8 +1245,58 @@ int xdna_mailbox_ringbuf_show(struct mailbox *mb, struct seq_file *m)
 	vfree(buf);
 	return 0;
 }
+
+int xdna_mailbox_latency_show(struct mailbox *mb, struct seq_file *m)
+{
+	struct mailbox_channel *mb_chann;
+	struct mailbox_lat_hist *hist;
+	int i, j;
+
+	seq_puts(m, "mbox  opcode  count     avg us    buckets <1us <2us <4us ...\n");
+	spin_lock(&mb->mbox_lock);
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry) {
+		for (i = 0; i < MB_LAT_OPCODES; i++) {
+			hist = &mb_chann->lat[i];
+			if (!hist->cnt)
+				break;
+
+			seq_printf(m, "%4d  0x%04x  %-8llu  %-8llu ", mb_chann->msix_irq,
+				   hist->opcode, hist->cnt, div64_u64(hist->total_us, hist->cnt));
+			for (j = 0; j < MB_LAT_BUCKETS; j++)
+				seq_printf(m, " %llu", hist->bucket[j]);
+			seq_puts(m, "\n");
+		}
+	}
+	spin_unlock(&mb->mbox_lock);
+
+	return 0;
+}
+
+void xdna_mailbox_latency_reset(struct mailbox *mb)
+{
+	struct mailbox_channel *mb_chann;
+
+	spin_lock(&mb->mbox_lock);
+	list_for_each_entry(mb_chann, &mb->chann_list, chann_entry)
+		memset(mb_chann->lat, 0, sizeof(mb_chann->lat));
+	spin_unlock(&mb->mbox_lock);
+}
 #endif /* CONFIG_DEBUG_FS */
 
+/* Caller holds mb->mbox_lock. Least loaded polld gets the new channel. */
+static struct mailbox_polld *mailbox_polld_assign(struct mailbox *mb)
+{
+	struct mailbox_polld *polld = &mb->polld[0];
+	u32 i;
+
+	for (i = 1; i < mb->nr_polld; i++) {
+		if (mb->polld[i].nr_chann < polld->nr_chann)
+			polld = &mb->polld[i];
+	}
+	polld->nr_chann++;
+	return polld;
+}
+
 struct mailbox_channel *
 xdna_mailbox_create_channel(struct mailbox *mb,
 			    struct xdna_mailbox_chann_info *info,
@@ -852,13 +1344,24 @@ xdna_mailbox_create_channel(struct mailbox *mb,
 	memcpy(&mb_chann->res[CHAN_RES_X2I], x2i, sizeof(*x2i));
 	memcpy(&mb_chann->res[CHAN_RES_I2X], i2x, sizeof(*i2x));
 
-	xa_init_flags(&mb_chann->chan_xa, XA_FLAGS_ALLOC | XA_FLAGS_LOCK_IRQ);
+	spin_lock_init(&mb_chann->x2i_lock);
+	INIT_LIST_HEAD(&mb_chann->poll_entry);
+	mb_chann->poll_rate = mailbox_poll_rate;
+	mb_chann->poll_idle_ns = (u64)mailbox_poll_idle_us * NSEC_PER_USEC;
 	mb_chann->x2i_tail = mailbox_get_tailptr(mb_chann, CHAN_RES_X2I);
 	mb_chann->i2x_head = mailbox_get_headptr(mb_chann, CHAN_RES_I2X);
 	mailbox_reg_write(mb_chann, mb_chann->iohub_int_addr, 0);
 
+	/*
+	 * Two priority classes. Context responses complete jobs and are
+	 * latency critical, they run in RT irq thread or highpri workqueue.
+	 * Management responses (status, telemetry, sensors) run in a normal
+	 * workqueue, so a monitoring query never holds a CPU the completion
+	 * of an inference is waiting for.
+	 */
 	INIT_WORK(&mb_chann->rx_work, mailbox_rx_worker);
-	mb_chann->work_q = alloc_ordered_workqueue(MAILBOX_NAME, 0);
+	mb_chann->work_q = alloc_ordered_workqueue(MAILBOX_NAME,
+						   type == MB_CHANNEL_MGMT ? 0 : WQ_HIGHPRI);
 	if (!mb_chann->work_q) {
 		MB_ERR(mb_chann, "Create workqueue failed");
 		goto free_and_out;
@@ -876,7 +1379,10 @@ xdna_mailbox_create_channel(struct mailbox *mb,
 	}
 #endif
 	/* Everything look good. Time to enable irq handler */
-	ret = request_irq(mb_irq, mailbox_irq_handler, 0, MAILBOX_NAME, mb_chann);
+	mb_chann->rx_thread = mailbox_rx_thread && type != MB_CHANNEL_MGMT;
+	ret = request_threaded_irq(mb_irq, mailbox_irq_handler,
+				   mb_chann->rx_thread ? mailbox_irq_thread : NULL,
+				   0, MAILBOX_NAME, mb_chann);
 	if (ret) {
 		MB_ERR(mb_chann, "Failed to request irq %d ret %d", mb_irq, ret);
 		goto destroy_wq;
@@ -887,16 +1393,21 @@ skip_irq:
 #endif
 	mb_chann->bad_state = false;
 	spin_lock(&mb->mbox_lock);
-	if (mb_chann->type == MB_CHANNEL_USER_POLL)
-		list_add_tail(&mb_chann->chann_entry, &mb->poll_chann_list);
-	else
-		list_add_tail(&mb_chann->chann_entry, &mb->chann_list);
+	list_add_tail(&mb_chann->chann_entry, &mb->chann_list);
+	if (mb_chann->type != MB_CHANNEL_MGMT)
+		mb_chann->polld = mailbox_polld_assign(mb);
 #if defined(CONFIG_DEBUG_FS)
 	mb_chann->record = record;
 	record->active = 1;
 #endif
 	spin_unlock(&mb->mbox_lock);
 
+	if (mb_chann->type == MB_CHANNEL_USER_POLL) {
+		spin_lock(&mb_chann->polld->lock);
+		list_add_tail(&mb_chann->poll_entry, &mb_chann->polld->chann_list);
+		spin_unlock(&mb_chann->polld->lock);
+	}
+
 	MB_DBG(mb_chann, "Mailbox channel created type %d (irq: %d)",
 	       mb_chann->type, mb_chann->msix_irq);
 	return mb_chann;
@@ -916,8 +1427,16 @@ void xdna_mailbox_release_channel(struct mailbox_channel *mb_chann)
 	if (!mb_chann)
 		return;
 
+	if (mb_chann->polld) {
+		spin_lock(&mb_chann->polld->lock);
+		list_del_init(&mb_chann->poll_entry);
+		spin_unlock(&mb_chann->polld->lock);
+	}
+
 	spin_lock(&mb_chann->mb->mbox_lock);
 	list_del(&mb_chann->chann_entry);
+	if (mb_chann->polld)
+		mb_chann->polld->nr_chann--;
 #if defined(CONFIG_DEBUG_FS)
 	mb_chann->record->active = 0;
 #endif
@@ -935,8 +1454,11 @@ destroy_wq:
 	destroy_workqueue(mb_chann->work_q);
 	/* We can clean up and release resources */
 
-	xa_for_each(&mb_chann->chan_xa, msg_id, mb_msg)
-		mailbox_release_msg(mb_chann, mb_msg);
+	for (msg_id = 0; msg_id < MAX_MSG_ID_ENTRIES; msg_id++) {
+		mb_msg = xchg(&mb_chann->msg_slots[msg_id], NULL);
+		if (mb_msg)
+			mailbox_release_msg(mb_chann, mb_msg);
+	}
 
 	MB_DBG(mb_chann, "Mailbox channel released type %d irq: %d",
 	       mb_chann->type, mb_chann->msix_irq);
@@ -947,15 +1469,29 @@ void xdna_mailbox_free_channel(struct mailbox_channel *mb_chann)
 	if (!mb_chann)
 		return;
 
-	xa_destroy(&mb_chann->chan_xa);
 	kfree(mb_chann);
 }
 
 void xdna_mailbox_stop_channel(struct mailbox_channel *mb_chann)
 {
+	bool polling;
+
 	if (!mb_chann)
 		return;
 
+	/* Off the poll list, so polld will not bring irq back */
+	polling = false;
+	if (mb_chann->polld) {
+		spin_lock(&mb_chann->polld->lock);
+		mb_chann->poll_rate = 0;
+		polling = mb_chann->polling;
+		if (polling) {
+			WRITE_ONCE(mb_chann->polling, false);
+			list_del_init(&mb_chann->poll_entry);
+		}
+		spin_unlock(&mb_chann->polld->lock);
+	}
+
 #ifdef AMDXDNA_DEVEL
 	if (MB_PERIODIC_POLL) {
 		timer_delete_sync(&mb_chann->timer);
@@ -963,7 +1499,10 @@ void xdna_mailbox_stop_channel(struct mailbox_channel *mb_chann)
 	}
 #endif
 	/* Disable an irq and wait. This might sleep. */
-	disable_irq(mb_chann->msix_irq);
+	if (polling)
+		synchronize_irq(mb_chann->msix_irq);
+	else
+		disable_irq(mb_chann->msix_irq);
 
 #ifdef AMDXDNA_DEVEL
 skip_irq:
@@ -979,6 +1518,79 @@ void xdna_mailbox_destroy_channel(struct mailbox_channel *mailbox_chann)
 	xdna_mailbox_free_channel(mailbox_chann);
 }
 
+static void mailbox_polld_destroy(struct mailbox *mb, u32 nr)
+{
+	u32 i;
+
+	for (i = 0; i < nr; i++)
+		(void)kthread_stop(mb->polld[i].task);
+	kfree(mb->polld);
+}
+
+/*
+ * One unbound polld per device by default. With mailbox_polld_cpus, one
+ * polld pinned on each listed online CPU, channels spread among them.
+ */
+static int mailbox_polld_create(struct mailbox *mb)
+{
+	struct mailbox_polld *polld;
+	struct task_struct *task;
+	cpumask_var_t cpus;
+	u32 i, nr = 0;
+	int cpu, ret;
+
+	if (!zalloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (mailbox_polld_cpus && cpulist_parse(mailbox_polld_cpus, cpus)) {
+		dev_warn(mb->dev, "Invalid polld CPU list %s", mailbox_polld_cpus);
+		cpumask_clear(cpus);
+	}
+	cpumask_and(cpus, cpus, cpu_online_mask);
+
+	mb->nr_polld = max(cpumask_weight(cpus), 1U);
+	mb->polld = kcalloc(mb->nr_polld, sizeof(*mb->polld), GFP_KERNEL);
+	if (!mb->polld) {
+		ret = -ENOMEM;
+		goto free_cpus;
+	}
+
+	for (i = 0; i < mb->nr_polld; i++) {
+		polld = &mb->polld[i];
+		polld->mb = mb;
+		spin_lock_init(&polld->lock);
+		INIT_LIST_HEAD(&polld->chann_list);
+		init_waitqueue_head(&polld->poll_wait);
+	}
+
+	for_each_cpu(cpu, cpus) {
+		task = kthread_create_on_cpu(mailbox_polld, &mb->polld[nr], cpu,
+					     MAILBOX_NAME "/%u");
+		if (IS_ERR(task))
+			goto stop_polld;
+		mb->polld[nr++].task = task;
+		wake_up_process(task);
+	}
+
+	if (!nr) {
+		task = kthread_run(mailbox_polld, &mb->polld[0], MAILBOX_NAME);
+		if (IS_ERR(task))
+			goto stop_polld;
+		mb->polld[nr++].task = task;
+	}
+
+	free_cpumask_var(cpus);
+	return 0;
+
+stop_polld:
+	ret = PTR_ERR(task);
+	dev_err(mb->dev, "Failed to create polld ret %d", ret);
+	mailbox_polld_destroy(mb, nr);
+free_cpus:
+	free_cpumask_var(cpus);
+	return ret;
+}
+
 struct mailbox *xdna_mailbox_create(struct device *dev,
 				    const struct xdna_mailbox_res *res)
 {
@@ -994,21 +1606,15 @@ struct mailbox *xdna_mailbox_create(struct device *dev,
 
 	spin_lock_init(&mb->mbox_lock);
 	INIT_LIST_HEAD(&mb->chann_list);
-	INIT_LIST_HEAD(&mb->poll_chann_list);
 
 	/*
-	 * The polld kthread will only wakeup and handle those
-	 * MB_CHANNEL_USER_POLL channels. If no thing to do, polld should
-	 * just sleep. It is a per device kthread.
+	 * The polld kthreads will only wakeup and handle polled channels.
+	 * If no thing to do, polld should just sleep.
 	 */
-	mb->polld = kthread_run(mailbox_polld, mb, MAILBOX_NAME);
-	if (IS_ERR(mb->polld)) {
-		dev_err(mb->dev, "Failed to create polld ret %ld", PTR_ERR(mb->polld));
+	if (mailbox_polld_create(mb)) {
 		kfree(mb);
 		return NULL;
 	}
-	init_waitqueue_head(&mb->poll_wait);
-	mb->sent_msg = false;
 
 #if defined(CONFIG_DEBUG_FS)
 	INIT_LIST_HEAD(&mb->res_records);
@@ -1033,7 +1639,7 @@ void xdna_mailbox_destroy(struct mailbox *mb)
 done_release_record:
 #endif /* CONFIG_DEBUG_FS */
 	dev_dbg(mb->dev, "Stopping polld");
-	(void)kthread_stop(mb->polld);
+	mailbox_polld_destroy(mb, mb->nr_polld);
 
 	spin_lock(&mb->mbox_lock);
 	WARN_ONCE(!list_empty(&mb->chann_list), "Channel not destroy");
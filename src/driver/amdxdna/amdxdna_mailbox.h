@@ -164,6 +164,44 @@ void xdna_mailbox_stop_channel(struct mailbox_channel *mailbox_chann);
 int xdna_mailbox_send_msg(struct mailbox_channel *mailbox_chann,
 			  struct xdna_mailbox_msg *msg, u64 tx_timeout);
 
+/*
+ * xdna_mailbox_reserve_msg() -- Reserve a message in ring buffer
+ *
+ * @mailbox_chann: Mailbox channel handle
+ * @msg: message struct for message information, send_data is not used
+ *
+ * The message header is written and msg->id is assigned. Caller writes
+ * msg->send_size bytes of payload at the returned address, the first word
+ * can NOT be the mailbox tombstone, then calls xdna_mailbox_commit_msg() or
+ * xdna_mailbox_cancel_msg(). Only one message can be reserved at a time.
+ *
+ * Return: payload address in ring buffer, otherwise, IOMEM_ERR_PTR()
+ */
+void __iomem *xdna_mailbox_reserve_msg(struct mailbox_channel *mailbox_chann,
+				       struct xdna_mailbox_msg *msg);
+
+/*
+ * xdna_mailbox_commit_msg() -- Send a reserved message to firmware
+ */
+void xdna_mailbox_commit_msg(struct mailbox_channel *mailbox_chann,
+			     struct xdna_mailbox_msg *msg);
+
+/*
+ * xdna_mailbox_cancel_msg() -- Drop a reserved message
+ */
+void xdna_mailbox_cancel_msg(struct mailbox_channel *mailbox_chann,
+			     struct xdna_mailbox_msg *msg);
+
+/*
+ * xdna_mailbox_set_poll_rate() -- Set when a channel adaptively switches to polling
+ *
+ * @mailbox_chann: Mailbox channel handle
+ * @rate: responses per 10ms to switch to polling, 0 to stay on interrupt
+ *
+ * Return: previous rate, or -EOPNOTSUPP if the channel does not adapt
+ */
+int xdna_mailbox_set_poll_rate(struct mailbox_channel *mailbox_chann, u32 rate);
+
 #if defined(CONFIG_DEBUG_FS)
 /*
  * xdna_mailbox_info_show() -- Show mailbox info for debug
@@ -186,6 +224,24 @@ int xdna_mailbox_info_show(struct mailbox *mailbox,
  */
 int xdna_mailbox_ringbuf_show(struct mailbox *mailbox,
 			      struct seq_file *m);
+
+/*
+ * xdna_mailbox_latency_show() -- Show message latency histograms for debug
+ *
+ * @mailbox: the handle return from xdna_mailbox_create()
+ * @m: the seq_file handle
+ *
+ * Return: if success, return 0; otherwise return error code
+ */
+int xdna_mailbox_latency_show(struct mailbox *mailbox,
+			      struct seq_file *m);
+
+/*
+ * xdna_mailbox_latency_reset() -- Clear message latency histograms
+ *
+ * @mailbox: the handle return from xdna_mailbox_create()
+ */
+void xdna_mailbox_latency_reset(struct mailbox *mailbox);
 #endif
 
 #endif /* _AIE2_MAILBOX_ */
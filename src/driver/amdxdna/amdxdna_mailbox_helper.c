@@ -48,3 +48,40 @@ int xdna_send_msg_wait(struct amdxdna_dev *xdna, struct mailbox_channel *chann,
 
 	return hdl->error;
 }
+
+/*
+ * Send all messages before waiting for any response, firmware handles them
+ * back to back instead of one per round trip. The messages share one
+ * RX_TIMEOUT. Return the first error in message order.
+ */
+int xdna_send_msg_wait_all(struct amdxdna_dev *xdna, struct mailbox_channel *chann,
+			   struct xdna_mailbox_msg **msgs, int cnt)
+{
+	unsigned long timeout = msecs_to_jiffies(RX_TIMEOUT);
+	int ret = 0;
+	int sent, i;
+
+	for (sent = 0; sent < cnt; sent++) {
+		ret = xdna_mailbox_send_msg(chann, msgs[sent], TX_TIMEOUT);
+		if (ret) {
+			XDNA_ERR(xdna, "Send message %d failed, ret %d", sent, ret);
+			break;
+		}
+	}
+
+	/* Handles are on caller stack, wait for everything already sent */
+	for (i = 0; i < sent; i++) {
+		struct xdna_notify *hdl = msgs[i]->handle;
+
+		timeout = wait_for_completion_timeout(&hdl->comp, timeout);
+		if (!timeout) {
+			XDNA_ERR(xdna, "Wait for completion timeout");
+			return -ETIME;
+		}
+
+		if (!ret)
+			ret = hdl->error;
+	}
+
+	return ret;
+}
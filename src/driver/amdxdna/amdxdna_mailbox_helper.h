@@ -37,10 +37,33 @@ struct xdna_notify {
 		.notify_cb = xdna_msg_cb,				\
 	}
 
+/*
+ * Named variant for functions that have more than one message in flight, see
+ * xdna_send_msg_wait_all(). Request body is left zero.
+ */
+#define DECLARE_XDNA_MSG_NAMED(name, op, status)			\
+	struct name##_req	name##_req = { 0 };			\
+	struct name##_resp	name##_resp = { status };		\
+	struct xdna_notify	name##_hdl = {				\
+		.error = 0,						\
+		.data = (u32 *)&name##_resp,				\
+		.size = sizeof(name##_resp),				\
+		.comp = COMPLETION_INITIALIZER_ONSTACK(name##_hdl.comp), \
+	};								\
+	struct xdna_mailbox_msg name##_msg = {				\
+		.send_data = (u8 *)&name##_req,				\
+		.send_size = sizeof(name##_req),			\
+		.handle = &name##_hdl,					\
+		.opcode = op,						\
+		.notify_cb = xdna_msg_cb,				\
+	}
+
 #define XDNA_STATUS_OFFSET(name) (offsetof(struct name##_resp, status) / sizeof(u32))
 
 int xdna_msg_cb(void *handle, void __iomem *data, size_t size);
 int xdna_send_msg_wait(struct amdxdna_dev *xdna, struct mailbox_channel *chann,
 		       struct xdna_mailbox_msg *msg);
+int xdna_send_msg_wait_all(struct amdxdna_dev *xdna, struct mailbox_channel *chann,
+			   struct xdna_mailbox_msg **msgs, int cnt);
 
 #endif /* _AMDXDNA_MAILBOX_HELPER_H */
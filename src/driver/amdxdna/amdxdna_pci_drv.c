@@ -82,9 +82,12 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 #if KERNEL_VERSION(6, 10, 0) > LINUX_VERSION_CODE
 	drmm_mutex_init(&xdna->ddev, &xdna->dev_lock);
+	drmm_mutex_init(&xdna->ddev, &xdna->import_lock);
 #else
 	devm_mutex_init(dev, &xdna->dev_lock);
+	devm_mutex_init(dev, &xdna->import_lock);
 #endif
+	hash_init(xdna->import_ht);
 	init_rwsem(&xdna->notifier_lock);
 	INIT_LIST_HEAD(&xdna->client_list);
 	pci_set_drvdata(pdev, xdna);
@@ -102,6 +105,14 @@ static int amdxdna_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	if (!xdna->notifier_wq)
 		return -ENOMEM;
 
+	amdxdna_gem_huge_mnt_init(xdna);
+
+	ret = amdxdna_gem_shrinker_init(xdna);
+	if (ret) {
+		XDNA_ERR(xdna, "Pin shrinker init failed, ret %d", ret);
+		goto destroy_notifier_wq;
+	}
+
 	ret = xdna->dev_info->ops->init(xdna);
 	if (ret) {
 		XDNA_ERR(xdna, "Hardware init failed, ret %d", ret);
@@ -248,14 +259,26 @@ static struct pci_driver amdxdna_pci_driver = {
 
 static int __init amdxdna_mod_init(void)
 {
+	int ret;
+
+	ret = amdxdna_job_cache_init();
+	if (ret)
+		return ret;
+
 	amdxdna_carvedout_init();
-	return pci_register_driver(&amdxdna_pci_driver);
+	ret = pci_register_driver(&amdxdna_pci_driver);
+	if (ret) {
+		amdxdna_carvedout_fini();
+		amdxdna_job_cache_fini();
+	}
+	return ret;
 }
 
 static void __exit amdxdna_mod_exit(void)
 {
 	pci_unregister_driver(&amdxdna_pci_driver);
 	amdxdna_carvedout_fini();
+	amdxdna_job_cache_fini();
 }
 
 module_init(amdxdna_mod_init);
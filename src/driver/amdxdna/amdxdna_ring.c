@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ */
+
+#include <linux/iosys-map.h>
+#include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/sched/mm.h>
+#include <linux/slab.h>
+#include "drm_local/amdxdna_accel.h"
+
+#include "amdxdna_drm.h"
+#include "amdxdna_ctx.h"
+
+/*
+ * A submission ring lets user space queue commands without EXEC_CMD and
+ * reap them without WAIT_CMD. SQEs are consumed in the context of the ring
+ * owner's mm, either by the KICK ioctl or by a work item which every
+ * completion of a ring command queues. So as long as commands are running,
+ * new SQEs are picked up without a syscall.
+ */
+#define SUBMIT_RING_MAX_ENTRIES		4096
+
+struct ring_inflight {
+	struct amdxdna_submit_ring	*ring;
+	struct dma_fence		*fence;
+	struct dma_fence_cb		cb;
+	u64				user_data;
+	u64				seq;
+};
+
+struct amdxdna_submit_ring {
+	struct amdxdna_ctx		*ctx;
+	struct amdxdna_gem_obj		*abo;
+	struct iosys_map		map;
+	struct amdxdna_submit_ring_hdr	*hdr;
+	struct amdxdna_submit_ring_sqe	*sq;
+	struct amdxdna_submit_ring_cqe	*cq;
+	struct mm_struct		*mm;
+	struct work_struct		work;
+	struct mutex			lock; /* one consumer at a time */
+	bool				stopped;
+
+	u32				sq_entries;
+	u32				cq_entries;
+	/* Driver's copies, user space can not move them under us */
+	u32				sq_head;
+	u32				cq_tail;
+
+	/* Submitted commands not yet posted, in submit order, sq_entries slots */
+	struct ring_inflight		*inflight;
+	u32				inf_head;
+	u32				inf_tail;
+};
+
+static inline u32 ring_nr_inflight(struct amdxdna_submit_ring *ring)
+{
+	return ring->inf_tail - ring->inf_head;
+}
+
+static inline struct ring_inflight *ring_inflight_head(struct amdxdna_submit_ring *ring)
+{
+	return &ring->inflight[ring->inf_head & (ring->sq_entries - 1)];
+}
+
+/* A bogus cq_head from user space reads as a full CQ */
+static inline u32 ring_cq_free(struct amdxdna_submit_ring *ring)
+{
+	u32 used = ring->cq_tail - READ_ONCE(ring->hdr->cq_head);
+
+	return used < ring->cq_entries ? ring->cq_entries - used : 0;
+}
+
+static void ring_post(struct amdxdna_submit_ring *ring, u64 user_data, u64 seq, int result)
+{
+	struct amdxdna_submit_ring_cqe *cqe;
+
+	cqe = &ring->cq[ring->cq_tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->seq = seq;
+	cqe->result = result;
+	ring->cq_tail++;
+	smp_store_release(&ring->hdr->cq_tail, ring->cq_tail);
+}
+
+static void ring_fence_cb(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct ring_inflight *inf = container_of(cb, struct ring_inflight, cb);
+
+	queue_work(system_unbound_wq, &inf->ring->work);
+}
+
+static void ring_inflight_put(struct ring_inflight *inf)
+{
+	/* Returns after the callback finished, if it is running */
+	dma_fence_remove_callback(inf->fence, &inf->cb);
+	dma_fence_put(inf->fence);
+	inf->fence = NULL;
+}
+
+/* Post completed commands in submit order */
+static bool ring_reap(struct amdxdna_submit_ring *ring)
+{
+	struct ring_inflight *inf;
+	bool progress = false;
+	int status;
+
+	while (ring_nr_inflight(ring) && ring_cq_free(ring)) {
+		inf = ring_inflight_head(ring);
+		status = dma_fence_get_status(inf->fence);
+		if (!status)
+			break;
+
+		ring_post(ring, inf->user_data, inf->seq, status < 0 ? status : 0);
+		ring_inflight_put(inf);
+		ring->inf_head++;
+		progress = true;
+	}
+
+	return progress;
+}
+
+static int ring_submit(struct amdxdna_submit_ring *ring, struct amdxdna_submit_ring_sqe *sqe)
+{
+	struct amdxdna_ctx *ctx = ring->ctx;
+	struct amdxdna_client *client = ctx->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct ring_inflight *inf;
+	struct dma_fence *fence;
+	u64 seq;
+	int ret;
+
+	if (!sqe->arg_count || sqe->arg_count > AMDXDNA_SUBMIT_RING_MAX_ARGS) {
+		XDNA_DBG(xdna, "%s ring invalid arg bo count %d", ctx->name, sqe->arg_count);
+		return -EINVAL;
+	}
+
+	ret = amdxdna_cmd_submit(client, OP_USER, sqe->cmd_handle, sqe->arg_handles,
+				 sqe->arg_count, NULL, NULL, 0, ctx->id, &seq);
+	if (ret)
+		return ret;
+
+	/* Out fence is gone only if the command already completed */
+	fence = xdna->dev_info->ops->cmd_get_out_fence(ctx, seq);
+	if (!fence)
+		fence = dma_fence_get_stub();
+
+	inf = &ring->inflight[ring->inf_tail & (ring->sq_entries - 1)];
+	inf->ring = ring;
+	inf->fence = fence;
+	inf->user_data = sqe->user_data;
+	inf->seq = seq;
+	ring->inf_tail++;
+	/* Signaled already, the reap right after picks it up */
+	dma_fence_add_callback(fence, &inf->cb, ring_fence_cb);
+	return 0;
+}
+
+/* Every SQE takes a CQE, only consume while its CQE is guaranteed */
+static bool ring_consume(struct amdxdna_submit_ring *ring)
+{
+	struct amdxdna_submit_ring_sqe sqe;
+	bool progress = false;
+	u32 tail;
+	int ret;
+
+	tail = smp_load_acquire(&ring->hdr->sq_tail);
+	while (ring->sq_head != tail) {
+		if (ring_nr_inflight(ring) == ring->sq_entries ||
+		    ring_cq_free(ring) <= ring_nr_inflight(ring))
+			break;
+
+		memcpy(&sqe, &ring->sq[ring->sq_head & (ring->sq_entries - 1)], sizeof(sqe));
+		ring->sq_head++;
+		smp_store_release(&ring->hdr->sq_head, ring->sq_head);
+		progress = true;
+
+		ret = ring_submit(ring, &sqe);
+		if (ret)
+			ring_post(ring, sqe.user_data, 0, ret);
+	}
+
+	return progress;
+}
+
+/* True if nothing is running whose completion would run the ring again */
+static bool ring_need_wakeup(struct amdxdna_submit_ring *ring)
+{
+	return !ring_nr_inflight(ring) ||
+		dma_fence_is_signaled(ring_inflight_head(ring)->fence);
+}
+
+static void ring_run(struct amdxdna_submit_ring *ring)
+{
+	bool progress;
+
+	mutex_lock(&ring->lock);
+	if (ring->stopped)
+		goto out;
+
+	do {
+		progress = ring_reap(ring);
+		progress |= ring_consume(ring);
+	} while (progress);
+
+	if (!ring_need_wakeup(ring)) {
+		WRITE_ONCE(ring->hdr->flags, 0);
+		goto out;
+	}
+
+	/* Pairs with the barrier user space has between its tail update and flags check */
+	WRITE_ONCE(ring->hdr->flags, AMDXDNA_SUBMIT_RING_NEED_WAKEUP);
+	smp_mb();
+	if (smp_load_acquire(&ring->hdr->sq_tail) != ring->sq_head)
+		queue_work(system_unbound_wq, &ring->work);
+out:
+	mutex_unlock(&ring->lock);
+}
+
+static void ring_work(struct work_struct *work)
+{
+	struct amdxdna_submit_ring *ring;
+
+	ring = container_of(work, struct amdxdna_submit_ring, work);
+	if (!mmget_not_zero(ring->mm))
+		return;
+
+	/* Command and arg BOs may be userptr, job submit needs the owner's mm */
+	kthread_use_mm(ring->mm);
+	ring_run(ring);
+	kthread_unuse_mm(ring->mm);
+	mmput(ring->mm);
+}
+
+int amdxdna_ring_config(struct amdxdna_ctx *ctx, void *buf, u32 size)
+{
+	struct amdxdna_ctx_param_submit_ring *req = buf;
+	struct amdxdna_client *client = ctx->client;
+	struct amdxdna_dev *xdna = client->xdna;
+	struct amdxdna_submit_ring *ring;
+	size_t ring_sz, need;
+	int ret;
+
+	if (size != sizeof(*req) || req->pad) {
+		XDNA_ERR(xdna, "Invalid submit ring request size %d", size);
+		return -EINVAL;
+	}
+
+	if (!is_power_of_2(req->sq_entries) || !is_power_of_2(req->cq_entries) ||
+	    req->sq_entries > SUBMIT_RING_MAX_ENTRIES ||
+	    req->cq_entries > SUBMIT_RING_MAX_ENTRIES ||
+	    req->cq_entries < req->sq_entries) {
+		XDNA_ERR(xdna, "Invalid submit ring entries sq %d cq %d",
+			 req->sq_entries, req->cq_entries);
+		return -EINVAL;
+	}
+
+	if (READ_ONCE(ctx->ring))
+		return -EBUSY;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->inflight = kcalloc(req->sq_entries, sizeof(*ring->inflight), GFP_KERNEL);
+	if (!ring->inflight) {
+		ret = -ENOMEM;
+		goto free_ring;
+	}
+
+	ring->abo = amdxdna_gem_get_obj(client, req->bo_handle, AMDXDNA_BO_SHARE);
+	if (!ring->abo) {
+		XDNA_ERR(xdna, "Submit ring bo %d is not a share bo", req->bo_handle);
+		ret = -EINVAL;
+		goto free_inflight;
+	}
+
+	ring_sz = to_gobj(ring->abo)->size;
+	need = sizeof(*ring->hdr) + req->sq_entries * sizeof(*ring->sq) +
+		req->cq_entries * sizeof(*ring->cq);
+	if (ring_sz < need) {
+		XDNA_ERR(xdna, "Submit ring bo size 0x%zx too small, need 0x%zx", ring_sz, need);
+		ret = -EINVAL;
+		goto put_obj;
+	}
+
+	ret = drm_gem_vmap_unlocked(to_gobj(ring->abo), &ring->map);
+	if (ret) {
+		XDNA_ERR(xdna, "Vmap submit ring bo failed, ret %d", ret);
+		goto put_obj;
+	}
+
+	ring->ctx = ctx;
+	ring->sq_entries = req->sq_entries;
+	ring->cq_entries = req->cq_entries;
+	ring->hdr = ring->map.vaddr;
+	ring->sq = ring->map.vaddr + sizeof(*ring->hdr);
+	ring->cq = (void *)(ring->sq + ring->sq_entries);
+	mutex_init(&ring->lock);
+	INIT_WORK(&ring->work, ring_work);
+	ring->mm = current->mm;
+	mmgrab(ring->mm);
+
+	memset(ring->map.vaddr, 0, need);
+	ring->hdr->sq_entries = ring->sq_entries;
+	ring->hdr->cq_entries = ring->cq_entries;
+	ring->hdr->flags = AMDXDNA_SUBMIT_RING_NEED_WAKEUP;
+
+	if (cmpxchg(&ctx->ring, NULL, ring)) {
+		ret = -EBUSY;
+		goto drop_mm;
+	}
+
+	XDNA_DBG(xdna, "%s submit ring sq %d cq %d", ctx->name, ring->sq_entries,
+		 ring->cq_entries);
+	return 0;
+
+drop_mm:
+	mmdrop(ring->mm);
+	mutex_destroy(&ring->lock);
+	drm_gem_vunmap_unlocked(to_gobj(ring->abo), &ring->map);
+put_obj:
+	amdxdna_gem_put_obj(ring->abo);
+free_inflight:
+	kfree(ring->inflight);
+free_ring:
+	kfree(ring);
+	return ret;
+}
+
+int amdxdna_ring_kick(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_submit_ring *ring = READ_ONCE(ctx->ring);
+
+	if (!ring)
+		return -EINVAL;
+
+	if (current->mm == ring->mm)
+		ring_run(ring);
+	else
+		queue_work(system_unbound_wq, &ring->work);
+	return 0;
+}
+
+/* Called after the context is unreachable, commands in flight are not waited */
+void amdxdna_ring_fini(struct amdxdna_ctx *ctx)
+{
+	struct amdxdna_submit_ring *ring = ctx->ring;
+
+	if (!ring)
+		return;
+
+	mutex_lock(&ring->lock);
+	ring->stopped = true;
+	while (ring_nr_inflight(ring)) {
+		ring_inflight_put(ring_inflight_head(ring));
+		ring->inf_head++;
+	}
+	mutex_unlock(&ring->lock);
+	cancel_work_sync(&ring->work);
+
+	mmdrop(ring->mm);
+	mutex_destroy(&ring->lock);
+	drm_gem_vunmap_unlocked(to_gobj(ring->abo), &ring->map);
+	amdxdna_gem_put_obj(ring->abo);
+	kfree(ring->inflight);
+	kfree(ring);
+	ctx->ring = NULL;
+}
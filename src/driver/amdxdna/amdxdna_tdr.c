@@ -8,13 +8,37 @@
 
 uint timeout_in_sec = 2;
 module_param(timeout_in_sec, uint, 0644);
-MODULE_PARM_DESC(timeout_in_sec, "Seconds to timeout and recovery, default 2; 0 - No TDR");
+MODULE_PARM_DESC(timeout_in_sec, "Default seconds to timeout and recovery, default 2; 0 - No TDR");
 
 bool tdr_dump_ctx;
 module_param(tdr_dump_ctx, bool, 0644);
 MODULE_PARM_DESC(tdr_dump_ctx, "Instead of resetting, just dump the ctx info for debugging");
 
-#define TDR_TIMEOUT_JIFF msecs_to_jiffies(timeout_in_sec * 1000)
+static u32 amdxdna_tdr_dft_period_ms(void)
+{
+	return max(timeout_in_sec * MSEC_PER_SEC, TDR_MIN_TIMEOUT_MS);
+}
+
+/*
+ * Called by the device layer from detect() for each context it checks.
+ * A context is at most half of its timeout late to be found hung.
+ */
+void amdxdna_tdr_note_timeout(struct amdxdna_tdr *tdr, u32 timeout_ms)
+{
+	tdr->next_period_ms = min(tdr->next_period_ms, timeout_ms / 2);
+}
+
+/* A context with a short timeout showed up, do not wait a full period */
+void amdxdna_tdr_kick(struct amdxdna_tdr *tdr, u32 timeout_ms)
+{
+	u32 period = timeout_ms / 2;
+
+	if (!tdr->started || period >= READ_ONCE(tdr->period_ms))
+		return;
+
+	WRITE_ONCE(tdr->period_ms, period);
+	timer_reduce(&tdr->timer, jiffies + msecs_to_jiffies(period));
+}
 
 static void amdxdna_tdr_work(struct work_struct *work)
 {
@@ -22,10 +46,12 @@ static void amdxdna_tdr_work(struct work_struct *work)
 	struct amdxdna_dev *xdna;
 
 	xdna = tdr_to_xdna_dev(tdr);
+	tdr->next_period_ms = amdxdna_tdr_dft_period_ms();
 	if (xdna->dev_info->ops->detect(xdna)) {
 		XDNA_WARN(xdna, "Device isn't making progress... Count %d", ++tdr->tdr_counter);
 		xdna->dev_info->ops->recover(xdna, tdr_dump_ctx);
 	}
+	WRITE_ONCE(tdr->period_ms, tdr->next_period_ms);
 }
 
 static void amdxdna_tdr_timer(struct timer_list *t)
@@ -34,7 +60,7 @@ static void amdxdna_tdr_timer(struct timer_list *t)
 
 	queue_work(system_long_wq, &tdr->tdr_work);
 
-	mod_timer(t, jiffies + TDR_TIMEOUT_JIFF);
+	mod_timer(t, jiffies + msecs_to_jiffies(READ_ONCE(tdr->period_ms)));
 }
 
 void amdxdna_tdr_start(struct amdxdna_tdr *tdr)
@@ -54,7 +80,8 @@ void amdxdna_tdr_start(struct amdxdna_tdr *tdr)
 	timer_setup(&tdr->timer, amdxdna_tdr_timer, 0);
 	INIT_WORK(&tdr->tdr_work, amdxdna_tdr_work);
 
-	tdr->timer.expires = jiffies + TDR_TIMEOUT_JIFF;
+	tdr->period_ms = amdxdna_tdr_dft_period_ms();
+	tdr->timer.expires = jiffies + msecs_to_jiffies(tdr->period_ms);
 	add_timer(&tdr->timer);
 	tdr->started = 1;
 	XDNA_DBG(xdna, "Check activities in every %d secs", timeout_in_sec);
@@ -14,14 +14,24 @@
 #define to_tdr(work) \
 	((struct amdxdna_tdr *)container_of(work, struct amdxdna_tdr, tdr_work))
 
+/* Shortest per context timeout, keeps the check period sane */
+#define TDR_MIN_TIMEOUT_MS	100
+
+extern uint timeout_in_sec;
+
 struct amdxdna_tdr {
 	struct timer_list	timer;
 	struct work_struct	tdr_work;
 	int			tdr_counter;
 	int			started;
+	/* Check period, half of the shortest timeout seen in the last check */
+	u32			period_ms;
+	u32			next_period_ms;
 };
 
 void amdxdna_tdr_start(struct amdxdna_tdr *tdr);
 void amdxdna_tdr_stop(struct amdxdna_tdr *tdr);
+void amdxdna_tdr_note_timeout(struct amdxdna_tdr *tdr, u32 timeout_ms);
+void amdxdna_tdr_kick(struct amdxdna_tdr *tdr, u32 timeout_ms);
 
 #endif /* _AMDXDNA_TDR_H_ */
@@ -39,36 +39,92 @@ TRACE_EVENT(amdxdna_debug_point,
 		      __get_str(str))
 );
 
-TRACE_EVENT(xdna_job,
-	    TP_PROTO(struct drm_sched_job *sched_job, const char *name,
-		     const char *str, u64 seq, u32 op),
+/*
+ * One event per job lifecycle stage, in order:
+ *   submit, run, sent, done, free, release
+ * plus deadline_miss after done. Jobs are identified by (pid, ctx, seq) in
+ * every stage, so a trace can be split per context without guessing.
+ * tools/npu_job_analyze.py parses this format, keep them in sync.
+ */
+TRACE_EVENT(xdna_job_stage,
+	    TP_PROTO(pid_t pid, u32 ctx, const char *name, u64 seq, u32 op, const char *stage),
 
-	    TP_ARGS(sched_job, name, str, seq, op),
+	    TP_ARGS(pid, ctx, name, seq, op, stage),
 
-	    TP_STRUCT__entry(__string(name, name)
-			     __string(str, str)
-			     __field(u64, fence_context)
-			     __field(u64, fence_seqno)
+	    TP_STRUCT__entry(__field(pid_t, pid)
+			     __field(u32, ctx)
+			     __string(name, name)
 			     __field(u64, seq)
-			     __field(u32, op)),
+			     __field(u32, op)
+			     __string(stage, stage)),
 
 #if KERNEL_VERSION(6, 10, 0) > LINUX_VERSION_CODE
 	    TP_fast_assign(__assign_str(name, name);
-			   __assign_str(str, str);
+			   __assign_str(stage, stage);
 #else
 	    TP_fast_assign(__assign_str(name);
-			   __assign_str(str);
+			   __assign_str(stage);
 #endif
-			   __entry->fence_context = sched_job->s_fence->finished.context;
-			   __entry->fence_seqno = sched_job->s_fence->finished.seqno;
+			   __entry->pid = pid;
+			   __entry->ctx = ctx;
 			   __entry->seq = seq;
 			   __entry->op = op;),
 
-	    TP_printk("fence=(context:%llu, seqno:%lld), %s seq#:%lld %s, op=%d",
-		      __entry->fence_context, __entry->fence_seqno,
+	    TP_printk("pid=%d ctx=%u seq=%llu op=%u stage=%s name=%s",
+		      __entry->pid, __entry->ctx, __entry->seq, __entry->op,
+		      __get_str(stage), __get_str(name))
+);
+
+TRACE_EVENT(xdna_job_ts,
+	    TP_PROTO(const char *name, u64 seq, u64 submit, u64 run, u64 sent, u64 done),
+
+	    TP_ARGS(name, seq, submit, run, sent, done),
+
+	    TP_STRUCT__entry(__string(name, name)
+			     __field(u64, seq)
+			     __field(u64, submit)
+			     __field(u64, run)
+			     __field(u64, sent)
+			     __field(u64, done)),
+
+#if KERNEL_VERSION(6, 10, 0) > LINUX_VERSION_CODE
+	    TP_fast_assign(__assign_str(name, name);
+#else
+	    TP_fast_assign(__assign_str(name);
+#endif
+			   __entry->seq = seq;
+			   __entry->submit = submit;
+			   __entry->run = run;
+			   __entry->sent = sent;
+			   __entry->done = done;),
+
+	    TP_printk("%s seq#:%lld queued %lld ns, send %lld ns, device %lld ns",
 		      __get_str(name), __entry->seq,
-		      __get_str(str),
-		      __entry->op)
+		      __entry->run - __entry->submit,
+		      __entry->sent - __entry->run,
+		      __entry->done - __entry->sent)
+);
+
+/*
+ * One event per firmware event trace entry. ts is the entry time mapped to
+ * CLOCK_MONOTONIC ns, the clock of ktime_get() and of the xdna_job_ts
+ * stamps. With trace_clock set to mono it lines up with the event stamps.
+ */
+TRACE_EVENT(xdna_fw_event,
+	    TP_PROTO(u64 ts, u16 type, u64 payload),
+
+	    TP_ARGS(ts, type, payload),
+
+	    TP_STRUCT__entry(__field(u64, ts)
+			     __field(u16, type)
+			     __field(u64, payload)),
+
+	    TP_fast_assign(__entry->ts = ts;
+			   __entry->type = type;
+			   __entry->payload = payload;),
+
+	    TP_printk("ts=%llu type=0x%04x payload=0x%016llx",
+		      __entry->ts, __entry->type, __entry->payload)
 );
 
 DECLARE_EVENT_CLASS(xdna_mbox_msg,
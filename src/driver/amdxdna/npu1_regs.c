@@ -68,6 +68,7 @@ const struct amdxdna_dev_priv npu1_dev_priv = {
 	.mbox_size      = 0, /* Use BAR size */
 	.hwctx_limit	= 6,
 	.ctx_limit	= 6,
+	.ctx_max_cmds	= 16,
 	.sram_dev_addr  = NPU1_SRAM_BAR_BASE,
 	.sram_offs      = {
 		DEFINE_BAR_OFFSET(MBOX_CHANN_OFF, NPU1_SRAM, MPNPU_SRAM_X2I_MAILBOX_0),
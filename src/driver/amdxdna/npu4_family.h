@@ -68,6 +68,7 @@
 	.sram_dev_addr  = NPU4_SRAM_BAR_BASE,							\
 	.hwctx_limit	= 16,									\
 	.ctx_limit	= 32,									\
+	.ctx_max_cmds	= 32,									\
 	.sram_offs      = {									\
 		DEFINE_BAR_OFFSET(MBOX_CHANN_OFF, NPU4_SRAM, MPNPU_SRAM_X2I_MAILBOX_0),		\
 		DEFINE_BAR_OFFSET(FW_ALIVE_OFF,   NPU4_SRAM, MPNPU_SRAM_X2I_MAILBOX_15),	\
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2025, Advanced Micro Devices, Inc.
+
+"""
+Break NPU job latency down per context from amdxdna_trace:xdna_job_stage
+events. Input is text from either 'perf script --ns' (e.g. perf.converted.out
+produced by npu_perf_trace.sh) or /sys/kernel/tracing/trace.
+
+Examples:
+  npu_job_analyze.py perf.converted.out
+  npu_job_analyze.py -t timeline.json perf.converted.out
+  cat /sys/kernel/tracing/trace | npu_job_analyze.py -
+"""
+
+import argparse
+import json
+import re
+import sys
+from collections import defaultdict
+
+# Must match TP_printk() of xdna_job_stage in amdxdna_trace.h
+EVENT_RE = re.compile(
+    r'\s(?P<ts>\d+\.\d+):\s+(?:\S+:)?xdna_job_stage:\s+'
+    r'pid=(?P<pid>-?\d+) ctx=(?P<ctx>\d+) seq=(?P<seq>\d+) op=(?P<op>\d+) '
+    r'stage=(?P<stage>\S+) name=(?P<name>.*)$')
+
+# Stage pairs reported, in job lifecycle order
+INTERVALS = [
+    ('submit', 'run'),
+    ('run', 'sent'),
+    ('sent', 'done'),
+    ('done', 'free'),
+    ('free', 'release'),
+    ('submit', 'done'),
+]
+
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+def parse(lines):
+    """Return {(pid, ctx): {seq: job}}, job is a dict of stage -> ts in ns"""
+    ctxs = defaultdict(dict)
+    names = {}
+    for line in lines:
+        m = EVENT_RE.search(line)
+        if not m:
+            continue
+        sec, frac = m.group('ts').split('.')
+        ts = int(sec) * 1000000000 + int(frac.ljust(9, '0')[:9])
+        key = (int(m.group('pid')), int(m.group('ctx')))
+        seq = int(m.group('seq'))
+        names[key] = m.group('name').strip()
+        job = ctxs[key].setdefault(seq, {'op': int(m.group('op'))})
+        # Keep the first one, a stage may only be logged once per job
+        job.setdefault(m.group('stage'), ts)
+    return ctxs, names
+
+
+def percentile(sorted_vals, p):
+    # Nearest rank, same as shim_test perf_samples
+    idx = max(int(-(-p * len(sorted_vals) // 100)) - 1, 0)
+    return sorted_vals[min(idx, len(sorted_vals) - 1)]
+
+
+def interval_stats(jobs, begin, end):
+    vals = sorted(j[end] - j[begin] for j in jobs.values() if begin in j and end in j)
+    if not vals:
+        return None
+    stats = {'count': len(vals), 'avg': sum(vals) / len(vals), 'max': vals[-1]}
+    for p in PERCENTILES:
+        stats['p%g' % p] = percentile(vals, p)
+    return stats
+
+
+def report(ctxs, names, out):
+    cols = ['count', 'avg'] + ['p%g' % p for p in PERCENTILES] + ['max']
+    for key in sorted(ctxs):
+        jobs = ctxs[key]
+        misses = sum(1 for j in jobs.values() if 'deadline_miss' in j)
+        incomplete = sum(1 for j in jobs.values() if 'done' not in j)
+        out.write('pid %d ctx %d (%s): %d jobs, %d incomplete, %d deadline miss\n' %
+                  (key[0], key[1], names[key], len(jobs), incomplete, misses))
+        out.write('  %-16s' % 'stage (us)' + ''.join('%12s' % c for c in cols) + '\n')
+        for begin, end in INTERVALS:
+            stats = interval_stats(jobs, begin, end)
+            if not stats:
+                continue
+            row = '  %-16s%12d' % (begin + '->' + end, stats['count'])
+            row += ''.join('%12.1f' % (stats[c] / 1000.0) for c in cols[1:])
+            out.write(row + '\n')
+        out.write('\n')
+
+
+def timeline(ctxs, names, path):
+    """Chrome trace event format, loadable by Perfetto and chrome://tracing"""
+    events = []
+    for key in sorted(ctxs):
+        pid, ctx = key
+        events.append({'ph': 'M', 'name': 'process_name', 'pid': pid,
+                       'args': {'name': 'pid %d' % pid}})
+        events.append({'ph': 'M', 'name': 'thread_name', 'pid': pid, 'tid': ctx,
+                       'args': {'name': '%s (ctx %d)' % (names[key], ctx)}})
+        for seq, job in sorted(ctxs[key].items()):
+            for begin, end in INTERVALS[:-1]:
+                if begin not in job or end not in job:
+                    continue
+                events.append({'ph': 'X', 'name': begin + '->' + end,
+                               'pid': pid, 'tid': ctx,
+                               'ts': job[begin] / 1000.0,
+                               'dur': (job[end] - job[begin]) / 1000.0,
+                               'args': {'seq': seq, 'op': job['op']}})
+            if 'deadline_miss' in job:
+                events.append({'ph': 'i', 's': 't', 'name': 'deadline_miss',
+                               'pid': pid, 'tid': ctx,
+                               'ts': job['deadline_miss'] / 1000.0,
+                               'args': {'seq': seq}})
+    with open(path, 'w') as f:
+        json.dump({'traceEvents': events, 'displayTimeUnit': 'ns'}, f)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Per-context NPU job stage latency from xdna_job_stage trace events')
+    parser.add_argument('file', nargs='?', default='perf.converted.out',
+                        help="trace text file, '-' for stdin (default: perf.converted.out)")
+    parser.add_argument('-t', '--timeline', metavar='JSON',
+                        help='also write a Perfetto/Chrome trace event timeline')
+    args = parser.parse_args()
+
+    if args.file == '-':
+        ctxs, names = parse(sys.stdin)
+    else:
+        try:
+            with open(args.file) as f:
+                ctxs, names = parse(f)
+        except OSError as e:
+            sys.exit('%s: %s' % (args.file, e.strerror))
+
+    if not ctxs:
+        sys.exit('No xdna_job_stage events found in %s' % args.file)
+
+    report(ctxs, names, sys.stdout)
+    if args.timeline:
+        timeline(ctxs, names, args.timeline)
+        print('Timeline written to %s' % args.timeline)
+
+
+if __name__ == '__main__':
+    main()
@@ -133,4 +133,5 @@ sed "$ioctl_sed_expr" "${tmp_file}" > perf.converted.out
 rm -rf ${tmp_file}
 
 remove_sdt_xrt
+trace_info "Per-context job stage breakdown: npu_job_analyze.py perf.converted.out"
 ## -------- trace flow end --------
@@ -57,6 +57,7 @@ extern "C" {
 #define	DRM_AMDXDNA_GET_INFO		7
 #define	DRM_AMDXDNA_SET_STATE		8
 #define	DRM_AMDXDNA_WAIT_CMD		9
+#define	DRM_AMDXDNA_SYNC_BOS		10
 
 #define	AMDXDNA_DEV_TYPE_UNKNOWN	-1
 #define	AMDXDNA_DEV_TYPE_KMQ		0
@@ -113,6 +114,13 @@ struct amdxdna_qos_info {
  * @umq_doorbell: Returned offset of doorbell associated with UMQ.
  * @handle: Returned context handle.
  * @syncobj_handle: The drm timeline syncobj handle for command completion notification.
+ * @max_cmds: Number of commands allowed in flight on this context, 0 for
+ *            driver default. The driver rounds it up to a power of 2, caps
+ *            it to the device maximum and returns the effective value.
+ * @timeout_ms: Hang timeout in ms, 0 for the driver default. The context is
+ *              considered hung when it has outstanding commands and none of
+ *              them completed for this long. The driver raises it to its
+ *              minimum and returns the effective value.
  */
 struct amdxdna_drm_create_ctx {
 	__u64 ext;
@@ -126,6 +134,8 @@ struct amdxdna_drm_create_ctx {
 	__u32 umq_doorbell;
 	__u32 handle;
 	__u32 syncobj_handle;
+	__u32 max_cmds;
+	__u32 timeout_ms;
 };
 
 /**
@@ -162,6 +172,164 @@ struct amdxdna_ctx_param_config_cu {
 	struct amdxdna_cu_config cu_configs[];
 };
 
+/**
+ * struct amdxdna_ctx_param_resident_set - BOs kept resident for a context
+ * @id: Returned resident set ID, used in struct amdxdna_drm_exec_cmd.
+ * @num_bos: Number of BO handles.
+ * @bo_handles: Array of BO handles.
+ *
+ * The BOs are looked up and pinned once at registration and stay so until
+ * the set is removed or the context is destroyed. Commands submitted with
+ * the set skip per BO lookup, locking and implicit fencing for these BOs,
+ * so user space must order CPU access to them by waiting on the commands.
+ */
+struct amdxdna_ctx_param_resident_set {
+	__u32 id;
+	__u32 num_bos;
+	__u32 bo_handles[];
+};
+
+/**
+ * struct amdxdna_ctx_param_submit_ring - Submit commands through a ring
+ * @bo_handle: AMDXDNA_BO_SHARE BO holding the ring, mapped by the caller.
+ * @sq_entries: Number of submission entries, power of 2.
+ * @cq_entries: Number of completion entries, power of 2, not less than
+ *              @sq_entries.
+ * @pad: MBZ.
+ *
+ * The BO starts with struct amdxdna_submit_ring_hdr, followed by
+ * @sq_entries struct amdxdna_submit_ring_sqe, then @cq_entries
+ * struct amdxdna_submit_ring_cqe. A context has at most one ring, it is
+ * removed with the context.
+ */
+struct amdxdna_ctx_param_submit_ring {
+	__u32 bo_handle;
+	__u32 sq_entries;
+	__u32 cq_entries;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_submit_ring_hdr - Header of a submission ring
+ * @sq_head: Next SQE the driver consumes, written by driver.
+ * @sq_tail: Next SQE user space fills, written by user space.
+ * @cq_head: Next CQE user space reads, written by user space.
+ * @cq_tail: Next CQE the driver posts, written by driver.
+ * @sq_entries: Same as struct amdxdna_ctx_param_submit_ring.
+ * @cq_entries: Same as struct amdxdna_ctx_param_submit_ring.
+ * @flags: AMDXDNA_SUBMIT_RING_NEED_WAKEUP, written by driver.
+ * @pad: MBZ.
+ *
+ * Indexes are free running, the entry is at index & (entries - 1). Update a
+ * tail only after the entry it covers is written, read an entry only after
+ * reading the tail which covers it.
+ *
+ * The driver consumes new SQEs whenever one of its commands completes. When
+ * it has none running, it sets AMDXDNA_SUBMIT_RING_NEED_WAKEUP and user
+ * space must kick it with DRM_AMDXDNA_CTX_KICK_SUBMIT_RING after moving
+ * @sq_tail or @cq_head.
+ */
+struct amdxdna_submit_ring_hdr {
+	__u32 sq_head;
+	__u32 sq_tail;
+	__u32 cq_head;
+	__u32 cq_tail;
+	__u32 sq_entries;
+	__u32 cq_entries;
+#define AMDXDNA_SUBMIT_RING_NEED_WAKEUP	(1U << 0)
+	__u32 flags;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_submit_ring_sqe - One command to submit
+ * @user_data: Copied to the CQE of this command.
+ * @cmd_handle: Command BO handle.
+ * @arg_count: Number of argument BO handles.
+ * @arg_handles: Argument BO handles.
+ */
+struct amdxdna_submit_ring_sqe {
+	__u64 user_data;
+	__u32 cmd_handle;
+	__u32 arg_count;
+#define AMDXDNA_SUBMIT_RING_MAX_ARGS	12
+	__u32 arg_handles[AMDXDNA_SUBMIT_RING_MAX_ARGS];
+};
+
+/**
+ * struct amdxdna_submit_ring_cqe - Completion of one command
+ * @user_data: From the SQE.
+ * @seq: Sequence number of the command, 0 if it failed to submit.
+ * @result: 0 on completion, negative errno if the command failed to
+ *          submit or its fence signaled an error. Command state is in
+ *          the command BO as usual.
+ * @pad: MBZ.
+ */
+struct amdxdna_submit_ring_cqe {
+	__u64 user_data;
+	__u64 seq;
+	__s32 result;
+	__u32 pad[3];
+};
+
+/*
+ * Or'ed into the BO handle in param_val of DRM_AMDXDNA_CTX_ASSIGN_DBG_BUF
+ * to use the debug BO as a ring, see struct amdxdna_dbg_ring_hdr.
+ */
+#define AMDXDNA_DBG_BUF_RING	(1ULL << 32)
+
+/**
+ * struct amdxdna_dbg_ring_hdr - Header at offset 0 of a debug BO ring
+ * @magic: AMDXDNA_DBG_RING_MAGIC, written by driver.
+ * @data_offset: Offset of ring data in the BO, written by driver.
+ * @size: Size of ring data in bytes, written by driver.
+ * @pad: MBZ.
+ * @wr_off: Bytes written so far, written by firmware.
+ *
+ * @wr_off is free running, the byte it covers is at data_offset +
+ * (offset % size). Firmware appends without waiting for the reader, which
+ * keeps its own read offset and has lost the oldest data once it falls
+ * more than @size behind. DRM_IOCTL_AMDXDNA_SYNC_BO from device makes
+ * firmware flush the ring while it stays attached.
+ *
+ * Drivers without ring support truncate param_val to the BO handle and
+ * attach a plain debug BO, firmware without it writes over the header.
+ * Readers check the header after attaching and on every read, and stop
+ * once it is not the one the driver wrote.
+ */
+struct amdxdna_dbg_ring_hdr {
+#define AMDXDNA_DBG_RING_MAGIC	0x47424458 /* "XDBG" */
+	__u32 magic;
+	__u32 data_offset;
+	__u32 size;
+	__u32 pad;
+	__u64 wr_off;
+};
+
+/**
+ * struct amdxdna_ctx_seq_page - Completion state of a context
+ * @completed: Number of completed commands, written by driver.
+ * @errors: Number of commands completed with an error, written by driver.
+ * @error_seq: Seq of the last command completed with an error, written by
+ *             driver. Only valid if @errors is not 0.
+ * @pad: MBZ.
+ *
+ * Held at offset 0 of an AMDXDNA_BO_SHARE BO given by
+ * DRM_AMDXDNA_CTX_CONFIG_SEQ_PAGE, user space only reads it. Commands of a
+ * context complete in seq order, so seq N has completed once N is less than
+ * @completed. Driver writes the command state and the error fields before
+ * it moves @completed, read @completed first with acquire semantics.
+ *
+ * @completed may lag behind, it never runs ahead. If it shows a command not
+ * completed, wait with DRM_IOCTL_AMDXDNA_WAIT_CMD or on the syncobj point.
+ */
+struct amdxdna_ctx_seq_page {
+	__u64 completed;
+	__u64 errors;
+	__u64 error_seq;
+	__u64 pad;
+};
+
 /**
  * struct amdxdna_drm_config_ctx - Configure context.
  * @handle: Context handle.
@@ -179,6 +347,33 @@ struct amdxdna_drm_config_ctx {
 #define DRM_AMDXDNA_CTX_CONFIG_CU	0
 #define	DRM_AMDXDNA_CTX_ASSIGN_DBG_BUF	1
 #define	DRM_AMDXDNA_CTX_REMOVE_DBG_BUF	2
+#define	DRM_AMDXDNA_CTX_ADD_RESIDENT_SET	3
+#define	DRM_AMDXDNA_CTX_REMOVE_RESIDENT_SET	4
+/* param_val points to struct amdxdna_qos_info */
+#define	DRM_AMDXDNA_CTX_CONFIG_QOS		5
+/* param_val points to struct amdxdna_ctx_param_submit_ring */
+#define	DRM_AMDXDNA_CTX_CONFIG_SUBMIT_RING	6
+/* param_val is ignored */
+#define	DRM_AMDXDNA_CTX_KICK_SUBMIT_RING	7
+/*
+ * param_val is the coalescing window in us, 0 turns it off. A command
+ * submitted to an idle context is held for up to the window, commands
+ * submitted behind it in the meantime are sent to device with it.
+ */
+#define	DRM_AMDXDNA_CTX_CONFIG_COALESCE	8
+/*
+ * param_val is the handle of an AMDXDNA_BO_SHARE BO, see struct
+ * amdxdna_ctx_seq_page. Set once, it stays until the context is destroyed.
+ */
+#define	DRM_AMDXDNA_CTX_CONFIG_SEQ_PAGE	9
+/*
+ * param_val is the max number of sub-commands per firmware message of an
+ * ERT_CMD_CHAIN, 0 turns it off. As each message completes, the state of
+ * its sub-command BOs becomes ERT_CMD_STATE_COMPLETED, before the chain
+ * itself completes. Every message past the first takes a command buffer
+ * from the device heap and costs one firmware round trip.
+ */
+#define	DRM_AMDXDNA_CTX_CONFIG_CHAIN_PROGRESS	10
 	__u32 param_type;
 	__u64 param_val;
 	__u32 param_val_size;
@@ -187,13 +382,30 @@ struct amdxdna_drm_config_ctx {
 
 /**
  * struct amdxdna_drm_create_bo - Create a buffer object.
- * @flags: Buffer flags. MBZ.
+ * @flags: Buffer flags, see AMDXDNA_BO_FLAG_*.
  * @udma_fd: UDMA fd of buffer if applied.
  * @size: Size in bytes.
  * @type: Buffer type.
  * @handle: Returned DRM buffer object handle.
  */
 struct amdxdna_drm_create_bo {
+/*
+ * Hint to back AMDXDNA_BO_SHARE or AMDXDNA_BO_DEV_HEAP with huge pages when
+ * the kernel supports it. Ignored otherwise.
+ */
+#define	AMDXDNA_BO_FLAG_HUGE_PAGE	(1ULL << 0)
+/*
+ * Userspace orders all accesses to this BO through syncobjs. Commands of the
+ * creating client add their fence to the BO's dma_resv as BOOKKEEP only, so
+ * nothing waiting on its implicit fences sees them.
+ */
+#define	AMDXDNA_BO_FLAG_EXPLICIT_SYNC	(1ULL << 1)
+/*
+ * Only with @udma_fd. mmap of the BO returns without faulting its pages in,
+ * a driver worker does it. A submit using the BO before that is done
+ * faults in the rest by itself.
+ */
+#define	AMDXDNA_BO_FLAG_ASYNC_POPULATE	(1ULL << 2)
 	__u64	flags;
 	__u64	udma_fd;
 	__u64	size;
@@ -243,10 +455,58 @@ struct amdxdna_drm_sync_bo {
 	__u64 size;
 };
 
+/**
+ * struct amdxdna_drm_sync_bos - Sync many BOs or ranges in one call.
+ * @entries: Array of struct amdxdna_drm_sync_bo.
+ * @count: Number of entries.
+ * @pad: MBZ.
+ *
+ * Entries are handled as by DRM_IOCTL_AMDXDNA_SYNC_BO. Ones which need the
+ * device to write back are sent as one job per context, all in flight at
+ * the same time.
+ */
+struct amdxdna_drm_sync_bos {
+	__u64 entries;
+	__u32 count;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_cmd_copy_bo - Device side copy between BOs.
+ * @dst_handle: Destination BO handle.
+ * @src_handle: Source BO handle.
+ * @dst_offset: Byte offset in destination BO.
+ * @src_offset: Byte offset in source BO.
+ * @size: Number of bytes to copy.
+ */
+struct amdxdna_cmd_copy_bo {
+	__u32 dst_handle;
+	__u32 src_handle;
+	__u64 dst_offset;
+	__u64 src_offset;
+	__u64 size;
+};
+
+/**
+ * struct amdxdna_graph_node - One command of a graph submission.
+ * @ctx: Context handle the command is queued to.
+ * @cmd_handle: Command BO handle.
+ * @arg_count: Number of argument BO handles of this command.
+ * @dep_count: Number of earlier nodes this command waits for.
+ * @seq: Returned sequence number of this command in its context.
+ */
+struct amdxdna_graph_node {
+	__u32 ctx;
+	__u32 cmd_handle;
+	__u32 arg_count;
+	__u32 dep_count;
+	__u64 seq;
+};
+
 /**
  * struct amdxdna_drm_exec_cmd - Execute command.
- * @ext: MBZ.
- * @ext_flags: MBZ.
+ * @ext: Resident set ID if AMDXDNA_EXEC_FLAG_RESIDENT_SET, otherwise MBZ.
+ * @ext_flags: AMDXDNA_EXEC_FLAG_* or 0.
  * @ctx: Context handle.
  * @type: Command type.
  * @cmd_handles: Array of command handles or the command handle itself
@@ -255,14 +515,42 @@ struct amdxdna_drm_sync_bo {
  * @cmd_count: Number of command handles in the cmd_handles array.
  * @arg_count: Number of arguments in the args array.
  * @seq: Returned sequence number for this command.
+ *
+ * For AMDXDNA_CMD_SUBMIT_EXEC_BUF with cmd_count > 1, cmd_handles points to
+ * an array of cmd_count independent command BO handles and args points to
+ * the argument BO handles of all commands, each command's handles prefixed
+ * by their count, i.e. { n0, h0[0..n0), n1, h1[0..n1), ... }. arg_count is
+ * the total number of __u32 in args. The commands are queued in order with
+ * sequence numbers [seq, seq + cmd_count). If the submission fails part way,
+ * cmd_count is updated to the number of commands which have been queued.
+ *
+ * With AMDXDNA_EXEC_FLAG_RESIDENT_SET, the BOs of the resident set given by
+ * ext are used by every command in addition to the ones in args, and args
+ * may carry no handle at all.
+ *
+ * For AMDXDNA_CMD_SUBMIT_COPY_BO, cmd_handles points to one struct
+ * amdxdna_cmd_copy_bo, cmd_count is 1 and arg_count is 0. If ctx is
+ * AMDXDNA_INVALID_CTX_HANDLE, the copy is queued to any context of the
+ * client and ctx is updated to it.
+ *
+ * For AMDXDNA_CMD_SUBMIT_GRAPH, cmd_handles points to an array of cmd_count
+ * struct amdxdna_graph_node in topological order and ctx is ignored. args
+ * points to, for each node in turn, its arg_count argument BO handles followed
+ * by the indexes of the dep_count earlier nodes it waits for. arg_count is the
+ * total number of __u32 in args. The seq of every queued node is written back.
+ * If the submission fails part way, cmd_count is updated to the number of
+ * nodes which have been queued.
  */
 struct amdxdna_drm_exec_cmd {
 	__u64 ext;
+#define AMDXDNA_EXEC_FLAG_RESIDENT_SET	(1U << 0)
 	__u64 ext_flags;
 	__u32 ctx;
 #define	AMDXDNA_CMD_SUBMIT_EXEC_BUF	0
 #define	AMDXDNA_CMD_SUBMIT_DEPENDENCY	1
 #define	AMDXDNA_CMD_SUBMIT_SIGNAL	2
+#define	AMDXDNA_CMD_SUBMIT_COPY_BO	3
+#define	AMDXDNA_CMD_SUBMIT_GRAPH	4
 	__u32 type;
 	__u64 cmd_handles;
 	__u64 args;
@@ -460,6 +748,41 @@ struct amdxdna_drm_aie_reg {
 	__u32 val;
 };
 
+/**
+ * struct amdxdna_drm_aie_batch_entry - One region of a vectored AIE read
+ * @col:       The AIE column index
+ * @row:       The AIE row index
+ * @addr:      The AIE memory or register address to read, 4 bytes aligned
+ * @size:      The size of bytes to read, 4 for a register, 4 bytes aligned
+ * @bo_offset: Where the data goes in the destination BO, 4 bytes aligned
+ * @pad:       MBZ.
+ */
+struct amdxdna_drm_aie_batch_entry {
+	__u32 col;
+	__u32 row;
+	__u32 addr;
+	__u32 size;
+	__u32 bo_offset;
+	__u32 pad;
+};
+
+/**
+ * struct amdxdna_drm_aie_batch - Read many AIE regions at once
+ * @entries:     User pointer to an array of struct amdxdna_drm_aie_batch_entry
+ * @num_entries: Number of entries, up to AMDXDNA_AIE_BATCH_MAX_ENTRIES
+ * @bo_handle:   AMDXDNA_BO_SHARE BO the data is written to
+ *
+ * This is used for DRM_AMDXDNA_READ_AIE_BATCH parameter. All entries are
+ * read in one firmware request, so the data of one call is one sample of
+ * the array. Nothing is written to the BO if any entry is invalid.
+ */
+struct amdxdna_drm_aie_batch {
+#define AMDXDNA_AIE_BATCH_MAX_ENTRIES	4096
+	__u64 entries;
+	__u32 num_entries;
+	__u32 bo_handle;
+};
+
 /**
  * struct amdxdna_drm_get_power_mode - Get the power mode of the AIE hardware
  * @power_mode: Returned current power mode
@@ -495,6 +818,80 @@ struct amdxdna_drm_get_force_preempt_state {
 	__u8 pad[7];
 };
 
+/**
+ * struct amdxdna_drm_query_job_timestamp - Stage timestamps of a completed job.
+ * @ctx_handle: Context the job was submitted to.
+ * @pad: MBZ.
+ * @seq: Sequence number returned by the submit.
+ * @submit_ns: Job is accepted by the driver.
+ * @run_ns: Job is taken off the scheduler queue to run.
+ * @sent_ns: Job is written to the device mailbox.
+ * @done_ns: Device response is received and the fence is signaled.
+ *
+ * Timestamps are CLOCK_MONOTONIC. Only the last max_cmds completed jobs of a
+ * context are kept, -ENOENT is returned for other jobs.
+ */
+struct amdxdna_drm_query_job_timestamp {
+	__u32 ctx_handle; /* in */
+	__u32 pad;
+	__u64 seq; /* in */
+	__u64 submit_ns; /* out */
+	__u64 run_ns; /* out */
+	__u64 sent_ns; /* out */
+	__u64 done_ns; /* out */
+};
+
+/**
+ * struct amdxdna_drm_query_ctx_rq_stats - Runqueue statistics of a context.
+ * @ctx_handle: Context to query.
+ * @status: Runqueue state now, 0 disconnected, 1 waiting, 2 connected.
+ * @disconnected_ns: Time spent without a hardware context.
+ * @wait_ns: Time spent dispatched, waiting for a partition to connect.
+ * @connected_ns: Time spent holding a hardware context.
+ * @connects: Number of times connected to a partition.
+ * @disconnects: Number of times disconnected from a partition.
+ * @yields: Number of times swapped out, either idle or preempted.
+ * @preemptions: Number of those swap outs made for another context.
+ * @wait_hist: Dispatch wait histogram. Bucket 0 counts waits below 1 us,
+ *             bucket i counts waits in [2^(i-1), 2^i) us, the last bucket
+ *             counts all longer waits.
+ *
+ * Times include the current state up to the query. This parameter does not
+ * require root, only contexts of the caller can be queried.
+ */
+struct amdxdna_drm_query_ctx_rq_stats {
+	__u32 ctx_handle; /* in */
+	__u32 status; /* out */
+	__u64 disconnected_ns; /* out */
+	__u64 wait_ns; /* out */
+	__u64 connected_ns; /* out */
+	__u64 connects; /* out */
+	__u64 disconnects; /* out */
+	__u64 yields; /* out */
+	__u64 preemptions; /* out */
+#define AMDXDNA_RQ_WAIT_BUCKETS		16
+	__u64 wait_hist[AMDXDNA_RQ_WAIT_BUCKETS]; /* out */
+};
+
+/**
+ * struct amdxdna_drm_query_ctx_preempt - Preemption cost of a context.
+ * @ctx_handle: Context to query.
+ * @preempt_buf_size: Largest save plus restore buffer of its preemptible
+ *                    commands, in bytes.
+ * @preemptions: Number of times it was swapped out for another context.
+ * @preempt_cost_us: Average time to save and restore its hardware context.
+ *                   0 until it has been switched out and back in once.
+ *
+ * This parameter does not require root, only contexts of the caller can be
+ * queried.
+ */
+struct amdxdna_drm_query_ctx_preempt {
+	__u32 ctx_handle; /* in */
+	__u32 preempt_buf_size; /* out */
+	__u64 preemptions; /* out */
+	__u64 preempt_cost_us; /* out */
+};
+
 /**
  * struct amdxdna_drm_get_info - Get some information from the AIE hardware.
  * @param: Specifies the structure passed in the buffer.
@@ -514,6 +911,10 @@ struct amdxdna_drm_get_info {
 #define	DRM_AMDXDNA_GET_POWER_MODE		9
 #define	DRM_AMDXDNA_QUERY_TELEMETRY		10
 #define	DRM_AMDXDNA_GET_FORCE_PREEMPT_STATE	11
+#define	DRM_AMDXDNA_QUERY_JOB_TIMESTAMP		12
+#define	DRM_AMDXDNA_QUERY_CTX_RQ_STATS		13
+#define	DRM_AMDXDNA_READ_AIE_BATCH		14
+#define	DRM_AMDXDNA_QUERY_CTX_PREEMPT		15
 	__u32 param; /* in */
 	__u32 buffer_size; /* in/out */
 	__u64 buffer; /* in/out */
@@ -540,6 +941,89 @@ struct amdxdna_drm_set_force_preempt_state {
 	__u8 pad[7];
 };
 
+/**
+ * struct amdxdna_drm_set_prewarm - Hint that work is about to be submitted
+ * @ctx_handle: Context to connect ahead of its next submit.
+ *              AMDXDNA_INVALID_CTX_HANDLE to only bring up the device.
+ * @lead_us: Expected time in us until the work is submitted. At most the
+ *           driver's largest clock gating keep-warm window, -EINVAL otherwise.
+ *
+ * Device is resumed and clocks are raised before the call returns. This
+ * parameter does not require root.
+ */
+struct amdxdna_drm_set_prewarm {
+	__u32 ctx_handle;
+	__u32 lead_us;
+};
+
+/**
+ * struct amdxdna_drm_set_ctx_migrate - Move a context to other columns
+ * @ctx_handle: Context to move, owned by the caller.
+ * @start_col: New start column, one of the columns the context was
+ *             created with.
+ *
+ * A waiting context is moved right away. A running context is moved once
+ * its submitted commands complete, new submits wait until it reconnects.
+ */
+struct amdxdna_drm_set_ctx_migrate {
+	__u32 ctx_handle;
+	__u32 start_col;
+};
+
+/**
+ * struct amdxdna_drm_set_telemetry_ring - Sample telemetry into a ring
+ * @bo_handle: AMDXDNA_BO_SHARE BO holding the ring, mapped by the caller.
+ *             AMDXDNA_INVALID_BO_HANDLE to stop all rings of the caller.
+ * @type: Telemetry type, same as DRM_AMDXDNA_QUERY_TELEMETRY.
+ * @interval_ms: Sampling period in ms.
+ * @slot_size: Size of one slot in bytes, including the sample header.
+ *
+ * The BO starts with struct amdxdna_telemetry_ring_hdr, followed by
+ * nr_slots slots. Sample N is written to slot N % nr_slots. The driver
+ * stops sampling when the BO handle is closed.
+ */
+struct amdxdna_drm_set_telemetry_ring {
+	__u32 bo_handle;
+	__u32 type;
+	__u32 interval_ms;
+	__u32 slot_size;
+};
+
+/**
+ * struct amdxdna_telemetry_ring_hdr - Header of a telemetry ring
+ * @type: Telemetry type being sampled.
+ * @slot_size: Size of one slot in bytes.
+ * @nr_slots: Number of slots following the header.
+ * @pad: MBZ.
+ * @seq: Sequence number of the latest complete sample, 0 if none.
+ */
+struct amdxdna_telemetry_ring_hdr {
+	__u32 type;
+	__u32 slot_size;
+	__u32 nr_slots;
+	__u32 pad;
+	__u64 seq;
+};
+
+/**
+ * struct amdxdna_telemetry_sample - Header of one telemetry ring slot
+ * @seq: Sequence number of the sample in this slot.
+ * @timestamp_ns: CLOCK_MONOTONIC time the sample was taken.
+ * @major: Telemetry major version.
+ * @minor: Telemetry minor version.
+ * @data: Telemetry payload.
+ *
+ * The reader should re-check @seq after copying @data, the slot is being
+ * overwritten if it changed.
+ */
+struct amdxdna_telemetry_sample {
+	__u64 seq;
+	__u64 timestamp_ns;
+	__u32 major;
+	__u32 minor;
+	__u8 data[];
+};
+
 /**
  * struct amdxdna_drm_set_state - Set the state of some component within the AIE hardware.
  * @param: Specifies the structure passed in the buffer.
@@ -551,6 +1035,9 @@ struct amdxdna_drm_set_state {
 #define	DRM_AMDXDNA_WRITE_AIE_MEM		1
 #define	DRM_AMDXDNA_WRITE_AIE_REG		2
 #define	DRM_AMDXDNA_SET_FORCE_PREEMPT		3
+#define	DRM_AMDXDNA_SET_PREWARM			4
+#define	DRM_AMDXDNA_SET_TELEMETRY_RING		5
+#define	DRM_AMDXDNA_SET_CTX_MIGRATE		6
 	__u32 param; /* in */
 	__u32 buffer_size; /* in */
 	__u64 buffer; /* in */
@@ -580,6 +1067,10 @@ struct amdxdna_drm_set_state {
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SYNC_BO, \
 		 struct amdxdna_drm_sync_bo)
 
+#define DRM_IOCTL_AMDXDNA_SYNC_BOS \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_SYNC_BOS, \
+		 struct amdxdna_drm_sync_bos)
+
 #define DRM_IOCTL_AMDXDNA_EXEC_CMD \
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_AMDXDNA_EXEC_CMD, \
 		 struct amdxdna_drm_exec_cmd)
@@ -3,10 +3,156 @@
 
 #include "bo.h"
 #include "shim_debug.h"
+#include "core/common/config_reader.h"
+#include <atomic>
 #include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(_M_X64)
+  #include <cpuid.h>
+  #include <x86intrin.h>
+#endif
 
 namespace {
 
+#if defined(__x86_64__) || defined(_M_X64)
+struct cpu_flush_caps {
+  bool clflushopt = false;
+  bool clwb = false;
+};
+
+const cpu_flush_caps&
+get_cpu_flush_caps()
+{
+  static const cpu_flush_caps caps = [] {
+    cpu_flush_caps c;
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      c.clflushopt = ebx & bit_CLFLUSHOPT;
+      c.clwb = ebx & bit_CLWB;
+    }
+    return c;
+  }();
+  return caps;
+}
+#endif
+
+// Set on platforms where device DMA snoops CPU caches
+bool
+is_io_coherent()
+{
+  static bool coherent = xrt_core::config::detail::get_bool_value("Debug.io_coherent", false);
+  return coherent;
+}
+
+const size_t huge_page_size = 2 * 1024 * 1024;
+
+// Ask driver for huge page backed host memory for large BOs and the heap
+bool
+is_huge_page_bo(int type, size_t size)
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.huge_page_bo", false);
+
+  if (!enabled)
+    return false;
+  return type == AMDXDNA_BO_DEV_HEAP || (type == AMDXDNA_BO_SHARE && size >= huge_page_size);
+}
+
+// Shim orders all device access to SHARE BOs through command completion, the
+// driver does not need to add implicit fences for them.
+bool
+is_explicit_sync_bo(int type)
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.explicit_sync_bo", false);
+  return enabled && type == AMDXDNA_BO_SHARE;
+}
+
+// Attach debug BOs as rings which firmware keeps appending to, see
+// struct amdxdna_dbg_ring_hdr
+bool
+is_dbg_buf_stream()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.dbg_buf_stream", false);
+  return enabled;
+}
+
+// Place host pages of BOs on the NUMA node closest to the device
+bool
+is_numa_local_bo()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.numa_local_bo", false);
+  return enabled;
+}
+
+// Map BOs that device addresses directly on their first map() call
+bool
+is_lazy_bo_map()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.lazy_bo_map", false);
+  return enabled;
+}
+
+// Fault in and lock BO pages at mmap() time
+bool
+is_bo_map_locked()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.bo_map_locked", true);
+  return enabled;
+}
+
+// Temporarily prefer device's NUMA node for pages faulted in by this thread.
+// Driver BOs are shmem backed, so pages come from the calling task's memory
+// policy when they are pinned at creation or populated by mmap(MAP_LOCKED).
+class numa_local_scope
+{
+public:
+  explicit numa_local_scope(int node)
+  {
+    if (node < 0 || node >= max_nodes || !is_numa_local_bo())
+      return;
+    if (syscall(SYS_get_mempolicy, &m_mode, m_mask, max_nodes, nullptr, 0))
+      return;
+
+    unsigned long mask[max_nodes / bits_per_word] = {};
+    mask[node / bits_per_word] = 1UL << (node % bits_per_word);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, max_nodes))
+      return;
+    m_active = true;
+  }
+
+  ~numa_local_scope()
+  {
+    if (m_active)
+      syscall(SYS_set_mempolicy, m_mode, m_mask, max_nodes);
+  }
+
+  numa_local_scope(const numa_local_scope&) = delete;
+  numa_local_scope& operator=(const numa_local_scope&) = delete;
+
+private:
+  static constexpr int max_nodes = 1024;
+  static constexpr int bits_per_word = sizeof(unsigned long) * 8;
+
+  bool m_active = false;
+  int m_mode = MPOL_DEFAULT;
+  unsigned long m_mask[max_nodes / bits_per_word] = {};
+};
+
+long
+get_cacheline_size()
+{
+  static long cacheline_size = 0;
+
+  if (!cacheline_size) {
+    long sz = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    if (sz <= 0)
+      shim_err(EINVAL, "Invalid cache line size: %ld", sz);
+    cacheline_size = sz;
+  }
+  return cacheline_size;
+}
+
 void *
 map_parent_range(size_t size)
 {
@@ -30,12 +176,12 @@ unmap_drm_bo(const shim_xdna::pdev& dev, void* addr, size_t size)
 }
 
 void
-attach_dbg_drm_bo(const shim_xdna::pdev& dev, uint32_t boh, uint32_t ctx_id)
+attach_dbg_drm_bo(const shim_xdna::pdev& dev, uint32_t boh, uint32_t ctx_id, bool ring)
 {
   amdxdna_drm_config_ctx adbo = {
     .handle = ctx_id,
     .param_type = DRM_AMDXDNA_CTX_ASSIGN_DBG_BUF,
-    .param_val = boh,
+    .param_val = boh | (ring ? AMDXDNA_DBG_BUF_RING : 0),
   };
   dev.ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &adbo);
 }
@@ -67,9 +213,13 @@ import_drm_bo(const shim_xdna::pdev& dev, const shim_xdna::shared& share,
   drm_prime_handle imp_bo = {AMDXDNA_INVALID_BO_HANDLE, 0, fd};
   dev.ioctl(DRM_IOCTL_PRIME_FD_TO_HANDLE, &imp_bo);
 
+  // dma-buf inode size is the buffer size, saves seeking the fd back and forth
+  struct stat sb;
+  if (fstat(fd, &sb) == -1)
+    shim_err(errno, "fstat of dma-buf fd %d failed", fd);
+
   *type = AMDXDNA_BO_SHARE;
-  *size = lseek(fd, 0, SEEK_END);
-  lseek(fd, 0, SEEK_SET);
+  *size = sb.st_size;
 
   return imp_bo.handle;
 }
@@ -93,6 +243,46 @@ addr_align(void *p, size_t align)
 
 namespace shim_xdna {
 
+// clflushopt and clwb are weakly ordered, unlike clflush, so no serialization
+// per line. A single fence at the end orders them with later stores, e.g.
+// the doorbell. Same for aarch64 DC ops and the final DSB.
+void
+clflush_data(const void *base, size_t offset, size_t len, bool writeback_only)
+{
+  if (!len || is_io_coherent())
+    return;
+
+  const long line = get_cacheline_size();
+  const char *cur = reinterpret_cast<const char *>(
+    (reinterpret_cast<uintptr_t>(base) + offset) & ~(line - 1));
+  const char *end = reinterpret_cast<const char *>(base) + offset + len;
+
+#if defined(__x86_64__) || defined(_M_X64)
+  auto& caps = get_cpu_flush_caps();
+  if (writeback_only && caps.clwb) {
+    for (; cur < end; cur += line)
+      asm volatile("clwb %0" : "+m" (*(volatile char *)cur));
+    _mm_sfence();
+  } else if (caps.clflushopt) {
+    for (; cur < end; cur += line)
+      asm volatile("clflushopt %0" : "+m" (*(volatile char *)cur));
+    _mm_sfence();
+  } else {
+    for (; cur < end; cur += line)
+      _mm_clflush(cur);
+  }
+#elif defined(__aarch64__)
+  if (writeback_only) {
+    for (; cur < end; cur += line)
+      asm volatile("DC CVAC, %[addr]" : : [addr] "r" (cur) : "memory");
+  } else {
+    for (; cur < end; cur += line)
+      asm volatile("DC CIVAC, %[addr]" : : [addr] "r" (cur) : "memory");
+  }
+  asm volatile("DSB SY" : : : "memory");
+#endif
+}
+
 bo::drm_bo::
 drm_bo(bo& parent, const amdxdna_drm_get_bo_info& bo_info)
   : m_parent(parent)
@@ -174,9 +364,12 @@ mmap_bo()
     return;
   }
 
+  numa_local_scope numa(m_pdev.get_numa_node());
+  int flags = MAP_SHARED | (is_bo_map_locked() ? MAP_LOCKED : 0);
+
   if (m_alignment == 0) {
     m_aligned = map_drm_bo(m_pdev, nullptr, m_aligned_size, PROT_READ | PROT_WRITE,
-      MAP_SHARED | MAP_LOCKED, m_bo->m_map_offset);
+      flags, m_bo->m_map_offset);
     return;
   }
 
@@ -189,7 +382,29 @@ mmap_bo()
   m_parent = map_parent_range(m_parent_size);
   auto aligned = addr_align(m_parent, m_alignment);
   m_aligned = map_drm_bo(m_pdev, aligned, m_aligned_size, PROT_READ | PROT_WRITE,
-    MAP_SHARED | MAP_LOCKED | MAP_FIXED, m_bo->m_map_offset);
+    flags | MAP_FIXED, m_bo->m_map_offset);
+}
+
+void
+bo::
+mmap_bo_lazy()
+{
+  // Device only needs xdna_addr, host gets its mapping when it asks for it
+  if (is_lazy_bo_map() &&
+    (m_type == AMDXDNA_BO_DEV || m_type == AMDXDNA_BO_SHARE) &&
+    m_bo->m_map_offset != AMDXDNA_INVALID_ADDR &&
+    m_bo->m_xdna_addr != AMDXDNA_INVALID_ADDR) {
+    m_lazy_map = true;
+    return;
+  }
+  mmap_bo();
+}
+
+bool
+bo::
+is_mapped() const
+{
+  return !m_lazy_map || m_mapped.load(std::memory_order_acquire);
 }
 
 void
@@ -197,7 +412,7 @@ bo::
 munmap_bo()
 {
   shim_debug("Unmap BO, aligned %p parent %p", m_aligned, m_parent);
-  if (m_bo->m_map_offset == AMDXDNA_INVALID_ADDR)
+  if (m_bo->m_map_offset == AMDXDNA_INVALID_ADDR || !is_mapped())
       return;
 
   unmap_drm_bo(m_pdev, m_aligned, m_aligned_size);
@@ -209,6 +424,7 @@ void
 bo::
 alloc_bo()
 {
+  numa_local_scope numa(m_pdev.get_numa_node());
   uint32_t boh = alloc_drm_bo(m_type, m_aligned_size);
 
   amdxdna_drm_get_bo_info bo_info = {};
@@ -239,11 +455,73 @@ free_bo()
   m_bo.reset();
 }
 
+bo::drm_bo_state
+bo::
+release_drm_bo()
+{
+  drm_bo_state st = {};
+
+  st.info.handle = m_bo->m_handle;
+  st.info.map_offset = m_bo->m_map_offset;
+  st.info.vaddr = m_bo->m_vaddr;
+  st.info.xdna_addr = m_bo->m_xdna_addr;
+  st.addr = m_aligned;
+  st.size = m_aligned_size;
+
+  // Keep drm_bo destructor from closing the handle
+  m_bo->m_handle = AMDXDNA_INVALID_BO_HANDLE;
+  m_bo.reset();
+  m_aligned = nullptr;
+  return st;
+}
+
+bo::drm_bo_state
+bo::
+get_drm_bo_state(size_t offset) const
+{
+  drm_bo_state st = {};
+
+  st.info.handle = m_bo->m_handle;
+  st.info.map_offset = m_bo->m_map_offset;
+  st.info.vaddr = m_bo->m_vaddr;
+  if (st.info.vaddr != AMDXDNA_INVALID_ADDR)
+    st.info.vaddr += offset;
+  st.info.xdna_addr = m_bo->m_xdna_addr;
+  if (st.info.xdna_addr != AMDXDNA_INVALID_ADDR)
+    st.info.xdna_addr += offset;
+  st.addr = static_cast<char *>(m_aligned) + offset;
+  st.size = m_aligned_size - offset;
+  return st;
+}
+
+bo::drm_bo_state
+bo::
+release_drm_bo_mapping()
+{
+  auto st = release_drm_bo();
+  if (m_parent) {
+    st.addr = m_parent;
+    st.size = m_parent_size;
+    m_parent = nullptr;
+  }
+  return st;
+}
+
+void
+bo::
+adopt_drm_bo(const drm_bo_state& st)
+{
+  m_bo = std::make_unique<bo::drm_bo>(*this, st.info);
+  m_aligned = st.addr;
+  m_aligned_size = st.size;
+}
+
 bo::
 bo(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
   size_t size, uint64_t flags, int type)
   : m_pdev(pdev)
   , m_aligned_size(size)
+  , m_size(size)
   , m_flags(flags)
   , m_type(type)
   , m_import(-1)
@@ -252,6 +530,14 @@ bo(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
   // Device mem heap must align at 64MB boundary.
   if (m_type == AMDXDNA_BO_DEV_HEAP)
     m_alignment = 64 * 1024 * 1024;
+
+  // Huge pages can only be mapped at huge page aligned address.
+  if (is_huge_page_bo(m_type, m_aligned_size)) {
+    m_huge_page = true;
+    m_aligned_size = (m_aligned_size + huge_page_size - 1) & ~(huge_page_size - 1);
+    if (m_alignment < huge_page_size)
+      m_alignment = huge_page_size;
+  }
 }
 
 bo::
@@ -266,11 +552,30 @@ bo::
 {
 }
 
+void
+bo::
+set_cmd_hold(std::shared_ptr<cmd_hold> hold)
+{
+  m_cmd_hold = std::move(hold);
+}
+
+void
+bo::
+release_cmd_hold()
+{
+  if (!m_cmd_hold)
+    return;
+
+  std::lock_guard<std::mutex> lg(m_cmd_hold->lock);
+  if (m_cmd_hold->holder)
+    m_cmd_hold->holder->release_cmd(this);
+}
+
 bo::properties
 bo::
 get_properties() const
 {
-  return { m_flags, m_aligned_size, get_paddr(), get_drm_bo_handle() };
+  return { m_flags, m_size ? m_size : m_aligned_size, get_paddr(), get_drm_bo_handle() };
 }
 
 void*
@@ -279,6 +584,13 @@ map(bo::map_type type)
 {
   if (type != bo::map_type::write)
     shim_err(EINVAL, "Not support map BO as readonly. Type must be bo::map_type::write");
+  if (m_lazy_map) {
+    std::call_once(m_map_once, [this] {
+      mmap_bo();
+      m_mapped.store(true, std::memory_order_release);
+      shim_debug("Mapped BO on demand, %s", describe().c_str());
+    });
+  }
   return m_aligned;
 }
 
@@ -326,8 +638,9 @@ attach_to_ctx()
     return;
 
   auto boh = get_drm_bo_handle();
-  shim_debug("Attaching drm_bo %d to ctx: %d", boh, m_owner_ctx_id);
-  attach_dbg_drm_bo(m_pdev, boh, m_owner_ctx_id);
+  m_dbg_ring = is_dbg_buf_stream() && xcl_bo_flags{m_flags}.use == XRT_BO_USE_DEBUG;
+  shim_debug("Attaching drm_bo %d to ctx: %d%s", boh, m_owner_ctx_id, m_dbg_ring ? " as ring" : "");
+  attach_dbg_drm_bo(m_pdev, boh, m_owner_ctx_id, m_dbg_ring);
 }
 
 void
@@ -363,13 +676,53 @@ uint32_t
 bo::
 alloc_drm_bo(int type, size_t size)
 {
+  // Cleared once driver turns out not to know the flag
+  static std::atomic<bool> explicit_sync = true;
+  static std::atomic<bool> huge_page = true;
   amdxdna_drm_create_bo cbo = {
+    .flags = 0,
     .udma_fd = 0,
     .size = size,
     .type = static_cast<uint32_t>(type),
   };
-  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CREATE_BO, &cbo);
-  return cbo.handle;
+
+  if (m_huge_page && huge_page)
+    cbo.flags |= AMDXDNA_BO_FLAG_HUGE_PAGE;
+  if (explicit_sync && is_explicit_sync_bo(type))
+    cbo.flags |= AMDXDNA_BO_FLAG_EXPLICIT_SYNC;
+
+  // Older drivers reject flags they don't know with EINVAL, drop optional
+  // ones one by one. A flag is only given up on if the retry works.
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CREATE_BO, &cbo);
+    return cbo.handle;
+  } catch (const xrt_core::system_error& e) {
+    if (e.get_code() != EINVAL || !cbo.flags)
+      throw;
+
+    for (auto flag : { AMDXDNA_BO_FLAG_EXPLICIT_SYNC, AMDXDNA_BO_FLAG_HUGE_PAGE }) {
+      if (!(cbo.flags & flag))
+        continue;
+      cbo.flags &= ~flag;
+      try {
+        m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CREATE_BO, &cbo);
+      } catch (const xrt_core::system_error& e2) {
+        if (e2.get_code() != EINVAL)
+          throw;
+        continue;
+      }
+      if (flag == AMDXDNA_BO_FLAG_EXPLICIT_SYNC) {
+        shim_debug("Explicit sync BO not supported by driver");
+        explicit_sync = false;
+      } else {
+        shim_debug("Huge page BO not supported by driver");
+        huge_page = false;
+        m_huge_page = false;
+      }
+      return cbo.handle;
+    }
+    throw;
+  }
 }
 
 void
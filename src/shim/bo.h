@@ -16,53 +16,19 @@
 #include "drm_local/amdxdna_accel.h"
 #include <string>
 #include <atomic>
-#if defined(__x86_64__) || defined(_M_X64)
-  #include <x86intrin.h>
-#endif
-
-namespace {
-  
-inline void flush_cache_line(const char *cur)
-{
-#if defined(__x86_64__) || defined(_M_X64)
-  _mm_clflush(cur);
-#elif defined(__aarch64__)
-  asm volatile(
-    "DC CIVAC, %[addr]\n"  // Clean and invalidate data cache
-    "DSB SY\n"             // Data Synchronization Barrier
-    "ISB SY\n"             // Instruction Synchronization Barrier
-    :
-    : [addr] "r" (cur)
-    : "memory"
-  );
-#endif
-}
-
-}
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace shim_xdna {
 
-// flash cache line for non coherence memory
-inline void
-clflush_data(const void *base, size_t offset, size_t len)
-{
-  static long cacheline_size = 0;
-
-  if (!cacheline_size) {
-    long sz = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
-    if (sz <= 0)
-      shim_err(EINVAL, "Invalid cache line size: %ld", sz);
-    cacheline_size = sz;
-  }
-
-  const char *cur = (const char *)base;
-  cur += offset;
-  uintptr_t lastline = (uintptr_t)(cur + len - 1) | (cacheline_size - 1);
-  do {
-    flush_cache_line(cur);
-    cur += cacheline_size;
-  } while (cur <= (const char *)lastline);
-}
+// Flush cache lines covering the range for non coherent memory. With
+// writeback_only, lines may be cleaned without being invalidated, which is
+// enough to make CPU writes visible to device. No-op on I/O coherent
+// platforms.
+void
+clflush_data(const void *base, size_t offset, size_t len, bool writeback_only = false);
 
 class bo : public xrt_core::buffer_handle
 {
@@ -107,6 +73,40 @@ public:
   int 
   get_type() const;
 
+  // DRM BO and its mapping, detached from any bo object so that it can be
+  // parked in a pool and adopted by a later bo of the same size.
+  struct drm_bo_state {
+    amdxdna_drm_get_bo_info info;
+    void *addr;
+    size_t size;
+  };
+
+  // Snapshot of DRM BO and mapping at offset, ownership is not transferred
+  drm_bo_state
+  get_drm_bo_state(size_t offset) const;
+
+  // Queue still keeping a cmd BO after submit returned, e.g. to chain it or
+  // to send it later. It is told when the BO goes away before it let go.
+  class cmd_holder {
+  public:
+    virtual ~cmd_holder() = default;
+
+    // cmd is being destroyed, drop every reference to it
+    virtual void
+    release_cmd(bo *cmd) = 0;
+  };
+
+  // Shared by a holder and the cmd BOs it keeps. Holder clears it before
+  // it goes away, a BO destroyed after that has nobody to tell.
+  struct cmd_hold {
+    std::mutex lock;
+    cmd_holder *holder = nullptr;
+  };
+
+  // For cmd BO only, called by the holder before keeping the BO
+  void
+  set_cmd_hold(std::shared_ptr<cmd_hold> hold);
+
 protected:
   std::string
   describe() const;
@@ -129,6 +129,14 @@ protected:
   void
   munmap_bo();
 
+  // Like mmap_bo(), but may defer it to the first map() call
+  void
+  mmap_bo_lazy();
+
+  // False only while a deferred mapping has not been made yet
+  bool
+  is_mapped() const;
+
   uint64_t
   get_paddr() const;
 
@@ -141,15 +149,40 @@ protected:
   void
   detach_from_ctx();
 
+  // Give up ownership of DRM BO and mapping, this bo becomes empty
+  drm_bo_state
+  release_drm_bo();
+
+  // Take over a previously released DRM BO and mapping
+  void
+  adopt_drm_bo(const drm_bo_state& st);
+
+  // First thing in destructors of cmd BOs, holder may still use the BO
+  // until this returns
+  void
+  release_cmd_hold();
+
+  // Like release_drm_bo(), but the returned mapping covers the whole range
+  // reserved for alignment, so that munmap of it undoes mmap_bo()
+  drm_bo_state
+  release_drm_bo_mapping();
+
   const pdev& m_pdev;
   void* m_aligned = nullptr;
   size_t m_aligned_size = 0;
+  // Size asked for by caller, m_aligned_size may be rounded up to a pool,
+  // slab or huge page class. 0 for imported BOs.
+  size_t m_size = 0;
   size_t m_alignment = 0;
   uint64_t m_flags = 0;
   int m_type = AMDXDNA_BO_INVALID;
   // Used when exclusively assigned to a HW context. By default, BO is shared
   // among all HW contexts.
   xrt_core::hwctx_handle::slot_id m_owner_ctx_id = AMDXDNA_INVALID_CTX_HANDLE;
+  // Backed by huge pages if driver supports it
+  bool m_huge_page = false;
+  // Attached to m_owner_ctx_id as debug ring
+  bool m_dbg_ring = false;
 
 private:
   // DRM BO managed by driver.
@@ -172,6 +205,13 @@ private:
   // Command ID in the queue after command submission.
   // Only valid for cmd BO.
   uint64_t m_cmd_id = -1;
+  // Queue keeping this cmd BO, see set_cmd_hold()
+  std::shared_ptr<cmd_hold> m_cmd_hold;
+
+  // Deferred mapping, see mmap_bo_lazy()
+  bool m_lazy_map = false;
+  std::once_flag m_map_once;
+  std::atomic<bool> m_mapped = false;
 
   virtual uint32_t
   alloc_drm_bo(int type, size_t size);
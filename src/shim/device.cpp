@@ -7,10 +7,17 @@
 #include "fence.h"
 #include "smi.h"
 
+#include "core/common/config_reader.h"
 #include "core/common/query_requests.h"
 
 #include <any>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <string_view>
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -1057,8 +1064,37 @@ template <typename QueryRequestType, typename GetPut>
 struct function0_getput : function0_get<QueryRequestType, GetPut>, function_putter<QueryRequestType, GetPut>
 {};
 
+// Memoizes the result in the device object, ttl 0 keeps it for the life of the device
+template <typename QueryRequestType, typename Base>
+struct cached_get : Base
+{
+  std::chrono::milliseconds ttl;
+
+  template <typename... Args>
+  cached_get(std::chrono::milliseconds t, Args&&... args)
+    : Base(std::forward<Args>(args)...), ttl(t)
+  {}
+
+  using Base::get;
+
+  std::any
+  get(const xrt_core::device* device) const
+  {
+    auto device_impl = dynamic_cast<const shim_xdna::device*>(device);
+    if (!device_impl)
+      return Base::get(device);
+    return device_impl->get_cached_query(QueryRequestType::key, ttl,
+      [this, device] { return Base::get(device); });
+  }
+};
+
 static std::map<xrt_core::query::key_type, std::unique_ptr<query::request>> query_tbl;
 
+// Queries XRT repeats e.g. on each context creation, values never change
+const std::chrono::milliseconds forever(0);
+// Values that change at runtime, e.g. with power mode, still cached briefly
+const std::chrono::milliseconds short_ttl(100);
+
 template <typename QueryRequestType>
 static void
 emplace_sysfs_get(const char* subdev, const char* entry)
@@ -1067,6 +1103,24 @@ emplace_sysfs_get(const char* subdev, const char* entry)
   query_tbl.emplace(x, std::make_unique<sysfs_get<QueryRequestType>>(subdev, entry));
 }
 
+template <typename QueryRequestType>
+static void
+emplace_cached_sysfs_get(const char* subdev, const char* entry, std::chrono::milliseconds ttl)
+{
+  auto x = QueryRequestType::key;
+  query_tbl.emplace(x, std::make_unique<cached_get<QueryRequestType, sysfs_get<QueryRequestType>>>
+    (ttl, subdev, entry));
+}
+
+template <typename QueryRequestType, typename Getter>
+static void
+emplace_cached_func0_request(std::chrono::milliseconds ttl)
+{
+  auto k = QueryRequestType::key;
+  query_tbl.emplace(k, std::make_unique<cached_get<QueryRequestType,
+    function0_get<QueryRequestType, Getter>>>(ttl));
+}
+
 template <typename QueryRequestType, typename Getter>
 static void
 emplace_func0_request()
@@ -1095,26 +1149,26 @@ static void
 initialize_query_table()
 {
   emplace_func0_request<query::aie_partition_info,             partition_info>();
-  emplace_func0_request<query::aie_status_version,             aie_info>();
-  emplace_func0_request<query::aie_tiles_stats,                aie_info>();
+  emplace_cached_func0_request<query::aie_status_version,      aie_info>(forever);
+  emplace_cached_func0_request<query::aie_tiles_stats,         aie_info>(forever);
   emplace_func1_request<query::aie_tiles_status_info,          aie_info>();
-  emplace_func0_request<query::clock_freq_topology_raw,        clock_topology>();
+  emplace_cached_func0_request<query::clock_freq_topology_raw, clock_topology>(short_ttl);
   emplace_func0_request<query::device_class,                   default_value>();
   emplace_func0_request<query::instance,                       instance>();
   emplace_func0_request<query::is_ready,                       default_value>();
   emplace_func0_request<query::is_versal,                      default_value>();
   emplace_func0_request<query::logic_uuids,                    default_value>();
   emplace_func0_request<query::pcie_bdf,                       bdf>();
-  emplace_func0_request<query::pcie_id,                        pcie_id>();
-  emplace_func0_request<query::total_cols,                     total_cols>();
-  emplace_sysfs_get<query::pcie_device>                        ("", "device");
-  emplace_sysfs_get<query::pcie_express_lane_width>            ("", "link_width");
-  emplace_sysfs_get<query::pcie_express_lane_width_max>        ("", "link_width_max");
-  emplace_sysfs_get<query::pcie_link_speed>                    ("", "link_speed");
-  emplace_sysfs_get<query::pcie_link_speed_max>                ("", "link_speed_max");
-  emplace_sysfs_get<query::pcie_subsystem_id>                  ("", "subsystem_device");
-  emplace_sysfs_get<query::pcie_subsystem_vendor>              ("", "subsystem_vendor");
-  emplace_sysfs_get<query::pcie_vendor>                        ("", "vendor");
+  emplace_cached_func0_request<query::pcie_id,                 pcie_id>(forever);
+  emplace_cached_func0_request<query::total_cols,              total_cols>(forever);
+  emplace_cached_sysfs_get<query::pcie_device>                 ("", "device", forever);
+  emplace_cached_sysfs_get<query::pcie_express_lane_width>     ("", "link_width", short_ttl);
+  emplace_cached_sysfs_get<query::pcie_express_lane_width_max> ("", "link_width_max", forever);
+  emplace_cached_sysfs_get<query::pcie_link_speed>             ("", "link_speed", short_ttl);
+  emplace_cached_sysfs_get<query::pcie_link_speed_max>         ("", "link_speed_max", forever);
+  emplace_cached_sysfs_get<query::pcie_subsystem_id>           ("", "subsystem_device", forever);
+  emplace_cached_sysfs_get<query::pcie_subsystem_vendor>       ("", "subsystem_vendor", forever);
+  emplace_cached_sysfs_get<query::pcie_vendor>                 ("", "vendor", forever);
 
   emplace_func0_getput<query::performance_mode,                performance_mode>();
   emplace_func0_getput<query::preemption,                      preemption>();
@@ -1126,19 +1180,264 @@ initialize_query_table()
 
   emplace_func0_request<query::rom_ddr_bank_count_max,         default_value>();
   emplace_func0_request<query::rom_ddr_bank_size_gb,           default_value>();
-  emplace_sysfs_get<query::rom_vbnv>                           ("", "vbnv");
+  emplace_cached_sysfs_get<query::rom_vbnv>                    ("", "vbnv", forever);
   emplace_func1_request<query::sdm_sensor_info,                sensor_info>();
   emplace_func1_request<query::sequence_name,                  sequence_name>();
   emplace_func1_request<query::elf_name,                       elf_name>();
   emplace_func1_request<query::xclbin_name,                    xclbin_name>();
   emplace_func1_request<query::xrt_smi_config,                 xrt_smi_config>();
   emplace_func1_request<query::xrt_smi_lists,                  xrt_smi_lists>();
-  emplace_func0_request<query::firmware_version,               firmware_version>();
+  emplace_cached_func0_request<query::firmware_version,        firmware_version>(forever);
+}
+
+// Handed out instead of a context that lives somewhere else than a plain
+// context would: parked in the device pool on release, or created on a peer
+// NPU of the device group. Everything else goes to the real context.
+class hw_ctx_wrapper : public xrt_core::hwctx_handle
+{
+public:
+  // Context on a peer NPU, the peer is kept open while the context lives
+  hw_ctx_wrapper(std::shared_ptr<xrt_core::device> peer,
+                 std::unique_ptr<xrt_core::hwctx_handle> ctx)
+    : m_peer(std::move(peer))
+    , m_ctx(std::move(ctx))
+  {}
+
+  // Context given back to the pool of dev under key when released
+  hw_ctx_wrapper(const shim_xdna::device& dev, std::string key,
+                 std::unique_ptr<xrt_core::hwctx_handle> ctx)
+    : m_pool(&dev)
+    , m_key(std::move(key))
+    , m_ctx(std::move(ctx))
+  {}
+
+  ~hw_ctx_wrapper()
+  {
+    // Key promises the QoS and access mode the context was created with
+    if (m_pool && m_recycle)
+      m_pool->put_pooled_ctx(m_key, std::move(m_ctx));
+  }
+
+  void
+  update_qos(const qos_type& qos) override
+  {
+    m_recycle = false;
+    m_ctx->update_qos(qos);
+  }
+
+  void
+  update_access_mode(access_mode mode) override
+  {
+    m_recycle = false;
+    m_ctx->update_access_mode(mode);
+  }
+
+  slot_id
+  get_slotidx() const override
+  { return m_ctx->get_slotidx(); }
+
+  xrt_core::hwqueue_handle*
+  get_hw_queue() override
+  { return m_ctx->get_hw_queue(); }
+
+  std::unique_ptr<xrt_core::buffer_handle>
+  alloc_bo(void* userptr, size_t size, uint64_t flags) override
+  { return m_ctx->alloc_bo(userptr, size, flags); }
+
+  std::unique_ptr<xrt_core::buffer_handle>
+  alloc_bo(size_t size, uint64_t flags) override
+  { return m_ctx->alloc_bo(size, flags); }
+
+  std::unique_ptr<xrt_core::buffer_handle>
+  import_bo(pid_t pid, xrt_core::shared_handle::export_handle ehdl) override
+  { return m_ctx->import_bo(pid, ehdl); }
+
+  xrt_core::cuidx_type
+  open_cu_context(const std::string& cuname) override
+  { return m_ctx->open_cu_context(cuname); }
+
+  void
+  close_cu_context(xrt_core::cuidx_type cuidx) override
+  { m_ctx->close_cu_context(cuidx); }
+
+  void
+  exec_buf(xrt_core::buffer_handle *cmd) override
+  { m_ctx->exec_buf(cmd); }
+
+private:
+  // Declared first, the context is destroyed before its device
+  std::shared_ptr<xrt_core::device> m_peer;
+  const shim_xdna::device* m_pool = nullptr;
+  std::string m_key;
+  bool m_recycle = true;
+  std::unique_ptr<xrt_core::hwctx_handle> m_ctx;
+};
+
+size_t
+get_ctx_pool_size()
+{
+  static size_t size = xrt_core::config::detail::get_uint_value("Debug.hwctx_pool_size", 0);
+  return size;
+}
+
+// Contexts are interchangeable only with the same xclbin and QoS
+std::string
+get_ctx_pool_key(const xrt::uuid& uuid, const xrt::hw_context::qos_type& qos)
+{
+  auto key = uuid.to_string();
+  for (auto& [k, v] : qos)
+    key += ";" + k + "=" + std::to_string(v);
+  return key;
+}
+
+// Opt-in, spreads processes over all NPUs of the same kind by current load
+bool
+is_device_group()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.device_group", false);
+  return enabled;
+}
+
+// Contexts of all processes on the device, each plus its outstanding
+// commands, as seen by the driver's runqueue
+size_t
+get_device_load(const xrt_core::device* dev)
+{
+  size_t load = 0;
+
+  try {
+    auto ctxs = xrt_core::device_query<query::aie_partition_info>(dev);
+    for (auto& c : ctxs)
+      load += 1 + (c.command_submissions - c.command_completions);
+  }
+  catch (const std::exception& ex) {
+    shim_debug("Failed to get load of device %u: %s", dev->get_device_id(), ex.what());
+    return std::numeric_limits<size_t>::max();
+  }
+  return load;
+}
+
+// Peers are opened once per device and kept open for the life of the process
+const std::vector< std::shared_ptr<xrt_core::device> >&
+get_group_peers(const shim_xdna::device& dev)
+{
+  static std::mutex lock;
+  static std::map<xrt_core::device::id_type,
+    std::vector< std::shared_ptr<xrt_core::device> >> groups;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto [it, added] = groups.try_emplace(dev.get_device_id());
+  auto& peers = it->second;
+  if (!added)
+    return peers;
+
+  auto vendor = xrt_core::device_query<query::pcie_vendor>(&dev);
+  auto device_id = xrt_core::device_query<query::pcie_device>(&dev);
+  auto total = xrt_core::get_total_devices(true).first;
+  for (xrt_core::device::id_type id = 0; id < total; id++) {
+    if (id == dev.get_device_id())
+      continue;
+    try {
+      auto peer = xrt_core::get_userpf_device(id);
+      // Same kind of NPU, so the xclbin loads on either
+      if (!std::dynamic_pointer_cast<shim_xdna::device>(peer) ||
+          xrt_core::device_query<query::pcie_vendor>(peer.get()) != vendor ||
+          xrt_core::device_query<query::pcie_device>(peer.get()) != device_id)
+        continue;
+      peers.push_back(std::move(peer));
+    }
+    catch (const std::exception& ex) {
+      shim_debug("Skip device %u in group: %s", id, ex.what());
+    }
+  }
+  return peers;
+}
+
+// Least loaded peer, nullptr if dev itself is no busier than any of them
+std::shared_ptr<xrt_core::device>
+select_group_peer(const shim_xdna::device& dev)
+{
+  std::shared_ptr<xrt_core::device> best;
+  auto best_load = get_device_load(&dev);
+
+  for (auto& peer : get_group_peers(dev)) {
+    auto load = get_device_load(peer.get());
+    if (load < best_load) {
+      best = peer;
+      best_load = load;
+    }
+  }
+  return best;
 }
 
 struct X { X() { initialize_query_table(); }};
 static X x;
 
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_getfd)
+// A pidfd keeps referring to the process it was opened for, even after the
+// pid is reused, so it can be kept around for repeated imports from a peer
+struct pidfd_handle
+{
+  pid_t pid;
+  int fd;
+
+  explicit pidfd_handle(pid_t p) : pid(p)
+  {
+    fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd < 0)
+      throw xrt_core::system_error(errno, "pidfd_open failed");
+  }
+
+  ~pidfd_handle()
+  {
+    close(fd);
+  }
+};
+
+// Most recently used peers first, the least recent is closed beyond max_peers
+class pidfd_cache
+{
+  static constexpr size_t max_peers = 16;
+
+  std::mutex m_lock;
+  std::list< std::shared_ptr<pidfd_handle> > m_peers;
+
+public:
+  std::shared_ptr<pidfd_handle>
+  get(pid_t pid)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    for (auto it = m_peers.begin(); it != m_peers.end(); ++it) {
+      if ((*it)->pid == pid) {
+        m_peers.splice(m_peers.begin(), m_peers, it);
+        return m_peers.front();
+      }
+    }
+
+    m_peers.push_front(std::make_shared<pidfd_handle>(pid));
+    if (m_peers.size() > max_peers)
+      m_peers.pop_back();
+    return m_peers.front();
+  }
+
+  // Peer exited, users still holding it close it when they are done
+  void
+  drop(const std::shared_ptr<pidfd_handle>& peer)
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_peers.remove(peer);
+  }
+};
+
+pidfd_cache&
+get_pidfd_cache()
+{
+  static pidfd_cache cache;
+  return cache;
+}
+#endif
+
 int
 import_fd(pid_t pid, int ehdl)
 {
@@ -1146,11 +1445,16 @@ import_fd(pid_t pid, int ehdl)
     return ehdl;
 
 #if defined(SYS_pidfd_open) && defined(SYS_pidfd_getfd)
-  auto pidfd = syscall(SYS_pidfd_open, pid, 0);
-  if (pidfd < 0)
-    throw xrt_core::system_error(errno, "pidfd_open failed");
-
-  auto fd = syscall(SYS_pidfd_getfd, pidfd, ehdl, 0);
+  auto& cache = get_pidfd_cache();
+  auto peer = cache.get(pid);
+
+  auto fd = syscall(SYS_pidfd_getfd, peer->fd, ehdl, 0);
+  if (fd < 0 && errno == ESRCH) {
+    // Cached process is gone, the pid may belong to a new one by now
+    cache.drop(peer);
+    peer = cache.get(pid);
+    fd = syscall(SYS_pidfd_getfd, peer->fd, ehdl, 0);
+  }
   if (fd < 0) {
     if (errno == EPERM) {
       throw xrt_core::system_error
@@ -1200,6 +1504,8 @@ device(const pdev& pdev, handle_type shim_handle, id_type device_id)
 device::
 ~device()
 {
+  // Parked contexts still use the device
+  m_ctx_pool.clear();
   m_pdev.close();
 }
 
@@ -1211,6 +1517,84 @@ get_pdev() const
   return m_pdev;
 }
 
+std::any
+device::
+get_cached_query(xrt_core::query::key_type key, std::chrono::milliseconds ttl,
+  const std::function<std::any()>& fetch) const
+{
+  auto now = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> lock(m_query_cache_lock);
+    auto it = m_query_cache.find(key);
+    if (it != m_query_cache.end() && (!ttl.count() || now - it->second.first < ttl))
+      return it->second.second;
+  }
+
+  // Not under the lock, sysfs and ioctl may be slow. Failures are not cached.
+  auto value = fetch();
+  std::lock_guard<std::mutex> lock(m_query_cache_lock);
+  m_query_cache[key] = { now, value };
+  return value;
+}
+
+std::shared_ptr<xclbin_parse>
+device::
+get_xclbin_parse(const xrt::xclbin& xclbin,
+  const std::function<std::shared_ptr<xclbin_parse>()>& parse) const
+{
+  auto uuid = xclbin.get_uuid().to_string();
+  std::lock_guard<std::mutex> lock(m_xclbin_lock);
+
+  if (auto xp = m_xclbin_cache[uuid].lock()) {
+    shim_debug("Reusing parsed xclbin %s", uuid.c_str());
+    return xp;
+  }
+
+  for (auto it = m_xclbin_cache.begin(); it != m_xclbin_cache.end();) {
+    if (it->second.expired() && it->first != uuid)
+      it = m_xclbin_cache.erase(it);
+    else
+      ++it;
+  }
+  auto xp = parse();
+  m_xclbin_cache[uuid] = xp;
+  return xp;
+}
+
+std::shared_ptr<xrt_core::buffer_handle>
+device::
+get_pdi_bo(const std::vector<uint8_t>& pdi,
+  const std::function<std::unique_ptr<xrt_core::buffer_handle>()>& alloc) const
+{
+  auto hash = std::hash<std::string_view>{}(
+    std::string_view(reinterpret_cast<const char *>(pdi.data()), pdi.size()));
+  std::lock_guard<std::mutex> lock(m_pdi_lock);
+
+  auto [first, last] = m_pdi_cache.equal_range(hash);
+  for (auto it = first; it != last;) {
+    auto bo = it->second.bo.lock();
+    if (!bo) {
+      it = m_pdi_cache.erase(it);
+      continue;
+    }
+    // Same hash is not enough, a collision must not run someone else's PDI
+    auto vaddr = bo->map(xrt_core::buffer_handle::map_type::write);
+    if (it->second.size == pdi.size() && !std::memcmp(vaddr, pdi.data(), pdi.size())) {
+      shim_debug("Reusing PDI BO (%ld bytes)", pdi.size());
+      return bo;
+    }
+    ++it;
+  }
+
+  std::shared_ptr<xrt_core::buffer_handle> bo = alloc();
+  auto vaddr = bo->map(xrt_core::buffer_handle::map_type::write);
+  std::memcpy(vaddr, pdi.data(), pdi.size());
+  bo->sync(xrt_core::buffer_handle::direction::host2device, bo->get_properties().size, 0);
+  m_pdi_cache.emplace(hash, pdi_entry{ pdi.size(), bo });
+  return bo;
+}
+
 void
 device::
 close_device()
@@ -1232,12 +1616,79 @@ register_xclbin(const xrt::xclbin& xclbin) const
   // loaded by create_hw_context
 }
 
+std::shared_ptr<xrt_core::device>
+device::
+get_group_peer() const
+{
+  if (!is_device_group())
+    return nullptr;
+
+  std::call_once(m_group_once, [this] {
+    m_group_peer = select_group_peer(*this);
+    if (m_group_peer)
+      shim_debug("Device %u placed on device %u", get_device_id(), m_group_peer->get_device_id());
+  });
+  return m_group_peer;
+}
+
 std::unique_ptr<xrt_core::hwctx_handle>
 device::
 create_hw_context(const xrt::uuid& xclbin_uuid, const xrt::hw_context::qos_type& qos,
   xrt::hw_context::access_mode mode) const
 {
-  return create_hw_context(*this, get_xclbin(xclbin_uuid), qos);
+  auto xclbin = get_xclbin(xclbin_uuid);
+
+  if (auto peer = get_group_peer()) {
+    auto& p = static_cast<const device&>(*peer);
+    return std::make_unique<hw_ctx_wrapper>(std::move(peer), p.create_pooled_hw_context(xclbin, qos));
+  }
+  return create_pooled_hw_context(xclbin, qos);
+}
+
+std::unique_ptr<xrt_core::hwctx_handle>
+device::
+create_pooled_hw_context(const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos) const
+{
+  if (!get_ctx_pool_size())
+    return create_hw_context(*this, xclbin, qos);
+
+  auto key = get_ctx_pool_key(xclbin.get_uuid(), qos);
+  auto ctx = take_pooled_ctx(key);
+  if (!ctx)
+    ctx = create_hw_context(*this, xclbin, qos);
+  return std::make_unique<hw_ctx_wrapper>(*this, std::move(key), std::move(ctx));
+}
+
+std::unique_ptr<xrt_core::hwctx_handle>
+device::
+take_pooled_ctx(const std::string& key) const
+{
+  std::lock_guard<std::mutex> lock(m_ctx_pool_lock);
+  auto it = m_ctx_pool.find(key);
+
+  if (it == m_ctx_pool.end() || it->second.empty())
+    return nullptr;
+
+  auto ctx = std::move(it->second.back());
+  it->second.pop_back();
+  shim_debug("Reusing pooled HW context (%d)", ctx->get_slotidx());
+  return ctx;
+}
+
+void
+device::
+put_pooled_ctx(const std::string& key, std::unique_ptr<xrt_core::hwctx_handle> ctx) const
+{
+  {
+    std::lock_guard<std::mutex> lock(m_ctx_pool_lock);
+    auto& pool = m_ctx_pool[key];
+    if (pool.size() < get_ctx_pool_size()) {
+      pool.push_back(std::move(ctx));
+      return;
+    }
+  }
+  // Pool is full, destroying a context talks to firmware, not under the lock
+  ctx.reset();
 }
 
 std::unique_ptr<xrt_core::buffer_handle>
@@ -1251,6 +1702,8 @@ std::unique_ptr<xrt_core::buffer_handle>
 device::
 alloc_bo(void* userptr, size_t size, uint64_t flags)
 {
+  if (auto peer = get_group_peer())
+    return static_cast<device&>(*peer).alloc_bo(userptr, AMDXDNA_INVALID_CTX_HANDLE, size, flags);
   return alloc_bo(userptr, AMDXDNA_INVALID_CTX_HANDLE, size, flags);
 }
 
@@ -1258,6 +1711,8 @@ std::unique_ptr<xrt_core::buffer_handle>
 device::
 import_bo(pid_t pid, xrt_core::shared_handle::export_handle ehdl)
 {
+  if (auto peer = get_group_peer())
+    return static_cast<device&>(*peer).import_bo(import_fd(pid, ehdl));
   return import_bo(import_fd(pid, ehdl));
 }
 
@@ -1265,6 +1720,8 @@ std::unique_ptr<xrt_core::fence_handle>
 device::
 create_fence(xrt::fence::access_mode)
 {
+  if (auto peer = get_group_peer())
+    return std::make_unique<fence>(static_cast<device&>(*peer));
   return std::make_unique<fence>(*this);
 }
 
@@ -1272,6 +1729,8 @@ std::unique_ptr<xrt_core::fence_handle>
 device::
 import_fence(pid_t pid, xrt_core::shared_handle::export_handle ehdl)
 {
+  if (auto peer = get_group_peer())
+    return std::make_unique<fence>(static_cast<device&>(*peer), import_fd(pid, ehdl));
   return std::make_unique<fence>(*this, import_fd(pid, ehdl));
 }
 
@@ -10,8 +10,20 @@
 
 #include "core/common/ishim.h"
 
+#include <any>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace shim_xdna {
 
+struct xclbin_parse; // see hwctx.h
+
 class device : public xrt_core::noshim<xrt_core::device_pcie>
 {
 private:
@@ -23,6 +35,46 @@ private:
 
   std::map<uint32_t, xrt_core::buffer_handle *> m_bo_map;
 
+  mutable std::mutex m_query_cache_lock;
+  mutable std::map<xrt_core::query::key_type,
+    std::pair<std::chrono::steady_clock::time_point, std::any>> m_query_cache;
+
+  // Released contexts parked for reuse, keyed by xclbin UUID and QoS
+  mutable std::mutex m_ctx_pool_lock;
+  mutable std::map<std::string,
+    std::vector< std::unique_ptr<xrt_core::hwctx_handle> >> m_ctx_pool;
+
+  std::unique_ptr<xrt_core::hwctx_handle>
+  take_pooled_ctx(const std::string& key) const;
+
+  // Context from the pool if it is enabled, created on this device otherwise
+  std::unique_ptr<xrt_core::hwctx_handle>
+  create_pooled_hw_context(const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos) const;
+
+  // Device group peer chosen for this device at first use, see get_group_peer()
+  mutable std::once_flag m_group_once;
+  mutable std::shared_ptr<xrt_core::device> m_group_peer;
+
+  // With a device group, contexts, BOs and fences of this device are all
+  // placed on one member picked by load when the first of them is created,
+  // so that handles are always valid for the contexts they are used with.
+  // nullptr when they stay on this device.
+  std::shared_ptr<xrt_core::device>
+  get_group_peer() const;
+
+  // Entries live as long as a context created from the xclbin does
+  mutable std::mutex m_xclbin_lock;
+  mutable std::map<std::string, std::weak_ptr<xclbin_parse>> m_xclbin_cache;
+
+  // Read-only PDI BOs keyed by content hash, shared by all contexts and
+  // xclbins carrying the same PDI. Entries live as long as a user holds one.
+  struct pdi_entry {
+    size_t size;
+    std::weak_ptr<xrt_core::buffer_handle> bo;
+  };
+  mutable std::mutex m_pdi_lock;
+  mutable std::unordered_multimap<size_t, pdi_entry> m_pdi_cache;
+
   virtual std::unique_ptr<xrt_core::hwctx_handle>
   create_hw_context(const device& dev,
     const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos) const = 0;
@@ -38,6 +90,26 @@ public:
   const pdev&
   get_pdev() const;
 
+  // Returns the result of fetch, reused for ttl, 0 for the life of the device
+  std::any
+  get_cached_query(xrt_core::query::key_type key, std::chrono::milliseconds ttl,
+    const std::function<std::any()>& fetch) const;
+
+  // Parsed xclbin shared by all contexts using the same xclbin UUID,
+  // parse is only called when no context holds one
+  std::shared_ptr<xclbin_parse>
+  get_xclbin_parse(const xrt::xclbin& xclbin,
+    const std::function<std::shared_ptr<xclbin_parse>()>& parse) const;
+
+  // Device BO holding pdi, alloc is called for an empty BO on a miss
+  std::shared_ptr<xrt_core::buffer_handle>
+  get_pdi_bo(const std::vector<uint8_t>& pdi,
+    const std::function<std::unique_ptr<xrt_core::buffer_handle>()>& alloc) const;
+
+  // Takes back a released context, destroyed if the pool is full
+  void
+  put_pooled_ctx(const std::string& key, std::unique_ptr<xrt_core::hwctx_handle> ctx) const;
+
   virtual std::unique_ptr<xrt_core::buffer_handle>
   alloc_bo(void* userptr, xrt_core::hwctx_handle::slot_id ctx_id,
     size_t size, uint64_t flags) = 0;
@@ -3,10 +3,32 @@
 
 #include "fence.h"
 #include "drm_local/amdxdna_accel.h"
+#include "core/common/config_reader.h"
+#include <atomic>
+#include <chrono>
 #include <limits>
 
 namespace {
 
+// Max number of syncobjs cached per device, 0 disables the pool
+size_t
+get_syncobj_pool_depth()
+{
+  static size_t depth = xrt_core::config::detail::get_uint_value("Debug.fence_syncobj_pool_depth", 64);
+  return depth;
+}
+
+int64_t
+abs_timeout_ns(uint32_t timeout_ms)
+{
+  if (!timeout_ms)
+    return std::numeric_limits<int64_t>::max(); /* wait forever */
+
+  auto now = std::chrono::time_point_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now());
+  return now.time_since_epoch().count() + static_cast<int64_t>(timeout_ms) * 1000000;
+}
+
 uint32_t
 create_syncobj(const shim_xdna::pdev& dev)
 {
@@ -27,6 +49,24 @@ destroy_syncobj(const shim_xdna::pdev& dev, uint32_t hdl)
   dev.ioctl(DRM_IOCTL_SYNCOBJ_DESTROY, &dsobj);
 }
 
+void
+reset_syncobjs(const shim_xdna::pdev& dev, const uint32_t* sobj_hdls, uint32_t num)
+{
+  drm_syncobj_array sobjs = {
+    .handles = reinterpret_cast<uintptr_t>(sobj_hdls),
+    .count_handles = num,
+    .pad = 0,
+  };
+  dev.ioctl(DRM_IOCTL_SYNCOBJ_RESET, &sobjs);
+}
+
+uint32_t
+alloc_syncobj(const shim_xdna::pdev& dev)
+{
+  auto pool = dev.get_syncobj_pool();
+  return pool ? pool->get() : create_syncobj(dev);
+}
+
 uint64_t
 query_syncobj_timeline(const shim_xdna::pdev& dev, uint32_t sobj_hdl)
 {
@@ -78,12 +118,13 @@ signal_syncobj(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint
 }
 
 void
-wait_syncobj_done(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint)
+wait_syncobj_done(const shim_xdna::pdev& dev, uint32_t sobj_hdl, uint64_t timepoint,
+  uint32_t timeout_ms)
 {
   drm_syncobj_timeline_wait wsobj = {
     .handles = reinterpret_cast<uintptr_t>(&sobj_hdl),
     .points = reinterpret_cast<uintptr_t>(&timepoint),
-    .timeout_nsec = std::numeric_limits<int64_t>::max(), /* wait forever */
+    .timeout_nsec = abs_timeout_ns(timeout_ms),
     .count_handles = 1,
     .flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
   };
@@ -110,7 +151,9 @@ void
 submit_wait_syncobjs(const shim_xdna::pdev& dev, const shim_xdna::hw_ctx *ctx,
   const uint32_t* sobj_hdls, const uint64_t* points, uint32_t num)
 {
-  wait_syncobj_available(dev, sobj_hdls, points, num);
+  // Driver resolves points which are not submitted yet on its own. Older
+  // drivers reject them, then we have to wait for them here.
+  static std::atomic<bool> deferred_deps{true};
 
   amdxdna_drm_exec_cmd ecmd = {
     .ctx = ctx->get_slotidx(),
@@ -120,6 +163,21 @@ submit_wait_syncobjs(const shim_xdna::pdev& dev, const shim_xdna::hw_ctx *ctx,
     .cmd_count = num,
     .arg_count = num,
   };
+
+  if (deferred_deps.load(std::memory_order_relaxed)) {
+    try {
+      dev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+      return;
+    }
+    catch (const xrt_core::system_error& ex) {
+      if (ex.get_code() != EINVAL)
+        throw;
+      shim_debug("Driver can't defer dependency, wait for submission instead");
+      deferred_deps.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  wait_syncobj_available(dev, sobj_hdls, points, num);
   dev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
 }
 
@@ -142,11 +200,78 @@ submit_signal_syncobj(const shim_xdna::pdev& dev, const shim_xdna::hw_ctx *ctx,
 
 namespace shim_xdna {
 
+syncobj_pool::
+syncobj_pool(const pdev& pdev) : m_pdev(pdev)
+{
+}
+
+syncobj_pool::
+~syncobj_pool()
+{
+  clear();
+}
+
+uint32_t
+syncobj_pool::
+get()
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    if (!m_clean.empty()) {
+      auto hdl = m_clean.back();
+      m_clean.pop_back();
+      return hdl;
+    }
+  }
+  return create_syncobj(m_pdev);
+}
+
+void
+syncobj_pool::
+put(uint32_t hdl, uint64_t last_point)
+{
+  bool full;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    full = m_clean.size() >= get_syncobj_pool_depth();
+  }
+  if (full) {
+    destroy_syncobj(m_pdev, hdl);
+    return;
+  }
+
+  // Next owner starts from point 0 again, drops whatever is still pending
+  if (last_point) {
+    try {
+      reset_syncobjs(m_pdev, &hdl, 1);
+    } catch (const xrt_core::system_error&) {
+      destroy_syncobj(m_pdev, hdl);
+      throw;
+    }
+  }
+
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_clean.push_back(hdl);
+}
+
+void
+syncobj_pool::
+clear()
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  for (auto hdl : m_clean)
+    destroy_syncobj(m_pdev, hdl);
+  m_clean.clear();
+}
+
 fence::
 fence(const device& device)
   : m_pdev(device.get_pdev())
   , m_import(std::make_unique<shared>(-1))
-  , m_syncobj_hdl(create_syncobj(m_pdev))
+  , m_pooled(true)
+  , m_syncobj_hdl(alloc_syncobj(m_pdev))
 {
   shim_debug("Fence allocated: %d@%d", m_syncobj_hdl, m_state);
 }
@@ -155,6 +280,7 @@ fence::
 fence(const device& device, xrt_core::shared_handle::export_handle ehdl)
   : m_pdev(device.get_pdev())
   , m_import(std::make_unique<shared>(ehdl))
+  , m_pooled(false)
   , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
 {
   shim_debug("Fence imported: %d@%ld", m_syncobj_hdl, m_state);
@@ -164,6 +290,7 @@ fence::
 fence(const fence& f)
   : m_pdev(f.m_pdev)
   , m_import(f.share())
+  , m_pooled(false)
   , m_syncobj_hdl(import_syncobj(m_pdev, m_import->get_export_handle()))
   , m_state{f.m_state}
   , m_signaled{f.m_signaled}
@@ -176,7 +303,11 @@ fence::
 {
   shim_debug("Fence going away: %d@%ld", m_syncobj_hdl, m_state);
   try {
-    destroy_syncobj(m_pdev, m_syncobj_hdl);
+    auto pool = m_pdev.get_syncobj_pool();
+    if (m_pooled && !m_exported && pool)
+      pool->put(m_syncobj_hdl, m_state);
+    else
+      destroy_syncobj(m_pdev, m_syncobj_hdl);
   } catch (const xrt_core::system_error& e) {
     shim_debug("Failed to destroy fence");
   }
@@ -191,6 +322,7 @@ share() const
   if (m_state != initial_state)
     shim_err(-EINVAL, "Can't share fence not at initial state.");
 
+  m_exported = true;
   return std::make_unique<shared>(export_syncobj(m_pdev, m_syncobj_hdl));
 }
 
@@ -219,14 +351,27 @@ wait_next_state() const
   return ++m_state;
 }
 
-// Timeout value is ignored for now.
+// Timeout of 0 means wait forever. On timeout, fence state is rolled back
+// so that caller can wait on the same state again.
 void
 fence::
 wait(uint32_t timeout_ms) const
 {
   auto st = signal_next_state();
   shim_debug("Waiting for command fence %d@%ld", m_syncobj_hdl, st);
-  wait_syncobj_done(m_pdev, m_syncobj_hdl, st);
+  try {
+    wait_syncobj_done(m_pdev, m_syncobj_hdl, st, timeout_ms);
+  } catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      if (m_state == st)
+        m_state--;
+    }
+    shim_err(ETIME, "Timed out waiting for fence %d@%ld after %dms",
+      m_syncobj_hdl, st, timeout_ms);
+  }
 }
 
 void
@@ -11,9 +11,38 @@
 #include "shim_debug.h"
 #include "core/common/shim/fence_handle.h"
 #include <mutex>
+#include <vector>
 
 namespace shim_xdna {
 
+// Per-device cache of syncobjs backing locally created fences. A used
+// syncobj is reset when it is released, so creating a fence normally does
+// not hit the driver.
+class syncobj_pool
+{
+public:
+  syncobj_pool(const pdev& pdev);
+
+  ~syncobj_pool();
+
+  uint32_t
+  get();
+
+  // last_point is the last timeline point the owner has waited on or
+  // signaled, a syncobj never used needs no reset
+  void
+  put(uint32_t hdl, uint64_t last_point);
+
+  void
+  clear();
+
+private:
+  const pdev& m_pdev;
+  // Protects m_clean
+  std::mutex m_lock;
+  std::vector<uint32_t> m_clean;
+};
+
 class fence : public xrt_core::fence_handle
 {
 public:
@@ -59,12 +88,16 @@ private:
 
   const pdev& m_pdev;
   const std::unique_ptr<xrt_core::shared_handle> m_import;
+  // Set if syncobj came from the device syncobj pool
+  const bool m_pooled;
   uint32_t m_syncobj_hdl;
 
   // Protecting below mutables
   mutable std::mutex m_lock;
   // Set once at first signal
   mutable bool m_signaled = false;
+  // Set once syncobj is exported, it can't go back to the pool after that
+  mutable bool m_exported = false;
   // Ever incrementing at each wait/signal
   static constexpr uint64_t initial_state = 0;
   mutable uint64_t m_state = initial_state;
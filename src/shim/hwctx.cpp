@@ -25,6 +25,37 @@ get_pdi(const xrt_core::xclbin::aie_partition_obj& aie, uint16_t kernel_id)
   shim_err(ENOENT, "PDI for kernel ID 0x%x not found", kernel_id);
 }
 
+std::shared_ptr<shim_xdna::xclbin_parse>
+parse_xclbin_sections(const xrt::xclbin& xclbin)
+{
+  auto xp = std::make_shared<shim_xdna::xclbin_parse>();
+  auto axlf = xclbin.get_axlf();
+  auto aie_partition = xrt_core::xclbin::get_aie_partition(axlf);
+
+  for (const auto& k : xclbin.get_kernels()) {
+    auto& props = xrt_core::xclbin_int::get_properties(k);
+    try {
+      for (const auto& cu : k.get_cus()) {
+        xp->m_cu_info.push_back( {
+          .m_name = cu.get_name(),
+          .m_func = props.functional,
+          .m_pdi = get_pdi(aie_partition, props.kernel_id) } );
+      }
+    } catch (xrt_core::system_error &ex) {
+      if (ex.get_code() != ENOENT)
+        throw;
+      shim_debug("%s", ex.what());
+      continue;
+    }
+  }
+
+  if (xp->m_cu_info.empty())
+    shim_err(EINVAL, "No valid DPU kernel found in xclbin");
+  xp->m_ops_per_cycle = aie_partition.ops_per_cycle;
+  xp->m_num_cols = aie_partition.ncol;
+  return xp;
+}
+
 void
 destroy_syncobj(const shim_xdna::pdev& dev, uint32_t hdl)
 {
@@ -55,6 +86,9 @@ hw_ctx(const device& dev, const qos_type& qos, std::unique_ptr<hw_q> q, const xr
 hw_ctx::
 ~hw_ctx()
 {
+  auto [hits, misses] = m_q->get_wait_spin_stats();
+  if (hits || misses)
+    shim_debug("Wait spin succeeded %ld of %ld times", hits, hits + misses);
   try {
     delete_ctx_on_device();
   } catch (const xrt_core::system_error& e) {
@@ -86,8 +120,10 @@ xrt_core::cuidx_type
 hw_ctx::
 open_cu_context(const std::string& cu_name)
 {
-  for (uint32_t i = 0; i < m_cu_info.size(); i++) {
-    auto& ci = m_cu_info[i];
+  auto& cu_info = get_cu_info();
+
+  for (uint32_t i = 0; i < cu_info.size(); i++) {
+    auto& ci = cu_info[i];
     if (ci.m_name == cu_name)
       return xrt_core::cuidx_type{ .index = i };
   }
@@ -142,6 +178,12 @@ init_qos_info(const qos_type& qos)
       m_qos.frame_exec_time = value;
     else if (key == "priority")
       m_qos.priority = value;
+    else if (key == "max_inflight_cmds")
+      m_max_cmds = value;
+    else if (key == "timeout_ms")
+      m_timeout_ms = value;
+    else if (key == "wait_spin_us")
+      m_q->set_wait_spin(value);
   }
 }
 
@@ -149,13 +191,15 @@ void
 hw_ctx::
 print_xclbin_info()
 {
-  if (m_cu_info.empty()) {
+  auto& cu_info = get_cu_info();
+
+  if (cu_info.empty()) {
     shim_debug("CU INFO is empty");
     return;
   }
 
-  for (int idx = 0; idx < m_cu_info.size(); idx++) {
-    auto& e = m_cu_info[idx];
+  for (int idx = 0; idx < cu_info.size(); idx++) {
+    auto& e = cu_info[idx];
     shim_debug("index=%d, name=%s, func=%d, pdi(p=%p, sz=%ld)",
       idx, e.m_name.c_str(), e.m_func, e.m_pdi.data(), e.m_pdi.size());
   }
@@ -166,30 +210,9 @@ void
 hw_ctx::
 parse_xclbin(const xrt::xclbin& xclbin)
 {
-  auto axlf = xclbin.get_axlf();
-  auto aie_partition = xrt_core::xclbin::get_aie_partition(axlf);
-
-  for (const auto& k : xclbin.get_kernels()) {
-    auto& props = xrt_core::xclbin_int::get_properties(k);
-    try {
-      for (const auto& cu : k.get_cus()) {
-        m_cu_info.push_back( {
-          .m_name = cu.get_name(),
-          .m_func = props.functional,
-          .m_pdi = get_pdi(aie_partition, props.kernel_id) } );
-      }
-    } catch (xrt_core::system_error &ex) {
-      if (ex.get_code() != ENOENT)
-        throw;
-      shim_debug("%s", ex.what());
-      continue;
-    }
-  }
-
-  if (m_cu_info.empty())
-    shim_err(EINVAL, "No valid DPU kernel found in xclbin");
-  m_ops_per_cycle = aie_partition.ops_per_cycle;
-  m_num_cols = aie_partition.ncol;
+  m_xclbin = m_device.get_xclbin_parse(xclbin, [&xclbin] { return parse_xclbin_sections(xclbin); });
+  m_ops_per_cycle = m_xclbin->m_ops_per_cycle;
+  m_num_cols = m_xclbin->m_num_cols;
   print_xclbin_info();
 }
 
@@ -204,7 +227,14 @@ const std::vector<hw_ctx::cu_info>&
 hw_ctx::
 get_cu_info() const
 {
-  return m_cu_info;
+  return m_xclbin->m_cu_info;
+}
+
+xclbin_parse&
+hw_ctx::
+get_xclbin_parse() const
+{
+  return *m_xclbin;
 }
 
 void
@@ -219,7 +249,10 @@ create_ctx_on_device()
   arg.log_buf_bo = m_log_bo ?
     static_cast<bo*>(m_log_bo.get())->get_drm_bo_handle() :
     AMDXDNA_INVALID_BO_HANDLE;
+  arg.max_cmds = m_max_cmds;
+  arg.timeout_ms = m_timeout_ms;
   m_device.get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CREATE_CTX, &arg);
+  shim_debug("In-flight command window: %d, hang timeout %d ms", arg.max_cmds, arg.timeout_ms);
 
   set_slotidx(arg.handle);
   set_doorbell(arg.umq_doorbell);
@@ -269,4 +302,11 @@ get_syncobj() const
   return m_syncobj;
 }
 
+int
+hw_ctx::
+get_completion_fd() const
+{
+  return m_q->get_completion_fd();
+}
+
 } // shim_xdna
@@ -12,10 +12,30 @@
 #include "core/common/shim/hwctx_handle.h"
 #include "drm_local/amdxdna_accel.h"
 
+#include <mutex>
+
 namespace shim_xdna {
 
 class hw_q; // forward declaration
 
+// What contexts need from an xclbin, shared by all contexts using it
+struct xclbin_parse {
+  struct cu_info {
+    std::string m_name;
+    size_t m_func;
+    std::vector<uint8_t> m_pdi;
+  };
+
+  std::vector<cu_info> m_cu_info;
+  uint32_t m_ops_per_cycle;
+  uint32_t m_num_cols;
+
+  // PDI BOs in m_cu_info order, looked up by the first context which needs
+  // them. CUs with the same PDI share one BO, see device::get_pdi_bo().
+  std::mutex m_pdi_lock;
+  std::vector< std::shared_ptr<xrt_core::buffer_handle> > m_pdi_bos;
+};
+
 class hw_ctx : public xrt_core::hwctx_handle
 {
 public:
@@ -64,15 +84,15 @@ public:
   uint32_t
   get_syncobj() const;
 
+  // Pollable fd signaled on command completion, see hw_q::get_completion_fd()
+  int
+  get_completion_fd() const;
+
 protected:
   uint32_t m_num_cols;
   std::unique_ptr<xrt_core::buffer_handle> m_log_bo;
 
-  struct cu_info {
-    std::string m_name;
-    size_t m_func;
-    std::vector<uint8_t> m_pdi;
-  };
+  using cu_info = xclbin_parse::cu_info;
 
   const device&
   get_device() const;
@@ -80,6 +100,9 @@ protected:
   const std::vector<cu_info>&
   get_cu_info() const;
 
+  xclbin_parse&
+  get_xclbin_parse() const;
+
   void
   set_slotidx(slot_id id);
 
@@ -96,7 +119,11 @@ private:
   const device& m_device;
   slot_id m_handle = AMDXDNA_INVALID_CTX_HANDLE;
   amdxdna_qos_info m_qos = {};
-  std::vector<cu_info> m_cu_info;
+  // Requested in-flight command window, 0 for driver default
+  uint32_t m_max_cmds = 0;
+  // Hang timeout, 0 for driver default
+  uint32_t m_timeout_ms = 0;
+  std::shared_ptr<xclbin_parse> m_xclbin;
   std::unique_ptr<hw_q> m_q;
   uint32_t m_ops_per_cycle;
   uint32_t m_doorbell;
@@ -5,10 +5,27 @@
 #include "hwq.h"
 #include "fence.h"
 #include "shim_debug.h"
+#include "core/common/config_reader.h"
 #include "core/common/trace.h"
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(_M_X64)
+  #include <x86intrin.h>
+#endif
 
 namespace {
 
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
 uint64_t abs_now_ns()
 {
     auto now = std::chrono::high_resolution_clock::now();
@@ -43,6 +60,29 @@ wait_cmd_syncobj(const shim_xdna::pdev& pdev, uint32_t syncobj, uint64_t seq, ui
   pdev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
 }
 
+void
+wait_cmds_syncobj(const shim_xdna::pdev& pdev, uint32_t syncobj,
+  const std::vector<uint64_t>& seqs, uint32_t timeout_ms, bool wait_all)
+{
+  int64_t timeout = std::numeric_limits<int64_t>::max();
+
+  if (timeout_ms) {
+	  timeout = timeout_ms;
+	  timeout *= 1000000;
+	  timeout += abs_now_ns();
+  }
+  // All commands are signaled on the same context timeline
+  std::vector<uint32_t> handles(seqs.size(), syncobj);
+  drm_syncobj_timeline_wait wsobj = {
+    .handles = reinterpret_cast<uintptr_t>(handles.data()),
+    .points = reinterpret_cast<uintptr_t>(seqs.data()),
+    .timeout_nsec = timeout,
+    .count_handles = static_cast<uint32_t>(handles.size()),
+    .flags = wait_all ? DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL : 0u,
+  };
+  pdev.ioctl(DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wsobj);
+}
+
 void
 wait_cmd_ioctl(const shim_xdna::pdev& pdev, uint32_t ctx_id, uint64_t seq, uint32_t timeout_ms)
 {
@@ -92,6 +132,15 @@ hw_q(const device& device)
   , m_queue_boh(AMDXDNA_INVALID_BO_HANDLE)
   , m_pdev(device.get_pdev())
 {
+  static auto spin_us = xrt_core::config::detail::get_uint_value("Debug.cmd_wait_spin_us", 0);
+  m_wait_spin_us = spin_us;
+}
+
+hw_q::
+~hw_q()
+{
+  if (m_completion_fd >= 0)
+    close(m_completion_fd);
 }
 
 void
@@ -117,6 +166,97 @@ get_queue_bo()
   return m_queue_boh;
 }
 
+void
+hw_q::
+set_wait_spin(uint32_t us)
+{
+  m_wait_spin_us = us;
+  shim_debug("Wait spin budget set to %dus", us);
+}
+
+std::pair<uint64_t, uint64_t>
+hw_q::
+get_wait_spin_stats() const
+{
+  return { m_spin_hits.load(), m_spin_misses.load() };
+}
+
+int
+hw_q::
+get_completion_fd()
+{
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+  if (m_hwctx->get_syncobj() == AMDXDNA_INVALID_FENCE_HANDLE)
+    shim_not_supported_err("completion fd without context syncobj");
+
+  if (m_completion_fd >= 0)
+    return m_completion_fd;
+
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0)
+    shim_err(errno, "eventfd failed");
+  int expected = -1;
+  if (!m_completion_fd.compare_exchange_strong(expected, fd))
+    close(fd);
+  shim_debug("Completion fd %d for HW context %d", m_completion_fd.load(), m_hwctx->get_slotidx());
+  return m_completion_fd;
+#else
+  shim_not_supported_err(__func__);
+#endif
+}
+
+void
+hw_q::
+notify_on_completion(uint64_t seq) const noexcept
+{
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+  int fd = m_completion_fd;
+  if (fd < 0)
+    return;
+
+  drm_syncobj_eventfd efd = {
+    .handle = m_hwctx->get_syncobj(),
+    .flags = 0,
+    .point = seq,
+    .fd = fd,
+  };
+  try {
+    m_pdev.ioctl(DRM_IOCTL_SYNCOBJ_EVENTFD, &efd);
+  } catch (const std::exception& e) {
+    shim_debug("Failed to arm completion fd for seq %ld: %s", seq, e.what());
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+      shim_debug("Failed to signal completion fd %d, errno %d", fd, errno);
+  }
+#endif
+}
+
+bool
+hw_q::
+spin_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
+{
+  auto budget = std::chrono::microseconds(m_wait_spin_us);
+  if (timeout_ms)
+    budget = std::min<std::chrono::microseconds>(budget, std::chrono::milliseconds(timeout_ms));
+
+  auto cmdpkt = reinterpret_cast<volatile ert_packet *>(cmd->map(xrt_core::buffer_handle::map_type::write));
+  auto end = std::chrono::steady_clock::now() + budget;
+  do {
+    // Check clock only once per batch of polls to keep the loop cheap
+    for (int i = 0; i < 64; i++) {
+      if (cmdpkt->state >= ERT_CMD_STATE_COMPLETED) {
+        m_spin_hits++;
+        XRT_TRACE_POINT_LOG(poll_command_done);
+        return true;
+      }
+      cpu_relax();
+    }
+  } while (std::chrono::steady_clock::now() < end);
+
+  m_spin_misses++;
+  return false;
+}
+
 void
 hw_q::
 submit_command(xrt_core::buffer_handle *cmd)
@@ -124,6 +264,26 @@ submit_command(xrt_core::buffer_handle *cmd)
   issue_command(cmd);
 }
 
+void
+hw_q::
+submit_command(const std::vector<xrt_core::buffer_handle *>& cmds)
+{
+  if (cmds.empty())
+    return;
+  if (cmds.size() == 1)
+    issue_command(cmds.front());
+  else
+    issue_command(cmds);
+}
+
+void
+hw_q::
+issue_command(const std::vector<xrt_core::buffer_handle *>& cmds)
+{
+  for (auto cmd : cmds)
+    issue_command(cmd);
+}
+
 int
 hw_q::
 poll_command(xrt_core::buffer_handle *cmd) const
@@ -143,9 +303,61 @@ wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
 {
   if (poll_command(cmd))
       return 1;
+  if (m_wait_spin_us && spin_command(cmd, timeout_ms))
+      return 1;
   return wait_cmd(m_pdev, m_hwctx, cmd, timeout_ms);
 }
 
+int
+hw_q::
+wait_command(const std::vector<xrt_core::buffer_handle *>& cmds, uint32_t timeout_ms,
+  bool wait_all, std::vector<size_t> *done) const
+{
+  std::vector<uint64_t> seqs;
+  int ret = 1;
+
+  auto collect = [&] {
+    if (!done)
+      return;
+    done->clear();
+    for (size_t i = 0; i < cmds.size(); i++) {
+      if (poll_command(cmds[i]))
+        done->push_back(i);
+    }
+  };
+
+  for (auto cmd : cmds) {
+    if (poll_command(cmd))
+      continue;
+    seqs.push_back(static_cast<bo*>(cmd)->get_cmd_id());
+  }
+  if (seqs.empty() || (!wait_all && seqs.size() != cmds.size())) {
+    collect();
+    return 1;
+  }
+
+  auto syncobj = m_hwctx->get_syncobj();
+  try {
+    if (syncobj != AMDXDNA_INVALID_FENCE_HANDLE) {
+      wait_cmds_syncobj(m_pdev, syncobj, seqs, timeout_ms, wait_all);
+    } else if (wait_all) {
+      // Commands complete in submission order, waiting on the last one is enough
+      wait_cmd_ioctl(m_pdev, m_hwctx->get_slotidx(),
+        *std::max_element(seqs.begin(), seqs.end()), timeout_ms);
+    } else {
+      wait_cmd_ioctl(m_pdev, m_hwctx->get_slotidx(),
+        *std::min_element(seqs.begin(), seqs.end()), timeout_ms);
+    }
+  }
+  catch (const xrt_core::system_error& ex) {
+    if (ex.get_code() != ETIME)
+      throw;
+    ret = 0;
+  }
+  collect();
+  return ret;
+}
+
 void
 hw_q::
 submit_wait(const xrt_core::fence_handle* f)
@@ -9,6 +9,7 @@
 #include "shim_debug.h"
 
 #include "core/common/shim/hwqueue_handle.h"
+#include <atomic>
 
 namespace shim_xdna {
 
@@ -17,15 +18,27 @@ class hw_q : public xrt_core::hwqueue_handle
 public:
   hw_q(const device& device);
 
+  ~hw_q();
+
   void
   submit_command(xrt_core::buffer_handle *) override;
 
+  // Submit independent commands in order, as one submission if possible
+  virtual void
+  submit_command(const std::vector<xrt_core::buffer_handle *>&);
+
   int
   poll_command(xrt_core::buffer_handle *) const override;
 
   int
   wait_command(xrt_core::buffer_handle *, uint32_t timeout_ms) const override;
 
+  // Wait for all or for any of the commands in one call. Returns 0 on timeout.
+  // If done is not null, it returns the indices of the completed commands.
+  int
+  wait_command(const std::vector<xrt_core::buffer_handle *>&, uint32_t timeout_ms,
+    bool wait_all, std::vector<size_t> *done = nullptr) const;
+
   void
   submit_wait(const xrt_core::fence_handle*) override;
 
@@ -43,19 +56,51 @@ public:
   virtual void
   bind_hwctx(const hw_ctx *ctx) = 0;
 
-  void
+  virtual void
   unbind_hwctx();
 
   uint32_t
   get_queue_bo();
 
+  // Spin on command state for up to us microseconds before blocking in
+  // the driver. 0 disables spinning.
+  void
+  set_wait_spin(uint32_t us);
+
+  // Number of waits satisfied while spinning vs. ones that had to block
+  std::pair<uint64_t, uint64_t>
+  get_wait_spin_stats() const;
+
+  // Non-blocking eventfd which is signaled each time a command submitted
+  // after this call completes. Owned by the queue, do not close it.
+  int
+  get_completion_fd();
+
 protected:
   virtual void
   issue_command(xrt_core::buffer_handle *) = 0;
 
+  virtual void
+  issue_command(const std::vector<xrt_core::buffer_handle *>&);
+
+  // Called after the command is submitted, so it never throws. If the fd
+  // can't be armed, it is signaled right away and the waker finds out by
+  // checking command state.
+  void
+  notify_on_completion(uint64_t seq) const noexcept;
+
   const hw_ctx *m_hwctx;
   const pdev& m_pdev;
   uint32_t m_queue_boh;
+
+private:
+  bool
+  spin_command(xrt_core::buffer_handle *, uint32_t timeout_ms) const;
+
+  uint32_t m_wait_spin_us;
+  mutable std::atomic<uint64_t> m_spin_hits = 0;
+  mutable std::atomic<uint64_t> m_spin_misses = 0;
+  std::atomic<int> m_completion_fd = -1;
 };
 
 } // shim_xdna
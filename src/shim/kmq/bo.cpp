@@ -2,7 +2,13 @@
 // Copyright (C) 2023-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "bo.h"
+#include "pcidev.h"
+#include "ert.h"
 #include "core/common/config_reader.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sys/stat.h>
 
 namespace {
 
@@ -24,20 +30,56 @@ flag_to_type(uint64_t bo_flags)
   return AMDXDNA_BO_INVALID;
 }
 
-void
-sync_drm_bo(const shim_xdna::pdev& dev, uint32_t boh, xrt_core::buffer_handle::direction dir,
-  size_t offset, size_t len)
+amdxdna_drm_sync_bo
+make_drm_sync_bo(uint32_t boh, xrt_core::buffer_handle::direction dir, size_t offset, size_t len)
 {
-  amdxdna_drm_sync_bo sbo = {
+  return amdxdna_drm_sync_bo{
     .handle = boh,
     .direction = (dir == xrt_core::buffer_handle::direction::host2device ?
       SYNC_DIRECT_TO_DEVICE : SYNC_DIRECT_FROM_DEVICE),
     .offset = offset,
     .size = len,
   };
+}
+
+void
+sync_drm_bo(const shim_xdna::pdev& dev, uint32_t boh, xrt_core::buffer_handle::direction dir,
+  size_t offset, size_t len)
+{
+  auto sbo = make_drm_sync_bo(boh, dir, offset, len);
   dev.ioctl(DRM_IOCTL_AMDXDNA_SYNC_BO, &sbo);
 }
 
+// Driver syncs all entries in one call, falls back to one call per entry
+// on drivers without the vectored ioctl
+void
+sync_drm_bos(const shim_xdna::pdev& dev, std::vector<amdxdna_drm_sync_bo>& sbos)
+{
+  static std::atomic<bool> vectored{true};
+
+  if (sbos.empty())
+    return;
+
+  if (sbos.size() > 1 && vectored.load(std::memory_order_relaxed)) {
+    amdxdna_drm_sync_bos args = {
+      .entries = reinterpret_cast<uintptr_t>(sbos.data()),
+      .count = static_cast<uint32_t>(sbos.size()),
+    };
+    try {
+      dev.ioctl(DRM_IOCTL_AMDXDNA_SYNC_BOS, &args);
+      return;
+    }
+    catch (const xrt_core::system_error& ex) {
+      if (ex.get_code() != ENOTTY && ex.get_code() != EINVAL)
+        throw;
+      vectored.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  for (auto& sbo : sbos)
+    dev.ioctl(DRM_IOCTL_AMDXDNA_SYNC_BO, &sbo);
+}
+
 bool
 is_driver_sync()
 {
@@ -50,6 +92,29 @@ is_driver_sync()
   return drv_sync == 1;
 }
 
+// Max number of free BOs kept per size class, 0 disables the pool
+size_t
+get_cmd_bo_pool_depth()
+{
+  static size_t depth = xrt_core::config::detail::get_uint_value("Debug.cmd_bo_pool_depth", 16);
+  return depth;
+}
+
+// Only small command BOs are pooled
+const size_t cmd_bo_pool_min_size = 4096;
+const size_t cmd_bo_pool_max_size = 64 * 1024;
+
+// Size classes and slab size of BO sub-allocator
+const size_t suballoc_min_size = 4096;
+const size_t suballoc_max_size = 64 * 1024;
+const size_t suballoc_slab_size = 1024 * 1024;
+
+// Driver copies resident set param within one page
+const size_t resident_set_max_size = 4096;
+
+// Set once driver turns down a resident set, e.g. it is older than them
+std::atomic<bool> resident_set_unsupported = false;
+
 }
 
 namespace shim_xdna {
@@ -68,12 +133,365 @@ bo_kmq(const pdev& pdev, size_t size, int type)
 {
 }
 
+cmd_bo_pool::
+cmd_bo_pool(const pdev& pdev) : m_pdev(pdev)
+{
+}
+
+cmd_bo_pool::
+~cmd_bo_pool()
+{
+  close();
+}
+
+size_t
+cmd_bo_pool::
+size_class(size_t sz)
+{
+  if (!get_cmd_bo_pool_depth() || sz > cmd_bo_pool_max_size)
+    return 0;
+
+  size_t cls = cmd_bo_pool_min_size;
+  while (cls < sz)
+    cls <<= 1;
+  return cls;
+}
+
+bool
+cmd_bo_pool::
+get(size_t size, drm_bo_state& st)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  if (m_closed)
+    return false;
+  auto it = m_free.find(size);
+  if (it == m_free.end() || it->second.empty())
+    return false;
+  st = it->second.back();
+  it->second.pop_back();
+  return true;
+}
+
+bool
+cmd_bo_pool::
+put(const drm_bo_state& st)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  if (m_closed)
+    return false;
+  auto& list = m_free[st.size];
+  if (list.size() >= get_cmd_bo_pool_depth())
+    return false;
+  list.push_back(st);
+  return true;
+}
+
+void
+cmd_bo_pool::
+open()
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_closed = false;
+}
+
+void
+cmd_bo_pool::
+close()
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_closed = true;
+  clear();
+}
+
+// Called with m_lock held
+void
+cmd_bo_pool::
+clear()
+{
+  for (auto& [sz, list] : m_free) {
+    for (auto& st : list) {
+      try {
+        m_pdev.munmap(st.addr, st.size);
+        drm_gem_close close_bo = {st.info.handle, 0};
+        m_pdev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
+      } catch (const xrt_core::system_error& e) {
+        shim_debug("Failed to free pooled cmd BO: %s", e.what());
+      }
+    }
+  }
+  m_free.clear();
+}
+
+bo_import_cache::
+bo_import_cache(const pdev& pdev) : m_pdev(pdev)
+{
+}
+
+bo_import_cache::
+~bo_import_cache()
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  for (auto& [ino, e] : m_entries)
+    free_entry(e);
+  m_entries.clear();
+  m_ino_by_handle.clear();
+}
+
+void
+bo_import_cache::
+free_entry(const entry& e)
+{
+  try {
+    m_pdev.munmap(e.st.addr, e.st.size);
+    drm_gem_close close_bo = {e.st.info.handle, 0};
+    m_pdev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
+  } catch (const xrt_core::system_error& ex) {
+    shim_debug("Failed to free imported BO: %s", ex.what());
+  }
+}
+
+bo::drm_bo_state
+bo_import_cache::
+get(xrt_core::shared_handle::export_handle fd, int& type,
+  const std::function<drm_bo_state()>& import)
+{
+  struct stat sb;
+  if (fstat(fd, &sb) == -1)
+    shim_err(errno, "fstat of dma-buf fd %d failed", fd);
+
+  // Import is done under lock, so a racing importer can't get the same GEM
+  // handle from DRM while it is being closed here
+  std::lock_guard<std::mutex> lg(m_lock);
+  auto it = m_entries.find(sb.st_ino);
+  if (it != m_entries.end()) {
+    it->second.refs++;
+    type = it->second.type;
+    return it->second.st;
+  }
+
+  auto st = import();
+  m_entries[sb.st_ino] = { st, 1, type };
+  m_ino_by_handle[st.info.handle] = sb.st_ino;
+  return st;
+}
+
+void
+bo_import_cache::
+put(const drm_bo_state& st)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  auto h = m_ino_by_handle.find(st.info.handle);
+  if (h == m_ino_by_handle.end()) {
+    shim_debug("Freeing unknown imported BO %d", st.info.handle);
+    return;
+  }
+  auto it = m_entries.find(h->second);
+  if (--it->second.refs)
+    return;
+  free_entry(it->second);
+  m_entries.erase(it);
+  m_ino_by_handle.erase(h);
+}
+
+bo_reaper::
+bo_reaper(const pdev& pdev) : m_pdev(pdev)
+{
+  m_thread = std::thread([this] { run(); });
+}
+
+bo_reaper::
+~bo_reaper()
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+}
+
+void
+bo_reaper::
+put(const drm_bo_state& st)
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_queue.push_back(st);
+  }
+  m_cv.notify_one();
+}
+
+void
+bo_reaper::
+run()
+{
+  std::vector<drm_bo_state> bos;
+  std::unique_lock<std::mutex> lock(m_lock);
+
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+    if (m_queue.empty())
+      return;
+    bos.swap(m_queue);
+    lock.unlock();
+    for (auto& st : bos)
+      free_bo(st);
+    bos.clear();
+    lock.lock();
+  }
+}
+
+void
+bo_reaper::
+free_bo(const drm_bo_state& st)
+{
+  try {
+    // Lazily mapped BO may never have been mapped
+    if (st.addr)
+      m_pdev.munmap(st.addr, st.size);
+    // Driver reclaims the BO once device is done with it
+    drm_gem_close close_bo = {st.info.handle, 0};
+    m_pdev.ioctl(DRM_IOCTL_GEM_CLOSE, &close_bo);
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to free BO in background: %s", e.what());
+  }
+}
+
+bo_suballocator::
+bo_suballocator(const pdev& pdev) : m_pdev(pdev)
+{
+  shim_debug("BO sub-allocation enabled");
+}
+
+bo_suballocator::
+~bo_suballocator()
+{
+  // Slab bo_kmq objects free their DRM BOs
+  m_slab_by_handle.clear();
+  m_slabs.clear();
+}
+
+size_t
+bo_suballocator::
+size_class(size_t sz)
+{
+  if (!sz || sz > suballoc_max_size)
+    return 0;
+
+  size_t cls = suballoc_min_size;
+  while (cls < sz)
+    cls <<= 1;
+  return cls;
+}
+
+size_t
+bo_suballocator::
+get(int type, uint64_t flags, size_t size, drm_bo_state& st)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  auto& slabs = m_slabs[{type, flags, size}];
+  slab *s = nullptr;
+  for (auto& sl : slabs) {
+    if (!sl->m_free.empty()) {
+      s = sl.get();
+      break;
+    }
+  }
+
+  if (!s) {
+    auto sl = std::make_unique<slab>();
+    sl->m_bo = std::make_unique<bo_kmq>(m_pdev, suballoc_slab_size, type);
+    // Chunks share the slab mapping, it can't be deferred
+    sl->m_bo->map(bo::map_type::write);
+    // Hand out lower offsets first
+    for (size_t off = suballoc_slab_size; off >= size; off -= size)
+      sl->m_free.push_back(off - size);
+    s = sl.get();
+    m_slab_by_handle[s->m_bo->get_drm_bo_handle()] = s;
+    slabs.push_back(std::move(sl));
+    shim_debug("Added %ld bytes slab for %ld bytes type %d flags 0x%lx chunks",
+      suballoc_slab_size, size, type, flags);
+  }
+
+  auto off = s->m_free.back();
+  s->m_free.pop_back();
+  st = s->m_bo->get_drm_bo_state(off);
+  st.size = size;
+  return off;
+}
+
+void
+bo_suballocator::
+put(const drm_bo_state& st, size_t offset)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  auto it = m_slab_by_handle.find(st.info.handle);
+  if (it == m_slab_by_handle.end()) {
+    shim_debug("Freeing chunk of unknown slab BO %d", st.info.handle);
+    return;
+  }
+  it->second->m_free.push_back(offset);
+}
+
+void
+bo_kmq::
+alloc_dev_bo()
+{
+  if (m_type != AMDXDNA_BO_DEV) {
+    alloc_bo();
+    return;
+  }
+
+  // Device heap is full, grow it by one chunk and retry
+  auto& pdev = static_cast<const pdev_kmq&>(m_pdev);
+  while (true) {
+    auto gen = pdev.get_dev_heap_gen();
+    try {
+      alloc_bo();
+      return;
+    } catch (const xrt_core::system_error& e) {
+      if (e.get_code() != ENOSPC || !pdev.grow_dev_heap(m_aligned_size, gen))
+        throw;
+    }
+  }
+}
+
 bo_kmq::
 bo_kmq(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id, size_t size, uint64_t flags, int type)
   : bo(pdev, ctx_id, size, flags, type)
 {
-  alloc_bo();
-  mmap_bo();
+  auto sub = get_suballocator();
+  if (sub) {
+    drm_bo_state st;
+    m_sub_offset = sub->get(m_type, m_flags, bo_suballocator::size_class(size), st);
+    adopt_drm_bo(st);
+    m_suballoc = true;
+    // Chunk may carry dirty cache lines from its previous user
+    if (m_type == AMDXDNA_BO_SHARE)
+      sync(direction::host2device, m_aligned_size, 0);
+    shim_debug("Sub-allocated KMQ BO at offset 0x%lx, %s", m_sub_offset, describe().c_str());
+    return;
+  }
+
+  auto pool = get_cmd_bo_pool();
+  if (pool) {
+    drm_bo_state st;
+    m_aligned_size = cmd_bo_pool::size_class(size);
+    if (pool->get(m_aligned_size, st)) {
+      adopt_drm_bo(st);
+      shim_debug("Reused pooled KMQ BO, %s", describe().c_str());
+      return;
+    }
+  }
+
+  alloc_dev_bo();
+  mmap_bo_lazy();
 
   // Newly allocated buffer may contain dirty pages. If used as output buffer,
   // the data in cacheline will be flushed onto memory and pollute the output
@@ -83,6 +501,11 @@ bo_kmq(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id, size_t size, ui
     sync(direction::host2device, size, 0);
 
   attach_to_ctx();
+  if (m_dbg_ring) {
+    // Reader walks the ring through host mapping
+    map(bo::map_type::write);
+    start_dbg_reader();
+  }
 
   shim_debug("Allocated KMQ BO, %s", describe().c_str());
 }
@@ -91,8 +514,20 @@ bo_kmq::
 bo_kmq(const pdev& pdev, xrt_core::shared_handle::export_handle ehdl)
   : bo(pdev, ehdl)
 {
-  import_bo();
-  mmap_bo();
+  auto cache = get_import_cache();
+  if (cache) {
+    // import_bo() sets m_type on a miss, a hit restores it from the cache
+    auto st = cache->get(ehdl, m_type, [this] {
+      import_bo();
+      mmap_bo();
+      return release_drm_bo();
+    });
+    adopt_drm_bo(st);
+    m_import_cached = true;
+  } else {
+    import_bo();
+    mmap_bo();
+  }
   shim_debug("Imported KMQ BO (userptr=0x%lx, size=%ld, flags=0x%llx, type=%d, drm_bo=%d)",
     m_aligned, m_aligned_size, m_flags, m_type, get_drm_bo_handle());
 }
@@ -102,6 +537,50 @@ bo_kmq::
 {
   shim_debug("Freeing KMQ BO, %s", describe().c_str());
 
+  release_cmd_hold();
+  {
+    // Pooled cmd BO must not keep arg BOs pinned
+    std::lock_guard<std::mutex> lg(m_args_lock);
+    drop_resident_set();
+  }
+  // Ring is read till the end, firmware flushes it only while attached
+  stop_dbg_reader();
+
+  if (m_import_cached) {
+    auto st = release_drm_bo();
+    auto cache = get_import_cache();
+    if (cache)
+      cache->put(st);
+    return;
+  }
+
+  if (m_suballoc) {
+    // Slab BO stays with the sub-allocator
+    auto st = release_drm_bo();
+    auto sub = static_cast<const pdev_kmq&>(m_pdev).get_suballocator();
+    if (sub)
+      sub->put(st, m_sub_offset);
+    return;
+  }
+
+  auto pool = get_cmd_bo_pool();
+  if (pool) {
+    // A command still owned by the device must not be handed out again
+    auto pkt = reinterpret_cast<ert_packet *>(m_aligned);
+    if (get_cmd_id() == static_cast<uint64_t>(-1) || pkt->state >= ERT_CMD_STATE_COMPLETED) {
+      auto st = release_drm_bo();
+      if (pool->put(st))
+        return;
+      adopt_drm_bo(st);
+    }
+  }
+
+  auto reaper = get_bo_reaper();
+  if (reaper) {
+    reaper->put(release_drm_bo_mapping());
+    return;
+  }
+
   munmap_bo();
   try {
     detach_from_ctx();
@@ -116,46 +595,142 @@ void
 bo_kmq::
 sync(direction dir, size_t size, size_t offset)
 {
-  if (is_driver_sync()) {
-    sync_drm_bo(m_pdev, get_drm_bo_handle(), dir, offset, size);
-    return;
-  }
-
   if (offset + size > m_aligned_size)
     shim_err(EINVAL, "Invalid BO offset and size for sync'ing: %ld, %ld", offset, size);
 
+  std::vector<amdxdna_drm_sync_bo> sbos;
+  sync_range(dir, size, offset, sbos);
+  sync_drm_bos(m_pdev, sbos);
+}
+
+void
+bo_kmq::
+sync_range(direction dir, size_t size, size_t offset, std::vector<amdxdna_drm_sync_bo>& sbos)
+{
+  // Driver copies commands out through its own cached kernel mapping, the
+  // device never reads a command BO, so there is nothing to flush
+  if (m_type == AMDXDNA_BO_CMD)
+    return;
+
+  // No host mapping to flush through yet, driver does it
+  if (is_driver_sync() || !is_mapped()) {
+    sbos.push_back(make_drm_sync_bo(get_drm_bo_handle(), dir, m_sub_offset + offset, size));
+    return;
+  }
+
   switch (m_type) {
   case AMDXDNA_BO_SHARE:
-  case AMDXDNA_BO_CMD:
-    shim_xdna::clflush_data(m_aligned, offset, size); 
+    shim_xdna::clflush_data(m_aligned, offset, size, dir == direction::host2device);
     break;
   case AMDXDNA_BO_DEV:
     if (m_owner_ctx_id == AMDXDNA_INVALID_CTX_HANDLE)
-      shim_xdna::clflush_data(m_aligned, offset, size); 
+      shim_xdna::clflush_data(m_aligned, offset, size, dir == direction::host2device);
     else
-      sync_drm_bo(m_pdev, get_drm_bo_handle(), dir, offset, size);
+      sbos.push_back(make_drm_sync_bo(get_drm_bo_handle(), dir, m_sub_offset + offset, size));
     break;
   default:
     shim_err(ENOTSUP, "Can't sync bo type %d", m_type);
   }
 }
 
+void
+bo_kmq::
+sync(const std::vector<xrt_core::buffer_handle*>& bos, direction dir)
+{
+  std::vector<amdxdna_drm_sync_bo> sbos;
+  const pdev *dev = nullptr;
+
+  for (auto bo : bos) {
+    auto b = static_cast<bo_kmq*>(bo);
+    if (dev && dev != &b->m_pdev)
+      shim_err(EINVAL, "Can't sync BOs of different devices in one go");
+    dev = &b->m_pdev;
+    b->sync_range(dir, b->m_aligned_size, 0, sbos);
+  }
+  if (dev)
+    sync_drm_bos(*dev, sbos);
+}
+
+void
+bo_kmq::
+copy(const xrt_core::buffer_handle* src, size_t size, size_t dst_offset, size_t src_offset)
+{
+  auto sbo = dynamic_cast<const bo_kmq*>(src);
+  if (!sbo)
+    shim_not_supported_err("Can't copy from non-KMQ BO");
+  if (dst_offset + size > m_aligned_size || src_offset + size > sbo->m_aligned_size)
+    shim_err(EINVAL, "Invalid BO offset and size for copy: %ld, %ld, %ld",
+      dst_offset, src_offset, size);
+
+  amdxdna_cmd_copy_bo cb = {
+    .dst_handle = get_drm_bo_handle(),
+    .src_handle = sbo->get_drm_bo_handle(),
+    .dst_offset = m_sub_offset + dst_offset,
+    .src_offset = sbo->m_sub_offset + src_offset,
+    .size = size,
+  };
+  // Let driver pick a context, copy is not tied to a hwctx in XRT
+  amdxdna_drm_exec_cmd ecmd = {
+    .ctx = AMDXDNA_INVALID_CTX_HANDLE,
+    .type = AMDXDNA_CMD_SUBMIT_COPY_BO,
+    .cmd_handles = reinterpret_cast<uintptr_t>(&cb),
+    .cmd_count = 1,
+  };
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+  } catch (const xrt_core::system_error& e) {
+    // XRT falls back to CPU copy on not supported
+    auto err = e.get_code();
+    if (err == EINVAL || err == ENOENT || err == EOPNOTSUPP)
+      shim_not_supported_err(e.what());
+    throw;
+  }
+
+  amdxdna_drm_wait_cmd wcmd = {
+    .ctx = ecmd.ctx,
+    .timeout = 0,
+    .seq = ecmd.seq,
+  };
+  m_pdev.ioctl(DRM_IOCTL_AMDXDNA_WAIT_CMD, &wcmd);
+  shim_debug("Copied %ld bytes from BO %d@%ld to BO %d@%ld", size,
+    cb.src_handle, src_offset, cb.dst_handle, dst_offset);
+}
+
+void
+bo_kmq::
+set_arg_bo_handle(size_t key, uint32_t handle)
+{
+  if (key >= m_args_slots.size())
+    m_args_slots.resize(key + 1, AMDXDNA_INVALID_BO_HANDLE);
+  if (m_args_slots[key] == handle)
+    return;
+  m_args_slots[key] = handle;
+  m_args_dirty = true;
+}
+
 void
 bo_kmq::
 bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
 {
   auto boh = reinterpret_cast<const bo_kmq*>(bh);
-  std::lock_guard<std::mutex> lg(m_args_map_lock);
+  std::lock_guard<std::mutex> lg(m_args_lock);
 
   if (m_type != AMDXDNA_BO_CMD)
     shim_err(EINVAL, "Can't call bind_at() on non-cmd BO");
 
-  if (!pos)
-    m_args_map.clear();
+  // Handle values may be reused by new BOs, set goes with any rebinding
+  drop_resident_set();
+
+  if (!pos) {
+    // clear() keeps capacity, so re-binding the same run does not allocate
+    if (!m_args_slots.empty())
+      m_args_dirty = true;
+    m_args_slots.clear();
+  }
 
   if (boh->get_type() != AMDXDNA_BO_CMD) {
     auto h = boh->get_drm_bo_handle();
-    m_args_map[pos] = h;
+    set_arg_bo_handle(pos, h);
     shim_debug("Added arg BO %d to cmd BO %d", h, get_drm_bo_handle());
   } else {
     const size_t max_args_order = 6;
@@ -165,27 +740,280 @@ bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size)
     auto arg_cnt = boh->get_arg_bo_handles(hs, max_args);
     std::string bohs;
     for (int i = 0; i < arg_cnt; i++) {
-      m_args_map[key + i] = hs[i];
+      set_arg_bo_handle(key + i, hs[i]);
       bohs += std::to_string(hs[i]) + " ";
     }
     shim_debug("Added arg BO %s to cmd BO %d", bohs.c_str(), get_drm_bo_handle());
   }
 }
 
+cmd_bo_pool *
+bo_kmq::
+get_cmd_bo_pool() const
+{
+  // Only cmd BOs shared by all contexts and within pool size classes
+  if (m_type != AMDXDNA_BO_CMD || m_owner_ctx_id != AMDXDNA_INVALID_CTX_HANDLE ||
+    !cmd_bo_pool::size_class(m_aligned_size))
+    return nullptr;
+  return static_cast<const pdev_kmq&>(m_pdev).get_cmd_bo_pool();
+}
+
+bo_suballocator *
+bo_kmq::
+get_suballocator() const
+{
+  // Only small BOs from XRT shared by all contexts. Internal BOs, slabs
+  // included, are created with no flags.
+  if ((m_type != AMDXDNA_BO_SHARE && m_type != AMDXDNA_BO_DEV) || !m_flags ||
+    m_owner_ctx_id != AMDXDNA_INVALID_CTX_HANDLE ||
+    xcl_bo_flags{m_flags}.use == XRT_BO_USE_DEBUG ||
+    !bo_suballocator::size_class(m_aligned_size))
+    return nullptr;
+  return static_cast<const pdev_kmq&>(m_pdev).get_suballocator();
+}
+
+void
+bo_kmq::
+start_dbg_reader()
+{
+  static auto path = xrt_core::config::detail::get_string_value("Debug.dbg_buf_stream_file", "");
+  if (path.empty())
+    return;
+
+  // Older drivers drop the ring bit and attach the BO as a one-shot buffer
+  shim_xdna::clflush_data(m_aligned, 0, sizeof(amdxdna_dbg_ring_hdr));
+  auto hdr = reinterpret_cast<const volatile amdxdna_dbg_ring_hdr *>(m_aligned);
+  if (hdr->magic != AMDXDNA_DBG_RING_MAGIC || !hdr->size ||
+    hdr->data_offset + static_cast<size_t>(hdr->size) > m_aligned_size) {
+    shim_debug("Driver did not set up debug ring drm_bo %d, ring is not streamed",
+      get_drm_bo_handle());
+    return;
+  }
+  m_dbg_data_offset = hdr->data_offset;
+  m_dbg_size = hdr->size;
+
+  auto name = path + "." + std::to_string(m_owner_ctx_id) + "." + std::to_string(get_drm_bo_handle());
+  m_dbg_file = std::fopen(name.c_str(), "w");
+  if (!m_dbg_file) {
+    shim_debug("Can't open debug ring file %s, ring is not streamed", name.c_str());
+    return;
+  }
+
+  static auto poll_ms = xrt_core::config::detail::get_uint_value("Debug.dbg_buf_stream_poll_ms", 100);
+  m_dbg_thread = std::thread([this] {
+    std::unique_lock<std::mutex> lock(m_dbg_lock);
+    while (!m_dbg_cv.wait_for(lock, std::chrono::milliseconds(poll_ms), [this] { return m_dbg_stop; })) {
+      if (m_dbg_broken)
+        break;
+      try {
+        drain_dbg_ring();
+      } catch (const xrt_core::system_error& e) {
+        shim_debug("Failed to read debug ring: %s", e.what());
+      }
+    }
+  });
+}
+
+void
+bo_kmq::
+stop_dbg_reader()
+{
+  if (!m_dbg_thread.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_dbg_lock);
+    m_dbg_stop = true;
+  }
+  m_dbg_cv.notify_all();
+  m_dbg_thread.join();
+
+  // Whatever firmware wrote since the last poll
+  try {
+    drain_dbg_ring();
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to read debug ring: %s", e.what());
+  }
+  shim_debug("Debug ring drm_bo %d: %ld bytes streamed, %ld bytes lost",
+    get_drm_bo_handle(), m_dbg_rd - m_dbg_lost, m_dbg_lost);
+  std::fclose(m_dbg_file);
+  m_dbg_file = nullptr;
+}
+
+// Driver has firmware flush the ring, which stays attached, and the header
+// says how far firmware got. Firmware never waits for the reader, so data
+// more than one ring size behind the write offset is gone. Firmware that
+// does not know the ring writes over the header, streaming stops for good
+// once the header is not the one driver wrote.
+void
+bo_kmq::
+drain_dbg_ring()
+{
+  if (m_dbg_broken)
+    return;
+
+  sync_drm_bo(m_pdev, get_drm_bo_handle(), direction::device2host, m_sub_offset, m_aligned_size);
+  // Drop stale cache lines, device writes go to memory
+  shim_xdna::clflush_data(m_aligned, 0, m_aligned_size);
+
+  auto hdr = reinterpret_cast<const volatile amdxdna_dbg_ring_hdr *>(m_aligned);
+  uint64_t wr = hdr->wr_off;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (hdr->magic != AMDXDNA_DBG_RING_MAGIC || hdr->data_offset != m_dbg_data_offset ||
+    hdr->size != m_dbg_size || wr < m_dbg_rd) {
+    m_dbg_broken = true;
+    shim_debug("Debug ring drm_bo %d header overwritten (magic 0x%x), stop streaming",
+      get_drm_bo_handle(), hdr->magic);
+    return;
+  }
+  size_t size = m_dbg_size;
+
+  if (wr - m_dbg_rd > size) {
+    m_dbg_lost += wr - m_dbg_rd - size;
+    m_dbg_rd = wr - size;
+  }
+  auto n = static_cast<size_t>(wr - m_dbg_rd);
+  if (!n)
+    return;
+
+  auto base = reinterpret_cast<const char *>(m_aligned) + m_dbg_data_offset;
+  auto rd = static_cast<size_t>(m_dbg_rd % size);
+  auto first = std::min(n, size - rd);
+  std::fwrite(base + rd, 1, first, m_dbg_file);
+  if (n > first)
+    std::fwrite(base, 1, n - first, m_dbg_file);
+  std::fflush(m_dbg_file);
+  m_dbg_rd = wr;
+}
+
+bo_import_cache *
+bo_kmq::
+get_import_cache() const
+{
+  return static_cast<const pdev_kmq&>(m_pdev).get_import_cache();
+}
+
+bo_reaper *
+bo_kmq::
+get_bo_reaper() const
+{
+  // Device heap and debug BOs must be gone by the time the call returns
+  if (m_type != AMDXDNA_BO_SHARE || m_owner_ctx_id != AMDXDNA_INVALID_CTX_HANDLE)
+    return nullptr;
+  return static_cast<const pdev_kmq&>(m_pdev).get_bo_reaper();
+}
+
+std::unique_ptr<xrt_core::shared_handle>
+bo_kmq::
+share() const
+{
+  // Exporting would expose the whole slab
+  if (m_suballoc)
+    shim_not_supported_err("Sharing sub-allocated BO");
+  return bo::share();
+}
+
 uint32_t
 bo_kmq::
 get_arg_bo_handles(uint32_t *handles, size_t num) const
 {
-  std::lock_guard<std::mutex> lg(m_args_map_lock);
+  std::lock_guard<std::mutex> lg(m_args_lock);
 
-  auto sz = m_args_map.size();
+  flatten_arg_bo_handles();
+  auto sz = m_args_flat.size();
   if (sz > num)
     shim_err(E2BIG, "There are %ld BO args, provided buffer can hold only %ld", sz, num);
 
-  for (auto &m : m_args_map)
-    *(handles++) = m.second;
-
+  std::copy(m_args_flat.begin(), m_args_flat.end(), handles);
   return sz;
 }
 
+void
+bo_kmq::
+flatten_arg_bo_handles() const
+{
+  if (!m_args_dirty)
+    return;
+
+  m_args_flat.clear();
+  for (auto h : m_args_slots) {
+    if (h == AMDXDNA_INVALID_BO_HANDLE)
+      continue;
+    // Sub-allocated BOs share their slab's handle, pass it only once
+    if (std::find(m_args_flat.begin(), m_args_flat.end(), h) == m_args_flat.end())
+      m_args_flat.push_back(h);
+  }
+  m_args_dirty = false;
+}
+
+uint32_t
+bo_kmq::
+get_resident_set(const std::shared_ptr<resident_set_owner>& owner)
+{
+  std::lock_guard<std::mutex> lg(m_args_lock);
+
+  if (m_rset_owner.lock() != owner) {
+    drop_resident_set();
+    m_rset_owner = owner;
+  }
+  if (m_rset_id || resident_set_unsupported)
+    return m_rset_id;
+  if (++m_rset_submits < 2)
+    return 0;
+
+  flatten_arg_bo_handles();
+  auto num = m_args_flat.size();
+  auto size = sizeof(amdxdna_ctx_param_resident_set) + num * sizeof(uint32_t);
+  if (!num || size > resident_set_max_size)
+    return 0;
+
+  std::vector<char> param(size);
+  auto rset = reinterpret_cast<amdxdna_ctx_param_resident_set *>(param.data());
+  rset->num_bos = num;
+  std::copy(m_args_flat.begin(), m_args_flat.end(), rset->bo_handles);
+
+  amdxdna_drm_config_ctx arg = {};
+  arg.handle = owner->ctx;
+  arg.param_type = DRM_AMDXDNA_CTX_ADD_RESIDENT_SET;
+  arg.param_val = reinterpret_cast<uintptr_t>(rset);
+  arg.param_val_size = size;
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &arg);
+  } catch (const xrt_core::system_error& e) {
+    // Arg BOs are checked on submit anyway, only older drivers get here
+    shim_debug("Resident set not supported, passing arg BOs: %s", e.what());
+    resident_set_unsupported = true;
+    return 0;
+  }
+  m_rset_id = rset->id;
+  shim_debug("Registered resident set %d of %ld BOs for cmd BO %d", m_rset_id, num, get_drm_bo_handle());
+  return m_rset_id;
+}
+
+void
+bo_kmq::
+drop_resident_set()
+{
+  auto owner = m_rset_owner.lock();
+
+  m_rset_submits = 0;
+  if (!m_rset_id)
+    return;
+  auto id = m_rset_id;
+  m_rset_id = 0;
+  // Driver has dropped the set along with its context
+  if (!owner)
+    return;
+
+  amdxdna_drm_config_ctx arg = {};
+  arg.handle = owner->ctx;
+  arg.param_type = DRM_AMDXDNA_CTX_REMOVE_RESIDENT_SET;
+  arg.param_val = id;
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &arg);
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Failed to remove resident set %d: %s", id, e.what());
+  }
+}
+
 } // namespace shim_xdna
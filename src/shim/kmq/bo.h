@@ -7,10 +7,183 @@
 #include "../bo.h"
 #include "drm_local/amdxdna_accel.h"
 
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
 #include <set>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
 
 namespace shim_xdna {
 
+// Per device free list of mapped command BOs in power of 2 size classes.
+// Avoids CREATE_BO, GET_BO_INFO and mmap for every command buffer.
+class cmd_bo_pool {
+public:
+  using drm_bo_state = bo::drm_bo_state;
+
+  cmd_bo_pool(const pdev& pdev);
+
+  ~cmd_bo_pool();
+
+  // Size actually allocated for a request of sz, 0 if not poolable
+  static size_t
+  size_class(size_t sz);
+
+  // Returns false if nothing is pooled for size or the pool is closed
+  bool
+  get(size_t size, drm_bo_state& st);
+
+  // Returns false if the pool is full or closed, caller still owns st
+  bool
+  put(const drm_bo_state& st);
+
+  // Pool object lives as long as the device, so BOs racing with last close
+  // never see it freed. Closing frees all pooled BOs and turns get/put into
+  // no-ops till the device is opened again.
+  void
+  open();
+
+  void
+  close();
+
+private:
+  void
+  clear();
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  bool m_closed = false;
+  std::map<size_t, std::vector<drm_bo_state>> m_free;
+};
+
+// Per device cache of imported dma-bufs keyed by dma-buf inode. DRM returns
+// the same GEM handle each time a dma-buf is imported into one device file,
+// so all importers share the handle and its mapping, which are freed when
+// the last importer goes away.
+class bo_import_cache {
+public:
+  using drm_bo_state = bo::drm_bo_state;
+
+  bo_import_cache(const pdev& pdev);
+
+  ~bo_import_cache();
+
+  // Shared DRM BO and mapping of the dma-buf, import() is called on a miss.
+  // type is whatever the first importer got from import(), and is handed
+  // back to later importers of the same dma-buf.
+  drm_bo_state
+  get(xrt_core::shared_handle::export_handle fd, int& type,
+    const std::function<drm_bo_state()>& import);
+
+  // Drop a reference, unmap and close the DRM BO on the last one
+  void
+  put(const drm_bo_state& st);
+
+private:
+  struct entry {
+    drm_bo_state st;
+    uint32_t refs;
+    int type;
+  };
+
+  void
+  free_entry(const entry& e);
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  std::unordered_map<ino_t, entry> m_entries;
+  std::unordered_map<uint32_t, ino_t> m_ino_by_handle;
+};
+
+// Opt-in per device background freer for host BOs. munmap and GEM_CLOSE
+// of a large BO take a while, they are done off the destroying thread.
+class bo_reaper {
+public:
+  using drm_bo_state = bo::drm_bo_state;
+
+  bo_reaper(const pdev& pdev);
+
+  // Frees whatever is still queued
+  ~bo_reaper();
+
+  void
+  put(const drm_bo_state& st);
+
+private:
+  void
+  run();
+
+  void
+  free_bo(const drm_bo_state& st);
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::vector<drm_bo_state> m_queue;
+  bool m_stop = false;
+  std::thread m_thread;
+};
+
+class bo_kmq;
+
+// Context cmd BOs register their resident sets with, see Debug.resident_arg_bos.
+// Owned by the HW queue while it is bound to the context. Sets whose owner
+// is gone were dropped by the driver along with the context.
+struct resident_set_owner {
+  xrt_core::hwctx_handle::slot_id ctx;
+};
+
+// Opt-in per device sub-allocator for small host and device BOs. Chunks of
+// power of 2 size classes are carved out of large slab BOs, so a small BO
+// needs no CREATE_BO, mmap or GEM handle of its own. Slabs are kept till
+// the device is closed. Chunks only share a slab with BOs of the same type
+// and flags.
+//
+// Chunks also share the slab's DRM handle. A command using a chunk as arg
+// fences the whole slab, so commands of different contexts lock the same
+// reservation and a wait or invalidation on the slab covers all of them.
+// Results stay correct, but independent small BOs are no longer
+// independent to the driver. This is why sub-allocation is opt-in.
+class bo_suballocator {
+public:
+  using drm_bo_state = bo::drm_bo_state;
+
+  bo_suballocator(const pdev& pdev);
+
+  ~bo_suballocator();
+
+  // Chunk size for a request of sz, 0 if not sub-allocatable
+  static size_t
+  size_class(size_t sz);
+
+  // Returns offset of the chunk inside its slab BO
+  size_t
+  get(int type, uint64_t flags, size_t size, drm_bo_state& st);
+
+  void
+  put(const drm_bo_state& st, size_t offset);
+
+private:
+  struct slab {
+    std::unique_ptr<bo_kmq> m_bo;
+    // Offsets of free chunks
+    std::vector<size_t> m_free;
+  };
+
+  const pdev& m_pdev;
+  std::mutex m_lock;
+  // Slabs keyed by BO type, BO flags and size class
+  std::map<std::tuple<int, uint64_t, size_t>, std::vector<std::unique_ptr<slab>>> m_slabs;
+  // Slab lookup by DRM BO handle on free
+  std::map<uint32_t, slab*> m_slab_by_handle;
+};
+
 class bo_kmq : public bo {
 public:
   bo_kmq(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
@@ -26,6 +199,13 @@ public:
   void
   bind_at(size_t pos, const buffer_handle* bh, size_t offset, size_t size) override;
 
+  std::unique_ptr<xrt_core::shared_handle>
+  share() const override;
+
+  // Device side copy, waits for completion
+  void
+  copy(const xrt_core::buffer_handle* src, size_t size, size_t dst_offset, size_t src_offset) override;
+
 public:
   // Support BO creation from internal
   bo_kmq(const pdev& pdev, size_t size, int type);
@@ -34,13 +214,93 @@ public:
   uint32_t
   get_arg_bo_handles(uint32_t *handles, size_t num) const;
 
+  // Resident set of arg BOs registered with owner's context, 0 if arg BOs
+  // have to be passed with the command. A set is registered on the second
+  // submit with the same bindings, so one-shot commands don't pay for it,
+  // and is dropped once arg BOs are bound again.
+  uint32_t
+  get_resident_set(const std::shared_ptr<resident_set_owner>& owner);
+
+  // Sync whole BOs of one device, the ones driver has to handle in one ioctl
+  static void
+  sync(const std::vector<xrt_core::buffer_handle*>& bos, direction dir);
+
 private:
   bo_kmq(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
     size_t size, uint64_t flags, int type);
 
+  cmd_bo_pool *
+  get_cmd_bo_pool() const;
+
+  // Flush in place, or queue an entry for the driver to sync
+  void
+  sync_range(direction dir, size_t size, size_t offset, std::vector<amdxdna_drm_sync_bo>& sbos);
+
+  bo_suballocator *
+  get_suballocator() const;
+
+  bo_import_cache *
+  get_import_cache() const;
+
+  bo_reaper *
+  get_bo_reaper() const;
+
+  // DEV BO grows device heap on demand
+  void
+  alloc_dev_bo();
+
+  void
+  set_arg_bo_handle(size_t key, uint32_t handle);
+
+  // Rebuild m_args_flat if bindings changed, called with m_args_lock held
+  void
+  flatten_arg_bo_handles() const;
+
+  // Called with m_args_lock held
+  void
+  drop_resident_set();
+
+  // Background reader streaming a debug ring to <Debug.dbg_buf_stream_file>
+  void
+  start_dbg_reader();
+
+  void
+  stop_dbg_reader();
+
+  void
+  drain_dbg_ring();
+
   // Only for AMDXDNA_BO_CMD type
-  std::map<size_t, uint32_t> m_args_map;
-  mutable std::mutex m_args_map_lock;
+  // Arg BO handles indexed by bind position, AMDXDNA_INVALID_BO_HANDLE if
+  // unbound. Storage is kept across re-binding to avoid allocation.
+  std::vector<uint32_t> m_args_slots;
+  // Bound handles in position order, rebuilt only after bindings change
+  mutable std::vector<uint32_t> m_args_flat;
+  mutable bool m_args_dirty = false;
+  mutable std::mutex m_args_lock;
+  // Resident set of m_args_flat, guarded by m_args_lock
+  std::weak_ptr<resident_set_owner> m_rset_owner;
+  uint32_t m_rset_id = 0;
+  uint32_t m_rset_submits = 0;
+
+  // Set if DRM BO and mapping are shared with other importers
+  bool m_import_cached = false;
+  // Set if BO is a chunk of a sub-allocator slab at m_sub_offset
+  bool m_suballoc = false;
+  size_t m_sub_offset = 0;
+
+  // Only for debug ring
+  std::thread m_dbg_thread;
+  std::mutex m_dbg_lock;
+  std::condition_variable m_dbg_cv;
+  bool m_dbg_stop = false;
+  FILE *m_dbg_file = nullptr;
+  uint64_t m_dbg_rd = 0;   // bytes consumed so far
+  uint64_t m_dbg_lost = 0; // bytes overwritten before they were read
+  // Ring layout driver set up, checked against the header on each poll
+  uint32_t m_dbg_data_offset = 0;
+  uint32_t m_dbg_size = 0;
+  bool m_dbg_broken = false;
 };
 
 } // namespace shim_xdna
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "bo.h"
+#include "graph.h"
+
+namespace shim_xdna {
+
+cmd_graph::node_id
+cmd_graph::
+add_command(hw_q_kmq *hwq, xrt_core::buffer_handle *cmd_bo, const std::vector<node_id>& deps)
+{
+  node_id id = static_cast<node_id>(m_nodes.size());
+
+  if (!m_nodes.empty() && &m_nodes.front().hwq->m_pdev != &hwq->m_pdev)
+    shim_err(EINVAL, "Graph can't span devices");
+  for (auto d : deps) {
+    if (d >= id)
+      shim_err(EINVAL, "Node %d can't depend on node %d added after it", id, d);
+  }
+
+  m_nodes.push_back({ hwq, cmd_bo, deps });
+  m_exec_nodes.clear();
+  return id;
+}
+
+void
+cmd_graph::
+instantiate()
+{
+  // Assuming 1024 max args per cmd bo
+  const size_t max_arg_bos = 1024;
+
+  m_exec_nodes.clear();
+  m_exec_args.clear();
+  m_exec_nodes.reserve(m_nodes.size());
+
+  // Arg BO handles of each node are followed by its dependencies
+  for (auto& n : m_nodes) {
+    auto boh = static_cast<bo_kmq*>(n.cmd_bo);
+    auto off = m_exec_args.size();
+
+    m_exec_args.resize(off + max_arg_bos);
+    auto cnt = boh->get_arg_bo_handles(&m_exec_args[off], max_arg_bos);
+    m_exec_args.resize(off + cnt);
+    m_exec_args.insert(m_exec_args.end(), n.deps.begin(), n.deps.end());
+
+    m_exec_nodes.push_back({
+      .ctx = n.hwq->m_hwctx->get_slotidx(),
+      .cmd_handle = boh->get_drm_bo_handle(),
+      .arg_count = static_cast<uint32_t>(cnt),
+      .dep_count = static_cast<uint32_t>(n.deps.size()),
+    });
+  }
+}
+
+void
+cmd_graph::
+submit()
+{
+  if (m_nodes.empty())
+    return;
+  if (m_exec_nodes.size() != m_nodes.size())
+    instantiate();
+
+  amdxdna_drm_exec_cmd ecmd = {
+    .type = AMDXDNA_CMD_SUBMIT_GRAPH,
+    .cmd_handles = reinterpret_cast<uintptr_t>(m_exec_nodes.data()),
+    .args = reinterpret_cast<uintptr_t>(m_exec_args.data()),
+    .cmd_count = static_cast<uint32_t>(m_exec_nodes.size()),
+    .arg_count = static_cast<uint32_t>(m_exec_args.size()),
+  };
+
+  // Commands held back for chaining go first, as they were submitted earlier
+  for (auto& n : m_nodes)
+    n.hwq->flush_commands();
+
+  // Nodes queued before a failure still complete and can be waited on
+  auto set_cmd_ids = [this, &ecmd] {
+    for (uint32_t i = 0; i < ecmd.cmd_count && i < m_nodes.size(); i++) {
+      auto& n = m_nodes[i];
+      auto seq = m_exec_nodes[i].seq;
+      static_cast<bo_kmq*>(n.cmd_bo)->set_cmd_id(seq);
+      n.hwq->notify_on_completion(seq);
+    }
+  };
+
+  try {
+    m_nodes.front().hwq->m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+  }
+  catch (...) {
+    if (ecmd.cmd_count < m_nodes.size())
+      set_cmd_ids();
+    throw;
+  }
+  set_cmd_ids();
+  shim_debug("Submitted graph of %ld commands", m_nodes.size());
+}
+
+} // shim_xdna
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _GRAPH_KMQ_H_
+#define _GRAPH_KMQ_H_
+
+#include "hwq.h"
+#include "drm_local/amdxdna_accel.h"
+
+#include <vector>
+
+namespace shim_xdna {
+
+// Commands across one or more KMQ HW queues of a device, with dependencies
+// between them. The driver wires up the fences, so the whole graph goes out
+// with one EXEC_CMD ioctl instead of a submit/signal/wait per stage.
+class cmd_graph
+{
+public:
+  using node_id = uint32_t;
+
+  // Append a command which runs on hwq after all of deps have completed.
+  // Nodes can only depend on ones added before them.
+  node_id
+  add_command(hw_q_kmq *hwq, xrt_core::buffer_handle *cmd_bo,
+    const std::vector<node_id>& deps = {});
+
+  // Build the ioctl payload. Done by submit() if not done yet, call again if
+  // arg BOs of a recorded command have changed.
+  void
+  instantiate();
+
+  // Queue all commands. Can be called again once they have completed.
+  void
+  submit();
+
+  size_t
+  size() const
+  { return m_nodes.size(); }
+
+private:
+  struct node {
+    hw_q_kmq *hwq;
+    xrt_core::buffer_handle *cmd_bo;
+    std::vector<node_id> deps;
+  };
+
+  std::vector<node> m_nodes;
+  std::vector<amdxdna_graph_node> m_exec_nodes;
+  std::vector<uint32_t> m_exec_args;
+};
+
+} // shim_xdna
+
+#endif // _GRAPH_KMQ_H_
@@ -21,6 +21,22 @@ print_cu_config(amdxdna_ctx_param_config_cu *config)
     shim_debug("CU_CONF: bo %d func=%d", conf[i].cu_bo, conf[i].cu_func);
 }
 
+// Efficiency mode window of all contexts, 0 to send commands right away
+uint32_t
+get_coalesce_us()
+{
+  static uint32_t us = xrt_core::config::detail::get_uint_value("Debug.hwctx_coalesce_us", 0);
+  return us;
+}
+
+// Sub-commands per chain message that complete ahead of the chain, 0 for off
+uint32_t
+get_chain_progress()
+{
+  static uint32_t cnt = xrt_core::config::detail::get_uint_value("Debug.hwctx_chain_progress", 0);
+  return cnt;
+}
+
 }
 
 namespace shim_xdna {
@@ -31,7 +47,8 @@ hw_ctx_kmq(const device& device, const xrt::xclbin& xclbin, const xrt::hw_contex
 {
   hw_ctx::create_ctx_on_device();
 
-  auto cu_info = get_cu_info();
+  auto& cu_info = get_cu_info();
+  auto& xp = get_xclbin_parse();
   std::vector<char> cu_conf_param_buf(
     sizeof(amdxdna_ctx_param_config_cu) + cu_info.size() * sizeof(amdxdna_cu_config));
   auto cu_conf_param = reinterpret_cast<amdxdna_ctx_param_config_cu *>(cu_conf_param_buf.data());
@@ -39,19 +56,21 @@ hw_ctx_kmq(const device& device, const xrt::xclbin& xclbin, const xrt::hw_contex
   cu_conf_param->num_cus = cu_info.size();
   xcl_bo_flags f = {};
   f.flags = XRT_BO_FLAGS_CACHEABLE;
-  for (int i = 0; i < cu_info.size(); i++) {
+
+  // PDI BOs are not bound to a context, so contexts from one xclbin share them
+  std::unique_lock<std::mutex> lock(xp.m_pdi_lock);
+  for (int i = xp.m_pdi_bos.size(); i < cu_info.size(); i++) {
     auto& ci = cu_info[i];
 
-    m_pdi_bos.push_back(alloc_bo(nullptr, ci.m_pdi.size(), f.all));
-    auto& pdi_bo = m_pdi_bos[i];
-    auto pdi_vaddr = reinterpret_cast<char *>(
-      pdi_bo->map(xrt_core::buffer_handle::map_type::write));
+    xp.m_pdi_bos.push_back(get_device().get_pdi_bo(ci.m_pdi,
+      [this, &ci, &f] { return alloc_bo(nullptr, ci.m_pdi.size(), f.all); }));
+  }
+  lock.unlock();
 
+  for (int i = 0; i < cu_info.size(); i++) {
     auto& cf = cu_conf_param->cu_configs[i];
-    std::memcpy(pdi_vaddr, ci.m_pdi.data(), ci.m_pdi.size());
-    pdi_bo->sync(xrt_core::buffer_handle::direction::host2device, pdi_bo->get_properties().size, 0);
-    cf.cu_bo = static_cast<bo*>(pdi_bo.get())->get_drm_bo_handle();
-    cf.cu_func = ci.m_func;
+    cf.cu_bo = static_cast<bo*>(xp.m_pdi_bos[i].get())->get_drm_bo_handle();
+    cf.cu_func = cu_info[i].m_func;
   }
 
   print_cu_config(cu_conf_param);
@@ -63,6 +82,30 @@ hw_ctx_kmq(const device& device, const xrt::xclbin& xclbin, const xrt::hw_contex
   arg.param_val_size = cu_conf_param_buf.size();
   get_device().get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &arg);
 
+  if (get_coalesce_us()) {
+    amdxdna_drm_config_ctx carg = {};
+    carg.handle = get_slotidx();
+    carg.param_type = DRM_AMDXDNA_CTX_CONFIG_COALESCE;
+    carg.param_val = get_coalesce_us();
+    try {
+      get_device().get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &carg);
+    } catch (const xrt_core::system_error& e) {
+      shim_debug("Efficiency mode not set: %s", e.what());
+    }
+  }
+
+  if (get_chain_progress()) {
+    amdxdna_drm_config_ctx parg = {};
+    parg.handle = get_slotidx();
+    parg.param_type = DRM_AMDXDNA_CTX_CONFIG_CHAIN_PROGRESS;
+    parg.param_val = get_chain_progress();
+    try {
+      get_device().get_pdev().ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &parg);
+    } catch (const xrt_core::system_error& e) {
+      shim_debug("Chain progress not set: %s", e.what());
+    }
+  }
+
   shim_debug("Created KMQ HW context (%d)", get_slotidx());
 }
 
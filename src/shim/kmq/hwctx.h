@@ -16,9 +16,6 @@ public:
 
   std::unique_ptr<xrt_core::buffer_handle>
   alloc_bo(void* userptr, size_t size, uint64_t flags) override;
-
-private:
-  std::vector< std::unique_ptr<xrt_core::buffer_handle> > m_pdi_bos;
 };
 
 } // shim_xdna
@@ -3,9 +3,375 @@
 
 #include "bo.h"
 #include "hwq.h"
+#include "ert.h"
+#include "core/common/config_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <thread>
+
+namespace {
+
+bool
+is_auto_chain_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.cmd_auto_chain", false);
+  return enabled;
+}
+
+uint32_t
+get_auto_chain_max()
+{
+  // Driver splits longer chains into several messages, keep within one
+  static uint32_t len = std::clamp<uint32_t>(
+    xrt_core::config::detail::get_uint_value("Debug.cmd_auto_chain_max", 16), 2, 64);
+  return len;
+}
+
+uint32_t
+get_auto_chain_budget_us()
+{
+  static uint32_t us = xrt_core::config::detail::get_uint_value("Debug.cmd_auto_chain_budget_us", 100);
+  return us;
+}
+
+bool
+is_seq_page_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.kmq_seq_page", true);
+  return enabled;
+}
+
+// Repeatedly submitted cmd BOs register their arg BOs as a resident set.
+// Resident BOs are not implicitly fenced, so this is opt-in.
+bool
+is_resident_arg_bos_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.resident_arg_bos", false);
+  return enabled;
+}
+
+// Sub-commands of a chain are bound at pos << 6, see bo_kmq::bind_at()
+const uint32_t max_chained_cmd_args = 64;
+
+}
 
 namespace shim_xdna {
 
+// While the device is idle, a command is submitted right away. While it is
+// busy, following commands of the same opcode are held back and submitted as
+// one ERT_CMD_CHAIN when the target length is reached or the oldest one has
+// waited for the latency budget. The target length doubles when chains fill
+// up and halves when the budget expires first, so it follows the submission
+// rate. Driver only updates the chain BO, its state is copied to the
+// sub-commands when the chain is found completed. Held back and chained
+// commands are registered with the chainer, a command destroyed before
+// that is dropped from its chain, see release_cmd().
+class hw_q_kmq::cmd_chainer : public bo::cmd_holder
+{
+public:
+  cmd_chainer(hw_q_kmq& q)
+    : m_q(q)
+    , m_max(get_auto_chain_max())
+    , m_budget(std::chrono::microseconds(get_auto_chain_budget_us()))
+    , m_hold(std::make_shared<bo::cmd_hold>())
+  {
+    m_hold->holder = this;
+    m_thread = std::thread([this] { run(); });
+    shim_debug("Auto chaining up to %d commands, budget %ldus", m_max,
+      static_cast<long>(m_budget.count()));
+  }
+
+  ~cmd_chainer()
+  {
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      m_stop = true;
+      try {
+        flush_locked();
+      }
+      catch (const std::exception& e) {
+        shim_debug("Failed to flush chained commands: %s", e.what());
+      }
+    }
+    m_cv.notify_all();
+    m_thread.join();
+
+    // Sub-commands get their state only from a reaped chain
+    {
+      std::lock_guard<std::mutex> lg(m_lock);
+      for (auto& c : m_inflight) {
+        try {
+          m_q.hw_q::wait_command(c.bo.get(), 0);
+        }
+        catch (const std::exception& e) {
+          shim_debug("Failed to wait for chained commands (%ld): %s", c.seq, e.what());
+        }
+      }
+      reap_locked();
+      if (!m_inflight.empty())
+        shim_debug("%ld chains never completed", m_inflight.size());
+    }
+    {
+      std::lock_guard<std::mutex> lg(m_hold->lock);
+      m_hold->holder = nullptr;
+    }
+    shim_debug("Auto chained %ld commands in %ld chains", m_chained_cmds, m_chains);
+  }
+
+  void
+  release_cmd(bo *cmd) override
+  {
+    xrt_core::buffer_handle *bh = cmd;
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    // Never went out, nothing waits for it anymore
+    m_pending.erase(std::remove(m_pending.begin(), m_pending.end(), bh), m_pending.end());
+    // Driver holds its own reference till the chain completes
+    for (auto& c : m_inflight)
+      std::replace(c.cmds.begin(), c.cmds.end(), bh, static_cast<xrt_core::buffer_handle *>(nullptr));
+  }
+
+  // Returns false if caller should submit the command by itself
+  bool
+  submit(xrt_core::buffer_handle *cmd)
+  {
+    auto pkt = reinterpret_cast<ert_packet *>(cmd->map(xrt_core::buffer_handle::map_type::write));
+    uint32_t args[max_chained_cmd_args];
+    bool chainable = pkt->opcode != ERT_CMD_CHAIN;
+
+    if (chainable) {
+      try {
+        static_cast<bo_kmq*>(cmd)->get_arg_bo_handles(args, max_chained_cmd_args);
+      }
+      catch (const xrt_core::system_error&) {
+        chainable = false;
+      }
+    }
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    reap_locked();
+    if (!chainable || (!m_pending.empty() && pkt->opcode != m_pending_op)) {
+      flush_locked();
+      return false;
+    }
+    if (m_pending.empty()) {
+      if (device_idle_locked())
+        return false;
+      m_pending_ts = clock::now();
+      m_pending_op = pkt->opcode;
+    }
+
+    static_cast<bo*>(cmd)->set_cmd_hold(m_hold);
+    m_pending.push_back(cmd);
+    if (m_pending.size() >= m_target) {
+      m_target = std::min(m_target * 2, m_max);
+      flush_locked();
+      return true;
+    }
+    lk.unlock();
+    m_cv.notify_one();
+    return true;
+  }
+
+  void
+  flush()
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    flush_locked();
+  }
+
+  // Command to wait on for cmd, which is its chain if it is chained
+  xrt_core::buffer_handle *
+  resolve(xrt_core::buffer_handle *cmd)
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    if (std::find(m_pending.begin(), m_pending.end(), cmd) != m_pending.end())
+      flush_locked();
+    reap_locked();
+    for (auto& c : m_inflight) {
+      if (std::find(c.cmds.begin(), c.cmds.end(), cmd) != c.cmds.end())
+        return c.bo.get();
+    }
+    return cmd;
+  }
+
+  void
+  reap()
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    reap_locked();
+  }
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct chain {
+    std::unique_ptr<bo_kmq> bo;
+    std::vector<xrt_core::buffer_handle *> cmds;
+    uint64_t seq;
+  };
+
+  static ert_packet *
+  get_pkt(xrt_core::buffer_handle *cmd)
+  {
+    return reinterpret_cast<ert_packet *>(cmd->map(xrt_core::buffer_handle::map_type::write));
+  }
+
+  bool
+  device_idle_locked()
+  {
+    if (!m_inflight.empty())
+      return false;
+    if (m_last_seq == 0)
+      return true;
+
+    uint32_t syncobj = m_q.m_hwctx->get_syncobj();
+    uint64_t point = 0;
+    drm_syncobj_timeline_array query = {
+      .handles = reinterpret_cast<uintptr_t>(&syncobj),
+      .points = reinterpret_cast<uintptr_t>(&point),
+      .count_handles = 1,
+      .flags = 0,
+    };
+    m_q.m_pdev.ioctl(DRM_IOCTL_SYNCOBJ_QUERY, &query);
+    return point >= m_last_seq;
+  }
+
+  void
+  flush_locked()
+  {
+    if (m_pending.empty())
+      return;
+
+    if (m_pending.size() == 1) {
+      auto cmd = m_pending.front();
+      m_pending.clear();
+      m_q.issue_command(cmd);
+      m_last_seq = static_cast<bo*>(cmd)->get_cmd_id();
+      return;
+    }
+
+    chain c;
+    if (m_free.empty()) {
+      auto sz = sizeof(ert_packet) + sizeof(ert_cmd_chain_data) + m_max * sizeof(uint64_t);
+      c.bo = std::make_unique<bo_kmq>(m_q.m_pdev, sz, AMDXDNA_BO_CMD);
+    } else {
+      c.bo = std::move(m_free.back());
+      m_free.pop_back();
+    }
+    c.cmds.swap(m_pending);
+
+    auto pkt = get_pkt(c.bo.get());
+    pkt->state = ERT_CMD_STATE_NEW;
+    pkt->count = (c.cmds.size() * sizeof(uint64_t) + sizeof(ert_cmd_chain_data)) / sizeof(uint32_t);
+    pkt->opcode = ERT_CMD_CHAIN;
+    pkt->type = ERT_SCU;
+    auto payload = get_ert_cmd_chain_data(pkt);
+    payload->command_count = c.cmds.size();
+    payload->submit_index = 0;
+    payload->error_index = 0;
+    for (size_t i = 0; i < c.cmds.size(); i++) {
+      auto boh = static_cast<bo_kmq*>(c.cmds[i]);
+      payload->data[i] = boh->get_drm_bo_handle();
+      c.bo->bind_at(i, boh, 0, 0);
+    }
+
+    try {
+      m_q.issue_command(c.bo.get());
+    }
+    catch (...) {
+      // Never reached the driver, let waiters of the sub-commands see it
+      for (auto cmd : c.cmds)
+        get_pkt(cmd)->state = ERT_CMD_STATE_ABORT;
+      m_free.push_back(std::move(c.bo));
+      throw;
+    }
+    c.seq = c.bo->get_cmd_id();
+    for (auto cmd : c.cmds)
+      static_cast<bo*>(cmd)->set_cmd_id(c.seq);
+    m_last_seq = c.seq;
+    m_chained_cmds += c.cmds.size();
+    m_chains++;
+    shim_debug("Auto chained %ld commands as (%ld)", c.cmds.size(), c.seq);
+    m_inflight.push_back(std::move(c));
+  }
+
+  // Chains complete in submission order
+  void
+  reap_locked()
+  {
+    while (!m_inflight.empty()) {
+      auto& c = m_inflight.front();
+      auto pkt = get_pkt(c.bo.get());
+      auto state = pkt->state;
+      if (state < ERT_CMD_STATE_COMPLETED)
+        return;
+
+      auto err = get_ert_cmd_chain_data(pkt)->error_index;
+      for (size_t i = 0; i < c.cmds.size(); i++) {
+        auto s = ERT_CMD_STATE_COMPLETED;
+        if (state != ERT_CMD_STATE_COMPLETED && i >= err)
+          s = i == err ? static_cast<ert_cmd_state>(state) : ERT_CMD_STATE_ABORT;
+        // Destroyed while chained
+        if (c.cmds[i])
+          get_pkt(c.cmds[i])->state = s;
+      }
+      m_free.push_back(std::move(c.bo));
+      m_inflight.pop_front();
+    }
+  }
+
+  void
+  run()
+  {
+    std::unique_lock<std::mutex> lk(m_lock);
+    while (!m_stop) {
+      if (m_pending.empty()) {
+        m_cv.wait(lk);
+        continue;
+      }
+      auto deadline = m_pending_ts + m_budget;
+      if (clock::now() < deadline) {
+        m_cv.wait_until(lk, deadline);
+        continue;
+      }
+      // Budget ran out before the chain filled up
+      m_target = std::max(m_target / 2, 2u);
+      try {
+        flush_locked();
+      }
+      catch (const std::exception& e) {
+        shim_debug("Failed to submit chained commands: %s", e.what());
+      }
+    }
+  }
+
+  hw_q_kmq& m_q;
+  const uint32_t m_max;
+  const std::chrono::microseconds m_budget;
+  uint32_t m_target = 2;
+
+  // Lock order is m_hold->lock, then m_lock
+  std::shared_ptr<bo::cmd_hold> m_hold;
+  std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::thread m_thread;
+  bool m_stop = false;
+
+  std::vector<xrt_core::buffer_handle *> m_pending;
+  clock::time_point m_pending_ts;
+  uint32_t m_pending_op = 0;
+  std::list<chain> m_inflight;
+  std::vector<std::unique_ptr<bo_kmq>> m_free;
+  uint64_t m_last_seq = 0;
+
+  uint64_t m_chained_cmds = 0;
+  uint64_t m_chains = 0;
+};
+
 hw_q_kmq::
 hw_q_kmq(const device& device) : hw_q(device)
 {
@@ -16,6 +382,106 @@ hw_q_kmq::
 ~hw_q_kmq()
 {
   shim_debug("Destroying KMQ HW queue");
+  m_chainer.reset();
+}
+
+void
+hw_q_kmq::
+submit_command(xrt_core::buffer_handle *cmd)
+{
+  if (m_chainer && m_chainer->submit(cmd))
+    return;
+  hw_q::submit_command(cmd);
+}
+
+void
+hw_q_kmq::
+submit_command(const std::vector<xrt_core::buffer_handle *>& cmds)
+{
+  flush_commands();
+  hw_q::submit_command(cmds);
+}
+
+bool
+hw_q_kmq::
+seq_pending(xrt_core::buffer_handle *cmd) const
+{
+  if (!m_seq_page)
+    return false;
+
+  auto seq = static_cast<bo*>(cmd)->get_cmd_id();
+  if (seq == static_cast<uint64_t>(-1))
+    return false;
+  // Page never runs ahead of the command state, only trust it for pending
+  return seq >= __atomic_load_n(&m_seq_page->completed, __ATOMIC_ACQUIRE);
+}
+
+uint64_t
+hw_q_kmq::
+seq_completed() const
+{
+  if (!m_seq_page)
+    return static_cast<uint64_t>(-1);
+  return __atomic_load_n(&m_seq_page->completed, __ATOMIC_ACQUIRE);
+}
+
+int
+hw_q_kmq::
+poll_command(xrt_core::buffer_handle *cmd) const
+{
+  if (m_chainer)
+    m_chainer->resolve(cmd);
+  if (seq_pending(cmd))
+    return 0;
+  return hw_q::poll_command(cmd);
+}
+
+int
+hw_q_kmq::
+wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
+{
+  if (!m_chainer)
+    return hw_q::wait_command(cmd, timeout_ms);
+
+  auto c = m_chainer->resolve(cmd);
+  if (hw_q::poll_command(cmd))
+    return 1;
+  auto ret = hw_q::wait_command(c, timeout_ms);
+  if (c != cmd)
+    m_chainer->reap();
+  return ret;
+}
+
+void
+hw_q_kmq::
+submit_wait(const xrt_core::fence_handle* f)
+{
+  flush_commands();
+  hw_q::submit_wait(f);
+}
+
+void
+hw_q_kmq::
+submit_wait(const std::vector<xrt_core::fence_handle*>& fences)
+{
+  flush_commands();
+  hw_q::submit_wait(fences);
+}
+
+void
+hw_q_kmq::
+submit_signal(const xrt_core::fence_handle* f)
+{
+  flush_commands();
+  hw_q::submit_signal(f);
+}
+
+void
+hw_q_kmq::
+flush_commands()
+{
+  if (m_chainer)
+    m_chainer->flush();
 }
 
 void
@@ -37,19 +503,122 @@ issue_command(xrt_core::buffer_handle *cmd_bo)
     .cmd_count = 1,
     .arg_count = static_cast<uint32_t>(boh->get_arg_bo_handles(arg_bo_hdls, max_arg_bos)),
   };
+  auto rset = m_rset_owner ? boh->get_resident_set(m_rset_owner) : 0;
+  if (rset) {
+    ecmd.ext = rset;
+    ecmd.ext_flags = AMDXDNA_EXEC_FLAG_RESIDENT_SET;
+    ecmd.arg_count = 0;
+  }
   m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
 
   auto id = ecmd.seq;
   boh->set_cmd_id(id);
+  notify_on_completion(id);
   shim_debug("Submitted command (%ld)", id);
 }
 
+void
+hw_q_kmq::
+issue_command(const std::vector<xrt_core::buffer_handle *>& cmd_bos)
+{
+  // Assuming 1024 max args per cmd bo
+  const size_t max_arg_bos = 1024;
+
+  std::vector<uint32_t> cmd_bo_hdls;
+  std::vector<uint32_t> arg_bo_hdls;
+  cmd_bo_hdls.reserve(cmd_bos.size());
+
+  // Arg BO handles of each cmd are prefixed by their count
+  for (auto cmd_bo : cmd_bos) {
+    auto boh = static_cast<bo_kmq*>(cmd_bo);
+    auto off = arg_bo_hdls.size();
+
+    cmd_bo_hdls.push_back(boh->get_drm_bo_handle());
+    arg_bo_hdls.resize(off + 1 + max_arg_bos);
+    arg_bo_hdls[off] = boh->get_arg_bo_handles(&arg_bo_hdls[off + 1], max_arg_bos);
+    arg_bo_hdls.resize(off + 1 + arg_bo_hdls[off]);
+  }
+
+  amdxdna_drm_exec_cmd ecmd = {
+    .ctx = m_hwctx->get_slotidx(),
+    .type = AMDXDNA_CMD_SUBMIT_EXEC_BUF,
+    .cmd_handles = reinterpret_cast<uintptr_t>(cmd_bo_hdls.data()),
+    .args = reinterpret_cast<uintptr_t>(arg_bo_hdls.data()),
+    .cmd_count = static_cast<uint32_t>(cmd_bo_hdls.size()),
+    .arg_count = static_cast<uint32_t>(arg_bo_hdls.size()),
+  };
+
+  auto set_cmd_ids = [&ecmd, &cmd_bos] {
+    for (uint32_t i = 0; i < ecmd.cmd_count && i < cmd_bos.size(); i++)
+      static_cast<bo_kmq*>(cmd_bos[i])->set_cmd_id(ecmd.seq + i);
+  };
+
+  try {
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+  }
+  catch (...) {
+    // Commands queued before the failure still complete and can be waited on.
+    // A count not below the requested one means the driver never saw the batch.
+    if (ecmd.cmd_count < cmd_bos.size())
+      set_cmd_ids();
+    throw;
+  }
+  set_cmd_ids();
+  for (uint32_t i = 0; i < ecmd.cmd_count; i++)
+    notify_on_completion(ecmd.seq + i);
+  shim_debug("Submitted commands (%ld) - (%ld)", ecmd.seq, ecmd.seq + ecmd.cmd_count - 1);
+}
+
 void
 hw_q_kmq::
 bind_hwctx(const hw_ctx *ctx)
 {
   // link hwctx by parent class
   hw_q::bind_hwctx(ctx);
+  // Idle check needs the context timeline
+  if (is_auto_chain_enabled() && ctx->get_syncobj() != AMDXDNA_INVALID_FENCE_HANDLE)
+    m_chainer = std::make_unique<cmd_chainer>(*this);
+  if (is_resident_arg_bos_enabled())
+    m_rset_owner = std::make_shared<resident_set_owner>(resident_set_owner{ ctx->get_slotidx() });
+
+  if (!is_seq_page_enabled())
+    return;
+  try {
+    // const_cast: alloc_bo() is not const yet in device class
+    auto& dev = const_cast<device&>(ctx->get_device());
+    xcl_bo_flags f = {};
+    f.flags = XRT_BO_FLAGS_HOST_ONLY;
+    auto sbo = dev.alloc_bo(nullptr, AMDXDNA_INVALID_CTX_HANDLE,
+      sizeof(amdxdna_ctx_seq_page), f.all);
+    // Map first, page can't be taken back from driver once it is set.
+    // BO only maps as write, page is only read here.
+    auto page = reinterpret_cast<const amdxdna_ctx_seq_page *>(
+      sbo->map(xrt_core::buffer_handle::map_type::write));
+
+    amdxdna_drm_config_ctx arg = {};
+    arg.handle = ctx->get_slotidx();
+    arg.param_type = DRM_AMDXDNA_CTX_CONFIG_SEQ_PAGE;
+    arg.param_val = static_cast<bo*>(sbo.get())->get_drm_bo_handle();
+    m_pdev.ioctl(DRM_IOCTL_AMDXDNA_CONFIG_CTX, &arg);
+
+    m_seq_page = page;
+    m_seq_bo = std::move(sbo);
+  }
+  catch (const xrt_core::system_error& e) {
+    shim_debug("Completion page not set: %s", e.what());
+  }
+}
+
+void
+hw_q_kmq::
+unbind_hwctx()
+{
+  m_chainer.reset();
+  // Context goes away with its resident sets
+  m_rset_owner.reset();
+  m_seq_page = nullptr;
+  m_seq_bo.reset();
+  hw_q::unbind_hwctx();
 }
 
 } // shim_xdna
@@ -5,9 +5,12 @@
 #define _HWQ_KMQ_H_
 
 #include "../hwq.h"
+#include <memory>
 
 namespace shim_xdna {
 
+struct resident_set_owner;
+
 class hw_q_kmq : public hw_q
 {
 public:
@@ -18,8 +21,66 @@ public:
   void
   bind_hwctx(const hw_ctx *ctx);
 
+  void
+  unbind_hwctx() override;
+
+  using hw_q::submit_command;
+
+  // Coalesced into an ERT_CMD_CHAIN with following ones if auto chaining is on
+  void
+  submit_command(xrt_core::buffer_handle *) override;
+
+  void
+  submit_command(const std::vector<xrt_core::buffer_handle *>&) override;
+
+  int
+  poll_command(xrt_core::buffer_handle *) const override;
+
+  using hw_q::wait_command;
+
+  int
+  wait_command(xrt_core::buffer_handle *, uint32_t timeout_ms) const override;
+
+  void
+  submit_wait(const xrt_core::fence_handle*) override;
+
+  void
+  submit_wait(const std::vector<xrt_core::fence_handle*>&) override;
+
+  void
+  submit_signal(const xrt_core::fence_handle*) override;
+
+  // Submit commands held back for auto chaining
+  void
+  flush_commands();
+
   void
   issue_command(xrt_core::buffer_handle *) override;
+
+  void
+  issue_command(const std::vector<xrt_core::buffer_handle *>&) override;
+
+  // Completed count on the driver's completion page, -1 if there is no page
+  uint64_t
+  seq_completed() const;
+
+private:
+  friend class cmd_graph;
+
+  // Coalesces back to back single submissions, see Debug.cmd_auto_chain
+  class cmd_chainer;
+  std::unique_ptr<cmd_chainer> m_chainer;
+
+  // True if the driver's completion page shows cmd still running
+  bool
+  seq_pending(xrt_core::buffer_handle *cmd) const;
+
+  // Completion page of the context, see Debug.kmq_seq_page
+  std::unique_ptr<xrt_core::buffer_handle> m_seq_bo;
+  const amdxdna_ctx_seq_page *m_seq_page = nullptr;
+
+  // Cmd BOs register resident sets with it, see Debug.resident_arg_bos
+  std::shared_ptr<resident_set_owner> m_rset_owner;
 };
 
 } // shim_xdna
@@ -21,6 +21,27 @@ get_heap_num_pages()
   return num;
 }
 
+bool
+is_bo_suballoc_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.bo_suballoc", false);
+  return enabled;
+}
+
+bool
+is_bo_import_cache_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.bo_import_cache", false);
+  return enabled;
+}
+
+bool
+is_deferred_bo_free_enabled()
+{
+  static bool enabled = xrt_core::config::detail::get_bool_value("Debug.deferred_bo_free", false);
+  return enabled;
+}
+
 }
 
 namespace shim_xdna {
@@ -52,14 +73,89 @@ on_first_open() const
   auto heap_sz = heap_page_size * get_heap_num_pages();
   // Alloc device memory on first device open.
   m_dev_heap_bo = std::make_unique<bo_kmq>(*this, heap_sz, AMDXDNA_BO_DEV_HEAP);
+  if (!m_cmd_bo_pool)
+    m_cmd_bo_pool = std::make_unique<cmd_bo_pool>(*this);
+  m_cmd_bo_pool->open();
+  if (is_bo_suballoc_enabled())
+    m_suballocator = std::make_unique<bo_suballocator>(*this);
+  if (is_bo_import_cache_enabled())
+    m_import_cache = std::make_unique<bo_import_cache>(*this);
+  if (is_deferred_bo_free_enabled())
+    m_bo_reaper = std::make_unique<bo_reaper>(*this);
 }
 
 void
 pdev_kmq::
 on_last_close() const
 {
+  m_bo_reaper.reset();
+  m_import_cache.reset();
+  // Slabs may be carved from device heap, free them first
+  m_suballocator.reset();
+  // Cmd BOs being freed may still reach the pool, keep it around closed
+  if (m_cmd_bo_pool)
+    m_cmd_bo_pool->close();
+  m_dev_heap_chunks.clear();
   m_dev_heap_bo.reset();
 }
 
+cmd_bo_pool *
+pdev_kmq::
+get_cmd_bo_pool() const
+{
+  return m_cmd_bo_pool.get();
+}
+
+bo_suballocator *
+pdev_kmq::
+get_suballocator() const
+{
+  return m_suballocator.get();
+}
+
+bo_import_cache *
+pdev_kmq::
+get_import_cache() const
+{
+  return m_import_cache.get();
+}
+
+bo_reaper *
+pdev_kmq::
+get_bo_reaper() const
+{
+  return m_bo_reaper.get();
+}
+
+uint32_t
+pdev_kmq::
+get_dev_heap_gen() const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+  return m_dev_heap_gen;
+}
+
+bool
+pdev_kmq::
+grow_dev_heap(size_t size, uint32_t gen) const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+
+  // Someone else has grown it, just retry
+  if (gen != m_dev_heap_gen)
+    return true;
+
+  auto chunk_sz = heap_page_size * ((size + heap_page_size - 1) / heap_page_size);
+  try {
+    m_dev_heap_chunks.push_back(std::make_unique<bo_kmq>(*this, chunk_sz, AMDXDNA_BO_DEV_HEAP));
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Can't grow device heap by 0x%lx: %s", chunk_sz, e.what());
+    return false;
+  }
+  m_dev_heap_gen++;
+  shim_debug("Grew device heap by 0x%lx, %ld chunks", chunk_sz, m_dev_heap_chunks.size() + 1);
+  return true;
+}
+
 } // namespace shim_xdna
 
@@ -6,10 +6,17 @@
 
 #include "../pcidrv.h"
 #include "../pcidev.h"
+#include <mutex>
+#include <vector>
 
 
 namespace shim_xdna {
 
+class cmd_bo_pool;
+class bo_suballocator;
+class bo_import_cache;
+class bo_reaper;
+
 class pdev_kmq : public pdev
 {
 public:
@@ -19,8 +26,40 @@ public:
   std::shared_ptr<xrt_core::device>
   create_device(xrt_core::device::handle_type handle, xrt_core::device::id_type id) const override;
 
+  // Valid from first open till pdev goes away, closed while device is not open
+  cmd_bo_pool *
+  get_cmd_bo_pool() const;
+
+  // Valid while device is open, nullptr if sub-allocation is disabled
+  bo_suballocator *
+  get_suballocator() const;
+
+  // Valid while device is open, nullptr if import caching is disabled
+  bo_import_cache *
+  get_import_cache() const;
+
+  // Valid while device is open, nullptr if deferred BO free is disabled
+  bo_reaper *
+  get_bo_reaper() const;
+
+  // Generation of device heap, bumped each time it grows
+  uint32_t
+  get_dev_heap_gen() const;
+
+  // Add a heap chunk big enough for size unless heap has grown since gen.
+  // Returns false if heap can't grow any more.
+  bool
+  grow_dev_heap(size_t size, uint32_t gen) const;
+
 private:
   mutable std::unique_ptr<xrt_core::buffer_handle> m_dev_heap_bo;
+  mutable std::vector<std::unique_ptr<xrt_core::buffer_handle>> m_dev_heap_chunks;
+  mutable std::mutex m_dev_heap_lock;
+  mutable uint32_t m_dev_heap_gen = 0;
+  mutable std::unique_ptr<cmd_bo_pool> m_cmd_bo_pool;
+  mutable std::unique_ptr<bo_suballocator> m_suballocator;
+  mutable std::unique_ptr<bo_import_cache> m_import_cache;
+  mutable std::unique_ptr<bo_reaper> m_bo_reaper;
 
   virtual void
   on_first_open() const override;
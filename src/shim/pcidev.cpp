@@ -2,11 +2,16 @@
 // Copyright (C) 2022-2025, Advanced Micro Devices, Inc. All rights reserved.
 
 #include "device.h"
+#include "fence.h"
 #include "pcidev.h"
 #include "pcidrv.h"
 #include "shim_debug.h"
 #include "drm_local/amdxdna_accel.h"
+#include "core/common/config_reader.h"
 #include "core/common/trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <drm/virtgpu_drm.h>
 
 namespace {
@@ -27,6 +32,8 @@ namespace {
       return "DRM_IOCTL_AMDXDNA_GET_BO_INFO";
     case DRM_IOCTL_AMDXDNA_SYNC_BO:
       return "DRM_IOCTL_AMDXDNA_SYNC_BO";
+    case DRM_IOCTL_AMDXDNA_SYNC_BOS:
+      return "DRM_IOCTL_AMDXDNA_SYNC_BOS";
     case DRM_IOCTL_AMDXDNA_EXEC_CMD:
       return "DRM_IOCTL_AMDXDNA_EXEC_CMD";
     case DRM_IOCTL_AMDXDNA_WAIT_CMD:
@@ -53,6 +60,12 @@ namespace {
       return "DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE";
     case DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL:
       return "DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL";
+    case DRM_IOCTL_SYNCOBJ_RESET:
+      return "DRM_IOCTL_SYNCOBJ_RESET";
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+    case DRM_IOCTL_SYNCOBJ_EVENTFD:
+      return "DRM_IOCTL_SYNCOBJ_EVENTFD";
+#endif
     case DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT:
       return "DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT";
     case DRM_IOCTL_VIRTGPU_RESOURCE_CREATE_BLOB:
@@ -66,15 +79,161 @@ namespace {
     return "UNKNOWN(" + std::to_string(cmd) + ")";
   }
 
+  // Counters are kept per ioctl number, which is unique among the ioctls we issue
+  const size_t ioctl_stat_slots = 1 << _IOC_NRBITS;
+
+  struct ioctl_stat_slot {
+    std::atomic<unsigned long> cmd;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> hist[shim_xdna::ioctl_stat_buckets];
+  };
+
+  // Only the owner thread writes its block, so updates need no atomic RMW
+  struct ioctl_stat_block {
+    ioctl_stat_slot slot[ioctl_stat_slots] = {};
+  };
+
+  void
+  ioctl_stat_add(std::atomic<uint64_t>& c, uint64_t v)
+  {
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+  struct ioctl_stat_registry {
+    std::mutex lock;
+    std::vector<ioctl_stat_block*> live;
+    // Counters of threads that have exited
+    ioctl_stat_block retired;
+  };
+
+  ioctl_stat_registry&
+  get_ioctl_stat_registry()
+  {
+    // Never freed, thread_local destructors may run after static ones at exit
+    static auto r = new ioctl_stat_registry;
+    return *r;
+  }
+
+  struct ioctl_stat_holder {
+    std::unique_ptr<ioctl_stat_block> block;
+
+    ~ioctl_stat_holder()
+    {
+      if (!block)
+        return;
+
+      auto& r = get_ioctl_stat_registry();
+      const std::lock_guard<std::mutex> lock(r.lock);
+      for (size_t i = 0; i < ioctl_stat_slots; i++) {
+        auto& from = block->slot[i];
+        auto& to = r.retired.slot[i];
+        if (!from.count.load(std::memory_order_relaxed))
+          continue;
+        to.cmd.store(from.cmd.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        ioctl_stat_add(to.count, from.count.load(std::memory_order_relaxed));
+        ioctl_stat_add(to.total_ns, from.total_ns.load(std::memory_order_relaxed));
+        for (size_t b = 0; b < shim_xdna::ioctl_stat_buckets; b++)
+          ioctl_stat_add(to.hist[b], from.hist[b].load(std::memory_order_relaxed));
+      }
+      r.live.erase(std::find(r.live.begin(), r.live.end(), block.get()));
+    }
+  };
+
+  ioctl_stat_block&
+  get_ioctl_stat_block()
+  {
+    thread_local ioctl_stat_holder holder;
+
+    if (!holder.block) {
+      holder.block = std::make_unique<ioctl_stat_block>();
+      auto& r = get_ioctl_stat_registry();
+      const std::lock_guard<std::mutex> lock(r.lock);
+      r.live.push_back(holder.block.get());
+    }
+    return *holder.block;
+  }
+
+  void
+  ioctl_stat_record(unsigned long cmd, uint64_t ns)
+  {
+    auto& s = get_ioctl_stat_block().slot[_IOC_NR(cmd)];
+    uint64_t us = ns / 1000;
+    size_t b = us ? 64 - __builtin_clzll(us) : 0;
+
+    s.cmd.store(cmd, std::memory_order_relaxed);
+    ioctl_stat_add(s.count, 1);
+    ioctl_stat_add(s.total_ns, ns);
+    ioctl_stat_add(s.hist[std::min(b, shim_xdna::ioctl_stat_buckets - 1)], 1);
+  }
+
+  bool
+  is_ioctl_stats_dump_enabled()
+  {
+    static bool enabled = xrt_core::config::detail::get_bool_value("Debug.ioctl_stats", false);
+    return enabled;
+  }
+
+  void
+  dump_ioctl_stats()
+  {
+    for (auto& st : shim_xdna::get_ioctl_stats()) {
+      std::string hist;
+      for (auto h : st.hist)
+        hist += " " + std::to_string(h);
+      shim_info("%s: count %lu, avg %lu ns, buckets <1us <2us <4us ...:%s", st.name.c_str(),
+        st.count, st.total_ns / st.count, hist.c_str());
+    }
+  }
+
 }
 
 namespace shim_xdna {
 
+std::vector<ioctl_stat>
+get_ioctl_stats()
+{
+  std::vector<ioctl_stat> stats;
+  auto& r = get_ioctl_stat_registry();
+  const std::lock_guard<std::mutex> lock(r.lock);
+
+  for (size_t i = 0; i < ioctl_stat_slots; i++) {
+    ioctl_stat st = {};
+    unsigned long cmd = 0;
+    auto sum = [&](const ioctl_stat_block& blk) {
+      auto& s = blk.slot[i];
+      if (!s.count.load(std::memory_order_relaxed))
+        return;
+      cmd = s.cmd.load(std::memory_order_relaxed);
+      st.count += s.count.load(std::memory_order_relaxed);
+      st.total_ns += s.total_ns.load(std::memory_order_relaxed);
+      for (size_t b = 0; b < ioctl_stat_buckets; b++)
+        st.hist[b] += s.hist[b].load(std::memory_order_relaxed);
+    };
+
+    sum(r.retired);
+    for (auto blk : r.live)
+      sum(*blk);
+    if (!st.count)
+      continue;
+    st.name = ioctl_cmd2name(cmd);
+    stats.push_back(std::move(st));
+  }
+  return stats;
+}
+
 pdev::
 pdev(std::shared_ptr<const xrt_core::pci::drv> driver, std::string sysfs_name)
   : xrt_core::pci::dev(std::move(driver), std::move(sysfs_name))
 {
   m_is_ready = true; // We're always ready.
+
+  std::string err;
+  int node = -1;
+  sysfs_get("", "numa_node", err, node, -1);
+  if (err.empty() && node >= 0)
+    m_numa_node = node;
+  shim_debug("Device %s is on NUMA node %d", m_sysfs_name.c_str(), m_numa_node);
 }
 
 pdev::
@@ -116,6 +275,7 @@ open() const
       m_dev_fd = -1;
       throw;
     }
+    m_syncobj_pool = std::make_unique<syncobj_pool>(*this);
   }
   ++m_dev_users;
 }
@@ -129,6 +289,9 @@ close() const
 
   --m_dev_users;
   if (m_dev_users == 0) {
+    if (is_ioctl_stats_dump_enabled())
+      dump_ioctl_stats();
+    m_syncobj_pool.reset();
     on_last_close();
 
     // Stop new users of the fd from other threads.
@@ -140,13 +303,32 @@ close() const
   }
 }
 
+syncobj_pool *
+pdev::
+get_syncobj_pool() const
+{
+  return m_syncobj_pool.get();
+}
+
+int
+pdev::
+get_numa_node() const
+{
+  return m_numa_node;
+}
+
 void
 pdev::
 ioctl(unsigned long cmd, void* arg) const
 {
   XRT_TRACE_POINT_SCOPE2(ioctl, cmd, arg);
-  if (xrt_core::pci::dev::ioctl(m_dev_fd, cmd, arg) == -1)
-    shim_err(errno, "%s IOCTL failed", ioctl_cmd2name(cmd).c_str());
+  auto start = std::chrono::steady_clock::now();
+  auto ret = xrt_core::pci::dev::ioctl(m_dev_fd, cmd, arg);
+  auto err = errno;
+  ioctl_stat_record(cmd, std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count());
+  if (ret == -1)
+    shim_err(err, "%s IOCTL failed", ioctl_cmd2name(cmd).c_str());
 }
 
 void*
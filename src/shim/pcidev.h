@@ -8,9 +8,28 @@
 
 #include "core/pcie/linux/device_linux.h"
 #include "core/pcie/linux/pcidev.h"
+#include <array>
+#include <string>
+#include <vector>
 
 namespace shim_xdna {
 
+class syncobj_pool;
+
+// Bucket i counts ioctls that took less than 2^i us, the last bucket counts the rest
+constexpr size_t ioctl_stat_buckets = 22;
+
+struct ioctl_stat {
+  std::string name;
+  uint64_t count;
+  uint64_t total_ns;
+  std::array<uint64_t, ioctl_stat_buckets> hist;
+};
+
+// Always-on latency counters of all ioctls issued by this process so far
+std::vector<ioctl_stat>
+get_ioctl_stats();
+
 class pdev : public xrt_core::pci::dev
 {
 public:
@@ -40,6 +59,14 @@ public:
   void
   close() const;
 
+  // Valid while device is open
+  syncobj_pool *
+  get_syncobj_pool() const;
+
+  // NUMA node closest to the device's PCIe root, -1 if unknown
+  int
+  get_numa_node() const;
+
 private:
   virtual void
   on_first_open() const {}
@@ -49,6 +76,8 @@ private:
   mutable int m_dev_fd = -1;
   mutable int m_dev_users = 0;
   mutable std::mutex m_lock;
+  mutable std::unique_ptr<syncobj_pool> m_syncobj_pool;
+  int m_numa_node = -1;
 };
 
 } // namespace shim_xdna
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "stream.h"
+
+namespace shim_xdna {
+
+stream_q::
+stream_q(hw_q& q) : m_q(q)
+{
+}
+
+stream_q::
+~stream_q()
+{
+  // Commands still running keep using caller's BOs, let them finish
+  std::lock_guard<std::mutex> lg(m_lock);
+  for (auto idx : m_running)
+    m_q.wait_command(m_slots[idx].cmd, 0);
+}
+
+size_t
+stream_q::
+add_slot(xrt_core::buffer_handle *cmd, std::vector<xrt_core::buffer_handle *> in,
+  std::vector<xrt_core::buffer_handle *> out)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+
+  // Slots are referenced by index, adding one must not race with users
+  if (m_next || !m_running.empty())
+    shim_err(EBUSY, "Can't add stream slot after streaming started");
+  if (!cmd)
+    shim_err(EINVAL, "Stream slot needs a command BO");
+
+  m_slots.push_back({ cmd, std::move(in), std::move(out) });
+  return m_slots.size() - 1;
+}
+
+void
+stream_q::
+check_state(size_t idx, state st) const
+{
+  if (idx >= m_slots.size())
+    shim_err(EINVAL, "Invalid stream slot %ld", idx);
+  if (m_slots[idx].st != st)
+    shim_err(EINVAL, "Stream slot %ld in state %d, expect %d", idx,
+      static_cast<int>(m_slots[idx].st), static_cast<int>(st));
+}
+
+void
+stream_q::
+sync_all(const std::vector<xrt_core::buffer_handle *>& bos,
+  xrt_core::buffer_handle::direction dir)
+{
+  for (auto bo : bos)
+    bo->sync(dir, bo->get_properties().size, 0);
+}
+
+size_t
+stream_q::
+acquire()
+{
+  std::unique_lock<std::mutex> lk(m_lock);
+
+  if (m_slots.empty())
+    shim_err(EINVAL, "Stream has no slots");
+
+  // Round robin keeps slots in submission order, so only the next one counts
+  auto idx = m_next % m_slots.size();
+  m_cv.wait(lk, [this, idx] { return m_slots[idx].st == state::free; });
+  m_slots[idx].st = state::filling;
+  m_next++;
+  return idx;
+}
+
+void
+stream_q::
+submit(size_t idx)
+{
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    check_state(idx, state::filling);
+  }
+
+  // Slot is owned by the producer till it is on m_running
+  auto& s = m_slots[idx];
+  sync_all(s.in, xrt_core::buffer_handle::direction::host2device);
+  m_q.submit_command(s.cmd);
+
+  std::lock_guard<std::mutex> lg(m_lock);
+  s.st = state::running;
+  m_running.push_back(idx);
+  m_cv.notify_all();
+}
+
+int
+stream_q::
+complete(uint32_t timeout_ms)
+{
+  size_t idx;
+  {
+    std::lock_guard<std::mutex> lg(m_lock);
+    if (m_running.empty())
+      return -1;
+    idx = m_running.front();
+  }
+
+  // Only the consumer pops m_running, the front stays the same while waiting
+  auto& s = m_slots[idx];
+  if (!m_q.wait_command(s.cmd, timeout_ms))
+    return -1;
+  sync_all(s.out, xrt_core::buffer_handle::direction::device2host);
+
+  std::lock_guard<std::mutex> lg(m_lock);
+  m_running.pop_front();
+  s.st = state::done;
+  return static_cast<int>(idx);
+}
+
+void
+stream_q::
+release(size_t idx)
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  check_state(idx, state::done);
+  m_slots[idx].st = state::free;
+  m_cv.notify_all();
+}
+
+size_t
+stream_q::
+running() const
+{
+  std::lock_guard<std::mutex> lg(m_lock);
+  return m_running.size();
+}
+
+} // shim_xdna
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#ifndef _STREAM_XDNA_H_
+#define _STREAM_XDNA_H_
+
+#include "hwq.h"
+#include "shim_debug.h"
+
+#include "core/common/shim/buffer_handle.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace shim_xdna {
+
+// Rotates a fixed set of command slots through one hw_q, so that the host
+// fills slot k+1 while the device runs slot k. Each slot is a command BO
+// with its input and output BOs, all owned by the caller. Inputs are
+// flushed when a slot is submitted and outputs invalidated when it is
+// completed, so cache maintenance of one slot overlaps execution of others.
+//
+// Slots go free -> filling -> running -> done -> free and complete in the
+// order they were submitted. One producer thread (acquire/submit) and one
+// consumer thread (complete/release) may use the stream at the same time.
+class stream_q
+{
+public:
+  stream_q(hw_q& q);
+
+  ~stream_q();
+
+  // Returns the index of the new slot
+  size_t
+  add_slot(xrt_core::buffer_handle *cmd, std::vector<xrt_core::buffer_handle *> in,
+    std::vector<xrt_core::buffer_handle *> out);
+
+  // Next free slot in round robin order, blocks till the consumer releases
+  // it. The caller fills its inputs and command, then submits it.
+  size_t
+  acquire();
+
+  // Flush inputs of an acquired slot and submit its command
+  void
+  submit(size_t idx);
+
+  // Wait for the oldest running slot and invalidate its outputs. Returns
+  // its index, or -1 on timeout or if nothing is running.
+  int
+  complete(uint32_t timeout_ms);
+
+  // Outputs of a completed slot have been consumed, it can be refilled
+  void
+  release(size_t idx);
+
+  // Number of slots submitted but not completed yet
+  size_t
+  running() const;
+
+private:
+  enum class state { free, filling, running, done };
+
+  struct slot {
+    xrt_core::buffer_handle *cmd;
+    std::vector<xrt_core::buffer_handle *> in;
+    std::vector<xrt_core::buffer_handle *> out;
+    state st = state::free;
+  };
+
+  void
+  check_state(size_t idx, state st) const;
+
+  static void
+  sync_all(const std::vector<xrt_core::buffer_handle *>& bos,
+    xrt_core::buffer_handle::direction dir);
+
+  hw_q& m_q;
+  mutable std::mutex m_lock;
+  std::condition_variable m_cv;
+  std::vector<slot> m_slots;
+  // Slot to hand out next by acquire()
+  size_t m_next = 0;
+  // Submitted slots, oldest first
+  std::deque<size_t> m_running;
+};
+
+} // shim_xdna
+
+#endif // _STREAM_XDNA_H_
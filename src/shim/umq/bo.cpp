@@ -51,7 +51,7 @@ bo_umq(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
   : bo(pdev, ctx_id, size, flags, type)
 {
   alloc_bo();
-  mmap_bo();
+  mmap_bo_lazy();
   /*TODO: no need if cache coherent */
   sync(direction::host2device, size, 0);
 
@@ -71,6 +71,7 @@ bo_umq::
 {
   shim_debug("Freeing UMQ BO, %s", describe().c_str());
 
+  release_cmd_hold();
   munmap_bo();
   // If BO is in use, we should block and wait in driver
   free_bo();
@@ -79,6 +79,33 @@ struct host_queue_header
   uint64_t data_address;
 };
 
+/*
+ * Version 1 of the header, selected by version.major. read_index is written
+ * by CERT and write_index by host, version 0 keeps both in one cache line
+ * which then bounces on every submit and every completion. Version 1 moves
+ * write_index to a line of its own, the rest of the first line is only
+ * written once by host at init.
+ */
+#define HOST_QUEUE_HEADER_VERSION_SPLIT (1)
+#define HOST_QUEUE_CACHE_LINE (64)
+
+struct host_queue_header_split
+{
+  uint64_t read_index;
+  struct
+  {
+    uint16_t major;
+    uint16_t minor;
+  }
+  version;
+  uint32_t capacity; //Queue capacity, must be a power of two.
+  uint64_t reserved; //write_index in version 0
+  uint64_t data_address;
+  uint8_t pad0[HOST_QUEUE_CACHE_LINE - 32];
+  uint64_t write_index;
+  uint8_t pad1[HOST_QUEUE_CACHE_LINE - 8];
+};
+
 
 enum host_queue_packet_type
 {            
@@ -1,21 +1,65 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2023-2024, Advanced Micro Devices, Inc. All rights reserved.
 
+#include "bo.h"
 #include "hwctx.h"
 #include "hwq.h"
 
 #include "core/common/config_reader.h"
 #include "core/common/memalign.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+namespace {
+
+const size_t umq_max_slots = 256;
+
+// QoS value of the context wins over xrt.ini
+uint32_t
+get_umq_setting(const xrt::hw_context::qos_type& qos, const std::string& key,
+                const char *ini_key, uint32_t def)
+{
+  auto it = qos.find(key);
+  if (it != qos.end())
+    return it->second;
+  return xrt_core::config::detail::get_uint_value(ini_key, def);
+}
+
+// Ring index is masked with capacity - 1, so it has to be a power of 2
+size_t
+get_umq_nslots(const xrt::hw_context::qos_type& qos)
+{
+  size_t nslots = get_umq_setting(qos, "umq_slots", "Debug.umq_slots", 8);
+  size_t pow2 = 1;
+
+  while (pow2 < nslots && pow2 < umq_max_slots)
+    pow2 <<= 1;
+  if (pow2 != nslots)
+    shim_debug("UMQ slots %ld adjusted to %ld", nslots, pow2);
+  return pow2;
+}
+
+bool
+get_umq_overflow(const xrt::hw_context::qos_type& qos)
+{
+  return get_umq_setting(qos, "umq_overflow", "Debug.umq_overflow", 0);
+}
+
+}
+
 namespace shim_xdna {
 
 hw_ctx_umq::
 hw_ctx_umq(const device& device, const xrt::xclbin& xclbin, const xrt::hw_context::qos_type& qos)
-  : hw_ctx(device, qos, std::make_unique<hw_q_umq>(device, 8), xclbin)
+  : hw_ctx(device, qos, std::make_unique<hw_q_umq>(device, get_umq_nslots(qos), get_umq_overflow(qos)), xclbin)
   , m_metadata()
 {
   init_log_buf();
   hw_ctx::create_ctx_on_device();
+  start_log_reader();
 
   shim_debug("Created UMQ HW context (%d)", get_slotidx());
 }
@@ -24,6 +68,7 @@ hw_ctx_umq::
 ~hw_ctx_umq()
 {
   shim_debug("Destroying UMQ HW context (%d)...", get_slotidx());
+  stop_log_reader();
   fini_log_buf();
 }
 
@@ -74,4 +119,94 @@ set_metadata(int num_cols, size_t size, uint64_t bo_paddr, enum umq_log_flag fla
   }
 }
 
+void
+hw_ctx_umq::
+start_log_reader()
+{
+  static auto path = xrt_core::config::detail::get_string_value("Debug.umq_log_file", "");
+  if (path.empty())
+    return;
+
+  for (int col = 0; col < m_metadata.num_cols; col++) {
+    auto name = path + "." + std::to_string(get_slotidx()) + "." + std::to_string(col);
+    auto f = std::fopen(name.c_str(), "w");
+    if (!f) {
+      shim_debug("Can't open UMQ log file %s, log is not streamed", name.c_str());
+      for (auto lf : m_log_files)
+        std::fclose(lf);
+      m_log_files.clear();
+      return;
+    }
+    m_log_files.push_back(f);
+  }
+  m_log_rd.assign(m_metadata.num_cols, 0);
+  m_log_seq.assign(m_metadata.num_cols, 0);
+
+  static auto poll_ms = xrt_core::config::detail::get_uint_value("Debug.umq_log_poll_ms", 100);
+  m_log_thread = std::thread([this] {
+    std::unique_lock<std::mutex> lock(m_log_lock);
+    while (!m_log_cv.wait_for(lock, std::chrono::milliseconds(poll_ms), [this] { return m_log_stop; })) {
+      for (int col = 0; col < m_metadata.num_cols; col++)
+        drain_log_col(col);
+    }
+  });
+}
+
+void
+hw_ctx_umq::
+stop_log_reader()
+{
+  if (!m_log_thread.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_log_lock);
+    m_log_stop = true;
+  }
+  m_log_cv.notify_all();
+  m_log_thread.join();
+
+  // Whatever firmware wrote since the last poll
+  for (int col = 0; col < m_metadata.num_cols; col++) {
+    drain_log_col(col);
+    shim_debug("UMQ log col %d: %ld bytes streamed", col, m_log_seq[col]);
+    std::fclose(m_log_files[col]);
+  }
+  m_log_files.clear();
+}
+
+// Column rings start zeroed, firmware appends non-zero log bytes and wraps.
+// Consumed bytes are zeroed again, so the first zero byte after the read
+// offset is where firmware stopped. Only new bytes are read and written out.
+void
+hw_ctx_umq::
+drain_log_col(int col)
+{
+  auto size = m_metadata.col_size[col];
+  auto base = reinterpret_cast<char *>(m_log_buf) + sizeof(m_metadata) + static_cast<size_t>(size) * col;
+  auto& rd = m_log_rd[col];
+  size_t n = 0;
+
+  // Drop stale cache lines, device writes go to memory
+  clflush_data(base, 0, size);
+  while (n < size && base[(rd + n) % size])
+    n++;
+  if (!n)
+    return;
+
+  auto first = std::min<size_t>(n, size - rd);
+  std::fwrite(base + rd, 1, first, m_log_files[col]);
+  std::memset(base + rd, 0, first);
+  clflush_data(base, rd, first);
+  if (n > first) {
+    std::fwrite(base, 1, n - first, m_log_files[col]);
+    std::memset(base, 0, n - first);
+    clflush_data(base, 0, n - first);
+  }
+  std::fflush(m_log_files[col]);
+
+  rd = (rd + n) % size;
+  m_log_seq[col] += n;
+}
+
 } // shim_xdna
@@ -6,6 +6,11 @@
 
 #include "../hwctx.h"
 
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
 namespace shim_xdna {
 
 class hw_ctx_umq : public hw_ctx {
@@ -38,9 +43,21 @@ private:
   struct umq_log_metadata m_metadata;
   void *m_log_buf;
 
+  // Background reader streaming each column's log to <Debug.umq_log_file>.<col>
+  std::thread m_log_thread;
+  std::mutex m_log_lock;
+  std::condition_variable m_log_cv;
+  bool m_log_stop = false;
+  std::vector<FILE *> m_log_files;
+  std::vector<size_t> m_log_rd;   // read offset in each column ring
+  std::vector<uint64_t> m_log_seq; // bytes consumed so far from each column
+
   void init_log_buf();
   void fini_log_buf();
   void set_metadata(int num_cols, size_t size, uint64_t bo_paddr, enum umq_log_flag flag);
+  void start_log_reader();
+  void stop_log_reader();
+  void drain_log_col(int col);
 };
 
 } // shim_xdna
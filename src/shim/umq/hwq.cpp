@@ -3,20 +3,30 @@
 
 #include "bo.h"
 #include "hwq.h"
+#include "core/common/config_reader.h"
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(_M_X64)
+  #include <cpuid.h>
+  #include <x86intrin.h>
+#endif
 
 namespace {
 
+static_assert(offsetof(struct host_queue_header_split, write_index) == HOST_QUEUE_CACHE_LINE &&
+  sizeof(struct host_queue_header_split) == 2 * HOST_QUEUE_CACHE_LINE,
+  "write_index must be alone in the second cache line");
+
 inline void
 mark_slot_invalid(volatile struct host_queue_packet *pkt)
 {
   pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_INVALID;
 }
 
+// Caller issues the fence ordering slot content before this, once for a batch
 inline void
 mark_slot_valid(volatile struct host_queue_packet *pkt)
 {
-  /* Issue mfence instruction to make sure all writes to the slot before is done */
-  std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
   pkt->xrt_header.common_header.type = HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
   /* must flush this data to make cache coherence */
   shim_xdna::clflush_data((void *)&pkt->xrt_header.common_header, 0, sizeof(pkt->xrt_header.common_header));
@@ -28,6 +38,91 @@ is_slot_valid(volatile struct host_queue_packet *pkt)
   return pkt->xrt_header.common_header.type == HOST_QUEUE_PACKET_TYPE_VENDOR_SPECIFIC;
 }
 
+// How long to wait in process for CERT before blocking in the driver
+std::chrono::microseconds
+get_user_wait_budget()
+{
+  static auto us = xrt_core::config::detail::get_uint_value("Debug.umq_wait_spin_us", 200);
+  return std::chrono::microseconds(us);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+bool
+has_waitpkg()
+{
+  static const bool waitpkg = [] {
+    unsigned int eax, ebx, ecx, edx;
+    // CPUID.(EAX=7,ECX=0):ECX[5] is WAITPKG, umonitor/umwait
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 5));
+  }();
+  return waitpkg;
+}
+
+// Raw encodings, so no -mwaitpkg or new enough assembler is needed
+inline void
+umonitor(volatile void *addr)
+{
+  asm volatile(".byte 0xf3, 0x0f, 0xae, 0xf0" :: "a"(addr) : "memory");
+}
+
+inline void
+umwait(uint64_t tsc_deadline)
+{
+  // C0.1, the lighter state with the faster wakeup
+  asm volatile(".byte 0xf2, 0x0f, 0xae, 0xf1" ::
+    "c"(1u), "a"(static_cast<uint32_t>(tsc_deadline)),
+    "d"(static_cast<uint32_t>(tsc_deadline >> 32)) : "cc", "memory");
+}
+#endif
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Wait for CERT to change the word at addr until done() is true, without a
+// syscall. CERT writes the completion word and read_index directly, so a
+// monitored cache line wakes up umwait right away. Returns false when the
+// budget runs out, callers fall back to blocking in the driver.
+template <typename T, typename Done>
+bool
+user_wait(volatile T *addr, Done done, std::chrono::microseconds budget)
+{
+  if (done())
+    return true;
+  if (budget.count() == 0)
+    return false;
+
+  auto end = std::chrono::steady_clock::now() + budget;
+  do {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (has_waitpkg()) {
+      umonitor(addr);
+      if (done())
+        return true;
+      // Bounded, also wakes up on interrupts and on the OS umwait limit
+      umwait(__rdtsc() + 20000);
+      if (done())
+        return true;
+      continue;
+    }
+#endif
+    // Check clock only once per batch of polls to keep the loop cheap
+    for (int i = 0; i < 64; i++) {
+      if (done())
+        return true;
+      cpu_relax();
+    }
+  } while (std::chrono::steady_clock::now() < end);
+
+  return done();
+}
+
 int
 wait_slot(const shim_xdna::pdev& pdev, const shim_xdna::hw_ctx *ctx,
   uint64_t cmd_id, uint32_t timeout_ms)
@@ -72,13 +167,18 @@ init_indirect_buf(volatile struct host_indirect_data *indirect_buf, int size)
 }
 
 hw_q_umq::
-hw_q_umq(const device& dev, size_t nslots) : hw_q(dev)
+hw_q_umq(const device& dev, size_t nslots, bool overflow) : hw_q(dev)
+  , m_overflow_mode(overflow)
 {
   // host queue layout:
   //   host_queue_header_t
   //   host_queue_packet_t [nslots]
   //   indirect [4 * indirect_buffer * nslots]
-  const size_t header_sz = sizeof(struct host_queue_header);
+  // No firmware query for the layout it reads, the split one is opted in
+  static auto hdr_version = xrt_core::config::detail::get_uint_value("Debug.umq_header_version", 0);
+  const bool split = hdr_version == HOST_QUEUE_HEADER_VERSION_SPLIT;
+  const size_t header_sz = split ?
+    sizeof(struct host_queue_header_split) : sizeof(struct host_queue_header);
   const size_t queue_sz = sizeof(struct host_queue_packet) * nslots;
   const size_t indirect_sz = (sizeof(struct host_indirect_data) * HSA_MAX_LEVEL1_INDIRECT_ENTRIES) * nslots;
 
@@ -103,6 +203,7 @@ hw_q_umq(const device& dev, size_t nslots) : hw_q(dev)
   std::memset(m_umq_bo_buf, 0, umq_sz);
   
   // init slots and indirect buf
+  m_indirect_tmpl.resize(nslots);
   for (int i = 0; i < nslots; i++) {
     mark_slot_invalid(&m_umq_pkt[i]);
     init_indirect_buf(&m_umq_indirect_buf[i * HSA_MAX_LEVEL1_INDIRECT_ENTRIES], HSA_MAX_LEVEL1_INDIRECT_ENTRIES);
@@ -111,6 +212,16 @@ hw_q_umq(const device& dev, size_t nslots) : hw_q(dev)
   m_umq_hdr->capacity = nslots;
   // data_address starts after header
   m_umq_hdr->data_address = m_umq_bo->get_properties().paddr + header_sz;
+  m_read_index = &m_umq_hdr->read_index;
+  if (split) {
+    auto h = reinterpret_cast<volatile struct host_queue_header_split *>(m_umq_bo_buf);
+    h->version.major = HOST_QUEUE_HEADER_VERSION_SPLIT;
+    m_write_index = &h->write_index;
+  } else {
+    m_write_index = &m_umq_hdr->write_index;
+  }
+  // Kept here, reading it from the header pulls in the line CERT writes
+  m_capacity = nslots;
 
   // indirect buf starts after queue
   m_indirect_paddr = m_umq_hdr->data_address + queue_sz;
@@ -118,13 +229,24 @@ hw_q_umq(const device& dev, size_t nslots) : hw_q(dev)
   // this is the bo handler defined in parent class
   m_queue_boh = static_cast<bo*>(m_umq_bo.get())->get_drm_bo_handle();
 
-  shim_debug("Created UMQ HW queue");
+  if (overflow) {
+    m_overflow_hold = std::make_shared<bo::cmd_hold>();
+    m_overflow_hold->holder = this;
+  }
+
+  shim_debug("Created UMQ HW queue, %ld slots%s", nslots, overflow ? ", overflow to host" : "");
 }
 
 hw_q_umq::
 ~hw_q_umq()
 {
   shim_debug("Destroying UMA HW queue");
+  if (m_overflow_hold) {
+    std::lock_guard<std::mutex> lg(m_overflow_hold->lock);
+    m_overflow_hold->holder = nullptr;
+  }
+  if (!m_overflow.empty())
+    shim_debug("%ld commands never left the overflow queue", m_overflow.size());
 
   m_umq_bo->unmap(m_umq_bo_buf);
   m_pdev.munmap(const_cast<uint32_t*>(m_mapped_doorbell), sizeof(uint32_t));
@@ -151,8 +273,9 @@ dump() const
 {
   auto h = get_header_ptr();
   shim_debug("Dumping UMQ queue header @%p:", h);
-  shim_debug("\tRead Index:\t0x%lx", h->read_index);
-  shim_debug("\tWrite Index:\t0x%lx", h->write_index);
+  shim_debug("\tVersion:\t%d.%d", h->version.major, h->version.minor);
+  shim_debug("\tRead Index:\t0x%lx", *m_read_index);
+  shim_debug("\tWrite Index:\t0x%lx", *m_write_index);
   shim_debug("\tCapacity:\t%d", h->capacity);
   shim_debug("\tData Addr:\t%p", h->data_address);
 
@@ -211,44 +334,66 @@ dump_raw() const
     shim_debug("0x%08x", d[i]);
 }
 
-uint64_t
+bool
 hw_q_umq::
-reserve_slot()
+try_reserve_slot(uint64_t& slot_idx)
 {
-  uint64_t cur_slot = 0;
-  bool queue_full = false;
-  auto h = get_header_ptr();
+  auto wr = __atomic_load_n(m_write_index, __ATOMIC_ACQUIRE);
 
-  do {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    if (h->write_index < h->read_index) {
-      shim_err(EINVAL, "Queue read before write! read_index=0x%lx, write_index=0x%lx",
-        h->read_index, h->write_index);
+  // Lock-free multi-producer reservation. write_index only claims the slot,
+  // the slot is published to CERT later by mark_slot_valid(), so producers
+  // may fill their slots concurrently and out of order.
+  while (true) {
+    auto rd = __atomic_load_n(m_read_index, __ATOMIC_ACQUIRE);
+
+    if (wr < rd) {
       dump();
-    } else if ((h->write_index - h->read_index) < h->capacity) {
-      cur_slot = h->write_index;
-      h->write_index++;
-      break;
-    } else {
-      queue_full = true;
+      shim_err(EINVAL, "Queue read before write! read_index=0x%lx, write_index=0x%lx",
+        rd, wr);
     }
-    lock.unlock();
 
-    if (queue_full) {
-      shim_debug("Queue is full, wait for next available slot");
-      //should wait for h->read_index which should be the first available slot.
-      wait_slot(m_pdev, m_hwctx, h->read_index, 0);
+    if ((wr - rd) >= m_capacity)
+      return false;
+
+    // On failure wr is reloaded with the index claimed by another producer
+    if (__atomic_compare_exchange_n(m_write_index, &wr, wr + 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      slot_idx = wr;
+      return true;
     }
-  } while (queue_full);
+  }
+}
+
+uint64_t
+hw_q_umq::
+reserve_slot(std::vector<volatile struct host_queue_packet *> *unsent)
+{
+  auto rd_ptr = m_read_index;
+  uint64_t slot_idx;
+
+  while (!try_reserve_slot(slot_idx)) {
+    auto rd = __atomic_load_n(rd_ptr, __ATOMIC_ACQUIRE);
 
-  return cur_slot;
+    shim_debug("Queue is full, wait for next available slot");
+    // The slot waited for may be one of ours, CERT has to see them first
+    if (unsent && !unsent->empty()) {
+      send_slots(unsent->data(), unsent->size());
+      unsent->clear();
+    }
+    //should wait for h->read_index which should be the first available slot.
+    if (!user_wait(rd_ptr,
+          [rd_ptr, rd] { return __atomic_load_n(rd_ptr, __ATOMIC_ACQUIRE) != rd; },
+          get_user_wait_budget()))
+      wait_slot(m_pdev, m_hwctx, rd, 0);
+  }
+  return slot_idx;
 }
 
 int
 hw_q_umq::
 get_pkt_idx(uint64_t index)
 {
-  return index & (get_header_ptr()->capacity - 1);
+  return index & (m_capacity - 1);
 }
 
 volatile struct host_queue_packet *
@@ -263,11 +408,11 @@ get_pkt(uint64_t index)
   return pkt;
 }
 
-uint64_t
+void
 hw_q_umq::
-issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
+fill_exec_buf(uint64_t slot_idx, uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp,
+              std::vector<volatile struct host_queue_packet *>& unsent)
 {
-  auto slot_idx = reserve_slot();
   auto pkt = get_pkt(slot_idx);
   size_t pkt_size;
 
@@ -280,9 +425,8 @@ issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu, uint64_t comp)
   hdr->common_header.opcode = HOST_QUEUE_PACKET_EXEC_BUF;
   hdr->completion_signal = comp;
 
-  fill_slot_and_send(pkt, pkt_size);
-
-  return slot_idx;
+  fill_slot(pkt, pkt_size);
+  unsent.push_back(pkt);
 }
 
 size_t
@@ -303,6 +447,8 @@ fill_indirect_exec_buf(uint64_t slot_idx, uint16_t cu_idx,
   // no need to memset to zero, all buffer will be set
   volatile struct host_indirect_packet_entry *hp =
     reinterpret_cast<volatile struct host_indirect_packet_entry *>(pkt->data);
+  // Slot is owned by this producer until it is published, so is its template
+  auto& tmpl = m_indirect_tmpl[get_pkt_idx(slot_idx)];
 
   for (int i = 0; dpu; i++, hp++, dpu = get_ert_dpu_data_next(dpu)) {
     auto data_size = sizeof(struct host_indirect_data) * HSA_MAX_LEVEL1_INDIRECT_ENTRIES;
@@ -315,6 +461,10 @@ fill_indirect_exec_buf(uint64_t slot_idx, uint16_t cu_idx,
     hp->host_addr_high = static_cast<uint32_t>(buf_paddr >> 32);
     hp->uc_index = dpu->uc_index;
 
+    // Same run object resubmitted, the buffer from the last time is still valid
+    if (tmpl.cu_idx == cu_idx && tmpl.ctrl_addr[i] == dpu->instruction_buffer)
+      continue;
+
     auto cebp = &m_umq_indirect_buf[prefix_idx + i];
     // do not zero this buffer, the cebp->header is pre-set 
     // set every cebp->payload field in case of garbage data
@@ -326,7 +476,10 @@ fill_indirect_exec_buf(uint64_t slot_idx, uint16_t cu_idx,
     cebp->payload.args_len = 0;
     cebp->payload.args_host_addr_low = 0;
     cebp->payload.args_host_addr_high = 0;
+    clflush_data((void *)&cebp->payload, 0, sizeof(cebp->payload));
+    tmpl.ctrl_addr[i] = dpu->instruction_buffer;
   }
+  tmpl.cu_idx = cu_idx;
 
   auto hdr = &pkt->xrt_header;
   hdr->common_header.distribute = 1;
@@ -344,14 +497,12 @@ fill_direct_exec_buf(uint16_t cu_idx, volatile struct host_queue_packet *pkt,
     shim_err(EINVAL, "dpu pkt_size=0x%lx > pkt_data max size=%x%lx",
       pkt_size, sizeof(pkt->data));
   
-  // zero this buffer
-  auto data = const_cast<uint32_t *>(pkt->data);
-  std::memset(data, 0, pkt_size);
-  // set correct dpu control code
-  volatile struct exec_buf *ebp = reinterpret_cast<volatile struct exec_buf *>(pkt->data);
-  ebp->cu_index = cu_idx;
-  ebp->dpu_control_code_host_addr_low = static_cast<uint32_t>(dpu->instruction_buffer);
-  ebp->dpu_control_code_host_addr_high = static_cast<uint32_t>(dpu->instruction_buffer >> 32);
+  // Patch a zeroed template and store it with one copy, not field by field
+  struct exec_buf eb = {};
+  eb.cu_index = cu_idx;
+  eb.dpu_control_code_host_addr_low = static_cast<uint32_t>(dpu->instruction_buffer);
+  eb.dpu_control_code_host_addr_high = static_cast<uint32_t>(dpu->instruction_buffer >> 32);
+  std::memcpy(const_cast<uint32_t *>(pkt->data), &eb, pkt_size);
 
   auto hdr = &pkt->xrt_header;
   hdr->common_header.distribute = 0;
@@ -362,7 +513,7 @@ fill_direct_exec_buf(uint16_t cu_idx, volatile struct host_queue_packet *pkt,
 
 void
 hw_q_umq::
-fill_slot_and_send(volatile struct host_queue_packet *pkt, size_t size)
+fill_slot(volatile struct host_queue_packet *pkt, size_t size)
 {
   if (size > sizeof(pkt->data))
     shim_err(EINVAL, "HSA packet payload too big, size=0x%lx", size);
@@ -375,21 +526,32 @@ fill_slot_and_send(volatile struct host_queue_packet *pkt, size_t size)
 
   //comment this out, debug only
   //dump();
-
-  /* Always done as last step. */
-  mark_slot_valid(pkt);
-
-  /* Wake up CERT */
-  *m_mapped_doorbell = 0;
 }
 
 void
 hw_q_umq::
-issue_command(xrt_core::buffer_handle *cmd_bo)
+send_slots(volatile struct host_queue_packet **pkts, size_t num)
 {
-  auto boh = static_cast<bo*>(cmd_bo);
-  auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(boh->map(bo::map_type::write));
+  m_publishing.fetch_add(1, std::memory_order_acq_rel);
+
+  /* Issue mfence instruction to make sure all writes to the slots before is done */
+  std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
+  /* Always done as last step. */
+  for (size_t i = 0; i < num; i++)
+    mark_slot_valid(pkts[i]);
+
+  /*
+   * Wake up CERT. Doorbell writes are uncached MMIO, so producers racing here
+   * leave it to the last one out, which rings after all their slots are valid.
+   */
+  if (m_publishing.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    *m_mapped_doorbell = 0;
+}
 
+ert_dpu_data *
+hw_q_umq::
+get_cmd_dpu_data(ert_start_kernel_cmd *cmd)
+{
   // Sanity check
   auto dpu_data = get_ert_dpu_data(cmd);
   if (!dpu_data) {
@@ -404,13 +566,169 @@ issue_command(xrt_core::buffer_handle *cmd_bo)
 
   if (get_ert_dpu_data_next(dpu_data))
     shim_debug("this is a multi-column dpu request.");
+  return dpu_data;
+}
+
+bool
+hw_q_umq::
+fill_command(xrt_core::buffer_handle *cmd_bo,
+             std::vector<volatile struct host_queue_packet *>& unsent, bool block)
+{
+  auto boh = static_cast<bo*>(cmd_bo);
+  auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(boh->map(bo::map_type::write));
+  // Validate before taking a slot, a reserved slot has to be sent
+  auto dpu_data = get_cmd_dpu_data(cmd);
 
   // Completion signal area has to be a full WORD, we utilze the command_bo
   uint64_t comp = boh->get_properties().paddr + offsetof(ert_start_kernel_cmd, header);
 
-  auto id = issue_exec_buf(ffs(cmd->cu_mask) - 1, dpu_data, comp);
+  uint64_t id;
+  if (block)
+    id = reserve_slot(&unsent);
+  else if (!try_reserve_slot(id))
+    return false;
+
+  fill_exec_buf(id, ffs(cmd->cu_mask) - 1, dpu_data, comp, unsent);
   boh->set_cmd_id(id);
   shim_debug("Submitted command (%ld)", id);
+  return true;
+}
+
+void
+hw_q_umq::
+issue_command(xrt_core::buffer_handle *cmd_bo)
+{
+  if (m_overflow_mode) {
+    queue_commands({ cmd_bo });
+    return;
+  }
+
+  std::vector<volatile struct host_queue_packet *> pkts;
+  fill_command(cmd_bo, pkts, true);
+  send_slots(pkts.data(), pkts.size());
+}
+
+void
+hw_q_umq::
+issue_command(const std::vector<xrt_core::buffer_handle *>& cmd_bos)
+{
+  if (m_overflow_mode) {
+    queue_commands(cmd_bos);
+    return;
+  }
+
+  // Slots are filled first, then published with one fence and one doorbell.
+  // Queue full publishes what is filled so far, see reserve_slot().
+  std::vector<volatile struct host_queue_packet *> pkts;
+  pkts.reserve(cmd_bos.size());
+
+  for (auto cmd_bo : cmd_bos)
+    fill_command(cmd_bo, pkts, true);
+  send_slots(pkts.data(), pkts.size());
+}
+
+void
+hw_q_umq::
+queue_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos)
+{
+  for (auto cmd_bo : cmd_bos)
+    static_cast<bo*>(cmd_bo)->set_cmd_hold(m_overflow_hold);
+
+  std::lock_guard<std::mutex> lock(m_overflow_lock);
+
+  // Commands are sent in order, nothing can pass the ones already waiting
+  m_overflow.insert(m_overflow.end(), cmd_bos.begin(), cmd_bos.end());
+  drain_overflow_locked(nullptr);
+  if (!m_overflow.empty())
+    shim_debug("Queue is full, %ld commands wait on host", m_overflow.size());
+}
+
+void
+hw_q_umq::
+drain_overflow_locked(xrt_core::buffer_handle *until)
+{
+  std::vector<volatile struct host_queue_packet *> pkts;
+  // Only block on a full ring until the command someone waits for is sent
+  bool block = until != nullptr;
+
+  try {
+    while (!m_overflow.empty()) {
+      auto cmd_bo = m_overflow.front();
+
+      m_overflow.pop_front();
+      if (!fill_command(cmd_bo, pkts, block)) {
+        m_overflow.push_front(cmd_bo);
+        break;
+      }
+      if (cmd_bo == until)
+        block = false;
+    }
+  } catch (...) {
+    // The bad command is dropped, the ones filled before it still go out
+    if (!pkts.empty())
+      send_slots(pkts.data(), pkts.size());
+    throw;
+  }
+
+  if (!pkts.empty())
+    send_slots(pkts.data(), pkts.size());
+}
+
+void
+hw_q_umq::
+drain_overflow(xrt_core::buffer_handle *cmd)
+{
+  std::lock_guard<std::mutex> lock(m_overflow_lock);
+
+  if (m_overflow.empty())
+    return;
+  if (std::find(m_overflow.begin(), m_overflow.end(), cmd) == m_overflow.end())
+    cmd = nullptr;
+  drain_overflow_locked(cmd);
+}
+
+void
+hw_q_umq::
+release_cmd(bo *cmd)
+{
+  xrt_core::buffer_handle *bh = cmd;
+  std::lock_guard<std::mutex> lock(m_overflow_lock);
+
+  m_overflow.erase(std::remove(m_overflow.begin(), m_overflow.end(), bh), m_overflow.end());
+}
+
+int
+hw_q_umq::
+poll_command(xrt_core::buffer_handle *cmd) const
+{
+  // Make progress on the host side queue as slots free up
+  if (m_overflow_mode)
+    const_cast<hw_q_umq *>(this)->drain_overflow(nullptr);
+  return hw_q::poll_command(cmd);
+}
+
+int
+hw_q_umq::
+wait_command(xrt_core::buffer_handle *cmd, uint32_t timeout_ms) const
+{
+  // A command still in the host side queue has to reach the ring first
+  if (m_overflow_mode)
+    const_cast<hw_q_umq *>(this)->drain_overflow(cmd);
+
+  // Completion signal CERT writes is the command header, see fill_command()
+  auto hdr = reinterpret_cast<volatile uint32_t *>(cmd->map(bo::map_type::write));
+  auto budget = get_user_wait_budget();
+  if (timeout_ms)
+    budget = std::min<std::chrono::microseconds>(budget, std::chrono::milliseconds(timeout_ms));
+
+  auto done = [hdr] {
+    ert_packet pkt;
+    pkt.header = *hdr;
+    return pkt.state >= ERT_CMD_STATE_COMPLETED;
+  };
+  if (user_wait(hdr, done, budget))
+    return 1;
+  return hw_q::wait_command(cmd, timeout_ms);
 }
 
 void
@@ -6,21 +6,39 @@
 
 #include "../hwq.h"
 
+#include "bo.h"
 #include "ert.h"
 #include "host_queue.h"
 
+#include <deque>
+#include <mutex>
+
 namespace shim_xdna {
 
-class hw_q_umq : public hw_q
+class hw_q_umq : public hw_q, public bo::cmd_holder
 {
 public:
-  hw_q_umq(const device& device, size_t nslots);
+  // nslots has to be a power of 2. With overflow, submitting to a full ring
+  // queues the commands on host instead of blocking the caller.
+  hw_q_umq(const device& device, size_t nslots, bool overflow = false);
 
   ~hw_q_umq();
 
   void
   issue_command(xrt_core::buffer_handle *) override;
 
+  void
+  issue_command(const std::vector<xrt_core::buffer_handle *>&) override;
+
+  // Waits on the completion signal in process first, the driver only for long waits
+  int
+  poll_command(xrt_core::buffer_handle *) const override;
+
+  using hw_q::wait_command;
+
+  int
+  wait_command(xrt_core::buffer_handle *, uint32_t timeout_ms) const override;
+
   void
   dump() const;
 
@@ -33,6 +51,10 @@ public:
   volatile struct host_queue_header *
   get_header_ptr() const;
 
+  // Drops a destroyed command from the overflow queue
+  void
+  release_cmd(bo *cmd) override;
+
 private:
 
   struct host_indirect_data {
@@ -40,19 +62,42 @@ private:
     struct exec_buf		payload;
   };
 
+  // What the indirect buffers of a slot hold from its last submission
+  struct indirect_template {
+    uint16_t cu_idx = UINT16_MAX;
+    uint64_t ctrl_addr[HSA_MAX_LEVEL1_INDIRECT_ENTRIES] = {};
+  };
+
   std::unique_ptr<xrt_core::buffer_handle> m_umq_bo;
   void *m_umq_bo_buf;
   volatile struct host_queue_header *m_umq_hdr = nullptr;
+  // Where the indices live depends on the header version
+  volatile uint64_t *m_read_index = nullptr;
+  volatile uint64_t *m_write_index = nullptr;
+  uint32_t m_capacity = 0;
   volatile struct host_queue_packet *m_umq_pkt = nullptr;
   volatile struct host_indirect_data *m_umq_indirect_buf = nullptr;
   uint64_t m_indirect_paddr;
+  std::vector<indirect_template> m_indirect_tmpl;
 
   volatile uint32_t *m_mapped_doorbell = nullptr;
+  // Producers between marking slots valid and deciding to ring the doorbell
+  std::atomic<int> m_publishing = 0;
+
+  // Commands submitted while the ring was full, sent as slots free up.
+  // Lock order is m_overflow_hold->lock, then m_overflow_lock.
+  const bool m_overflow_mode;
+  std::shared_ptr<bo::cmd_hold> m_overflow_hold;
+  std::mutex m_overflow_lock;
+  std::deque<xrt_core::buffer_handle *> m_overflow;
 
-  std::mutex m_mutex;
+  // Returns false when the queue is full
+  bool
+  try_reserve_slot(uint64_t& slot_idx);
 
+  // Publishes unsent slots of the caller before waiting on a full queue
   uint64_t
-  reserve_slot();
+  reserve_slot(std::vector<volatile struct host_queue_packet *> *unsent = nullptr);
 
   int
   get_pkt_idx(uint64_t index);
@@ -72,10 +117,33 @@ private:
     volatile struct host_queue_packet *pkt, ert_dpu_data *dpu);
 
   void
-  fill_slot_and_send(volatile struct host_queue_packet *pkt, size_t size);
+  fill_slot(volatile struct host_queue_packet *pkt, size_t size);
 
-  uint64_t
-  issue_exec_buf(uint16_t cu_idx, ert_dpu_data *dpu_data, uint64_t comp);
+  void
+  send_slots(volatile struct host_queue_packet **pkts, size_t num);
+
+  // Fills a reserved slot, which is appended to unsent
+  void
+  fill_exec_buf(uint64_t slot_idx, uint16_t cu_idx, ert_dpu_data *dpu_data, uint64_t comp,
+    std::vector<volatile struct host_queue_packet *>& unsent);
+
+  // Returns false if block is not set and there is no free slot
+  bool
+  fill_command(xrt_core::buffer_handle *cmd_bo,
+    std::vector<volatile struct host_queue_packet *>& unsent, bool block);
+
+  void
+  queue_commands(const std::vector<xrt_core::buffer_handle *>& cmd_bos);
+
+  // Sends what fits in the ring, blocking until until is sent if not null
+  void
+  drain_overflow_locked(xrt_core::buffer_handle *until);
+
+  void
+  drain_overflow(xrt_core::buffer_handle *cmd);
+
+  ert_dpu_data *
+  get_cmd_dpu_data(ert_start_kernel_cmd *cmd);
 
   void
   map_doorbell(uint32_t doorbell_offset);
@@ -82,6 +82,8 @@ host_bo_alloc(const shim_xdna::pdev& dev, int type, size_t size, uint32_t res_id
   req.size = size;
   req.map_align = align;
   vdev.host_call(&req, sizeof(req), &rsp, sizeof(rsp));
+  if (rsp.hdr.ret)
+    shim_err(-rsp.hdr.ret, "Host failed to create BO type %d size 0x%lx", type, size);
   return { req.blob_id, rsp.xdna_addr };
 }
 
@@ -95,7 +97,8 @@ host_bo_free(const shim_xdna::pdev& dev, uint32_t blob_id)
   req.hdr.len = sizeof(req);
   req.hdr.rsp_off = 0;
   req.blob_id = blob_id;
-  vdev.host_call(&req, sizeof(req), nullptr, 0);
+  // Nothing to wait for, goes to host with the next call
+  vdev.host_call_async(&req, sizeof(req));
 }
 
 }
@@ -122,7 +125,7 @@ bo_virtio(const pdev& pdev, xrt_core::hwctx_handle::slot_id ctx_id,
   size_t size, uint64_t flags, int type)
   : bo(pdev, ctx_id, size, flags, type)
 {
-  alloc_bo();
+  alloc_dev_bo();
   mmap_bo();
 
   // Newly allocated buffer may contain dirty pages. If used as output buffer,
@@ -155,7 +158,7 @@ sync(direction dir, size_t size, size_t offset)
 {
   if (offset + size > m_aligned_size)
     shim_err(EINVAL, "Invalid BO offset and size for sync'ing: %ld, %ld", offset, size);
-  shim_xdna::clflush_data(m_aligned, offset, size); 
+  shim_xdna::clflush_data(m_aligned, offset, size, dir == direction::host2device);
 }
 
 uint32_t
@@ -177,6 +180,36 @@ alloc_drm_bo(int type, size_t size)
   return boh;
 }
 
+void
+bo_virtio::
+alloc_dev_bo()
+{
+  if (m_type != AMDXDNA_BO_DEV) {
+    alloc_bo();
+    return;
+  }
+
+  auto& vdev = static_cast<const pdev_virtio&>(m_pdev);
+  while (true) {
+    auto gen = vdev.get_dev_heap_gen();
+    // First DEV BO commits the heap
+    if (!gen) {
+      if (!vdev.grow_dev_heap(m_aligned_size, gen))
+        shim_err(ENOMEM, "Failed to commit device heap");
+      continue;
+    }
+
+    // Device heap is full, grow it by one chunk and retry
+    try {
+      alloc_bo();
+      return;
+    } catch (const xrt_core::system_error& e) {
+      if (e.get_code() != ENOSPC || !vdev.grow_dev_heap(m_aligned_size, gen))
+        throw;
+    }
+  }
+}
+
 void
 bo_virtio::
 get_drm_bo_info(uint32_t boh, amdxdna_drm_get_bo_info* bo_info)
@@ -194,6 +227,10 @@ bo_virtio::
 free_drm_bo(uint32_t boh)
 {
   host_bo_free(m_pdev, m_blob_id);
+  // Destroy must reach host before the guest resource backing it is gone,
+  // both go through the same virtio queue so sending without waiting is enough.
+  if (boh != AMDXDNA_INVALID_BO_HANDLE)
+    static_cast<const shim_xdna::pdev_virtio&>(m_pdev).host_call_flush();
   drm_bo_free(m_pdev, boh);
 }
 
@@ -34,6 +34,10 @@ private:
   uint32_t
   alloc_drm_bo(int type, size_t size) override;
 
+  // DEV BO commits device heap on demand
+  void
+  alloc_dev_bo();
+
   void
   get_drm_bo_info(uint32_t boh, amdxdna_drm_get_bo_info* bo_info) override;
 
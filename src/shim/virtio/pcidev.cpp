@@ -7,12 +7,24 @@
 #include "amdxdna_proto.h"
 #include "core/common/config_reader.h"
 
+#include <algorithm>
 #include <poll.h>
 #include <drm/virtgpu_drm.h>
 
 namespace {
 
 const size_t resp_buf_size = 0x1000;
+// Responses of async requests are not read, host writes them to the tail slot
+const size_t async_rsp_size = 0x100;
+const size_t async_rsp_off = resp_buf_size - async_rsp_size;
+// Rest of response buffer is shared by concurrent host calls
+const size_t resp_slot_size = 0x100;
+const uint32_t num_resp_slots = async_rsp_off / resp_slot_size;
+static_assert(num_resp_slots <= 32, "free slot mask is 32 bits");
+// Queued async requests are sent once this many bytes are pending
+const size_t max_batch_size = 0x1000;
+// Fence timelines of the virtgpu context, ring 0 is left unused
+const uint32_t num_rings = 64;
 // Device memory heap needs to be multiple of 64MB page.
 const size_t heap_page_size = (64 << 20);
 
@@ -90,8 +102,18 @@ sync_wait(int fd, int timeout)
   }
 }
 
-void
-hcall(const shim_xdna::pdev& dev, void *in_buf, size_t in_size)
+// Threads are spread over rings, so a slow call only holds back fences of its own ring
+uint32_t
+get_ring_idx()
+{
+  static std::atomic<uint32_t> next = 0;
+  thread_local uint32_t idx = 1 + (next++ % (num_rings - 1));
+  return idx;
+}
+
+// Returns fence fd signaled when host is done with the request
+int
+hcall_submit(const shim_xdna::pdev& dev, void *in_buf, size_t in_size)
 {
   drm_virtgpu_execbuffer exec = {};
 
@@ -99,10 +121,21 @@ hcall(const shim_xdna::pdev& dev, void *in_buf, size_t in_size)
   exec.command = reinterpret_cast<uintptr_t>(in_buf);
   exec.size = in_size;
   exec.fence_fd = 0;
-  exec.ring_idx = 1;
+  exec.ring_idx = get_ring_idx();
   dev.ioctl(DRM_IOCTL_VIRTGPU_EXECBUFFER, &exec);
-  sync_wait(exec.fence_fd, -1);
-  close(exec.fence_fd);
+  return exec.fence_fd;
+}
+
+void
+hcall_wait(int fence_fd)
+{
+  try {
+    sync_wait(fence_fd, -1);
+  } catch (...) {
+    close(fence_fd);
+    throw;
+  }
+  close(fence_fd);
 }
 
 void
@@ -149,7 +182,7 @@ set_virtgpu_context(const shim_xdna::pdev& dev)
 {
   struct drm_virtgpu_context_set_param params[] = {
     { VIRTGPU_CONTEXT_PARAM_CAPSET_ID, 6 /* VIRGL_RENDERER_CAPSET_DRM */ },
-    { VIRTGPU_CONTEXT_PARAM_NUM_RINGS, 64 },
+    { VIRTGPU_CONTEXT_PARAM_NUM_RINGS, num_rings },
   };
   struct drm_virtgpu_context_init args = {
     .num_params = 2,
@@ -194,17 +227,17 @@ on_first_open() const
   auto [m_resp_buf_bo_hdl, m_resp_buf_res_hdl] = alloc_resp_buf(*this);
   m_resp_buf = map_resp_buf(*this, m_resp_buf_bo_hdl);
   init_resp_buf(*this, m_resp_buf_res_hdl);
-
-  // Allocating heap BO (require response buffer init'ed above) on first open
-  auto heap_sz = heap_page_size * get_heap_num_pages();
-  m_dev_heap_bo = std::make_unique<bo_virtio>(*this, heap_sz, AMDXDNA_BO_DEV_HEAP);
+  m_free_slots = (num_resp_slots == 32) ? ~0u : (1u << num_resp_slots) - 1;
+  // Device heap is not committed until the first DEV BO, see grow_dev_heap()
 }
 
 void
 pdev_virtio::
 on_last_close() const
 {
-  m_dev_heap_bo.reset();
+  m_dev_heap_chunks.clear();
+  m_dev_heap_gen = 0;
+  host_call_flush();
 
   shim_debug("Tearing down response buffer");
   fini_resp_buf(*this, m_resp_buf_res_hdl);
@@ -212,19 +245,109 @@ on_last_close() const
   free_resp_buf(*this, m_resp_buf_bo_hdl);
 }
 
+void
+pdev_virtio::
+queue_request(void *in_buf, size_t in_size) const
+{
+  auto p = static_cast<uint8_t *>(in_buf);
+  m_batch.insert(m_batch.end(), p, p + in_size);
+}
+
+void
+pdev_virtio::
+flush_locked() const
+{
+  if (m_batch.empty())
+    return;
+
+  // Host runs requests in submission order, no need to wait for these
+  hcall_no_resp(*this, m_batch.data(), m_batch.size());
+  m_batch.clear();
+}
+
+uint32_t
+pdev_virtio::
+get_resp_slot() const
+{
+  std::unique_lock<std::mutex> lock(m_slot_lock);
+
+  m_slot_cv.wait(lock, [this] { return m_free_slots != 0; });
+  auto slot = static_cast<uint32_t>(__builtin_ctz(m_free_slots));
+  m_free_slots &= ~(1u << slot);
+  return slot;
+}
+
+void
+pdev_virtio::
+put_resp_slot(uint32_t slot) const
+{
+  {
+    const std::lock_guard<std::mutex> lock(m_slot_lock);
+    m_free_slots |= 1u << slot;
+  }
+  m_slot_cv.notify_one();
+}
+
 void
 pdev_virtio::
 host_call(void *in_buf, size_t in_size, void *out_buf, size_t out_size) const
 {
-  const std::lock_guard<std::mutex> lock(m_lock);
-  auto sz = out_size;
+  if (out_size > resp_slot_size)
+    shim_err(EINVAL, "Host call response size %ld is larger than slot size %ld", out_size, resp_slot_size);
+
+  auto slot = get_resp_slot();
+  auto rsp_off = slot * resp_slot_size;
+  int fence_fd;
+
+  reinterpret_cast<vdrm_ccmd_req *>(in_buf)->rsp_off = rsp_off;
+  try {
+    // Queued requests have to reach host before this one and before anything
+    // queued after it, so submit under m_lock. Only the wait is done unlocked.
+    const std::lock_guard<std::mutex> lock(m_lock);
+
+    // One execbuffer and fence for queued requests and this one
+    if (m_batch.empty()) {
+      fence_fd = hcall_submit(*this, in_buf, in_size);
+    } else {
+      queue_request(in_buf, in_size);
+      fence_fd = hcall_submit(*this, m_batch.data(), m_batch.size());
+      m_batch.clear();
+    }
+  } catch (...) {
+    put_resp_slot(slot);
+    throw;
+  }
 
-  if (sz > resp_buf_size)
-    sz = resp_buf_size;
+  try {
+    hcall_wait(fence_fd);
+  } catch (...) {
+    put_resp_slot(slot);
+    throw;
+  }
 
-  hcall(*this, in_buf, in_size);
   if (out_buf)
-    memcpy(out_buf, m_resp_buf, sz);
+    memcpy(out_buf, static_cast<char *>(m_resp_buf) + rsp_off, out_size);
+  put_resp_slot(slot);
+}
+
+void
+pdev_virtio::
+host_call_async(void *in_buf, size_t in_size) const
+{
+  const std::lock_guard<std::mutex> lock(m_lock);
+
+  reinterpret_cast<vdrm_ccmd_req *>(in_buf)->rsp_off = async_rsp_off;
+  if (m_batch.size() + in_size > max_batch_size)
+    flush_locked();
+  queue_request(in_buf, in_size);
+}
+
+void
+pdev_virtio::
+host_call_flush() const
+{
+  const std::lock_guard<std::mutex> lock(m_lock);
+  flush_locked();
 }
 
 uint32_t
@@ -238,9 +361,49 @@ uint64_t
 pdev_virtio::
 get_dev_bo_vaddr(uint64_t dev_bo_xdna_addr) const
 {
-  uint64_t xdna_addr = m_dev_heap_bo->get_properties().paddr;
-  uint64_t vaddr = reinterpret_cast<uint64_t>(m_dev_heap_bo->map(bo::map_type::write));
-  return vaddr + (dev_bo_xdna_addr - xdna_addr);
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+
+  for (auto& chunk : m_dev_heap_chunks) {
+    auto prop = chunk->get_properties();
+    if (dev_bo_xdna_addr < prop.paddr || dev_bo_xdna_addr >= prop.paddr + prop.size)
+      continue;
+    uint64_t vaddr = reinterpret_cast<uint64_t>(chunk->map(bo::map_type::write));
+    return vaddr + (dev_bo_xdna_addr - prop.paddr);
+  }
+  shim_err(EINVAL, "DEV BO address 0x%lx is not in device heap", dev_bo_xdna_addr);
+}
+
+uint32_t
+pdev_virtio::
+get_dev_heap_gen() const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+  return m_dev_heap_gen;
+}
+
+bool
+pdev_virtio::
+grow_dev_heap(size_t size, uint32_t gen) const
+{
+  std::lock_guard<std::mutex> lg(m_dev_heap_lock);
+
+  // Someone else has grown it, just retry
+  if (gen != m_dev_heap_gen)
+    return true;
+
+  auto chunk_sz = heap_page_size * ((size + heap_page_size - 1) / heap_page_size);
+  // First chunk keeps the configured heap size, later ones only what is asked for
+  if (m_dev_heap_chunks.empty())
+    chunk_sz = std::max(chunk_sz, heap_page_size * get_heap_num_pages());
+  try {
+    m_dev_heap_chunks.push_back(std::make_unique<bo_virtio>(*this, chunk_sz, AMDXDNA_BO_DEV_HEAP));
+  } catch (const xrt_core::system_error& e) {
+    shim_debug("Can't grow device heap by 0x%lx: %s", chunk_sz, e.what());
+    return false;
+  }
+  m_dev_heap_gen++;
+  shim_debug("Grew device heap by 0x%lx, %ld chunks", chunk_sz, m_dev_heap_chunks.size());
+  return true;
 }
 
 } // namespace shim_xdna
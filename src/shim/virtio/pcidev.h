@@ -9,6 +9,9 @@
 #include "drm_local/amdxdna_accel.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
 
 namespace shim_xdna {
 
@@ -22,30 +25,70 @@ public:
   create_device(xrt_core::device::handle_type handle, xrt_core::device::id_type id) const override;
 
 public:
+  // Sends queued async requests plus this one in one execbuffer, waits for all
   void
   host_call(void *in_buf, size_t in_size, void *out_buf, size_t out_size) const;
 
+  // Queues a request without response, sent with the next host_call() or flush
+  void
+  host_call_async(void *in_buf, size_t in_size) const;
+
+  void
+  host_call_flush() const;
+
   uint32_t
   get_unique_id() const;
 
   uint64_t
   get_dev_bo_vaddr(uint64_t dev_bo_xdna_addr) const;
 
+  // Generation of device heap, bumped each time it grows
+  uint32_t
+  get_dev_heap_gen() const;
+
+  // Add a heap chunk big enough for size unless heap has grown since gen.
+  // Returns false if heap can't grow any more.
+  bool
+  grow_dev_heap(size_t size, uint32_t gen) const;
+
 private:
   // Below are init'ed on first device open and removed right before device is closed
   mutable uint32_t m_resp_buf_bo_hdl = AMDXDNA_INVALID_BO_HANDLE;
   mutable uint32_t m_resp_buf_res_hdl = AMDXDNA_INVALID_BO_HANDLE;
   mutable void *m_resp_buf = nullptr;
-  mutable std::unique_ptr<xrt_core::buffer_handle> m_dev_heap_bo;
+  // Device heap is committed in chunks by the first DEV BOs needing them
+  mutable std::vector<std::unique_ptr<xrt_core::buffer_handle>> m_dev_heap_chunks;
+  mutable std::mutex m_dev_heap_lock;
+  mutable uint32_t m_dev_heap_gen = 0;
 
   // Ever incrementing to provide generic per device unique ID. May wrap around in
   // theory, should not happen in practice.
   // Can be used for BO's blob ID.
   mutable std::atomic<std::uint32_t> m_id = 0;
 
-  // Serialize host call
+  // Concatenated async requests not yet sent to host
+  mutable std::vector<uint8_t> m_batch;
+
+  // Protect m_batch
   mutable std::mutex m_lock;
 
+  // Response buffer is split in slots, one per host call in flight
+  mutable std::mutex m_slot_lock;
+  mutable std::condition_variable m_slot_cv;
+  mutable uint32_t m_free_slots = 0;
+
+  uint32_t
+  get_resp_slot() const;
+
+  void
+  put_resp_slot(uint32_t slot) const;
+
+  void
+  queue_request(void *in_buf, size_t in_size) const;
+
+  void
+  flush_locked() const;
+
   virtual void
   on_first_open() const override;
 
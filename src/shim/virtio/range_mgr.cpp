@@ -6,81 +6,150 @@
 
 #include <iostream>
 
+namespace {
+
+// Best fit candidates looked at for an aligned request before settling for
+// a range big enough whatever its start.
+const int max_aligned_tries = 8;
+
+uint64_t
+align_up(uint64_t v, uint64_t align)
+{
+  return (v + align - 1) / align * align;
+}
+
+}
+
 namespace shim_xdna {
 
 range_mgr::
 range_mgr(uint64_t start, uint64_t end)
 {
-  m_free_ranges.insert({start, end});
+  insert_free(start, end);
+}
+
+void
+range_mgr::
+insert_free(uint64_t start, uint64_t end)
+{
+  m_free_by_addr.emplace(start, end);
+  m_free_by_size.emplace(end - start + 1, start);
+}
+
+void
+range_mgr::
+erase_free(std::map<uint64_t, uint64_t>::iterator it)
+{
+  m_free_by_size.erase({it->second - it->first + 1, it->first});
+  m_free_by_addr.erase(it);
 }
 
 uint64_t
 range_mgr::
-alloc(uint64_t size)
+alloc(uint64_t size, uint64_t align)
 {
-  for (auto it = m_free_ranges.begin(); it != m_free_ranges.end(); ++it) {
-    if (it->m_end - it->m_start + 1 < size)
-      continue;
-
-    uint64_t alloc_start = it->m_start;
-    uint64_t alloc_end = alloc_start + size - 1;
-    uint64_t it_end = it->m_end;
-    m_allocated_ranges.insert({alloc_start, alloc_end});
-          
-    // Remove the used part from m_free_ranges
-    m_free_ranges.erase(it);
-    if (alloc_end < it_end)
-      m_free_ranges.insert({alloc_end + 1, it_end});
-
-    return alloc_start;
+  if (!size || !align)
+    shim_err(EINVAL, "Invalid range size 0x%lx or alignment 0x%lx", size, align);
+
+  // Smallest free range that fits, aligned start may push the end out of it
+  auto it = m_free_by_size.lower_bound({size, 0});
+  for (int i = 0; it != m_free_by_size.end() && align > 1; ++it, ++i) {
+    if (align_up(it->second, align) + size - 1 <= it->second + it->first - 1)
+      break;
+    if (i == max_aligned_tries) {
+      // Anything this big fits whatever its start
+      it = m_free_by_size.lower_bound({size + align - 1, 0});
+      break;
+    }
   }
-  shim_err(ENOMEM, "Not enough ranges");
+  if (it == m_free_by_size.end())
+    shim_err(ENOMEM, "Not enough ranges for 0x%lx bytes", size);
+
+  uint64_t free_start = it->second;
+  uint64_t free_end = free_start + it->first - 1;
+  uint64_t alloc_start = align_up(free_start, align);
+  uint64_t alloc_end = alloc_start + size - 1;
+
+  // Keep the head skipped for alignment and the unused tail free
+  erase_free(m_free_by_addr.find(free_start));
+  if (alloc_start > free_start)
+    insert_free(free_start, alloc_start - 1);
+  if (alloc_end < free_end)
+    insert_free(alloc_end + 1, free_end);
+
+  m_allocated_ranges.emplace(alloc_start, alloc_end);
+  m_allocated_bytes += size;
+  return alloc_start;
 }
 
 void
 range_mgr::
 free(uint64_t start)
 {
-  auto it = m_allocated_ranges.find({start, start+1});
+  auto it = m_allocated_ranges.find(start);
   if (it == m_allocated_ranges.end())
     shim_err(ENOENT, "Freeing range not alloc'ed before");
-  auto end = it->m_end;
+  auto end = it->second;
 
+  m_allocated_bytes -= end - start + 1;
   m_allocated_ranges.erase(it);
 
   // Merge with adjacent free ranges
-  range new_free{start, end};
-
-  auto after = m_free_ranges.upper_bound(new_free);
-  auto before = (after == m_free_ranges.begin()) ? m_free_ranges.end() : std::prev(after);
-
-  if (after != m_free_ranges.end() && after->m_start == end + 1) {
-    new_free.m_end = after->m_end;
-    m_free_ranges.erase(after);
+  auto after = m_free_by_addr.upper_bound(start);
+  if (after != m_free_by_addr.end() && after->first == end + 1) {
+    end = after->second;
+    after = std::next(after);
+    erase_free(std::prev(after));
   }
 
-  if (before != m_free_ranges.end() && before->m_end + 1 == start) {
-    new_free.m_start = before->m_start;
-    m_free_ranges.erase(before);
+  if (after != m_free_by_addr.begin()) {
+    auto before = std::prev(after);
+    if (before->second + 1 == start) {
+      start = before->first;
+      erase_free(before);
+    }
   }
 
-  m_free_ranges.insert(new_free);
+  insert_free(start, end);
+}
+
+range_mgr_stats
+range_mgr::
+get_stats() const
+{
+  range_mgr_stats stats = {};
+
+  for (const auto& [start, end] : m_free_by_addr)
+    stats.free_bytes += end - start + 1;
+  stats.free_ranges = m_free_by_addr.size();
+  stats.largest_free = m_free_by_size.empty() ? 0 : m_free_by_size.rbegin()->first;
+  stats.allocated_bytes = m_allocated_bytes;
+  stats.allocated_ranges = m_allocated_ranges.size();
+  stats.fragmentation = stats.free_bytes ?
+    1.0 - static_cast<double>(stats.largest_free) / stats.free_bytes : 0;
+  return stats;
 }
 
 void
 range_mgr::
 print(void)
 {
+  auto stats = get_stats();
+
   std::cout << "Free Ranges: ";
-  for (const auto& range : m_free_ranges)
-    std::cout << "[" << range.m_start << ", " << range.m_end << "] ";
+  for (const auto& [start, end] : m_free_by_addr)
+    std::cout << "[" << start << ", " << end << "] ";
   std::cout << "\n";
 
   std::cout << "Allocated Ranges: ";
-  for (const auto& range : m_allocated_ranges)
-    std::cout << "[" << range.m_start << ", " << range.m_end << "] ";
-  std::cout << "\n\n";
+  for (const auto& [start, end] : std::map<uint64_t, uint64_t>(
+         m_allocated_ranges.begin(), m_allocated_ranges.end()))
+    std::cout << "[" << start << ", " << end << "] ";
+  std::cout << "\n";
+
+  std::cout << "Free " << stats.free_bytes << " bytes in " << stats.free_ranges
+            << " ranges, largest " << stats.largest_free
+            << ", fragmentation " << stats.fragmentation << "\n\n";
 }
 
 } // namespace shim_xdna
-
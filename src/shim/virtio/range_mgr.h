@@ -4,37 +4,55 @@
 #ifndef RANGE_MGR_H
 #define RANGE_MGR_H
 
-#include <set>
 #include <cstdint>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
 
 namespace shim_xdna {
 
-struct range {
-  uint64_t m_start;
-  uint64_t m_end;
-        
-  bool operator<(const range& other) const
-  {
-    return m_end < other.m_start;
-  }
+struct range_mgr_stats {
+  uint64_t free_bytes;
+  uint64_t free_ranges;
+  uint64_t largest_free;
+  uint64_t allocated_bytes;
+  uint64_t allocated_ranges;
+  // 0 when all free space is one range, close to 1 when it is scattered
+  double fragmentation;
 };
 
+// Best-fit allocator of [start, end] ranges, end is inclusive
 class range_mgr {
 public:
   range_mgr(uint64_t start, uint64_t end);
 
   uint64_t
-  alloc(uint64_t size);
+  alloc(uint64_t size, uint64_t align = 1);
 
   void
   free(uint64_t start);
 
+  range_mgr_stats
+  get_stats() const;
+
   void
   print(void);
 
 private:
-  std::set<range> m_free_ranges;
-  std::set<range> m_allocated_ranges;
+  // Free ranges indexed by start for coalescing, value is end
+  std::map<uint64_t, uint64_t> m_free_by_addr;
+  // Same free ranges indexed by (size, start) for best fit
+  std::set< std::pair<uint64_t, uint64_t> > m_free_by_size;
+  // Allocated ranges, start to end
+  std::unordered_map<uint64_t, uint64_t> m_allocated_ranges;
+  uint64_t m_allocated_bytes = 0;
+
+  void
+  insert_free(uint64_t start, uint64_t end);
+
+  void
+  erase_free(std::map<uint64_t, uint64_t>::iterator it);
 };
 
 } // namespace shim_xdna
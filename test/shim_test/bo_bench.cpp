@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "bo.h"
+#include "speed.h"
+
+#include "core/common/device.h"
+#include "core/common/system.h"
+
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+#define BO_BENCH_ALLOC        0
+#define BO_BENCH_TOUCH        1
+#define BO_BENCH_SYNC         2
+#define BO_BENCH_EXPORT       3
+#define BO_BENCH_IMPORT       4
+#define BO_BENCH_FREE         5
+#define BO_BENCH_MAX_OPS      6
+
+const char *bo_bench_op_names[BO_BENCH_MAX_OPS] = {
+  "alloc", "touch", "sync", "export", "import", "free"
+};
+
+struct bo_bench_type {
+  const char *name;
+  uint32_t flags;
+  bool can_sync;
+  bool can_export;
+};
+
+const bo_bench_type bo_bench_types[] = {
+  { "share", XCL_BO_FLAGS_HOST_ONLY, true, true },
+  { "dev", XCL_BO_FLAGS_CACHEABLE, true, false },
+  { "cmd", XCL_BO_FLAGS_EXECBUF, false, false },
+};
+
+// Upper bound of memory held by one thread at a time
+const size_t bo_bench_batch_bytes = 256ul * 1024 * 1024;
+
+// One thread's worth of the lifecycle, BOs go through each stage in batches
+void
+bo_bench_thread(device* dev, const bo_bench_type& type, size_t size, int iters,
+                std::vector<perf_samples>& samples)
+{
+  const size_t page_size = getpagesize();
+  int batch = std::max<size_t>(std::min<size_t>(iters, bo_bench_batch_bytes / size), 1);
+
+  for (int done = 0; done < iters; done += batch) {
+    int n = std::min(batch, iters - done);
+    std::vector< std::unique_ptr<buffer_handle> > bos;
+    std::vector< std::unique_ptr<buffer_handle> > imported;
+
+    for (int i = 0; i < n; i++) {
+      auto start = clk::now();
+      bos.push_back(dev->alloc_bo(nullptr, size, get_bo_flags(type.flags, 0)));
+      samples[BO_BENCH_ALLOC].add(start, clk::now());
+    }
+
+    // Mapping is part of allocation in shim, time the first touch of every page instead
+    for (auto& boh : bos) {
+      auto p = reinterpret_cast<volatile char *>(boh->map(buffer_handle::map_type::write));
+      auto start = clk::now();
+      for (size_t off = 0; off < size; off += page_size)
+        p[off] = 0;
+      samples[BO_BENCH_TOUCH].add(start, clk::now());
+    }
+
+    if (type.can_sync) {
+      for (auto& boh : bos) {
+        auto start = clk::now();
+        boh->sync(buffer_handle::direction::host2device, size, 0);
+        samples[BO_BENCH_SYNC].add(start, clk::now());
+      }
+    }
+
+    if (type.can_export) {
+      for (auto& boh : bos) {
+        auto start = clk::now();
+        auto share = boh->share();
+        samples[BO_BENCH_EXPORT].add(start, clk::now());
+
+        start = clk::now();
+        imported.push_back(dev->import_bo(getpid(), share->get_export_handle()));
+        samples[BO_BENCH_IMPORT].add(start, clk::now());
+      }
+      imported.clear();
+    }
+
+    for (auto& boh : bos) {
+      auto start = clk::now();
+      boh.reset();
+      samples[BO_BENCH_FREE].add(start, clk::now());
+    }
+  }
+}
+
+// Returns false when the size can't be allocated, e.g. beyond device heap or locked memory limit
+bool
+bo_bench_run(device* dev, const bo_bench_type& type, size_t size, int iters, int nthreads)
+{
+  std::vector< std::vector<perf_samples> > samples(nthreads,
+    std::vector<perf_samples>(BO_BENCH_MAX_OPS));
+  std::vector<std::exception_ptr> errors(nthreads);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread([&, t] {
+      try {
+        bo_bench_thread(dev, type, size, iters, samples[t]);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    }));
+  }
+  for (auto& t : threads)
+    t.join();
+
+  for (auto& e : errors) {
+    if (!e)
+      continue;
+    try {
+      std::rethrow_exception(e);
+    } catch (const std::exception& ex) {
+      std::cout << "\t" << type.name << " BO of 0x" << std::hex << size << std::dec
+                << " bytes not benchmarked: " << ex.what() << std::endl;
+    }
+    return false;
+  }
+
+  for (int op = 0; op < BO_BENCH_MAX_OPS; op++) {
+    perf_samples all;
+    double total_us = 0;
+    for (auto& s : samples)
+      all.append(s[op]);
+    if (!all.size())
+      continue;
+    for (auto us : all.us())
+      total_us += us;
+
+    // Threads run side by side, so each contributes its own share of ops/sec
+    double ops = all.size() * 1000000.0 * nthreads / total_us;
+    std::string label = std::string("bo-") + type.name + "-" + bo_bench_op_names[op];
+    all.report(label, { {"size", static_cast<double>(size)}, {"threads", nthreads},
+                        {"ops_per_sec", ops} });
+  }
+  return true;
+}
+
+}
+
+void
+TEST_bo_lifecycle_bench(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto max_size = static_cast<size_t>(arg[0]);
+  auto iters = static_cast<int>(arg[1]);
+  auto nthreads = static_cast<int>(arg[2]);
+  perf_samples heap;
+
+  // Device heap is only allocated and freed by shim on first open and last close
+  sdev.reset();
+  for (int i = 0; i < std::max(iters / 8, 1); i++) {
+    auto start = clk::now();
+    get_userpf_device(id).reset();
+    heap.add(start, clk::now());
+  }
+  heap.report("bo-dev_heap-open_close", { {"threads", 1} });
+
+  sdev = get_userpf_device(id);
+  auto dev = sdev.get();
+  for (int r = 0; r < std::max(perf_bench.repeat, 1); r++) {
+    for (auto& type : bo_bench_types) {
+      for (size_t size = 0x1000; size <= max_size; size *= 4) {
+        if (perf_bench.warmup > 0) {
+          std::vector<perf_samples> discard(BO_BENCH_MAX_OPS);
+          try {
+            bo_bench_thread(dev, type, size, perf_bench.warmup, discard);
+          } catch (...) {
+          }
+        }
+        if (!bo_bench_run(dev, type, size, iters, nthreads))
+          break;
+      }
+    }
+  }
+}
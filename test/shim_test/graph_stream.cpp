@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+// Tests of shim helpers which have no XRT interface yet, they are reached
+// through the shim objects behind the XRT handles.
+
+#include "io.h"
+#include "hwctx.h"
+#include "dev_info.h"
+
+#include "../../src/shim/device.h"
+#include "../../src/shim/stream.h"
+#include "../../src/shim/kmq/bo.h"
+#include "../../src/shim/kmq/graph.h"
+#include "../../src/shim/kmq/hwq.h"
+
+#include "core/common/device.h"
+#include <functional>
+#include <string>
+
+namespace {
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+// One io test command set bound to a context
+struct graph_stream_cmd {
+  std::unique_ptr<io_test_bo_set> boset;
+  ert_start_kernel_cmd *pkt;
+
+  graph_stream_cmd(device *dev, hw_ctx& hwctx)
+    : boset(std::make_unique<io_test_bo_set>(dev))
+  {
+    auto kernel = get_kernel_name(dev, nullptr);
+    if (kernel.empty())
+      throw std::runtime_error("No kernel found");
+    boset->init_cmd(hwctx.get()->open_cu_context(kernel), false);
+    boset->sync_before_run();
+    pkt = reinterpret_cast<ert_start_kernel_cmd *>(cmd()->map());
+  }
+
+  bo*
+  cmd()
+  {
+    return boset->get_bos()[IO_TEST_BO_CMD].tbo.get();
+  }
+
+  // Clear output so a stale result from the previous run can't pass
+  void
+  reset()
+  {
+    auto obo = boset->get_bos()[IO_TEST_BO_OUTPUT].tbo;
+    std::memset(obo->map(), 0, obo->size());
+    obo->get()->sync(buffer_handle::direction::host2device, obo->size(), 0);
+    pkt->state = ERT_CMD_STATE_NEW;
+  }
+
+  void
+  check()
+  {
+    if (pkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("Command failed, state=") + std::to_string(pkt->state));
+    boset->sync_after_run();
+    boset->verify_result();
+  }
+};
+
+shim_xdna::hw_q_kmq *
+graph_stream_kmq_queue(hw_ctx& hwctx)
+{
+  return dynamic_cast<shim_xdna::hw_q_kmq *>(hwctx.get()->get_hw_queue());
+}
+
+void
+graph_stream_expect_error(const char *what, const std::function<void()>& f)
+{
+  try {
+    f();
+  } catch (const system_error&) {
+    return;
+  }
+  throw std::runtime_error(std::string(what) + " did not fail");
+}
+
+}
+
+// Args: number of graph submissions
+void
+TEST_cmd_graph(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto total = static_cast<int>(arg[0]);
+  hw_ctx hwctx0{dev};
+  hw_ctx hwctx1{dev};
+  auto q0 = graph_stream_kmq_queue(hwctx0);
+  auto q1 = graph_stream_kmq_queue(hwctx1);
+  if (!q0 || !q1) {
+    std::cout << "	Command graph needs KMQ, skipping" << std::endl;
+    return;
+  }
+
+  // Pipeline bouncing between two contexts: a on 0, b on 1, c on 0
+  graph_stream_cmd a{dev, hwctx0};
+  graph_stream_cmd b{dev, hwctx1};
+  graph_stream_cmd c{dev, hwctx0};
+  shim_xdna::cmd_graph g;
+  auto na = g.add_command(q0, a.cmd()->get());
+  auto nb = g.add_command(q1, b.cmd()->get(), { na });
+  g.add_command(q0, c.cmd()->get(), { na, nb });
+  graph_stream_expect_error("Dependency on a later node", [&] {
+    g.add_command(q1, a.cmd()->get(), { static_cast<shim_xdna::cmd_graph::node_id>(g.size()) });
+  });
+
+  for (int i = 0; i < total; i++) {
+    for (auto cmd : { &a, &b, &c })
+      cmd->reset();
+    g.submit();
+    q0->wait_command(a.cmd()->get(), 5000);
+    q1->wait_command(b.cmd()->get(), 5000);
+    q0->wait_command(c.cmd()->get(), 5000);
+    for (auto cmd : { &a, &b, &c })
+      cmd->check();
+  }
+
+  // Second node goes to a context that does not exist. The first one is
+  // queued anyway, reported by cmd_count, and has its seq written back.
+  const size_t max_arg_bos = 1024;
+  std::vector<uint32_t> args(max_arg_bos);
+  auto abo = static_cast<shim_xdna::bo_kmq *>(a.cmd()->get());
+  auto bbo = static_cast<shim_xdna::bo_kmq *>(b.cmd()->get());
+  auto acnt = abo->get_arg_bo_handles(args.data(), max_arg_bos);
+  args.resize(acnt + max_arg_bos);
+  auto bcnt = bbo->get_arg_bo_handles(&args[acnt], max_arg_bos);
+  args.resize(acnt + bcnt);
+  args.push_back(0);
+  amdxdna_graph_node nodes[2] = {
+    { hwctx0.get()->get_slotidx(), abo->get_drm_bo_handle(), acnt, 0, 0 },
+    { AMDXDNA_INVALID_CTX_HANDLE, bbo->get_drm_bo_handle(), bcnt, 1, 0 },
+  };
+  amdxdna_drm_exec_cmd ecmd = {
+    .type = AMDXDNA_CMD_SUBMIT_GRAPH,
+    .cmd_handles = reinterpret_cast<uintptr_t>(nodes),
+    .args = reinterpret_cast<uintptr_t>(args.data()),
+    .cmd_count = 2,
+    .arg_count = static_cast<uint32_t>(args.size()),
+  };
+  auto& pdev = dynamic_cast<shim_xdna::device *>(dev)->get_pdev();
+  a.reset();
+  graph_stream_expect_error("Graph with an invalid context", [&] {
+    pdev.ioctl(DRM_IOCTL_AMDXDNA_EXEC_CMD, &ecmd);
+  });
+  if (ecmd.cmd_count != 1)
+    throw std::runtime_error("Queued node count is " + std::to_string(ecmd.cmd_count) + ", expect 1");
+  amdxdna_drm_wait_cmd wcmd = {
+    .ctx = nodes[0].ctx,
+    .timeout = 5000,
+    .seq = nodes[0].seq,
+  };
+  pdev.ioctl(DRM_IOCTL_AMDXDNA_WAIT_CMD, &wcmd);
+  a.check();
+}
+
+// Args: number of slots, number of submissions
+void
+TEST_stream_q(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto num_slots = static_cast<size_t>(arg[0]);
+  auto total = static_cast<int>(arg[1]);
+  hw_ctx hwctx{dev};
+  auto hwq = dynamic_cast<shim_xdna::hw_q *>(hwctx.get()->get_hw_queue());
+  // Stream waits for running slots when it goes, so it has to go first
+  std::vector<std::unique_ptr<graph_stream_cmd>> cmds;
+  shim_xdna::stream_q s{*hwq};
+
+  graph_stream_expect_error("Acquire without slots", [&] { s.acquire(); });
+
+  for (size_t i = 0; i < num_slots; i++) {
+    cmds.push_back(std::make_unique<graph_stream_cmd>(dev, hwctx));
+    auto& bos = cmds.back()->boset->get_bos();
+    std::vector<buffer_handle *> in;
+    std::vector<buffer_handle *> out;
+    for (auto t : { IO_TEST_BO_INPUT, IO_TEST_BO_PARAMETERS, IO_TEST_BO_INSTRUCTION, IO_TEST_BO_MC_CODE }) {
+      if (bos[t].tbo)
+        in.push_back(bos[t].tbo->get());
+    }
+    for (auto t : { IO_TEST_BO_OUTPUT, IO_TEST_BO_INTERMEDIATE }) {
+      if (bos[t].tbo)
+        out.push_back(bos[t].tbo->get());
+    }
+    if (s.add_slot(cmds.back()->cmd()->get(), in, out) != i)
+      throw std::runtime_error("Unexpected stream slot index");
+  }
+
+  graph_stream_expect_error("Submit of a free slot", [&] { s.submit(0); });
+  graph_stream_expect_error("Release of a free slot", [&] { s.release(0); });
+  if (s.complete(0) != -1)
+    throw std::runtime_error("Complete with nothing running did not fail");
+
+  int submitted = 0;
+  int completed = 0;
+  while (completed < total) {
+    if (submitted < total && s.running() < num_slots) {
+      auto idx = s.acquire();
+      cmds[idx]->reset();
+      s.submit(idx);
+      submitted++;
+      continue;
+    }
+
+    auto idx = s.complete(5000);
+    if (idx < 0)
+      throw std::runtime_error("Stream slot timed out");
+    if (static_cast<size_t>(idx) != completed % num_slots)
+      throw std::runtime_error("Stream slot " + std::to_string(idx) + " completed out of order");
+    cmds[idx]->check();
+    graph_stream_expect_error("Submit of a done slot", [&] { s.submit(idx); });
+    s.release(idx);
+    completed++;
+  }
+
+  graph_stream_expect_error("Adding slot while streaming", [&] {
+    s.add_slot(cmds[0]->cmd()->get(), {}, {});
+  });
+}
+
+// Args: number of submissions
+void
+TEST_seq_page(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto total = static_cast<int>(arg[0]);
+  hw_ctx hwctx{dev};
+  auto q = graph_stream_kmq_queue(hwctx);
+  if (!q) {
+    std::cout << "	Completion page needs KMQ, skipping" << std::endl;
+    return;
+  }
+
+  graph_stream_cmd cmd{dev, hwctx};
+  auto prev = q->seq_completed();
+  if (prev == static_cast<uint64_t>(-1))
+    throw std::runtime_error("Completion page is not set");
+
+  for (int i = 0; i < total; i++) {
+    cmd.reset();
+    q->submit_command(cmd.cmd()->get());
+    q->wait_command(cmd.cmd()->get(), 5000);
+    cmd.check();
+    // Driver moves the page before it signals the command done
+    auto seq = static_cast<shim_xdna::bo *>(cmd.cmd()->get())->get_cmd_id();
+    auto completed = q->seq_completed();
+    if (completed <= prev || completed <= seq)
+      throw std::runtime_error("Completion page at " + std::to_string(completed) +
+        " after seq " + std::to_string(seq) + ", was " + std::to_string(prev));
+    prev = completed;
+  }
+}
@@ -13,10 +13,10 @@ using namespace xrt_core;
 
 class hw_ctx {
 public:
-  hw_ctx(device* dev, const char *xclbin_name=nullptr)
+  hw_ctx(device* dev, const char *xclbin_name=nullptr, uint32_t priority=0x180)
   {
     auto path = get_xclbin_path(dev, xclbin_name);
-    hw_ctx_init(dev, path);
+    hw_ctx_init(dev, path, priority);
   }
 
   hwctx_handle *
@@ -29,7 +29,7 @@ private:
   std::unique_ptr<hwctx_handle> m_handle;
 
   void
-  hw_ctx_init(device* dev, const std::string& xclbin_path)
+  hw_ctx_init(device* dev, const std::string& xclbin_path, uint32_t priority)
   {
     xrt::xclbin xclbin;
 
@@ -42,7 +42,7 @@ private:
     }
     dev->record_xclbin(xclbin);
     auto xclbin_uuid = xclbin.get_uuid();
-    xrt::hw_context::qos_type qos{ {"gops", 100}, {"priority", 0x180} };
+    xrt::hw_context::qos_type qos{ {"gops", 100}, {"priority", priority} };
     xrt::hw_context::access_mode mode = xrt::hw_context::access_mode::shared;
 
     m_handle = dev->create_hw_context(xclbin_uuid, qos, mode);
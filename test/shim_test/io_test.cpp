@@ -8,8 +8,14 @@
 #include "io_param.h"
 
 #include "core/common/device.h"
+#include "core/common/system.h"
+#include <functional>
+#include <future>
 #include <string>
 #include <regex>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace xrt_core;
 using arg_type = const std::vector<uint64_t>;
@@ -105,7 +111,8 @@ void
 io_test_cmd_submit_and_wait_latency(
   hwqueue_handle *hwq,
   int total_cmd_submission,
-  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos
+  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos,
+  perf_samples *samples
   )
 {
   int completed = 0;
@@ -113,8 +120,11 @@ io_test_cmd_submit_and_wait_latency(
 
   while (completed < total_cmd_submission) {
     for (auto& cmd : cmdlist_bos) {
+      auto submit = clk::now();
       hwq->submit_command(std::get<0>(cmd).get()->get());
       io_test_cmd_wait(hwq, std::get<0>(cmd));
+      if (samples)
+        samples->add(submit, clk::now());
       auto state = std::get<1>(cmd)->state;
       if (state != ERT_CMD_STATE_COMPLETED)
         throw std::runtime_error(std::string("Command failed, state=") + std::to_string(state));
@@ -130,14 +140,18 @@ void
 io_test_cmd_submit_and_wait_thruput(
   hwqueue_handle *hwq,
   int total_cmd_submission,
-  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos
+  std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> >& cmdlist_bos,
+  perf_samples *samples
   )
 {
   int issued = 0;
   int completed = 0;
   int wait_idx = 0;
+  // Latency under load is measured from each submission to its completion
+  std::vector<clk::time_point> submit_ts(cmdlist_bos.size());
 
   for (auto& cmd : cmdlist_bos) {
+    submit_ts[issued] = clk::now();
     hwq->submit_command(std::get<0>(cmd).get()->get());
     issued++;
     if (issued >= total_cmd_submission)
@@ -146,6 +160,8 @@ io_test_cmd_submit_and_wait_thruput(
 
   while (completed < issued) {
     io_test_cmd_wait(hwq, std::get<0>(cmdlist_bos[wait_idx]));
+    if (samples)
+      samples->add(submit_ts[wait_idx], clk::now());
     auto state = std::get<1>(cmdlist_bos[wait_idx])->state;
     if (state != ERT_CMD_STATE_COMPLETED)
       throw std::runtime_error(std::string("Command failed, state=") + std::to_string(state));
@@ -153,6 +169,7 @@ io_test_cmd_submit_and_wait_thruput(
     completed++;
 
     if (issued < total_cmd_submission) {
+      submit_ts[wait_idx] = clk::now();
       hwq->submit_command(std::get<0>(cmdlist_bos[wait_idx]).get()->get());
       issued++;
     }
@@ -162,9 +179,12 @@ io_test_cmd_submit_and_wait_thruput(
   }
 }
 
-void
+// Returns commands per second over all repeats, 0 if perf is not measured
+double
 io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist, int cmds_per_list, bool is_elf)
 {
+  double total_us = 0;
+
   // Allocate set of BOs for command submission based on num_cmdlist and cmds_per_list
   // Intentionally this is done before context creation to make sure BO and context
   // are totally decoupled.
@@ -213,12 +233,51 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
   }
 
   // Submit commands and wait for results
-  auto start = clk::now();
-  if (io_test_parameters.perf == IO_TEST_THRUPUT_PERF)
-    io_test_cmd_submit_and_wait_thruput(hwq, total_hwq_submit, cmdlist_bos);
-  else
-    io_test_cmd_submit_and_wait_latency(hwq, total_hwq_submit, cmdlist_bos);
-  auto end = clk::now();
+  auto submit_and_wait = [&](int total, perf_samples *samples) {
+    if (io_test_parameters.perf == IO_TEST_THRUPUT_PERF)
+      io_test_cmd_submit_and_wait_thruput(hwq, total, cmdlist_bos, samples);
+    else
+      io_test_cmd_submit_and_wait_latency(hwq, total, cmdlist_bos, samples);
+  };
+
+  if (io_test_parameters.perf == IO_TEST_NO_PERF) {
+    submit_and_wait(total_hwq_submit, nullptr);
+  } else {
+    // Label carries the configuration so that CSV/JSON rows can be told apart
+    std::string label = std::string(io_test_parameters.perf == IO_TEST_THRUPUT_PERF ?
+                                    "thruput" : "latency") +
+      (io_test_parameters.wait == IO_TEST_POLL_WAIT ? "-poll" : "-ioctl") +
+      (io_test_parameters.type == IO_TEST_NOOP_RUN ? "-noop" : "-normal") +
+      "-list" + std::to_string(cmds_per_list);
+    perf_samples all;
+
+    if (perf_bench.warmup > 0)
+      submit_and_wait(perf_bench.warmup, nullptr);
+
+    for (int r = 0; r < std::max(perf_bench.repeat, 1); r++) {
+      perf_samples samples;
+      samples.reserve(total_hwq_submit);
+
+      auto start = clk::now();
+      submit_and_wait(total_hwq_submit, &samples);
+      auto end = clk::now();
+
+      // Report the performance numbers
+      auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
+      total_us += duration_us;
+      auto cps = (total_hwq_submit * cmds_per_list * 1000000.0) / duration_us;
+      auto latency_us = 1000000.0 / cps;
+      std::cout << total_hwq_submit * cmds_per_list << " commands finished in "
+                << duration_us << " us, " << cmds_per_list << " commands per list, "
+                << cps << " Command/sec,"
+                << " Average latency " << latency_us << " us" << std::endl;
+      samples.report(label);
+      all.append(samples);
+    }
+
+    if (perf_bench.repeat > 1)
+      all.report(label + "-all");
+  }
 
   // Verify result
   if (io_test_parameters.type != IO_TEST_NOOP_RUN) {
@@ -229,16 +288,325 @@ io_test(device::id_type id, device* dev, int total_hwq_submit, int num_cmdlist,
     }
   }
 
-  // Report the performance numbers
-  if (io_test_parameters.perf != IO_TEST_NO_PERF) {
-    auto duration_us = std::chrono::duration_cast<us_t>(end - start).count();
-    auto cps = (total_hwq_submit * cmds_per_list * 1000000.0) / duration_us;
-    auto latency_us = 1000000.0 / cps;
-    std::cout << total_hwq_submit * cmds_per_list << " commands finished in "
-              << duration_us << " us, " << cmds_per_list << " commands per list, "
-              << cps << " Command/sec,"
-              << " Average latency " << latency_us << " us" << std::endl;
+  if (!total_us)
+    return 0;
+  return total_hwq_submit * cmds_per_list * 1000000.0 * std::max(perf_bench.repeat, 1) / total_us;
+}
+
+// Smallest chain length reaching this share of the best throughput is the knee
+const double io_runlist_knee_ratio = 0.95;
+
+struct io_runlist_point {
+  int num_cmdlist;
+  int cmds_per_list;
+  double cps;
+};
+
+const io_runlist_point&
+io_runlist_knee(const std::vector<io_runlist_point>& points)
+{
+  double best = 0;
+  for (auto& pt : points)
+    best = std::max(best, pt.cps);
+
+  // Points are in increasing chain length, fewer commands per list means lower latency
+  for (auto& pt : points) {
+    if (pt.cps >= best * io_runlist_knee_ratio)
+      return pt;
   }
+  return points.back();
+}
+
+
+// One sweep point of the scaling benchmark
+struct io_scaling_config {
+  int procs;
+  int ctxs;     // total across all processes
+  int threads;  // submitting threads per context
+  int qdepth;   // outstanding commands per thread
+  int cmds;     // commands per context
+};
+
+// Per-context outcome, passed from worker processes to the parent
+struct io_scaling_ctx_result {
+  uint64_t cmds;
+  int64_t start_ns; // steady_clock is system wide, comparable across processes
+  int64_t end_ns;
+  uint64_t nsamples;
+};
+
+struct io_scaling_ctx {
+  std::vector< std::unique_ptr<io_test_bo_set_base> > bo_set;
+  std::unique_ptr<hw_ctx> hwctx;
+  hwqueue_handle *hwq;
+  // One command list per submitting thread, its size is the queue depth
+  std::vector< std::vector< std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *> > > cmdlists;
+};
+
+int64_t
+io_scaling_now_ns()
+{
+  return std::chrono::duration_cast<ns_t>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::unique_ptr<io_scaling_ctx>
+io_scaling_ctx_init(device* dev, const io_scaling_config& cfg)
+{
+  auto ctx = std::make_unique<io_scaling_ctx>();
+
+  for (int i = 0; i < cfg.threads * cfg.qdepth; i++)
+    ctx->bo_set.push_back(alloc_and_init_bo_set(dev, false));
+
+  ctx->hwctx = std::make_unique<hw_ctx>(dev);
+  ctx->hwq = ctx->hwctx->get()->get_hw_queue();
+  auto ip_name = get_kernel_name(dev, nullptr);
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = ctx->hwctx->get()->open_cu_context(ip_name);
+
+  ctx->cmdlists.resize(cfg.threads);
+  for (int i = 0; i < ctx->bo_set.size(); i++) {
+    auto& boset = ctx->bo_set[i];
+    boset->init_cmd(cu_idx, io_test_parameters.debug);
+    boset->sync_before_run();
+    auto& cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    auto cmdpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+    ctx->cmdlists[i / cfg.qdepth].push_back( {cbo, cmdpkt} );
+  }
+  return ctx;
+}
+
+// Run the contexts of one process, with all submitting threads released at once by go
+std::vector< std::pair<io_scaling_ctx_result, perf_samples> >
+io_scaling_run_proc(device::id_type id, const io_scaling_config& cfg, int proc_idx,
+                    const std::function<void()>& wait_for_go)
+{
+  auto sdev = get_userpf_device(id);
+  auto dev = sdev.get();
+  std::vector< std::unique_ptr<io_scaling_ctx> > ctxs;
+
+  // Contexts are dealt to processes round robin
+  for (int i = proc_idx; i < cfg.ctxs; i += cfg.procs)
+    ctxs.push_back(io_scaling_ctx_init(dev, cfg));
+
+  int cmds_per_thread = std::max(cfg.cmds / cfg.threads, 1);
+  std::vector<perf_samples> samples(ctxs.size() * cfg.threads);
+  std::vector<int64_t> start(samples.size());
+  std::vector<int64_t> end(samples.size());
+  std::promise<void> go;
+  std::shared_future<void> go_f = go.get_future().share();
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(samples.size());
+
+  for (int c = 0; c < ctxs.size(); c++) {
+    for (int t = 0; t < cfg.threads; t++) {
+      int idx = c * cfg.threads + t;
+      threads.push_back(std::thread([&, c, t, idx] {
+        auto& cmdlist = ctxs[c]->cmdlists[t];
+        try {
+          if (perf_bench.warmup > 0)
+            io_test_cmd_submit_and_wait_thruput(ctxs[c]->hwq, perf_bench.warmup, cmdlist, nullptr);
+          samples[idx].reserve(cmds_per_thread);
+          go_f.wait();
+          start[idx] = io_scaling_now_ns();
+          io_test_cmd_submit_and_wait_thruput(ctxs[c]->hwq, cmds_per_thread, cmdlist, &samples[idx]);
+          end[idx] = io_scaling_now_ns();
+        } catch (...) {
+          errors[idx] = std::current_exception();
+        }
+      }));
+    }
+  }
+
+  wait_for_go();
+  go.set_value();
+  for (auto& t : threads)
+    t.join();
+  for (auto& e : errors) {
+    if (e)
+      std::rethrow_exception(e);
+  }
+
+  std::vector< std::pair<io_scaling_ctx_result, perf_samples> > results;
+  for (int c = 0; c < ctxs.size(); c++) {
+    io_scaling_ctx_result r = { 0, INT64_MAX, 0, 0 };
+    perf_samples ctx_samples;
+    for (int t = 0; t < cfg.threads; t++) {
+      int idx = c * cfg.threads + t;
+      r.cmds += cmds_per_thread;
+      r.start_ns = std::min(r.start_ns, start[idx]);
+      r.end_ns = std::max(r.end_ns, end[idx]);
+      ctx_samples.append(samples[idx]);
+    }
+    r.nsamples = ctx_samples.size();
+    results.push_back( {r, std::move(ctx_samples)} );
+  }
+  return results;
+}
+
+bool
+io_scaling_read(int fd, void *buf, size_t size)
+{
+  auto p = static_cast<char *>(buf);
+  while (size) {
+    auto n = read(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool
+io_scaling_write(int fd, const void *buf, size_t size)
+{
+  auto p = static_cast<const char *>(buf);
+  while (size) {
+    auto n = write(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Fork one worker per process. The device must not be opened by the caller.
+std::vector< std::pair<io_scaling_ctx_result, perf_samples> >
+io_scaling_run(device::id_type id, const io_scaling_config& cfg)
+{
+  std::vector<pid_t> pids;
+  std::vector<int> result_fds;
+  std::vector<int> go_fds;
+
+  for (int p = 0; p < cfg.procs; p++) {
+    int result_pipe[2];
+    int go_pipe[2];
+    if (pipe(result_pipe) < 0 || pipe(go_pipe) < 0)
+      throw std::runtime_error("Can't create pipes");
+
+    std::cout << std::flush;
+    auto pid = fork();
+    if (pid == -1)
+      throw std::runtime_error("Can't fork");
+
+    if (!pid) {
+      close(result_pipe[0]);
+      close(go_pipe[1]);
+      int ret = EXIT_SUCCESS;
+      try {
+        auto results = io_scaling_run_proc(id, cfg, p, [&] {
+          char c = 0;
+          // Ready, then wait for all other processes to be ready too
+          if (!io_scaling_write(result_pipe[1], &c, sizeof(c)) ||
+              !io_scaling_read(go_pipe[0], &c, sizeof(c)))
+            throw std::runtime_error("Lost parent");
+        });
+        for (auto& r : results) {
+          if (!io_scaling_write(result_pipe[1], &r.first, sizeof(r.first)) ||
+              !io_scaling_write(result_pipe[1], r.second.us().data(),
+                                r.second.size() * sizeof(double)))
+            throw std::runtime_error("Failed to send results to parent");
+        }
+      } catch (const std::exception& ex) {
+        std::cout << "Process " << p << " failed: " << ex.what() << std::endl;
+        ret = EXIT_FAILURE;
+      }
+      std::cout << std::flush;
+      _exit(ret);
+    }
+
+    close(result_pipe[1]);
+    close(go_pipe[0]);
+    pids.push_back(pid);
+    result_fds.push_back(result_pipe[0]);
+    go_fds.push_back(go_pipe[1]);
+  }
+
+  std::vector< std::pair<io_scaling_ctx_result, perf_samples> > results;
+  bool ok = true;
+  char c;
+  for (auto fd : result_fds)
+    ok = ok && io_scaling_read(fd, &c, sizeof(c));
+  // Closing the go pipes releases the processes, or fails them if one is missing
+  for (auto fd : go_fds) {
+    if (ok)
+      ok = io_scaling_write(fd, &c, sizeof(c));
+    close(fd);
+  }
+
+  for (int p = 0; p < cfg.procs; p++) {
+    for (int i = p; ok && i < cfg.ctxs; i += cfg.procs) {
+      io_scaling_ctx_result r;
+      ok = io_scaling_read(result_fds[p], &r, sizeof(r));
+      if (!ok)
+        break;
+      std::vector<double> us(r.nsamples);
+      ok = io_scaling_read(result_fds[p], us.data(), us.size() * sizeof(double));
+      results.push_back( {r, perf_samples(std::move(us))} );
+    }
+    close(result_fds[p]);
+  }
+
+  for (auto pid : pids) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+      ok = false;
+  }
+  if (!ok)
+    throw std::runtime_error("Scaling worker process did not complete successfully");
+  return results;
+}
+
+void
+io_scaling_report(const io_scaling_config& cfg,
+                  const std::vector< std::pair<io_scaling_ctx_result, perf_samples> >& results)
+{
+  int64_t start = INT64_MAX;
+  int64_t end = 0;
+  uint64_t cmds = 0;
+  double sum = 0;
+  double sum_sq = 0;
+  perf_samples all;
+
+  for (auto& r : results) {
+    // Fairness is computed on what each context achieved over its own run
+    double cps = r.first.cmds * 1000000000.0 / (r.first.end_ns - r.first.start_ns);
+    sum += cps;
+    sum_sq += cps * cps;
+    cmds += r.first.cmds;
+    start = std::min(start, r.first.start_ns);
+    end = std::max(end, r.first.end_ns);
+    all.append(r.second);
+  }
+
+  // Jain's index: 1 when all contexts get the same throughput, 1/n when one gets it all
+  double jain = sum_sq ? (sum * sum) / (results.size() * sum_sq) : 0;
+  double cps = cmds * 1000000000.0 / (end - start);
+  std::string label = "scaling-p" + std::to_string(cfg.procs) +
+    "-c" + std::to_string(cfg.ctxs) + "-t" + std::to_string(cfg.threads) +
+    "-q" + std::to_string(cfg.qdepth);
+
+  std::cout << cfg.procs << " processes, " << cfg.ctxs << " contexts, " << cfg.threads
+            << " threads per context, queue depth " << cfg.qdepth << ": " << cmds
+            << " commands in " << (end - start) / 1000 << " us, " << cps << " Command/sec,"
+            << " Jain fairness " << jain << std::endl;
+  all.report(label, { {"procs", cfg.procs}, {"ctxs", cfg.ctxs}, {"threads", cfg.threads},
+                      {"qdepth", cfg.qdepth}, {"cps", cps}, {"fairness", jain} });
+}
+
+// Powers of two up to and including max
+std::vector<int>
+io_scaling_sweep(int max)
+{
+  std::vector<int> v;
+  for (int i = 1; i < max; i *= 2)
+    v.push_back(i);
+  v.push_back(std::max(max, 1));
+  return v;
 }
 
 }
@@ -311,6 +679,43 @@ TEST_io_runlist_throughput(device::id_type id, std::shared_ptr<device> sdev, arg
   }
 }
 
+void
+TEST_io_runlist_sweep(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  unsigned int run_type = static_cast<unsigned int>(arg[0]);
+  unsigned int wait_type = static_cast<unsigned int>(arg[1]);
+  unsigned int total_commands = static_cast<unsigned int>(arg[2]);
+  int max_cmds_per_list = std::min(static_cast<int>(arg[3]), 24);
+  int max_cmdlist = static_cast<int>(arg[4]);
+  std::vector<io_runlist_point> knees;
+
+  io_test_parameter_init(IO_TEST_THRUPUT_PERF, run_type, wait_type);
+
+  for (auto num_cmdlist : io_scaling_sweep(max_cmdlist)) {
+    std::vector<io_runlist_point> points;
+
+    for (auto cmds_per_list : io_scaling_sweep(max_cmds_per_list)) {
+      int total_hwq_submit = std::max<int>(total_commands / cmds_per_list, num_cmdlist);
+      auto cps = io_test(id, sdev.get(), total_hwq_submit, num_cmdlist, cmds_per_list, false);
+      points.push_back({ num_cmdlist, cmds_per_list, cps });
+    }
+
+    auto& knee = io_runlist_knee(points);
+    std::cout << "Runlists " << num_cmdlist << ": knee at " << knee.cmds_per_list
+              << " commands per list, " << knee.cps << " Command/sec" << std::endl;
+    knees.push_back(knee);
+  }
+
+  // Best overall is the knee with highest throughput, ties go to fewer runlists
+  auto best = knees.front();
+  for (auto& k : knees) {
+    if (k.cps > best.cps * (2 - io_runlist_knee_ratio))
+      best = k;
+  }
+  std::cout << "Optimum: " << best.num_cmdlist << " runlists of " << best.cmds_per_list
+            << " commands, " << best.cps << " Command/sec" << std::endl;
+}
+
 void
 TEST_noop_io_with_dup_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
 {
@@ -331,3 +736,74 @@ TEST_elf_io(device::id_type id, std::shared_ptr<device> sdev, const std::vector<
   io_test_parameter_init(IO_TEST_NO_PERF, run_type, IO_TEST_IOCTL_WAIT);
   io_test(id, sdev.get(), 1, 1, arg[1], true);
 }
+
+void
+TEST_io_scaling(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  unsigned int run_type = static_cast<unsigned int>(arg[0]);
+  unsigned int wait_type = static_cast<unsigned int>(arg[1]);
+  int cmds = static_cast<int>(arg[2]);
+  int max_ctxs = static_cast<int>(arg[3]);
+  int max_threads = static_cast<int>(arg[4]);
+  int max_procs = static_cast<int>(arg[5]);
+  int max_qdepth = static_cast<int>(arg[6]);
+
+  // Can't fork with opened device.
+  sdev.reset();
+
+  io_test_parameter_init(IO_TEST_THRUPUT_PERF, run_type, wait_type);
+  for (auto procs : io_scaling_sweep(max_procs)) {
+    for (auto ctxs : io_scaling_sweep(max_ctxs)) {
+      if (ctxs < procs)
+        continue;
+      for (auto threads : io_scaling_sweep(max_threads)) {
+        for (auto qdepth : io_scaling_sweep(max_qdepth)) {
+          io_scaling_config cfg = { procs, ctxs, threads, qdepth, cmds };
+          for (int r = 0; r < std::max(perf_bench.repeat, 1); r++)
+            io_scaling_report(cfg, io_scaling_run(id, cfg));
+        }
+      }
+    }
+  }
+}
+
+// Same cmd BO submitted again and again, with its args rebound half way to a
+// new output BO. Exercises resident arg BO sets with Debug.resident_arg_bos,
+// the set must follow the new binding.
+void
+TEST_io_resident_args(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto total = static_cast<int>(arg[0]);
+  io_test_bo_set boset{dev};
+  auto& bos = boset.get_bos();
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto kernel = get_kernel_name(dev, nullptr);
+  if (kernel.empty())
+    throw std::runtime_error("No kernel found");
+  auto cu_idx = hwctx.get()->open_cu_context(kernel);
+
+  boset.init_cmd(cu_idx, false);
+  boset.sync_before_run();
+  auto cbo = bos[IO_TEST_BO_CMD].tbo;
+  auto cpkt = reinterpret_cast<ert_start_kernel_cmd *>(cbo->map());
+  for (int i = 0; i < total; i++) {
+    if (i == total / 2) {
+      auto obo = bos[IO_TEST_BO_OUTPUT].tbo;
+      bos[IO_TEST_BO_OUTPUT].tbo = std::make_shared<bo>(dev, obo->size());
+      boset.init_cmd(cu_idx, false);
+    }
+    auto obo = bos[IO_TEST_BO_OUTPUT].tbo;
+    std::memset(obo->map(), 0, obo->size());
+    obo->get()->sync(buffer_handle::direction::host2device, obo->size(), 0);
+
+    cpkt->state = ERT_CMD_STATE_NEW;
+    hwq->submit_command(cbo->get());
+    hwq->wait_command(cbo->get(), 5000);
+    if (cpkt->state != ERT_CMD_STATE_COMPLETED)
+      throw std::runtime_error(std::string("Command failed, state=") + std::to_string(cpkt->state));
+    boset.sync_after_run();
+    boset.verify_result();
+  }
+}
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "io.h"
+#include "hwctx.h"
+#include "speed.h"
+#include "dev_info.h"
+
+#include "core/common/device.h"
+#include "core/common/query_requests.h"
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+namespace {
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+using power_type = query::performance_mode::power_type;
+
+// Lowest to highest, POWER_MODE_LOW .. POWER_MODE_TURBO. DPM levels are
+// selected through the power modes, there is no ioctl for a single level.
+const int power_sweep_modes[] = { 1, 2, 3, 4 };
+const int power_sweep_sample_ms = 50;
+
+// Device power in W from the driver sensors, negative if there is no reading.
+// Driver reports UINT32_MAX as input when it has no power data.
+double
+power_sweep_read_watts(device* dev)
+{
+  double watts = 0;
+  bool valid = false;
+
+  try {
+    auto sensors = device_query<query::sdm_sensor_info>(dev, query::sdm_sensor_info::sdr_req_type::power);
+    for (auto& s : sensors) {
+      if (s.input == std::numeric_limits<uint32_t>::max())
+        continue;
+      watts += s.input * std::pow(10, s.unitm);
+      valid = true;
+    }
+  } catch (const std::exception&) {
+  }
+  return valid ? watts : -1;
+}
+
+// Puts power mode back the way it was found
+struct power_sweep_mode_restore {
+  device* dev;
+  int mode;
+
+  ~power_sweep_mode_restore()
+  {
+    try {
+      device_update<query::performance_mode>(dev, static_cast<power_type>(mode));
+    } catch (...) {
+    }
+  }
+};
+
+void
+power_sweep_run(device* dev, int mode, int total, int qdepth)
+{
+  auto dev_id = device_query<query::pcie_device>(dev);
+  std::vector< std::unique_ptr<io_test_bo_set> > bo_set;
+  std::vector<std::shared_ptr<bo>> cmds;
+
+  device_update<query::performance_mode>(dev, static_cast<power_type>(mode));
+
+  for (int i = 0; i < qdepth; i++)
+    bo_set.push_back(std::make_unique<io_test_bo_set>(dev));
+  hw_ctx hwctx{dev};
+  auto hwq = hwctx.get()->get_hw_queue();
+  auto ip_name = get_kernel_name(dev, nullptr);
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = hwctx.get()->open_cu_context(ip_name);
+  for (auto& boset : bo_set) {
+    boset->init_cmd(cu_idx, false);
+    boset->sync_before_run();
+    cmds.push_back(boset->get_bos()[IO_TEST_BO_CMD].tbo);
+  }
+
+  auto run = [&] (int n, perf_samples& samples) {
+    std::vector<clk::time_point> submit_ts(cmds.size());
+    int issued = 0;
+    int completed = 0;
+    size_t idx = 0;
+
+    for (size_t i = 0; i < cmds.size() && issued < n; i++, issued++) {
+      submit_ts[i] = clk::now();
+      hwq->submit_command(cmds[i]->get());
+    }
+    while (completed < issued) {
+      hwq->wait_command(cmds[idx]->get(), 0);
+      auto cmd = reinterpret_cast<ert_start_kernel_cmd *>(cmds[idx]->map());
+      if (cmd->state != ERT_CMD_STATE_COMPLETED)
+        throw std::runtime_error(std::string("Command failed, state=") + std::to_string(cmd->state));
+      samples.add(submit_ts[idx], clk::now());
+      completed++;
+      if (issued < n) {
+        submit_ts[idx] = clk::now();
+        hwq->submit_command(cmds[idx]->get());
+        issued++;
+      }
+      if (++idx == cmds.size())
+        idx = 0;
+    }
+  };
+
+  // Let clocks settle at the new level before measuring
+  if (perf_bench.warmup > 0) {
+    perf_samples discard;
+    run(perf_bench.warmup, discard);
+  }
+
+  std::atomic<bool> stop{false};
+  double watts_sum = 0;
+  int watts_cnt = 0;
+  std::thread sampler([&] {
+    while (!stop) {
+      auto w = power_sweep_read_watts(dev);
+      if (w >= 0) {
+        watts_sum += w;
+        watts_cnt++;
+      }
+      std::this_thread::sleep_for(ms_t(power_sweep_sample_ms));
+    }
+  });
+
+  perf_samples samples;
+  samples.reserve(total);
+  auto start = clk::now();
+  try {
+    run(total, samples);
+  } catch (...) {
+    stop = true;
+    sampler.join();
+    throw;
+  }
+  auto secs = std::chrono::duration<double>(clk::now() - start).count();
+  stop = true;
+  sampler.join();
+
+  double cps = total / secs;
+  perf_metrics m = {
+    {"device", static_cast<double>(dev_id)},
+    {"power_mode", static_cast<double>(mode)},
+    {"cmds_per_sec", cps},
+  };
+  if (watts_cnt) {
+    double watts = watts_sum / watts_cnt;
+    m.emplace_back("watts", watts);
+    if (watts > 0)
+      m.emplace_back("cmds_per_joule", cps / watts);
+  } else {
+    std::cout << "power-sweep: no power sensor reading, watts n/a" << std::endl;
+  }
+  samples.report("power-sweep", m);
+}
+
+}
+
+void
+TEST_power_sweep(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto total = static_cast<int>(arg[0]);
+  auto qdepth = static_cast<int>(arg[1]);
+  auto dev = sdev.get();
+  power_sweep_mode_restore restore{ dev, device_query<query::performance_mode>(dev) };
+
+  for (int r = 0; r < std::max(perf_bench.repeat, 1); r++) {
+    for (auto mode : power_sweep_modes)
+      power_sweep_run(dev, mode, total, qdepth);
+  }
+}
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2025, Advanced Micro Devices, Inc. All rights reserved.
+
+#include "io.h"
+#include "hwctx.h"
+#include "speed.h"
+#include "dev_info.h"
+
+#include "core/common/device.h"
+#include "core/common/query_requests.h"
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+using namespace xrt_core;
+using arg_type = const std::vector<uint64_t>;
+
+// QoS priorities of xrt::hw_context
+const uint32_t preempt_bench_prio_high = 0x100; // realtime
+const uint32_t preempt_bench_prio_low = 0x280;
+
+using preempt_bench_cmd = std::pair<std::shared_ptr<bo>, ert_start_kernel_cmd *>;
+
+struct preempt_bench_ctx {
+  std::vector< std::unique_ptr<io_test_bo_set> > bo_set;
+  std::unique_ptr<hw_ctx> hwctx;
+  hwqueue_handle *hwq;
+  std::vector<preempt_bench_cmd> cmds;
+};
+
+std::unique_ptr<preempt_bench_ctx>
+preempt_bench_ctx_init(device* dev, uint32_t priority, int qdepth)
+{
+  auto ctx = std::make_unique<preempt_bench_ctx>();
+
+  for (int i = 0; i < qdepth; i++)
+    ctx->bo_set.push_back(std::make_unique<io_test_bo_set>(dev));
+
+  ctx->hwctx = std::make_unique<hw_ctx>(dev, nullptr, priority);
+  ctx->hwq = ctx->hwctx->get()->get_hw_queue();
+  auto ip_name = get_kernel_name(dev, nullptr);
+  if (ip_name.empty())
+    throw std::runtime_error("Cannot find any kernel name matched DPU.*");
+  auto cu_idx = ctx->hwctx->get()->open_cu_context(ip_name);
+
+  for (auto& boset : ctx->bo_set) {
+    boset->init_cmd(cu_idx, false);
+    boset->sync_before_run();
+    auto& cbo = boset->get_bos()[IO_TEST_BO_CMD].tbo;
+    ctx->cmds.push_back( {cbo, reinterpret_cast<ert_start_kernel_cmd *>(cbo->map())} );
+  }
+  return ctx;
+}
+
+void
+preempt_bench_wait(hwqueue_handle *hwq, preempt_bench_cmd& cmd)
+{
+  hwq->wait_command(cmd.first->get(), 0);
+  if (cmd.second->state != ERT_CMD_STATE_COMPLETED)
+    throw std::runtime_error(std::string("Command failed, state=") + std::to_string(cmd.second->state));
+  cmd.second->state = ERT_CMD_STATE_NEW;
+}
+
+// Keeps all commands of ctx in flight till stop is set or total commands are done
+uint64_t
+preempt_bench_flood(preempt_bench_ctx& ctx, const std::atomic<bool>& stop, uint64_t total,
+                    perf_samples& samples)
+{
+  std::vector<clk::time_point> submit_ts(ctx.cmds.size());
+  uint64_t issued = 0;
+  uint64_t completed = 0;
+  size_t idx = 0;
+
+  for (size_t i = 0; i < ctx.cmds.size() && issued < total; i++, issued++) {
+    submit_ts[i] = clk::now();
+    ctx.hwq->submit_command(ctx.cmds[i].first->get());
+  }
+  while (completed < issued) {
+    preempt_bench_wait(ctx.hwq, ctx.cmds[idx]);
+    samples.add(submit_ts[idx], clk::now());
+    completed++;
+    if (!stop.load() && issued < total) {
+      submit_ts[idx] = clk::now();
+      ctx.hwq->submit_command(ctx.cmds[idx].first->get());
+      issued++;
+    }
+    if (++idx == ctx.cmds.size())
+      idx = 0;
+  }
+  return completed;
+}
+
+// One command at a time, gap_us apart so that each one lands on a busy device
+void
+preempt_bench_probe(preempt_bench_ctx& ctx, int total, int gap_us, perf_samples& samples)
+{
+  for (int i = 0; i < total; i++) {
+    auto start = clk::now();
+    ctx.hwq->submit_command(ctx.cmds[0].first->get());
+    preempt_bench_wait(ctx.hwq, ctx.cmds[0]);
+    samples.add(start, clk::now());
+    usleep(gap_us);
+  }
+}
+
+uint64_t
+preempt_bench_preemptions(device* dev, preempt_bench_ctx& ctx)
+{
+  auto id = std::to_string(ctx.hwctx->get()->get_slotidx());
+
+  for (auto& e : device_query<query::aie_partition_info>(dev)) {
+    if (e.pid == getpid() && e.metadata.id == id)
+      return e.preemptions;
+  }
+  return 0;
+}
+
+double
+preempt_bench_avg(const perf_samples& s)
+{
+  double sum = 0;
+  for (auto us : s.us())
+    sum += us;
+  return s.size() ? sum / s.size() : 0;
+}
+
+// Puts force preemption back the way it was found
+struct preempt_bench_force_restore {
+  device* dev;
+  uint32_t state;
+
+  ~preempt_bench_force_restore()
+  {
+    try {
+      device_update<query::preemption>(dev, state);
+    } catch (...) {
+    }
+  }
+};
+
+void
+preempt_bench_run(device* dev, uint32_t force, int probes, int qdepth, int gap_us)
+{
+  auto dev_id = device_query<query::pcie_device>(dev);
+  std::atomic<bool> stop{false};
+  std::atomic<bool> done{false};
+  perf_samples high_alone, low_alone, high_busy, low_busy;
+
+  device_update<query::preemption>(dev, force);
+
+  auto low = preempt_bench_ctx_init(dev, preempt_bench_prio_low, qdepth);
+  auto high = preempt_bench_ctx_init(dev, preempt_bench_prio_high, 1);
+
+  // Baselines, each context has the device to itself
+  if (perf_bench.warmup > 0) {
+    perf_samples discard;
+    preempt_bench_probe(*high, perf_bench.warmup, 0, discard);
+  }
+  preempt_bench_probe(*high, probes, 0, high_alone);
+  auto low_start = clk::now();
+  preempt_bench_flood(*low, stop, probes * qdepth, low_alone);
+  double low_alone_us = std::chrono::duration<double, std::micro>(clk::now() - low_start).count();
+  double low_alone_per_cmd = low_alone_us / low_alone.size();
+
+  // High priority probes against a device kept busy by the low priority context
+  auto preempt_start = preempt_bench_preemptions(dev, *low);
+  std::exception_ptr err;
+  uint64_t low_cmds = 0;
+  low_start = clk::now();
+  std::thread flooder([&] {
+    try {
+      low_cmds = preempt_bench_flood(*low, stop, UINT64_MAX, low_busy);
+    } catch (...) {
+      err = std::current_exception();
+    }
+    done = true;
+  });
+  // Let the low priority queue fill up first
+  while (!done && low_busy.size() < static_cast<size_t>(qdepth))
+    std::this_thread::yield();
+  try {
+    preempt_bench_probe(*high, probes, gap_us, high_busy);
+  } catch (...) {
+    err = std::current_exception();
+  }
+  stop = true;
+  flooder.join();
+  double low_busy_us = std::chrono::duration<double, std::micro>(clk::now() - low_start).count();
+  if (err)
+    std::rethrow_exception(err);
+  auto preemptions = preempt_bench_preemptions(dev, *low) - preempt_start;
+
+  // Device time the low priority context lost beyond what the probes used
+  // themselves, spread over the preemptions, is the save and restore cost
+  double lost_us = low_busy_us - low_cmds * low_alone_per_cmd - probes * preempt_bench_avg(high_alone);
+  double per_preempt_us = preemptions ? std::max(lost_us, 0.0) / preemptions : 0;
+
+  perf_metrics m = { {"device", static_cast<double>(dev_id)}, {"force_preempt", static_cast<double>(force)} };
+  high_alone.report("preempt-high-alone", m);
+  low_alone.report("preempt-low-alone", m);
+
+  auto mb = m;
+  mb.push_back({"added_avg_us", std::max(preempt_bench_avg(high_busy) - preempt_bench_avg(high_alone), 0.0)});
+  high_busy.report("preempt-high-busy", mb);
+
+  auto ml = m;
+  ml.push_back({"preemptions", static_cast<double>(preemptions)});
+  ml.push_back({"save_restore_us", per_preempt_us});
+  low_busy.report("preempt-low-busy", ml);
+}
+
+}
+
+void
+TEST_preempt_bench(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto probes = static_cast<int>(arg[0]);
+  auto qdepth = static_cast<int>(arg[1]);
+  auto gap_us = static_cast<int>(arg[2]);
+  auto dev = sdev.get();
+  preempt_bench_force_restore restore{ dev, device_query<query::preemption>(dev) };
+
+  for (int r = 0; r < std::max(perf_bench.repeat, 1); r++) {
+    // Firmware default first, then preemption at every layer boundary
+    for (uint32_t force : { 0u, 1u })
+      preempt_bench_run(dev, force, probes, qdepth, gap_us);
+  }
+}
@@ -37,6 +37,7 @@ struct kern_version {
 kern_version current_kern;
 std::string cur_path;
 std::string xclbin_path;
+perf_bench_parameter perf_bench = { 0, 1, PERF_OUTPUT_TEXT };
 int base_write_speed;
 int base_read_speed;
 
@@ -48,7 +49,16 @@ void TEST_io_latency(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_io_throughput(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_io_runlist_latency(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_io_runlist_throughput(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_scaling(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_runlist_sweep(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_bo_lifecycle_bench(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_preempt_bench(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_power_sweep(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_noop_io_with_dup_bo(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_io_resident_args(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_cmd_graph(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_stream_q(device::id_type, std::shared_ptr<device>, arg_type&);
+void TEST_seq_page(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_vadd(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_memtiles(device::id_type, std::shared_ptr<device>, arg_type&);
 void TEST_shim_umq_ddr_memtile(device::id_type, std::shared_ptr<device>, arg_type&);
@@ -73,6 +83,9 @@ usage(const std::string& prog)
   std::cout << "Options:\n";
   std::cout << "\t" << "-h" << ": print this help message\n";
   std::cout << "\t" << "-k" << ": evaluate test result based on kernel version\n";
+  std::cout << "\t" << "-o <text|csv|json>" << ": output format of perf test latency percentiles\n";
+  std::cout << "\t" << "-r <repeat>" << ": number of measured runs per perf test configuration\n";
+  std::cout << "\t" << "-w <warmup>" << ": number of un-recorded commands before each perf test run\n";
   std::cout << "\t" << "-x <xclbin_path>" << ": run test cases with specified xclbin file\n";
   std::cout << std::endl;
 }
@@ -379,6 +392,41 @@ TEST_create_free_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type&
     get_and_show_bo_properties(dev, bo->get());
 }
 
+// Only meaningful with Debug.bo_suballoc, small BOs share slabs then
+void
+TEST_suballoc_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
+{
+  auto dev = sdev.get();
+  auto size = static_cast<size_t>(arg[0]);
+  bo a{dev, size, XCL_BO_FLAGS_HOST_ONLY};
+  bo b{dev, size, XCL_BO_FLAGS_HOST_ONLY};
+  bo c{dev, size, XCL_BO_FLAGS_CACHEABLE};
+  auto pa = a.get()->get_properties();
+  auto pb = b.get()->get_properties();
+  auto pc = c.get()->get_properties();
+
+  if (pa.kmhdl != pb.kmhdl) {
+    std::cout << "	BO sub-allocation is off, skipping" << std::endl;
+    return;
+  }
+  if (pc.kmhdl == pa.kmhdl)
+    throw std::runtime_error("BOs of different flags share a slab");
+  if (pa.size != size || pb.size != size)
+    throw std::runtime_error("Sub-allocated BO size is not the requested one");
+  auto lo = std::min(pa.paddr, pb.paddr);
+  auto hi = std::max(pa.paddr, pb.paddr);
+  if (hi - lo < size)
+    throw std::runtime_error("Sub-allocated BOs overlap");
+
+  std::memset(a.map(), 0x5a, size);
+  std::memset(b.map(), 0xa5, size);
+  a.get()->sync(buffer_handle::direction::host2device, size, 0);
+  b.get()->sync(buffer_handle::direction::host2device, size, 0);
+  a.get()->sync(buffer_handle::direction::device2host, size, 0);
+  if (std::memcmp(a.map(), std::string(size, 0x5a).c_str(), size) != 0)
+    throw std::runtime_error("Sub-allocated BO content is clobbered by its neighbor");
+}
+
 void
 TEST_sync_bo(device::id_type id, std::shared_ptr<device> sdev, arg_type& arg)
 {
@@ -729,9 +777,54 @@ std::vector<test_case> test_list {
   test_case{ "Multi context IO test 4 (npu4)", {},
     TEST_POSITIVE, skip_dev_filter, TEST_multi_context_io_test, { 20 }
   },
+  // Args: run type, wait type, commands per context, max contexts, threads, processes, queue depth
+  test_case{ "measure no-op kernel multi-context scaling (npu1)", {},
+    TEST_POSITIVE, dev_filter_is_npu1, TEST_io_scaling, { IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, 2000, 6, 2, 2, 4 }
+  },
+  test_case{ "measure no-op kernel multi-context scaling (npu4)", {},
+    TEST_POSITIVE, dev_filter_is_npu4, TEST_io_scaling, { IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, 2000, 32, 2, 2, 4 }
+  },
+  // Args: run type, wait type, total commands, max commands per list, max runlists
+  test_case{ "measure no-op kernel runlist sweep", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_runlist_sweep, { IO_TEST_NOOP_RUN, IO_TEST_IOCTL_WAIT, 32000, 24, 8 }
+  },
+  // Args: max BO size, iterations per size, threads
+  test_case{ "measure bo lifecycle", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_bo_lifecycle_bench, { 0x40000000, 64, 1 }
+  },
+  test_case{ "measure bo lifecycle (multi-threaded)", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_bo_lifecycle_bench, { 0x40000000, 64, 4 }
+  },
+  // Args: high priority probes, low priority queue depth, gap between probes in us
+  test_case{ "measure preemption latency and cost", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_preempt_bench, { 200, 4, 1000 }
+  },
+  // Args: commands per power mode, queue depth
+  test_case{ "measure perf per watt across power modes", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_power_sweep, { 2000, 4 }
+  },
   test_case{ "Create and destroy devices", {},
     TEST_POSITIVE, dev_filter_is_aie2, TEST_create_destroy_device, {}
   },
+  test_case{ "create sub-allocated bos of different flags", {},
+    TEST_POSITIVE, dev_filter_xdna, TEST_suballoc_bo, {0x1000}
+  },
+  // Args: number of submissions of the same cmd BO
+  test_case{ "io test with resident arg BOs", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_io_resident_args, { 32 }
+  },
+  // Args: number of graph submissions
+  test_case{ "submit command graph across contexts", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_cmd_graph, { 8 }
+  },
+  // Args: number of slots, number of submissions
+  test_case{ "stream commands through rotating slots", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_stream_q, { 3, 32 }
+  },
+  // Args: number of submissions
+  test_case{ "completion page advances with commands", {},
+    TEST_POSITIVE, dev_filter_is_aie2, TEST_seq_page, { 16 }
+  },
 };
 
 // Test case executor implementation
@@ -882,7 +975,7 @@ main(int argc, char **argv)
   std::string program = std::filesystem::path(argv[0]).filename();
 
   int option;
-  while ((option = getopt(argc, argv, ":hx:k")) != -1) {
+  while ((option = getopt(argc, argv, ":hx:ko:r:w:")) != -1) {
     switch (option) {
     case 'h':
       usage(program);
@@ -905,6 +998,40 @@ main(int argc, char **argv)
         << current_kern.major << "." << current_kern.minor << std::endl;
       break;
     }
+    case 'o': {
+      std::string fmt(optarg);
+      if (fmt == "text") {
+        perf_bench.output = PERF_OUTPUT_TEXT;
+      } else if (fmt == "csv") {
+        perf_bench.output = PERF_OUTPUT_CSV;
+      } else if (fmt == "json") {
+        perf_bench.output = PERF_OUTPUT_JSON;
+      } else {
+        std::cout << "Unknown output format: " << fmt << std::endl;
+        return 1;
+      }
+      break;
+    }
+    case 'r':
+    case 'w': {
+      int val;
+      try {
+        val = std::stoi(optarg);
+      }
+      catch (...) {
+        val = -1;
+      }
+      if (val < 0 || (option == 'r' && val == 0)) {
+        std::cout << "Invalid value for option -" << static_cast<char>(option)
+          << ": " << optarg << std::endl;
+        return 1;
+      }
+      if (option == 'r')
+        perf_bench.repeat = val;
+      else
+        perf_bench.warmup = val;
+      break;
+    }
     case '?':
       std::cout << "Unknown option: " << static_cast<char>(optopt) << std::endl;;
       return 1;
@@ -4,7 +4,14 @@
 #ifndef _SHIMTEST_SPEED_H_
 #define _SHIMTEST_SPEED_H_
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 using clk = std::chrono::high_resolution_clock;
 using ms_t = std::chrono::milliseconds;
@@ -29,4 +36,133 @@ get_speed_and_print(std::string prefix, size_t size, clk::time_point &start, clk
   return speed;
 }
 
+// Global benchmark configurations for all perf test cases, set from command line
+struct perf_bench_parameter {
+  int warmup;   // un-recorded iterations before each measured run
+  int repeat;   // measured runs per test configuration
+#define PERF_OUTPUT_TEXT      0
+#define PERF_OUTPUT_CSV       1
+#define PERF_OUTPUT_JSON      2
+  int output;
+};
+extern perf_bench_parameter perf_bench;
+
+// Extra per-report metrics, e.g. throughput, printed in front of the percentiles
+using perf_metrics = std::vector<std::pair<std::string, double>>;
+
+// Per-iteration latency samples, reported as percentiles instead of an average
+class perf_samples {
+public:
+  perf_samples() = default;
+
+  explicit perf_samples(std::vector<double> us) : m_us(std::move(us))
+  {}
+
+  const std::vector<double>&
+  us() const
+  {
+    return m_us;
+  }
+
+  void
+  reserve(size_t n)
+  {
+    m_us.reserve(n);
+  }
+
+  void
+  add(const clk::time_point& start, const clk::time_point& end)
+  {
+    m_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+  }
+
+  void
+  append(const perf_samples& other)
+  {
+    m_us.insert(m_us.end(), other.m_us.begin(), other.m_us.end());
+  }
+
+  size_t
+  size() const
+  {
+    return m_us.size();
+  }
+
+  void
+  report(const std::string& label, const perf_metrics& extra = {}) const
+  {
+    if (m_us.empty())
+      return;
+
+    auto sorted = m_us;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (auto v : sorted)
+      sum += v;
+
+    const double avg = sum / sorted.size();
+    const double p50 = percentile(sorted, 50);
+    const double p90 = percentile(sorted, 90);
+    const double p99 = percentile(sorted, 99);
+    const double p999 = percentile(sorted, 99.9);
+    const double max = sorted.back();
+
+    std::ios_base::fmtflags f(std::cout.flags());
+    auto prec = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(3);
+
+    switch (perf_bench.output) {
+    case PERF_OUTPUT_CSV: {
+      // Header is repeated whenever the set of columns changes
+      static std::string last_header;
+      std::string header = "label,";
+      for (auto& m : extra)
+        header += m.first + ",";
+      header += "samples,avg_us,p50_us,p90_us,p99_us,p99.9_us,max_us";
+      if (header != last_header) {
+        std::cout << header << std::endl;
+        last_header = header;
+      }
+      std::cout << label << ",";
+      for (auto& m : extra)
+        std::cout << m.second << ",";
+      std::cout << sorted.size() << "," << avg << "," << p50 << ","
+                << p90 << "," << p99 << "," << p999 << "," << max << std::endl;
+      break;
+    }
+    case PERF_OUTPUT_JSON:
+      std::cout << "{\"label\": \"" << label << "\"";
+      for (auto& m : extra)
+        std::cout << ", \"" << m.first << "\": " << m.second;
+      std::cout << ", \"samples\": " << sorted.size()
+                << ", \"avg_us\": " << avg << ", \"p50_us\": " << p50
+                << ", \"p90_us\": " << p90 << ", \"p99_us\": " << p99
+                << ", \"p99.9_us\": " << p999 << ", \"max_us\": " << max << "}" << std::endl;
+      break;
+    default:
+      std::cout << "\t" << label << ":";
+      for (auto& m : extra)
+        std::cout << " " << m.first << " " << m.second;
+      std::cout << " " << sorted.size() << " samples, latency (us)"
+                << " avg " << avg << " p50 " << p50 << " p90 " << p90 << " p99 " << p99
+                << " p99.9 " << p999 << " max " << max << std::endl;
+      break;
+    }
+
+    std::cout.precision(prec);
+    std::cout.flags(f);
+  }
+
+private:
+  // Nearest-rank percentile, samples must be sorted
+  static double
+  percentile(const std::vector<double>& sorted, double p)
+  {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+  }
+
+  std::vector<double> m_us;
+};
+
 #endif // _SHIMTEST_SPEED_H_
@@ -19,6 +19,8 @@
 #include <vector>
 #include <chrono>
 #include <regex>
+#include <thread>
+#include <sys/resource.h>
 
 namespace {
 
@@ -424,6 +426,114 @@ TEST_xrt_stress_hwctx(int device_index, arg_type& arg)
   }
 }
 
+double
+cpu_time_us()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec + ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+}
+
+/* One worker per hwctx, each runs iters runlists of batch nop commands */
+void
+run_mq_throughput(xrt::device& device, xrt::uuid& uuid, xrt::module& mod,
+  unsigned nctx, unsigned iters, unsigned batch)
+{
+  std::vector<xrt::hw_context> hwctxs;
+  std::vector<std::vector<double>> lat_us(nctx);
+  std::vector<std::exception_ptr> errs(nctx);
+  std::vector<std::thread> workers;
+
+  for (unsigned i = 0; i < nctx; i++)
+    hwctxs.emplace_back(device, uuid);
+
+  auto cpu_start = cpu_time_us();
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned i = 0; i < nctx; i++) {
+    workers.emplace_back([&, i] {
+      try {
+        xrt::kernel kernel = xrt::ext::kernel{hwctxs[i], mod, "dpu:{nop}"};
+        std::vector<xrt::run> runs;
+        for (unsigned j = 0; j < batch; j++)
+          runs.emplace_back(kernel);
+        xrt::runlist rl{hwctxs[i]};
+        for (auto& run : runs)
+          rl.add(run);
+
+        for (unsigned j = 0; j < iters; j++) {
+          auto s = std::chrono::high_resolution_clock::now();
+          rl.execute();
+          if (rl.wait(std::chrono::milliseconds(600000)) == std::cv_status::timeout)
+            throw std::runtime_error(std::string("runlist timed out."));
+          auto e = std::chrono::high_resolution_clock::now();
+          lat_us[i].push_back(std::chrono::duration_cast<std::chrono::microseconds>(e - s).count());
+        }
+      } catch (...) {
+        errs[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+  auto end = std::chrono::high_resolution_clock::now();
+  auto cpu_us = cpu_time_us() - cpu_start;
+
+  for (auto& e : errs) {
+    if (e)
+      std::rethrow_exception(e);
+  }
+
+  auto total_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  double ops = static_cast<double>(nctx) * iters * batch;
+  std::cout << nctx << " hwctx: " << ops * 1000000 / total_us << " ops/sec, "
+    << cpu_us / ops << " us CPU/op" << std::endl;
+  for (unsigned i = 0; i < nctx; i++) {
+    auto& l = lat_us[i];
+    std::sort(l.begin(), l.end());
+    auto pct = [&l](double p) { return l[static_cast<size_t>(p * (l.size() - 1))]; };
+    std::cout << "\thwctx " << i << " runlist of " << batch << " latency(us): p50 " << pct(0.5)
+      << ", p90 " << pct(0.9) << ", p99 " << pct(0.99) << ", max " << l.back() << std::endl;
+  }
+}
+
+/* Throughput of 1, 2, 4, ... concurrent hwctx till arg[0] or device limit */
+void
+TEST_xrt_throughput_mq(int device_index, arg_type& arg)
+{
+  auto device = xrt::device{device_index};
+  unsigned max_ctx = static_cast<unsigned>(arg[0]);
+  unsigned iters = static_cast<unsigned>(arg[1]);
+  unsigned batch = static_cast<unsigned>(arg[2]);
+
+  auto xclbin = xrt::xclbin(
+    xclbinpath.empty() ? local_path("npu3_workspace/nop.xclbin") : xclbinpath);
+  auto uuid = device.register_xclbin(xclbin);
+
+  xrt::elf elf{local_path("npu3_workspace/nop.elf")};
+  xrt::module mod{elf};
+
+  // Probe how many hwctx the device takes
+  unsigned limit = 0;
+  {
+    std::vector<xrt::hw_context> probe;
+    try {
+      while (probe.size() < max_ctx)
+        probe.emplace_back(device, uuid);
+    } catch (const std::exception& ex) {
+      std::cout << "hwctx limit reached: " << ex.what() << std::endl;
+    }
+    limit = probe.size();
+  }
+  if (!limit)
+    throw std::runtime_error("can't create any hwctx");
+
+  for (unsigned n = 1; ; n = std::min(n * 2, limit)) {
+    run_mq_throughput(device, uuid, mod, n, iters, batch);
+    if (n == limit)
+      break;
+  }
+}
+
 // List of all test cases
 std::vector<test_case> test_list {
   test_case{ "npu3 xrt vadd", TEST_xrt_umq_vadd, {} },
@@ -434,6 +544,7 @@ std::vector<test_case> test_list {
   test_case{ "npu3 xrt df_bw", TEST_xrt_umq_df_bw, {} },
   test_case{ "npu3 xrt stress - start", TEST_xrt_stress_start, {32} },
   test_case{ "npu3 xrt stress - hwctx", TEST_xrt_stress_hwctx, {2} }, //upto 2 now
+  test_case{ "npu3 xrt throughput - multi hwctx", TEST_xrt_throughput_mq, {16, 200, 8} },
 };
 
 }